@@ -12,9 +12,14 @@
 #include <wangle/acceptor/ManagedConnection.h>
 #include <wangle/ssl/SSLContextManager.h>
 #include <wangle/acceptor/AcceptorHandshakeManager.h>
+#include <wangle/acceptor/ProxyProtocol.h>
 #include <wangle/acceptor/SSLAcceptorHandshakeHelper.h>
+#include <wangle/concurrent/EventBaseMetrics.h>
 
+#include <algorithm>
 #include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <folly/ScopeGuard.h>
 #include <folly/io/async/EventBase.h>
 #include <fstream>
@@ -63,6 +68,7 @@ Acceptor::init(AsyncServerSocket* serverSocket,
         "vip_" + getName(),
         accConfig_.strictSSL, stats);
     }
+    sslCtxManager_->setMaxLazySSLContexts(accConfig_.maxLazySSLContexts);
     for (const auto& sslCtxConfig : accConfig_.sslContextConfigs) {
       sslCtxManager_->addSSLContextConfig(
         sslCtxConfig,
@@ -80,6 +86,19 @@ Acceptor::init(AsyncServerSocket* serverSocket,
   state_ = State::kRunning;
   downstreamConnectionManager_ = ConnectionManager::makeUnique(
     eventBase, accConfig_.connectionIdleTimeout, this);
+  downstreamConnectionManager_->setDrainDuration(
+      accConfig_.gracefulDrainDuration);
+  if (accConfig_.bufferLimitShedBatchSize > 0) {
+    downstreamConnectionManager_->setBufferLimitShedding(
+        accConfig_.bufferLimitCheckInterval,
+        accConfig_.bufferLimitShedBatchSize);
+  }
+  if (accConfig_.adaptiveIdleMinTimeout > std::chrono::milliseconds(0)) {
+    downstreamConnectionManager_->setAdaptiveIdleTimeout(
+        accConfig_.adaptiveIdleCheckInterval,
+        accConfig_.adaptiveIdleMinTimeout,
+        [this] { return getIdlePressure(); });
+  }
 
   if (serverSocket) {
     serverSocket->addAcceptCallback(this, eventBase);
@@ -88,6 +107,13 @@ Acceptor::init(AsyncServerSocket* serverSocket,
       if (fd < 0) {
         continue;
       }
+      // For the TCP_INFO backlog samples
+      sockaddr_storage addr;
+      socklen_t len = sizeof(addr);
+      if (getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) == 0 &&
+          addr.ss_family != AF_UNIX) {
+        listenFds_.push_back(fd);
+      }
       for (const auto& opt: socketOptions_) {
         opt.first.apply(fd, opt.second);
       }
@@ -120,7 +146,51 @@ void Acceptor::setLoadShedConfig(const LoadShedConfiguration& from,
   connectionCounter_ = counter;
 }
 
+uint64_t Acceptor::getCountedConnections() {
+  if (!cacheConnectionCount_ || !base_) {
+    return connectionCounter_->getNumConnections();
+  }
+  if (!connectionCountCache_.valid) {
+    connectionCountCache_.count = connectionCounter_->getNumConnections();
+    connectionCountCache_.valid = true;
+    base_->runInLoop(&connectionCountCache_);
+  }
+  return connectionCountCache_.count;
+}
+
+double Acceptor::getIdlePressure() {
+  double pressure = 0;
+  if (loadSampler_) {
+    pressure = ConnectionManager::pressureBetween(
+        loadSampler_->getMemUsage(),
+        accConfig_.adaptiveIdleMemUsage,
+        loadShedConfig_.getMaxMemUsage());
+  }
+  if (connectionCounter_ && connectionCounter_->getMaxConnections() > 0) {
+    const double maxConnections = connectionCounter_->getMaxConnections();
+    pressure = std::max(pressure, ConnectionManager::pressureBetween(
+        getCountedConnections(), maxConnections / 2, maxConnections));
+  }
+  return pressure;
+}
+
 bool Acceptor::canAccept(const SocketAddress& address) {
+  if (loadSampler_) {
+    const bool memOverloaded = loadSampler_->isMemOverloaded(loadShedConfig_);
+    if ((memOverloaded || loadSampler_->isCpuOverloaded(loadShedConfig_)) &&
+        !loadShedConfig_.isWhitelisted(address)) {
+      if (memOverloaded && downstreamConnectionManager_) {
+        downstreamConnectionManager_->dropIdleConnections(1);
+      }
+      VLOG(4) << address.describe() << " refused, system overloaded";
+      if (acceptorStats_) {
+        acceptorStats_->recordConnectionRejected(
+          AcceptRejectReason::SYSTEM_OVERLOADED);
+      }
+      return false;
+    }
+  }
+
   if (!connectionCounter_) {
     return true;
   }
@@ -130,7 +200,7 @@ bool Acceptor::canAccept(const SocketAddress& address) {
     return true;
   }
 
-  uint64_t currentConnections = connectionCounter_->getNumConnections();
+  uint64_t currentConnections = getCountedConnections();
   if (currentConnections < maxConnections) {
     return true;
   }
@@ -152,12 +222,53 @@ bool Acceptor::canAccept(const SocketAddress& address) {
   }
 
   VLOG(4) << address.describe() << " not whitelisted";
+  if (acceptorStats_) {
+    acceptorStats_->recordConnectionRejected(
+      AcceptRejectReason::MAX_CONNECTIONS);
+  }
   return false;
 }
 
 void
 Acceptor::connectionAccepted(
     int fd, const SocketAddress& clientAddr) noexcept {
+  auto acceptTime = std::chrono::steady_clock::now();
+  if (acceptorStats_) {
+    acceptorStats_->recordConnectionAccepted();
+    if (acceptTime - lastBacklogSample_ >= std::chrono::seconds(1)) {
+      lastBacklogSample_ = acceptTime;
+      sampleAcceptBacklog();
+    }
+  }
+  if (accConfig_.proxyProtocol) {
+    // Shedding waits for the client address the header carries
+    auto reader = new ProxyHeaderReader(this, base_, fd, clientAddr,
+                                        acceptTime);
+    reader->start(downstreamConnectionManager_.get(),
+                  accConfig_.proxyProtocolTimeout);
+    return;
+  }
+  acceptConnection(fd, clientAddr, acceptTime);
+}
+
+void Acceptor::proxyHeaderReceived(
+    int fd,
+    const SocketAddress& proxyAddr,
+    const ProxyHeader& header,
+    std::chrono::steady_clock::time_point acceptTime) noexcept {
+  if (!header.hasAddresses) {
+    acceptConnection(fd, proxyAddr, acceptTime);
+    return;
+  }
+  proxyAddr_ = std::make_shared<SocketAddress>(proxyAddr);
+  acceptConnection(fd, header.source, acceptTime);
+  proxyAddr_.reset();
+}
+
+void Acceptor::acceptConnection(
+    int fd,
+    const SocketAddress& clientAddr,
+    std::chrono::steady_clock::time_point acceptTime) noexcept {
   if (!canAccept(clientAddr)) {
     // Send a RST to free kernel memory faster
     struct linger optLinger = {1, 0};
@@ -165,7 +276,6 @@ Acceptor::connectionAccepted(
     close(fd);
     return;
   }
-  auto acceptTime = std::chrono::steady_clock::now();
   for (const auto& opt: socketOptions_) {
     opt.first.apply(fd, opt.second);
   }
@@ -173,6 +283,20 @@ Acceptor::connectionAccepted(
   onDoneAcceptingConnection(fd, clientAddr, acceptTime);
 }
 
+void Acceptor::sampleAcceptBacklog() {
+#ifdef __linux__
+  for (auto fd : listenFds_) {
+    // For a listening socket, the accept queue length and its limit
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0 &&
+        info.tcpi_state == TCP_LISTEN) {
+      acceptorStats_->recordAcceptBacklog(info.tcpi_unacked, info.tcpi_sacked);
+    }
+  }
+#endif
+}
+
 void Acceptor::onDoneAcceptingConnection(
     int fd,
     const SocketAddress& clientAddr,
@@ -187,6 +311,15 @@ Acceptor::processEstablishedConnection(
     const SocketAddress& clientAddr,
     std::chrono::steady_clock::time_point acceptTime,
     TransportInfo& tinfo) noexcept {
+  if (proxyAddr_ && !tinfo.clientAddrOriginal) {
+    tinfo.clientAddrOriginal = proxyAddr_;
+  }
+  if (socketTuningPolicy_) {
+    for (const auto& opt:
+           socketTuningPolicy_->getAcceptOptions(clientAddr, tinfo)) {
+      opt.first.apply(fd, opt.second);
+    }
+  }
   if (accConfig_.isSSL()) {
     CHECK(sslCtxManager_);
     AsyncSSLSocket::UniquePtr sslSock(
@@ -194,12 +327,19 @@ Acceptor::processEstablishedConnection(
         sslCtxManager_->getDefaultSSLCtx(), base_, fd));
     ++numPendingSSLConns_;
     ++totalNumPendingSSLConns_;
+    if (auto metrics = EventBaseMetrics::local()) {
+      metrics->addHandshakes(1);
+    }
     if (totalNumPendingSSLConns_ > accConfig_.maxConcurrentSSLHandshakes) {
       VLOG(2) << "dropped SSL handshake on " << accConfig_.name <<
         " too many handshakes in progress";
       auto error = SSLErrorEnum::DROPPED;
       auto latency = std::chrono::milliseconds(0);
       updateSSLStats(sslSock.get(), latency, error);
+      if (acceptorStats_) {
+        acceptorStats_->recordConnectionRejected(
+          AcceptRejectReason::MAX_SSL_HANDSHAKES);
+      }
       auto ex = folly::make_exception_wrapper<SSLException>(
           error, latency, sslSock->getRawBytesReceived());
       sslConnectionError(ex);
@@ -252,7 +392,16 @@ Acceptor::connectionReady(
   // writing client from starving other connections.
   auto asyncSocket = sock->getUnderlyingTransport<AsyncSocket>();
   asyncSocket->setMaxReadsPerEvent(16);
-  tinfo.initWithSocket(asyncSocket);
+  // No TCP_INFO for Unix domain sockets
+  if (clientAddr.getFamily() != AF_UNIX) {
+    tinfo.initWithSocket(asyncSocket);
+  }
+  if (socketTuningPolicy_) {
+    for (const auto& opt: socketTuningPolicy_->getEstablishedOptions(
+           tinfo, secureTransportType, nextProtocolName)) {
+      opt.first.apply(asyncSocket->getFd(), opt.second);
+    }
+  }
   onNewConnection(
       std::move(sock),
       &clientAddr,
@@ -276,6 +425,9 @@ Acceptor::sslConnectionReady(AsyncTransportWrapper::UniquePtr sock,
       tinfo);
   --numPendingSSLConns_;
   --totalNumPendingSSLConns_;
+  if (auto metrics = EventBaseMetrics::local()) {
+    metrics->addHandshakes(-1);
+  }
   if (state_ == State::kDraining) {
     checkDrained();
   }
@@ -285,6 +437,9 @@ void Acceptor::sslConnectionError(const folly::exception_wrapper& ex) {
   CHECK(numPendingSSLConns_ > 0);
   --numPendingSSLConns_;
   --totalNumPendingSSLConns_;
+  if (auto metrics = EventBaseMetrics::local()) {
+    metrics->addHandshakes(-1);
+  }
   if (state_ == State::kDraining) {
     checkDrained();
   }
@@ -297,6 +452,9 @@ Acceptor::acceptError(const std::exception& ex) noexcept {
   // briefly if we are out of FDs, then continue accepting later.
   // Just log a message here.
   LOG(ERROR) << "error accepting on acceptor socket: " << ex.what();
+  if (acceptorStats_) {
+    acceptorStats_->recordAcceptError();
+  }
 }
 
 void
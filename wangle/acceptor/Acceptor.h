@@ -10,12 +10,16 @@
 #pragma once
 
 #include <wangle/acceptor/ServerSocketConfig.h>
+#include <wangle/acceptor/AcceptorStats.h>
 #include <wangle/acceptor/ConnectionCounter.h>
 #include <wangle/acceptor/ConnectionManager.h>
 #include <wangle/acceptor/LoadShedConfiguration.h>
 #include <wangle/acceptor/SecureTransportType.h>
+#include <wangle/acceptor/SocketTuningPolicy.h>
+#include <wangle/acceptor/SystemLoadSampler.h>
 #include <wangle/ssl/SSLCacheProvider.h>
 #include <wangle/acceptor/TransportInfo.h>
+#include <wangle/concurrent/IOExecutor.h>
 #include <wangle/ssl/SSLStats.h>
 
 #include <chrono>
@@ -24,13 +28,22 @@
 #include <folly/io/async/AsyncSSLSocket.h>
 #include <folly/io/async/AsyncServerSocket.h>
 #include <folly/io/async/AsyncUDPServerSocket.h>
+#include <vector>
 
 namespace wangle {
 
 class AsyncTransport;
 class ManagedConnection;
+struct ProxyHeader;
 class SSLContextManager;
 
+// A datagram received by a BatchedUDPServerSocket, or one to send with it
+struct UDPDatagram {
+  std::unique_ptr<folly::IOBuf> buf;
+  folly::SocketAddress address;
+  bool truncated{false};
+};
+
 /**
  * An abstract acceptor for TCP-based network services.
  *
@@ -227,6 +240,19 @@ class Acceptor :
    */
   virtual void sslConnectionError(const folly::exception_wrapper& ex);
 
+  /**
+   * The datagrams one read of a BatchedUDPServerSocket returned. By default
+   * handed to onDataAvailable() one at a time.
+   */
+  virtual void onDataBatchAvailable(
+      std::shared_ptr<folly::AsyncUDPSocket> socket,
+      std::vector<UDPDatagram> datagrams) noexcept {
+    for (auto& datagram : datagrams) {
+      onDataAvailable(socket, datagram.address, std::move(datagram.buf),
+                      datagram.truncated);
+    }
+  }
+
   /**
    * Hook for subclasses to record stats about SSL connection establishment.
    */
@@ -236,10 +262,37 @@ class Acceptor :
       SSLErrorEnum /*error*/,
       SecureTransportType /*type*/ = SecureTransportType::TLS) noexcept {}
 
+  /**
+   * Record connection establishment stats to stats, which must outlive the
+   * acceptor; nullptr, the default, records none.
+   */
+  void setAcceptorStats(AcceptorStats* stats) {
+    acceptorStats_ = stats;
+  }
+  AcceptorStats* getAcceptorStats() const {
+    return acceptorStats_;
+  }
+
   bool getParseClientHello() {
     return parseClientHello_;
   }
 
+  /**
+   * Run SSL handshakes, and so their private key operations, on an
+   * EventBase of executor rather than on this acceptor's thread, so a burst
+   * of handshakes doesn't stall the connections already established. The
+   * socket moves back to this acceptor's thread once the handshake is over.
+   * Handshakes still count against maxConcurrentSSLHandshakes, and the
+   * acceptor's EventBase must outlive those in progress. nullptr, the
+   * default, runs them on this acceptor's thread.
+   */
+  void setSSLHandshakeExecutor(std::shared_ptr<IOExecutor> executor) {
+    sslHandshakeExecutor_ = std::move(executor);
+  }
+  const std::shared_ptr<IOExecutor>& getSSLHandshakeExecutor() const {
+    return sslHandshakeExecutor_;
+  }
+
  protected:
 
   /**
@@ -260,6 +313,14 @@ class Acceptor :
    */
   virtual bool canAccept(const folly::SocketAddress&);
 
+  /**
+   * The pressure, between 0 and 1, the idle timeout shrinks with when
+   * ServerSocketConfig::adaptiveIdleMinTimeout is set: from the load
+   * sampler's memory use and the connection counter's connections, as
+   * described there.
+   */
+  virtual double getIdlePressure();
+
   /**
    * Invoked when a new connection is created. This is where application starts
    * processing a new downstream connection.
@@ -354,6 +415,34 @@ class Acceptor :
   void setLoadShedConfig(const LoadShedConfiguration& from,
                          IConnectionCounter* counter);
 
+  /**
+   * Have canAccept() read the connection counter at most once per loop
+   * iteration, for counters that are costly to read, such as a
+   * ShardedConnectionCounter. The limit can then be exceeded by the
+   * connections accepted within one iteration.
+   */
+  void setConnectionCountCached(bool cached) {
+    cacheConnectionCount_ = cached;
+  }
+
+  /**
+   * Refuse connections from addresses that aren't whitelisted while the
+   * sampler finds the CPU or memory use above the thresholds of the load
+   * shed configuration, such as SystemLoadSampler::get(). While memory is
+   * short, an idle connection is also dropped for each refused one.
+   */
+  void setLoadSampler(std::shared_ptr<SystemLoadSampler> sampler) {
+    loadSampler_ = std::move(sampler);
+  }
+
+  /**
+   * Pick socket options per connection, on top of socketOptions_.
+   * nullptr, the default, only applies socketOptions_.
+   */
+  void setSocketTuningPolicy(std::shared_ptr<SocketTuningPolicy> policy) {
+    socketTuningPolicy_ = std::move(policy);
+  }
+
   /**
    * Socket options to apply to the client socket
    */
@@ -377,6 +466,38 @@ class Acceptor :
 
   void checkDrained();
 
+  void sampleAcceptBacklog();
+
+  friend class ProxyHeaderReader;
+
+  // The rest of connectionAccepted(), once the client address is known
+  void acceptConnection(
+      int fd,
+      const folly::SocketAddress& clientAddr,
+      std::chrono::steady_clock::time_point acceptTime) noexcept;
+
+  // From the ProxyHeaderReader of a connection, with the header read off
+  void proxyHeaderReceived(
+      int fd,
+      const folly::SocketAddress& proxyAddr,
+      const ProxyHeader& header,
+      std::chrono::steady_clock::time_point acceptTime) noexcept;
+
+  // The connection counter's count, read at most once per loop iteration if
+  // cacheConnectionCount_
+  uint64_t getCountedConnections();
+
+  // Invalidated at the end of the loop iteration that filled it
+  class ConnectionCountCache : public folly::EventBase::LoopCallback {
+   public:
+    void runLoopCallback() noexcept override {
+      valid = false;
+    }
+
+    bool valid{false};
+    uint64_t count{0};
+  };
+
   State state_{State::kInit};
   uint64_t numPendingSSLConns_{0};
 
@@ -385,6 +506,17 @@ class Acceptor :
   bool forceShutdownInProgress_{false};
   LoadShedConfiguration loadShedConfig_;
   IConnectionCounter* connectionCounter_{nullptr};
+  bool cacheConnectionCount_{false};
+  ConnectionCountCache connectionCountCache_;
+  std::shared_ptr<SystemLoadSampler> loadSampler_;
+  std::shared_ptr<SocketTuningPolicy> socketTuningPolicy_;
+  AcceptorStats* acceptorStats_{nullptr};
+  std::vector<int> listenFds_;
+  std::chrono::steady_clock::time_point lastBacklogSample_;
+  std::shared_ptr<IOExecutor> sslHandshakeExecutor_;
+  // The load balancer's address while accepting a connection that came
+  // with a PROXY header, for processEstablishedConnection()
+  std::shared_ptr<folly::SocketAddress> proxyAddr_;
   std::shared_ptr<SSLCacheProvider> cacheProvider_;
   std::chrono::milliseconds gracefulShutdownTimeout_{5000};
 };
@@ -61,6 +61,12 @@ class AcceptorHandshakeManager : public ManagedConnection,
   virtual void start(
       folly::AsyncSSLSocket::UniquePtr sock) noexcept {
     acceptor_->getConnectionManager()->addConnection(this, true);
+    startTime_ = std::chrono::steady_clock::now();
+    if (auto stats = acceptor_->getAcceptorStats()) {
+      stats->recordHandshakeStartLatency(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+          startTime_ - acceptTime_));
+    }
     startHelper(std::move(sock));
   }
 
@@ -96,6 +102,9 @@ class AcceptorHandshakeManager : public ManagedConnection,
       std::string nextProtocol,
       SecureTransportType secureTransportType) noexcept override {
     acceptor_->getConnectionManager()->removeConnection(this);
+    if (auto stats = acceptor_->getAcceptorStats()) {
+      stats->recordHandshake(secureTransportType, getHandshakeLatency());
+    }
     // We pass TransportInfo by reference even though we're about to destroy it,
     // so lets hope that anything saving it makes a copy!
     acceptor_->sslConnectionReady(
@@ -110,15 +119,28 @@ class AcceptorHandshakeManager : public ManagedConnection,
   virtual void connectionError(
       folly::exception_wrapper ex) noexcept override {
     acceptor_->getConnectionManager()->removeConnection(this);
+    if (auto stats = acceptor_->getAcceptorStats()) {
+      auto error = SSLErrorEnum::NO_ERROR;
+      ex.with_exception<SSLException>([&](SSLException& sslEx) {
+        error = sslEx.getError();
+      });
+      stats->recordHandshakeError(error, getHandshakeLatency());
+    }
     acceptor_->sslConnectionError(std::move(ex));
     destroy();
   }
 
   virtual void startHelper(folly::AsyncSSLSocket::UniquePtr sock) = 0;
 
+  std::chrono::milliseconds getHandshakeLatency() const {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - startTime_);
+  }
+
   Acceptor* acceptor_;
   folly::SocketAddress clientAddr_;
   std::chrono::steady_clock::time_point acceptTime_;
+  std::chrono::steady_clock::time_point startTime_;
   TransportInfo tinfo_;
   AcceptorHandshakeHelper::UniquePtr helper_;
 };
@@ -0,0 +1,65 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <wangle/acceptor/SecureTransportType.h>
+#include <wangle/ssl/SSLUtil.h>
+
+#include <chrono>
+
+namespace wangle {
+
+enum class AcceptRejectReason {
+  // Above the CPU or memory thresholds of Acceptor::setLoadSampler()
+  SYSTEM_OVERLOADED,
+  // Above the connection counter's or the load shed connection limits
+  MAX_CONNECTIONS,
+  // Too many SSL handshakes in progress
+  MAX_SSL_HANDSHAKES,
+  // No valid PROXY header, see ServerSocketConfig::proxyProtocol
+  INVALID_PROXY_HEADER,
+};
+
+/**
+ * Stats of an Acceptor's connection establishment, set with
+ * Acceptor::setAcceptorStats(). Called in the acceptor's thread.
+ */
+class AcceptorStats {
+ public:
+  virtual ~AcceptorStats() noexcept {}
+
+  // Each connection handed to the acceptor, before canAccept()
+  virtual void recordConnectionAccepted() noexcept = 0;
+  virtual void recordConnectionRejected(AcceptRejectReason reason)
+    noexcept = 0;
+  // AsyncServerSocket failed to accept, e.g. out of fds
+  virtual void recordAcceptError() noexcept = 0;
+
+  // From the accept to the start of the handshake manager
+  virtual void recordHandshakeStartLatency(
+      std::chrono::microseconds latency) noexcept = 0;
+  // Of handshakes that succeeded, from their start
+  virtual void recordHandshake(
+      SecureTransportType type,
+      std::chrono::milliseconds latency) noexcept = 0;
+  virtual void recordHandshakeError(
+      SSLErrorEnum error,
+      std::chrono::milliseconds latency) noexcept = 0;
+
+  /**
+   * The connections completed by the kernel but not yet accepted from a
+   * listening socket, and its backlog. Recorded at most once a second per
+   * acceptor, while connections arrive; Linux only.
+   */
+  virtual void recordAcceptBacklog(uint32_t queued, uint32_t backlog)
+    noexcept = 0;
+};
+
+} // namespace wangle
@@ -9,6 +9,13 @@
  */
 #pragma once
 
+#include <folly/detail/CacheLocality.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
 namespace wangle {
 
 class IConnectionCounter {
@@ -51,4 +58,66 @@ class SimpleConnectionCounter: public IConnectionCounter {
   uint64_t numConnections_{0};
 };
 
+/**
+ * A counter for many Acceptors on different threads to share: each thread
+ * counts its connections in its own shard, so adding and removing them
+ * never contends with other threads. getNumConnections() sums the shards,
+ * which is exact but touches one cache line per shard; pair it with
+ * Acceptor::setConnectionCountCached() so each acceptor only does so once
+ * per loop iteration. getCachedNumConnections() returns the last sum
+ * without recomputing it.
+ */
+class ShardedConnectionCounter: public IConnectionCounter {
+ public:
+  explicit ShardedConnectionCounter(size_t numShards = 64)
+    : shards_(numShards) {}
+
+  uint64_t getNumConnections() const override {
+    int64_t n = 0;
+    for (const auto& shard : shards_) {
+      n += shard.count.load(std::memory_order_relaxed);
+    }
+    // Connections may be counted on one thread and uncounted on another,
+    // so the sum can be briefly negative
+    const uint64_t count = n > 0 ? n : 0;
+    cached_.store(count, std::memory_order_relaxed);
+    return count;
+  }
+
+  uint64_t getCachedNumConnections() const {
+    return cached_.load(std::memory_order_relaxed);
+  }
+
+  uint64_t getMaxConnections() const override {
+    return maxConnections_.load(std::memory_order_relaxed);
+  }
+
+  void setMaxConnections(uint64_t maxConnections) {
+    maxConnections_.store(maxConnections, std::memory_order_relaxed);
+  }
+
+  void onConnectionAdded() override {
+    shard().count.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void onConnectionRemoved() override {
+    shard().count.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+ private:
+  struct FOLLY_ALIGN_TO_AVOID_FALSE_SHARING Shard {
+    std::atomic<int64_t> count{0};
+  };
+
+  Shard& shard() {
+    static std::atomic<size_t> nextThread{0};
+    static thread_local size_t thread = nextThread++;
+    return shards_[thread % shards_.size()];
+  }
+
+  std::vector<Shard> shards_;
+  std::atomic<uint64_t> maxConnections_{0};
+  mutable std::atomic<uint64_t> cached_{0};
+};
+
 } // namespace wangle
@@ -9,10 +9,13 @@
  */
 
 #include <wangle/acceptor/ConnectionManager.h>
+#include <wangle/acceptor/TransportInfo.h>
 
 #include <glog/logging.h>
 #include <folly/io/async/EventBase.h>
 
+#include <algorithm>
+
 using folly::HHWheelTimer;
 using std::chrono::milliseconds;
 
@@ -26,7 +29,14 @@ ConnectionManager::ConnectionManager(folly::EventBase* eventBase,
     drainIterator_(conns_.end()),
     idleIterator_(conns_.end()),
     idleLoopCallback_(this),
+    drainPaceCallback_(this),
+    shedCallback_(this),
+    tcpInfoIterator_(conns_.end()),
+    tcpInfoCallback_(this),
+    bufferLimitCallback_(this),
+    adaptiveIdleCallback_(this),
     timeout_(timeout),
+    idleTimeout_(timeout),
     idleConnEarlyDropThreshold_(timeout_ / 2) {
 
 }
@@ -47,6 +57,12 @@ ConnectionManager::addConnection(ManagedConnection* connection,
     // because the last callback for an idle connection must be onDeactivated(),
     // so the connection must be moved to idle part then.
     conns_.push_front(*connection);
+    if (!metrics_) {
+      metrics_ = EventBaseMetrics::local();
+    }
+    if (metrics_) {
+      metrics_->addConnections(1);
+    }
 
     connection->setConnectionManager(this);
     if (callback_) {
@@ -54,7 +70,7 @@ ConnectionManager::addConnection(ManagedConnection* connection,
     }
   }
   if (timeout) {
-    scheduleTimeout(connection, timeout_);
+    scheduleTimeout(connection, idleTimeout_);
   }
   if (shutdownState_ >= ShutdownState::NOTIFY_PENDING_SHUTDOWN &&
       notifyPendingShutdown_) {
@@ -108,7 +124,13 @@ ConnectionManager::removeConnection(ManagedConnection* connection) {
     if (it == idleIterator_) {
       ++idleIterator_;
     }
+    if (it == tcpInfoIterator_) {
+      ++tcpInfoIterator_;
+    }
     conns_.erase(it);
+    if (metrics_) {
+      metrics_->addConnections(-1);
+    }
 
     if (callback_) {
       callback_->onConnectionRemoved(*this);
@@ -136,10 +158,30 @@ ConnectionManager::initiateGracefulShutdown(
     shutdownState_ = ShutdownState::CLOSE_WHEN_IDLE;
     VLOG(3) << "proceeding directly to closing idle connections";
   }
-  drainIterator_ = conns_.begin();
+  startDrainPass();
   drainAllConnections();
 }
 
+void
+ConnectionManager::setDrainDuration(milliseconds duration,
+                                    milliseconds step) {
+  CHECK_GT(step.count(), 0);
+  drainDuration_ = duration;
+  drainStep_ = step;
+}
+
+void
+ConnectionManager::startDrainPass() {
+  drainIterator_ = conns_.begin();
+  if (drainDuration_ > drainStep_) {
+    const uint64_t steps = drainDuration_.count() / drainStep_.count();
+    drainBatchSize_ = std::max<size_t>(
+        1, (conns_.size() + steps - 1) / steps);
+  } else {
+    drainBatchSize_ = 64;
+  }
+}
+
 void
 ConnectionManager::drainAllConnections() {
   DestructorGuard g(this);
@@ -150,7 +192,7 @@ ConnectionManager::drainAllConnections() {
 
   CHECK(shutdownState_ == ShutdownState::NOTIFY_PENDING_SHUTDOWN ||
         shutdownState_ == ShutdownState::CLOSE_WHEN_IDLE);
-  while (it != conns_.end() && (numKept + numCleared) < 64) {
+  while (it != conns_.end() && (numKept + numCleared) < drainBatchSize_) {
     ManagedConnection& conn = *it++;
     if (shutdownState_ == ShutdownState::NOTIFY_PENDING_SHUTDOWN) {
       conn.notifyPendingShutdown();
@@ -175,7 +217,11 @@ ConnectionManager::drainAllConnections() {
   }
   drainIterator_ = it;
   if (it != conns_.end()) {
-    eventBase_->runInLoop(&idleLoopCallback_);
+    if (drainDuration_ > drainStep_) {
+      drainPaceCallback_.scheduleTimeout(drainStep_.count());
+    } else {
+      eventBase_->runInLoop(&idleLoopCallback_);
+    }
   } else {
     if (shutdownState_ == ShutdownState::NOTIFY_PENDING_SHUTDOWN) {
       VLOG(3) << this << " finished notify_pending_shutdown";
@@ -183,7 +229,7 @@ ConnectionManager::drainAllConnections() {
       if (!idleLoopCallback_.isScheduled()) {
         // The idle grace timer already fired, start over immediately
         shutdownState_ = ShutdownState::CLOSE_WHEN_IDLE;
-        drainIterator_ = conns_.begin();
+        startDrainPass();
         eventBase_->runInLoop(&idleLoopCallback_);
       }
     } else {
@@ -197,7 +243,7 @@ ConnectionManager::idleGracefulTimeoutExpired() {
   VLOG(2) << this << " idleGracefulTimeoutExpired";
   if (shutdownState_ == ShutdownState::NOTIFY_PENDING_SHUTDOWN_COMPLETE) {
     shutdownState_ = ShutdownState::CLOSE_WHEN_IDLE;
-    drainIterator_ = conns_.begin();
+    startDrainPass();
     drainAllConnections();
   } else {
     VLOG(4) << this << " idleGracefulTimeoutExpired during "
@@ -213,10 +259,14 @@ ConnectionManager::dropAllConnections() {
   // Iterate through our connection list, and drop each connection.
   VLOG(3) << "connections to drop: " << conns_.size();
   idleLoopCallback_.cancelTimeout();
+  drainPaceCallback_.cancelTimeout();
   unsigned i = 0;
   while (!conns_.empty()) {
     ManagedConnection& conn = conns_.front();
     conns_.pop_front();
+    if (metrics_) {
+      metrics_->addConnections(-1);
+    }
     conn.cancelTimeout();
     conn.setConnectionManager(nullptr);
     // For debugging purposes, dump information about the first few
@@ -230,6 +280,7 @@ ConnectionManager::dropAllConnections() {
   drainIterator_ = conns_.end();
   idleIterator_ = conns_.end();
   idleLoopCallback_.cancelLoopCallback();
+  cancelPacedShedding();
 
   if (callback_) {
     callback_->onEmpty(*this);
@@ -242,6 +293,9 @@ ConnectionManager::onActivated(ManagedConnection& conn) {
   if (it == idleIterator_) {
     idleIterator_++;
   }
+  if (it == tcpInfoIterator_) {
+    tcpInfoIterator_++;
+  }
   conns_.erase(it);
   conns_.push_front(conn);
 }
@@ -254,6 +308,9 @@ ConnectionManager::onDeactivated(ManagedConnection& conn) {
     drainIterator_++;
     moveDrainIter = true;
   }
+  if (it == tcpInfoIterator_) {
+    tcpInfoIterator_++;
+  }
   conns_.erase(it);
   conns_.push_back(conn);
   if (idleIterator_ == conns_.end()) {
@@ -270,7 +327,12 @@ ConnectionManager::dropIdleConnections(size_t num) {
   if (idleConnEarlyDropThreshold_ >= timeout_) {
     return 0;
   }
+  return dropConnectionsIdleOver(idleConnEarlyDropThreshold_, num);
+}
 
+size_t
+ConnectionManager::dropConnectionsIdleOver(milliseconds threshold,
+                                           size_t num) {
   size_t count = 0;
   while(count < num) {
     auto it = idleIterator_;
@@ -279,9 +341,9 @@ ConnectionManager::dropIdleConnections(size_t num) {
     }
     auto idleTime = it->getIdleTime();
     if (idleTime == std::chrono::milliseconds(0) ||
-          idleTime <= idleConnEarlyDropThreshold_) {
+          idleTime <= threshold) {
       VLOG(4) << "conn's idletime: " << idleTime.count()
-              << ", earlyDropThreshold: " << idleConnEarlyDropThreshold_.count()
+              << ", earlyDropThreshold: " << threshold.count()
               << ", attempt to drop " << count << "/" << num;
       return count; // idleTime cannot be further reduced
     }
@@ -294,5 +356,175 @@ ConnectionManager::dropIdleConnections(size_t num) {
   return count;
 }
 
+void
+ConnectionManager::dropIdleConnectionsPaced(
+    size_t num,
+    size_t batchSize,
+    milliseconds interval,
+    ShedProgressCallback progress) {
+  CHECK_GT(batchSize, 0);
+  shedCallback_.cancelLoopCallback();
+  shedCallback_.cancelTimeout();
+  shedRemaining_ = num;
+  shedDropped_ = 0;
+  shedBatchSize_ = batchSize;
+  shedInterval_ = interval;
+  shedProgress_ = std::move(progress);
+  shedIdleConnections();
+}
+
+void
+ConnectionManager::cancelPacedShedding() {
+  if (!isShedding()) {
+    return;
+  }
+  shedCallback_.cancelLoopCallback();
+  shedCallback_.cancelTimeout();
+  shedRemaining_ = 0;
+  auto progress = std::move(shedProgress_);
+  shedProgress_ = nullptr;
+  if (progress) {
+    progress(shedDropped_, true);
+  }
+}
+
+void
+ConnectionManager::shedIdleConnections() {
+  DestructorGuard g(this);
+  const size_t batch = std::min(shedRemaining_, shedBatchSize_);
+  const size_t dropped = dropIdleConnections(batch);
+  shedDropped_ += dropped;
+  shedRemaining_ -= dropped;
+  if (dropped < batch) {
+    // Out of connections idle for long enough
+    shedRemaining_ = 0;
+  }
+  VLOG(4) << "shed " << dropped << " idle connections, " << shedRemaining_
+          << " to go";
+
+  // The callback may start over, so it is called last
+  auto progress = shedProgress_;
+  if (shedRemaining_ > 0) {
+    if (shedInterval_ > milliseconds(0)) {
+      shedCallback_.scheduleTimeout(shedInterval_.count());
+    } else {
+      eventBase_->runInLoop(&shedCallback_);
+    }
+  } else {
+    shedProgress_ = nullptr;
+  }
+  if (progress) {
+    progress(shedDropped_, shedRemaining_ == 0);
+  }
+}
+
+void
+ConnectionManager::setTcpInfoSampling(milliseconds interval,
+                                      size_t batchSize) {
+  CHECK_GT(batchSize, 0);
+  tcpInfoCallback_.cancelTimeout();
+  tcpInfoInterval_ = interval;
+  tcpInfoBatchSize_ = batchSize;
+  tcpInfoIterator_ = conns_.begin();
+  tcpInfoPass_ = TcpInfoStats();
+  if (interval > milliseconds(0)) {
+    tcpInfoCallback_.scheduleTimeout(interval.count());
+  }
+}
+
+void
+ConnectionManager::sampleTcpInfo() {
+  for (size_t i = 0; i < tcpInfoBatchSize_; i++) {
+    if (tcpInfoIterator_ == conns_.end()) {
+      // A pass is over; the next one starts with the next batch
+      tcpInfoStats_ = tcpInfoPass_;
+      tcpInfoPass_ = TcpInfoStats();
+      tcpInfoIterator_ = conns_.begin();
+      break;
+    }
+    auto& conn = *tcpInfoIterator_++;
+    auto tinfo = conn.sampleTcpInfo();
+    if (!tinfo || !tinfo->validTcpinfo) {
+      continue;
+    }
+    tcpInfoPass_.numSampled++;
+    tcpInfoPass_.rtt.add(tinfo->rtt);
+    if (tinfo->rtx >= 0) {
+      tcpInfoPass_.rtxPpm.add(
+          std::chrono::nanoseconds(int64_t(tinfo->rtx * 1000000)));
+    }
+  }
+  tcpInfoCallback_.scheduleTimeout(tcpInfoInterval_.count());
+}
+
+void
+ConnectionManager::setBufferLimitShedding(milliseconds interval,
+                                          size_t batchSize,
+                                          BufferAccounting& accounting) {
+  CHECK_GT(batchSize, 0);
+  bufferLimitCallback_.cancelTimeout();
+  bufferLimitInterval_ = interval;
+  bufferLimitBatchSize_ = batchSize;
+  bufferAccounting_ = &accounting;
+  if (interval > milliseconds(0)) {
+    bufferLimitCallback_.scheduleTimeout(interval.count());
+  }
+}
+
+void
+ConnectionManager::checkBufferLimit() {
+  if (bufferAccounting_->isOverLimit()) {
+    auto dropped = dropIdleConnections(bufferLimitBatchSize_);
+    VLOG(3) << "over the buffer limit, dropped " << dropped
+            << " idle connections";
+  }
+  bufferLimitCallback_.scheduleTimeout(bufferLimitInterval_.count());
+}
+
+void
+ConnectionManager::setAdaptiveIdleTimeout(milliseconds interval,
+                                          milliseconds minTimeout,
+                                          PressureFunction pressure,
+                                          size_t batchSize) {
+  CHECK_GT(batchSize, 0);
+  adaptiveIdleCallback_.cancelTimeout();
+  adaptiveIdleInterval_ = interval;
+  adaptiveIdleMin_ = std::max(milliseconds(0), std::min(minTimeout, timeout_));
+  adaptiveIdleBatchSize_ = batchSize;
+  pressure_ = std::move(pressure);
+  idleTimeout_ = timeout_;
+  if (interval > milliseconds(0) && pressure_) {
+    adaptiveIdleCallback_.scheduleTimeout(interval.count());
+  } else {
+    pressure_ = nullptr;
+  }
+}
+
+double
+ConnectionManager::pressureBetween(double value, double low, double high) {
+  if (value <= low) {
+    return 0;
+  }
+  if (value >= high) {
+    return 1;
+  }
+  return (value - low) / (high - low);
+}
+
+void
+ConnectionManager::adaptIdleTimeout() {
+  DestructorGuard g(this);
+  const double pressure = std::max(0.0, std::min(pressure_(), 1.0));
+  idleTimeout_ = timeout_ - milliseconds(int64_t(
+      (timeout_ - adaptiveIdleMin_).count() * pressure));
+  if (idleTimeout_ < timeout_) {
+    auto dropped = dropConnectionsIdleOver(idleTimeout_,
+                                           adaptiveIdleBatchSize_);
+    VLOG(3) << "pressure " << pressure << ", idle timeout "
+            << idleTimeout_.count() << "ms, dropped " << dropped
+            << " idle connections";
+  }
+  adaptiveIdleCallback_.scheduleTimeout(adaptiveIdleInterval_.count());
+}
 
 } // wangle
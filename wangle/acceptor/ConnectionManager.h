@@ -12,11 +12,15 @@
 #include <wangle/acceptor/ManagedConnection.h>
 
 #include <chrono>
+#include <functional>
 #include <folly/Memory.h>
 #include <folly/io/async/AsyncTimeout.h>
 #include <folly/io/async/HHWheelTimer.h>
 #include <folly/io/async/DelayedDestruction.h>
 #include <folly/io/async/EventBase.h>
+#include <wangle/channel/BufferAccounting.h>
+#include <wangle/concurrent/EventBaseMetrics.h>
+#include <wangle/concurrent/LatencyHistogram.h>
 
 namespace wangle {
 
@@ -107,6 +111,20 @@ class ConnectionManager: public folly::DelayedDestruction,
    */
   void initiateGracefulShutdown(std::chrono::milliseconds idleGrace);
 
+  /**
+   * Spread each pass of graceful shutdown, notifyPendingShutdown() and then
+   * closeWhenIdle(), over duration rather than going through all the
+   * connections at once: every step, the pass goes through
+   * step / duration of the connections there were when it started, at
+   * least one. The clients of a host with many connections then move to
+   * the rest of the fleet gradually instead of all reconnecting at once.
+   * Closing still waits for the idle grace, or for notifying to end if it
+   * takes longer. A zero duration, the default, drains at once.
+   */
+  void setDrainDuration(
+      std::chrono::milliseconds duration,
+      std::chrono::milliseconds step = std::chrono::milliseconds(100));
+
   /**
    * Destroy all connections Managed by this ConnectionManager, even
    * the ones that are busy.
@@ -140,6 +158,97 @@ class ConnectionManager: public folly::DelayedDestruction,
    */
   size_t dropIdleConnections(size_t num);
 
+  /**
+   * Called after each batch of dropIdleConnectionsPaced() with the number
+   * of connections dropped so far, and whether shedding is over, because
+   * num were dropped, no idle connection was left or it was cancelled.
+   */
+  typedef std::function<void(size_t dropped, bool done)> ShedProgressCallback;
+
+  /**
+   * Like dropIdleConnections(num), but drops at most batchSize connections
+   * at a time, the longest idle first, with the next batch one loop
+   * iteration later, or interval later if it is non-zero. Shedding tens of
+   * thousands of connections then neither stalls the thread nor has all
+   * their clients reconnect at once. The first batch is dropped before this
+   * returns. Replaces any paced shedding in progress.
+   */
+  void dropIdleConnectionsPaced(
+      size_t num,
+      size_t batchSize,
+      std::chrono::milliseconds interval = std::chrono::milliseconds(0),
+      ShedProgressCallback progress = nullptr);
+
+  void cancelPacedShedding();
+
+  bool isShedding() const {
+    return shedRemaining_ > 0;
+  }
+
+  /**
+   * What setTcpInfoSampling() found over a full pass of the connections
+   */
+  struct TcpInfoStats {
+    LatencyHistogram rtt;
+    // TransportInfo::rtx, the estimated retransmission ratio, in parts per
+    // million rather than nanoseconds
+    LatencyHistogram rtxPpm;
+    uint64_t numSampled{0};
+  };
+
+  /**
+   * Refresh the TCP_INFO of batchSize connections every interval, in turn,
+   * through ManagedConnection::sampleTcpInfo(), so their TransportInfo's
+   * rtt, cwnd and rtx stay current for the life of the connection rather
+   * than reflect the time it was accepted. Each connection is refreshed
+   * every numConnections / batchSize intervals, at a cost of batchSize
+   * getsockopt() calls per interval. A zero interval stops sampling.
+   */
+  void setTcpInfoSampling(std::chrono::milliseconds interval,
+                          size_t batchSize = 16);
+
+  // Of the last full pass over the connections
+  const TcpInfoStats& getTcpInfoStats() const {
+    return tcpInfoStats_;
+  }
+
+  /**
+   * Check accounting every interval, and while it's over its limit drop up
+   * to batchSize idle connections, as dropIdleConnections() does, so that
+   * their buffers are freed before the process runs out of memory. A zero
+   * interval stops checking.
+   */
+  void setBufferLimitShedding(
+      std::chrono::milliseconds interval,
+      size_t batchSize = 16,
+      BufferAccounting& accounting = BufferAccounting::get());
+
+  // Between 0, no pressure at all, and 1, as much as the process can take
+  typedef std::function<double()> PressureFunction;
+
+  /**
+   * Every interval, shrink the idle timeout from the default one toward
+   * minTimeout as pressure() rises from 0 to 1, and grow it back as it
+   * falls, so that idle connections give way to memory and to new
+   * connections gradually rather than all at once past a threshold. Up to
+   * batchSize idle connections idle for longer than the shrunk timeout are
+   * dropped each interval, the longest idle first, and the timeouts
+   * connections (re)schedule from then on are the shrunk one. A zero
+   * interval stops it, restoring the default timeout.
+   */
+  void setAdaptiveIdleTimeout(std::chrono::milliseconds interval,
+                              std::chrono::milliseconds minTimeout,
+                              PressureFunction pressure,
+                              size_t batchSize = 64);
+
+  // Where value stands between low, 0, and high, 1
+  static double pressureBetween(double value, double low, double high);
+
+  // The idle timeout in effect: the default one unless adaptive
+  std::chrono::milliseconds getIdleTimeout() const {
+    return idleTimeout_;
+  }
+
   /**
    * ManagedConnection::Callbacks
    */
@@ -170,6 +279,82 @@ class ConnectionManager: public folly::DelayedDestruction,
     ConnectionManager* manager_;
   };
 
+  class ShedIdleConnsCallback :
+      public folly::EventBase::LoopCallback,
+      public folly::AsyncTimeout {
+   public:
+    explicit ShedIdleConnsCallback(ConnectionManager* manager)
+        : folly::AsyncTimeout(manager->eventBase_),
+          manager_(manager) {}
+
+    void runLoopCallback() noexcept override {
+      manager_->shedIdleConnections();
+    }
+
+    void timeoutExpired() noexcept override {
+      manager_->shedIdleConnections();
+    }
+
+   private:
+    ConnectionManager* manager_;
+  };
+
+  class DrainPaceCallback : public folly::AsyncTimeout {
+   public:
+    explicit DrainPaceCallback(ConnectionManager* manager)
+        : folly::AsyncTimeout(manager->eventBase_),
+          manager_(manager) {}
+
+    void timeoutExpired() noexcept override {
+      manager_->drainAllConnections();
+    }
+
+   private:
+    ConnectionManager* manager_;
+  };
+
+  class TcpInfoSampleCallback : public folly::AsyncTimeout {
+   public:
+    explicit TcpInfoSampleCallback(ConnectionManager* manager)
+        : folly::AsyncTimeout(manager->eventBase_),
+          manager_(manager) {}
+
+    void timeoutExpired() noexcept override {
+      manager_->sampleTcpInfo();
+    }
+
+   private:
+    ConnectionManager* manager_;
+  };
+
+  class BufferLimitCallback : public folly::AsyncTimeout {
+   public:
+    explicit BufferLimitCallback(ConnectionManager* manager)
+        : folly::AsyncTimeout(manager->eventBase_),
+          manager_(manager) {}
+
+    void timeoutExpired() noexcept override {
+      manager_->checkBufferLimit();
+    }
+
+   private:
+    ConnectionManager* manager_;
+  };
+
+  class AdaptiveIdleCallback : public folly::AsyncTimeout {
+   public:
+    explicit AdaptiveIdleCallback(ConnectionManager* manager)
+        : folly::AsyncTimeout(manager->eventBase_),
+          manager_(manager) {}
+
+    void timeoutExpired() noexcept override {
+      manager_->adaptIdleTimeout();
+    }
+
+   private:
+    ConnectionManager* manager_;
+  };
+
   enum class ShutdownState : uint8_t {
     NONE = 0,
     // All ManagedConnections receive notifyPendingShutdown
@@ -196,6 +381,25 @@ class ConnectionManager: public folly::DelayedDestruction,
 
   void idleGracefulTimeoutExpired();
 
+  // Starts a pass of drainAllConnections() from the first connection
+  void startDrainPass();
+
+  // Drops the next batch of dropIdleConnectionsPaced()
+  void shedIdleConnections();
+
+  // Samples the next batch of setTcpInfoSampling()
+  void sampleTcpInfo();
+
+  // Sheds the next batch of setBufferLimitShedding(), if over the limit
+  void checkBufferLimit();
+
+  // Recomputes the idle timeout of setAdaptiveIdleTimeout()
+  void adaptIdleTimeout();
+
+  // Drops up to num of the idle connections idle for longer than idleTime
+  size_t dropConnectionsIdleOver(std::chrono::milliseconds idleTime,
+                                 size_t num);
+
   /**
    * All the managed connections. idleIterator_ seperates them into two parts:
    * idle and busy ones.  [conns_.begin(), idleIterator_) are the busy ones,
@@ -213,12 +417,43 @@ class ConnectionManager: public folly::DelayedDestruction,
   /** Event base in which we run */
   folly::EventBase* eventBase_;
 
+  /** Those of eventBase_'s thread, looked up on the first addConnection() */
+  EventBaseMetrics* metrics_{nullptr};
+
   /** Iterator to the next connection to shed; used by drainAllConnections() */
   folly::CountedIntrusiveList<
     ManagedConnection,&ManagedConnection::listHook_>::iterator drainIterator_;
   folly::CountedIntrusiveList<
     ManagedConnection,&ManagedConnection::listHook_>::iterator idleIterator_;
   CloseIdleConnsCallback idleLoopCallback_;
+  DrainPaceCallback drainPaceCallback_;
+  std::chrono::milliseconds drainDuration_{0};
+  std::chrono::milliseconds drainStep_{0};
+  // Connections per drainAllConnections() call
+  size_t drainBatchSize_{64};
+  ShedIdleConnsCallback shedCallback_;
+  size_t shedRemaining_{0};
+  size_t shedDropped_{0};
+  size_t shedBatchSize_{0};
+  std::chrono::milliseconds shedInterval_{0};
+  ShedProgressCallback shedProgress_;
+  /** Next connection to sample; kept valid like drainIterator_ */
+  folly::CountedIntrusiveList<
+    ManagedConnection,&ManagedConnection::listHook_>::iterator tcpInfoIterator_;
+  TcpInfoSampleCallback tcpInfoCallback_;
+  std::chrono::milliseconds tcpInfoInterval_{0};
+  size_t tcpInfoBatchSize_{0};
+  TcpInfoStats tcpInfoPass_;
+  BufferLimitCallback bufferLimitCallback_;
+  std::chrono::milliseconds bufferLimitInterval_{0};
+  size_t bufferLimitBatchSize_{0};
+  BufferAccounting* bufferAccounting_{nullptr};
+  AdaptiveIdleCallback adaptiveIdleCallback_;
+  std::chrono::milliseconds adaptiveIdleInterval_{0};
+  std::chrono::milliseconds adaptiveIdleMin_{0};
+  size_t adaptiveIdleBatchSize_{0};
+  PressureFunction pressure_;
+  TcpInfoStats tcpInfoStats_;
   ShutdownState shutdownState_{ShutdownState::NONE};
   bool notifyPendingShutdown_{true};
 
@@ -228,6 +463,12 @@ class ConnectionManager: public folly::DelayedDestruction,
    */
   std::chrono::milliseconds timeout_;
 
+  /**
+   * The idle timeout connections are scheduled with: timeout_, or less
+   * under pressure with setAdaptiveIdleTimeout()
+   */
+  std::chrono::milliseconds idleTimeout_;
+
   /**
    * The idle connections can be closed earlier that their idle timeout when any
    * system resource limit is reached.  This feature can be considerred as a pre
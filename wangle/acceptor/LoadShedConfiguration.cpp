@@ -26,6 +26,7 @@ void LoadShedConfiguration::addWhitelistAddr(folly::StringPiece input) {
     unsigned prefixLen = folly::to<unsigned>(addr.substr(separator + 1));
     addr.erase(separator);
     whitelistNetworks_.insert(NetworkAddress(SocketAddress(addr, 0), prefixLen));
+    whitelistRanges_ = NetworkRanges(whitelistNetworks_);
   }
 }
 
@@ -33,12 +34,7 @@ bool LoadShedConfiguration::isWhitelisted(const SocketAddress& address) const {
   if (whitelistAddrs_.find(address) != whitelistAddrs_.end()) {
     return true;
   }
-  for (auto& network : whitelistNetworks_) {
-    if (network.contains(address)) {
-      return true;
-    }
-  }
-  return false;
+  return whitelistRanges_.contains(address);
 }
 
 } // namespace wangle
@@ -18,6 +18,7 @@
 #include <string>
 
 #include <wangle/acceptor/NetworkAddress.h>
+#include <wangle/acceptor/NetworkRanges.h>
 
 namespace wangle {
 
@@ -54,10 +55,13 @@ class LoadShedConfiguration {
 
   /**
    * Set/get the set of networks that should be whitelisted through even
-   * when we're trying to shed load.
+   * when we're trying to shed load. They are indexed for isWhitelisted()
+   * when set, so setting them all at once is cheaper than adding them one
+   * by one.
    */
   void setWhitelistNetworks(const NetworkSet& networks) {
     whitelistNetworks_ = networks;
+    whitelistRanges_ = NetworkRanges(whitelistNetworks_);
   }
   const NetworkSet& getWhitelistNetworks() const { return whitelistNetworks_; }
 
@@ -162,13 +166,14 @@ class LoadShedConfiguration {
 
   AddressSet whitelistAddrs_;
   NetworkSet whitelistNetworks_;
+  NetworkRanges whitelistRanges_;
   uint64_t maxConnections_{0};
   uint64_t maxActiveConnections_{0};
   uint64_t acceptPauseOnAcceptorQueueSize_{0};
   uint64_t acceptResumeOnAcceptorQueueSize_{0};
   uint64_t minFreeMem_{0};
-  double maxMemUsage_;
-  double maxCpuUsage_;
+  double maxMemUsage_{1.0};
+  double maxCpuUsage_{1.0};
   double minCpuIdle_{0.0};
   uint64_t cpuUsageExceedWindowSize_{0};
   std::chrono::milliseconds period_;
@@ -27,7 +27,7 @@ ManagedConnection::~ManagedConnection() {
 void
 ManagedConnection::resetTimeout() {
   if (connectionManager_) {
-    resetTimeoutTo(connectionManager_->getDefaultTimeout());
+    resetTimeoutTo(connectionManager_->getIdleTimeout());
   }
 }
 
@@ -38,6 +38,35 @@ ManagedConnection::resetTimeoutTo(std::chrono::milliseconds timeout) {
   }
 }
 
+void
+ManagedConnection::touchTimeout() {
+  if (connectionManager_) {
+    lastActivity_ = std::chrono::steady_clock::now();
+    if (!isScheduled()) {
+      resetTimeout();
+    }
+  }
+}
+
+bool
+ManagedConnection::checkIdleTimeout() {
+  if (!connectionManager_ ||
+      lastActivity_ == std::chrono::steady_clock::time_point()) {
+    return true;
+  }
+  auto idle = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - lastActivity_);
+  auto timeout = connectionManager_->getIdleTimeout();
+  // The wheel fires up to a tick early; don't rearm it for less
+  const std::chrono::milliseconds tick(
+      folly::HHWheelTimer::DEFAULT_TICK_INTERVAL);
+  if (idle + tick >= timeout) {
+    return true;
+  }
+  resetTimeoutTo(timeout - idle);
+  return false;
+}
+
 void
 ManagedConnection::scheduleTimeout(
   folly::HHWheelTimer::Callback* callback,
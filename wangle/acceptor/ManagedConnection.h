@@ -11,6 +11,7 @@
 #pragma once
 
 #include <folly/IntrusiveList.h>
+#include <chrono>
 #include <ostream>
 #include <folly/io/async/HHWheelTimer.h>
 #include <folly/io/async/DelayedDestruction.h>
@@ -18,6 +19,7 @@
 namespace wangle {
 
 class ConnectionManager;
+struct TransportInfo;
 
 /**
  * Interface describing a connection that can be managed by a
@@ -88,9 +90,18 @@ class ManagedConnection:
    */
   virtual void dumpConnectionState(uint8_t loglevel) = 0;
 
+  /**
+   * Refresh the TCP_INFO fields of the connection's TransportInfo, for
+   * ConnectionManager::setTcpInfoSampling(), and return it. Returns nullptr
+   * if the connection has no TCP socket or TransportInfo to refresh.
+   */
+  virtual const TransportInfo* sampleTcpInfo() {
+    return nullptr;
+  }
+
   /**
    * If the connection has a connection manager, reset the timeout countdown to
-   * connection manager's default timeout.
+   * connection manager's idle timeout (see getIdleTimeout()).
    * @note If the connection manager doesn't have the connection scheduled
    *       for a timeout already, this method will schedule one.  If the
    *       connection manager does have the connection connection scheduled
@@ -105,6 +116,25 @@ class ManagedConnection:
    */
   void resetTimeoutTo(std::chrono::milliseconds);
 
+  /**
+   * Like resetTimeout(), for connections that see activity at a high rate:
+   * records the time instead of moving the timeout, which is only
+   * scheduled if it isn't already. When it fires, timeoutExpired() calls
+   * checkIdleTimeout() first, which schedules it again for the rest of the
+   * idle timeout if there was activity meanwhile. The timer is then updated
+   * once per idle timeout rather than once per read or write.
+   */
+  void touchTimeout();
+
+  /**
+   * For the timeoutExpired() of connections using touchTimeout(): returns
+   * true if the connection was idle for the whole idle timeout, else
+   * schedules the timeout again and returns false. Idle shedding calls
+   * timeoutExpired() too, for connections that aren't busy, which this
+   * then keeps from dropping those touched within the idle timeout.
+   */
+  bool checkIdleTimeout();
+
   // Schedule an arbitrary timeout on the HHWheelTimer
   virtual void scheduleTimeout(
     folly::HHWheelTimer::Callback* callback,
@@ -126,6 +156,9 @@ class ManagedConnection:
 
   ConnectionManager* connectionManager_;
 
+  // Of the last touchTimeout(), if any
+  std::chrono::steady_clock::time_point lastActivity_;
+
   folly::SafeIntrusiveListHook listHook_;
 };
 
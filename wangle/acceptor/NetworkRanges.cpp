@@ -0,0 +1,112 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/acceptor/NetworkRanges.h>
+
+#include <folly/IPAddress.h>
+
+#include <algorithm>
+
+using folly::IPAddress;
+using folly::SocketAddress;
+
+namespace wangle {
+
+namespace {
+
+uint32_t v4Mask(unsigned prefixLen) {
+  return prefixLen == 0 ? 0 : ~uint32_t(0) << (32 - std::min(prefixLen, 32u));
+}
+
+uint64_t v6HalfMask(unsigned prefixLen) {
+  return prefixLen == 0 ? 0 : ~uint64_t(0) << (64 - std::min(prefixLen, 64u));
+}
+
+std::pair<uint64_t, uint64_t> v6Halves(const IPAddress& ip) {
+  const auto bytes = ip.asV6().toByteArray();
+  uint64_t hi = 0;
+  uint64_t lo = 0;
+  for (size_t i = 0; i < 8; i++) {
+    hi = (hi << 8) | bytes[i];
+    lo = (lo << 8) | bytes[i + 8];
+  }
+  return std::make_pair(hi, lo);
+}
+
+}
+
+NetworkRanges::NetworkRanges(const std::set<NetworkAddress>& networks) {
+  for (const auto& network : networks) {
+    const auto& addr = network.getAddress();
+    if (!addr.isFamilyInet()) {
+      continue;
+    }
+    const auto ip = addr.getIPAddress();
+    const unsigned prefixLen = network.getPrefixLength();
+    if (ip.isV4()) {
+      const uint32_t mask = v4Mask(prefixLen);
+      const uint32_t first = ip.asV4().toLongHBO() & mask;
+      v4_.emplace_back(first, first | ~mask);
+    } else {
+      const auto halves = v6Halves(ip);
+      const uint64_t hiMask = v6HalfMask(prefixLen);
+      const uint64_t loMask = prefixLen > 64 ? v6HalfMask(prefixLen - 64) : 0;
+      const V6 first(halves.first & hiMask, halves.second & loMask);
+      const V6 last(first.first | ~hiMask, first.second | ~loMask);
+      v6_.emplace_back(first, last);
+    }
+  }
+  merge(v4_);
+  merge(v6_);
+}
+
+bool NetworkRanges::contains(const SocketAddress& addr) const {
+  if (!addr.isFamilyInet()) {
+    return false;
+  }
+  const auto ip = addr.getIPAddress();
+  if (ip.isV4()) {
+    return find(v4_, ip.asV4().toLongHBO());
+  }
+  return find(v6_, v6Halves(ip));
+}
+
+template <class T>
+void NetworkRanges::merge(Ranges<T>& ranges) {
+  if (ranges.empty()) {
+    return;
+  }
+  std::sort(ranges.begin(), ranges.end());
+  size_t last = 0;
+  for (size_t i = 1; i < ranges.size(); i++) {
+    if (ranges[i].first <= ranges[last].second) {
+      ranges[last].second = std::max(ranges[last].second, ranges[i].second);
+    } else {
+      ranges[++last] = ranges[i];
+    }
+  }
+  ranges.resize(last + 1);
+  ranges.shrink_to_fit();
+}
+
+template <class T>
+bool NetworkRanges::find(const Ranges<T>& ranges, const T& value) {
+  // The last range starting at or before value
+  auto it = std::upper_bound(
+      ranges.begin(), ranges.end(), value,
+      [] (const T& v, const std::pair<T, T>& range) {
+        return v < range.first;
+      });
+  if (it == ranges.begin()) {
+    return false;
+  }
+  return value <= (--it)->second;
+}
+
+} // namespace wangle
@@ -0,0 +1,59 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/SocketAddress.h>
+#include <wangle/acceptor/NetworkAddress.h>
+
+#include <cstdint>
+#include <set>
+#include <utility>
+#include <vector>
+
+namespace wangle {
+
+/**
+ * An immutable index of a set of networks, for checking whether an address
+ * is in any of them in O(log n). The networks are turned into sorted,
+ * disjoint ranges of addresses, one table per family, so thousands of
+ * overlapping CIDRs cost a binary search over a few flat vectors.
+ *
+ * Like NetworkAddress::contains(), IPv4 addresses only match IPv4
+ * networks and IPv6 addresses IPv6 networks.
+ */
+class NetworkRanges {
+ public:
+  NetworkRanges() = default;
+  explicit NetworkRanges(const std::set<NetworkAddress>& networks);
+
+  bool contains(const folly::SocketAddress& addr) const;
+
+  bool empty() const {
+    return v4_.empty() && v6_.empty();
+  }
+
+ private:
+  // The high and low halves of an IPv6 address
+  typedef std::pair<uint64_t, uint64_t> V6;
+
+  template <class T>
+  using Ranges = std::vector<std::pair<T, T>>;
+
+  template <class T>
+  static void merge(Ranges<T>& ranges);
+
+  template <class T>
+  static bool find(const Ranges<T>& ranges, const T& value);
+
+  Ranges<uint32_t> v4_;
+  Ranges<V6> v6_;
+};
+
+} // namespace wangle
@@ -11,6 +11,10 @@
 
 #include <wangle/acceptor/AcceptorHandshakeManager.h>
 
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+
 namespace wangle {
 
 /**
@@ -21,6 +25,9 @@ namespace wangle {
  * The mechanism used by this is to peek the first N
  * bytes of the socket and send it to the peek helper
  * to decide which protocol it is.
+ * While peeking, the socket's receive low water mark is N,
+ * so that it only becomes readable once all N bytes are in,
+ * rather than on each segment, re-peeking the same bytes.
  */
 template<size_t N>
 class PeekingAcceptorHandshakeHelper :
@@ -61,6 +68,7 @@ class PeekingAcceptorHandshakeHelper :
           socket_->getSSLState(),
           folly::AsyncSSLSocket::SSLStateEnum::STATE_UNENCRYPTED);
       socket_->setPeek(true);
+      setReceiveLowWatermark(N);
       socket_->setReadCB(this);
     }
 
@@ -92,6 +100,7 @@ class PeekingAcceptorHandshakeHelper :
       }
       socket_->setPeek(false);
       socket_->setReadCB(nullptr);
+      setReceiveLowWatermark(1);
 
       helper_ = peekCallback_->getHelper(
           std::move(peekBytes_),
@@ -147,6 +156,13 @@ class PeekingAcceptorHandshakeHelper :
     }
 
   private:
+    void setReceiveLowWatermark(int bytes) {
+      // Just more wakeups if it fails
+      if (socket_->setSockOpt(SOL_SOCKET, SO_RCVLOWAT, &bytes) != 0) {
+        VLOG(4) << "Failed to set SO_RCVLOWAT: " << strerror(errno);
+      }
+    }
+
     folly::AsyncSSLSocket::UniquePtr socket_;
     AcceptorHandshakeHelper::UniquePtr helper_;
 
@@ -0,0 +1,312 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/acceptor/ProxyProtocol.h>
+
+#include <wangle/acceptor/Acceptor.h>
+#include <wangle/acceptor/ConnectionManager.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <folly/Conv.h>
+#include <folly/IPAddress.h>
+#include <folly/Range.h>
+#include <folly/String.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+using folly::ByteRange;
+using folly::SocketAddress;
+using folly::StringPiece;
+
+namespace wangle {
+
+namespace {
+
+const char kV1Prefix[] = "PROXY ";
+const size_t kV1PrefixLength = sizeof(kV1Prefix) - 1;
+const size_t kV1MaxLength = 107;
+
+const uint8_t kV2Signature[] = {
+  0x0D, 0x0A, 0x0D, 0x0A, 0x00, 0x0D, 0x0A, 0x51, 0x55, 0x49, 0x54, 0x0A,
+};
+const size_t kV2HeaderLength = 16;
+
+// Whether data, as much of it as there is, starts like prefix
+bool startsLike(const uint8_t* data, size_t len, const void* prefix,
+                size_t prefixLen) {
+  return memcmp(data, prefix, std::min(len, prefixLen)) == 0;
+}
+
+uint16_t readUint16(const uint8_t* p) {
+  return uint16_t((p[0] << 8) | p[1]);
+}
+
+// "PROXY TCP4 192.0.2.1 198.51.100.1 56324 443\r\n", or
+// "PROXY UNKNOWN ...\r\n"
+ProxyParseResult parseV1(
+    const uint8_t* data,
+    size_t len,
+    ProxyHeader& header) {
+  auto chars = reinterpret_cast<const char*>(data);
+  StringPiece available(chars, std::min(len, kV1MaxLength));
+  auto end = available.find("\r\n");
+  if (end == StringPiece::npos) {
+    if (len >= kV1MaxLength) {
+      return ProxyParseResult::INVALID;
+    }
+    header.length = len + 1;
+    return ProxyParseResult::NEED_MORE;
+  }
+  header.version = 1;
+  header.length = end + 2;
+
+  std::vector<StringPiece> fields;
+  folly::split(' ', available.subpiece(0, end), fields);
+  if (fields.size() >= 2 && fields[1] == "UNKNOWN") {
+    header.hasAddresses = false;
+    return ProxyParseResult::OK;
+  }
+  if (fields.size() != 6 ||
+      (fields[1] != "TCP4" && fields[1] != "TCP6")) {
+    return ProxyParseResult::INVALID;
+  }
+  try {
+    header.source = SocketAddress(
+        fields[2].str(), folly::to<uint16_t>(fields[4]));
+    header.destination = SocketAddress(
+        fields[3].str(), folly::to<uint16_t>(fields[5]));
+  } catch (const std::exception&) {
+    return ProxyParseResult::INVALID;
+  }
+  const auto family = fields[1] == "TCP4" ? AF_INET : AF_INET6;
+  if (header.source.getFamily() != family ||
+      header.destination.getFamily() != family) {
+    return ProxyParseResult::INVALID;
+  }
+  header.hasAddresses = true;
+  return ProxyParseResult::OK;
+}
+
+ProxyParseResult parseV2(
+    const uint8_t* data,
+    size_t len,
+    ProxyHeader& header) {
+  if (len < kV2HeaderLength) {
+    header.length = kV2HeaderLength;
+    return ProxyParseResult::NEED_MORE;
+  }
+  const uint8_t verCmd = data[12];
+  const uint8_t family = data[13];
+  const size_t addrLength = readUint16(data + 14);
+  if ((verCmd >> 4) != 2 || (verCmd & 0xF) > 1 ||
+      kV2HeaderLength + addrLength > kMaxProxyHeaderLength) {
+    return ProxyParseResult::INVALID;
+  }
+  header.version = 2;
+  header.length = kV2HeaderLength + addrLength;
+  if (len < header.length) {
+    return ProxyParseResult::NEED_MORE;
+  }
+
+  // LOCAL: the proxy's own connection, the addresses are to be ignored
+  header.hasAddresses = false;
+  if ((verCmd & 0xF) == 0) {
+    return ProxyParseResult::OK;
+  }
+  const uint8_t* addrs = data + kV2HeaderLength;
+  try {
+    switch (family >> 4) {
+      case 0x1:
+        if (addrLength < 12) {
+          return ProxyParseResult::INVALID;
+        }
+        header.source = SocketAddress(
+            folly::IPAddressV4::fromBinary(ByteRange(addrs, 4)),
+            readUint16(addrs + 8));
+        header.destination = SocketAddress(
+            folly::IPAddressV4::fromBinary(ByteRange(addrs + 4, 4)),
+            readUint16(addrs + 10));
+        header.hasAddresses = true;
+        break;
+      case 0x2:
+        if (addrLength < 36) {
+          return ProxyParseResult::INVALID;
+        }
+        header.source = SocketAddress(
+            folly::IPAddressV6::fromBinary(ByteRange(addrs, 16)),
+            readUint16(addrs + 32));
+        header.destination = SocketAddress(
+            folly::IPAddressV6::fromBinary(ByteRange(addrs + 16, 16)),
+            readUint16(addrs + 34));
+        header.hasAddresses = true;
+        break;
+      default:
+        // Unspecified or Unix sockets: nothing to shed or route on
+        break;
+    }
+  } catch (const std::exception&) {
+    return ProxyParseResult::INVALID;
+  }
+  return ProxyParseResult::OK;
+}
+
+} // namespace
+
+ProxyParseResult parseProxyHeader(
+    const uint8_t* data,
+    size_t len,
+    ProxyHeader& header) {
+  header = ProxyHeader();
+  if (len == 0) {
+    header.length = 1;
+    return ProxyParseResult::NEED_MORE;
+  }
+  if (startsLike(data, len, kV1Prefix, kV1PrefixLength)) {
+    if (len < kV1PrefixLength) {
+      header.length = kV1PrefixLength;
+      return ProxyParseResult::NEED_MORE;
+    }
+    return parseV1(data, len, header);
+  }
+  if (startsLike(data, len, kV2Signature, sizeof(kV2Signature))) {
+    return parseV2(data, len, header);
+  }
+  return ProxyParseResult::INVALID;
+}
+
+ProxyHeaderReader::ProxyHeaderReader(
+    Acceptor* acceptor,
+    folly::EventBase* base,
+    int fd,
+    const SocketAddress& proxyAddr,
+    std::chrono::steady_clock::time_point acceptTime)
+    : folly::EventHandler(base, fd),
+      acceptor_(acceptor),
+      fd_(fd),
+      proxyAddr_(proxyAddr),
+      acceptTime_(acceptTime) {}
+
+ProxyHeaderReader::~ProxyHeaderReader() {
+  if (fd_ >= 0) {
+    unregisterHandler();
+    ::close(fd_);
+  }
+}
+
+void ProxyHeaderReader::start(
+    ConnectionManager* manager,
+    std::chrono::milliseconds timeout) {
+  folly::DelayedDestruction::DestructorGuard dg(this);
+  manager->addConnection(this);
+  resetTimeoutTo(timeout);
+  // The header may well be in already
+  tryRead();
+  if (fd_ >= 0 && !isHandlerRegistered()) {
+    registerHandler(folly::EventHandler::READ | folly::EventHandler::PERSIST);
+  }
+}
+
+void ProxyHeaderReader::handlerReady(uint16_t /* events */) noexcept {
+  folly::DelayedDestruction::DestructorGuard dg(this);
+  tryRead();
+}
+
+void ProxyHeaderReader::tryRead() {
+  uint8_t buf[kMaxProxyHeaderLength];
+  ssize_t n;
+  do {
+    n = ::recv(fd_, buf, sizeof(buf), MSG_PEEK | MSG_DONTWAIT);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return;
+  }
+  if (n <= 0) {
+    VLOG(4) << "Connection from " << proxyAddr_
+            << " closed before its PROXY header";
+    dropConnection();
+    return;
+  }
+
+  ProxyHeader header;
+  const auto result = parseProxyHeader(buf, n, header);
+  if (result == ProxyParseResult::NEED_MORE) {
+    // Not woken up again before it could be complete
+    setReceiveLowWatermark(header.length);
+    return;
+  }
+  if (result == ProxyParseResult::INVALID) {
+    VLOG(4) << "Invalid PROXY header from " << proxyAddr_;
+    if (auto stats = acceptor_->getAcceptorStats()) {
+      stats->recordConnectionRejected(
+          AcceptRejectReason::INVALID_PROXY_HEADER);
+    }
+    dropConnection();
+    return;
+  }
+
+  // Take the header off the socket, leaving the rest to the connection
+  do {
+    n = ::recv(fd_, buf, header.length, MSG_DONTWAIT);
+  } while (n < 0 && errno == EINTR);
+  if (n != ssize_t(header.length)) {
+    dropConnection();
+    return;
+  }
+  setReceiveLowWatermark(1);
+  auto fd = fd_;
+  finish();
+  acceptor_->proxyHeaderReceived(fd, proxyAddr_, header, acceptTime_);
+  destroy();
+}
+
+void ProxyHeaderReader::setReceiveLowWatermark(int bytes) {
+  if (bytes == lowWatermark_) {
+    return;
+  }
+  lowWatermark_ = bytes;
+  // Just more wakeups if it fails
+  if (setsockopt(fd_, SOL_SOCKET, SO_RCVLOWAT, &bytes, sizeof(bytes)) != 0) {
+    VLOG(4) << "Failed to set SO_RCVLOWAT: " << strerror(errno);
+  }
+}
+
+void ProxyHeaderReader::finish() {
+  if (isHandlerRegistered()) {
+    unregisterHandler();
+  }
+  cancelTimeout();
+  if (auto manager = getConnectionManager()) {
+    manager->removeConnection(this);
+  }
+  fd_ = -1;
+}
+
+void ProxyHeaderReader::timeoutExpired() noexcept {
+  VLOG(4) << "Timed out waiting for the PROXY header from " << proxyAddr_;
+  dropConnection();
+}
+
+void ProxyHeaderReader::describe(std::ostream& os) const {
+  os << "pending PROXY header from " << proxyAddr_;
+}
+
+void ProxyHeaderReader::dropConnection() {
+  if (fd_ < 0) {
+    return;
+  }
+  auto fd = fd_;
+  finish();
+  ::close(fd);
+  destroy();
+}
+
+} // namespace wangle
@@ -0,0 +1,115 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include <folly/SocketAddress.h>
+#include <folly/io/async/EventHandler.h>
+#include <wangle/acceptor/ManagedConnection.h>
+
+namespace wangle {
+
+class Acceptor;
+
+/**
+ * A PROXY protocol header, as L4 load balancers and proxies send it at the
+ * start of a connection to pass on the client's address, see
+ * http://www.haproxy.org/download/1.8/doc/proxy-protocol.txt
+ */
+struct ProxyHeader {
+  // 1 or 2
+  uint8_t version{0};
+  // False for v1 UNKNOWN and v2 LOCAL headers, on the proxy's own
+  // connections (e.g. health checks), and for families other than IP
+  bool hasAddresses{false};
+  folly::SocketAddress source;
+  folly::SocketAddress destination;
+  // The length of the header. While more is needed, the length it's known
+  // to have at least.
+  size_t length{0};
+};
+
+enum class ProxyParseResult {
+  OK,
+  NEED_MORE,
+  INVALID,
+};
+
+/**
+ * The longest header accepted: a v1 header is at most 107 bytes, and v2
+ * headers above this are refused, as the spec allows.
+ */
+constexpr size_t kMaxProxyHeaderLength = 536;
+
+/**
+ * Parses a v1 or v2 header at the start of the len bytes of data.
+ */
+ProxyParseResult parseProxyHeader(
+    const uint8_t* data,
+    size_t len,
+    ProxyHeader& header);
+
+/**
+ * Reads the PROXY header of a newly accepted connection for its Acceptor,
+ * before any TransportInfo, load shedding or handshake, when
+ * ServerSocketConfig::proxyProtocol is set. The header is peeked at as it
+ * comes in, rather than read through a transport, and then read off the
+ * socket exactly, so that what follows it is left for the connection. The
+ * receive low watermark keeps it from waking up until the header could be
+ * complete; most headers take one peek and one read.
+ *
+ * Tracked by the acceptor's ConnectionManager until the header is in, so
+ * that it's dropped with the other connections, or after the timeout.
+ */
+class ProxyHeaderReader : public ManagedConnection,
+                          private folly::EventHandler {
+ public:
+  ProxyHeaderReader(
+      Acceptor* acceptor,
+      folly::EventBase* base,
+      int fd,
+      const folly::SocketAddress& proxyAddr,
+      std::chrono::steady_clock::time_point acceptTime);
+
+  void start(ConnectionManager* manager, std::chrono::milliseconds timeout);
+
+  // ManagedConnection
+  void timeoutExpired() noexcept override;
+  void describe(std::ostream& os) const override;
+  bool isBusy() const override {
+    return true;
+  }
+  void notifyPendingShutdown() override {}
+  void closeWhenIdle() override {}
+  void dropConnection() override;
+  void dumpConnectionState(uint8_t /* loglevel */) override {}
+
+ private:
+  ~ProxyHeaderReader() override;
+
+  // EventHandler
+  void handlerReady(uint16_t events) noexcept override;
+
+  void tryRead();
+  void setReceiveLowWatermark(int bytes);
+  // Stops tracking the connection before it's handed on or closed
+  void finish();
+
+  Acceptor* acceptor_;
+  int fd_;
+  folly::SocketAddress proxyAddr_;
+  std::chrono::steady_clock::time_point acceptTime_;
+  int lowWatermark_{1};
+};
+
+} // namespace wangle
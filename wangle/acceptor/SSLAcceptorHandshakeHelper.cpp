@@ -9,8 +9,14 @@
  */
 #include <wangle/acceptor/SSLAcceptorHandshakeHelper.h>
 
+#include <folly/MoveWrapper.h>
+#include <folly/Random.h>
 #include <string>
 #include <wangle/acceptor/SecureTransportType.h>
+#include <wangle/concurrent/IOExecutor.h>
+#include <wangle/ssl/KernelTLS.h>
+#include <wangle/ssl/SSLContextManager.h>
+#include <wangle/ssl/SSLStats.h>
 
 namespace wangle {
 
@@ -24,15 +30,134 @@ void SSLAcceptorHandshakeHelper::start(
   socket_ = std::move(sock);
   callback_ = callback;
 
-  if (acceptor_->getParseClientHello()) {
-    socket_->enableClientHelloParsing();
+  auto& config = acceptor_->getConfig();
+  if (acceptor_->getParseClientHello() &&
+      folly::Random::oneIn(config.sslClientHelloSampleRate)) {
+    if (config.sslClientHelloLazy) {
+      clientHello_ = std::make_shared<SSLClientHello>();
+    } else {
+      socket_->enableClientHelloParsing();
+      parseClientHello_ = true;
+    }
   }
 
   socket_->forceCacheAddrOnFailure(true);
+  auto sampleRate = config.sslHandshakeTimingSampleRate;
+  if (sampleRate > 0 && folly::Random::oneIn(sampleRate)) {
+    timings_ = std::make_shared<SSLHandshakeTimings>(acceptTime_);
+  }
+  auto executor = acceptor_->getSSLHandshakeExecutor();
+  auto handshakeBase = executor ? executor->getEventBase() : nullptr;
+  if (handshakeBase && handshakeBase != socket_->getEventBase()) {
+    offloadHandshake(handshakeBase);
+    return;
+  }
+  startTiming(socket_.get());
   socket_->sslAccept(this);
 }
 
+void SSLAcceptorHandshakeHelper::dropConnection(SSLErrorEnum reason) {
+  sslError_ = reason;
+  if (!offload_) {
+    socket_->closeNow();
+    return;
+  }
+  // Fails the handshake, unless it is already on its way back
+  auto offload = offload_;
+  handshakeBase_->runInEventBaseThread([offload] {
+    if (offload->socket) {
+      offload->socket->closeNow();
+    }
+  });
+}
+
+void SSLAcceptorHandshakeHelper::offloadHandshake(EventBase* handshakeBase) {
+  handshakeBase_ = handshakeBase;
+  offload_ = std::make_shared<OffloadState>();
+  socket_->detachEventBase();
+  auto sock = socket_.get();
+  auto offload = offload_;
+  handshakeBase->runInEventBaseThread([this, sock, offload, handshakeBase] {
+    sock->attachEventBase(handshakeBase);
+    offload->socket = sock;
+    startTiming(sock);
+    sock->sslAccept(this);
+  });
+}
+
+void SSLAcceptorHandshakeHelper::returnToAcceptor(Func func) {
+  // Not from within the socket's callback, which may still use its
+  // EventBase on the way out
+  auto func2 = folly::makeMoveWrapper(std::move(func));
+  handshakeBase_->runInLoop([this, func2] () mutable {
+    offload_->socket = nullptr;
+    socket_->detachEventBase();
+    auto base = acceptor_->getEventBase();
+    base->runInEventBaseThread([this, base, func2] () mutable {
+      socket_->attachEventBase(base);
+      handshakeBase_ = nullptr;
+      offload_.reset();
+      (*func2)();
+    });
+  });
+}
+
+void SSLAcceptorHandshakeHelper::startTiming(AsyncSSLSocket* sock) {
+  if (timings_) {
+    SSLHandshakeTimings::attach(sock, timings_);
+    timings_->mark(SSLHandshakeTimings::Stage::STARTED);
+  }
+  if (clientHello_) {
+    SSLClientHello::attach(sock, clientHello_);
+  }
+}
+
+void SSLAcceptorHandshakeHelper::stopTiming(AsyncSSLSocket* sock) {
+  if (timings_) {
+    SSLHandshakeTimings::detach(sock);
+  }
+  if (clientHello_) {
+    SSLClientHello::detach(sock);
+  }
+}
+
+void SSLAcceptorHandshakeHelper::recordTimings() {
+  if (!timings_) {
+    return;
+  }
+  tinfo_.sslHandshakeTimings = timings_;
+  auto contextManager = acceptor_->getSSLContextManager();
+  auto stats = contextManager ? contextManager->getSSLStats() : nullptr;
+  if (stats) {
+    stats->recordSSLHandshakeTimings(*timings_);
+  }
+}
+
 void SSLAcceptorHandshakeHelper::handshakeSuc(AsyncSSLSocket* sock) noexcept {
+  if (timings_) {
+    timings_->mark(SSLHandshakeTimings::Stage::FINISHED);
+  }
+  stopTiming(sock);
+  if (offload_) {
+    returnToAcceptor([this, sock] { finishHandshake(sock); });
+    return;
+  }
+  finishHandshake(sock);
+}
+
+void SSLAcceptorHandshakeHelper::handshakeErr(
+    AsyncSSLSocket* sock,
+    const AsyncSocketException& ex) noexcept {
+  stopTiming(sock);
+  if (offload_) {
+    returnToAcceptor([this, sock, ex] { failHandshake(sock, ex); });
+    return;
+  }
+  failHandshake(sock, ex);
+}
+
+void SSLAcceptorHandshakeHelper::finishHandshake(
+    AsyncSSLSocket* sock) noexcept {
   const unsigned char* nextProto = nullptr;
   unsigned nextProtoLength = 0;
   sock->getSelectedNextProtocol(&nextProto, &nextProtoLength);
@@ -57,38 +182,61 @@ void SSLAcceptorHandshakeHelper::handshakeSuc(AsyncSSLSocket* sock) noexcept {
   tinfo_.sslServerName = sock->getSSLServerName() ?
     std::make_shared<std::string>(sock->getSSLServerName()) : nullptr;
   tinfo_.sslCipher = sock->getNegotiatedCipherName() ?
-    std::make_shared<std::string>(sock->getNegotiatedCipherName()) : nullptr;
+    TransportInfo::internString(sock->getNegotiatedCipherName()) : nullptr;
   tinfo_.sslVersion = sock->getSSLVersion();
   const char* sigAlgName = sock->getSSLCertSigAlgName();
   tinfo_.sslCertSigAlgName =
-    std::make_shared<std::string>(sigAlgName ? sigAlgName : "");
+    TransportInfo::internString(sigAlgName ? sigAlgName : "");
   tinfo_.sslCertSize = sock->getSSLCertSize();
   tinfo_.sslResume = SSLUtil::getResumeState(sock);
-  tinfo_.sslClientCiphers = std::make_shared<std::string>();
-  sock->getSSLClientCiphers(*tinfo_.sslClientCiphers);
-  tinfo_.sslClientCiphersHex = std::make_shared<std::string>();
-  sock->getSSLClientCiphers(
-      *tinfo_.sslClientCiphersHex, /* convertToString = */ false);
-  tinfo_.sslServerCiphers = std::make_shared<std::string>();
-  sock->getSSLServerCiphers(*tinfo_.sslServerCiphers);
-  tinfo_.sslClientComprMethods =
-      std::make_shared<std::string>(sock->getSSLClientComprMethods());
-  tinfo_.sslClientExts =
-      std::make_shared<std::string>(sock->getSSLClientExts());
-  tinfo_.sslClientSigAlgs =
-      std::make_shared<std::string>(sock->getSSLClientSigAlgs());
-  tinfo_.sslNextProtocol = std::make_shared<std::string>();
-  tinfo_.sslNextProtocol->assign(reinterpret_cast<const char*>(nextProto),
-                                nextProtoLength);
+#ifdef SSL_EARLY_DATA_ACCEPTED
+  tinfo_.sslEarlyData =
+    SSL_get_early_data_status(sock->getSSL()) == SSL_EARLY_DATA_ACCEPTED;
+#endif
+  if (clientHello_ && !clientHello_->empty()) {
+    tinfo_.sslClientHello = clientHello_;
+  }
+  if (parseClientHello_) {
+    tinfo_.sslClientCiphers = std::make_shared<std::string>();
+    sock->getSSLClientCiphers(*tinfo_.sslClientCiphers);
+    tinfo_.sslClientCiphersHex = std::make_shared<std::string>();
+    sock->getSSLClientCiphers(
+        *tinfo_.sslClientCiphersHex, /* convertToString = */ false);
+    tinfo_.sslClientComprMethods =
+        std::make_shared<std::string>(sock->getSSLClientComprMethods());
+    tinfo_.sslClientExts =
+        std::make_shared<std::string>(sock->getSSLClientExts());
+    tinfo_.sslClientSigAlgs =
+        std::make_shared<std::string>(sock->getSSLClientSigAlgs());
+  }
+  std::string serverCiphers;
+  sock->getSSLServerCiphers(serverCiphers);
+  tinfo_.sslServerCiphers = TransportInfo::internString(serverCiphers);
+  tinfo_.sslNextProtocol = TransportInfo::internString(
+      folly::StringPiece(reinterpret_cast<const char*>(nextProto),
+                         nextProtoLength));
 
   acceptor_->updateSSLStats(
     sock,
     tinfo_.sslSetupTime,
     SSLErrorEnum::NO_ERROR
   );
+  recordTimings();
   auto nextProtocol = nextProto ?
     std::string((const char*)nextProto, nextProtoLength) : empty_string;
 
+  if (acceptor_->getConfig().kernelTLS) {
+    if (auto plain = KernelTLS::offload(socket_)) {
+      VLOG(4) << "TLS records of the connection are handled by the kernel";
+      // The callback will delete this.
+      callback_->connectionReady(
+          std::move(plain),
+          std::move(nextProtocol),
+          SecureTransportType::TLS);
+      return;
+    }
+  }
+
   // The callback will delete this.
   callback_->connectionReady(
       std::move(socket_),
@@ -96,7 +244,7 @@ void SSLAcceptorHandshakeHelper::handshakeSuc(AsyncSSLSocket* sock) noexcept {
       SecureTransportType::TLS);
 }
 
-void SSLAcceptorHandshakeHelper::handshakeErr(
+void SSLAcceptorHandshakeHelper::failHandshake(
     AsyncSSLSocket* sock,
     const AsyncSocketException& ex) noexcept {
   auto elapsedTime =
@@ -107,6 +255,7 @@ void SSLAcceptorHandshakeHelper::handshakeErr(
       sock->getRawBytesWritten() << " bytes sent: " <<
       ex.what();
   acceptor_->updateSSLStats(sock, elapsedTime, sslError_);
+  recordTimings();
   auto sslEx = folly::make_exception_wrapper<SSLException>(
       sslError_, elapsedTime, sock->getRawBytesReceived());
 
@@ -37,10 +37,7 @@ class SSLAcceptorHandshakeHelper : public AcceptorHandshakeHelper,
       AcceptorHandshakeHelper::Callback* callback) noexcept override;
 
   virtual void dropConnection(
-      SSLErrorEnum reason = SSLErrorEnum::NO_ERROR) override {
-    sslError_ = reason;
-    socket_->closeNow();
-  }
+      SSLErrorEnum reason = SSLErrorEnum::NO_ERROR) override;
 
  protected:
   // AsyncSSLSocket::HandshakeCallback API
@@ -48,6 +45,30 @@ class SSLAcceptorHandshakeHelper : public AcceptorHandshakeHelper,
   void handshakeErr(folly::AsyncSSLSocket* sock,
                     const folly::AsyncSocketException& ex) noexcept override;
 
+  // Called on the acceptor's thread once the handshake is over
+  void finishHandshake(folly::AsyncSSLSocket* sock) noexcept;
+  void failHandshake(folly::AsyncSSLSocket* sock,
+                     const folly::AsyncSocketException& ex) noexcept;
+
+  // Only touched on the thread running an offloaded handshake
+  struct OffloadState {
+    // While the socket is attached to that thread's EventBase
+    folly::AsyncSSLSocket* socket{nullptr};
+  };
+
+  // Moves the socket to handshakeBase, where sslAccept() is then called
+  void offloadHandshake(folly::EventBase* handshakeBase);
+  // From handshakeBase's thread, moves the socket back to the acceptor's
+  // thread and runs func there
+  void returnToAcceptor(folly::Func func);
+
+  // On the thread running the handshake, right before sslAccept()
+  void startTiming(folly::AsyncSSLSocket* sock);
+  // And right after it's over
+  void stopTiming(folly::AsyncSSLSocket* sock);
+  // Reports the timings, on the acceptor's thread
+  void recordTimings();
+
   folly::AsyncSSLSocket::UniquePtr socket_;
   Acceptor* acceptor_;
   AcceptorHandshakeHelper::Callback* callback_;
@@ -55,6 +76,15 @@ class SSLAcceptorHandshakeHelper : public AcceptorHandshakeHelper,
   std::chrono::steady_clock::time_point acceptTime_;
   TransportInfo& tinfo_;
   SSLErrorEnum sslError_{SSLErrorEnum::NO_ERROR};
+  // Set while the handshake runs on another thread
+  folly::EventBase* handshakeBase_{nullptr};
+  std::shared_ptr<OffloadState> offload_;
+  // Set if this handshake is sampled for timing
+  std::shared_ptr<SSLHandshakeTimings> timings_;
+  // Set if this handshake's ClientHello is parsed by the socket
+  bool parseClientHello_{false};
+  // Set if it's kept as received instead
+  std::shared_ptr<SSLClientHello> clientHello_;
 };
 
 class SSLAcceptorHandshakeManager : public AcceptorHandshakeManager {
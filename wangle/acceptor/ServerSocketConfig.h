@@ -85,11 +85,65 @@ struct ServerSocketConfig {
    */
   uint32_t acceptBacklog{1024};
 
+  /**
+   * The number of TCP Fast Open connections that may be pending before
+   * falling back to regular handshakes, so that clients with a cookie can
+   * send their first request in the SYN. 0 disables TFO, which also needs
+   * the server bit of the net.ipv4.tcp_fastopen sysctl on Linux.
+   */
+  uint32_t fastOpenQueueSize{0};
+
+  /**
+   * Accept connections only once the client sent data, or after this
+   * long, through TCP_DEFER_ACCEPT on Linux; so connections opened ahead of
+   * time cost no accept or handshake work until they are used. 0 accepts
+   * them as soon as they are established.
+   */
+  std::chrono::seconds deferAcceptTimeout{0};
+
+  /**
+   * Expect a PROXY protocol (v1 or v2) header at the start of every
+   * connection, as L4 load balancers send it, and take the client address
+   * from it before load shedding, handshakes and everything else, which
+   * would otherwise see the load balancer's. The load balancer's address is
+   * kept in TransportInfo::clientAddrOriginal. Connections without a valid
+   * header within proxyProtocolTimeout are dropped.
+   */
+  bool proxyProtocol{false};
+  std::chrono::milliseconds proxyProtocolTimeout{5000};
+
   /**
    * The number of milliseconds a connection can be idle before we close it.
    */
   std::chrono::milliseconds connectionIdleTimeout{600000};
 
+  /**
+   * Spread the graceful shutdown of each acceptor's connections over this
+   * long, rather than notifying and closing them all at once (see
+   * ConnectionManager::setDrainDuration()); 0 drains at once.
+   */
+  std::chrono::milliseconds gracefulDrainDuration{0};
+
+  /**
+   * While BufferAccounting::get() is over its limit, each acceptor drops up
+   * to this many idle connections every bufferLimitCheckInterval (see
+   * ConnectionManager::setBufferLimitShedding()); 0 disables it.
+   */
+  uint32_t bufferLimitShedBatchSize{0};
+  std::chrono::milliseconds bufferLimitCheckInterval{100};
+
+  /**
+   * Shrink connectionIdleTimeout down to this under pressure, checked every
+   * adaptiveIdleCheckInterval (see Acceptor::getIdlePressure() and
+   * ConnectionManager::setAdaptiveIdleTimeout()); 0 disables it. Pressure
+   * rises as the load sampler's memory use goes from adaptiveIdleMemUsage
+   * to the load shed configuration's maxMemUsage, and as the connection
+   * counter's connections go from half its maximum to all of it.
+   */
+  std::chrono::milliseconds adaptiveIdleMinTimeout{0};
+  std::chrono::milliseconds adaptiveIdleCheckInterval{1000};
+  double adaptiveIdleMemUsage{0.6};
+
   /**
    * The address to bind to.
    */
@@ -116,11 +170,51 @@ struct ServerSocketConfig {
    */
   bool strictSSL{true};
 
+  /**
+   * Once a TLS handshake is over, hand the connection's record encryption
+   * over to the kernel where it can be (see KernelTLS), and the pipeline a
+   * plain socket, which FileRegion can sendfile() over. Connections that
+   * can't be offloaded stay in userspace TLS.
+   */
+  bool kernelTLS{false};
+
+  /**
+   * Time the stages of 1 in this many SSL handshakes, see
+   * SSLHandshakeTimings; 0 times none.
+   */
+  uint32_t sslHandshakeTimingSampleRate{0};
+
+  /**
+   * Parse the ClientHello of 1 in this many SSL handshakes, when the SSL
+   * contexts ask for it (SSLContextConfig::clientHelloParsingEnabled);
+   * 0 parses none.
+   */
+  uint32_t sslClientHelloSampleRate{1};
+
+  /**
+   * Keep the ClientHellos parsed as received, in TransportInfo's
+   * sslClientHello, decoded only when asked for, rather than filling the
+   * sslClient* strings of TransportInfo for every connection.
+   */
+  bool sslClientHelloLazy{false};
+
   /**
    * Maximum number of concurrent pending SSL handshakes
    */
   uint32_t maxConcurrentSSLHandshakes{30720};
 
+  /**
+   * Maximum number of idle pipelines each acceptor keeps for reuse when the
+   * pipeline factory supports recycling (see PipelineFactory).
+   */
+  uint32_t maxRecycledPipelines{128};
+
+  /**
+   * Lazy SSL contexts (see SSLContextConfig::lazy) each acceptor keeps
+   * built at most, dropping the least recently used; 0 for no limit.
+   */
+  uint32_t maxLazySSLContexts{256};
+
  private:
   folly::AsyncSocket::OptionMap socketOptions_;
 };
@@ -9,6 +9,8 @@
  */
 #include <wangle/acceptor/SocketOptions.h>
 
+#include <algorithm>
+#include <cerrno>
 #include <netinet/tcp.h>
 #include <sys/socket.h>
 
@@ -25,6 +27,14 @@ AsyncSocket::OptionMap filterIPSocketOptions(
     exclude = IPPROTO_IPV6;
   } else if (addrFamily == AF_INET6) {
     exclude = IPPROTO_IP;
+  } else if (addrFamily == AF_UNIX) {
+    // Neither IP nor TCP
+    for (const auto& opt: allOptions) {
+      if (opt.first.level == SOL_SOCKET) {
+        opts[opt.first] = opt.second;
+      }
+    }
+    return opts;
   } else {
     LOG(FATAL) << "Address family " << addrFamily << " was not IPv4 or IPv6";
     return opts;
@@ -37,4 +47,26 @@ AsyncSocket::OptionMap filterIPSocketOptions(
   return opts;
 }
 
+bool setNotSentLowWatermark(int fd, uint32_t bytes) {
+#ifdef TCP_NOTSENT_LOWAT
+  return setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT,
+                    &bytes, sizeof(bytes)) == 0;
+#else
+  errno = ENOPROTOOPT;
+  return false;
+#endif
+}
+
+bool setMaxPacingRate(int fd, uint64_t bytesPerSecond) {
+#ifdef SO_MAX_PACING_RATE
+  // Older kernels only take 32 bits, where ~0U means unlimited
+  uint32_t rate = std::min<uint64_t>(bytesPerSecond, ~0U - 1);
+  return setsockopt(fd, SOL_SOCKET, SO_MAX_PACING_RATE,
+                    &rate, sizeof(rate)) == 0;
+#else
+  errno = ENOPROTOOPT;
+  return false;
+#endif
+}
+
 } // namespace wangle
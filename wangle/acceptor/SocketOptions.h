@@ -15,10 +15,24 @@ namespace wangle {
 
 /**
  * Returns a copy of the socket options excluding options with the given
- * level.
+ * level. Of SOL_SOCKET only for AF_UNIX.
  */
 folly::AsyncSocket::OptionMap filterIPSocketOptions(
   const folly::AsyncSocket::OptionMap& allOptions,
   const int addrFamily);
 
+/**
+ * Limits the data queued in the kernel but not yet sent to bytes
+ * (TCP_NOTSENT_LOWAT), so the socket only becomes writable once there is
+ * room under that. Returns false, with errno set, if the kernel refuses.
+ */
+bool setNotSentLowWatermark(int fd, uint32_t bytes);
+
+/**
+ * Caps the rate the socket sends at (SO_MAX_PACING_RATE), enforced by the
+ * fq qdisc or, on newer kernels, by TCP itself. Rates above 4GB/s are
+ * capped there. Returns false, with errno set, if the kernel refuses.
+ */
+bool setMaxPacingRate(int fd, uint64_t bytesPerSecond);
+
 } // namespace wangle
@@ -0,0 +1,61 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <wangle/acceptor/SecureTransportType.h>
+#include <wangle/acceptor/TransportInfo.h>
+
+#include <folly/SocketAddress.h>
+#include <folly/io/async/AsyncSocket.h>
+
+#include <string>
+
+namespace wangle {
+
+/**
+ * Picks socket options per connection, on top of the static ones of
+ * ServerSocketConfig::setSocketOptions(), which have already been applied
+ * by then. Set it with Acceptor::setSocketTuningPolicy().
+ *
+ * For instance, a bulk transfer service might set a small TCP_NOTSENT_LOWAT
+ * so less data sits in kernel buffers, and cap SO_MAX_PACING_RATE only for
+ * connections with a high RTT. To retune a connection later, once its
+ * traffic is known, see setNotSentLowWatermark() and setMaxPacingRate().
+ *
+ * Both methods are called in the acceptor's thread and must be cheap.
+ */
+class SocketTuningPolicy {
+ public:
+  virtual ~SocketTuningPolicy() {}
+
+  /**
+   * Called by Acceptor::processEstablishedConnection(), before the SSL
+   * handshake, if any. tinfo holds whatever the caller filled in, such as
+   * routing data; nothing has been read from the socket yet.
+   */
+  virtual folly::AsyncSocket::OptionMap getAcceptOptions(
+      const folly::SocketAddress& /*clientAddr*/,
+      const TransportInfo& /*tinfo*/) {
+    return folly::AsyncSocket::OptionMap();
+  }
+
+  /**
+   * Called once the connection is ready to hand to onNewConnection(), with
+   * tinfo filled in from TCP_INFO (rtt, cwnd, mss) and the handshake.
+   */
+  virtual folly::AsyncSocket::OptionMap getEstablishedOptions(
+      const TransportInfo& /*tinfo*/,
+      SecureTransportType /*secureTransportType*/,
+      const std::string& /*nextProtocolName*/) {
+    return folly::AsyncSocket::OptionMap();
+  }
+};
+
+} // namespace wangle
@@ -0,0 +1,291 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/acceptor/SystemLoadSampler.h>
+
+#include <folly/Conv.h>
+#include <folly/FileUtil.h>
+#include <folly/Singleton.h>
+#include <folly/String.h>
+
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+#include <vector>
+
+using folly::StringPiece;
+
+namespace {
+
+struct SystemLoadSamplerTag {};
+
+folly::Singleton<wangle::SystemLoadSampler, SystemLoadSamplerTag> sampler(
+  []{
+    auto s = new wangle::SystemLoadSampler();
+    s->start();
+    return s;
+  });
+
+bool parse(StringPiece s, uint64_t& value) {
+  try {
+    value = folly::to<uint64_t>(folly::trimWhitespace(s));
+    return true;
+  } catch (const std::range_error&) {
+    return false;
+  }
+}
+
+bool readFile(const std::string& path, std::string& out) {
+  out.clear();
+  return folly::readFile(path.c_str(), out) && !out.empty();
+}
+
+// The value of the "key value [kB]" line of key, multiplied by unit
+bool findField(StringPiece data, StringPiece key, uint64_t unit,
+               uint64_t& value) {
+  std::vector<StringPiece> lines;
+  folly::split('\n', data, lines);
+  for (auto line : lines) {
+    if (!line.startsWith(key) || line.size() == key.size() ||
+        !isspace(line[key.size()])) {
+      continue;
+    }
+    line.advance(key.size());
+    if (!parse(line.subpiece(0, line.find(" kB")), value)) {
+      return false;
+    }
+    value *= unit;
+    return true;
+  }
+  return false;
+}
+
+bool readLimit(const std::string& path, uint64_t& value) {
+  std::string data;
+  return readFile(path, data) && parse(data, value);
+}
+
+uint64_t nowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+namespace wangle {
+
+constexpr size_t SystemLoadSampler::kMaxWindowSize;
+
+std::shared_ptr<SystemLoadSampler> SystemLoadSampler::get() {
+  return sampler.try_get();
+}
+
+SystemLoadSampler::SystemLoadSampler(
+    std::chrono::milliseconds period,
+    std::string procRoot,
+    std::string cgroupRoot)
+  : procRoot_(std::move(procRoot)),
+    cgroupRoot_(std::move(cgroupRoot)),
+    period_(period.count()) {
+  for (auto& usage : cpuUsages_) {
+    usage.store(0, std::memory_order_relaxed);
+  }
+}
+
+SystemLoadSampler::~SystemLoadSampler() {
+  stop();
+}
+
+void SystemLoadSampler::start() {
+  std::lock_guard<std::mutex> g(mutex_);
+  if (running_) {
+    return;
+  }
+  running_ = true;
+  thread_ = std::thread([this] { run(); });
+}
+
+void SystemLoadSampler::stop() {
+  {
+    std::lock_guard<std::mutex> g(mutex_);
+    if (!running_) {
+      return;
+    }
+    running_ = false;
+  }
+  cv_.notify_all();
+  thread_.join();
+}
+
+void SystemLoadSampler::run() {
+  std::unique_lock<std::mutex> l(mutex_);
+  while (running_) {
+    l.unlock();
+    sample();
+    l.lock();
+    cv_.wait_for(l, std::chrono::milliseconds(period_.load()),
+                 [this] { return !running_; });
+  }
+}
+
+void SystemLoadSampler::sample() {
+  std::lock_guard<std::mutex> g(sampleMutex_);
+  CpuTimes times;
+  if (readCpuTimes(times)) {
+    if (haveCpuTimes_ && times.cgroup == lastCpuTimes_.cgroup &&
+        times.total > lastCpuTimes_.total &&
+        times.busy >= lastCpuTimes_.busy) {
+      double usage = double(times.busy - lastCpuTimes_.busy) /
+        (times.total - lastCpuTimes_.total);
+      usage = std::min(1.0, usage);
+      cpuUsage_.store(usage, std::memory_order_relaxed);
+      auto n = numCpuSamples_.load(std::memory_order_relaxed);
+      cpuUsages_[n % kMaxWindowSize].store(usage, std::memory_order_relaxed);
+      numCpuSamples_.store(n + 1, std::memory_order_release);
+    }
+    lastCpuTimes_ = times;
+    haveCpuTimes_ = true;
+  }
+  sampleMem();
+}
+
+bool SystemLoadSampler::readCpuTimes(CpuTimes& times) {
+  std::string data;
+  // A cgroup v2 quota, e.g. "50000 100000" for half a CPU
+  if (readFile(cgroupRoot_ + "/cpu.max", data)) {
+    std::vector<StringPiece> fields;
+    folly::split(' ', folly::trimWhitespace(data), fields);
+    uint64_t quota, period, usageUs;
+    if (fields.size() == 2 && parse(fields[0], quota) &&
+        parse(fields[1], period) && period > 0) {
+      if (readFile(cgroupRoot_ + "/cpu.stat", data) &&
+          findField(data, "usage_usec", 1, usageUs)) {
+        times.busy = usageUs;
+        times.total = uint64_t(nowUs() * (double(quota) / period));
+        times.cgroup = true;
+        return true;
+      }
+    }
+  }
+
+  if (!readFile(procRoot_ + "/stat", data)) {
+    return false;
+  }
+  // cpu  user nice system idle iowait irq softirq steal guest guest_nice;
+  // guest time is already counted in user time
+  auto line = StringPiece(data).subpiece(0, data.find('\n'));
+  if (!line.startsWith("cpu ")) {
+    return false;
+  }
+  line.advance(4);
+  std::vector<StringPiece> fields;
+  folly::split(' ', folly::trimWhitespace(line), fields, true);
+  if (fields.size() < 5) {
+    return false;
+  }
+  uint64_t total = 0;
+  uint64_t idle = 0;
+  for (size_t i = 0; i < std::min<size_t>(fields.size(), 8); i++) {
+    uint64_t v;
+    if (!parse(fields[i], v)) {
+      return false;
+    }
+    total += v;
+    if (i == 3 || i == 4) {
+      idle += v;
+    }
+  }
+  times.busy = total - idle;
+  times.total = total;
+  times.cgroup = false;
+  return true;
+}
+
+void SystemLoadSampler::sampleMem() {
+  std::string data;
+  if (!readFile(procRoot_ + "/meminfo", data)) {
+    return;
+  }
+  uint64_t total;
+  uint64_t free;
+  if (!findField(data, "MemTotal:", 1024, total)) {
+    return;
+  }
+  if (!findField(data, "MemAvailable:", 1024, free)) {
+    // Kernels before 3.14
+    uint64_t buffers = 0;
+    uint64_t cached = 0;
+    if (!findField(data, "MemFree:", 1024, free)) {
+      return;
+    }
+    findField(data, "Buffers:", 1024, buffers);
+    findField(data, "Cached:", 1024, cached);
+    free += buffers + cached;
+  }
+
+  uint64_t limit;
+  uint64_t usage;
+  bool limited;
+  if (readFile(cgroupRoot_ + "/memory.max", data)) {
+    // cgroup v2, where no limit is "max"
+    limited = parse(data, limit) &&
+      readLimit(cgroupRoot_ + "/memory.current", usage);
+  } else {
+    auto dir = cgroupRoot_ + "/memory";
+    limited = readLimit(dir + "/memory.limit_in_bytes", limit) &&
+      readLimit(dir + "/memory.usage_in_bytes", usage);
+  }
+  if (limited) {
+    // cgroup v1 reports no limit as a huge one
+    if (limit < total) {
+      total = limit;
+      free = std::min(free, limit > usage ? limit - usage : 0);
+    }
+  }
+  totalMem_.store(total, std::memory_order_relaxed);
+  freeMem_.store(std::min(free, total), std::memory_order_relaxed);
+}
+
+double SystemLoadSampler::getMemUsage() const {
+  auto total = getTotalMem();
+  if (total == 0) {
+    return 0;
+  }
+  return 1 - double(std::min(getFreeMem(), total)) / total;
+}
+
+bool SystemLoadSampler::isCpuOverloaded(
+    const LoadShedConfiguration& config) const {
+  auto window = std::max<uint64_t>(1, std::min<uint64_t>(
+      config.getCpuUsageExceedWindowSize(), kMaxWindowSize));
+  auto n = numCpuSamples_.load(std::memory_order_acquire);
+  if (n < window) {
+    return false;
+  }
+  for (uint64_t i = n - window; i < n; i++) {
+    auto usage = cpuUsages_[i % kMaxWindowSize].load(
+        std::memory_order_relaxed);
+    if (usage <= config.getMaxCpuUsage() &&
+        1 - usage >= config.getMinCpuIdle()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SystemLoadSampler::isMemOverloaded(
+    const LoadShedConfiguration& config) const {
+  if (getTotalMem() == 0) {
+    return false;
+  }
+  return getMemUsage() > config.getMaxMemUsage() ||
+    getFreeMem() < config.getMinFreeMem();
+}
+
+} // namespace wangle
@@ -0,0 +1,122 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <wangle/acceptor/LoadShedConfiguration.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace wangle {
+
+/**
+ * Samples the CPU and memory use of the system, or of the process' cgroup
+ * when it is limited more tightly, from a background thread, and publishes
+ * the latest values for any thread to read without locking. This is what
+ * gives the CPU and memory thresholds of LoadShedConfiguration effect: see
+ * Acceptor::setLoadSampler().
+ *
+ * CPU use comes from /proc/stat, or from the cgroup's cpu.stat against its
+ * cpu.max quota (cgroup v2). Free memory is MemAvailable of /proc/meminfo,
+ * capped by what is left under the cgroup's memory.max (v2) or
+ * memory.limit_in_bytes (v1).
+ */
+class SystemLoadSampler {
+ public:
+  // The process-wide sampler, sampling every second from first use
+  static std::shared_ptr<SystemLoadSampler> get();
+
+  // The roots are for tests; nothing is sampled until start() or sample()
+  explicit SystemLoadSampler(
+      std::chrono::milliseconds period = std::chrono::seconds(1),
+      std::string procRoot = "/proc",
+      std::string cgroupRoot = "/sys/fs/cgroup");
+
+  ~SystemLoadSampler();
+
+  void start();
+  void stop();
+
+  void setPeriod(std::chrono::milliseconds period) {
+    period_ = period.count();
+  }
+
+  // Takes a sample now. CPU use is over the time since the previous one.
+  void sample();
+
+  // Of the last sample, between 0 and 1
+  double getCpuUsage() const {
+    return cpuUsage_.load(std::memory_order_relaxed);
+  }
+
+  // In bytes, 0 until memory is sampled
+  uint64_t getTotalMem() const {
+    return totalMem_.load(std::memory_order_relaxed);
+  }
+  uint64_t getFreeMem() const {
+    return freeMem_.load(std::memory_order_relaxed);
+  }
+
+  // Between 0 and 1
+  double getMemUsage() const;
+
+  /**
+   * Whether CPU use was above config's maxCpuUsage, or CPU idle below its
+   * minCpuIdle, for each of the last cpuUsageExceedWindowSize samples
+   * (at least one, and at most kMaxWindowSize).
+   */
+  bool isCpuOverloaded(const LoadShedConfiguration& config) const;
+
+  // Whether memory use is above config's maxMemUsage, or free memory below
+  // its minFreeMem
+  bool isMemOverloaded(const LoadShedConfiguration& config) const;
+
+  static constexpr size_t kMaxWindowSize = 64;
+
+ private:
+  struct CpuTimes {
+    // Of the system, in jiffies, or of the cgroup, in microseconds
+    uint64_t busy{0};
+    uint64_t total{0};
+    bool cgroup{false};
+  };
+
+  bool readCpuTimes(CpuTimes& times);
+  void sampleMem();
+  void run();
+
+  const std::string procRoot_;
+  const std::string cgroupRoot_;
+  std::atomic<int64_t> period_;
+
+  // Only touched by sample()
+  std::mutex sampleMutex_;
+  CpuTimes lastCpuTimes_;
+  bool haveCpuTimes_{false};
+
+  std::atomic<double> cpuUsage_{0};
+  std::array<std::atomic<double>, kMaxWindowSize> cpuUsages_;
+  std::atomic<uint64_t> numCpuSamples_{0};
+  std::atomic<uint64_t> totalMem_{0};
+  std::atomic<uint64_t> freeMem_{0};
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool running_{false};
+  std::thread thread_;
+};
+
+} // namespace wangle
@@ -11,14 +11,50 @@
 
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <folly/SocketAddress.h>
+#include <folly/ThreadLocal.h>
 #include <folly/io/async/AsyncSocket.h>
 
+#include <utility>
+#include <vector>
+
 using std::chrono::microseconds;
 using std::map;
 using std::string;
 
+namespace {
+
+// Few enough that a linear scan is cheap; values past that aren't interned
+constexpr size_t kMaxInternedStrings = 64;
+
+folly::ThreadLocal<std::vector<std::shared_ptr<string>>> internedStrings;
+
+}
+
 namespace wangle {
 
+void TransportInfo::setAddresses(const folly::SocketAddress& local,
+                                 const folly::SocketAddress& remote) {
+  auto addrs = std::make_shared<
+    std::pair<folly::SocketAddress, folly::SocketAddress>>(local, remote);
+  localAddr = std::shared_ptr<folly::SocketAddress>(addrs, &addrs->first);
+  remoteAddr = std::shared_ptr<folly::SocketAddress>(addrs, &addrs->second);
+}
+
+std::shared_ptr<string> TransportInfo::internString(folly::StringPiece str) {
+  auto& strings = *internedStrings;
+  for (const auto& s : strings) {
+    if (s->size() == str.size() && folly::StringPiece(*s) == str) {
+      return s;
+    }
+  }
+  auto s = std::make_shared<string>(str.data(), str.size());
+  if (strings.size() < kMaxInternedStrings) {
+    strings.push_back(s);
+  }
+  return s;
+}
+
 bool TransportInfo::initWithSocket(const folly::AsyncSocket* sock) {
 #if defined(__linux__) || defined(__FreeBSD__)
   if (!TransportInfo::readTcpInfo(&tcpinfo, sock)) {
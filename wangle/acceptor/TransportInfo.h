@@ -9,15 +9,21 @@
  */
 #pragma once
 
+#include <wangle/ssl/SSLClientHello.h>
+#include <wangle/ssl/SSLHandshakeTimings.h>
 #include <wangle/ssl/SSLUtil.h>
 
+#include <folly/Range.h>
+
 #include <chrono>
+#include <memory>
 #include <netinet/tcp.h>
 #include <string>
 
 namespace folly {
 
 class AsyncSocket;
+class SocketAddress;
 
 }
 
@@ -99,9 +105,15 @@ struct TransportInfo {
    */
   std::chrono::milliseconds sslSetupTime{0};
 
+  /*
+   * When the stages of the SSL handshake were reached, if it was sampled
+   * (see ServerSocketConfig::sslHandshakeTimingSampleRate)
+   */
+  std::shared_ptr<SSLHandshakeTimings> sslHandshakeTimings{nullptr};
+
   /*
    * The name of the SSL ciphersuite used by the transaction's
-   * transport.  Returns null if the transport is not SSL.
+   * transport.  Returns null if the transport is not SSL. Interned.
    */
   std::shared_ptr<std::string> sslCipher{nullptr};
 
@@ -112,7 +124,15 @@ struct TransportInfo {
   std::shared_ptr<std::string> sslServerName{nullptr};
 
   /*
-   * list of ciphers sent by the client
+   * The client hello as received, if the acceptor keeps them (see
+   * ServerSocketConfig::sslClientHelloLazy), in which case the client
+   * hello fields below are left unset: its getters return them instead.
+   */
+  std::shared_ptr<SSLClientHello> sslClientHello{nullptr};
+
+  /*
+   * list of ciphers sent by the client. This and the other client hello
+   * fields below are only set if the acceptor parses client hellos.
    */
   std::shared_ptr<std::string> sslClientCiphers{nullptr};
 
@@ -142,7 +162,7 @@ struct TransportInfo {
   std::shared_ptr<std::string> sslSignature{nullptr};
 
   /*
-   * list of ciphers supported by the server
+   * list of ciphers supported by the server. Interned.
    */
   std::shared_ptr<std::string> sslServerCiphers{nullptr};
 
@@ -152,7 +172,7 @@ struct TransportInfo {
   std::shared_ptr<std::string> guessedUserAgent{nullptr};
 
   /**
-   * The result of SSL NPN negotiation.
+   * The result of SSL NPN negotiation. Interned.
    */
   std::shared_ptr<std::string> sslNextProtocol{nullptr};
 
@@ -164,6 +184,7 @@ struct TransportInfo {
   /**
    * the address of the remote side. If this is associated with a client socket,
    * it is a server side address. Otherwise, it is a client side address.
+   * See setAddresses().
    */
   std::shared_ptr<folly::SocketAddress> remoteAddr;
 
@@ -175,7 +196,8 @@ struct TransportInfo {
 
   /**
    * If the client passed through one of our L4 proxies (using PROXY Protocol),
-   * then this will contain the IP address of the proxy host.
+   * then this will contain the IP address of the proxy host. Filled by the
+   * Acceptor with ServerSocketConfig::proxyProtocol.
    */
   std::shared_ptr<folly::SocketAddress> clientAddrOriginal;
 
@@ -293,7 +315,7 @@ struct TransportInfo {
   uint16_t sslVersion{0};
 
   /*
-   * The signature algorithm used in the certificate.
+   * The signature algorithm used in the certificate. Interned.
    */
   std::shared_ptr<std::string> sslCertSigAlgName{nullptr};
 
@@ -313,6 +335,13 @@ struct TransportInfo {
    */
   SSLResumeEnum sslResume{SSLResumeEnum::NA};
 
+  /*
+   * true if the client's TLS 1.3 early data was accepted: what it sent
+   * before the handshake finished may be a replay, from a recording of
+   * another connection, and should only carry idempotent requests.
+   */
+  bool sslEarlyData{false};
+
   /*
    * true if the tcpinfo was successfully read from the kernel
    */
@@ -328,6 +357,20 @@ struct TransportInfo {
    */
   std::shared_ptr<ProtocolInfo> protocolInfo{nullptr};
 
+  /*
+   * Sets localAddr and remoteAddr, sharing a single allocation
+   */
+  void setAddresses(const folly::SocketAddress& local,
+                    const folly::SocketAddress& remote);
+
+  /*
+   * A string shared with the other TransportInfos of this thread with the
+   * same value, for the fields marked interned: they have few distinct
+   * values, so this saves a copy and an allocation per connection. Interned
+   * strings must not be modified.
+   */
+  static std::shared_ptr<std::string> internString(folly::StringPiece str);
+
   /*
    * get the RTT value in milliseconds
    */
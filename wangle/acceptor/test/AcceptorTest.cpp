@@ -11,6 +11,9 @@
 
 #include <gtest/gtest.h>
 
+#include <thread>
+#include <vector>
+
 using namespace folly;
 using namespace testing;
 
@@ -41,6 +44,7 @@ class TestableAcceptor : public Acceptor {
     }
 
     using Acceptor::setLoadShedConfig;
+    using Acceptor::setConnectionCountCached;
     using Acceptor::canAccept;
 
   protected:
@@ -63,6 +67,7 @@ class AcceptorTest : public Test {
     }
 
     SocketAddress address_ { "127.0.0.1", 2000 };
+    EventBase base_;
     TestableAcceptor acceptor_ { ServerSocketConfig() };
     LoadShedConfiguration loadShedConfig_;
     SimpleConnectionCounterForTest connectionCounter_;
@@ -157,4 +162,77 @@ TEST_F(AcceptorTest, TestCanAcceptWithBothConnectionCountsBreachingThresholds) {
   EXPECT_FALSE(acceptor_.canAccept(address_));
 }
 
+TEST_F(AcceptorTest, TestCanAcceptWithCachedConnectionCount) {
+  acceptor_.init(nullptr, &base_);
+  acceptor_.setConnectionCountCached(true);
+  connectionCounter_.setNumConnections(100);
+  connectionCounter_.setMaxConnections(200);
+  EXPECT_TRUE(acceptor_.canAccept(address_));
+  // Not read again until the next loop iteration
+  connectionCounter_.setNumConnections(300);
+  EXPECT_TRUE(acceptor_.canAccept(address_));
+  base_.loopOnce();
+  EXPECT_FALSE(acceptor_.canAccept(address_));
+}
+
+class TestAcceptorStats : public AcceptorStats {
+ public:
+  void recordConnectionAccepted() noexcept override {}
+  void recordConnectionRejected(AcceptRejectReason reason) noexcept override {
+    rejected.push_back(reason);
+  }
+  void recordAcceptError() noexcept override {}
+  void recordHandshakeStartLatency(std::chrono::microseconds) noexcept
+    override {}
+  void recordHandshake(SecureTransportType, std::chrono::milliseconds)
+    noexcept override {}
+  void recordHandshakeError(SSLErrorEnum, std::chrono::milliseconds)
+    noexcept override {}
+  void recordAcceptBacklog(uint32_t, uint32_t) noexcept override {}
+
+  std::vector<AcceptRejectReason> rejected;
+};
+
+TEST_F(AcceptorTest, TestCanAcceptRecordsRejections) {
+  TestAcceptorStats stats;
+  acceptor_.setAcceptorStats(&stats);
+  connectionCounter_.setNumConnections(100);
+  connectionCounter_.setMaxConnections(200);
+  EXPECT_TRUE(acceptor_.canAccept(address_));
+  EXPECT_TRUE(stats.rejected.empty());
+
+  connectionCounter_.setNumConnections(300);
+  EXPECT_FALSE(acceptor_.canAccept(address_));
+  ASSERT_EQ(1, stats.rejected.size());
+  EXPECT_EQ(AcceptRejectReason::MAX_CONNECTIONS, stats.rejected[0]);
+}
+
+TEST(ShardedConnectionCounterTest, CountsAcrossThreads) {
+  ShardedConnectionCounter counter(4);
+  counter.setMaxConnections(1000);
+  EXPECT_EQ(1000, counter.getMaxConnections());
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; i++) {
+    threads.emplace_back([&] {
+      for (int j = 0; j < 1000; j++) {
+        counter.onConnectionAdded();
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  EXPECT_EQ(0, counter.getCachedNumConnections());
+  EXPECT_EQ(8000, counter.getNumConnections());
+  EXPECT_EQ(8000, counter.getCachedNumConnections());
+
+  // Removed on other threads than they were added on
+  std::thread([&] {
+    for (int j = 0; j < 3000; j++) {
+      counter.onConnectionRemoved();
+    }
+  }).join();
+  EXPECT_EQ(5000, counter.getNumConnections());
+}
+
 } // namespace wangle
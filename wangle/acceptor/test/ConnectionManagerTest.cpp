@@ -8,6 +8,7 @@
  *
  */
 #include <wangle/acceptor/ConnectionManager.h>
+#include <wangle/acceptor/TransportInfo.h>
 
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
@@ -56,6 +57,7 @@ class MockConnection : public ManagedConnection {
   MOCK_METHOD0(closeWhenIdle, void());
   MOCK_METHOD0(dropConnection, void());
   MOCK_METHOD1(dumpConnectionState, void(uint8_t));
+  MOCK_METHOD0(sampleTcpInfo, const TransportInfo*());
 
   void setIdle(bool idle) {
     idle_ = idle;
@@ -182,6 +184,28 @@ TEST_F(ConnectionManagerTest, testIdleGraceTimeout) {
   eventBase_.loop();
 }
 
+TEST_F(ConnectionManagerTest, testPacedDrain) {
+  size_t notified = 0;
+  size_t closed = 0;
+  for (const auto& conn: conns_) {
+    EXPECT_CALL(*conn, notifyPendingShutdown())
+      .WillOnce(Invoke([&] { notified++; }));
+    EXPECT_CALL(*conn, closeWhenIdle())
+      .WillOnce(Invoke([&] { closed++; }));
+  }
+  // 5 steps of 13 connections for each pass
+  cm_->setDrainDuration(std::chrono::milliseconds(50),
+                        std::chrono::milliseconds(10));
+  const auto start = std::chrono::steady_clock::now();
+  cm_->initiateGracefulShutdown(std::chrono::milliseconds(1));
+  EXPECT_EQ(13, notified);
+  eventBase_.loop();
+  EXPECT_EQ(65, notified);
+  EXPECT_EQ(65, closed);
+  EXPECT_GE(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(70));
+}
+
 TEST_F(ConnectionManagerTest, testDropAll) {
   InSequence enforceOrder;
 
@@ -219,6 +243,149 @@ TEST_F(ConnectionManagerTest, testDropIdle) {
   cm_->dropIdleConnections(conns_.size());
 }
 
+TEST_F(ConnectionManagerTest, testDropIdlePaced) {
+  for (const auto& conn: conns_) {
+    EXPECT_CALL(*conn, getIdleTime())
+      .WillRepeatedly(Return(std::chrono::milliseconds(100)));
+    cm_->onDeactivated(*conn);
+  }
+  // The longest idle go first
+  for (auto i = 0; i < 40; i++) {
+    EXPECT_CALL(*conns_[i], timeoutExpired())
+      .WillOnce(Invoke([&, i] { cm_->removeConnection(conns_[i].get()); }));
+  }
+
+  std::vector<std::pair<size_t, bool>> progress;
+  cm_->dropIdleConnectionsPaced(40, 16, std::chrono::milliseconds(0),
+                                [&] (size_t dropped, bool done) {
+                                  progress.emplace_back(dropped, done);
+                                });
+  EXPECT_TRUE(cm_->isShedding());
+  EXPECT_EQ(49, cm_->getNumConnections());
+  eventBase_.loopOnce();
+  EXPECT_EQ(33, cm_->getNumConnections());
+  eventBase_.loop();
+  EXPECT_FALSE(cm_->isShedding());
+  EXPECT_EQ(25, cm_->getNumConnections());
+  EXPECT_EQ((std::vector<std::pair<size_t, bool>>{
+      {16, false}, {32, false}, {40, true}}), progress);
+}
+
+TEST_F(ConnectionManagerTest, testDropIdlePacedRunsOut) {
+  for (auto i = 0; i < 10; i++) {
+    EXPECT_CALL(*conns_[i], getIdleTime())
+      .WillRepeatedly(Return(std::chrono::milliseconds(100)));
+    EXPECT_CALL(*conns_[i], timeoutExpired())
+      .WillOnce(Invoke([&, i] { cm_->removeConnection(conns_[i].get()); }));
+    cm_->onDeactivated(*conns_[i]);
+  }
+
+  size_t dropped = 0;
+  bool done = false;
+  cm_->dropIdleConnectionsPaced(conns_.size(), 4,
+                                std::chrono::milliseconds(1),
+                                [&] (size_t d, bool dn) {
+                                  dropped = d;
+                                  done = dn;
+                                });
+  eventBase_.loop();
+  EXPECT_EQ(10, dropped);
+  EXPECT_TRUE(done);
+  EXPECT_EQ(55, cm_->getNumConnections());
+}
+
+TEST_F(ConnectionManagerTest, testAdaptiveIdleTimeout) {
+  // Idle the longest first, like the idle list
+  for (auto i = 0; i < 20; i++) {
+    EXPECT_CALL(*conns_[i], getIdleTime())
+      .WillRepeatedly(Return(std::chrono::milliseconds(i < 10 ? 80 : 20)));
+    cm_->onDeactivated(*conns_[i]);
+  }
+  for (auto i = 0; i < 10; i++) {
+    EXPECT_CALL(*conns_[i], timeoutExpired())
+      .WillOnce(Invoke([&, i] { cm_->removeConnection(conns_[i].get()); }));
+  }
+
+  double pressure = 0.5;
+  cm_->setAdaptiveIdleTimeout(std::chrono::milliseconds(1),
+                              std::chrono::milliseconds(10),
+                              [&] { return pressure; });
+  EXPECT_EQ(std::chrono::milliseconds(100), cm_->getIdleTimeout());
+  eventBase_.loopOnce();
+  EXPECT_EQ(std::chrono::milliseconds(55), cm_->getIdleTimeout());
+  EXPECT_EQ(55, cm_->getNumConnections());
+
+  pressure = 0;
+  eventBase_.loopOnce();
+  EXPECT_EQ(std::chrono::milliseconds(100), cm_->getIdleTimeout());
+  EXPECT_EQ(55, cm_->getNumConnections());
+
+  // Clamped to 1
+  for (auto i = 10; i < 20; i++) {
+    EXPECT_CALL(*conns_[i], timeoutExpired())
+      .WillOnce(Invoke([&, i] { cm_->removeConnection(conns_[i].get()); }));
+  }
+  pressure = 2;
+  eventBase_.loopOnce();
+  EXPECT_EQ(std::chrono::milliseconds(10), cm_->getIdleTimeout());
+  EXPECT_EQ(45, cm_->getNumConnections());
+  cm_->setAdaptiveIdleTimeout(std::chrono::milliseconds(0),
+                              std::chrono::milliseconds(0), nullptr);
+  EXPECT_EQ(std::chrono::milliseconds(100), cm_->getIdleTimeout());
+}
+
+TEST_F(ConnectionManagerTest, testTouchTimeout) {
+  auto conn = conns_[0].get();
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<bool> expired;
+  EXPECT_CALL(*conn, timeoutExpired())
+    .Times(2)
+    .WillRepeatedly(Invoke([&] {
+          expired.push_back(conn->checkIdleTimeout());
+        }));
+
+  conn->touchTimeout();
+  // Not moving the timeout, which fires early and is scheduled again
+  eventBase_.tryRunAfterDelay([&] { conn->touchTimeout(); }, 50);
+  eventBase_.loop();
+  EXPECT_EQ(std::vector<bool>({false, true}), expired);
+  EXPECT_GE(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(130));
+}
+
+TEST_F(ConnectionManagerTest, testTcpInfoSampling) {
+  TransportInfo tinfo;
+  tinfo.validTcpinfo = true;
+  tinfo.rtt = std::chrono::microseconds(2000);
+  tinfo.rtx = 0.01;
+  for (const auto& conn: conns_) {
+    EXPECT_CALL(*conn, sampleTcpInfo())
+      .WillRepeatedly(Return(&tinfo));
+  }
+
+  cm_->setTcpInfoSampling(std::chrono::milliseconds(1), 20);
+  eventBase_.loopOnce();
+  // The cursor is on the connection removed
+  removeConn(conns_[20].get());
+  size_t ticks = 1;
+  while (cm_->getTcpInfoStats().numSampled == 0 && ticks < 100) {
+    eventBase_.loopOnce();
+    ticks++;
+  }
+  EXPECT_EQ(4, ticks);
+
+  const auto& stats = cm_->getTcpInfoStats();
+  EXPECT_EQ(64, stats.numSampled);
+  EXPECT_EQ(64, stats.rtt.count());
+  EXPECT_LE(stats.rtt.getPercentile(50), std::chrono::microseconds(2000));
+  EXPECT_GT(stats.rtt.getPercentile(50), std::chrono::microseconds(1700));
+  EXPECT_LE(stats.rtxPpm.getPercentile(50), std::chrono::nanoseconds(10000));
+  EXPECT_GT(stats.rtxPpm.getPercentile(50), std::chrono::nanoseconds(8700));
+
+  cm_->setTcpInfoSampling(std::chrono::milliseconds(0));
+  eventBase_.loop();
+}
+
 TEST_F(ConnectionManagerTest, testAddDuringShutdown) {
   auto extraConn = MockConnection::makeUnique(this);
   InSequence enforceOrder;
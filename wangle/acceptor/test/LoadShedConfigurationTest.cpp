@@ -8,6 +8,7 @@
  *
  */
 #include <wangle/acceptor/LoadShedConfiguration.h>
+#include <wangle/acceptor/NetworkRanges.h>
 
 #include <gtest/gtest.h>
 
@@ -77,3 +78,54 @@ TEST(LoadShedConfigurationTest, TestSettersAndGetters) {
   lsc.addWhitelistAddr(folly::StringPiece("10.0.0.7/20"));
   EXPECT_TRUE(lsc.isWhitelisted(folly::SocketAddress("10.0.0.7", 0)));
 }
+
+TEST(LoadShedConfigurationTest, TestNetworkRanges) {
+  auto network = [] (const char* addr, unsigned prefixLen) {
+    return NetworkAddress(folly::SocketAddress(addr, 0), prefixLen);
+  };
+  auto contains = [] (const NetworkRanges& ranges, const char* addr) {
+    return ranges.contains(folly::SocketAddress(addr, 0));
+  };
+
+  NetworkRanges empty;
+  EXPECT_TRUE(empty.empty());
+  EXPECT_FALSE(contains(empty, "10.0.0.1"));
+
+  NetworkRanges ranges({
+    network("10.1.0.0", 16),
+    // Inside the /16, and overlapping each other
+    network("10.1.2.0", 24),
+    network("10.1.2.128", 25),
+    network("10.3.0.7", 32),
+    network("192.168.1.77", 24),
+    network("2001:db8::", 32),
+    network("2001:db9:0:0:8000::", 65),
+    network("2001:dba::1:0", 112),
+  });
+  EXPECT_FALSE(ranges.empty());
+  EXPECT_TRUE(contains(ranges, "10.1.0.0"));
+  EXPECT_TRUE(contains(ranges, "10.1.255.255"));
+  EXPECT_TRUE(contains(ranges, "10.1.2.200"));
+  EXPECT_FALSE(contains(ranges, "10.0.255.255"));
+  EXPECT_FALSE(contains(ranges, "10.2.0.0"));
+  EXPECT_TRUE(contains(ranges, "10.3.0.7"));
+  EXPECT_FALSE(contains(ranges, "10.3.0.6"));
+  EXPECT_FALSE(contains(ranges, "10.3.0.8"));
+  // The host bits of the network's address are ignored
+  EXPECT_TRUE(contains(ranges, "192.168.1.1"));
+  EXPECT_FALSE(contains(ranges, "192.168.2.1"));
+
+  EXPECT_TRUE(contains(ranges, "2001:db8::"));
+  EXPECT_TRUE(contains(ranges, "2001:db8:ffff:ffff:ffff:ffff:ffff:ffff"));
+  EXPECT_FALSE(contains(ranges, "2001:db7:ffff:ffff:ffff:ffff:ffff:ffff"));
+  EXPECT_TRUE(contains(ranges, "2001:db9::8000:0:0:1"));
+  EXPECT_FALSE(contains(ranges, "2001:db9::7fff:0:0:1"));
+  EXPECT_TRUE(contains(ranges, "2001:dba::1:ffff"));
+  EXPECT_FALSE(contains(ranges, "2001:dba::2:0"));
+  // Families don't mix
+  EXPECT_FALSE(contains(ranges, "::ffff:10.1.0.1"));
+
+  NetworkRanges all({network("0.0.0.0", 0)});
+  EXPECT_TRUE(contains(all, "255.255.255.255"));
+  EXPECT_FALSE(contains(all, "::1"));
+}
@@ -0,0 +1,240 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/acceptor/ProxyProtocol.h>
+
+#include <wangle/acceptor/Acceptor.h>
+
+#include <folly/io/async/AsyncSocket.h>
+#include <gtest/gtest.h>
+
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace folly;
+using namespace testing;
+
+namespace wangle {
+
+namespace {
+
+ProxyParseResult parse(const std::string& data, ProxyHeader& header) {
+  return parseProxyHeader(
+      reinterpret_cast<const uint8_t*>(data.data()), data.size(), header);
+}
+
+const std::string kV2Signature("\r\n\r\n\0\r\nQUIT\n", 12);
+
+} // namespace
+
+TEST(ProxyProtocolTest, V1) {
+  ProxyHeader header;
+  const std::string line = "PROXY TCP4 192.0.2.1 198.51.100.1 56324 443\r\n";
+  EXPECT_EQ(ProxyParseResult::OK, parse(line + "GET /", header));
+  EXPECT_EQ(1, header.version);
+  EXPECT_TRUE(header.hasAddresses);
+  EXPECT_EQ(line.size(), header.length);
+  EXPECT_EQ(SocketAddress("192.0.2.1", 56324), header.source);
+  EXPECT_EQ(SocketAddress("198.51.100.1", 443), header.destination);
+
+  EXPECT_EQ(ProxyParseResult::OK,
+            parse("PROXY TCP6 2001:db8::1 2001:db8::2 1000 80\r\n", header));
+  EXPECT_EQ(SocketAddress("2001:db8::1", 1000), header.source);
+
+  EXPECT_EQ(ProxyParseResult::OK, parse("PROXY UNKNOWN\r\n", header));
+  EXPECT_FALSE(header.hasAddresses);
+  EXPECT_EQ(15, header.length);
+}
+
+TEST(ProxyProtocolTest, V1Partial) {
+  ProxyHeader header;
+  EXPECT_EQ(ProxyParseResult::NEED_MORE, parse("PRO", header));
+  EXPECT_EQ(6, header.length);
+  EXPECT_EQ(ProxyParseResult::NEED_MORE,
+            parse("PROXY TCP4 192.0.2.1", header));
+  EXPECT_EQ(21, header.length);
+  EXPECT_EQ(ProxyParseResult::INVALID,
+            parse("PROXY " + std::string(200, 'x'), header));
+}
+
+TEST(ProxyProtocolTest, V1Invalid) {
+  ProxyHeader header;
+  EXPECT_EQ(ProxyParseResult::INVALID, parse("GET / HTTP/1.1\r\n", header));
+  EXPECT_EQ(ProxyParseResult::INVALID,
+            parse("PROXY TCP4 192.0.2.1 198.51.100.1 56324\r\n", header));
+  EXPECT_EQ(ProxyParseResult::INVALID,
+            parse("PROXY TCP4 2001:db8::1 2001:db8::2 1000 80\r\n", header));
+  EXPECT_EQ(ProxyParseResult::INVALID,
+            parse("PROXY TCP4 192.0.2.1 198.51.100.1 99999 443\r\n", header));
+}
+
+TEST(ProxyProtocolTest, V2) {
+  ProxyHeader header;
+  std::string v4 = kV2Signature + std::string("\x21\x11\x00\x0C", 4) +
+    std::string("\xC0\x00\x02\x01\xC6\x33\x64\x01\xDC\x04\x01\xBB", 12);
+  EXPECT_EQ(ProxyParseResult::OK, parse(v4 + "data", header));
+  EXPECT_EQ(2, header.version);
+  EXPECT_TRUE(header.hasAddresses);
+  EXPECT_EQ(28, header.length);
+  EXPECT_EQ(SocketAddress("192.0.2.1", 56324), header.source);
+  EXPECT_EQ(SocketAddress("198.51.100.1", 443), header.destination);
+
+  // TLVs after the addresses are skipped
+  std::string v6 = kV2Signature + std::string("\x21\x21\x00\x28", 4) +
+    std::string(15, '\0') + "\x01" + std::string(15, '\0') + "\x02" +
+    std::string("\x03\xE8\x00\x50", 4) + std::string("\x04\x00\x01\x00", 4);
+  EXPECT_EQ(ProxyParseResult::OK, parse(v6, header));
+  EXPECT_EQ(56, header.length);
+  EXPECT_EQ(SocketAddress("::1", 1000), header.source);
+  EXPECT_EQ(SocketAddress("::2", 80), header.destination);
+
+  // LOCAL
+  EXPECT_EQ(ProxyParseResult::OK,
+            parse(kV2Signature + std::string("\x20\x00\x00\x00", 4),
+                  header));
+  EXPECT_FALSE(header.hasAddresses);
+  EXPECT_EQ(16, header.length);
+}
+
+TEST(ProxyProtocolTest, V2Partial) {
+  ProxyHeader header;
+  EXPECT_EQ(ProxyParseResult::NEED_MORE,
+            parse(kV2Signature.substr(0, 5), header));
+  EXPECT_EQ(ProxyParseResult::NEED_MORE, parse(kV2Signature, header));
+  EXPECT_EQ(16, header.length);
+  EXPECT_EQ(ProxyParseResult::NEED_MORE,
+            parse(kV2Signature + std::string("\x21\x11\x00\x0C\xC0", 5),
+                  header));
+  EXPECT_EQ(28, header.length);
+}
+
+TEST(ProxyProtocolTest, V2Invalid) {
+  ProxyHeader header;
+  // Version 3, and a command that isn't LOCAL or PROXY
+  EXPECT_EQ(ProxyParseResult::INVALID,
+            parse(kV2Signature + std::string("\x31\x11\x00\x00", 4),
+                  header));
+  EXPECT_EQ(ProxyParseResult::INVALID,
+            parse(kV2Signature + std::string("\x22\x11\x00\x00", 4),
+                  header));
+  // Too long, and too short for its family
+  EXPECT_EQ(ProxyParseResult::INVALID,
+            parse(kV2Signature + std::string("\x21\x11\x10\x00", 4),
+                  header));
+  EXPECT_EQ(ProxyParseResult::INVALID,
+            parse(kV2Signature + std::string("\x21\x11\x00\x04", 4) +
+                  std::string(4, '\0'),
+                  header));
+}
+
+class ProxyAcceptor : public Acceptor {
+ public:
+  explicit ProxyAcceptor(const ServerSocketConfig& config)
+    : Acceptor(config) {}
+
+  using Acceptor::canAccept;
+  using Acceptor::connectionAccepted;
+  using Acceptor::setLoadShedConfig;
+
+  void onNewConnection(
+      AsyncTransportWrapper::UniquePtr sock,
+      const SocketAddress* address,
+      const std::string& /* nextProtocolName */,
+      SecureTransportType /* secureTransportType */,
+      const TransportInfo& tinfo) override {
+    clientAddr = *address;
+    proxyAddr = tinfo.clientAddrOriginal;
+    sock_ = std::move(sock);
+  }
+
+  int getFd() {
+    return sock_->getUnderlyingTransport<AsyncSocket>()->getFd();
+  }
+
+  SocketAddress clientAddr;
+  std::shared_ptr<SocketAddress> proxyAddr;
+
+ private:
+  AsyncTransportWrapper::UniquePtr sock_;
+};
+
+class ProxyAcceptorTest : public Test {
+ protected:
+  void SetUp() override {
+    ServerSocketConfig config;
+    config.proxyProtocol = true;
+    acceptor_.reset(new ProxyAcceptor(config));
+    acceptor_->init(nullptr, &base_);
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds_));
+  }
+
+  void TearDown() override {
+    acceptor_->dropAllConnections();
+    acceptor_.reset();
+    close(fds_[0]);
+  }
+
+  void send(const std::string& data) {
+    ASSERT_EQ(data.size(), ::send(fds_[0], data.data(), data.size(), 0));
+  }
+
+  EventBase base_;
+  std::unique_ptr<ProxyAcceptor> acceptor_;
+  SocketAddress proxyAddr_{"10.0.0.1", 4000};
+  int fds_[2];
+};
+
+TEST_F(ProxyAcceptorTest, ClientAddress) {
+  // Refused for its load balancer's address, accepted for its own
+  SimpleConnectionCounter counter;
+  counter.setMaxConnections(1);
+  counter.onConnectionAdded();
+  LoadShedConfiguration loadShedConfig;
+  SocketAddress clientAddr("192.0.2.1", 56324);
+  LoadShedConfiguration::AddressSet addrs = { clientAddr };
+  loadShedConfig.setWhitelistAddrs(addrs);
+  acceptor_->setLoadShedConfig(loadShedConfig, &counter);
+  EXPECT_FALSE(acceptor_->canAccept(proxyAddr_));
+
+  send("PROXY TCP4 192.0.2.1 198.51.100.1 56324 443\r\nhello");
+  acceptor_->connectionAccepted(fds_[1], proxyAddr_);
+  EXPECT_EQ(clientAddr, acceptor_->clientAddr);
+  ASSERT_TRUE(acceptor_->proxyAddr);
+  EXPECT_EQ(proxyAddr_, *acceptor_->proxyAddr);
+
+  // Only the header was read off
+  char buf[16];
+  EXPECT_EQ(5, recv(acceptor_->getFd(), buf, sizeof(buf), 0));
+  EXPECT_EQ("hello", std::string(buf, 5));
+}
+
+TEST_F(ProxyAcceptorTest, WaitsForHeader) {
+  acceptor_->connectionAccepted(fds_[1], proxyAddr_);
+  send("PROXY UNKNOWN");
+  base_.loopOnce(EVLOOP_NONBLOCK);
+  EXPECT_EQ(SocketAddress(), acceptor_->clientAddr);
+
+  // Without addresses in it, the connection's own are used
+  send("\r\n");
+  base_.loopOnce();
+  EXPECT_EQ(proxyAddr_, acceptor_->clientAddr);
+  EXPECT_FALSE(acceptor_->proxyAddr);
+}
+
+TEST_F(ProxyAcceptorTest, InvalidHeader) {
+  send("GET / HTTP/1.1\r\n\r\n");
+  acceptor_->connectionAccepted(fds_[1], proxyAddr_);
+  EXPECT_EQ(SocketAddress(), acceptor_->clientAddr);
+  // Dropped, possibly with a reset for the unread bytes
+  char buf[1];
+  EXPECT_GE(0, recv(fds_[0], buf, sizeof(buf), 0));
+}
+
+} // namespace wangle
@@ -0,0 +1,280 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/acceptor/SSLAcceptorHandshakeHelper.h>
+
+#include <folly/io/async/EventBase.h>
+#include <folly/io/async/SSLContext.h>
+#include <gtest/gtest.h>
+#include <wangle/concurrent/IOThreadPoolExecutor.h>
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace folly;
+
+namespace wangle {
+
+namespace {
+
+std::string testCertPath(const std::string& name) {
+  const std::string file = __FILE__;
+  return file.substr(0, file.rfind('/') + 1) + "../../ssl/test/certs/" + name;
+}
+
+// Runs evb until done, for up to 5 seconds
+bool loopUntil(EventBase& evb, const std::function<bool()>& done) {
+  for (int i = 0; i < 5000 && !done(); i++) {
+    evb.loopOnce(EVLOOP_NONBLOCK);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return done();
+}
+
+// A connected pair of TCP sockets on the loopback
+void tcpPair(int fds[2]) {
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_GE(listener, 0);
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  ASSERT_EQ(0, bind(listener, reinterpret_cast<sockaddr*>(&addr), len));
+  ASSERT_EQ(0, listen(listener, 1));
+  ASSERT_EQ(0, getsockname(listener, reinterpret_cast<sockaddr*>(&addr),
+                           &len));
+  fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_EQ(0, connect(fds[0], reinterpret_cast<sockaddr*>(&addr), len));
+  fds[1] = accept(listener, nullptr, nullptr);
+  ASSERT_GE(fds[1], 0);
+  close(listener);
+}
+
+class ClientHandshakeCallback : public AsyncSSLSocket::HandshakeCB {
+ public:
+  void handshakeSuc(AsyncSSLSocket*) noexcept override {
+    done = true;
+  }
+
+  void handshakeErr(AsyncSSLSocket*,
+                    const AsyncSocketException&) noexcept override {
+    done = true;
+  }
+
+  bool done{false};
+};
+
+class StringReadCallback : public AsyncTransportWrapper::ReadCallback {
+ public:
+  void getReadBuffer(void** buf, size_t* len) override {
+    *buf = buf_;
+    *len = sizeof(buf_);
+  }
+
+  void readDataAvailable(size_t len) noexcept override {
+    data.append(buf_, len);
+  }
+
+  void readEOF() noexcept override {}
+
+  void readErr(const AsyncSocketException&) noexcept override {}
+
+  std::string data;
+
+ private:
+  char buf_[1024];
+};
+
+// Where the stats of the handshake are reported from
+class StatsAcceptor : public Acceptor {
+ public:
+  explicit StatsAcceptor(const ServerSocketConfig& accConfig) :
+    Acceptor(accConfig) {}
+
+  void updateSSLStats(const AsyncTransportWrapper*,
+                      std::chrono::milliseconds,
+                      SSLErrorEnum,
+                      SecureTransportType) noexcept override {
+    statsThread = std::this_thread::get_id();
+  }
+
+  std::thread::id statsThread;
+};
+
+// Where the socket's handshake callback runs
+class RecordingHandshakeHelper : public SSLAcceptorHandshakeHelper {
+ public:
+  using SSLAcceptorHandshakeHelper::SSLAcceptorHandshakeHelper;
+
+  void handshakeSuc(AsyncSSLSocket* sock) noexcept override {
+    record(sock);
+    SSLAcceptorHandshakeHelper::handshakeSuc(sock);
+  }
+
+  void handshakeErr(AsyncSSLSocket* sock,
+                    const AsyncSocketException& ex) noexcept override {
+    record(sock);
+    SSLAcceptorHandshakeHelper::handshakeErr(sock, ex);
+  }
+
+  std::thread::id handshakeThread;
+  EventBase* handshakeBase{nullptr};
+
+ private:
+  void record(AsyncSSLSocket* sock) {
+    handshakeThread = std::this_thread::get_id();
+    handshakeBase = sock->getEventBase();
+  }
+};
+
+class RecordingCallback : public AcceptorHandshakeHelper::Callback {
+ public:
+  void connectionReady(AsyncTransportWrapper::UniquePtr sock,
+                       std::string,
+                       SecureTransportType type) noexcept override {
+    thread = std::this_thread::get_id();
+    base = sock->getEventBase();
+    secureTransportType = type;
+    transport = std::move(sock);
+    done = true;
+  }
+
+  void connectionError(exception_wrapper ex) noexcept override {
+    thread = std::this_thread::get_id();
+    error = std::move(ex);
+    done = true;
+  }
+
+  std::thread::id thread;
+  EventBase* base{nullptr};
+  SecureTransportType secureTransportType{SecureTransportType::NONE};
+  AsyncTransportWrapper::UniquePtr transport;
+  exception_wrapper error;
+  bool done{false};
+};
+
+}
+
+class SSLAcceptorHandshakeHelperTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    serverCtx_ = std::make_shared<SSLContext>();
+    serverCtx_->loadCertificate(testCertPath("test.cert.pem").c_str());
+    serverCtx_->loadPrivateKey(testCertPath("test.key.pem").c_str());
+    acceptor_.init(nullptr, &evb_);
+    tcpPair(fds_);
+  }
+
+  void TearDown() override {
+    if (fds_[0] >= 0) {
+      close(fds_[0]);
+    }
+  }
+
+  // Starts the handshake of the server side of the pair
+  void start() {
+    AsyncSSLSocket::UniquePtr sock(
+      new AsyncSSLSocket(serverCtx_, &evb_, fds_[1], true));
+    helper_.reset(new RecordingHandshakeHelper(
+      &acceptor_, clientAddr_, std::chrono::steady_clock::now(), tinfo_));
+    helper_->start(std::move(sock), &callback_);
+  }
+
+  // Completes a handshake with the client side of the pair
+  void handshakeClient() {
+    auto clientCtx = std::make_shared<SSLContext>();
+    client_ = AsyncSSLSocket::newSocket(clientCtx, &evb_, fds_[0], false);
+    fds_[0] = -1;
+    client_->sslConn(&clientHandshake_);
+    ASSERT_TRUE(loopUntil(evb_, [&] {
+      return callback_.done && clientHandshake_.done;
+    }));
+  }
+
+  EventBase evb_;
+  StatsAcceptor acceptor_{ServerSocketConfig()};
+  std::shared_ptr<SSLContext> serverCtx_;
+  int fds_[2]{-1, -1};
+  SocketAddress clientAddr_{"127.0.0.1", 0};
+  TransportInfo tinfo_;
+  std::unique_ptr<RecordingHandshakeHelper,
+                  DelayedDestruction::Destructor> helper_;
+  RecordingCallback callback_;
+  AsyncSSLSocket::UniquePtr client_;
+  ClientHandshakeCallback clientHandshake_;
+};
+
+TEST_F(SSLAcceptorHandshakeHelperTest, HandshakeOnAcceptorThread) {
+  start();
+  handshakeClient();
+  ASSERT_TRUE(callback_.transport);
+  EXPECT_EQ(std::this_thread::get_id(), helper_->handshakeThread);
+  EXPECT_EQ(&evb_, helper_->handshakeBase);
+  EXPECT_EQ(std::this_thread::get_id(), callback_.thread);
+  EXPECT_EQ(&evb_, callback_.base);
+  EXPECT_EQ(SecureTransportType::TLS, callback_.secureTransportType);
+  EXPECT_TRUE(tinfo_.ssl);
+}
+
+TEST_F(SSLAcceptorHandshakeHelperTest, HandshakeOffloaded) {
+  auto executor = std::make_shared<IOThreadPoolExecutor>(1);
+  auto handshakeBase = executor->getEventBase();
+  std::thread::id handshakeThread;
+  handshakeBase->runInEventBaseThreadAndWait([&] {
+    handshakeThread = std::this_thread::get_id();
+  });
+  acceptor_.setSSLHandshakeExecutor(executor);
+
+  start();
+  handshakeClient();
+  ASSERT_TRUE(callback_.transport);
+  // Run on the executor
+  EXPECT_EQ(handshakeThread, helper_->handshakeThread);
+  EXPECT_EQ(handshakeBase, helper_->handshakeBase);
+  // Handed back on the acceptor's, attached to its EventBase
+  EXPECT_EQ(std::this_thread::get_id(), callback_.thread);
+  EXPECT_EQ(&evb_, callback_.base);
+  EXPECT_EQ(std::this_thread::get_id(), acceptor_.statsThread);
+  EXPECT_TRUE(tinfo_.ssl);
+
+  // And usable from there
+  StringReadCallback clientRead;
+  client_->setReadCB(&clientRead);
+  callback_.transport->write(nullptr, "hello", 5);
+  EXPECT_TRUE(loopUntil(evb_, [&] { return clientRead.data.size() >= 5; }));
+  EXPECT_EQ("hello", clientRead.data);
+  client_->setReadCB(nullptr);
+}
+
+TEST_F(SSLAcceptorHandshakeHelperTest, HandshakeErrorOffloaded) {
+  auto executor = std::make_shared<IOThreadPoolExecutor>(1);
+  auto handshakeBase = executor->getEventBase();
+  acceptor_.setSSLHandshakeExecutor(executor);
+
+  start();
+  // Not a ClientHello
+  const char request[] = "GET / HTTP/1.0\r\n\r\n";
+  ASSERT_EQ(ssize_t(sizeof(request) - 1),
+            write(fds_[0], request, sizeof(request) - 1));
+  ASSERT_TRUE(loopUntil(evb_, [&] { return callback_.done; }));
+  EXPECT_FALSE(callback_.transport);
+  EXPECT_TRUE(callback_.error);
+  EXPECT_EQ(handshakeBase, helper_->handshakeBase);
+  EXPECT_NE(std::this_thread::get_id(), helper_->handshakeThread);
+  EXPECT_EQ(std::this_thread::get_id(), callback_.thread);
+  EXPECT_EQ(std::this_thread::get_id(), acceptor_.statsThread);
+}
+
+} // namespace wangle
@@ -0,0 +1,68 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/acceptor/SocketOptions.h>
+
+#include <gtest/gtest.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace wangle;
+
+class SocketOptionsTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_GE(fd_, 0);
+  }
+
+  void TearDown() override {
+    close(fd_);
+  }
+
+  int fd_{-1};
+};
+
+#ifdef TCP_NOTSENT_LOWAT
+TEST_F(SocketOptionsTest, NotSentLowWatermark) {
+  ASSERT_TRUE(setNotSentLowWatermark(fd_, 16384));
+  uint32_t bytes = 0;
+  socklen_t len = sizeof(bytes);
+  ASSERT_EQ(0, getsockopt(fd_, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &bytes, &len));
+  EXPECT_EQ(16384, bytes);
+}
+#endif
+
+#ifdef SO_MAX_PACING_RATE
+TEST_F(SocketOptionsTest, MaxPacingRate) {
+  ASSERT_TRUE(setMaxPacingRate(fd_, 1000000));
+  uint32_t rate = 0;
+  socklen_t len = sizeof(rate);
+  ASSERT_EQ(0, getsockopt(fd_, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, &len));
+  EXPECT_EQ(1000000, rate);
+
+  // Capped rather than wrapped
+  ASSERT_TRUE(setMaxPacingRate(fd_, 1ULL << 40));
+  ASSERT_EQ(0, getsockopt(fd_, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, &len));
+  EXPECT_EQ(~0U - 1, rate);
+}
+#endif
+
+TEST(SocketOptions, FilterUnixSocketOptions) {
+  folly::AsyncSocket::OptionMap opts;
+  opts[folly::AsyncSocket::OptionKey{SOL_SOCKET, SO_SNDBUF}] = 65536;
+  opts[folly::AsyncSocket::OptionKey{IPPROTO_TCP, TCP_NODELAY}] = 1;
+  opts[folly::AsyncSocket::OptionKey{IPPROTO_IP, IP_TOS}] = 0x10;
+  auto filtered = filterIPSocketOptions(opts, AF_UNIX);
+  ASSERT_EQ(1, filtered.size());
+  EXPECT_EQ(SOL_SOCKET, filtered.begin()->first.level);
+}
@@ -0,0 +1,159 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/acceptor/SystemLoadSampler.h>
+
+#include <folly/Conv.h>
+#include <folly/FileUtil.h>
+#include <folly/experimental/TestUtil.h>
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <sys/stat.h>
+#include <thread>
+
+using namespace wangle;
+using namespace testing;
+
+class SystemLoadSamplerTest : public Test {
+ protected:
+  void SetUp() override {
+    root_ = tmpdir_.path().string();
+    ASSERT_EQ(0, mkdir((root_ + "/proc").c_str(), 0755));
+    ASSERT_EQ(0, mkdir((root_ + "/cgroup").c_str(), 0755));
+    sampler_ = std::make_shared<SystemLoadSampler>(
+        std::chrono::seconds(1), root_ + "/proc", root_ + "/cgroup");
+  }
+
+  // Atomically, as the sampler may be reading it
+  void write(const std::string& path, const std::string& data) {
+    auto tmp = root_ + path + ".tmp";
+    ASSERT_TRUE(folly::writeFile(data, tmp.c_str()));
+    ASSERT_EQ(0, rename(tmp.c_str(), (root_ + path).c_str()));
+  }
+
+  // busy and idle jiffies, split across the /proc/stat fields
+  void writeStat(uint64_t busy, uint64_t idle) {
+    write("/proc/stat", folly::to<std::string>(
+        "cpu  ", busy / 2, " 0 ", busy - busy / 2, " ", idle,
+        " 0 0 0 0 0 0\ncpu0 1 2 3 4 5 6 7 8 9 10\n"));
+  }
+
+  folly::test::TemporaryDirectory tmpdir_{"wangle-load-sampler-test"};
+  std::string root_;
+  std::shared_ptr<SystemLoadSampler> sampler_;
+};
+
+TEST_F(SystemLoadSamplerTest, CpuUsage) {
+  LoadShedConfiguration config;
+  config.setMaxCpuUsage(0.7);
+  config.setCpuUsageExceedWindowSize(2);
+
+  writeStat(100, 100);
+  sampler_->sample();
+  // No usage before the second sample
+  EXPECT_EQ(0, sampler_->getCpuUsage());
+  EXPECT_FALSE(sampler_->isCpuOverloaded(config));
+
+  writeStat(180, 120);
+  sampler_->sample();
+  EXPECT_DOUBLE_EQ(0.8, sampler_->getCpuUsage());
+  // Only one sample above the threshold
+  EXPECT_FALSE(sampler_->isCpuOverloaded(config));
+
+  writeStat(270, 130);
+  sampler_->sample();
+  EXPECT_DOUBLE_EQ(0.9, sampler_->getCpuUsage());
+  EXPECT_TRUE(sampler_->isCpuOverloaded(config));
+
+  writeStat(320, 180);
+  sampler_->sample();
+  EXPECT_DOUBLE_EQ(0.5, sampler_->getCpuUsage());
+  EXPECT_FALSE(sampler_->isCpuOverloaded(config));
+
+  // Idle below the minimum
+  config.setMaxCpuUsage(1.0);
+  config.setMinCpuIdle(0.6);
+  config.setCpuUsageExceedWindowSize(0);
+  EXPECT_TRUE(sampler_->isCpuOverloaded(config));
+}
+
+TEST_F(SystemLoadSamplerTest, MemUsage) {
+  LoadShedConfiguration config;
+  EXPECT_FALSE(sampler_->isMemOverloaded(config));
+
+  write("/proc/meminfo",
+        "MemTotal:        1000 kB\n"
+        "MemFree:          100 kB\n"
+        "MemAvailable:     400 kB\n");
+  sampler_->sample();
+  EXPECT_EQ(1000 * 1024, sampler_->getTotalMem());
+  EXPECT_EQ(400 * 1024, sampler_->getFreeMem());
+  EXPECT_DOUBLE_EQ(0.6, sampler_->getMemUsage());
+  EXPECT_FALSE(sampler_->isMemOverloaded(config));
+
+  config.setMaxMemUsage(0.5);
+  EXPECT_TRUE(sampler_->isMemOverloaded(config));
+  config.setMaxMemUsage(1.0);
+  config.setMinFreeMem(500 * 1024);
+  EXPECT_TRUE(sampler_->isMemOverloaded(config));
+
+  // Without MemAvailable
+  write("/proc/meminfo",
+        "MemTotal:        1000 kB\n"
+        "MemFree:          100 kB\n"
+        "Buffers:           50 kB\n"
+        "Cached:           150 kB\n"
+        "SwapCached:       999 kB\n");
+  sampler_->sample();
+  EXPECT_EQ(300 * 1024, sampler_->getFreeMem());
+}
+
+TEST_F(SystemLoadSamplerTest, CgroupMemLimit) {
+  write("/proc/meminfo",
+        "MemTotal:        1000 kB\n"
+        "MemAvailable:     800 kB\n");
+
+  // cgroup v1 without a limit
+  ASSERT_EQ(0, mkdir((root_ + "/cgroup/memory").c_str(), 0755));
+  write("/cgroup/memory/memory.limit_in_bytes", "9223372036854771712\n");
+  write("/cgroup/memory/memory.usage_in_bytes", "102400\n");
+  sampler_->sample();
+  EXPECT_EQ(1000 * 1024, sampler_->getTotalMem());
+  EXPECT_EQ(800 * 1024, sampler_->getFreeMem());
+
+  write("/cgroup/memory/memory.limit_in_bytes", "512000\n");
+  sampler_->sample();
+  EXPECT_EQ(500 * 1024, sampler_->getTotalMem());
+  EXPECT_EQ(400 * 1024, sampler_->getFreeMem());
+
+  // cgroup v2 takes precedence
+  write("/cgroup/memory.max", "204800\n");
+  write("/cgroup/memory.current", "204800\n");
+  sampler_->sample();
+  EXPECT_EQ(200 * 1024, sampler_->getTotalMem());
+  EXPECT_EQ(0, sampler_->getFreeMem());
+
+  write("/cgroup/memory.max", "max\n");
+  sampler_->sample();
+  EXPECT_EQ(1000 * 1024, sampler_->getTotalMem());
+}
+
+TEST_F(SystemLoadSamplerTest, Background) {
+  writeStat(100, 100);
+  sampler_->setPeriod(std::chrono::milliseconds(1));
+  sampler_->start();
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  writeStat(200, 200);
+  while (sampler_->getCpuUsage() == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  sampler_->stop();
+  EXPECT_DOUBLE_EQ(0.5, sampler_->getCpuUsage());
+}
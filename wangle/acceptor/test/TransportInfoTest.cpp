@@ -0,0 +1,59 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/acceptor/TransportInfo.h>
+
+#include <folly/SocketAddress.h>
+#include <gtest/gtest.h>
+
+#include <thread>
+
+using namespace wangle;
+using namespace testing;
+
+TEST(TransportInfoTest, InternString) {
+  auto a = TransportInfo::internString("ECDHE-RSA-AES128-GCM-SHA256");
+  auto b = TransportInfo::internString(std::string("ECDHE-RSA-AES128-GCM-"
+                                                   "SHA256"));
+  EXPECT_EQ("ECDHE-RSA-AES128-GCM-SHA256", *a);
+  EXPECT_EQ(a, b);
+
+  auto c = TransportInfo::internString("h2");
+  EXPECT_EQ("h2", *c);
+  EXPECT_NE(a, c);
+  EXPECT_EQ("", *TransportInfo::internString(""));
+
+  // Per thread
+  std::shared_ptr<std::string> other;
+  std::thread([&] { other = TransportInfo::internString("h2"); }).join();
+  EXPECT_EQ("h2", *other);
+  EXPECT_NE(c, other);
+
+  // Still correct once the table is full
+  for (int i = 0; i < 100; i++) {
+    auto s = std::to_string(i);
+    EXPECT_EQ(s, *TransportInfo::internString(s));
+  }
+  EXPECT_EQ(a, TransportInfo::internString("ECDHE-RSA-AES128-GCM-SHA256"));
+}
+
+TEST(TransportInfoTest, SetAddresses) {
+  folly::SocketAddress local("127.0.0.1", 80);
+  folly::SocketAddress remote("10.0.0.1", 12345);
+  std::shared_ptr<folly::SocketAddress> remoteAddr;
+  {
+    TransportInfo tinfo;
+    tinfo.setAddresses(local, remote);
+    EXPECT_EQ(local, *tinfo.localAddr);
+    EXPECT_EQ(remote, *tinfo.remoteAddr);
+    remoteAddr = tinfo.remoteAddr;
+  }
+  // Outlives the TransportInfo
+  EXPECT_EQ(remote, *remoteAddr);
+}
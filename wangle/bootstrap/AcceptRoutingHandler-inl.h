@@ -14,12 +14,12 @@ namespace wangle {
 template <typename Pipeline, typename R>
 void AcceptRoutingHandler<Pipeline, R>::read(Context* ctx,
                                              AcceptPipelineType conn) {
+  populateAcceptors();
+
   if (conn.type() != typeid(ConnInfo&)) {
     return;
   }
 
-  populateAcceptors();
-
   const auto& connInfo = boost::get<ConnInfo&>(conn);
   auto socket = std::shared_ptr<folly::AsyncTransportWrapper>(
       connInfo.sock, folly::DelayedDestruction::Destructor());
@@ -38,8 +38,7 @@ void AcceptRoutingHandler<Pipeline, R>::read(Context* ctx,
   folly::SocketAddress localAddr, peerAddr;
   socket->getLocalAddress(&localAddr);
   socket->getPeerAddress(&peerAddr);
-  transportInfo->localAddr = std::make_shared<folly::SocketAddress>(localAddr);
-  transportInfo->remoteAddr = std::make_shared<folly::SocketAddress>(peerAddr);
+  transportInfo->setAddresses(localAddr, peerAddr);
   routingPipeline->setTransportInfo(transportInfo);
 
   routingPipeline->transportActive();
@@ -71,37 +70,57 @@ void AcceptRoutingHandler<Pipeline, R>::onRoutingData(
   auto socket = std::dynamic_pointer_cast<folly::AsyncSocket>(
       routingPipeline->getTransport());
   routingPipeline->transportInactive();
-  socket->detachEventBase();
 
   // Hash based on routing data to pick a new acceptor
   uint64_t hash = std::hash<R>()(routingData.routingData);
-  auto acceptor = acceptors_[hash % acceptors_.size()];
+  auto worker = workerSelector_->select(hash, acceptors_.size());
+  auto acceptor = acceptors_[worker];
+  auto evb = acceptor->getEventBase();
+
+  if (evb->isInEventBaseThread()) {
+    // Already on the hashed acceptor's thread, so the socket stays put
+    addChildPipeline(acceptor, worker, socket, routingPipeline, routingData);
+    // The routing handler calling us is still on the stack
+    evb->runInLoop([routingPipeline]() {});
+    return;
+  }
 
   // Switch to the new acceptor's thread
+  socket->detachEventBase();
   auto mwRoutingData =
       folly::makeMoveWrapper<typename RoutingDataHandler<R>::RoutingData>(
           std::move(routingData));
-  acceptor->getEventBase()->runInEventBaseThread([=]() mutable {
-    socket->attachEventBase(acceptor->getEventBase());
-
-    auto routingHandler =
-        routingPipeline->template getHandler<RoutingDataHandler<R>>();
-    DCHECK(routingHandler);
-    auto transportInfo = routingPipeline->getTransportInfo();
-    auto pipeline = childPipelineFactory_->newPipeline(
-        socket, mwRoutingData->routingData, routingHandler, transportInfo);
-
-    auto connection =
-        new typename ServerAcceptor<Pipeline>::ServerConnection(pipeline);
-    acceptor->addConnection(connection);
-
-    pipeline->transportActive();
-
-    // Pass in the buffered bytes to the pipeline
-    pipeline->read(mwRoutingData->bufQueue);
+  evb->runInEventBaseThread([=]() mutable {
+    socket->attachEventBase(evb);
+    addChildPipeline(
+        acceptor, worker, socket, routingPipeline, *mwRoutingData);
   });
 }
 
+template <typename Pipeline, typename R>
+void AcceptRoutingHandler<Pipeline, R>::addChildPipeline(
+    Acceptor* acceptor,
+    size_t worker,
+    std::shared_ptr<folly::AsyncSocket> socket,
+    const DefaultPipeline::Ptr& routingPipeline,
+    typename RoutingDataHandler<R>::RoutingData& routingData) {
+  auto routingHandler =
+      routingPipeline->template getHandler<RoutingDataHandler<R>>();
+  DCHECK(routingHandler);
+  auto transportInfo = routingPipeline->getTransportInfo();
+  auto pipeline = childPipelineFactory_->newPipeline(
+      socket, routingData.routingData, routingHandler, transportInfo);
+
+  auto connection =
+      new RoutedConnection<Pipeline>(pipeline, workerSelector_, worker);
+  acceptor->addConnection(connection);
+
+  pipeline->transportActive();
+
+  // Pass in the buffered bytes to the pipeline
+  pipeline->read(routingData.bufQueue);
+}
+
 template <typename Pipeline, typename R>
 void AcceptRoutingHandler<Pipeline, R>::onError(uint64_t connId,
                                                 folly::exception_wrapper ex) {
@@ -123,8 +142,9 @@ void AcceptRoutingHandler<Pipeline, R>::populateAcceptors() {
     return;
   }
   CHECK(server_);
-  server_->forEachWorker(
-      [&](Acceptor* acceptor) { acceptors_.push_back(acceptor); });
+  server_->forEachWorker([&](Acceptor* acceptor) {
+    acceptors_.push_back(acceptor);
+  });
 }
 
 } // namespace wangle
@@ -11,10 +11,39 @@
 
 #include <wangle/bootstrap/RoutingDataHandler.h>
 #include <wangle/bootstrap/ServerBootstrap.h>
+#include <wangle/bootstrap/WorkerSelector.h>
 #include <wangle/channel/Pipeline.h>
 
+#include <unordered_map>
+
 namespace wangle {
 
+/**
+ * A connection the WorkerSelector placed, counted against the worker
+ * select() returned until it goes: the acceptor's ConnEvent::CONN_REMOVED,
+ * fired for its other connections too, such as handshakes, can't be
+ * paired with select().
+ */
+template <typename Pipeline>
+class RoutedConnection : public ServerAcceptor<Pipeline>::ServerConnection {
+ public:
+  RoutedConnection(typename Pipeline::Ptr pipeline,
+                   std::shared_ptr<WorkerSelector> workerSelector,
+                   size_t worker)
+      : ServerAcceptor<Pipeline>::ServerConnection(std::move(pipeline)),
+        workerSelector_(std::move(workerSelector)),
+        worker_(worker) {}
+
+ protected:
+  ~RoutedConnection() {
+    workerSelector_->onConnectionRemoved(worker_);
+  }
+
+ private:
+  std::shared_ptr<WorkerSelector> workerSelector_;
+  size_t worker_;
+};
+
 /**
  * An AcceptPipeline with the ability to hash connections to
  * a specific worker thread. Hashing can be based on data passed
@@ -26,7 +55,11 @@ namespace wangle {
  * the connection and invoking RoutingDataHandler::Callback::onRoutingData
  * to notify the AcceptRoutingHandler. AcceptRoutingHandler then pauses
  * reads from the socket, moves the connection over to the hashed
- * worker thread, and resumes reading from the socket on the child pipeline.
+ * worker thread, unless it is already there, and resumes reading from the
+ * socket on the child pipeline.
+ *
+ * The worker is picked by a WorkerSelector from the hash of the routing
+ * data, hash % number of workers unless given one.
  */
 
 template <typename Pipeline, typename R>
@@ -40,10 +73,13 @@ class AcceptRoutingHandler : public wangle::InboundHandler<AcceptPipelineType>,
       ServerBootstrap<Pipeline>* server,
       std::shared_ptr<RoutingDataHandlerFactory<R>> routingHandlerFactory,
       std::shared_ptr<RoutingDataPipelineFactory<Pipeline, R>>
-          childPipelineFactory)
+          childPipelineFactory,
+      std::shared_ptr<WorkerSelector> workerSelector = nullptr)
       : server_(CHECK_NOTNULL(server)),
         routingHandlerFactory_(routingHandlerFactory),
-        childPipelineFactory_(childPipelineFactory) {}
+        childPipelineFactory_(childPipelineFactory),
+        workerSelector_(workerSelector ? workerSelector :
+                        std::make_shared<ModuloWorkerSelector>()) {}
 
   // InboundHandler implementation
   void read(Context* ctx, AcceptPipelineType conn) override;
@@ -59,13 +95,22 @@ class AcceptRoutingHandler : public wangle::InboundHandler<AcceptPipelineType>,
  private:
   void populateAcceptors();
 
+  // In the thread of acceptor, the worker-th
+  void addChildPipeline(
+      Acceptor* acceptor,
+      size_t worker,
+      std::shared_ptr<folly::AsyncSocket> socket,
+      const DefaultPipeline::Ptr& routingPipeline,
+      typename RoutingDataHandler<R>::RoutingData& routingData);
+
   ServerBootstrap<Pipeline>* server_;
   std::shared_ptr<RoutingDataHandlerFactory<R>> routingHandlerFactory_;
   std::shared_ptr<RoutingDataPipelineFactory<Pipeline, R>>
       childPipelineFactory_;
+  std::shared_ptr<WorkerSelector> workerSelector_;
 
   std::vector<Acceptor*> acceptors_;
-  std::map<uint64_t, DefaultPipeline::Ptr> routingPipelines_;
+  std::unordered_map<uint64_t, DefaultPipeline::Ptr> routingPipelines_;
   uint64_t nextConnId_{0};
 };
 
@@ -76,15 +121,19 @@ class AcceptRoutingPipelineFactory : public AcceptPipelineFactory {
       ServerBootstrap<Pipeline>* server,
       std::shared_ptr<RoutingDataHandlerFactory<R>> routingHandlerFactory,
       std::shared_ptr<RoutingDataPipelineFactory<Pipeline, R>>
-          childPipelineFactory)
+          childPipelineFactory,
+      std::shared_ptr<WorkerSelector> workerSelector = nullptr)
       : server_(CHECK_NOTNULL(server)),
         routingHandlerFactory_(routingHandlerFactory),
-        childPipelineFactory_(childPipelineFactory) {}
+        childPipelineFactory_(childPipelineFactory),
+        workerSelector_(workerSelector ? workerSelector :
+                        std::make_shared<ModuloWorkerSelector>()) {}
 
   AcceptPipeline::Ptr newPipeline(Acceptor* acceptor) override {
     auto pipeline = AcceptPipeline::create();
     pipeline->addBack(AcceptRoutingHandler<Pipeline, R>(
-        server_, routingHandlerFactory_, childPipelineFactory_));
+        server_, routingHandlerFactory_, childPipelineFactory_,
+        workerSelector_));
     pipeline->finalize();
 
     return pipeline;
@@ -95,6 +144,7 @@ class AcceptRoutingPipelineFactory : public AcceptPipelineFactory {
   std::shared_ptr<RoutingDataHandlerFactory<R>> routingHandlerFactory_;
   std::shared_ptr<RoutingDataPipelineFactory<Pipeline, R>>
       childPipelineFactory_;
+  std::shared_ptr<WorkerSelector> workerSelector_;
 };
 
 template <typename Pipeline, typename R>
@@ -0,0 +1,158 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+namespace wangle {
+
+template <typename Pipeline>
+void AcceptSteeringHandler<Pipeline>::read(Context* ctx,
+                                          AcceptPipelineType conn) {
+  populateAcceptors();
+
+  if (conn.type() != typeid(ConnInfo&)) {
+    return;
+  }
+
+  const auto& connInfo = boost::get<ConnInfo&>(conn);
+  folly::AsyncTransportWrapper::UniquePtr socket(connInfo.sock);
+
+  auto tinfo = std::make_shared<TransportInfo>(connInfo.tinfo);
+  folly::SocketAddress localAddr;
+  socket->getLocalAddress(&localAddr);
+  tinfo->setAddresses(localAddr, *connInfo.clientAddr);
+  tinfo->sslNextProtocol = TransportInfo::internString(connInfo.nextProtoName);
+
+  auto evb = socket->getEventBase();
+  if (!timer_) {
+    timer_.reset(new folly::HHWheelTimer(evb));
+  }
+  const auto id = nextConnId_++;
+  auto peek = new Peek(this, id, std::move(socket), std::move(tinfo));
+  peeks_[id].reset(peek);
+  timer_->scheduleTimeout(peek, timeout_);
+  peek->socket->setReadCB(peek);
+}
+
+template <typename Pipeline>
+void AcceptSteeringHandler<Pipeline>::readEOF(Context* ctx) {
+  // Null implementation to terminate the call in this handler
+}
+
+template <typename Pipeline>
+void AcceptSteeringHandler<Pipeline>::readException(
+    Context* ctx, folly::exception_wrapper ex) {
+  // Null implementation to terminate the call in this handler
+}
+
+template <typename Pipeline>
+void AcceptSteeringHandler<Pipeline>::onPeekData(Peek* peek) {
+  uint64_t hash = 0;
+  bool parsed;
+  try {
+    parsed = parser_(peek->buf, hash);
+  } catch (const std::exception& ex) {
+    VLOG(4) << "Exception while parsing routing data: " << ex.what();
+    peeks_.erase(peek->id);
+    return;
+  }
+  if (parsed) {
+    steer(peek, workerSelector_->select(hash, acceptors_.size()), true);
+  } else if (peek->buf.chainLength() >= maxPeekBytes_) {
+    steer(peek, worker_, false);
+  }
+}
+
+template <typename Pipeline>
+void AcceptSteeringHandler<Pipeline>::steer(
+    Peek* peek, size_t worker, bool selected) {
+  auto it = peeks_.find(peek->id);
+  DCHECK(it != peeks_.end());
+  auto owned = std::move(it->second);
+  peeks_.erase(it);
+  owned->cancelTimeout();
+
+  auto socket = std::move(owned->socket);
+  socket->setReadCB(nullptr);
+  auto data = owned->buf.move();
+  auto acceptor = acceptors_[worker];
+  auto evb = acceptor->getEventBase();
+  // Given back to the selector, as the connection goes, for the worker
+  // select() counted it against, even if it can't move there
+  auto selector = selected ? workerSelector_ : nullptr;
+  if (evb->isInEventBaseThread() || !socket->isDetachable()) {
+    addConnection(acceptors_[worker_], childPipelineFactory_, selector,
+                  worker, std::move(socket), std::move(data),
+                  std::move(owned->tinfo));
+    return;
+  }
+
+  // All the worker needs, in one message
+  socket->detachEventBase();
+  auto mwSocket = folly::makeMoveWrapper(std::move(socket));
+  auto mwData = folly::makeMoveWrapper(std::move(data));
+  auto factory = childPipelineFactory_;
+  auto tinfo = std::move(owned->tinfo);
+  evb->runInEventBaseThread([=]() mutable {
+    (*mwSocket)->attachEventBase(evb);
+    addConnection(acceptor, factory, selector, worker, std::move(*mwSocket),
+                  std::move(*mwData), tinfo);
+  });
+}
+
+template <typename Pipeline>
+void AcceptSteeringHandler<Pipeline>::addConnection(
+    Acceptor* acceptor,
+    const std::shared_ptr<PipelineFactory<Pipeline>>& factory,
+    const std::shared_ptr<WorkerSelector>& selector,
+    size_t worker,
+    folly::AsyncTransportWrapper::UniquePtr socket,
+    std::unique_ptr<folly::IOBuf> data,
+    std::shared_ptr<TransportInfo> tinfo) {
+  std::shared_ptr<folly::AsyncTransportWrapper> transport(
+      socket.release(), folly::DelayedDestruction::Destructor());
+  auto pipeline = factory->newPipeline(std::move(transport));
+  pipeline->setTransportInfo(std::move(tinfo));
+  typename ServerAcceptor<Pipeline>::ServerConnection* connection;
+  if (selector) {
+    connection = new RoutedConnection<Pipeline>(pipeline, selector, worker);
+  } else {
+    connection =
+        new typename ServerAcceptor<Pipeline>::ServerConnection(pipeline);
+  }
+  acceptor->addConnection(connection);
+  connection->init();
+
+  if (!data) {
+    return;
+  }
+  if (auto handler = pipeline->template getHandler<AsyncSocketHandler>()) {
+    handler->readPrefetched(std::move(data));
+  } else {
+    folly::IOBufQueue q(folly::IOBufQueue::cacheChainLength());
+    q.append(std::move(data));
+    pipeline->read(q);
+  }
+}
+
+template <typename Pipeline>
+void AcceptSteeringHandler<Pipeline>::populateAcceptors() {
+  if (!acceptors_.empty()) {
+    return;
+  }
+  CHECK(server_);
+  server_->forEachWorker([&](Acceptor* acceptor) {
+    if (acceptor->getEventBase()->isInEventBaseThread()) {
+      worker_ = acceptors_.size();
+    }
+    acceptors_.push_back(acceptor);
+  });
+}
+
+} // namespace wangle
@@ -0,0 +1,192 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <wangle/bootstrap/AcceptRoutingHandler.h>
+#include <wangle/bootstrap/ServerBootstrap.h>
+#include <wangle/bootstrap/WorkerSelector.h>
+#include <wangle/channel/AsyncSocketHandler.h>
+#include <wangle/channel/Pipeline.h>
+
+#include <folly/io/async/HHWheelTimer.h>
+
+#include <unordered_map>
+
+namespace wangle {
+
+/**
+ * Routes connections to worker threads by their first bytes, like
+ * AcceptRoutingHandler, without building a routing pipeline for each:
+ * the accepting thread reads up to maxPeekBytes of the connection with a
+ * plain read callback and asks a parser for the hash of the routing data
+ * in them. The socket, the bytes read and the TransportInfo then go to the
+ * worker picked by the WorkerSelector in a single message, where the
+ * connection gets a pipeline of the child PipelineFactory, whose
+ * AsyncSocketHandler is handed the bytes read (see
+ * AsyncSocketHandler::readPrefetched()).
+ *
+ * Connections whose routing data isn't in their first maxPeekBytes, or
+ * that send none within timeout, stay on the accepting thread. A parser
+ * that throws drops the connection.
+ */
+template <typename Pipeline>
+class AcceptSteeringHandler : public InboundHandler<AcceptPipelineType> {
+ public:
+  // Returns true, setting hash, once data holds the routing data, false if
+  // it needs more
+  typedef std::function<bool(const folly::IOBufQueue& data, uint64_t& hash)>
+    Parser;
+
+  AcceptSteeringHandler(
+      ServerBootstrap<Pipeline>* server,
+      Parser parser,
+      std::shared_ptr<PipelineFactory<Pipeline>> childPipelineFactory,
+      std::shared_ptr<WorkerSelector> workerSelector = nullptr,
+      size_t maxPeekBytes = 4096,
+      std::chrono::milliseconds timeout = std::chrono::milliseconds(5000))
+      : server_(CHECK_NOTNULL(server)),
+        parser_(std::move(parser)),
+        childPipelineFactory_(std::move(childPipelineFactory)),
+        workerSelector_(workerSelector ? workerSelector :
+                        std::make_shared<ModuloWorkerSelector>()),
+        maxPeekBytes_(std::max<size_t>(maxPeekBytes, 1)),
+        timeout_(timeout) {}
+
+  // InboundHandler implementation
+  void read(Context* ctx, AcceptPipelineType conn) override;
+  void readEOF(Context* ctx) override;
+  void readException(Context* ctx, folly::exception_wrapper ex) override;
+
+ private:
+  // A connection whose routing data is still being read
+  class Peek : public folly::AsyncTransportWrapper::ReadCallback,
+               public folly::HHWheelTimer::Callback {
+   public:
+    Peek(AcceptSteeringHandler* handler,
+         uint64_t id,
+         folly::AsyncTransportWrapper::UniquePtr socket,
+         std::shared_ptr<TransportInfo> tinfo)
+        : handler(handler),
+          id(id),
+          socket(std::move(socket)),
+          tinfo(std::move(tinfo)),
+          buf(folly::IOBufQueue::cacheChainLength()) {}
+
+    ~Peek() {
+      if (socket) {
+        socket->setReadCB(nullptr);
+      }
+    }
+
+    void getReadBuffer(void** bufReturn, size_t* lenReturn) override {
+      const auto room = handler->maxPeekBytes_ - buf.chainLength();
+      auto ret = buf.preallocate(1, room, room);
+      *bufReturn = ret.first;
+      *lenReturn = ret.second;
+    }
+
+    void readDataAvailable(size_t len) noexcept override {
+      buf.postallocate(len);
+      handler->onPeekData(this);
+    }
+
+    void readEOF() noexcept override {
+      handler->peeks_.erase(id);
+    }
+
+    void readErr(const folly::AsyncSocketException& /*ex*/) noexcept override {
+      handler->peeks_.erase(id);
+    }
+
+    void timeoutExpired() noexcept override {
+      handler->steer(this, handler->worker_, false);
+    }
+
+    AcceptSteeringHandler* handler;
+    uint64_t id;
+    folly::AsyncTransportWrapper::UniquePtr socket;
+    std::shared_ptr<TransportInfo> tinfo;
+    folly::IOBufQueue buf;
+  };
+
+  void populateAcceptors();
+
+  void onPeekData(Peek* peek);
+
+  // Deletes peek, which may be the caller. selected if worker came from
+  // the WorkerSelector.
+  void steer(Peek* peek, size_t worker, bool selected);
+
+  // In the thread of acceptor. Counted against worker by selector, if any.
+  static void addConnection(
+      Acceptor* acceptor,
+      const std::shared_ptr<PipelineFactory<Pipeline>>& factory,
+      const std::shared_ptr<WorkerSelector>& selector,
+      size_t worker,
+      folly::AsyncTransportWrapper::UniquePtr socket,
+      std::unique_ptr<folly::IOBuf> data,
+      std::shared_ptr<TransportInfo> tinfo);
+
+  ServerBootstrap<Pipeline>* server_;
+  Parser parser_;
+  std::shared_ptr<PipelineFactory<Pipeline>> childPipelineFactory_;
+  std::shared_ptr<WorkerSelector> workerSelector_;
+  const size_t maxPeekBytes_;
+  const std::chrono::milliseconds timeout_;
+
+  std::vector<Acceptor*> acceptors_;
+  // Of the acceptor this handler's pipeline belongs to
+  size_t worker_{0};
+  // Ahead of peeks_, for their timeouts to be cancelled before it goes
+  folly::HHWheelTimer::UniquePtr timer_;
+  std::unordered_map<uint64_t, std::unique_ptr<Peek>> peeks_;
+  uint64_t nextConnId_{0};
+};
+
+template <typename Pipeline>
+class AcceptSteeringPipelineFactory : public AcceptPipelineFactory {
+ public:
+  AcceptSteeringPipelineFactory(
+      ServerBootstrap<Pipeline>* server,
+      typename AcceptSteeringHandler<Pipeline>::Parser parser,
+      std::shared_ptr<PipelineFactory<Pipeline>> childPipelineFactory,
+      std::shared_ptr<WorkerSelector> workerSelector = nullptr,
+      size_t maxPeekBytes = 4096,
+      std::chrono::milliseconds timeout = std::chrono::milliseconds(5000))
+      : server_(CHECK_NOTNULL(server)),
+        parser_(std::move(parser)),
+        childPipelineFactory_(std::move(childPipelineFactory)),
+        workerSelector_(workerSelector ? workerSelector :
+                        std::make_shared<ModuloWorkerSelector>()),
+        maxPeekBytes_(maxPeekBytes),
+        timeout_(timeout) {}
+
+  AcceptPipeline::Ptr newPipeline(Acceptor* acceptor) override {
+    auto pipeline = AcceptPipeline::create();
+    pipeline->addBack(AcceptSteeringHandler<Pipeline>(
+        server_, parser_, childPipelineFactory_, workerSelector_,
+        maxPeekBytes_, timeout_));
+    pipeline->finalize();
+
+    return pipeline;
+  }
+
+ protected:
+  ServerBootstrap<Pipeline>* server_;
+  typename AcceptSteeringHandler<Pipeline>::Parser parser_;
+  std::shared_ptr<PipelineFactory<Pipeline>> childPipelineFactory_;
+  std::shared_ptr<WorkerSelector> workerSelector_;
+  size_t maxPeekBytes_;
+  std::chrono::milliseconds timeout_;
+};
+
+} // namespace wangle
+
+#include <wangle/bootstrap/AcceptSteeringHandler-inl.h>
@@ -0,0 +1,299 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/bootstrap/BatchedUDPServerSocket.h>
+
+#include <folly/MoveWrapper.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <netinet/in.h>
+#include <system_error>
+
+#ifdef __linux__
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#endif
+
+using folly::AsyncUDPSocket;
+using folly::IOBuf;
+using folly::SocketAddress;
+
+namespace {
+
+// Holds the UDP_GRO segment size of each read
+const size_t kControlSize = CMSG_SPACE(sizeof(int));
+
+// The most the kernel coalesces with UDP_GRO
+const size_t kMaxGroSize = 65535;
+
+} // namespace
+
+namespace wangle {
+
+BatchedUDPServerSocket::BatchedUDPServerSocket(
+    folly::EventBase* evb,
+    size_t batchSize,
+    size_t maxPacketSize)
+  : folly::EventHandler(evb),
+    evb_(evb),
+    batchSize_(std::max<size_t>(1, batchSize)),
+    maxPacketSize_(maxPacketSize),
+    socket_(std::make_shared<AsyncUDPSocket>(evb)) {
+}
+
+BatchedUDPServerSocket::~BatchedUDPServerSocket() {
+  close();
+}
+
+void BatchedUDPServerSocket::setReusePort(bool reusePort) {
+  socket_->setReusePort(reusePort);
+}
+
+void BatchedUDPServerSocket::bind(const SocketAddress& address) {
+  socket_->bind(address);
+  if (gro_) {
+#ifdef UDP_GRO
+    int on = 1;
+    if (setsockopt(socket_->getFD(), SOL_UDP, UDP_GRO, &on, sizeof(on)) != 0) {
+      throw std::system_error(errno, std::system_category(),
+                              "failed to enable UDP GRO");
+    }
+#else
+    throw std::runtime_error("UDP GRO is not supported on this platform");
+#endif
+  }
+}
+
+void BatchedUDPServerSocket::addListener(
+    folly::EventBase* evb, Acceptor* listener) {
+  listeners_.emplace_back(evb, listener);
+}
+
+void BatchedUDPServerSocket::listen() {
+  CHECK(socket_->getFD() >= 0) << "need to bind before listening";
+  msgs_.resize(batchSize_);
+  iovs_.resize(batchSize_);
+  addrs_.resize(batchSize_);
+  bufs_.resize(batchSize_);
+  if (gro_) {
+    control_.resize(batchSize_ * kControlSize);
+  }
+  for (size_t i = 0; i < batchSize_; i++) {
+    resetSlot(i);
+  }
+
+  for (auto& listener : listeners_) {
+    folly::AsyncUDPServerSocket::Callback* callback = listener.second;
+    listener.first->runInEventBaseThread([callback] {
+      callback->onListenStarted();
+    });
+  }
+  changeHandlerFD(socket_->getFD());
+  registerHandler(folly::EventHandler::READ | folly::EventHandler::PERSIST);
+}
+
+void BatchedUDPServerSocket::close() {
+  if (socket_->getFD() < 0) {
+    return;
+  }
+  unregisterHandler();
+  for (auto& listener : listeners_) {
+    folly::AsyncUDPServerSocket::Callback* callback = listener.second;
+    listener.first->runInEventBaseThread([callback] {
+      callback->onListenStopped();
+    });
+  }
+  listeners_.clear();
+  socket_->close();
+}
+
+void BatchedUDPServerSocket::resetSlot(size_t i) {
+  if (!bufs_[i]) {
+    bufs_[i] = IOBuf::create(gro_ ? kMaxGroSize : maxPacketSize_);
+  }
+  iovs_[i].iov_base = bufs_[i]->writableTail();
+  iovs_[i].iov_len = bufs_[i]->tailroom();
+
+  memset(&msgs_[i], 0, sizeof(msgs_[i]));
+  auto& hdr = msgs_[i].msg_hdr;
+  hdr.msg_name = &addrs_[i];
+  hdr.msg_namelen = sizeof(addrs_[i]);
+  hdr.msg_iov = &iovs_[i];
+  hdr.msg_iovlen = 1;
+  if (gro_) {
+    hdr.msg_control = &control_[i * kControlSize];
+    hdr.msg_controllen = kControlSize;
+  }
+}
+
+void BatchedUDPServerSocket::handlerReady(uint16_t /*events*/) noexcept {
+  int n = recvmmsg(socket_->getFD(), msgs_.data(), msgs_.size(),
+                   MSG_DONTWAIT, nullptr);
+  if (n <= 0) {
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      PLOG(ERROR) << "recvmmsg() failed on " << socket_->address();
+    }
+    return;
+  }
+
+  std::vector<UDPDatagram> datagrams;
+  datagrams.reserve(n);
+  for (int i = 0; i < n; i++) {
+    auto& hdr = msgs_[i].msg_hdr;
+    size_t len = msgs_[i].msg_len;
+    SocketAddress address;
+    address.setFromSockaddr(
+        reinterpret_cast<sockaddr*>(&addrs_[i]), hdr.msg_namelen);
+    bool truncated = hdr.msg_flags & MSG_TRUNC;
+
+    int segment = 0;
+#ifdef UDP_GRO
+    if (gro_) {
+      for (auto cmsg = CMSG_FIRSTHDR(&hdr); cmsg;
+           cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+          memcpy(&segment, CMSG_DATA(cmsg), sizeof(segment));
+        }
+      }
+    }
+#endif
+
+    auto buf = std::move(bufs_[i]);
+    buf->append(len);
+    if (segment > 0 && len > size_t(segment)) {
+      // Coalesced by GRO: split back into datagrams sharing the buffer
+      for (size_t offset = 0; offset < len; offset += segment) {
+        datagrams.emplace_back();
+        auto& datagram = datagrams.back();
+        datagram.buf = buf->cloneOne();
+        datagram.buf->trimStart(offset);
+        datagram.buf->trimEnd(
+          datagram.buf->length() -
+          std::min<size_t>(segment, datagram.buf->length()));
+        datagram.address = address;
+      }
+      datagrams.back().truncated = truncated;
+    } else {
+      datagrams.emplace_back();
+      auto& datagram = datagrams.back();
+      datagram.buf = std::move(buf);
+      datagram.address = std::move(address);
+      datagram.truncated = truncated;
+    }
+    resetSlot(i);
+  }
+  dispatch(std::move(datagrams));
+}
+
+void BatchedUDPServerSocket::dispatch(std::vector<UDPDatagram> datagrams) {
+  if (listeners_.empty()) {
+    return;
+  }
+  auto& listener = listeners_[nextListener_++ % listeners_.size()];
+  auto acceptor = listener.second;
+  auto socket = socket_;
+  auto batch = folly::makeMoveWrapper(std::move(datagrams));
+  listener.first->runInEventBaseThread([acceptor, socket, batch]() mutable {
+    acceptor->onDataBatchAvailable(socket, std::move(*batch));
+  });
+}
+
+size_t BatchedUDPServerSocket::writeBatch(
+    AsyncUDPSocket& socket,
+    const std::vector<UDPDatagram>& datagrams) {
+  std::vector<mmsghdr> msgs(datagrams.size());
+  std::vector<sockaddr_storage> addrs(datagrams.size());
+  // Reserved up front, as the headers point into it
+  std::vector<iovec> iovs;
+  size_t numIovs = 0;
+  for (const auto& datagram : datagrams) {
+    numIovs += datagram.buf->countChainElements();
+  }
+  iovs.reserve(numIovs);
+
+  for (size_t i = 0; i < datagrams.size(); i++) {
+    memset(&msgs[i], 0, sizeof(msgs[i]));
+    auto& hdr = msgs[i].msg_hdr;
+    hdr.msg_name = &addrs[i];
+    hdr.msg_namelen = datagrams[i].address.getAddress(&addrs[i]);
+    hdr.msg_iov = iovs.data() + iovs.size();
+    for (auto range : *datagrams[i].buf) {
+      iovec iov = {const_cast<uint8_t*>(range.data()), range.size()};
+      iovs.push_back(iov);
+    }
+    hdr.msg_iovlen = iovs.data() + iovs.size() - hdr.msg_iov;
+  }
+
+  size_t sent = 0;
+  while (sent < msgs.size()) {
+    int n = sendmmsg(socket.getFD(), msgs.data() + sent, msgs.size() - sent, 0);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    sent += n;
+  }
+  return sent;
+}
+
+ssize_t BatchedUDPServerSocket::writeGso(
+    AsyncUDPSocket& socket,
+    const SocketAddress& address,
+    const IOBuf& buf,
+    uint16_t segmentSize) {
+#ifdef UDP_SEGMENT
+  sockaddr_storage addr;
+  std::vector<iovec> iovs;
+  for (auto range : buf) {
+    iovec iov = {const_cast<uint8_t*>(range.data()), range.size()};
+    iovs.push_back(iov);
+  }
+  union {
+    char buf[CMSG_SPACE(sizeof(uint16_t))];
+    cmsghdr align;
+  } control;
+  memset(&control, 0, sizeof(control));
+
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_name = &addr;
+  msg.msg_namelen = address.getAddress(&addr);
+  msg.msg_iov = iovs.data();
+  msg.msg_iovlen = iovs.size();
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  auto cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_UDP;
+  cmsg->cmsg_type = UDP_SEGMENT;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(segmentSize));
+  memcpy(CMSG_DATA(cmsg), &segmentSize, sizeof(segmentSize));
+
+  ssize_t ret;
+  do {
+    ret = sendmsg(socket.getFD(), &msg, 0);
+  } while (ret < 0 && errno == EINTR);
+  return ret;
+#else
+  errno = ENOPROTOOPT;
+  return -1;
+#endif
+}
+
+} // namespace wangle
@@ -0,0 +1,114 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <wangle/acceptor/Acceptor.h>
+
+#include <folly/io/async/AsyncUDPSocket.h>
+#include <folly/io/async/EventHandler.h>
+
+#include <sys/socket.h>
+#include <vector>
+
+namespace wangle {
+
+/**
+ * A UDP server socket that reads up to batchSize datagrams per wakeup
+ * (recvmmsg), and hands each batch to one listener, round robin, with
+ * Acceptor::onDataBatchAvailable(). AsyncUDPServerSocket instead hands
+ * datagrams over one at a time, each with its own hop to the listener's
+ * thread.
+ *
+ * With setGro(), the kernel coalesces datagrams of a flow into one read
+ * (UDP_GRO), which is split back into datagrams sharing one buffer.
+ *
+ * Created by AsyncUDPServerSocketFactory::setBatchSize(). Must be used and
+ * destroyed in the thread of its EventBase.
+ */
+class BatchedUDPServerSocket : public folly::AsyncSocketBase,
+                               private folly::EventHandler {
+ public:
+  BatchedUDPServerSocket(
+      folly::EventBase* evb,
+      size_t batchSize = 32,
+      size_t maxPacketSize = 1500);
+  ~BatchedUDPServerSocket();
+
+  void setReusePort(bool reusePort);
+
+  // Linux 5.0 and later; bind() throws if unsupported
+  void setGro(bool gro) {
+    gro_ = gro;
+  }
+
+  void bind(const folly::SocketAddress& address);
+  void addListener(folly::EventBase* evb, Acceptor* listener);
+  void listen();
+  void close();
+
+  folly::EventBase* getEventBase() const override {
+    return evb_;
+  }
+
+  void getAddress(folly::SocketAddress* address) const override {
+    *address = socket_->address();
+  }
+
+  // To reply on
+  std::shared_ptr<folly::AsyncUDPSocket> getSocket() const {
+    return socket_;
+  }
+
+  /**
+   * Sends datagrams on socket in as few syscalls as possible (sendmmsg).
+   * Returns how many were sent, fewer than all only on error, with errno
+   * set.
+   */
+  static size_t writeBatch(
+      folly::AsyncUDPSocket& socket,
+      const std::vector<UDPDatagram>& datagrams);
+
+  /**
+   * Sends buf to address as datagrams of segmentSize bytes, the last one
+   * possibly shorter, split by the kernel or the NIC (UDP_SEGMENT, Linux
+   * 4.18 and later). Returns the bytes sent, or -1 with errno set.
+   */
+  static ssize_t writeGso(
+      folly::AsyncUDPSocket& socket,
+      const folly::SocketAddress& address,
+      const folly::IOBuf& buf,
+      uint16_t segmentSize);
+
+ private:
+  void handlerReady(uint16_t events) noexcept override;
+
+  // Points slot i at a fresh buffer, and resets what recvmmsg() changed
+  void resetSlot(size_t i);
+
+  void dispatch(std::vector<UDPDatagram> datagrams);
+
+  folly::EventBase* const evb_;
+  const size_t batchSize_;
+  const size_t maxPacketSize_;
+  bool gro_{false};
+  std::shared_ptr<folly::AsyncUDPSocket> socket_;
+
+  std::vector<std::pair<folly::EventBase*, Acceptor*>> listeners_;
+  size_t nextListener_{0};
+
+  // Reused across reads
+  std::vector<mmsghdr> msgs_;
+  std::vector<iovec> iovs_;
+  std::vector<sockaddr_storage> addrs_;
+  std::vector<std::unique_ptr<folly::IOBuf>> bufs_;
+  std::vector<char> control_;
+};
+
+} // namespace wangle
@@ -9,15 +9,33 @@
  */
 
 #include "wangle/bootstrap/ServerBootstrap.h"
+#include "wangle/bootstrap/AcceptRoutingHandler.h"
+#include "wangle/bootstrap/AcceptSteeringHandler.h"
 #include "wangle/bootstrap/ClientBootstrap.h"
+#include "wangle/bootstrap/ClientConnectionPool.h"
+#include "wangle/bootstrap/RoutingDataHandler.h"
+#include "wangle/channel/AsyncSocketHandler.h"
 #include "wangle/channel/Handler.h"
+#include "wangle/codec/BufferScanner.h"
+#include "wangle/codec/LineBasedFrameDecoder.h"
+#include "wangle/codec/StringCodec.h"
+#include "wangle/concurrent/AffinityThreadFactory.h"
+#include "wangle/service/ServerDispatcher.h"
+#include "wangle/service/Service.h"
 
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 #include <boost/thread.hpp>
+#include <folly/Baton.h>
+#include <folly/Memory.h>
 #include <folly/String.h>
 #include <folly/experimental/TestUtil.h>
 
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+
 using namespace wangle;
 using namespace folly;
 
@@ -262,6 +280,109 @@ TEST(Bootstrap, SharedThreadPool) {
   EXPECT_EQ(factory->pipelines, 5);
 }
 
+#if defined(__linux__) && defined(SO_INCOMING_CPU)
+// Checks each connection arrives on the CPU of the thread accepting it
+class SteeredPipelineFactory : public PipelineFactory<BytesPipeline> {
+ public:
+  BytesPipeline::Ptr newPipeline(
+      std::shared_ptr<AsyncTransportWrapper> sock) override {
+    int cpu = -1;
+    socklen_t len = sizeof(cpu);
+    auto fd = std::dynamic_pointer_cast<AsyncSocket>(sock)->getFd();
+    EXPECT_EQ(0, getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len));
+    EXPECT_EQ(sched_getcpu(), cpu);
+    pipelines++;
+    auto pipeline = BytesPipeline::create();
+    pipeline->addBack(new BytesToBytesHandler());
+    pipeline->finalize();
+    return pipeline;
+  }
+  std::atomic<int> pipelines{0};
+};
+
+TEST(Bootstrap, CpuSteering) {
+  if (sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+    LOG(INFO) << "CPU steering needs two CPUs to test";
+    return;
+  }
+  // One thread on each of CPU 0 and 1
+  auto pool = std::make_shared<IOThreadPoolExecutor>(
+    2,
+    std::make_shared<AffinityThreadFactory>(
+      std::make_shared<NamedThreadFactory>("Steered"),
+      std::vector<std::vector<size_t>>{{0}, {1}}));
+  auto socketFactory = std::make_shared<AsyncServerSocketFactory>();
+  socketFactory->setCpuSteering(true);
+
+  TestServer server;
+  auto factory = std::make_shared<SteeredPipelineFactory>();
+  server.childPipeline(factory);
+  server.channelFactory(socketFactory);
+  server.group(pool, pool);
+  try {
+    server.bind(0);
+  } catch (const std::system_error& e) {
+    LOG(INFO) << "Reuse port CPU steering probably not supported: "
+              << e.what();
+    return;
+  }
+
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+
+  // Over loopback, the SYN is received on the CPU that sent it
+  cpu_set_t saved;
+  ASSERT_EQ(0, sched_getaffinity(0, sizeof(saved), &saved));
+  std::vector<std::unique_ptr<TestClient>> clients;
+  for (int cpu = 0; cpu < 2; cpu++) {
+    cpu_set_t one;
+    CPU_ZERO(&one);
+    CPU_SET(cpu, &one);
+    ASSERT_EQ(0, sched_setaffinity(0, sizeof(one), &one));
+    clients.emplace_back(new TestClient);
+    clients.back()->pipelineFactory(
+        std::make_shared<TestClientPipelineFactory>());
+    clients.back()->connect(address);
+  }
+  sched_setaffinity(0, sizeof(saved), &saved);
+
+  EventBaseManager::get()->getEventBase()->loop();
+
+  server.stop();
+  server.join();
+
+  EXPECT_EQ(factory->pipelines, 2);
+}
+#endif
+
+#ifdef TCP_DEFER_ACCEPT
+TEST(Bootstrap, ListenOptions) {
+  ServerSocketConfig config;
+  config.fastOpenQueueSize = 16;
+  config.deferAcceptTimeout = std::chrono::seconds(5);
+
+  TestServer server;
+  auto factory = std::make_shared<TestPipelineFactory>();
+  server.childPipeline(factory);
+  server.acceptorConfig(config);
+  server.bind(0);
+
+  auto socket = std::dynamic_pointer_cast<AsyncServerSocket>(
+      server.getSockets()[0]);
+  ASSERT_TRUE(socket);
+  for (auto fd : socket->getSockets()) {
+    int secs = 0;
+    socklen_t len = sizeof(secs);
+    ASSERT_EQ(0, getsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &secs, &len));
+    // Rounded up to a number of SYN-ACK retransmissions
+    EXPECT_GE(secs, 5);
+  }
+
+  server.stop();
+  server.join();
+}
+#endif
+
 TEST(Bootstrap, ExistingSocket) {
   TestServer server;
   auto factory = std::make_shared<TestPipelineFactory>();
@@ -270,6 +391,730 @@ TEST(Bootstrap, ExistingSocket) {
   server.bind(std::move(socket));
 }
 
+TEST(Bootstrap, Handoff) {
+  folly::test::TemporaryDirectory tmpdir;
+  auto path = tmpdir.path().string() + "/handoff";
+
+  TestServer server;
+  auto factory = std::make_shared<TestPipelineFactory>();
+  server.childPipeline(factory);
+  server.bind(0);
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+
+  std::thread handoff([&] {
+    server.handoff(path, "seeds", std::chrono::seconds(5));
+  });
+
+  TestServer successor;
+  auto successorFactory = std::make_shared<TestPipelineFactory>();
+  successor.childPipeline(successorFactory);
+  std::string data;
+  bool bound = false;
+  // Until the predecessor waits at path
+  for (int i = 0; i < 1000 && !bound; i++) {
+    try {
+      successor.bindHandoff(path, &data);
+      bound = true;
+    } catch (const std::system_error&) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  handoff.join();
+  ASSERT_TRUE(bound);
+  EXPECT_EQ("seeds", data);
+  EXPECT_TRUE(server.getSockets().empty());
+
+  SocketAddress successorAddress;
+  successor.getSockets()[0]->getAddress(&successorAddress);
+  EXPECT_EQ(address, successorAddress);
+
+  auto base = EventBaseManager::get()->getEventBase();
+  TestClient client;
+  client.pipelineFactory(std::make_shared<TestClientPipelineFactory>());
+  client.connect(address);
+  base->loop();
+  successor.stop();
+  successor.join();
+  server.join();
+
+  EXPECT_EQ(0, factory->pipelines);
+  EXPECT_EQ(1, successorFactory->pipelines);
+}
+
+class PooledClientPipelineFactory : public PipelineFactory<BytesPipeline> {
+ public:
+  BytesPipeline::Ptr newPipeline(
+      std::shared_ptr<AsyncTransportWrapper> sock) override {
+    pipelines++;
+    auto pipeline = BytesPipeline::create();
+    pipeline->addBack(AsyncSocketHandler(sock));
+    pipeline->finalize();
+    return pipeline;
+  }
+  int pipelines{0};
+};
+
+TEST(Bootstrap, ClientConnectionPool) {
+  typedef ClientConnectionPool<BytesPipeline> Pool;
+
+  TestServer server;
+  server.childPipeline(std::make_shared<TestPipelineFactory>());
+  server.bind(0);
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+
+  auto base = EventBaseManager::get()->getEventBase();
+  auto factory = std::make_shared<PooledClientPipelineFactory>();
+  ClientConnectionPoolOptions options;
+  options.maxPerHost = 1;
+  {
+    Pool pool(base, factory, nullptr, options);
+    BytesPipeline* first = nullptr;
+    bool reused = false;
+    pool.get(address).then([&](Try<Pool::Lease>&& t) {
+      auto lease = std::move(t.value());
+      first = lease.get();
+      // At maxPerHost, so waits for the first one to be released
+      pool.get(address).then([&](Try<Pool::Lease>&& t2) {
+        EXPECT_EQ(first, t2.value().get());
+        reused = true;
+        base->terminateLoopSoon();
+      });
+    });
+    base->loop();
+
+    EXPECT_TRUE(reused);
+    EXPECT_EQ(1, factory->pipelines);
+    EXPECT_EQ(1, pool.getNumIdle(address));
+    EXPECT_EQ(0, pool.getNumIdle(address, "other"));
+  }
+
+  server.stop();
+  server.join();
+}
+
+class EchoHandler : public BytesToBytesHandler {
+ public:
+  void read(Context* ctx, IOBufQueue& q) override {
+    ctx->fireWrite(q.move());
+  }
+};
+
+class EchoPipelineFactory : public PipelineFactory<BytesPipeline> {
+ public:
+  BytesPipeline::Ptr newPipeline(
+      std::shared_ptr<AsyncTransportWrapper> sock) override {
+    auto pipeline = BytesPipeline::create();
+    pipeline->addBack(AsyncSocketHandler(sock));
+    pipeline->addBack(EchoHandler());
+    pipeline->finalize();
+    return pipeline;
+  }
+};
+
+TEST(Bootstrap, ClientConnectionPoolConnectFailed) {
+  typedef ClientConnectionPool<BytesPipeline> Pool;
+
+  auto base = EventBaseManager::get()->getEventBase();
+  ClientConnectionPoolOptions options;
+  options.maxPerHost = 1;
+  Pool pool(base, std::make_shared<PooledClientPipelineFactory>(), nullptr,
+            options);
+  // Nothing listens on port 1
+  SocketAddress address("127.0.0.1", 1);
+  int failed = 0;
+  auto onFailure = [&](Try<Pool::Lease>&& t) {
+    EXPECT_TRUE(t.hasException());
+    if (++failed == 3) {
+      base->terminateLoopSoon();
+    }
+  };
+  pool.get(address).then(onFailure);
+  // At maxPerHost, so wait for the first one, which fails
+  pool.get(address).then(onFailure);
+  pool.get(address).then(onFailure);
+  base->loop();
+
+  EXPECT_EQ(3, failed);
+  EXPECT_EQ(0, pool.getNumIdle(address));
+}
+
+TEST(Bootstrap, RebalanceConnections) {
+  typedef ServerAcceptor<BytesPipeline> TestServerAcceptor;
+
+  TestServer server;
+  server.childPipeline(std::make_shared<EchoPipelineFactory>());
+  server.group(std::make_shared<IOThreadPoolExecutor>(2));
+  server.bind(0);
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+
+  std::vector<int> fds;
+  for (int i = 0; i < 8; i++) {
+    sockaddr_storage addr;
+    auto len = address.getAddress(&addr);
+    int fd = socket(address.getFamily(), SOCK_STREAM, 0);
+    ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&addr), len));
+    fds.push_back(fd);
+  }
+  auto echoAll = [&] {
+    for (auto fd : fds) {
+      char buf[4];
+      EXPECT_EQ(4, write(fd, "ping", 4));
+      EXPECT_EQ(4, read(fd, buf, 4));
+      EXPECT_EQ("ping", std::string(buf, 4));
+    }
+  };
+  std::vector<TestServerAcceptor*> acceptors;
+  server.forEachWorker([&](Acceptor* acceptor) {
+    acceptors.push_back(dynamic_cast<TestServerAcceptor*>(acceptor));
+  });
+  ASSERT_EQ(2, acceptors.size());
+  auto waitFor = [&](size_t first, size_t second) {
+    for (int i = 0; i < 500; i++) {
+      if (acceptors[0]->getNumConnectionsAnyThread() == first &&
+          acceptors[1]->getNumConnectionsAnyThread() == second) {
+        return true;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+  };
+  // Accepted round robin
+  echoAll();
+  ASSERT_TRUE(waitFor(4, 4));
+
+  // Pile them up on one thread
+  auto from = acceptors[0];
+  auto to = acceptors[1];
+  from->getEventBase()->runImmediatelyOrRunInEventBaseThreadAndWait([&] {
+    auto conns = from->detachConnections(8, nullptr);
+    EXPECT_EQ(4, conns.size());
+    to->getEventBase()->runInEventBaseThread([to, conns] {
+      to->adoptConnections(conns);
+    });
+  });
+  EXPECT_TRUE(waitFor(0, 8));
+  echoAll();
+
+  server.rebalanceConnections();
+  EXPECT_TRUE(waitFor(4, 4));
+  echoAll();
+
+  for (auto fd : fds) {
+    close(fd);
+  }
+  server.stop();
+  server.join();
+}
+
+// Answers each request once told to, in the IO thread
+class HeldService : public Service<std::string, std::string> {
+ public:
+  Future<std::string> operator()(std::string) override {
+    promises.emplace_back();
+    return promises.back().getFuture();
+  }
+  std::vector<Promise<std::string>> promises;
+};
+
+class HeldServicePipelineFactory : public PipelineFactory<BytesPipeline> {
+ public:
+  BytesPipeline::Ptr newPipeline(
+      std::shared_ptr<AsyncTransportWrapper> sock) override {
+    auto pipeline = BytesPipeline::create();
+    pipeline->addBack(AsyncSocketHandler(sock));
+    pipeline->addBack(LineBasedFrameDecoder(8192));
+    pipeline->addBack(StringCodec());
+    pipeline->addBack(SerialServerDispatcher<std::string>(&service));
+    pipeline->finalize();
+    return pipeline;
+  }
+  HeldService service;
+};
+
+TEST(Bootstrap, RebalanceMovesOnlyIdleConnections) {
+  typedef ServerAcceptor<BytesPipeline> TestServerAcceptor;
+
+  auto factory = std::make_shared<HeldServicePipelineFactory>();
+  TestServer server;
+  server.childPipeline(factory);
+  server.group(std::make_shared<IOThreadPoolExecutor>(1));
+  server.bind(0);
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+  TestServerAcceptor* acceptor = nullptr;
+  server.forEachWorker([&](Acceptor* worker) {
+    acceptor = dynamic_cast<TestServerAcceptor*>(worker);
+  });
+  ASSERT_NE(nullptr, acceptor);
+  auto evb = acceptor->getEventBase();
+
+  sockaddr_storage addr;
+  auto len = address.getAddress(&addr);
+  int fd = socket(address.getFamily(), SOCK_STREAM, 0);
+  ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&addr), len));
+  EXPECT_EQ(4, write(fd, "req\n", 4));
+  bool dispatched = false;
+  for (int i = 0; i < 500 && !dispatched; i++) {
+    evb->runInEventBaseThreadAndWait([&] {
+      dispatched = !factory->service.promises.empty();
+    });
+    if (!dispatched) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+  ASSERT_TRUE(dispatched);
+
+  size_t moved = 0;
+  evb->runInEventBaseThreadAndWait([&] {
+    // Still serving the request
+    moved = acceptor->detachConnections(1, nullptr).size();
+    factory->service.promises.front().setValue("resp");
+  });
+  EXPECT_EQ(0, moved);
+  char buf[4];
+  EXPECT_EQ(4, read(fd, buf, 4));
+  EXPECT_EQ("resp", std::string(buf, 4));
+
+  evb->runInEventBaseThreadAndWait([&] {
+    // Idle once its response is written
+    auto conns = acceptor->detachConnections(1, nullptr);
+    moved = conns.size();
+    acceptor->adoptConnections(conns);
+  });
+  EXPECT_EQ(1, moved);
+  close(fd);
+  server.stop();
+  server.join();
+}
+
+TEST(Bootstrap, AcceptSteering) {
+  typedef ServerAcceptor<BytesPipeline> TestServerAcceptor;
+
+  // Routed by their first byte, once they sent two
+  auto parser = [](const IOBufQueue& data, uint64_t& hash) {
+    if (data.chainLength() < 2) {
+      return false;
+    }
+    auto buf = data.front()->clone();
+    buf->coalesce();
+    hash = buf->data()[0] - '0';
+    return true;
+  };
+  TestServer server;
+  server.pipeline(std::make_shared<AcceptSteeringPipelineFactory<
+      BytesPipeline>>(
+          &server, parser, std::make_shared<EchoPipelineFactory>()));
+  server.group(std::make_shared<IOThreadPoolExecutor>(2));
+  server.bind(0);
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+
+  std::vector<TestServerAcceptor*> acceptors;
+  server.forEachWorker([&](Acceptor* acceptor) {
+    acceptors.push_back(dynamic_cast<TestServerAcceptor*>(acceptor));
+  });
+  ASSERT_EQ(2, acceptors.size());
+
+  std::vector<int> fds;
+  for (int i = 0; i < 4; i++) {
+    sockaddr_storage addr;
+    auto len = address.getAddress(&addr);
+    int fd = socket(address.getFamily(), SOCK_STREAM, 0);
+    ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&addr), len));
+    fds.push_back(fd);
+  }
+  // The bytes read to route a connection are echoed along with the rest
+  for (auto fd : fds) {
+    char buf[6];
+    EXPECT_EQ(1, write(fd, "1", 1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_EQ(5, write(fd, "ping!", 5));
+    size_t got = 0;
+    while (got < sizeof(buf)) {
+      auto n = read(fd, buf + got, sizeof(buf) - got);
+      ASSERT_GT(n, 0);
+      got += n;
+    }
+    EXPECT_EQ("1ping!", std::string(buf, 6));
+  }
+  EXPECT_EQ(0, acceptors[0]->getNumConnectionsAnyThread());
+  EXPECT_EQ(4, acceptors[1]->getNumConnectionsAnyThread());
+
+  for (auto fd : fds) {
+    close(fd);
+  }
+  server.stop();
+  server.join();
+}
+
+TEST(Bootstrap, EventBaseMetrics) {
+  TestServer server;
+  server.childPipeline(std::make_shared<EchoPipelineFactory>());
+  server.group(std::make_shared<IOThreadPoolExecutor>(2));
+  server.bind(0);
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+
+  std::vector<int> fds;
+  for (int i = 0; i < 4; i++) {
+    sockaddr_storage addr;
+    auto len = address.getAddress(&addr);
+    int fd = socket(address.getFamily(), SOCK_STREAM, 0);
+    ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&addr), len));
+    char buf[4];
+    EXPECT_EQ(4, write(fd, "ping", 4));
+    EXPECT_EQ(4, read(fd, buf, 4));
+    fds.push_back(fd);
+  }
+  // Summed over the threads, once their counters caught up
+  auto waitFor = [&](uint64_t connections) {
+    for (int i = 0; i < 500; i++) {
+      auto metrics = server.getEventBaseMetrics();
+      EXPECT_EQ(2, metrics.size());
+      EventBaseMetrics::Snapshot total;
+      for (const auto& thread : metrics) {
+        total.connections += thread.connections;
+        total.bytesRead += thread.bytesRead;
+        total.bytesWritten += thread.bytesWritten;
+        total.loops += thread.loops;
+      }
+      if (total.connections == connections) {
+        EXPECT_EQ(16, total.bytesRead);
+        EXPECT_EQ(16, total.bytesWritten);
+        EXPECT_GT(total.loops, 0);
+        return true;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+  };
+  EXPECT_TRUE(waitFor(4));
+
+  for (auto fd : fds) {
+    close(fd);
+  }
+  EXPECT_TRUE(waitFor(0));
+  server.stop();
+  server.join();
+}
+
+TEST(Bootstrap, ThreadPerCore) {
+  TestServer server;
+  server.childPipeline(std::make_shared<EchoPipelineFactory>());
+  server.threadPerCore();
+  server.group(std::make_shared<IOThreadPoolExecutor>(2));
+  try {
+    server.bind(0);
+  } catch (const std::system_error& e) {
+    LOG(INFO) << "Reuse port probably not supported: " << e.what();
+    return;
+  }
+
+  // A socket in each IO thread
+  std::set<EventBase*> bases;
+  server.forEachWorker([&](Acceptor* acceptor) {
+    bases.insert(acceptor->getEventBase());
+  });
+  ASSERT_EQ(2, bases.size());
+  ASSERT_EQ(2, server.getSockets().size());
+  std::set<EventBase*> socketBases;
+  for (auto& socket : server.getSockets()) {
+    EXPECT_EQ(1, bases.count(socket->getEventBase()));
+    socketBases.insert(socket->getEventBase());
+  }
+  EXPECT_EQ(bases, socketBases);
+
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+  for (int i = 0; i < 8; i++) {
+    sockaddr_storage addr;
+    auto len = address.getAddress(&addr);
+    int fd = socket(address.getFamily(), SOCK_STREAM, 0);
+    ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&addr), len));
+    char buf[4];
+    EXPECT_EQ(4, write(fd, "ping", 4));
+    EXPECT_EQ(4, read(fd, buf, 4));
+    EXPECT_EQ("ping", std::string(buf, 4));
+    close(fd);
+  }
+  server.stop();
+  server.join();
+}
+
+TEST(Bootstrap, IoUringServer) {
+  if (!IoUring::isSupported()) {
+    LOG(INFO) << "io_uring not supported, skipping";
+    return;
+  }
+  TestServer server;
+  server.childPipeline(std::make_shared<EchoPipelineFactory>());
+  server.channelFactory(std::make_shared<IoUringServerSocketFactory>());
+  server.group(std::make_shared<IOThreadPoolExecutor>(2));
+  server.bind(0);
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+  EXPECT_NE(0, address.getPort());
+
+  std::vector<int> fds;
+  for (int i = 0; i < 4; i++) {
+    sockaddr_storage addr;
+    auto len = address.getAddress(&addr);
+    int fd = socket(address.getFamily(), SOCK_STREAM, 0);
+    ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&addr), len));
+    fds.push_back(fd);
+  }
+  for (auto fd : fds) {
+    char buf[4];
+    EXPECT_EQ(4, write(fd, "ping", 4));
+    EXPECT_EQ(4, read(fd, buf, 4));
+    EXPECT_EQ("ping", std::string(buf, 4));
+    close(fd);
+  }
+  size_t acceptors = 0;
+  server.forEachWorker([&](Acceptor*) { acceptors++; });
+  EXPECT_EQ(2, acceptors);
+  server.stop();
+  server.join();
+}
+
+TEST(Bootstrap, ClientConnectRace) {
+  TestServer server;
+  auto factory = std::make_shared<TestPipelineFactory>();
+  server.childPipeline(factory);
+  server.bind(0);
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+
+  auto base = EventBaseManager::get()->getEventBase();
+  TestClient client;
+  client.pipelineFactory(std::make_shared<PooledClientPipelineFactory>());
+  // Nothing listens on port 1, and the next attempt starts when it fails
+  std::vector<SocketAddress> addresses{
+    SocketAddress("127.0.0.1", 1), address};
+  bool connected = false;
+  client.connect(addresses, std::chrono::seconds(5), std::chrono::seconds(5))
+    .then([&](BytesPipeline* pipeline) {
+      EXPECT_EQ(client.getPipeline(), pipeline);
+      connected = true;
+      base->terminateLoopSoon();
+    });
+  base->loop();
+  server.stop();
+  server.join();
+
+  EXPECT_TRUE(connected);
+  EXPECT_EQ(1, factory->pipelines);
+}
+
+std::string testCertPath(const std::string& name) {
+  const std::string file = __FILE__;
+  return file.substr(0, file.rfind('/') + 1) + "../ssl/test/certs/" + name;
+}
+
+// Hands each session out once, to whichever thread connects next
+class OneTimeSessionCache : public SSLSessionCallbacks {
+ public:
+  void setSSLSession(const std::string& identity,
+                     SSLSessionPtr session) noexcept override {
+    std::lock_guard<std::mutex> g(lock_);
+    sessions_[identity] = std::move(session);
+  }
+
+  SSLSessionPtr getSSLSession(
+      const std::string& identity) const noexcept override {
+    std::lock_guard<std::mutex> g(lock_);
+    auto it = sessions_.find(identity);
+    if (it == sessions_.end()) {
+      return SSLSessionPtr(nullptr);
+    }
+    auto session = std::move(it->second);
+    sessions_.erase(it);
+    return session;
+  }
+
+  bool removeSSLSession(const std::string& identity) noexcept override {
+    std::lock_guard<std::mutex> g(lock_);
+    return sessions_.erase(identity) > 0;
+  }
+
+ private:
+  mutable std::mutex lock_;
+  mutable std::map<std::string, SSLSessionPtr> sessions_;
+};
+
+// Lets the socket close once connected
+class NoClientPipelineFactory : public PipelineFactory<BytesPipeline> {
+ public:
+  BytesPipeline::Ptr newPipeline(
+      std::shared_ptr<AsyncTransportWrapper>) override {
+    return nullptr;
+  }
+};
+
+TEST(Bootstrap, ClientSSLSessionCache) {
+  SSLContextConfig sslConfig;
+  sslConfig.setCertificate(
+    testCertPath("test.cert.pem"), testCertPath("test.key.pem"), "");
+  sslConfig.isDefault = true;
+  ServerSocketConfig config;
+  config.sslContextConfigs.push_back(sslConfig);
+
+  TestServer server;
+  server.acceptorConfig(config);
+  server.childPipeline(std::make_shared<TestPipelineFactory>());
+  server.bind(0);
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+
+  OneTimeSessionCache cache;
+  auto ctx = std::make_shared<SSLContext>();
+  {
+    TestClient client;
+    // Connects from each thread in turn
+    client.group(std::make_shared<IOThreadPoolExecutor>(2));
+    client.pipelineFactory(std::make_shared<NoClientPipelineFactory>());
+    client.sslSessionCache(&cache);
+    client.sslContext(ctx);
+    // Once, before any IO thread uses the context
+    EXPECT_EQ(&cache,
+              SSLSessionCallbacks::getCacheFromContext(ctx->getSSLCtx()));
+
+    client.connect(address).get();
+    EXPECT_EQ(1, client.getSSLHandshakes());
+    EXPECT_EQ(0, client.getSSLSessionResumptions());
+    // Resumes the session the other thread stored
+    client.connect(address).get();
+    EXPECT_EQ(2, client.getSSLHandshakes());
+    EXPECT_EQ(1, client.getSSLSessionResumptions());
+  }
+  SSLSessionCallbacks::detachCallbacksFromContext(ctx->getSSLCtx(), &cache);
+  server.stop();
+  server.join();
+}
+
+TEST(Bootstrap, ClientSSLSessionCacheContextSetLater) {
+  OneTimeSessionCache cache;
+  auto ctx = std::make_shared<SSLContext>();
+  TestClient client;
+  client.sslSessionCache(&cache);
+  EXPECT_EQ(nullptr,
+            SSLSessionCallbacks::getCacheFromContext(ctx->getSSLCtx()));
+  client.sslContext(ctx);
+  EXPECT_EQ(&cache,
+            SSLSessionCallbacks::getCacheFromContext(ctx->getSSLCtx()));
+  SSLSessionCallbacks::detachCallbacksFromContext(ctx->getSSLCtx(), &cache);
+}
+
+// The EventBase each connection was made on
+class EventBaseRecordingPipelineFactory
+    : public PipelineFactory<BytesPipeline> {
+ public:
+  BytesPipeline::Ptr newPipeline(
+      std::shared_ptr<AsyncTransportWrapper> sock) override {
+    base = sock->getEventBase();
+    return nullptr;
+  }
+  std::atomic<EventBase*> base{nullptr};
+};
+
+TEST(Bootstrap, ClientConnectDoesNotWait) {
+  TestServer server;
+  server.childPipeline(std::make_shared<TestPipelineFactory>());
+  server.bind(0);
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+
+  auto group = std::make_shared<IOThreadPoolExecutor>(1);
+  auto ioBase = group->getEventBase();
+  auto factory = std::make_shared<EventBaseRecordingPipelineFactory>();
+  TestClient client;
+  client.group(group);
+  client.pipelineFactory(factory);
+
+  // The IO thread is busy, and the connect is queued behind
+  folly::Baton<> busy;
+  folly::Baton<> release;
+  ioBase->runInEventBaseThread([&] {
+    busy.post();
+    release.wait();
+  });
+  busy.wait();
+  auto future = client.connect(address);
+  EXPECT_FALSE(future.isReady());
+  EXPECT_EQ(nullptr, factory->base.load());
+  release.post();
+
+  future.get();
+  EXPECT_EQ(ioBase, factory->base.load());
+  server.stop();
+  server.join();
+}
+
+TEST(Bootstrap, ClientDestroyedBeforeQueuedConnect) {
+  auto group = std::make_shared<IOThreadPoolExecutor>(1);
+  auto factory = std::make_shared<EventBaseRecordingPipelineFactory>();
+  auto client = folly::make_unique<TestClient>();
+  client->group(group);
+  client->pipelineFactory(factory);
+
+  folly::Baton<> busy;
+  folly::Baton<> release;
+  group->getEventBase()->runInEventBaseThread([&] {
+    busy.post();
+    release.wait();
+  });
+  busy.wait();
+  auto future = client->connect(SocketAddress("127.0.0.1", 1));
+  client.reset();
+  release.post();
+
+  EXPECT_THROW(future.get(), AsyncSocketException);
+  EXPECT_EQ(nullptr, factory->base.load());
+}
+
+TEST(Bootstrap, ClientUseCallerEventBase) {
+  TestServer server;
+  server.childPipeline(std::make_shared<TestPipelineFactory>());
+  server.bind(0);
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+
+  auto base = EventBaseManager::get()->getEventBase();
+  auto group = std::make_shared<IOThreadPoolExecutor>(1);
+  auto factory = std::make_shared<EventBaseRecordingPipelineFactory>();
+  TestClient client;
+  client.group(group);
+  client.pipelineFactory(factory);
+
+  // On one of group()
+  client.connect(address).get();
+  EXPECT_NE(nullptr, factory->base.load());
+  EXPECT_NE(base, factory->base.load());
+
+  // On this thread's, set up right away
+  client.useCallerEventBase(true);
+  bool connected = false;
+  client.connect(address).then([&](BytesPipeline*) {
+    connected = true;
+    base->terminateLoopSoon();
+  });
+  EXPECT_EQ(base, factory->base.load());
+  base->loop();
+  EXPECT_TRUE(connected);
+
+  // Without an EventBase of its own, a thread connects on group()'s
+  std::thread([&] {
+    EXPECT_EQ(nullptr, EventBaseManager::get()->getExistingEventBase());
+    client.connect(address).get();
+  }).join();
+  EXPECT_EQ(group->getEventBase(), factory->base.load());
+  server.stop();
+  server.join();
+}
+
 std::atomic<int> connections{0};
 
 class TestHandlerPipeline : public InboundHandler<AcceptPipelineType> {
@@ -365,6 +1210,40 @@ TEST(Bootstrap, UDPClientServerTest) {
   EXPECT_EQ(connections, 1);
 }
 
+TEST(Bootstrap, UDPBatchClientServerTest) {
+  connections = 0;
+
+  TestServer server;
+  auto pipelinefactory =
+    std::make_shared<TestHandlerPipelineFactory<TestUDPPipeline>>();
+  server.pipeline(pipelinefactory);
+  auto socketFactory = std::make_shared<AsyncUDPServerSocketFactory>();
+  socketFactory->setBatchSize(8);
+  server.channelFactory(socketFactory);
+  server.bind(0);
+
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+
+  auto base = EventBaseManager::get()->getEventBase();
+  AsyncUDPSocket client(base);
+  client.bind(SocketAddress("::1", 0));
+  std::vector<UDPDatagram> datagrams(3);
+  for (auto& datagram : datagrams) {
+    datagram.buf = IOBuf::copyBuffer("a");
+    datagram.address = address;
+  }
+  EXPECT_EQ(3, BatchedUDPServerSocket::writeBatch(client, datagrams));
+
+  for (int i = 0; i < 1000 && connections < 3; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  server.stop();
+  server.join();
+
+  EXPECT_EQ(3, connections);
+}
+
 TEST(Bootstrap, UnixServer) {
   TestServer server;
   auto factory = std::make_shared<TestPipelineFactory>();
@@ -388,6 +1267,455 @@ TEST(Bootstrap, UnixServer) {
   EXPECT_EQ(factory->pipelines, 1);
 }
 
+TEST(Bootstrap, UnixSeqPacketServer) {
+  TestServer server;
+  auto factory = std::make_shared<TestPipelineFactory>();
+  auto socketFactory = std::make_shared<AsyncServerSocketFactory>();
+  socketFactory->setSeqPacket(true);
+
+  folly::test::TemporaryDirectory tmpdir("wangle-bootstrap-test");
+  auto socketPath = (tmpdir.path() / "sock").string();
+
+  server.childPipeline(factory);
+  server.channelFactory(socketFactory);
+  SocketAddress address;
+  address.setFromPath(socketPath);
+  server.bind(address);
+  auto base = EventBaseManager::get()->getEventBase();
+
+  TestClient client;
+  client.pipelineFactory(std::make_shared<PooledClientPipelineFactory>());
+  client.seqPacket(true);
+  bool connected = false;
+  client.connect(address).then([&](BytesPipeline* pipeline) {
+    auto socket =
+      std::dynamic_pointer_cast<AsyncSocket>(pipeline->getTransport());
+    int type = 0;
+    socklen_t len = sizeof(type);
+    EXPECT_EQ(0, getsockopt(socket->getFd(), SOL_SOCKET, SO_TYPE,
+                            &type, &len));
+    EXPECT_EQ(SOCK_SEQPACKET, type);
+    connected = true;
+    base->terminateLoopSoon();
+  });
+  base->loop();
+  server.stop();
+  server.join();
+
+  EXPECT_TRUE(connected);
+}
+
+// Routes on the first line, hashed in place
+class LineRoutingDataHandler : public PeekingRoutingDataHandler<RoutingKey> {
+ public:
+  using PeekingRoutingDataHandler<RoutingKey>::PeekingRoutingDataHandler;
+
+  bool peekRoutingData(const IOBufQueue& q, RoutingKey& key) override {
+    BufferScanner scanner(q);
+    auto eol = scanner.find('\n');
+    if (eol < 0) {
+      return false;
+    }
+    key = RoutingKey::fromQueue(q, 0, eol);
+    return true;
+  }
+};
+
+class RoutingDataRecorder : public RoutingDataHandler<RoutingKey>::Callback {
+ public:
+  void onRoutingData(
+      uint64_t connId,
+      RoutingDataHandler<RoutingKey>::RoutingData& routingData) override {
+    key = routingData.routingData;
+    buf = routingData.bufQueue.move();
+  }
+  void onError(uint64_t connId, folly::exception_wrapper ex) override {}
+
+  RoutingKey key;
+  std::unique_ptr<IOBuf> buf;
+};
+
+TEST(RoutingDataHandler, PeekHandsOverBuffers) {
+  RoutingDataRecorder recorder;
+  LineRoutingDataHandler handler(1, &recorder);
+  IOBufQueue q(IOBufQueue::cacheChainLength());
+  q.append(IOBuf::copyBuffer("ro"));
+  handler.read(nullptr, q);
+  EXPECT_FALSE(recorder.buf);
+  EXPECT_EQ(2, q.chainLength());
+
+  q.append(IOBuf::copyBuffer("ute\nbody"));
+  auto front = q.front();
+  handler.read(nullptr, q);
+  EXPECT_TRUE(q.empty());
+  // The very buffers read, not copies
+  EXPECT_EQ(front, recorder.buf.get());
+  EXPECT_EQ(11, recorder.buf->computeChainDataLength());
+  EXPECT_EQ(0, recorder.key.offset);
+  EXPECT_EQ(5, recorder.key.length);
+
+  IOBufQueue other(IOBufQueue::cacheChainLength());
+  other.append(IOBuf::copyBuffer("xroute"));
+  auto key = RoutingKey::fromQueue(other, 1, 5);
+  EXPECT_EQ(key.hash, recorder.key.hash);
+  EXPECT_TRUE(key.sameHash(recorder.key));
+  EXPECT_EQ(std::hash<RoutingKey>()(key), key.hash);
+}
+
+class LineRoutingHandlerFactory
+    : public RoutingDataHandlerFactory<RoutingKey> {
+ public:
+  std::shared_ptr<RoutingDataHandler<RoutingKey>> newHandler(
+      uint64_t connId,
+      RoutingDataHandler<RoutingKey>::Callback* cob) override {
+    return std::make_shared<LineRoutingDataHandler>(connId, cob);
+  }
+};
+
+class EchoUntilEOFHandler : public EchoHandler {
+ public:
+  void readEOF(Context* ctx) override {
+    ctx->fireClose();
+  }
+};
+
+class EchoRoutingPipelineFactory
+    : public RoutingDataPipelineFactory<BytesPipeline, RoutingKey> {
+ public:
+  BytesPipeline::Ptr newPipeline(
+      std::shared_ptr<AsyncSocket> socket,
+      const RoutingKey& routingData,
+      RoutingDataHandler<RoutingKey>* routingHandler,
+      std::shared_ptr<TransportInfo> transportInfo) override {
+    auto pipeline = BytesPipeline::create();
+    pipeline->addBack(AsyncSocketHandler(socket));
+    pipeline->addBack(EchoUntilEOFHandler());
+    pipeline->finalize();
+    return pipeline;
+  }
+};
+
+TEST(Bootstrap, AcceptRoutingCountsRoutedConnections) {
+  typedef ServerAcceptor<BytesPipeline> TestServerAcceptor;
+
+  // The PROXY header reader is a connection of the accepting acceptor too
+  ServerSocketConfig config;
+  config.proxyProtocol = true;
+  auto selector = std::make_shared<BoundedLoadWorkerSelector>();
+  TestServer server;
+  server.acceptorConfig(config);
+  server.pipeline(std::make_shared<AcceptRoutingPipelineFactory<
+      BytesPipeline, RoutingKey>>(
+          &server,
+          std::make_shared<LineRoutingHandlerFactory>(),
+          std::make_shared<EchoRoutingPipelineFactory>(),
+          selector));
+  server.group(std::make_shared<IOThreadPoolExecutor>(2));
+  server.bind(0);
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+
+  std::vector<TestServerAcceptor*> acceptors;
+  server.forEachWorker([&](Acceptor* acceptor) {
+    acceptors.push_back(dynamic_cast<TestServerAcceptor*>(acceptor));
+  });
+  ASSERT_EQ(2, acceptors.size());
+  auto numConnections = [&] {
+    return acceptors[0]->getNumConnectionsAnyThread() +
+      acceptors[1]->getNumConnectionsAnyThread();
+  };
+  auto numRouted = [&] {
+    return selector->getNumConnections(0) + selector->getNumConnections(1);
+  };
+
+  const std::string hello =
+    "PROXY TCP4 192.0.2.1 192.0.2.2 1111 2222\r\nkey\n";
+  std::vector<int> fds;
+  for (int i = 0; i < 4; i++) {
+    sockaddr_storage addr;
+    auto len = address.getAddress(&addr);
+    int fd = socket(address.getFamily(), SOCK_STREAM, 0);
+    ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&addr), len));
+    ASSERT_EQ(hello.size(), write(fd, hello.data(), hello.size()));
+    // The bytes after the header are echoed once routed
+    char buf[4];
+    size_t got = 0;
+    while (got < sizeof(buf)) {
+      auto n = read(fd, buf + got, sizeof(buf) - got);
+      ASSERT_GT(n, 0);
+      got += n;
+    }
+    EXPECT_EQ("key\n", std::string(buf, 4));
+    fds.push_back(fd);
+  }
+  EXPECT_EQ(4, numConnections());
+  EXPECT_EQ(4, numRouted());
+
+  for (auto fd : fds) {
+    close(fd);
+  }
+  for (int i = 0; i < 500 && numConnections() > 0; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(0, numConnections());
+  EXPECT_EQ(0, selector->getNumConnections(0));
+  EXPECT_EQ(0, selector->getNumConnections(1));
+
+  server.stop();
+  server.join();
+}
+
+class EchoUntilEOFPipelineFactory : public PipelineFactory<BytesPipeline> {
+ public:
+  BytesPipeline::Ptr newPipeline(
+      std::shared_ptr<AsyncTransportWrapper> sock) override {
+    auto pipeline = BytesPipeline::create();
+    pipeline->addBack(AsyncSocketHandler(sock));
+    pipeline->addBack(EchoUntilEOFHandler());
+    pipeline->finalize();
+    return pipeline;
+  }
+};
+
+TEST(Bootstrap, AcceptSteeringCountsSteeredConnections) {
+  typedef ServerAcceptor<BytesPipeline> TestServerAcceptor;
+
+  // Routed by their first byte, unless it is 'x': those stay put once
+  // they sent two bytes, without asking the selector
+  auto parser = [](const IOBufQueue& data, uint64_t& hash) {
+    auto buf = data.front()->clone();
+    buf->coalesce();
+    hash = buf->data()[0];
+    return buf->data()[0] != 'x';
+  };
+  ServerSocketConfig config;
+  config.proxyProtocol = true;
+  auto selector = std::make_shared<BoundedLoadWorkerSelector>();
+  TestServer server;
+  server.acceptorConfig(config);
+  server.pipeline(std::make_shared<AcceptSteeringPipelineFactory<
+      BytesPipeline>>(
+          &server, parser, std::make_shared<EchoUntilEOFPipelineFactory>(),
+          selector, 2));
+  server.group(std::make_shared<IOThreadPoolExecutor>(2));
+  server.bind(0);
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+
+  std::vector<TestServerAcceptor*> acceptors;
+  server.forEachWorker([&](Acceptor* acceptor) {
+    acceptors.push_back(dynamic_cast<TestServerAcceptor*>(acceptor));
+  });
+  ASSERT_EQ(2, acceptors.size());
+  auto numConnections = [&] {
+    return acceptors[0]->getNumConnectionsAnyThread() +
+      acceptors[1]->getNumConnectionsAnyThread();
+  };
+
+  std::vector<int> fds;
+  for (auto data : {"ab", "cd", "xx"}) {
+    sockaddr_storage addr;
+    auto len = address.getAddress(&addr);
+    int fd = socket(address.getFamily(), SOCK_STREAM, 0);
+    ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&addr), len));
+    auto hello =
+      std::string("PROXY TCP4 192.0.2.1 192.0.2.2 1111 2222\r\n") + data;
+    ASSERT_EQ(hello.size(), write(fd, hello.data(), hello.size()));
+    char buf[2];
+    size_t got = 0;
+    while (got < sizeof(buf)) {
+      auto n = read(fd, buf + got, sizeof(buf) - got);
+      ASSERT_GT(n, 0);
+      got += n;
+    }
+    EXPECT_EQ(data, std::string(buf, 2));
+    fds.push_back(fd);
+  }
+  EXPECT_EQ(3, numConnections());
+  EXPECT_EQ(2, selector->getNumConnections(0) +
+            selector->getNumConnections(1));
+
+  for (auto fd : fds) {
+    close(fd);
+  }
+  for (int i = 0; i < 500 && numConnections() > 0; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(0, numConnections());
+  EXPECT_EQ(0, selector->getNumConnections(0));
+  EXPECT_EQ(0, selector->getNumConnections(1));
+
+  server.stop();
+  server.join();
+}
+
+// Keeps the TransportInfo of its connection, and an eye on its transport
+class TransportInfoKeeper : public BytesToBytesHandler {
+ public:
+  TransportInfoKeeper(std::shared_ptr<TransportInfo>* tinfo,
+                      std::weak_ptr<AsyncTransportWrapper>* transport)
+      : tinfo_(tinfo), transport_(transport) {}
+
+  void transportActive(Context* ctx) override {
+    *tinfo_ = ctx->getPipeline()->getTransportInfo();
+    *transport_ = std::dynamic_pointer_cast<AsyncTransportWrapper>(
+        ctx->getTransport());
+    ctx->fireTransportActive();
+  }
+
+ private:
+  std::shared_ptr<TransportInfo>* tinfo_;
+  std::weak_ptr<AsyncTransportWrapper>* transport_;
+};
+
+TEST(Bootstrap, TransportInfoOutlivesTransport) {
+  typedef ServerAcceptor<BytesPipeline> TestServerAcceptor;
+
+  std::shared_ptr<TransportInfo> tinfo;
+  std::weak_ptr<AsyncTransportWrapper> transport;
+  class KeeperPipelineFactory : public PipelineFactory<BytesPipeline> {
+   public:
+    KeeperPipelineFactory(std::shared_ptr<TransportInfo>* tinfo,
+                          std::weak_ptr<AsyncTransportWrapper>* transport)
+        : tinfo_(tinfo), transport_(transport) {}
+
+    BytesPipeline::Ptr newPipeline(
+        std::shared_ptr<AsyncTransportWrapper> sock) override {
+      auto pipeline = BytesPipeline::create();
+      pipeline->addBack(AsyncSocketHandler(sock));
+      pipeline->addBack(TransportInfoKeeper(tinfo_, transport_));
+      pipeline->addBack(EchoUntilEOFHandler());
+      pipeline->finalize();
+      return pipeline;
+    }
+
+   private:
+    std::shared_ptr<TransportInfo>* tinfo_;
+    std::weak_ptr<AsyncTransportWrapper>* transport_;
+  };
+
+  TestServer server;
+  server.childPipeline(
+      std::make_shared<KeeperPipelineFactory>(&tinfo, &transport));
+  server.group(std::make_shared<IOThreadPoolExecutor>(1));
+  server.bind(0);
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+  TestServerAcceptor* acceptor = nullptr;
+  server.forEachWorker([&](Acceptor* a) {
+    acceptor = dynamic_cast<TestServerAcceptor*>(a);
+  });
+  ASSERT_TRUE(acceptor);
+
+  sockaddr_storage addr;
+  auto len = address.getAddress(&addr);
+  int fd = socket(address.getFamily(), SOCK_STREAM, 0);
+  ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&addr), len));
+  char buf;
+  EXPECT_EQ(1, write(fd, "x", 1));
+  EXPECT_EQ(1, read(fd, &buf, 1));
+  close(fd);
+  for (int i = 0; i < 500 && acceptor->getNumConnectionsAnyThread() > 0;
+       i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(0, acceptor->getNumConnectionsAnyThread());
+
+  // The connection's TransportInfo is still whole, its transport gone
+  ASSERT_TRUE(tinfo);
+  ASSERT_TRUE(tinfo->localAddr);
+  EXPECT_EQ(address.getPort(), tinfo->localAddr->getPort());
+  acceptor->getEventBase()->runImmediatelyOrRunInEventBaseThreadAndWait([&] {
+    EXPECT_TRUE(transport.expired());
+  });
+
+  server.stop();
+  server.join();
+}
+
+// Where the TransportInfo of each connection was
+class TransportInfoRecorder : public BytesToBytesHandler {
+ public:
+  explicit TransportInfoRecorder(std::vector<const TransportInfo*>* tinfos)
+      : tinfos_(tinfos) {}
+
+  void transportActive(Context* ctx) override {
+    tinfos_->push_back(ctx->getPipeline()->getTransportInfo().get());
+    ctx->fireTransportActive();
+  }
+
+ private:
+  std::vector<const TransportInfo*>* tinfos_;
+};
+
+TEST(Bootstrap, TransportInfoPooled) {
+  typedef ServerAcceptor<BytesPipeline> TestServerAcceptor;
+
+  // Only used from the acceptor's thread
+  std::vector<const TransportInfo*> tinfos;
+  class RecorderPipelineFactory : public PipelineFactory<BytesPipeline> {
+   public:
+    explicit RecorderPipelineFactory(
+        std::vector<const TransportInfo*>* tinfos)
+        : tinfos_(tinfos) {}
+
+    BytesPipeline::Ptr newPipeline(
+        std::shared_ptr<AsyncTransportWrapper> sock) override {
+      auto pipeline = BytesPipeline::create();
+      pipeline->addBack(AsyncSocketHandler(sock));
+      pipeline->addBack(TransportInfoRecorder(tinfos_));
+      pipeline->addBack(EchoUntilEOFHandler());
+      pipeline->finalize();
+      return pipeline;
+    }
+
+   private:
+    std::vector<const TransportInfo*>* tinfos_;
+  };
+
+  TestServer server;
+  server.childPipeline(std::make_shared<RecorderPipelineFactory>(&tinfos));
+  server.group(std::make_shared<IOThreadPoolExecutor>(1));
+  server.bind(0);
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+  TestServerAcceptor* acceptor = nullptr;
+  server.forEachWorker([&](Acceptor* a) {
+    acceptor = dynamic_cast<TestServerAcceptor*>(a);
+  });
+  ASSERT_TRUE(acceptor);
+
+  // One connection after the other, each gone before the next
+  sockaddr_storage addr;
+  auto len = address.getAddress(&addr);
+  for (int conn = 0; conn < 2; conn++) {
+    int fd = socket(address.getFamily(), SOCK_STREAM, 0);
+    ASSERT_EQ(0, connect(fd, reinterpret_cast<sockaddr*>(&addr), len));
+    char buf;
+    EXPECT_EQ(1, write(fd, "x", 1));
+    EXPECT_EQ(1, read(fd, &buf, 1));
+    close(fd);
+    for (int i = 0; i < 500 && acceptor->getNumConnectionsAnyThread() > 0;
+         i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(0, acceptor->getNumConnectionsAnyThread());
+    // Past the loop callback that lets go of the pipeline
+    for (int i = 0; i < 2; i++) {
+      acceptor->getEventBase()->runInEventBaseThreadAndWait([] {});
+    }
+  }
+
+  // The second connection's TransportInfo got the block of the first's
+  acceptor->getEventBase()->runInEventBaseThreadAndWait([&] {
+    ASSERT_EQ(2, tinfos.size());
+    EXPECT_EQ(tinfos[0], tinfos[1]);
+  });
+
+  server.stop();
+  server.join();
+}
+
 TEST(Bootstrap, ServerBindFailure) {
   // Bind to a TCP socket
   EventBase base;
@@ -10,12 +10,28 @@
 
 #pragma once
 
+#include <folly/MoveWrapper.h>
 #include <folly/io/async/AsyncSSLSocket.h>
 #include <folly/io/async/AsyncSocket.h>
+#include <folly/io/async/AsyncTimeout.h>
 #include <folly/io/async/EventBaseManager.h>
 #include <wangle/channel/Pipeline.h>
+#include <wangle/client/ssl/SSLSessionCallbacks.h>
 #include <wangle/concurrent/IOThreadPoolExecutor.h>
 
+#include <algorithm>
+#include <atomic>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+// Older headers than the kernels that support it
+#if defined(__linux__) && !defined(TCP_FASTOPEN_CONNECT)
+#define TCP_FASTOPEN_CONNECT 30
+#endif
+
 namespace wangle {
 
 /*
@@ -27,11 +43,21 @@ class ClientBootstrap {
 
   class ConnectCallback : public folly::AsyncSocket::ConnectCallback {
    public:
-    ConnectCallback(folly::Promise<Pipeline*> promise, ClientBootstrap* bootstrap)
+    ConnectCallback(folly::Promise<Pipeline*> promise,
+                    ClientBootstrap* bootstrap,
+                    std::shared_ptr<folly::AsyncSocket> socket)
         : promise_(std::move(promise))
-        , bootstrap_(bootstrap) {}
+        , bootstrap_(bootstrap)
+        , alive_(bootstrap->alive_)
+        , socket_(std::move(socket)) {}
 
     void connectSuccess() noexcept override {
+      if (!alive_.lock()) {
+        promise_.setException(destroyedError());
+        delete this;
+        return;
+      }
+      bootstrap_->recordSSLResumption(socket_.get());
       if (bootstrap_->getPipeline()) {
         bootstrap_->getPipeline()->transportActive();
       }
@@ -47,8 +73,199 @@ class ClientBootstrap {
    private:
     folly::Promise<Pipeline*> promise_;
     ClientBootstrap* bootstrap_;
+    std::weak_ptr<bool> alive_;
+    std::shared_ptr<folly::AsyncSocket> socket_;
+  };
+
+  // The attempts of connect() to several addresses. Deletes itself once
+  // none is left.
+  class ConnectRace : public folly::AsyncTimeout {
+    class Attempt : public folly::AsyncSocket::ConnectCallback {
+     public:
+      Attempt(ConnectRace* race, std::shared_ptr<folly::AsyncSocket> socket)
+          : race_(race), socket_(std::move(socket)) {}
+
+      void connectSuccess() noexcept override {
+        race_->attemptSucceeded(this);
+      }
+
+      void connectErr(const folly::AsyncSocketException& ex) noexcept override {
+        race_->attemptFailed(this, ex);
+      }
+
+      ConnectRace* race_;
+      std::shared_ptr<folly::AsyncSocket> socket_;
+    };
+
+   public:
+    ConnectRace(ClientBootstrap* bootstrap,
+                folly::EventBase* base,
+                std::vector<folly::SocketAddress> addresses,
+                std::chrono::milliseconds timeout,
+                std::chrono::milliseconds attemptDelay)
+        : folly::AsyncTimeout(base),
+          bootstrap_(bootstrap),
+          alive_(bootstrap->alive_),
+          base_(base),
+          addresses_(std::move(addresses)),
+          timeout_(timeout),
+          attemptDelay_(attemptDelay) {}
+
+    folly::Future<Pipeline*> start() {
+      auto future = promise_.getFuture();
+      Guard g(this);
+      startAttempt();
+      return future;
+    }
+
+    void timeoutExpired() noexcept override {
+      Guard g(this);
+      startAttempt();
+    }
+
+   private:
+    // Held by every entry point, as callbacks may run nested in connect()
+    // or closeNow(). The last one out settles the race.
+    class Guard {
+     public:
+      explicit Guard(ConnectRace* race) : race_(race) {
+        race_->depth_++;
+      }
+      ~Guard() {
+        if (--race_->depth_ == 0) {
+          race_->settle();
+        }
+      }
+     private:
+      ConnectRace* race_;
+    };
+
+    void startAttempt() {
+      if (done_ || next_ == addresses_.size()) {
+        return;
+      }
+      if (!alive_.lock()) {
+        lastError_ = destroyedError();
+        next_ = addresses_.size();
+        return;
+      }
+      auto& address = addresses_[next_++];
+      auto attempt =
+        new Attempt(this, bootstrap_->newSocket(base_, address));
+      attempts_.push_back(attempt);
+      if (next_ < addresses_.size()) {
+        scheduleTimeout(attemptDelay_.count());
+      }
+      attempt->socket_->connect(attempt, address, timeout_.count());
+    }
+
+    void attemptSucceeded(Attempt* winner) {
+      Guard g(this);
+      auto socket = winner->socket_;
+      finish(winner);
+      if (done_) {
+        return;
+      }
+      done_ = true;
+      cancelTimeout();
+      if (!alive_.lock()) {
+        for (auto attempt : std::vector<Attempt*>(attempts_)) {
+          attempt->socket_->closeNow();
+        }
+        promise_.setException(destroyedError());
+        return;
+      }
+      bootstrap_->recordSSLResumption(socket.get());
+      // Closing the others fails their connects, right away
+      for (auto attempt : std::vector<Attempt*>(attempts_)) {
+        attempt->socket_->closeNow();
+      }
+      bootstrap_->pipeline_ =
+        bootstrap_->pipelineFactory_->newPipeline(socket);
+      if (bootstrap_->pipeline_) {
+        bootstrap_->pipeline_->transportActive();
+      }
+      promise_.setValue(bootstrap_->pipeline_.get());
+    }
+
+    void attemptFailed(Attempt* attempt,
+                       const folly::AsyncSocketException& ex) {
+      Guard g(this);
+      finish(attempt);
+      if (done_) {
+        return;
+      }
+      lastError_ =
+        folly::make_exception_wrapper<folly::AsyncSocketException>(ex);
+      if (next_ < addresses_.size()) {
+        // No point waiting out the delay for the next one
+        cancelTimeout();
+        startAttempt();
+      }
+    }
+
+    void finish(Attempt* attempt) {
+      attempts_.erase(
+        std::find(attempts_.begin(), attempts_.end(), attempt));
+      delete attempt;
+    }
+
+    void settle() {
+      if (!attempts_.empty() || (!done_ && next_ < addresses_.size())) {
+        return;
+      }
+      if (!done_) {
+        // Every attempt failed
+        done_ = true;
+        promise_.setException(lastError_);
+      }
+      delete this;
+    }
+
+    ClientBootstrap* bootstrap_;
+    std::weak_ptr<bool> alive_;
+    folly::EventBase* base_;
+    std::vector<folly::SocketAddress> addresses_;
+    std::chrono::milliseconds timeout_;
+    std::chrono::milliseconds attemptDelay_;
+    folly::Promise<Pipeline*> promise_;
+    std::vector<Attempt*> attempts_;
+    folly::exception_wrapper lastError_;
+    size_t next_{0};
+    size_t depth_{0};
+    bool done_{false};
   };
 
+  // Of a connect still queued or in progress when the bootstrap went away
+  static folly::exception_wrapper destroyedError() {
+    return folly::make_exception_wrapper<folly::AsyncSocketException>(
+      folly::AsyncSocketException::NOT_OPEN, "ClientBootstrap destroyed");
+  }
+
+  // Alternates address families, starting with that of the first address
+  static std::vector<folly::SocketAddress> interleaveFamilies(
+      const std::vector<folly::SocketAddress>& addresses) {
+    std::vector<folly::SocketAddress> first;
+    std::vector<folly::SocketAddress> others;
+    for (const auto& address : addresses) {
+      if (address.getFamily() == addresses[0].getFamily()) {
+        first.push_back(address);
+      } else {
+        others.push_back(address);
+      }
+    }
+    std::vector<folly::SocketAddress> result;
+    for (size_t i = 0; i < std::max(first.size(), others.size()); i++) {
+      if (i < first.size()) {
+        result.push_back(first[i]);
+      }
+      if (i < others.size()) {
+        result.push_back(others[i]);
+      }
+    }
+    return result;
+  }
+
  public:
   ClientBootstrap() {
   }
@@ -61,6 +278,7 @@ class ClientBootstrap {
 
   ClientBootstrap* sslContext(folly::SSLContextPtr sslContext) {
     sslContext_ = sslContext;
+    attachSSLSessionCache();
     return this;
   }
 
@@ -69,38 +287,165 @@ class ClientBootstrap {
     return this;
   }
 
+  /**
+   * Resume TLS sessions from cache, the sessions of each peer stored as
+   * handshakes complete and offered on the next connect to that peer. Peers
+   * are told apart by serviceIdentity(), else serverName(), else address.
+   * The cache's callbacks are attached to sslContext() here, or when it is
+   * set, not by the IO threads connecting with it. The cache must then
+   * outlive the context.
+   */
+  ClientBootstrap* sslSessionCache(SSLSessionCallbacks* cache) {
+    sslSessionCache_ = cache;
+    attachSSLSessionCache();
+    return this;
+  }
+
+  // The key of the sessions in sslSessionCache()
+  ClientBootstrap* serviceIdentity(const std::string& identity) {
+    serviceIdentity_ = identity;
+    return this;
+  }
+
+  // Of connections with sslSessionCache(): all, and those resumed. Read
+  // from any thread.
+  uint64_t getSSLHandshakes() const {
+    return sslHandshakes_;
+  }
+
+  uint64_t getSSLSessionResumptions() const {
+    return sslSessionResumptions_;
+  }
+
+  // The SNI sent with the TLS handshake
+  ClientBootstrap* serverName(const std::string& serverName) {
+    serverName_ = serverName;
+    return this;
+  }
+
+  /**
+   * Send the first write in the SYN with TCP Fast Open, once the server
+   * gave this host a cookie, saving a round trip per connection. The
+   * connection then looks established before the server replied, so a
+   * refused one fails on the first read or write rather than in connect().
+   * Needs Linux 4.11 (TCP_FASTOPEN_CONNECT) and the client bit of the
+   * net.ipv4.tcp_fastopen sysctl; connect() fails on older Linux kernels,
+   * and it is ignored on other systems.
+   */
+  ClientBootstrap* fastOpen(bool enabled) {
+    fastOpen_ = enabled;
+    return this;
+  }
+
+  /**
+   * Connect on the calling thread's EventBase, when it has one, as an IO
+   * thread does, rather than on one of group(). The connection then stays
+   * on the thread that uses it.
+   */
+  ClientBootstrap* useCallerEventBase(bool enabled) {
+    useCallerEventBase_ = enabled;
+    return this;
+  }
+
+  /**
+   * Connect to Unix domain socket addresses with SOCK_SEQPACKET, for a
+   * server with AsyncServerSocketFactory::setSeqPacket(). Not with TLS.
+   */
+  ClientBootstrap* seqPacket(bool enabled) {
+    seqPacket_ = enabled;
+    return this;
+  }
+
   ClientBootstrap* bind(int port) {
     port_ = port;
     return this;
   }
 
+  /**
+   * Connects on one of the EventBases of group(), or on the calling
+   * thread's without one. Never waits on another thread: the connect is
+   * queued on the EventBase if it is not the caller's, and getPipeline()
+   * is only set once that ran, at the latest when the future completes.
+   * Should the bootstrap be destroyed first, in the EventBase's thread or
+   * before it got to the connect, the future fails.
+   */
   folly::Future<Pipeline*> connect(
       const folly::SocketAddress& address,
       std::chrono::milliseconds timeout = std::chrono::milliseconds(0)) {
     DCHECK(pipelineFactory_);
-    auto base = folly::EventBaseManager::get()->getEventBase();
-    if (group_) {
-      base = group_->getEventBase();
-    }
-    folly::Future<Pipeline*> retval((Pipeline*)nullptr);
-    base->runImmediatelyOrRunInEventBaseThreadAndWait([&](){
+    auto base = getConnectEventBase();
+    folly::Promise<Pipeline*> promise;
+    auto retval = promise.getFuture();
+    auto mwPromise = folly::makeMoveWrapper(std::move(promise));
+    std::weak_ptr<bool> alive = alive_;
+    runInEventBase(base, [=]() mutable {
+      if (!alive.lock()) {
+        mwPromise->setException(destroyedError());
+        return;
+      }
+      if (seqPacket_ && address.getFamily() == AF_UNIX) {
+        connectSeqPacket(base, address, std::move(*mwPromise));
+        return;
+      }
       std::shared_ptr<folly::AsyncSocket> socket;
-      if (sslContext_) {
-        auto sslSocket = folly::AsyncSSLSocket::newSocket(sslContext_, base);
-        if (sslSession_) {
-          sslSocket->setSSLSession(sslSession_, true);
-        }
-        socket = sslSocket;
-      } else {
-        socket = folly::AsyncSocket::newSocket(base);
+      try {
+        socket = newSocket(base, address);
+        // Before connect(), which may succeed right away, as with Fast Open
+        pipeline_ = pipelineFactory_->newPipeline(socket);
+      } catch (const std::exception& ex) {
+        mwPromise->setException(
+          folly::exception_wrapper(std::current_exception(), ex));
+        return;
+      }
+      folly::AsyncSocket::OptionMap options;
+#ifdef TCP_FASTOPEN_CONNECT
+      if (fastOpen_) {
+        options[folly::AsyncSocket::OptionKey{
+            IPPROTO_TCP, TCP_FASTOPEN_CONNECT}] = 1;
       }
-      folly::Promise<Pipeline*> promise;
-      retval = promise.getFuture();
+#endif
       socket->connect(
-          new ConnectCallback(std::move(promise), this),
+          new ConnectCallback(std::move(*mwPromise), this, socket),
           address,
-          timeout.count());
-      pipeline_ = pipelineFactory_->newPipeline(socket);
+          timeout.count(),
+          options);
+    });
+    return retval;
+  }
+
+  /**
+   * Connects to whichever of addresses, those of one host, accepts first,
+   * so an unreachable one does not cost the whole timeout (Happy Eyeballs,
+   * RFC 8305). Attempts alternate address families, in the order of the
+   * first address', and start attemptDelay apart, or as soon as the one
+   * before fails. The others are closed once one connects. timeout applies
+   * to each attempt. The pipeline is only created for the connection that
+   * wins, so fastOpen() is not used.
+   */
+  folly::Future<Pipeline*> connect(
+      const std::vector<folly::SocketAddress>& addresses,
+      std::chrono::milliseconds timeout,
+      std::chrono::milliseconds attemptDelay = std::chrono::milliseconds(250)) {
+    DCHECK(pipelineFactory_);
+    if (addresses.empty()) {
+      return folly::makeFuture<Pipeline*>(
+        std::invalid_argument("no address to connect to"));
+    }
+    auto base = getConnectEventBase();
+    folly::Promise<Pipeline*> promise;
+    auto retval = promise.getFuture();
+    auto mwPromise = folly::makeMoveWrapper(std::move(promise));
+    auto sorted = interleaveFamilies(addresses);
+    std::weak_ptr<bool> alive = alive_;
+    runInEventBase(base, [=]() mutable {
+      if (!alive.lock()) {
+        mwPromise->setException(destroyedError());
+        return;
+      }
+      auto race = new ConnectRace(this, base, sorted, timeout, attemptDelay);
+      race->start().then([mwPromise](folly::Try<Pipeline*>&& t) mutable {
+        mwPromise->setTry(std::move(t));
+      });
     });
     return retval;
   }
@@ -118,6 +463,105 @@ class ClientBootstrap {
   virtual ~ClientBootstrap() = default;
 
  protected:
+  folly::EventBase* getConnectEventBase() {
+    if (group_) {
+      if (useCallerEventBase_) {
+        auto base = folly::EventBaseManager::get()->getExistingEventBase();
+        if (base) {
+          return base;
+        }
+      }
+      return group_->getEventBase();
+    }
+    return folly::EventBaseManager::get()->getEventBase();
+  }
+
+  // Once, before any connection uses the context
+  void attachSSLSessionCache() {
+    if (sslContext_ && sslSessionCache_) {
+      SSLSessionCallbacks::attachCallbacksToContext(
+        sslContext_->getSSLCtx(), sslSessionCache_);
+    }
+  }
+
+  void recordSSLResumption(folly::AsyncSocket* socket) {
+    auto sslSocket = dynamic_cast<folly::AsyncSSLSocket*>(socket);
+    if (!sslSessionCache_ || !sslSocket) {
+      return;
+    }
+    sslHandshakes_++;
+    if (sslSocket->getSSLSessionReused()) {
+      sslSessionResumptions_++;
+    }
+  }
+
+  // Connecting a Unix domain socket completes, or fails, right away
+  void connectSeqPacket(folly::EventBase* base,
+                        const folly::SocketAddress& address,
+                        folly::Promise<Pipeline*> promise) {
+    int fd = ::socket(
+        AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    sockaddr_storage addr;
+    auto len = address.getAddress(&addr);
+    if (fd < 0 ||
+        ::connect(fd, reinterpret_cast<sockaddr*>(&addr), len) != 0) {
+      int err = errno;
+      if (fd >= 0) {
+        ::close(fd);
+      }
+      promise.setException(
+        folly::make_exception_wrapper<folly::AsyncSocketException>(
+          folly::AsyncSocketException::NOT_OPEN,
+          "connect to " + address.describe() + " failed", err));
+      return;
+    }
+    auto socket = folly::AsyncSocket::newSocket(base, fd);
+    try {
+      pipeline_ = pipelineFactory_->newPipeline(socket);
+    } catch (const std::exception& ex) {
+      promise.setException(
+        folly::exception_wrapper(std::current_exception(), ex));
+      return;
+    }
+    (new ConnectCallback(std::move(promise), this, socket))->connectSuccess();
+  }
+
+  // Inline when already in base's thread, else queued without waiting
+  template <typename F>
+  static void runInEventBase(folly::EventBase* base, F func) {
+    if (base->isInEventBaseThread()) {
+      func();
+    } else {
+      base->runInEventBaseThread(std::move(func));
+    }
+  }
+
+  std::shared_ptr<folly::AsyncSocket> newSocket(
+      folly::EventBase* base, const folly::SocketAddress& address) {
+    if (!sslContext_) {
+      return folly::AsyncSocket::newSocket(base);
+    }
+    auto sslSocket = folly::AsyncSSLSocket::newSocket(sslContext_, base);
+    SSLSessionPtr cached;
+    if (sslSessionCache_) {
+      auto identity = !serviceIdentity_.empty() ? serviceIdentity_ :
+        !serverName_.empty() ? serverName_ : address.describe();
+      // Where the new session gets stored
+      sslSocket->setServiceIdentity(identity);
+      cached = sslSessionCache_->getSSLSession(identity);
+    }
+    if (cached) {
+      sslSocket->setSSLSession(cached.release(), true);
+    } else if (sslSession_) {
+      sslSocket->setSSLSession(sslSession_, true);
+    }
+    if (!serverName_.empty()) {
+      sslSocket->setServerName(serverName_);
+    }
+    return sslSocket;
+  }
+
+
   typename Pipeline::Ptr pipeline_;
 
   int port_;
@@ -126,5 +570,16 @@ class ClientBootstrap {
   std::shared_ptr<wangle::IOThreadPoolExecutor> group_;
   folly::SSLContextPtr sslContext_;
   SSL_SESSION* sslSession_{nullptr};
+  std::string serverName_;
+  SSLSessionCallbacks* sslSessionCache_{nullptr};
+  std::string serviceIdentity_;
+  // Updated in the threads of the connections' EventBases
+  std::atomic<uint64_t> sslHandshakes_{0};
+  std::atomic<uint64_t> sslSessionResumptions_{0};
+  bool fastOpen_{false};
+  bool useCallerEventBase_{false};
+  bool seqPacket_{false};
+  // Checked by the connects queued on, or in progress in, other threads
+  std::shared_ptr<bool> alive_{std::make_shared<bool>(true)};
 };
 } // namespace wangle
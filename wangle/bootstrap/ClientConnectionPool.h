@@ -0,0 +1,397 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <wangle/bootstrap/ClientBootstrap.h>
+
+#include <folly/MoveWrapper.h>
+#include <folly/io/async/AsyncTimeout.h>
+
+#include <chrono>
+#include <deque>
+#include <string>
+#include <unordered_map>
+
+namespace wangle {
+
+struct ClientConnectionPoolOptions {
+  // Idle connections kept per host, the rest are closed as released
+  size_t maxIdlePerHost{8};
+  // Connections per host, leased, idle or connecting. get() waits for a
+  // connection to be released beyond that
+  size_t maxPerHost{64};
+  // Idle connections per host opened ahead of demand, once it is used
+  size_t minIdlePerHost{0};
+  // Idle connections older than that are closed
+  std::chrono::milliseconds idleTimeout{60000};
+  std::chrono::milliseconds connectTimeout{0};
+};
+
+/**
+ * A pool of client connections of one EventBase, keyed by address and SNI
+ * server name, so requests reuse an idle connection rather than paying
+ * for a connect and a TLS handshake each.
+ *
+ * get() hands out a Lease on a connected pipeline, which returns it to the
+ * pool once destroyed, unless its transport is no longer good or the lease
+ * was discard()ed. A leased pipeline is the holder's alone until then.
+ *
+ * Must be used, and its leases released, in the thread of its EventBase.
+ * Leases may outlive the pool, in which case they just close.
+ */
+template <typename Pipeline>
+class ClientConnectionPool {
+  struct Impl;
+
+  struct Key {
+    folly::SocketAddress address;
+    std::string serverName;
+
+    bool operator==(const Key& other) const {
+      return address == other.address && serverName == other.serverName;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key& key) const {
+      return key.address.hash() * 31 +
+        std::hash<std::string>()(key.serverName);
+    }
+  };
+
+ public:
+  typedef ClientConnectionPoolOptions Options;
+
+  class Lease {
+   public:
+    Lease() {}
+    Lease(Lease&&) = default;
+    Lease& operator=(Lease&& other) {
+      release();
+      impl_ = std::move(other.impl_);
+      key_ = std::move(other.key_);
+      pipeline_ = std::move(other.pipeline_);
+      return *this;
+    }
+
+    ~Lease() {
+      release();
+    }
+
+    Pipeline* get() const {
+      return pipeline_.get();
+    }
+
+    Pipeline* operator->() const {
+      return pipeline_.get();
+    }
+
+    explicit operator bool() const {
+      return bool(pipeline_);
+    }
+
+    // Returns the connection to the pool
+    void release() {
+      giveBack(true);
+    }
+
+    // Closes the connection instead, e.g. when an error left it in an
+    // unknown state
+    void discard() {
+      giveBack(false);
+    }
+
+   private:
+    friend class ClientConnectionPool;
+    friend struct Impl;
+
+    Lease(std::weak_ptr<Impl> impl,
+          Key key,
+          typename Pipeline::Ptr pipeline)
+      : impl_(std::move(impl)),
+        key_(std::move(key)),
+        pipeline_(std::move(pipeline)) {}
+
+    void giveBack(bool reuse) {
+      if (!pipeline_) {
+        return;
+      }
+      auto pipeline = std::move(pipeline_);
+      if (auto impl = impl_.lock()) {
+        impl->release(key_, std::move(pipeline), reuse);
+      } else {
+        Impl::close(pipeline);
+      }
+    }
+
+    std::weak_ptr<Impl> impl_;
+    Key key_;
+    typename Pipeline::Ptr pipeline_;
+  };
+
+  ClientConnectionPool(
+      folly::EventBase* evb,
+      std::shared_ptr<PipelineFactory<Pipeline>> pipelineFactory,
+      folly::SSLContextPtr sslContext = nullptr,
+      Options options = Options())
+    : impl_(std::make_shared<Impl>(
+          evb, pipelineFactory, sslContext, options)) {
+    impl_->self = impl_;
+  }
+
+  ~ClientConnectionPool() {
+    impl_->closeAll();
+  }
+
+  /**
+   * An idle connection to address, with serverName as SNI if TLS, or a
+   * new one. Fails if a new one fails to connect, as do the calls waiting
+   * at maxPerHost when no other connection to the host is left.
+   */
+  folly::Future<Lease> get(
+      const folly::SocketAddress& address,
+      const std::string& serverName = "") {
+    return impl_->get(Key{address, serverName});
+  }
+
+  size_t getNumIdle(
+      const folly::SocketAddress& address,
+      const std::string& serverName = "") const {
+    auto it = impl_->hosts.find(Key{address, serverName});
+    return it == impl_->hosts.end() ? 0 : it->second.idle.size();
+  }
+
+  // Closes every idle connection
+  void closeIdle() {
+    impl_->closeIdle(std::chrono::steady_clock::time_point::max());
+  }
+
+ private:
+  struct Impl {
+    struct Idle {
+      typename Pipeline::Ptr pipeline;
+      std::chrono::steady_clock::time_point since;
+    };
+
+    struct Host {
+      std::deque<Idle> idle;
+      std::deque<folly::Promise<Lease>> waiters;
+      // Leased, idle or connecting
+      size_t total{0};
+      // Connecting for minIdlePerHost
+      size_t warming{0};
+    };
+
+    class IdleTimeout : public folly::AsyncTimeout {
+     public:
+      IdleTimeout(folly::EventBase* evb, Impl* impl)
+        : folly::AsyncTimeout(evb), impl_(impl) {}
+
+      void timeoutExpired() noexcept override {
+        impl_->closeIdle(
+            std::chrono::steady_clock::now() - impl_->options.idleTimeout);
+        impl_->scheduleIdleTimeout();
+      }
+
+     private:
+      Impl* impl_;
+    };
+
+    // Gives access to the pipeline ClientBootstrap connected
+    class Connector : public ClientBootstrap<Pipeline> {
+     public:
+      typename Pipeline::Ptr takePipeline() {
+        return std::move(this->pipeline_);
+      }
+    };
+
+    Impl(folly::EventBase* base,
+         std::shared_ptr<PipelineFactory<Pipeline>> factory,
+         folly::SSLContextPtr ctx,
+         Options opts)
+      : evb(base),
+        pipelineFactory(factory),
+        sslContext(ctx),
+        options(opts),
+        idleTimeout(base, this) {}
+
+    static bool usable(const typename Pipeline::Ptr& pipeline) {
+      auto transport = pipeline->getTransport();
+      return transport && transport->good();
+    }
+
+    static void close(const typename Pipeline::Ptr& pipeline) {
+      auto transport = pipeline->getTransport();
+      if (transport) {
+        transport->closeNow();
+      }
+    }
+
+    folly::Future<Lease> get(const Key& key) {
+      DCHECK(evb->isInEventBaseThread());
+      auto& host = hosts[key];
+      // Most recently used first, the likeliest to still be open
+      while (!host.idle.empty()) {
+        auto pipeline = std::move(host.idle.back().pipeline);
+        host.idle.pop_back();
+        if (usable(pipeline)) {
+          warm(key, host);
+          return folly::makeFuture(Lease(self, key, std::move(pipeline)));
+        }
+        close(pipeline);
+        host.total--;
+      }
+      if (host.total >= options.maxPerHost) {
+        host.waiters.emplace_back();
+        return host.waiters.back().getFuture();
+      }
+      auto lease = connect(key, host);
+      warm(key, host);
+      return lease;
+    }
+
+    folly::Future<Lease> connect(const Key& key, Host& host) {
+      host.total++;
+      auto connector = std::make_shared<Connector>();
+      connector->pipelineFactory(pipelineFactory);
+      if (sslContext) {
+        connector->sslContext(sslContext);
+        connector->serverName(key.serverName);
+      }
+      std::weak_ptr<Impl> weak = self;
+      return connector->connect(key.address, options.connectTimeout)
+        .then([weak, key, connector](folly::Try<Pipeline*>&& t) {
+          auto impl = weak.lock();
+          if (impl && t.hasException()) {
+            impl->connectFailed(key, t.exception());
+          }
+          t.throwIfFailed();
+          return Lease(weak, key, connector->takePipeline());
+        });
+    }
+
+    void connectFailed(const Key& key, const folly::exception_wrapper& ew) {
+      auto it = hosts.find(key);
+      DCHECK(it != hosts.end());
+      auto& host = it->second;
+      host.total--;
+      if (host.total > 0) {
+        connectWaiter(key, host);
+        return;
+      }
+      // No connection left to be released to the waiters, and new ones
+      // fail: so do they. Their callbacks may get() again.
+      auto waiters = std::move(host.waiters);
+      host.waiters.clear();
+      for (auto& waiter : waiters) {
+        waiter.setException(ew);
+      }
+    }
+
+    // Connects for the first waiter, if any, in the room left by a
+    // connection
+    void connectWaiter(const Key& key, Host& host) {
+      if (host.waiters.empty()) {
+        return;
+      }
+      auto promise = folly::makeMoveWrapper(std::move(host.waiters.front()));
+      host.waiters.pop_front();
+      connect(key, host).then([promise](folly::Try<Lease>&& t) mutable {
+        promise->setTry(std::move(t));
+      });
+    }
+
+    // Opens connections until minIdlePerHost are idle or on their way
+    void warm(const Key& key, Host& host) {
+      while (host.idle.size() + host.warming < options.minIdlePerHost &&
+             host.total < options.maxPerHost) {
+        host.warming++;
+        std::weak_ptr<Impl> weak = self;
+        connect(key, host).then([weak, key](folly::Try<Lease>&& t) {
+          if (auto impl = weak.lock()) {
+            impl->hosts[key].warming--;
+          }
+          // The lease, if any, puts the connection in the pool as it goes
+        });
+      }
+    }
+
+    void release(const Key& key, typename Pipeline::Ptr pipeline, bool reuse) {
+      DCHECK(evb->isInEventBaseThread());
+      auto it = hosts.find(key);
+      DCHECK(it != hosts.end());
+      auto& host = it->second;
+      reuse = reuse && usable(pipeline);
+      if (reuse && !host.waiters.empty()) {
+        auto promise = std::move(host.waiters.front());
+        host.waiters.pop_front();
+        promise.setValue(Lease(self, key, std::move(pipeline)));
+        return;
+      }
+      if (reuse && host.idle.size() < options.maxIdlePerHost) {
+        host.idle.push_back(
+            Idle{std::move(pipeline), std::chrono::steady_clock::now()});
+        scheduleIdleTimeout();
+        return;
+      }
+
+      close(pipeline);
+      host.total--;
+      connectWaiter(key, host);
+    }
+
+    void closeIdle(std::chrono::steady_clock::time_point before) {
+      for (auto& entry : hosts) {
+        auto& idle = entry.second.idle;
+        // Oldest first
+        while (!idle.empty() && idle.front().since <= before) {
+          close(idle.front().pipeline);
+          idle.pop_front();
+          entry.second.total--;
+        }
+      }
+    }
+
+    void scheduleIdleTimeout() {
+      if (idleTimeout.isScheduled()) {
+        return;
+      }
+      for (auto& entry : hosts) {
+        if (!entry.second.idle.empty()) {
+          idleTimeout.scheduleTimeout(options.idleTimeout.count());
+          return;
+        }
+      }
+    }
+
+    void closeAll() {
+      idleTimeout.cancelTimeout();
+      closeIdle(std::chrono::steady_clock::time_point::max());
+      for (auto& entry : hosts) {
+        for (auto& waiter : entry.second.waiters) {
+          waiter.setException(std::runtime_error("connection pool destroyed"));
+        }
+      }
+      hosts.clear();
+    }
+
+    folly::EventBase* evb;
+    std::shared_ptr<PipelineFactory<Pipeline>> pipelineFactory;
+    folly::SSLContextPtr sslContext;
+    Options options;
+    std::unordered_map<Key, Host, KeyHash> hosts;
+    IdleTimeout idleTimeout;
+    std::weak_ptr<Impl> self;
+  };
+
+  std::shared_ptr<Impl> impl_;
+};
+
+} // namespace wangle
@@ -0,0 +1,122 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Reports the heap used per idle connection of a ServerBootstrap, and the
+// size of the objects making it up. Each connection needs two fds, so raise
+// the fd limit (ulimit -n) for large --connections.
+
+#include <folly/Benchmark.h>
+#include <gflags/gflags.h>
+#include <wangle/bootstrap/ServerBootstrap.h>
+#include <wangle/channel/AsyncSocketHandler.h>
+
+#include <malloc.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+DEFINE_int32(connections, 10000, "Idle connections to open");
+
+using namespace wangle;
+using folly::AsyncTransportWrapper;
+using folly::IOBufQueue;
+using folly::SocketAddress;
+
+namespace {
+
+class Discard : public InboundHandler<IOBufQueue&> {
+ public:
+  void read(Context*, IOBufQueue& q) override {
+    q.clear();
+  }
+};
+
+class IdlePipelineFactory : public PipelineFactory<DefaultPipeline> {
+ public:
+  DefaultPipeline::Ptr newPipeline(
+      std::shared_ptr<AsyncTransportWrapper> sock) override {
+    auto pipeline = DefaultPipeline::create();
+    pipeline->addBack(AsyncSocketHandler(sock));
+    pipeline->addBack(Discard());
+    pipeline->finalize();
+    return pipeline;
+  }
+};
+
+size_t heapInUse() {
+  auto info = mallinfo();
+  return info.uordblks + info.hblkhd;
+}
+
+size_t numConnections(ServerBootstrap<DefaultPipeline>& server) {
+  size_t n = 0;
+  server.forEachWorker([&](Acceptor* acceptor) {
+    acceptor->getEventBase()->runInEventBaseThreadAndWait([&] {
+      n += acceptor->getNumConnections();
+    });
+  });
+  return n;
+}
+
+void reportFootprint() {
+  ServerBootstrap<DefaultPipeline> server;
+  server.childPipeline(std::make_shared<IdlePipelineFactory>());
+  server.group(std::make_shared<IOThreadPoolExecutor>(1));
+  server.bind(0);
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+  sockaddr_storage addr;
+  auto len = address.getAddress(&addr);
+
+  auto before = heapInUse();
+  std::vector<int> clients;
+  for (int i = 0; i < FLAGS_connections; i++) {
+    int fd = socket(address.getFamily(), SOCK_STREAM, 0);
+    PCHECK(fd >= 0);
+    PCHECK(connect(fd, reinterpret_cast<sockaddr*>(&addr), len) == 0);
+    clients.push_back(fd);
+  }
+  while (numConnections(server) < clients.size()) {
+    usleep(10000);
+  }
+  auto after = heapInUse();
+
+  printf("%zu idle connections: %.0f heap bytes each\n",
+         clients.size(), double(after - before) / clients.size());
+  printf("  sizeof(AsyncSocket)      %zu\n", sizeof(folly::AsyncSocket));
+  printf("  sizeof(DefaultPipeline)  %zu\n", sizeof(DefaultPipeline));
+  printf("  sizeof(TransportInfo)    %zu\n", sizeof(TransportInfo));
+  printf("  sizeof(ServerConnection) %zu\n",
+         sizeof(ServerAcceptor<DefaultPipeline>::ServerConnection));
+  printf("  sizeof(AsyncSocketHandler) %zu\n", sizeof(AsyncSocketHandler));
+
+  for (auto fd : clients) {
+    close(fd);
+  }
+  server.stop();
+  server.join();
+}
+
+} // namespace
+
+BENCHMARK(newPipeline, iters) {
+  IdlePipelineFactory factory;
+  while (iters--) {
+    auto pipeline = factory.newPipeline(nullptr);
+    folly::doNotOptimizeAway(pipeline);
+  }
+}
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  folly::runBenchmarks();
+  reportFootprint();
+  return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/bootstrap/ConnectionRebalancer.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace wangle {
+
+ConnectionRebalancer::ConnectionRebalancer(
+    std::chrono::milliseconds period,
+    std::function<void()> rebalance)
+    : period_(period),
+      rebalance_(std::move(rebalance)) {
+  thread_ = std::thread([this] { run(); });
+}
+
+ConnectionRebalancer::~ConnectionRebalancer() {
+  {
+    std::lock_guard<std::mutex> g(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+}
+
+void ConnectionRebalancer::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!cv_.wait_for(lock, period_, [this] { return stopping_; })) {
+    lock.unlock();
+    rebalance_();
+    lock.lock();
+  }
+}
+
+std::vector<ConnectionRebalancer::Move> ConnectionRebalancer::plan(
+    const std::vector<size_t>& counts,
+    double threshold,
+    size_t maxMovesPerThread) {
+  std::vector<Move> moves;
+  if (counts.size() < 2) {
+    return moves;
+  }
+  size_t total = 0;
+  for (auto count : counts) {
+    total += count;
+  }
+  const double mean = double(total) / counts.size();
+  const size_t high = size_t(std::ceil(mean));
+  const size_t low = size_t(std::floor(mean));
+
+  // {surplus or deficit, thread}, largest first
+  std::vector<std::pair<size_t, size_t>> over;
+  std::vector<std::pair<size_t, size_t>> under;
+  for (size_t i = 0; i < counts.size(); i++) {
+    if (counts[i] > mean * threshold && counts[i] > high) {
+      over.emplace_back(
+          std::min(counts[i] - high, maxMovesPerThread), i);
+    } else if (counts[i] < low) {
+      under.emplace_back(low - counts[i], i);
+    }
+  }
+  std::sort(over.rbegin(), over.rend());
+  std::sort(under.rbegin(), under.rend());
+
+  auto to = under.begin();
+  for (auto& from : over) {
+    while (from.first > 0 && to != under.end()) {
+      const size_t count = std::min(from.first, to->first);
+      moves.push_back(Move{from.second, to->second, count});
+      from.first -= count;
+      to->first -= count;
+      if (to->first == 0) {
+        ++to;
+      }
+    }
+  }
+  return moves;
+}
+
+} // namespace wangle
@@ -0,0 +1,86 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace wangle {
+
+class PipelineBase;
+
+struct ConnectionRebalancerOptions {
+  std::chrono::milliseconds period{1000};
+  // IO threads with more than threshold times the mean number of
+  // connections give some up to the ones below the mean
+  double threshold{1.25};
+  // Connections moved off a thread per period. Moving one costs a pair of
+  // epoll updates and a cross-thread hop, so keep it small enough not to
+  // stall the loops
+  size_t maxMovesPerThread{64};
+  // Whether a connection is between messages as far as its pipeline is
+  // concerned, if anything in it keeps state of its own on the IO thread's
+  // EventBase. Called in the thread the connection is moved from. If not
+  // set, only idle connections move: those serving no request, as told by
+  // the server dispatchers (see PipelineBase::requestStarted()).
+  std::function<bool(PipelineBase*)> canMove;
+};
+
+/**
+ * Keeps long-lived connections evenly spread over a server's IO threads,
+ * which otherwise keep every connection they accept until it closes.
+ *
+ * Every period, the rebalancer calls back, in a thread of its own, for the
+ * server to plan() moves from its connection counts and carry them out.
+ */
+class ConnectionRebalancer {
+ public:
+  typedef ConnectionRebalancerOptions Options;
+
+  struct Move {
+    size_t from;
+    size_t to;
+    size_t count;
+  };
+
+  ConnectionRebalancer(std::chrono::milliseconds period,
+                       std::function<void()> rebalance);
+
+  ~ConnectionRebalancer();
+
+  /**
+   * The moves evening out counts, the number of connections of each
+   * thread: the threads above threshold times the mean give down to the
+   * mean to the threads below it, fullest to emptiest, each giving at most
+   * maxMovesPerThread.
+   */
+  static std::vector<Move> plan(
+      const std::vector<size_t>& counts,
+      double threshold,
+      size_t maxMovesPerThread);
+
+ private:
+  void run();
+
+  const std::chrono::milliseconds period_;
+  std::function<void()> rebalance_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopping_{false};
+
+  std::thread thread_;
+};
+
+} // namespace wangle
@@ -0,0 +1,76 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/bootstrap/ConnectionRebalancer.h>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+
+using namespace wangle;
+
+namespace {
+
+std::vector<size_t> apply(
+    std::vector<size_t> counts,
+    const std::vector<ConnectionRebalancer::Move>& moves) {
+  for (auto& move : moves) {
+    EXPECT_GE(counts[move.from], move.count);
+    counts[move.from] -= move.count;
+    counts[move.to] += move.count;
+  }
+  return counts;
+}
+
+} // namespace
+
+TEST(ConnectionRebalancer, PlanEvensOut) {
+  std::vector<size_t> counts{300, 100, 100, 100};
+  auto moves = ConnectionRebalancer::plan(counts, 1.25, 1000);
+  EXPECT_EQ(std::vector<size_t>({150, 150, 150, 150}), apply(counts, moves));
+}
+
+TEST(ConnectionRebalancer, PlanSeveralSources) {
+  std::vector<size_t> counts{40, 0, 40, 0, 20};
+  auto moves = ConnectionRebalancer::plan(counts, 1.25, 1000);
+  for (auto count : apply(counts, moves)) {
+    EXPECT_EQ(20, count);
+  }
+}
+
+TEST(ConnectionRebalancer, PlanLeavesBalancedAlone) {
+  EXPECT_TRUE(ConnectionRebalancer::plan({110, 100, 90}, 1.25, 1000).empty());
+  EXPECT_TRUE(ConnectionRebalancer::plan({1, 0}, 1.25, 1000).empty());
+  EXPECT_TRUE(ConnectionRebalancer::plan({0, 0, 0}, 1.25, 1000).empty());
+  EXPECT_TRUE(ConnectionRebalancer::plan({500}, 1.25, 1000).empty());
+}
+
+TEST(ConnectionRebalancer, PlanCapsMoves) {
+  std::vector<size_t> counts{300, 100, 100, 100};
+  auto moves = ConnectionRebalancer::plan(counts, 1.25, 64);
+  auto after = apply(counts, moves);
+  EXPECT_EQ(236, after[0]);
+  for (size_t i = 1; i < after.size(); i++) {
+    EXPECT_LE(after[i], 150);
+  }
+}
+
+TEST(ConnectionRebalancer, RunsPeriodically) {
+  std::atomic<int> runs{0};
+  {
+    ConnectionRebalancer rebalancer(
+        std::chrono::milliseconds(1), [&] { runs++; });
+    while (runs < 3) {
+      std::this_thread::yield();
+    }
+  }
+  auto after = runs.load();
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  EXPECT_EQ(after, runs.load());
+}
@@ -0,0 +1,213 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/bootstrap/IoUring.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#if WANGLE_HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace wangle {
+
+#if WANGLE_HAVE_IO_URING
+
+namespace {
+
+int ioUringSetup(unsigned entries, io_uring_params* params) {
+  return int(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ioUringEnter(int fd, unsigned toSubmit) {
+  return int(syscall(__NR_io_uring_enter, fd, toSubmit, 0, 0, nullptr, 0));
+}
+
+void* mapRing(int fd, size_t size, off_t offset) {
+  void* ring = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, offset);
+  if (ring == MAP_FAILED) {
+    throw std::system_error(errno, std::system_category(),
+                            "failed to map io_uring");
+  }
+  return ring;
+}
+
+template <typename T>
+T* at(void* ring, uint32_t offset) {
+  return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+}
+
+} // namespace
+
+IoUring::IoUring(unsigned entries) {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  fd_ = ioUringSetup(entries, &params);
+  if (fd_ < 0) {
+    throw std::system_error(errno, std::system_category(),
+                            "io_uring_setup failed");
+  }
+  sqEntries_ = params.sq_entries;
+  try {
+    sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+    }
+    sqRing_ = mapRing(fd_, sqRingSize_, IORING_OFF_SQ_RING);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      cqRing_ = sqRing_;
+    } else {
+      cqRing_ = mapRing(fd_, cqRingSize_, IORING_OFF_CQ_RING);
+    }
+    sqes_ = static_cast<io_uring_sqe*>(mapRing(
+        fd_, params.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES));
+  } catch (...) {
+    unmap();
+    throw;
+  }
+
+  sqHead_ = at<unsigned>(sqRing_, params.sq_off.head);
+  sqTail_ = at<unsigned>(sqRing_, params.sq_off.tail);
+  sqMask_ = *at<unsigned>(sqRing_, params.sq_off.ring_mask);
+  sqeTail_ = *sqTail_;
+  // Each slot of the ring always points at the entry of the same index
+  auto array = at<unsigned>(sqRing_, params.sq_off.array);
+  for (unsigned i = 0; i < sqEntries_; i++) {
+    array[i] = i;
+  }
+
+  cqHead_ = at<unsigned>(cqRing_, params.cq_off.head);
+  cqTail_ = at<unsigned>(cqRing_, params.cq_off.tail);
+  cqMask_ = *at<unsigned>(cqRing_, params.cq_off.ring_mask);
+  cqes_ = at<io_uring_cqe>(cqRing_, params.cq_off.cqes);
+}
+
+IoUring::~IoUring() {
+  unmap();
+}
+
+void IoUring::unmap() {
+  if (sqes_) {
+    munmap(sqes_, sqEntries_ * sizeof(io_uring_sqe));
+    sqes_ = nullptr;
+  }
+  if (cqRing_ && cqRing_ != sqRing_) {
+    munmap(cqRing_, cqRingSize_);
+  }
+  cqRing_ = nullptr;
+  if (sqRing_) {
+    munmap(sqRing_, sqRingSize_);
+    sqRing_ = nullptr;
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+bool IoUring::isSupported() {
+  try {
+    IoUring ring(1);
+    return true;
+  } catch (const std::system_error&) {
+    return false;
+  }
+}
+
+io_uring_sqe* IoUring::getSqe() {
+  const unsigned head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+  if (sqeTail_ - head >= sqEntries_) {
+    return nullptr;
+  }
+  auto sqe = &sqes_[sqeTail_ & sqMask_];
+  sqeTail_++;
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+unsigned IoUring::submit() {
+  const unsigned toSubmit = sqeTail_ - *sqTail_;
+  if (toSubmit == 0) {
+    return 0;
+  }
+  // Entries written before the kernel can see the new tail
+  __atomic_store_n(sqTail_, sqeTail_, __ATOMIC_RELEASE);
+  int ret;
+  do {
+    ret = ioUringEnter(fd_, toSubmit);
+  } while (ret < 0 && errno == EINTR);
+  if (ret < 0) {
+    throw std::system_error(errno, std::system_category(),
+                            "io_uring_enter failed");
+  }
+  return unsigned(ret);
+}
+
+void IoUring::registerEventFd(int eventFd) {
+  if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_EVENTFD,
+              &eventFd, 1) != 0) {
+    throw std::system_error(errno, std::system_category(),
+                            "failed to register io_uring eventfd");
+  }
+}
+
+const io_uring_cqe* IoUring::peekCompletion() {
+  const unsigned head = *cqHead_;
+  if (head == __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE)) {
+    return nullptr;
+  }
+  return &cqes_[head & cqMask_];
+}
+
+void IoUring::popCompletion() {
+  __atomic_store_n(cqHead_, *cqHead_ + 1, __ATOMIC_RELEASE);
+}
+
+#else
+
+IoUring::IoUring(unsigned /*entries*/) {
+  throw std::system_error(ENOSYS, std::system_category(),
+                          "io_uring is not supported on this platform");
+}
+
+IoUring::~IoUring() {}
+
+void IoUring::unmap() {}
+
+bool IoUring::isSupported() {
+  return false;
+}
+
+io_uring_sqe* IoUring::getSqe() {
+  return nullptr;
+}
+
+unsigned IoUring::submit() {
+  return 0;
+}
+
+void IoUring::registerEventFd(int /*eventFd*/) {}
+
+const io_uring_cqe* IoUring::peekCompletion() {
+  return nullptr;
+}
+
+void IoUring::popCompletion() {}
+
+#endif
+
+} // namespace wangle
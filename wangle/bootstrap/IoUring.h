@@ -0,0 +1,116 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define WANGLE_HAVE_IO_URING 1
+#endif
+#endif
+
+#ifndef WANGLE_HAVE_IO_URING
+#define WANGLE_HAVE_IO_URING 0
+struct io_uring_sqe;
+struct io_uring_cqe;
+#endif
+
+namespace wangle {
+
+/**
+ * A minimal io_uring instance, straight on the system calls: entries are
+ * queued with getSqe() and handed to the kernel all at once by submit(),
+ * and completions are read from the shared ring without a system call.
+ *
+ * Not thread safe. Linux 5.1 and later; the constructor throws
+ * std::system_error where io_uring isn't available.
+ */
+class IoUring {
+ public:
+  explicit IoUring(unsigned entries);
+  ~IoUring();
+
+  IoUring(const IoUring&) = delete;
+  IoUring& operator=(const IoUring&) = delete;
+
+  // Whether the kernel lets this process set up an io_uring
+  static bool isSupported();
+
+  /**
+   * A zeroed entry to fill in, submitted by the next submit(), or null if
+   * the submission queue is full.
+   */
+  io_uring_sqe* getSqe();
+
+  // Submits the entries queued since the last call. Throws on error
+  unsigned submit();
+
+  /**
+   * Calls f(res, user_data) for each completion ready, and returns how
+   * many there were.
+   */
+  template <typename F>
+  size_t reapCompletions(F&& f);
+
+  // Have the kernel signal eventFd as completions are posted
+  void registerEventFd(int eventFd);
+
+  unsigned getNumEntries() const {
+    return sqEntries_;
+  }
+
+ private:
+  void unmap();
+
+  // The next completion ready, or null
+  const io_uring_cqe* peekCompletion();
+  void popCompletion();
+
+  int fd_{-1};
+
+  void* sqRing_{nullptr};
+  size_t sqRingSize_{0};
+  void* cqRing_{nullptr};
+  size_t cqRingSize_{0};
+  io_uring_sqe* sqes_{nullptr};
+
+  unsigned* sqHead_{nullptr};
+  unsigned* sqTail_{nullptr};
+  unsigned sqMask_{0};
+  unsigned sqEntries_{0};
+  // Entries handed out by getSqe(), ahead of *sqTail_ until submit()
+  unsigned sqeTail_{0};
+
+  unsigned* cqHead_{nullptr};
+  unsigned* cqTail_{nullptr};
+  unsigned cqMask_{0};
+  io_uring_cqe* cqes_{nullptr};
+};
+
+template <typename F>
+size_t IoUring::reapCompletions(F&& f) {
+  size_t n = 0;
+#if WANGLE_HAVE_IO_URING
+  while (auto cqe = peekCompletion()) {
+    auto res = cqe->res;
+    auto data = cqe->user_data;
+    // Freed before the callback, which may queue more
+    popCompletion();
+    f(res, data);
+    n++;
+  }
+#endif
+  return n;
+}
+
+} // namespace wangle
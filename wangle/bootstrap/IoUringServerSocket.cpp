@@ -0,0 +1,266 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/bootstrap/IoUringServerSocket.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <system_error>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+using folly::AsyncServerSocket;
+using folly::SocketAddress;
+
+namespace {
+
+// Before accepting again after running out of fds or memory
+const uint32_t kBackoffMs = 100;
+
+} // namespace
+
+namespace wangle {
+
+IoUringServerSocket::IoUringServerSocket(
+    folly::EventBase* evb,
+    size_t acceptDepth)
+  : folly::EventHandler(evb),
+    evb_(evb),
+    acceptDepth_(std::max<size_t>(1, acceptDepth)),
+    backoff_(evb, this) {
+}
+
+IoUringServerSocket::~IoUringServerSocket() {
+  close();
+}
+
+void IoUringServerSocket::bind(const SocketAddress& address) {
+  CHECK(fd_ < 0) << "already bound";
+  int fd = ::socket(address.getFamily(), SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    throw std::system_error(errno, std::system_category(),
+                            "failed to create socket");
+  }
+  int one = 1;
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+      (reusePort_ &&
+       setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0)) {
+    int err = errno;
+    ::close(fd);
+    throw std::system_error(err, std::system_category(),
+                            "failed to set socket options");
+  }
+  sockaddr_storage addr;
+  auto len = address.getAddress(&addr);
+  if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), len) != 0) {
+    int err = errno;
+    ::close(fd);
+    throw std::system_error(err, std::system_category(),
+                            "failed to bind to " + address.describe());
+  }
+  fd_ = fd;
+}
+
+void IoUringServerSocket::listen(int backlog) {
+  CHECK(fd_ >= 0) << "need to bind before listening";
+  if (::listen(fd_, backlog) != 0) {
+    throw std::system_error(errno, std::system_category(),
+                            "failed to listen");
+  }
+}
+
+void IoUringServerSocket::startAccepting() {
+  CHECK(fd_ >= 0) << "need to listen before accepting";
+  if (accepting_) {
+    return;
+  }
+  // The ring posts completions to the eventfd, which wakes up the loop
+  ring_.reset(new IoUring(acceptDepth_));
+  eventFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (eventFd_ < 0) {
+    ring_.reset();
+    throw std::system_error(errno, std::system_category(),
+                            "failed to create eventfd");
+  }
+  ring_->registerEventFd(eventFd_);
+  changeHandlerFD(eventFd_);
+  registerHandler(folly::EventHandler::READ | folly::EventHandler::PERSIST);
+
+  slots_.resize(acceptDepth_);
+  for (size_t i = 0; i < slots_.size(); i++) {
+    arm(i);
+  }
+  submit();
+  accepting_ = true;
+}
+
+void IoUringServerSocket::close() {
+  if (accepting_) {
+    accepting_ = false;
+    backoff_.cancelTimeout();
+    unregisterHandler();
+    changeHandlerFD(-1);
+    // Connections accepted meanwhile would have no one to go to
+    ring_->reapCompletions([](int res, uint64_t /*data*/) {
+      if (res >= 0) {
+        ::close(res);
+      }
+    });
+    // Cancels the accepts still queued
+    ring_.reset();
+    ::close(eventFd_);
+    eventFd_ = -1;
+    idle_.clear();
+  }
+  for (auto& callback : callbacks_) {
+    auto cb = callback.first;
+    callback.second->runInEventBaseThread([cb] {
+      cb->acceptStopped();
+    });
+  }
+  callbacks_.clear();
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+}
+
+void IoUringServerSocket::addAcceptCallback(
+    AsyncServerSocket::AcceptCallback* callback,
+    folly::EventBase* evb) {
+  if (!evb) {
+    evb = evb_;
+  }
+  callbacks_.emplace_back(callback, evb);
+  evb->runInEventBaseThread([callback] {
+    callback->acceptStarted();
+  });
+}
+
+void IoUringServerSocket::removeAcceptCallback(
+    AsyncServerSocket::AcceptCallback* callback) {
+  auto it = std::find_if(
+      callbacks_.begin(), callbacks_.end(),
+      [callback](const std::pair<AsyncServerSocket::AcceptCallback*,
+                                 folly::EventBase*>& cb) {
+        return cb.first == callback;
+      });
+  if (it == callbacks_.end()) {
+    return;
+  }
+  auto evb = it->second;
+  callbacks_.erase(it);
+  evb->runInEventBaseThread([callback] {
+    callback->acceptStopped();
+  });
+}
+
+void IoUringServerSocket::getAddress(SocketAddress* address) const {
+  address->setFromLocalAddress(fd_);
+}
+
+void IoUringServerSocket::arm(size_t i) {
+#if WANGLE_HAVE_IO_URING
+  auto sqe = ring_->getSqe();
+  // At most one accept per slot, and as many entries as slots
+  CHECK(sqe);
+  auto& slot = slots_[i];
+  slot.len = sizeof(slot.addr);
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = fd_;
+  sqe->addr = reinterpret_cast<uint64_t>(&slot.addr);
+  sqe->addr2 = reinterpret_cast<uint64_t>(&slot.len);
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  sqe->user_data = i;
+#endif
+}
+
+void IoUringServerSocket::rearmIdle() {
+  for (auto i : idle_) {
+    arm(i);
+  }
+  idle_.clear();
+  submit();
+}
+
+void IoUringServerSocket::submit() {
+  try {
+    ring_->submit();
+  } catch (const std::system_error& ex) {
+    LOG(ERROR) << "failed to queue accepts on " << fd_ << ": " << ex.what();
+    notifyError(ex);
+  }
+}
+
+void IoUringServerSocket::handlerReady(uint16_t /*events*/) noexcept {
+  uint64_t count;
+  if (read(eventFd_, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+    PLOG(ERROR) << "failed to read io_uring eventfd";
+  }
+
+  ring_->reapCompletions([this](int res, uint64_t data) {
+    const size_t i = size_t(data);
+    if (res >= 0) {
+      SocketAddress address;
+      try {
+        address.setFromSockaddr(
+            reinterpret_cast<sockaddr*>(&slots_[i].addr), slots_[i].len);
+      } catch (const std::exception& ex) {
+        LOG(ERROR) << "accepted connection with bad address: " << ex.what();
+      }
+      dispatch(res, address);
+      arm(i);
+      return;
+    }
+
+    if (res == -ECONNABORTED || res == -EINTR || res == -EAGAIN) {
+      // Only this connection
+      arm(i);
+      return;
+    }
+    // Out of fds or memory: like AsyncServerSocket, tell the callbacks and
+    // back off
+    notifyError(
+        std::system_error(-res, std::system_category(), "accept failed"));
+    idle_.push_back(i);
+    if (!backoff_.isScheduled()) {
+      backoff_.scheduleTimeout(kBackoffMs);
+    }
+  });
+  // One system call for every accept reaped
+  submit();
+}
+
+void IoUringServerSocket::notifyError(const std::system_error& ex) {
+  for (auto& callback : callbacks_) {
+    auto cb = callback.first;
+    callback.second->runInEventBaseThread([cb, ex] {
+      cb->acceptError(ex);
+    });
+  }
+}
+
+void IoUringServerSocket::dispatch(int fd, const SocketAddress& address) {
+  if (callbacks_.empty()) {
+    ::close(fd);
+    return;
+  }
+  auto& callback = callbacks_[nextCallback_++ % callbacks_.size()];
+  auto cb = callback.first;
+  if (callback.second == evb_) {
+    cb->connectionAccepted(fd, address);
+    return;
+  }
+  callback.second->runInEventBaseThread([cb, fd, address] {
+    cb->connectionAccepted(fd, address);
+  });
+}
+
+} // namespace wangle
@@ -0,0 +1,120 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <wangle/bootstrap/IoUring.h>
+
+#include <folly/io/async/AsyncServerSocket.h>
+#include <folly/io/async/AsyncTimeout.h>
+#include <folly/io/async/EventHandler.h>
+
+#include <memory>
+#include <system_error>
+#include <sys/socket.h>
+#include <vector>
+
+namespace wangle {
+
+/**
+ * A TCP server socket accepting through io_uring: acceptDepth accepts are
+ * kept queued in the kernel, each completing with the new connection and
+ * its peer address. Every wakeup reaps all the accepts completed since the
+ * last one and queues them again with a single system call, where
+ * AsyncServerSocket makes one accept() call per connection, plus one that
+ * fails once the backlog is empty. Connections are handed to the accept
+ * callbacks round robin, as AsyncServerSocket does, so acceptors and
+ * pipelines don't tell the difference.
+ *
+ * Created by IoUringServerSocketFactory. Must be used and destroyed in the
+ * thread of its EventBase.
+ */
+class IoUringServerSocket : public folly::AsyncSocketBase,
+                            private folly::EventHandler {
+ public:
+  explicit IoUringServerSocket(
+      folly::EventBase* evb,
+      size_t acceptDepth = 32);
+  ~IoUringServerSocket();
+
+  void setReusePort(bool reusePort) {
+    reusePort_ = reusePort;
+  }
+
+  void bind(const folly::SocketAddress& address);
+  void listen(int backlog);
+  void startAccepting();
+  void close();
+
+  void addAcceptCallback(
+      folly::AsyncServerSocket::AcceptCallback* callback,
+      folly::EventBase* evb);
+  void removeAcceptCallback(
+      folly::AsyncServerSocket::AcceptCallback* callback);
+
+  folly::EventBase* getEventBase() const override {
+    return evb_;
+  }
+
+  void getAddress(folly::SocketAddress* address) const override;
+
+  int getSocket() const {
+    return fd_;
+  }
+
+ private:
+  struct Slot {
+    sockaddr_storage addr;
+    socklen_t len;
+  };
+
+  // Re-arms the accepts that failed, e.g. out of fds, after a while
+  class BackoffTimeout : public folly::AsyncTimeout {
+   public:
+    BackoffTimeout(folly::EventBase* evb, IoUringServerSocket* socket)
+      : folly::AsyncTimeout(evb), socket_(socket) {}
+
+    void timeoutExpired() noexcept override {
+      socket_->rearmIdle();
+    }
+
+   private:
+    IoUringServerSocket* socket_;
+  };
+
+  void handlerReady(uint16_t events) noexcept override;
+
+  // Queues an accept into slots_[i], submitted by the caller
+  void arm(size_t i);
+  void rearmIdle();
+  void submit();
+
+  // In the callbacks' threads
+  void notifyError(const std::system_error& ex);
+  void dispatch(int fd, const folly::SocketAddress& address);
+
+  folly::EventBase* const evb_;
+  const size_t acceptDepth_;
+  bool reusePort_{false};
+  int fd_{-1};
+  int eventFd_{-1};
+  bool accepting_{false};
+
+  std::unique_ptr<IoUring> ring_;
+  std::vector<Slot> slots_;
+  // Slots without an accept queued, waiting for the backoff
+  std::vector<size_t> idle_;
+  BackoffTimeout backoff_;
+
+  std::vector<std::pair<folly::AsyncServerSocket::AcceptCallback*,
+                        folly::EventBase*>> callbacks_;
+  size_t nextCallback_{0};
+};
+
+} // namespace wangle
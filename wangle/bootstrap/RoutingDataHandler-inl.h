@@ -36,4 +36,17 @@ void RoutingDataHandler<R>::readException(Context* ctx, folly::exception_wrapper
   cob_->onError(connId_, ex);
 }
 
+template <typename R>
+bool PeekingRoutingDataHandler<R>::parseRoutingData(
+    folly::IOBufQueue& bufQueue,
+    typename RoutingDataHandler<R>::RoutingData& routingData) {
+  if (!peekRoutingData(bufQueue, routingData.routingData)) {
+    return false;
+  }
+  if (auto buf = bufQueue.move()) {
+    routingData.bufQueue.append(std::move(buf));
+  }
+  return true;
+}
+
 } // namespace wangle
@@ -9,10 +9,62 @@
  */
 #pragma once
 
+#include <folly/Hash.h>
 #include <wangle/channel/AsyncSocketHandler.h>
 
+#include <algorithm>
+
 namespace wangle {
 
+/**
+ * Routing data for keys among the bytes read, such as a header value,
+ * hashed in place as they are parsed rather than copied out into a
+ * string: AcceptRoutingHandler's std::hash is then the stored hash. offset
+ * and length locate the key in the bytes handed to the child pipeline.
+ *
+ * Only the hash of the bytes is kept, which is all worker selection needs,
+ * so keys aren't equality comparable: colliding keys can't be told apart.
+ * Don't use RoutingKey where routing data must be equal to be shared, such
+ * as a BroadcastPool's.
+ */
+struct RoutingKey {
+  // The key of the length bytes at offset of q, which must hold them
+  static RoutingKey fromQueue(const folly::IOBufQueue& q,
+                              uint64_t offset,
+                              uint64_t length) {
+    RoutingKey key;
+    key.offset = offset;
+    key.length = length;
+    const folly::IOBuf* front = q.front();
+    const folly::IOBuf* seg = front;
+    while (seg && length > 0) {
+      if (offset < seg->length()) {
+        const auto n = std::min<uint64_t>(seg->length() - offset, length);
+        key.hash = folly::hash::fnv64_buf(seg->data() + offset, n, key.hash);
+        length -= n;
+        offset = 0;
+      } else {
+        offset -= seg->length();
+      }
+      seg = seg->next();
+      if (seg == front) {
+        break;
+      }
+    }
+    DCHECK_EQ(0, length);
+    return key;
+  }
+
+  // Whether the bytes of both keys hash the same, if not equal
+  bool sameHash(const RoutingKey& other) const {
+    return hash == other.hash && length == other.length;
+  }
+
+  uint64_t hash{folly::hash::FNV_64_HASH_START};
+  uint64_t offset{0};
+  uint64_t length{0};
+};
+
 template <typename R>
 class RoutingDataHandler : public wangle::BytesToBytesHandler {
  public:
@@ -57,6 +109,32 @@ class RoutingDataHandler : public wangle::BytesToBytesHandler {
   Callback* cob_{nullptr};
 };
 
+/**
+ * A RoutingDataHandler for handlers that pass all the bytes read on to the
+ * child pipeline: the routing data is parsed from a read-only view of
+ * them, and the buffers are then handed over to RoutingData::bufQueue as
+ * they are, by ownership, neither copied nor re-chained.
+ */
+template <typename R>
+class PeekingRoutingDataHandler : public RoutingDataHandler<R> {
+ public:
+  using RoutingDataHandler<R>::RoutingDataHandler;
+
+  bool parseRoutingData(
+      folly::IOBufQueue& bufQueue,
+      typename RoutingDataHandler<R>::RoutingData& routingData) override;
+
+  /**
+   * Parse the routing data from bufQueue, e.g. with a BufferScanner,
+   * without touching it.
+   *
+   * @return bool - True on success, false if bufQueue doesn't have
+   *                sufficient bytes for parsing
+   */
+  virtual bool peekRoutingData(const folly::IOBufQueue& bufQueue,
+                               R& routingData) = 0;
+};
+
 template <typename R>
 class RoutingDataHandlerFactory {
  public:
@@ -68,4 +146,15 @@ class RoutingDataHandlerFactory {
 
 } // namespace wangle
 
+namespace std {
+
+template <>
+struct hash<wangle::RoutingKey> {
+  size_t operator()(const wangle::RoutingKey& key) const {
+    return key.hash;
+  }
+};
+
+} // namespace std
+
 #include <wangle/bootstrap/RoutingDataHandler-inl.h>
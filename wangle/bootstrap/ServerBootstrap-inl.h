@@ -16,11 +16,14 @@
 #include <wangle/acceptor/Acceptor.h>
 #include <wangle/acceptor/ManagedConnection.h>
 #include <wangle/bootstrap/ServerSocketFactory.h>
+#include <wangle/channel/AsyncSocketHandler.h>
 #include <wangle/channel/Handler.h>
 #include <wangle/channel/Pipeline.h>
 #include <wangle/concurrent/IOThreadPoolExecutor.h>
 #include <wangle/ssl/SSLStats.h>
 
+#include <thread>
+
 namespace wangle {
 
 class AcceptorException : public std::runtime_error {
@@ -50,24 +53,32 @@ template <typename Pipeline>
 class ServerAcceptor
     : public Acceptor
     , public wangle::InboundHandler<AcceptPipelineType> {
+  struct PipelinePool;
+
  public:
   class ServerConnection : public wangle::ManagedConnection,
                            public wangle::PipelineManager {
    public:
-    explicit ServerConnection(typename Pipeline::Ptr pipeline)
-        : pipeline_(std::move(pipeline)) {
+    explicit ServerConnection(
+        typename Pipeline::Ptr pipeline,
+        std::weak_ptr<PipelinePool> pool = std::weak_ptr<PipelinePool>())
+        : pipeline_(std::move(pipeline)), pool_(std::move(pool)) {
       pipeline_->setPipelineManager(this);
     }
 
     void timeoutExpired() noexcept override {
+      if (!checkIdleTimeout()) {
+        return;
+      }
       auto ew = folly::make_exception_wrapper<AcceptorException>(
           AcceptorException::ExceptionType::TIMED_OUT, "timeout");
       pipeline_->readException(ew);
     }
 
     void describe(std::ostream& os) const override {}
+    // While serving a request, see PipelineBase::requestStarted()
     bool isBusy() const override {
-      return true;
+      return pipeline_->getNumRequests() > 0;
     }
     void notifyPendingShutdown() override {}
     void closeWhenIdle() override {}
@@ -80,6 +91,20 @@ class ServerAcceptor
     }
     void dumpConnectionState(uint8_t loglevel) override {}
 
+    const TransportInfo* sampleTcpInfo() override {
+      auto tinfo = pipeline_->getTransportInfo();
+      auto transport = dynamic_cast<folly::AsyncTransportWrapper*>(
+          pipeline_->getTransport().get());
+      if (!tinfo || !transport) {
+        return nullptr;
+      }
+      auto sock = transport->getUnderlyingTransport<folly::AsyncSocket>();
+      if (!sock || !tinfo->initWithSocket(sock)) {
+        return nullptr;
+      }
+      return tinfo.get();
+    }
+
     void deletePipeline(wangle::PipelineBase* p) override {
       CHECK(p == pipeline_.get());
       destroy();
@@ -89,15 +114,39 @@ class ServerAcceptor
       pipeline_->transportActive();
     }
 
+    // Called on every read and write
     void refreshTimeout() override {
-      resetTimeout();
+      touchTimeout();
+    }
+
+    // See AsyncSocketHandler::tryDetachEventBase(). Only when not busy
+    // without canMove.
+    bool detachEventBase(const std::function<bool(PipelineBase*)>& canMove) {
+      auto handler = pipeline_->template getHandler<AsyncSocketHandler>();
+      if (!handler || (canMove ? !canMove(pipeline_.get()) : isBusy())) {
+        return false;
+      }
+      return handler->tryDetachEventBase();
     }
 
-   private:
+    void attachEventBase(
+        folly::EventBase* evb,
+        std::weak_ptr<PipelinePool> pool) {
+      // Recycled by the acceptor of the thread it ends in
+      pool_ = std::move(pool);
+      pipeline_->template getHandler<AsyncSocketHandler>()
+        ->reattachEventBase(evb);
+    }
+
+   protected:
     ~ServerConnection() {
       pipeline_->setPipelineManager(nullptr);
+      if (auto pool = pool_.lock()) {
+        pool->recycle(pool, std::move(pipeline_));
+      }
     }
     typename Pipeline::Ptr pipeline_;
+    std::weak_ptr<PipelinePool> pool_;
   };
 
   explicit ServerAcceptor(
@@ -123,6 +172,13 @@ class ServerAcceptor
       acceptPipeline_->addBack(this);
     }
     acceptPipeline_->finalize();
+
+    if (childPipelineFactory_ && accConfig_.maxRecycledPipelines > 0) {
+      pipelinePool_ = std::make_shared<PipelinePool>();
+      pipelinePool_->factory = childPipelineFactory_;
+      pipelinePool_->base = eventBase;
+      pipelinePool_->maxSize = accConfig_.maxRecycledPipelines;
+    }
   }
 
   void read(Context* ctx, AcceptPipelineType conn) override {
@@ -133,21 +189,33 @@ class ServerAcceptor
     auto connInfo = boost::get<ConnInfo&>(conn);
     folly::AsyncTransportWrapper::UniquePtr transport(connInfo.sock);
 
-    // Setup local and remote addresses
-    auto tInfoPtr = std::make_shared<TransportInfo>(connInfo.tinfo);
-    tInfoPtr->localAddr =
-      std::make_shared<folly::SocketAddress>(accConfig_.bindAddress);
-    transport->getLocalAddress(tInfoPtr->localAddr.get());
-    tInfoPtr->remoteAddr =
-      std::make_shared<folly::SocketAddress>(*connInfo.clientAddr);
+    // Setup local and remote addresses, in a block of the thread's pool
+    if (!tinfoPool_) {
+      tinfoPool_ = std::make_shared<TransportInfoPool>();
+    }
+    auto tInfoPtr = std::allocate_shared<TransportInfo>(
+        TransportInfoAllocator<TransportInfo>(tinfoPool_), connInfo.tinfo);
+    folly::SocketAddress localAddr(accConfig_.bindAddress);
+    transport->getLocalAddress(&localAddr);
+    tInfoPtr->setAddresses(localAddr, *connInfo.clientAddr);
     tInfoPtr->sslNextProtocol =
-      std::make_shared<std::string>(connInfo.nextProtoName);
-
-    auto pipeline = childPipelineFactory_->newPipeline(
-      std::shared_ptr<folly::AsyncTransportWrapper>(
-        transport.release(), folly::DelayedDestruction::Destructor()));
+      TransportInfo::internString(connInfo.nextProtoName);
+
+    // Owned apart, so a TransportInfo kept past the connection doesn't
+    // keep the transport
+    std::shared_ptr<folly::AsyncTransportWrapper> sharedTransport(
+        transport.release(), folly::DelayedDestruction::Destructor());
+    typename Pipeline::Ptr pipeline;
+    if (pipelinePool_ && !pipelinePool_->pipelines.empty()) {
+      auto recycled = std::move(pipelinePool_->pipelines.back());
+      pipelinePool_->pipelines.pop_back();
+      pipeline = childPipelineFactory_->reusePipeline(
+          std::move(recycled), std::move(sharedTransport));
+    } else {
+      pipeline = childPipelineFactory_->newPipeline(std::move(sharedTransport));
+    }
     pipeline->setTransportInfo(tInfoPtr);
-    auto connection = new ServerConnection(std::move(pipeline));
+    auto connection = new ServerConnection(std::move(pipeline), pipelinePool_);
     Acceptor::addConnection(connection);
     connection->init();
   }
@@ -197,23 +265,198 @@ class ServerAcceptor
         AcceptPipelineType(make_tuple(buf.release(), socket, addr)));
   }
 
+  // One pass through the accept pipeline per batch
+  void onDataBatchAvailable(
+      std::shared_ptr<folly::AsyncUDPSocket> socket,
+      std::vector<UDPDatagram> datagrams) noexcept override {
+    std::vector<AcceptPipelineType> msgs;
+    msgs.reserve(datagrams.size());
+    for (auto& datagram : datagrams) {
+      msgs.emplace_back(
+          make_tuple(datagram.buf.release(), socket, datagram.address));
+    }
+    acceptPipeline_->readBatch(
+        folly::range(msgs));
+  }
+
   void onConnectionAdded(const wangle::ConnectionManager&) override {
+    numConnections_++;
     acceptPipeline_->read(ConnEvent::CONN_ADDED);
   }
 
   void onConnectionRemoved(const wangle::ConnectionManager&) override {
+    numConnections_--;
     acceptPipeline_->read(ConnEvent::CONN_REMOVED);
   }
 
+  // getNumConnections(), but may be called from any thread
+  size_t getNumConnectionsAnyThread() const {
+    return numConnections_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Takes up to max connections between messages off this acceptor, for
+   * adoptConnections() to carry them on in another acceptor's thread. See
+   * ConnectionRebalancerOptions::canMove. Must be called in the acceptor's
+   * thread.
+   */
+  std::vector<ServerConnection*> detachConnections(
+      size_t max,
+      const std::function<bool(PipelineBase*)>& canMove) {
+    std::vector<ServerConnection*> detached;
+    auto manager = getConnectionManager();
+    if (!manager || getState() != State::kRunning) {
+      return detached;
+    }
+    // Connections can't be removed while iterating
+    std::vector<ServerConnection*> conns;
+    manager->iterateConns([&](ManagedConnection* conn) {
+      auto serverConn = dynamic_cast<ServerConnection*>(conn);
+      if (serverConn) {
+        conns.push_back(serverConn);
+      }
+    });
+    for (auto conn : conns) {
+      if (detached.size() >= max) {
+        break;
+      }
+      if (conn->detachEventBase(canMove)) {
+        manager->removeConnection(conn);
+        detached.push_back(conn);
+      }
+    }
+    return detached;
+  }
+
+  // Must be called in the acceptor's thread
+  void adoptConnections(const std::vector<ServerConnection*>& conns) {
+    for (auto conn : conns) {
+      conn->attachEventBase(getEventBase(), pipelinePool_);
+      if (getConnectionManager()) {
+        Acceptor::addConnection(conn);
+      } else {
+        // Stopped meanwhile, its connections already dropped
+        conn->dropConnection();
+      }
+    }
+  }
+
   void sslConnectionError(const folly::exception_wrapper& ex) override {
     acceptPipeline_->readException(ex);
     Acceptor::sslConnectionError(ex);
   }
 
  private:
+  // Idle pipelines of closed connections, kept for reuse by new ones (see
+  // PipelineFactory::recyclePipeline). Connections only hold a weak_ptr, as
+  // they may outlive the acceptor.
+  struct PipelinePool {
+    std::shared_ptr<PipelineFactory<Pipeline>> factory;
+    folly::EventBase* base{nullptr};
+    size_t maxSize{0};
+    std::vector<typename Pipeline::Ptr> pipelines;
+
+    static void recycle(
+        const std::shared_ptr<PipelinePool>& pool,
+        typename Pipeline::Ptr pipeline) {
+      if (!pipeline || pool->pipelines.size() >= pool->maxSize) {
+        return;
+      }
+      // The connection is usually deleted from within one of the pipeline's
+      // handlers, so only reset the pipeline once the stack has unwound.
+      std::weak_ptr<PipelinePool> weakPool = pool;
+      pool->base->runInLoop([weakPool, pipeline]() mutable {
+        auto p = weakPool.lock();
+        // Leave pipelines alone that something else still refers to
+        if (p && pipeline.use_count() == 1 &&
+            p->pipelines.size() < p->maxSize &&
+            p->factory->recyclePipeline(pipeline.get())) {
+          p->pipelines.push_back(std::move(pipeline));
+        }
+      });
+    }
+  };
+
+  // Blocks of connections' TransportInfos, each with the count of the
+  // shared_ptrs to it, freed in the acceptor's thread and reused for its
+  // next connections. Created in that thread on the first connection, and
+  // kept by the blocks' allocators, as a TransportInfo may outlive the
+  // acceptor.
+  struct TransportInfoPool {
+    static constexpr size_t kMaxSize = 256;
+
+    ~TransportInfoPool() {
+      for (auto block : blocks) {
+        ::operator delete(block);
+      }
+    }
+
+    const std::thread::id thread{std::this_thread::get_id()};
+    // Of the one type allocate_shared allocates
+    size_t blockSize{0};
+    std::vector<void*> blocks;
+  };
+
+  template <typename T>
+  struct TransportInfoAllocator {
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind {
+      typedef TransportInfoAllocator<U> other;
+    };
+
+    explicit TransportInfoAllocator(std::shared_ptr<TransportInfoPool> p)
+        : pool(std::move(p)) {}
+
+    template <typename U>
+    TransportInfoAllocator(const TransportInfoAllocator<U>& other)
+        : pool(other.pool) {}
+
+    T* allocate(size_t n) {
+      const auto size = n * sizeof(T);
+      if (size == pool->blockSize && !pool->blocks.empty() &&
+          std::this_thread::get_id() == pool->thread) {
+        auto block = pool->blocks.back();
+        pool->blocks.pop_back();
+        return static_cast<T*>(block);
+      }
+      return static_cast<T*>(::operator new(size));
+    }
+
+    // Freed elsewhere, e.g. by a connection moved to another acceptor, the
+    // block isn't pooled
+    void deallocate(T* p, size_t n) {
+      const auto size = n * sizeof(T);
+      if (std::this_thread::get_id() == pool->thread &&
+          (pool->blockSize == 0 || size == pool->blockSize) &&
+          pool->blocks.size() < TransportInfoPool::kMaxSize) {
+        pool->blockSize = size;
+        pool->blocks.push_back(p);
+      } else {
+        ::operator delete(p);
+      }
+    }
+
+    template <typename U>
+    bool operator==(const TransportInfoAllocator<U>& other) const {
+      return pool == other.pool;
+    }
+
+    template <typename U>
+    bool operator!=(const TransportInfoAllocator<U>& other) const {
+      return pool != other.pool;
+    }
+
+    std::shared_ptr<TransportInfoPool> pool;
+  };
+
   std::shared_ptr<AcceptPipelineFactory> acceptPipelineFactory_;
   std::shared_ptr<AcceptPipeline> acceptPipeline_;
   std::shared_ptr<PipelineFactory<Pipeline>> childPipelineFactory_;
+  std::shared_ptr<PipelinePool> pipelinePool_;
+  std::shared_ptr<TransportInfoPool> tinfoPool_;
+  std::atomic<size_t> numConnections_{0};
 };
 
 template <typename Pipeline>
@@ -246,19 +489,42 @@ class ServerWorkerPool : public wangle::ThreadPoolExecutor::Observer {
     std::shared_ptr<AcceptorFactory> acceptorFactory,
     wangle::IOThreadPoolExecutor* exec,
     std::shared_ptr<std::vector<std::shared_ptr<folly::AsyncSocketBase>>> sockets,
-    std::shared_ptr<ServerSocketFactory> socketFactory)
+    std::shared_ptr<ServerSocketFactory> socketFactory,
+    bool newAcceptorInIOThread = false,
+    bool localAccept = false)
       : workers_(std::make_shared<WorkerMap>())
       , workersMutex_(std::make_shared<Mutex>())
       , acceptorFactory_(acceptorFactory)
       , exec_(exec)
       , sockets_(sockets)
-      , socketFactory_(socketFactory) {
+      , socketFactory_(socketFactory)
+      , newAcceptorInIOThread_(newAcceptorInIOThread)
+      , localAccept_(localAccept) {
     CHECK(exec);
   }
 
+  // Whether worker accepts from socket: with localAccept, only from the
+  // sockets of its own thread
+  bool acceptsFrom(
+      const Acceptor* worker,
+      const std::shared_ptr<folly::AsyncSocketBase>& socket) const {
+    return !localAccept_ ||
+      worker->getEventBase() == socket->getEventBase();
+  }
+
   template <typename F>
   void forEachWorker(F&& f) const;
 
+  // The IO threads' acceptors, for use outside of the workers lock
+  std::vector<std::shared_ptr<Acceptor>> getWorkers() const {
+    Mutex::ReadHolder holder(workersMutex_.get());
+    std::vector<std::shared_ptr<Acceptor>> workers;
+    for (const auto& kv : *workers_) {
+      workers.push_back(kv.second);
+    }
+    return workers;
+  }
+
   void threadStarted(
     wangle::ThreadPoolExecutor::ThreadHandle*);
   void threadStopped(
@@ -284,6 +550,8 @@ class ServerWorkerPool : public wangle::ThreadPoolExecutor::Observer {
   std::shared_ptr<std::vector<std::shared_ptr<folly::AsyncSocketBase>>>
       sockets_;
   std::shared_ptr<ServerSocketFactory> socketFactory_;
+  bool newAcceptorInIOThread_;
+  bool localAccept_;
 };
 
 template <typename F>
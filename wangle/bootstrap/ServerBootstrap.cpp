@@ -17,13 +17,25 @@ namespace wangle {
 
 void ServerWorkerPool::threadStarted(
   wangle::ThreadPoolExecutor::ThreadHandle* h) {
-  auto worker = acceptorFactory_->newAcceptor(exec_->getEventBase(h));
+  auto evb = exec_->getEventBase(h);
+  std::shared_ptr<Acceptor> worker;
+  if (newAcceptorInIOThread_) {
+    // So the acceptor's memory comes from the IO thread's NUMA node
+    evb->runImmediatelyOrRunInEventBaseThreadAndWait([&] {
+      worker = acceptorFactory_->newAcceptor(evb);
+    });
+  } else {
+    worker = acceptorFactory_->newAcceptor(evb);
+  }
   {
     Mutex::WriteHolder holder(workersMutex_.get());
     workers_->insert({h, worker});
   }
 
   for(auto socket : *sockets_) {
+    if (!acceptsFrom(worker.get(), socket)) {
+      continue;
+    }
     socket->getEventBase()->runImmediatelyOrRunInEventBaseThreadAndWait(
       [this, worker, socket](){
         socketFactory_->addAcceptCB(
@@ -39,6 +51,9 @@ void ServerWorkerPool::threadStopped(
   CHECK(worker != workers_->end());
 
   for (auto socket : *sockets_) {
+    if (!acceptsFrom(worker->second.get(), socket)) {
+      continue;
+    }
     socket->getEventBase()->runImmediatelyOrRunInEventBaseThreadAndWait(
       [&]() {
         socketFactory_->removeAcceptCB(
@@ -11,10 +11,16 @@
 #pragma once
 
 #include <wangle/bootstrap/ServerBootstrap-inl.h>
+#include <wangle/bootstrap/ConnectionRebalancer.h>
+#include <wangle/bootstrap/SocketHandoff.h>
 #include <folly/Baton.h>
+#include <folly/ScopeGuard.h>
 #include <wangle/channel/Pipeline.h>
+#include <wangle/concurrent/AffinityThreadFactory.h>
+#include <wangle/ssl/SSLCertKeyCache.h>
 #include <iostream>
 #include <thread>
+#include <unistd.h>
 
 namespace wangle {
 
@@ -88,6 +94,50 @@ class ServerBootstrap {
     return this;
   }
 
+  /*
+   * Spread the default IO threads over the NUMA nodes, pinning each to its
+   * node's CPUs, and create each IO thread's acceptor on that thread so its
+   * memory is allocated on the same node. Must be called before group();
+   * an IO executor passed to group() should use an AffinityThreadFactory
+   * itself.
+   */
+  ServerBootstrap* numaAware(bool numaAware = true) {
+    numaAware_ = numaAware;
+    return this;
+  }
+
+  /*
+   * Shared nothing, one thread per core: a single pool of IO threads, each
+   * binding its own SO_REUSEPORT socket, and accepting and serving the
+   * connections the kernel hands it, so no connection crosses threads on
+   * the accept path. Each thread's acceptor keeps its own ConnectionManager
+   * and stats, as with the default groups. The default IO threads are each
+   * pinned to a CPU. Must be called before group(), which then uses the IO
+   * group to accept as well and ignores any accept group. IO threads
+   * added after bind() don't accept, and a Unix socket address is only
+   * accepted from by the thread that bound it.
+   */
+  ServerBootstrap* threadPerCore(bool threadPerCore = true) {
+    threadPerCore_ = threadPerCore;
+    return this;
+  }
+
+  /*
+   * Every options.period, move connections between messages off the IO
+   * threads holding many more than their share, see
+   * rebalanceConnections(). Connections otherwise stay on the thread that
+   * accepted them until they close, so long-lived ones can pile up on a few.
+   */
+  ServerBootstrap* connectionRebalancing(
+      ConnectionRebalancerOptions options = ConnectionRebalancerOptions()) {
+    rebalancing_ = true;
+    rebalancerOptions_ = options;
+    if (workerFactory_) {
+      startRebalancer();
+    }
+    return this;
+  }
+
   /*
    * Set the IO executor.  If not set, a default one will be created
    * with one thread per core.
@@ -111,6 +161,12 @@ class ServerBootstrap {
   ServerBootstrap* group(
       std::shared_ptr<wangle::IOThreadPoolExecutor> accept_group,
       std::shared_ptr<wangle::IOThreadPoolExecutor> io_group) {
+    if (threadPerCore_) {
+      if (!io_group) {
+        io_group = newThreadPerCoreGroup();
+      }
+      accept_group = io_group;
+    }
     if (!accept_group) {
       accept_group = std::make_shared<wangle::IOThreadPoolExecutor>(
         1, std::make_shared<wangle::NamedThreadFactory>("Acceptor Thread"));
@@ -121,24 +177,41 @@ class ServerBootstrap {
         // Reasonable mid-point for concurrency when actual value unknown
         threads = 8;
       }
+      std::shared_ptr<wangle::ThreadFactory> threadFactory =
+        std::make_shared<wangle::NamedThreadFactory>("IO Thread");
+      if (numaAware_) {
+        threadFactory = std::make_shared<wangle::AffinityThreadFactory>(
+          std::move(threadFactory),
+          wangle::AffinityThreadFactory::getNumaNodes());
+      }
       io_group = std::make_shared<wangle::IOThreadPoolExecutor>(
-        threads, std::make_shared<wangle::NamedThreadFactory>("IO Thread"));
+        threads, std::move(threadFactory));
     }
 
     // TODO better config checking
     // CHECK(acceptorFactory_ || childPipelineFactory_);
     CHECK(!(acceptorFactory_ && childPipelineFactory_));
 
+    // The acceptors, created from each IO thread below, then all find
+    // their certificates and keys parsed
+    auto certKeyCache = SSLCertKeyCache::getDefault();
+    if (accConfig_.isSSL() && certKeyCache) {
+      certKeyCache->preload(accConfig_.sslContextConfigs).wait();
+    }
+
     if (acceptorFactory_) {
       workerFactory_ = std::make_shared<ServerWorkerPool>(
-        acceptorFactory_, io_group.get(), sockets_, socketFactory_);
+        acceptorFactory_, io_group.get(), sockets_, socketFactory_,
+        numaAware_ || threadPerCore_, threadPerCore_);
     } else {
       workerFactory_ = std::make_shared<ServerWorkerPool>(
           std::make_shared<ServerAcceptorFactory<Pipeline>>(
               acceptPipelineFactory_, childPipelineFactory_, accConfig_),
           io_group.get(),
           sockets_,
-          socketFactory_);
+          socketFactory_,
+          numaAware_ || threadPerCore_,
+          threadPerCore_);
     }
 
     io_group->addObserver(workerFactory_);
@@ -146,6 +219,10 @@ class ServerBootstrap {
     acceptor_group_ = accept_group;
     io_group_ = io_group;
 
+    if (rebalancing_) {
+      startRebalancer();
+    }
+
     return this;
   }
 
@@ -173,13 +250,7 @@ class ServerBootstrap {
     }).get();
 
     // Startup all the threads
-    workerFactory_->forEachWorker([this, socket](Acceptor* worker){
-      socket->getEventBase()->runImmediatelyOrRunInEventBaseThreadAndWait(
-        [this, worker, socket](){
-          socketFactory_->addAcceptCB(socket, worker, worker->getEventBase());
-      });
-    });
-
+    addAcceptCallbacks({socket});
     sockets_->push_back(socket);
   }
 
@@ -207,63 +278,163 @@ class ServerBootstrap {
 
     bool reusePort = reusePort_ || (acceptor_group_->numThreads() > 1);
 
+    // With threadPerCore, one socket in each IO thread, rather than one per
+    // acceptor thread wherever the pool runs it
+    std::vector<folly::EventBase*> bases;
+    if (threadPerCore_ && address.isFamilyInet()) {
+      for (auto& worker : workerFactory_->getWorkers()) {
+        bases.push_back(worker->getEventBase());
+      }
+      reusePort = true;
+    }
+    const size_t numSockets =
+      bases.empty() ? acceptor_group_->numThreads() : bases.size();
+    auto start = [&](size_t i, folly::Func func) {
+      if (bases.empty()) {
+        acceptor_group_->add(std::move(func));
+      } else {
+        bases[i]->runInEventBaseThread(std::move(func));
+      }
+    };
+
     std::mutex sock_lock;
     std::vector<std::shared_ptr<folly::AsyncSocketBase>> new_sockets;
-
-
     std::exception_ptr exn;
 
-    auto startupFunc = [&](std::shared_ptr<folly::Baton<>> barrier) {
-
+    auto startupFunc = [&](std::shared_ptr<folly::Baton<>> barrier,
+                           bool first) {
       try {
         auto socket = socketFactory_->newSocket(
             address, socketConfig.acceptBacklog, reusePort, socketConfig);
-        sock_lock.lock();
+        if (first) {
+          // The port the others bind to, if it was 0
+          socket->getAddress(&address);
+        }
+        std::lock_guard<std::mutex> g(sock_lock);
         new_sockets.push_back(socket);
-        sock_lock.unlock();
-        socket->getAddress(&address);
-
-        barrier->post();
       } catch (...) {
+        std::lock_guard<std::mutex> g(sock_lock);
         exn = std::current_exception();
-        barrier->post();
-
-        return;
       }
-
+      barrier->post();
     };
 
-    auto wait0 = std::make_shared<folly::Baton<>>();
-    acceptor_group_->add(std::bind(startupFunc, wait0));
-    wait0->wait();
-
-    for (size_t i = 1; i < acceptor_group_->numThreads(); i++) {
+    // Only an ephemeral port needs the first socket bound ahead of the
+    // others; the rest are created concurrently, one per acceptor thread
+    size_t started = 0;
+    if (address.isFamilyInet() && address.getPort() == 0) {
       auto barrier = std::make_shared<folly::Baton<>>();
-      acceptor_group_->add(std::bind(startupFunc, barrier));
+      start(0, std::bind(startupFunc, barrier, true));
       barrier->wait();
+      started = 1;
+    }
+    if (!exn) {
+      std::vector<std::shared_ptr<folly::Baton<>>> barriers;
+      for (size_t i = started; i < numSockets; i++) {
+        barriers.push_back(std::make_shared<folly::Baton<>>());
+        start(i, std::bind(startupFunc, barriers.back(), false));
+      }
+      for (auto& barrier : barriers) {
+        barrier->wait();
+      }
     }
 
     if (exn) {
       std::rethrow_exception(exn);
     }
 
+    socketFactory_->finishBind(new_sockets);
+    addAcceptCallbacks(new_sockets);
     for (auto& socket : new_sockets) {
-      // Startup all the threads
-      workerFactory_->forEachWorker([this, socket](Acceptor* worker){
-        socket->getEventBase()->runImmediatelyOrRunInEventBaseThreadAndWait(
-          [this, worker, socket](){
-            socketFactory_->addAcceptCB(socket, worker, worker->getEventBase());
-        });
-      });
+      sockets_->push_back(socket);
+    }
+  }
+
+  /*
+   * Take over the listening sockets of a predecessor process calling
+   * handoff(path) instead of binding new ones, so no connection is refused
+   * across a restart. The predecessor stops accepting once all the sockets
+   * accept here. Throws if nothing is handing off at path, so the caller
+   * can bind() instead.
+   *
+   * @param data set to the predecessor's handoff data, if not null
+   */
+  void bindHandoff(const std::string& path, std::string* data = nullptr) {
+    if (!workerFactory_) {
+      group(nullptr);
+    }
+
+    std::vector<std::vector<int>> fds;
+    std::string handoffData;
+    auto connection = SocketHandoff::receive(path, fds, handoffData);
+
+    // Close the fds no AsyncServerSocket took on failure
+    size_t taken = 0;
+    auto guard = folly::makeGuard([&] {
+      for (size_t i = taken; i < fds.size(); i++) {
+        for (auto fd : fds[i]) {
+          ::close(fd);
+        }
+      }
+    });
+
+    // Spread over the acceptor threads, as bind() does
+    std::vector<std::shared_ptr<folly::AsyncSocketBase>> new_sockets;
+    for (; taken < fds.size(); taken++) {
+      auto& group = fds[taken];
+      folly::via(acceptor_group_.get(), [&] {
+        std::shared_ptr<folly::AsyncServerSocket> socket(
+          new folly::AsyncServerSocket(
+            folly::EventBaseManager::get()->getEventBase()),
+          AsyncServerSocketFactory::ThreadSafeDestructor());
+        socket->useExistingSockets(group);
+        socket->listen(socketConfig.acceptBacklog);
+        socket->startAccepting();
+        new_sockets.push_back(socket);
+      }).get();
+    }
+    guard.dismiss();
 
+    addAcceptCallbacks(new_sockets);
+    for (auto& socket : new_sockets) {
       sockets_->push_back(socket);
     }
+
+    SocketHandoff::acknowledge(connection);
+    if (data) {
+      *data = std::move(handoffData);
+    }
+  }
+
+  /*
+   * Hand the listening sockets, and data such as serialized TLS ticket
+   * seeds, to a successor process calling bindHandoff(path), then stop():
+   * the acceptors drain their connections while the successor accepts new
+   * ones on the same sockets. Start the successor once this is waiting.
+   * Throws, still accepting, if no successor takes the sockets within
+   * timeout. Only TCP sockets are handed off.
+   */
+  void handoff(
+      const std::string& path,
+      const std::string& data = std::string(),
+      std::chrono::milliseconds timeout = std::chrono::seconds(30)) {
+    std::vector<std::vector<int>> fds;
+    for (auto& socket : *sockets_) {
+      auto serverSocket =
+        std::dynamic_pointer_cast<folly::AsyncServerSocket>(socket);
+      if (serverSocket) {
+        fds.push_back(serverSocket->getSockets());
+      }
+    }
+    SocketHandoff::send(path, fds, data, timeout);
+    stop();
   }
 
   /*
    * Stop listening on all sockets.
    */
   void stop() {
+    rebalancer_.reset();
     // sockets_ may be null if ServerBootstrap has been std::move'd
     if (sockets_) {
       sockets_->clear();
@@ -305,11 +476,41 @@ class ServerBootstrap {
     return io_group_;
   }
 
+  /*
+   * The metrics of each IO thread, for an admin endpoint to poll: the
+   * connections, handshakes and bytes of this server and of anything else
+   * the IO group runs, e.g. clients sharing it. Empty before group().
+   */
+  std::vector<EventBaseMetrics::Snapshot> getEventBaseMetrics() const {
+    if (!io_group_) {
+      return {};
+    }
+    return io_group_->getEventBaseMetrics();
+  }
+
   template <typename F>
   void forEachWorker(F&& f) const {
     workerFactory_->forEachWorker(f);
   }
 
+  /*
+   * Move connections from the IO threads holding more than
+   * options.threshold times the mean number of connections to the ones
+   * holding fewer than the mean, with the pipeline and ManagedConnection of
+   * each. A connection only moves between messages, see
+   * AsyncSocketHandler::tryDetachEventBase() and options.canMove, and by
+   * default only while serving no request, so fewer than planned may.
+   * Only the acceptors of childPipeline() take part.
+   *
+   * The moves are done in the IO threads, without waiting for them.
+   */
+  void rebalanceConnections(
+      ConnectionRebalancerOptions options = ConnectionRebalancerOptions()) {
+    if (workerFactory_) {
+      rebalance(workerFactory_, options);
+    }
+  }
+
   ServerSocketConfig socketConfig;
 
   ServerBootstrap* setReusePort(bool reusePort) {
@@ -318,6 +519,102 @@ class ServerBootstrap {
   }
 
  private:
+  typedef ServerAcceptor<Pipeline> DefaultAcceptor;
+
+  // One IO thread pinned to each CPU
+  static std::shared_ptr<wangle::IOThreadPoolExecutor>
+  newThreadPerCoreGroup() {
+    size_t cpus = std::thread::hardware_concurrency();
+    if (cpus == 0) {
+      cpus = 8;
+    }
+    std::vector<std::vector<size_t>> cpuSets;
+    for (size_t cpu = 0; cpu < cpus; cpu++) {
+      cpuSets.push_back({cpu});
+    }
+    return std::make_shared<wangle::IOThreadPoolExecutor>(
+      cpus,
+      std::make_shared<wangle::AffinityThreadFactory>(
+        std::make_shared<wangle::NamedThreadFactory>("IO Thread"),
+        std::move(cpuSets)));
+  }
+
+  void startRebalancer() {
+    rebalancer_.reset();
+    // Not this, which a move would leave behind
+    auto workers = workerFactory_;
+    auto options = rebalancerOptions_;
+    rebalancer_ = folly::make_unique<ConnectionRebalancer>(
+        options.period, [workers, options] { rebalance(workers, options); });
+  }
+
+  static void rebalance(
+      const std::shared_ptr<ServerWorkerPool>& workerFactory,
+      const ConnectionRebalancerOptions& options) {
+    std::vector<std::shared_ptr<DefaultAcceptor>> acceptors;
+    std::vector<size_t> counts;
+    for (auto& worker : workerFactory->getWorkers()) {
+      auto acceptor = std::dynamic_pointer_cast<DefaultAcceptor>(worker);
+      if (acceptor) {
+        acceptors.push_back(acceptor);
+        counts.push_back(acceptor->getNumConnectionsAnyThread());
+      }
+    }
+
+    auto moves = ConnectionRebalancer::plan(
+        counts, options.threshold, options.maxMovesPerThread);
+    auto canMove = options.canMove;
+    for (auto& move : moves) {
+      auto from = acceptors[move.from];
+      auto to = acceptors[move.to];
+      auto count = move.count;
+      from->getEventBase()->runInEventBaseThread([from, to, count, canMove] {
+        auto conns = from->detachConnections(count, canMove);
+        if (conns.empty()) {
+          return;
+        }
+        // In neither thread until then, so nothing happens to them
+        to->getEventBase()->runInEventBaseThread([to, conns] {
+          to->adoptConnections(conns);
+        });
+      });
+    }
+  }
+
+  // Registers every worker with each socket, in the sockets' threads, all
+  // at once rather than one worker and socket at a time
+  void addAcceptCallbacks(
+      const std::vector<std::shared_ptr<folly::AsyncSocketBase>>& sockets) {
+    std::vector<Acceptor*> workers;
+    workerFactory_->forEachWorker([&](Acceptor* worker) {
+      workers.push_back(worker);
+    });
+
+    std::vector<std::shared_ptr<folly::Baton<>>> barriers;
+    for (auto& socket : sockets) {
+      auto barrier = std::make_shared<folly::Baton<>>();
+      barriers.push_back(barrier);
+      auto evb = socket->getEventBase();
+      auto addAll = [this, socket, workers, barrier]() {
+        for (auto worker : workers) {
+          if (workerFactory_->acceptsFrom(worker, socket)) {
+            socketFactory_->addAcceptCB(
+                socket, worker, worker->getEventBase());
+          }
+        }
+        barrier->post();
+      };
+      if (evb->isInEventBaseThread()) {
+        addAll();
+      } else {
+        evb->runInEventBaseThread(addAll);
+      }
+    }
+    for (auto& barrier : barriers) {
+      barrier->wait();
+    }
+  }
+
   std::shared_ptr<wangle::IOThreadPoolExecutor> acceptor_group_;
   std::shared_ptr<wangle::IOThreadPoolExecutor> io_group_;
 
@@ -335,6 +632,12 @@ class ServerBootstrap {
   ServerSocketConfig accConfig_;
 
   bool reusePort_{false};
+  bool numaAware_{false};
+  bool threadPerCore_{false};
+
+  bool rebalancing_{false};
+  ConnectionRebalancerOptions rebalancerOptions_;
+  std::unique_ptr<ConnectionRebalancer> rebalancer_;
 
   std::unique_ptr<folly::Baton<>> stopBaton_{
     folly::make_unique<folly::Baton<>>()};
@@ -14,6 +14,26 @@
 #include <folly/io/async/EventBaseManager.h>
 #include <folly/io/async/AsyncUDPServerSocket.h>
 #include <wangle/acceptor/Acceptor.h>
+#include <wangle/bootstrap/BatchedUDPServerSocket.h>
+#include <wangle/bootstrap/IoUringServerSocket.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <system_error>
+#include <vector>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/filter.h>
+#include <sched.h>
+#endif
 
 namespace wangle {
 
@@ -33,6 +53,11 @@ class ServerSocketFactory {
       Acceptor* callback,
       folly::EventBase* base) = 0 ;
 
+  // Called once every socket of one bind() is listening
+  virtual void finishBind(
+      const std::vector<std::shared_ptr<folly::AsyncSocketBase>>& /*socks*/) {
+  }
+
   virtual ~ServerSocketFactory() = default;
 };
 
@@ -47,9 +72,22 @@ class AsyncServerSocketFactory : public ServerSocketFactory {
         new folly::AsyncServerSocket(evb),
         ThreadSafeDestructor());
     socket->setReusePortEnabled(reuse);
-    socket->bind(address);
+    if (seqPacket_ && address.getFamily() == AF_UNIX) {
+      socket->useExistingSocket(newSeqPacketSocket(address));
+    } else {
+      socket->bind(address);
+    }
+    if (address.isFamilyInet()) {
+      for (auto fd : socket->getSockets()) {
+        setListenOptions(fd, config);
+      }
+    }
 
-    socket->listen(config.acceptBacklog);
+    if (cpuSteering_) {
+      listenOnThisCpu(socket, config.acceptBacklog);
+    } else {
+      socket->listen(config.acceptBacklog);
+    }
     socket->startAccepting();
 
     return socket;
@@ -59,6 +97,9 @@ class AsyncServerSocketFactory : public ServerSocketFactory {
                       Acceptor *callback, folly::EventBase* base) override {
     auto socket = std::dynamic_pointer_cast<folly::AsyncServerSocket>(s);
     CHECK(socket);
+    if (cpuSteering_ && base != socket->getEventBase()) {
+      return;
+    }
     socket->removeAcceptCallback(callback, base);
   }
 
@@ -66,9 +107,77 @@ class AsyncServerSocketFactory : public ServerSocketFactory {
                    Acceptor* callback, folly::EventBase* base) override {
     auto socket = std::dynamic_pointer_cast<folly::AsyncServerSocket>(s);
     CHECK(socket);
+    if (cpuSteering_ && base != socket->getEventBase()) {
+      return;
+    }
     socket->addAcceptCallback(callback, base);
   }
 
+  void finishBind(
+      const std::vector<std::shared_ptr<folly::AsyncSocketBase>>& socks)
+      override {
+    if (cpuSteering_ && !socks.empty()) {
+      attachSteering(socks.front());
+    }
+  }
+
+  /**
+   * Keeps each connection on the CPU that received it: with reuse port,
+   * the kernel hands it to the listening socket created on the thread
+   * pinned to that CPU (by an SO_ATTACH_REUSEPORT_CBPF program matching
+   * SO_INCOMING_CPU), and each socket only accepts for the Acceptor of its
+   * own thread, so interrupts, accept and processing all happen on one core.
+   *
+   * The accept and IO groups must be the same pool, with each thread pinned
+   * to a single CPU, e.g. by an AffinityThreadFactory with one CPU per set.
+   * Connections received on other CPUs are spread by hash as usual. Linux
+   * only; newSocket() throws if the kernel doesn't support it. Set before
+   * binding.
+   */
+  void setCpuSteering(bool enabled) {
+    cpuSteering_ = enabled;
+  }
+
+  /**
+   * Listen on Unix domain socket addresses with SOCK_SEQPACKET rather than
+   * SOCK_STREAM, so each write the peer makes arrives as one message, and
+   * each read returns at most one: a pipeline reading whole messages needs
+   * no framing decoder. A message longer than the read buffer is cut short,
+   * so the read buffer settings of the pipeline must cover the largest
+   * one. See ClientBootstrap::seqPacket(). Set before binding.
+   */
+  void setSeqPacket(bool enabled) {
+    seqPacket_ = enabled;
+  }
+
+  /**
+   * Applies the TCP listen options of config, such as TCP Fast Open, to
+   * the listening socket fd. Best effort: connections are accepted either
+   * way.
+   */
+  static void setListenOptions(int fd, const ServerSocketConfig& config) {
+#ifdef TCP_FASTOPEN
+    if (config.fastOpenQueueSize > 0) {
+      int qlen = config.fastOpenQueueSize;
+      if (setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN,
+                     &qlen, sizeof(qlen)) != 0) {
+        LOG(WARNING) << "Failed to enable TCP Fast Open: "
+                     << strerror(errno);
+      }
+    }
+#endif
+#ifdef TCP_DEFER_ACCEPT
+    if (config.deferAcceptTimeout.count() > 0) {
+      int secs = config.deferAcceptTimeout.count();
+      if (setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+                     &secs, sizeof(secs)) != 0) {
+        LOG(WARNING) << "Failed to set TCP_DEFER_ACCEPT: "
+                     << strerror(errno);
+      }
+    }
+#endif
+  }
+
   class ThreadSafeDestructor {
    public:
     void operator()(folly::AsyncServerSocket* socket) const {
@@ -82,6 +191,156 @@ class AsyncServerSocketFactory : public ServerSocketFactory {
       }
     }
   };
+
+ private:
+  static int newSeqPacketSocket(const folly::SocketAddress& address) {
+    int fd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      throw std::system_error(errno, std::system_category(),
+                              "failed to create SOCK_SEQPACKET socket");
+    }
+    sockaddr_storage addr;
+    auto len = address.getAddress(&addr);
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), len) != 0) {
+      int err = errno;
+      ::close(fd);
+      throw std::system_error(err, std::system_category(),
+                              "failed to bind to " + address.describe());
+    }
+    return fd;
+  }
+
+  // Sockets of a reuse port group are numbered in the order they started
+  // listening, so the listen() and the record of its position (with the CPU
+  // of the socket's thread) happen together, even with concurrent binds.
+  void listenOnThisCpu(
+      const std::shared_ptr<folly::AsyncServerSocket>& socket, int backlog) {
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+    cpu_set_t affinity;
+    if (sched_getaffinity(0, sizeof(affinity), &affinity) != 0 ||
+        CPU_COUNT(&affinity) != 1) {
+      LOG(WARNING) << "Steering connections to a thread that isn't pinned "
+                   << "to a single CPU";
+    }
+    const int cpu = sched_getcpu();
+    if (cpu < 0) {
+      throw std::system_error(errno, std::system_category(), "sched_getcpu");
+    }
+    folly::SocketAddress bound;
+    socket->getAddress(&bound);
+
+    std::lock_guard<std::mutex> g(steeringMutex_);
+    auto& group = steeringGroups_[bound];
+    // Sockets of an earlier bind() that have since been closed
+    group.erase(std::remove_if(group.begin(), group.end(), [] (
+        const std::pair<std::weak_ptr<folly::AsyncServerSocket>, int>& s) {
+      return s.first.expired();
+    }), group.end());
+    socket->listen(backlog);
+    group.emplace_back(socket, cpu);
+#else
+    throw std::runtime_error("CPU steering is not supported on this platform");
+#endif
+  }
+
+  // Attached once the whole group is listening: the program applies to
+  // every socket of the group, whichever one it is set on.
+  void attachSteering(const std::shared_ptr<folly::AsyncSocketBase>& sock) {
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+    auto socket = std::dynamic_pointer_cast<folly::AsyncServerSocket>(sock);
+    CHECK(socket);
+    folly::SocketAddress bound;
+    socket->getAddress(&bound);
+
+    std::lock_guard<std::mutex> g(steeringMutex_);
+    auto& group = steeringGroups_[bound];
+    std::vector<sock_filter> code;
+    code.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS,
+                            uint32_t(SKF_AD_OFF + SKF_AD_CPU)));
+    for (uint32_t i = 0; i < group.size(); i++) {
+      code.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,
+                              uint32_t(group[i].second), 0, 1));
+      code.push_back(BPF_STMT(BPF_RET | BPF_K, i));
+    }
+    // Out of range, so the kernel falls back to hashing
+    code.push_back(BPF_STMT(BPF_RET | BPF_K, uint32_t(group.size())));
+    sock_fprog prog;
+    prog.len = code.size();
+    prog.filter = code.data();
+    if (setsockopt(socket->getSocket(), SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                   &prog, sizeof(prog)) != 0) {
+      throw std::system_error(errno, std::system_category(),
+                              "failed to attach reuse port CPU steering");
+    }
+#endif
+  }
+
+  bool cpuSteering_{false};
+  bool seqPacket_{false};
+  std::mutex steeringMutex_;
+  std::map<folly::SocketAddress,
+           std::vector<std::pair<std::weak_ptr<folly::AsyncServerSocket>, int>>>
+    steeringGroups_;
+};
+
+/**
+ * Listens with IoUringServerSocket, accepting through io_uring rather than
+ * with one accept() call per connection. The connections are regular
+ * AsyncSockets, so pipelines work unchanged. TCP only; Linux 5.5 and
+ * later, newSocket() throws where io_uring isn't available, see
+ * IoUring::isSupported().
+ */
+class IoUringServerSocketFactory : public ServerSocketFactory {
+ public:
+  std::shared_ptr<folly::AsyncSocketBase> newSocket(
+      folly::SocketAddress address, int /*backlog*/, bool reuse,
+      ServerSocketConfig& config) override {
+    auto* evb = folly::EventBaseManager::get()->getEventBase();
+    std::shared_ptr<IoUringServerSocket> socket(
+        new IoUringServerSocket(evb, acceptDepth_),
+        ThreadSafeDestructor());
+    socket->setReusePort(reuse);
+    socket->bind(address);
+    if (address.isFamilyInet()) {
+      AsyncServerSocketFactory::setListenOptions(socket->getSocket(), config);
+    }
+    socket->listen(config.acceptBacklog);
+    socket->startAccepting();
+    return socket;
+  }
+
+  void removeAcceptCB(std::shared_ptr<folly::AsyncSocketBase> s,
+                      Acceptor* callback,
+                      folly::EventBase* /*base*/) override {
+    auto socket = std::dynamic_pointer_cast<IoUringServerSocket>(s);
+    CHECK(socket);
+    socket->removeAcceptCallback(callback);
+  }
+
+  void addAcceptCB(std::shared_ptr<folly::AsyncSocketBase> s,
+                   Acceptor* callback, folly::EventBase* base) override {
+    auto socket = std::dynamic_pointer_cast<IoUringServerSocket>(s);
+    CHECK(socket);
+    socket->addAcceptCallback(callback, base);
+  }
+
+  // Accepts kept queued in the kernel per listening socket
+  void setAcceptDepth(size_t depth) {
+    acceptDepth_ = depth;
+  }
+
+  class ThreadSafeDestructor {
+   public:
+    void operator()(IoUringServerSocket* socket) const {
+      socket->getEventBase()->runImmediatelyOrRunInEventBaseThreadAndWait(
+        [socket]() {
+          delete socket;
+        });
+    }
+  };
+
+ private:
+  size_t acceptDepth_{32};
 };
 
 class AsyncUDPServerSocketFactory : public ServerSocketFactory {
@@ -91,6 +350,17 @@ class AsyncUDPServerSocketFactory : public ServerSocketFactory {
       ServerSocketConfig& /*config*/) override {
 
     folly::EventBase* evb = folly::EventBaseManager::get()->getEventBase();
+    if (batchSize_ > 1 || gro_) {
+      std::shared_ptr<BatchedUDPServerSocket> socket(
+          new BatchedUDPServerSocket(evb, batchSize_, maxPacketSize_),
+          ThreadSafeDestructor());
+      socket->setReusePort(reuse);
+      socket->setGro(gro_);
+      socket->bind(address);
+      socket->listen();
+      return socket;
+    }
+
     std::shared_ptr<folly::AsyncUDPServerSocket> socket(
         new folly::AsyncUDPServerSocket(evb),
         ThreadSafeDestructor());
@@ -108,14 +378,34 @@ class AsyncUDPServerSocketFactory : public ServerSocketFactory {
 
   void addAcceptCB(std::shared_ptr<folly::AsyncSocketBase> s,
                    Acceptor* callback, folly::EventBase* base) override {
+    if (auto batched = std::dynamic_pointer_cast<BatchedUDPServerSocket>(s)) {
+      batched->addListener(base, callback);
+      return;
+    }
     auto socket = std::dynamic_pointer_cast<folly::AsyncUDPServerSocket>(s);
     DCHECK(socket);
     socket->addListener(base, callback);
   }
 
+  /**
+   * Read up to batchSize datagrams of up to maxPacketSize bytes per wakeup,
+   * and hand each batch to an acceptor at once; see BatchedUDPServerSocket.
+   * 1, the default, reads and hands them over one at a time.
+   */
+  void setBatchSize(size_t batchSize, size_t maxPacketSize = 1500) {
+    batchSize_ = batchSize;
+    maxPacketSize_ = maxPacketSize;
+  }
+
+  // Let the kernel coalesce datagrams of a flow (UDP_GRO); implies batching
+  void setGro(bool gro) {
+    gro_ = gro;
+  }
+
   class ThreadSafeDestructor {
    public:
-    void operator()(folly::AsyncUDPServerSocket* socket) const {
+    template <class Socket>
+    void operator()(Socket* socket) const {
       socket->getEventBase()->runImmediatelyOrRunInEventBaseThreadAndWait(
         [socket]() {
           delete socket;
@@ -123,6 +413,11 @@ class AsyncUDPServerSocketFactory : public ServerSocketFactory {
       );
     }
   };
+
+ private:
+  size_t batchSize_{1};
+  size_t maxPacketSize_{1500};
+  bool gro_{false};
 };
 
 } // namespace wangle
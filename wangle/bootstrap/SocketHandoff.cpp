@@ -0,0 +1,235 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/bootstrap/SocketHandoff.h>
+
+#include <folly/Exception.h>
+#include <folly/ScopeGuard.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using folly::File;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+
+namespace {
+
+// The first byte of each message; SOCK_SEQPACKET keeps them apart
+const char kSocketMessage = 'S';
+const char kDataMessage = 'D';
+const char kAck = 'A';
+
+sockaddr_un makeAddress(const std::string& path) {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+    throw std::invalid_argument("bad handoff socket path: " + path);
+  }
+  memcpy(addr.sun_path, path.data(), path.size());
+  return addr;
+}
+
+File newSocket() {
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    folly::throwSystemError("handoff socket() failed");
+  }
+  return File(fd, true);
+}
+
+void waitReadable(int fd, steady_clock::time_point deadline) {
+  while (true) {
+    auto left = std::chrono::duration_cast<milliseconds>(
+        deadline - steady_clock::now());
+    pollfd pfd = {fd, POLLIN, 0};
+    int ret = poll(&pfd, 1, std::max<int64_t>(0, left.count()));
+    if (ret > 0) {
+      return;
+    }
+    if (ret == 0) {
+      throw std::runtime_error("socket handoff timed out");
+    }
+    if (errno != EINTR) {
+      folly::throwSystemError("handoff poll() failed");
+    }
+  }
+}
+
+void sendMessage(int fd, char type, const std::string& payload,
+                 const std::vector<int>& fds) {
+  if (fds.size() > wangle::SocketHandoff::kMaxFds) {
+    throw std::invalid_argument("too many fds to hand off");
+  }
+  std::string buf(1, type);
+  buf += payload;
+  iovec iov = {&buf[0], buf.size()};
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  std::vector<char> control(CMSG_SPACE(sizeof(int) * fds.size()));
+  if (!fds.empty()) {
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+    memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+  }
+  ssize_t ret;
+  do {
+    ret = sendmsg(fd, &msg, MSG_NOSIGNAL);
+  } while (ret < 0 && errno == EINTR);
+  if (ret < 0) {
+    folly::throwSystemError("handoff sendmsg() failed");
+  }
+}
+
+// An empty payload when the peer is gone
+void recvMessage(int fd, std::string& payload, std::vector<int>& fds) {
+  payload.resize(wangle::SocketHandoff::kMaxDataSize + 1);
+  iovec iov = {&payload[0], payload.size()};
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  std::vector<char> control(
+      CMSG_SPACE(sizeof(int) * wangle::SocketHandoff::kMaxFds));
+  msg.msg_control = control.data();
+  msg.msg_controllen = control.size();
+  ssize_t ret;
+  do {
+    ret = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+  } while (ret < 0 && errno == EINTR);
+  if (ret < 0) {
+    folly::throwSystemError("handoff recvmsg() failed");
+  }
+  payload.resize(ret);
+
+  for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      auto n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      auto first = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+      fds.insert(fds.end(), first, first + n);
+    }
+  }
+  if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+    throw std::runtime_error("socket handoff message truncated");
+  }
+}
+
+} // namespace
+
+namespace wangle {
+
+constexpr size_t SocketHandoff::kMaxDataSize;
+constexpr size_t SocketHandoff::kMaxFds;
+
+void SocketHandoff::send(
+    const std::string& path,
+    const std::vector<std::vector<int>>& sockets,
+    const std::string& data,
+    milliseconds timeout) {
+  if (data.size() > kMaxDataSize) {
+    throw std::invalid_argument("socket handoff data too large");
+  }
+  auto addr = makeAddress(path);
+  auto listener = newSocket();
+  unlink(path.c_str());
+  if (bind(listener.fd(), reinterpret_cast<sockaddr*>(&addr),
+           sizeof(addr)) < 0) {
+    folly::throwSystemError("handoff bind() to ", path, " failed");
+  }
+  SCOPE_EXIT {
+    unlink(path.c_str());
+  };
+  if (listen(listener.fd(), 1) < 0) {
+    folly::throwSystemError("handoff listen() failed");
+  }
+
+  waitReadable(listener.fd(), steady_clock::now() + timeout);
+  int fd = accept4(listener.fd(), nullptr, nullptr, SOCK_CLOEXEC);
+  if (fd < 0) {
+    folly::throwSystemError("handoff accept() failed");
+  }
+  File connection(fd, true);
+
+  for (const auto& fds : sockets) {
+    sendMessage(connection.fd(), kSocketMessage, "", fds);
+  }
+  sendMessage(connection.fd(), kDataMessage, data, {});
+
+  waitReadable(connection.fd(), steady_clock::now() + timeout);
+  char ack = 0;
+  if (recv(connection.fd(), &ack, 1, 0) != 1 || ack != kAck) {
+    throw std::runtime_error("successor did not take the sockets");
+  }
+}
+
+File SocketHandoff::receive(
+    const std::string& path,
+    std::vector<std::vector<int>>& sockets,
+    std::string& data) {
+  auto addr = makeAddress(path);
+  auto connection = newSocket();
+  if (connect(connection.fd(), reinterpret_cast<sockaddr*>(&addr),
+              sizeof(addr)) < 0) {
+    folly::throwSystemError("handoff connect() to ", path, " failed");
+  }
+
+  std::vector<std::vector<int>> received;
+  auto guard = folly::makeGuard([&] {
+    for (const auto& fds : received) {
+      for (auto fd : fds) {
+        close(fd);
+      }
+    }
+  });
+  while (true) {
+    std::string payload;
+    received.emplace_back();
+    recvMessage(connection.fd(), payload, received.back());
+    if (payload.empty()) {
+      throw std::runtime_error("predecessor closed the socket handoff");
+    }
+    if (payload[0] == kSocketMessage) {
+      continue;
+    }
+    if (payload[0] == kDataMessage) {
+      // Not expecting any fds with it
+      for (auto fd : received.back()) {
+        close(fd);
+      }
+      received.pop_back();
+      data = payload.substr(1);
+      break;
+    }
+    throw std::runtime_error("bad socket handoff message");
+  }
+
+  guard.dismiss();
+  sockets.insert(sockets.end(), received.begin(), received.end());
+  return connection;
+}
+
+void SocketHandoff::acknowledge(const File& connection) {
+  sendMessage(connection.fd(), kAck, "", {});
+}
+
+} // namespace wangle
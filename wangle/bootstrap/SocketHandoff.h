@@ -0,0 +1,63 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/File.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace wangle {
+
+/**
+ * Passes listening sockets from a process to its successor over a Unix
+ * domain socket (SCM_RIGHTS), so a restart never stops accepting: the
+ * kernel keeps queueing connections on the same sockets throughout.
+ * See ServerBootstrap::handoff() and ServerBootstrap::bindHandoff().
+ *
+ * Each socket is a group of fds, as AsyncServerSocket::getSockets() returns
+ * them. data is opaque, e.g. serialized TLS ticket seeds, so the successor
+ * can resume the sessions of its predecessor. Errors throw.
+ */
+class SocketHandoff {
+ public:
+  /**
+   * Waits up to timeout for the successor to connect at path, sends it
+   * sockets and data, then waits, up to timeout again, for it to
+   * acknowledge that it is accepting on them.
+   */
+  static void send(
+      const std::string& path,
+      const std::vector<std::vector<int>>& sockets,
+      const std::string& data,
+      std::chrono::milliseconds timeout);
+
+  /**
+   * Connects to the predecessor at path and receives its sockets and data.
+   * The fds received are the caller's to close. Throws at once if nothing
+   * is handing off at path, so the caller can bind normally instead.
+   *
+   * @return the connection to acknowledge() on
+   */
+  static folly::File receive(
+      const std::string& path,
+      std::vector<std::vector<int>>& sockets,
+      std::string& data);
+
+  // Tells the predecessor the successor accepts on the sockets received
+  static void acknowledge(const folly::File& connection);
+
+  // Of data, and of fds per socket
+  static constexpr size_t kMaxDataSize = 64 * 1024;
+  static constexpr size_t kMaxFds = 64;
+};
+
+} // namespace wangle
@@ -0,0 +1,71 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/bootstrap/WorkerSelector.h>
+
+#include <glog/logging.h>
+
+#include <cmath>
+
+namespace wangle {
+
+size_t ConsistentHashWorkerSelector::jumpConsistentHash(
+    uint64_t key, size_t numBuckets) {
+  int64_t b = -1;
+  int64_t j = 0;
+  while (j < int64_t(numBuckets)) {
+    b = j;
+    key = key * 2862933555777941757ULL + 1;
+    j = (b + 1) * (double(1LL << 31) / double((key >> 33) + 1));
+  }
+  return b;
+}
+
+BoundedLoadWorkerSelector::BoundedLoadWorkerSelector(
+    double loadFactor, size_t maxWorkers)
+  : loadFactor_(loadFactor),
+    maxWorkers_(maxWorkers),
+    counts_(new std::atomic<uint64_t>[maxWorkers]) {
+  CHECK_GE(loadFactor_, 1.0);
+  for (size_t i = 0; i < maxWorkers_; i++) {
+    counts_[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+size_t BoundedLoadWorkerSelector::select(uint64_t hash, size_t numWorkers) {
+  CHECK_LE(numWorkers, maxWorkers_);
+  uint64_t total = 0;
+  for (size_t i = 0; i < numWorkers; i++) {
+    total += counts_[i].load(std::memory_order_relaxed);
+  }
+  // Counting the connection being placed, so there always is room
+  auto capacity = uint64_t(
+      std::ceil(loadFactor_ * double(total + 1) / double(numWorkers)));
+
+  auto first = ConsistentHashWorkerSelector::jumpConsistentHash(
+      hash, numWorkers);
+  auto worker = first;
+  for (size_t i = 0; i < numWorkers; i++) {
+    auto candidate = (first + i) % numWorkers;
+    if (counts_[candidate].load(std::memory_order_relaxed) < capacity) {
+      worker = candidate;
+      break;
+    }
+  }
+  counts_[worker].fetch_add(1, std::memory_order_relaxed);
+  return worker;
+}
+
+void BoundedLoadWorkerSelector::onConnectionRemoved(size_t worker) {
+  DCHECK_LT(worker, maxWorkers_);
+  auto count = counts_[worker].fetch_sub(1, std::memory_order_relaxed);
+  DCHECK_GT(count, 0);
+}
+
+} // namespace wangle
@@ -0,0 +1,84 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace wangle {
+
+/**
+ * Picks the worker a connection is routed to by AcceptRoutingHandler, from
+ * the hash of its routing data. Shared by the acceptor threads, so must be
+ * thread safe.
+ */
+class WorkerSelector {
+ public:
+  virtual ~WorkerSelector() {}
+
+  // Returns a worker in [0, numWorkers)
+  virtual size_t select(uint64_t hash, size_t numWorkers) = 0;
+
+  // Called once for each connection select() routed to worker, as it closes
+  virtual void onConnectionRemoved(size_t /*worker*/) {}
+};
+
+/**
+ * hash % numWorkers. Changing the number of workers moves almost every key.
+ */
+class ModuloWorkerSelector : public WorkerSelector {
+ public:
+  size_t select(uint64_t hash, size_t numWorkers) override {
+    return hash % numWorkers;
+  }
+};
+
+/**
+ * Jump consistent hash (Lamping and Veach): going from n to n + 1 workers
+ * only moves 1/(n + 1) of the keys, all of them to the new worker.
+ */
+class ConsistentHashWorkerSelector : public WorkerSelector {
+ public:
+  size_t select(uint64_t hash, size_t numWorkers) override {
+    return jumpConsistentHash(hash, numWorkers);
+  }
+
+  static size_t jumpConsistentHash(uint64_t key, size_t numBuckets);
+};
+
+/**
+ * Consistent hashing with bounded loads: a key goes to its consistent hash
+ * worker unless that one already has more than loadFactor times the mean
+ * number of connections, in which case it spills to the next worker that
+ * does not. A hot key thus cannot overload a single event loop, while most
+ * keys still stay put as the number of workers changes.
+ */
+class BoundedLoadWorkerSelector : public WorkerSelector {
+ public:
+  explicit BoundedLoadWorkerSelector(
+      double loadFactor = 1.25,
+      size_t maxWorkers = 256);
+
+  size_t select(uint64_t hash, size_t numWorkers) override;
+  void onConnectionRemoved(size_t worker) override;
+
+  uint64_t getNumConnections(size_t worker) const {
+    return counts_[worker].load(std::memory_order_relaxed);
+  }
+
+ private:
+  const double loadFactor_;
+  const size_t maxWorkers_;
+  std::unique_ptr<std::atomic<uint64_t>[]> counts_;
+};
+
+} // namespace wangle
@@ -0,0 +1,72 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/bootstrap/WorkerSelector.h>
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+using namespace wangle;
+
+TEST(WorkerSelector, ConsistentHashMovesFewKeys) {
+  ConsistentHashWorkerSelector selector;
+  const size_t kKeys = 10000;
+  size_t moved = 0;
+  for (uint64_t key = 0; key < kKeys; key++) {
+    auto before = selector.select(key, 10);
+    auto after = selector.select(key, 11);
+    EXPECT_LT(before, 10);
+    EXPECT_LT(after, 11);
+    if (before != after) {
+      // Only ever to the new worker
+      EXPECT_EQ(10, after);
+      moved++;
+    }
+  }
+  // About 1/11 of the keys
+  EXPECT_GT(moved, kKeys / 20);
+  EXPECT_LT(moved, kKeys / 7);
+}
+
+TEST(WorkerSelector, ConsistentHashSpreadsKeys) {
+  ConsistentHashWorkerSelector selector;
+  std::vector<size_t> counts(8);
+  for (uint64_t key = 0; key < 8000; key++) {
+    counts[selector.select(key, counts.size())]++;
+  }
+  for (auto count : counts) {
+    EXPECT_GT(count, 800);
+    EXPECT_LT(count, 1200);
+  }
+}
+
+TEST(WorkerSelector, BoundedLoadSpillsHotKey) {
+  BoundedLoadWorkerSelector selector(1.5, 4);
+  const uint64_t kHotKey = 42;
+  auto home = ConsistentHashWorkerSelector::jumpConsistentHash(kHotKey, 4);
+  std::vector<size_t> workers;
+  for (int i = 0; i < 100; i++) {
+    workers.push_back(selector.select(kHotKey, 4));
+  }
+  EXPECT_EQ(home, workers[0]);
+  for (size_t worker = 0; worker < 4; worker++) {
+    // ceil(1.5 * 100 / 4)
+    EXPECT_LE(selector.getNumConnections(worker), 38);
+  }
+
+  // Back home once its connections close
+  for (size_t i = 0; i < workers.size(); i++) {
+    selector.onConnectionRemoved(workers[i]);
+  }
+  for (size_t worker = 0; worker < 4; worker++) {
+    EXPECT_EQ(0, selector.getNumConnections(worker));
+  }
+  EXPECT_EQ(home, selector.select(kHotKey, 4));
+}
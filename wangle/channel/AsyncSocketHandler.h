@@ -11,9 +11,15 @@
 #pragma once
 
 #include <wangle/channel/Handler.h>
+#include <wangle/channel/ReadBufferPool.h>
+#include <wangle/concurrent/EventBaseMetrics.h>
+#include <wangle/concurrent/RequestTrace.h>
+#include <wangle/ssl/SSLUtil.h>
 #include <folly/io/async/AsyncSocket.h>
+#include <folly/io/async/AsyncTimeout.h>
 #include <folly/io/async/EventBase.h>
 #include <folly/io/async/EventBaseManager.h>
+#include <folly/io/Cursor.h>
 #include <folly/io/IOBuf.h>
 #include <folly/io/IOBufQueue.h>
 
@@ -28,17 +34,48 @@ class AsyncSocketHandler
       std::shared_ptr<folly::AsyncTransportWrapper> socket)
     : socket_(std::move(socket)) {}
 
-  AsyncSocketHandler(AsyncSocketHandler&&) = default;
+  AsyncSocketHandler(AsyncSocketHandler&& other)
+    : bufQueue_(std::move(other.bufQueue_)),
+      writeTracker_(std::move(other.writeTracker_)),
+      socket_(std::move(other.socket_)),
+      firedInactive_(other.firedInactive_),
+      pipelineDeleted_(other.pipelineDeleted_),
+      pauseReadsWhileUnwritable_(other.pauseReadsWhileUnwritable_),
+      readsPausedForWrite_(other.readsPausedForWrite_),
+      readsPausedByPipeline_(other.readsPausedByPipeline_),
+      readsWanted_(other.readsWanted_),
+      queuedBytes_(other.queuedBytes_),
+      bufferCharge_(other.bufferCharge_),
+      pauseReadsOverBufferLimit_(other.pauseReadsOverBufferLimit_),
+      readsPausedForBufferLimit_(other.readsPausedForBufferLimit_),
+      bufferLimitPoll_(std::move(other.bufferLimitPoll_)),
+      readStats_(other.readStats_),
+      readAllocation_(other.readAllocation_),
+      lastReadBufferLength_(other.lastReadBufferLength_),
+      hintedRead_(other.hintedRead_),
+      shortReads_(other.shortReads_),
+      zeroCopyThreshold_(other.zeroCopyThreshold_),
+      releaseIdleBuffers_(other.releaseIdleBuffers_) {
+    if (writeTracker_) {
+      writeTracker_->handler_ = this;
+    }
+    if (bufferLimitPoll_) {
+      bufferLimitPoll_->handler_ = this;
+    }
+    other.bufferCharge_ = 0;
+  }
 
   ~AsyncSocketHandler() {
     detachReadCallback();
   }
 
   void attachReadCallback() {
-    socket_->setReadCB(socket_->good() ? this : nullptr);
+    readsWanted_ = true;
+    updateReadCallback();
   }
 
   void detachReadCallback() {
+    readsWanted_ = false;
     if (socket_ && socket_->getReadCallback() == this) {
       socket_->setReadCB(nullptr);
     }
@@ -49,6 +86,73 @@ class AsyncSocketHandler
     }
   }
 
+  // Stop reading from the socket while the pipeline is over its high write
+  // watermark (see PipelineBase::setWriteBufferWatermarks), so that a peer
+  // which doesn't read its responses can't make us buffer without bound.
+  void setPauseReadsWhileUnwritable(bool pause) {
+    pauseReadsWhileUnwritable_ = pause;
+  }
+
+  struct ReadStats {
+    uint64_t reads{0};
+    uint64_t bytes{0};
+    // Reads that filled the whole buffer they were given
+    uint64_t fullReads{0};
+  };
+
+  const ReadStats& getReadStats() const {
+    return readStats_;
+  }
+
+  // Current allocation size when adaptive read buffers are enabled, 0 if not
+  uint64_t getReadAllocationSize() const {
+    return readAllocation_;
+  }
+
+  // After each read, copy what the handlers left of a message out of the
+  // read buffer into one of its size, so that a connection waiting for the
+  // rest of it, possibly for a long time, doesn't hold a whole read buffer.
+  // With SSL_MODE_RELEASE_BUFFERS, which SSLContextManager sets, an idle
+  // TLS connection then holds no buffer but that small one.
+  void setReleaseIdleBuffers(bool release) {
+    releaseIdleBuffers_ = release;
+  }
+
+  // Stop reading from the socket after a read that finds the pipeline's
+  // BufferAccounting over its limit, until it's back under; on by default
+  void setPauseReadsOverBufferLimit(bool pause) {
+    pauseReadsOverBufferLimit_ = pause;
+  }
+
+  // Bytes of the buffers held for the connection: read buffers, and
+  // OpenSSL's record buffers for a TLS socket. Not the socket nor the
+  // pipeline themselves, nor writes queued in the socket.
+  size_t getBufferMemoryUsage() const {
+    size_t bytes = readBufferCapacity();
+    auto sslSocket = dynamic_cast<const folly::AsyncSSLSocket*>(socket_.get());
+    if (sslSocket) {
+      bytes += SSLUtil::getRecordBufferSize(sslSocket->getSSL());
+    }
+    return bytes;
+  }
+
+  // Opt-in zero-copy sends (MSG_ZEROCOPY): writes of at least threshold
+  // bytes are handed to the kernel without copying and smaller ones are
+  // copied as usual. The Future of a zero-copy write() is only fulfilled once
+  // the kernel reports it is done with the buffers. Returns false, leaving
+  // zero copy off, if the socket doesn't support it. 0 turns it off.
+  bool setZeroCopyThreshold(size_t threshold) {
+#if FOLLY_HAVE_MSG_ERRQUEUE
+    auto sock = dynamic_cast<folly::AsyncSocket*>(socket_.get());
+    if (sock && sock->setZeroCopy(threshold > 0)) {
+      zeroCopyThreshold_ = threshold;
+      return true;
+    }
+#endif
+    zeroCopyThreshold_ = 0;
+    return threshold == 0;
+  }
+
   void attachEventBase(folly::EventBase* eventBase) {
     if (eventBase && !socket_->getEventBase()) {
       socket_->attachEventBase(eventBase);
@@ -57,11 +161,87 @@ class AsyncSocketHandler
 
   void detachEventBase() {
     detachReadCallback();
+    stopBufferLimitPoll();
     if (socket_->getEventBase()) {
       socket_->detachEventBase();
     }
   }
 
+  // Like detachEventBase(), but the transport stays active for the pipeline
+  // to carry on in another thread once reattachEventBase() is called there.
+  // Only done between messages: fails, changing nothing, while a write is
+  // queued, zero copy buffers may still be in the kernel's hands, or a
+  // message is half read.
+  bool tryDetachEventBase() {
+    if (!socket_ || !socket_->good() || !socket_->getEventBase() ||
+        (writeTracker_ && writeTracker_->pending_ > 0) ||
+        zeroCopyThreshold_ > 0 || !bufQueue_.empty() ||
+        readsPausedForBufferLimit_) {
+      return false;
+    }
+    auto readCallback = socket_->getReadCallback();
+    socket_->setReadCB(nullptr);
+    if (!socket_->isDetachable()) {
+      socket_->setReadCB(readCallback);
+      return false;
+    }
+    socket_->detachEventBase();
+    return true;
+  }
+
+  void reattachEventBase(folly::EventBase* eventBase) {
+    DCHECK(!socket_->getEventBase());
+    socket_->attachEventBase(eventBase);
+    updateReadCallback();
+  }
+
+  // Drops the socket and per-connection state so that the pipeline can be
+  // recycled; a new socket must be given through setSocket() before the
+  // pipeline is reused.
+  bool reset() override {
+    if (socket_ && socket_->getReadCallback() == this) {
+      socket_->setReadCB(nullptr);
+    }
+    socket_.reset();
+    writeTracker_.reset();
+    bufQueue_.move();
+    stopBufferLimitPoll();
+    releaseBufferCharge();
+    firedInactive_ = false;
+    pipelineDeleted_ = false;
+    readsPausedForWrite_ = false;
+    readsPausedByPipeline_ = false;
+    readsWanted_ = false;
+    queuedBytes_ = 0;
+    readStats_ = ReadStats();
+    readAllocation_ = 0;
+    lastReadBufferLength_ = 0;
+    hintedRead_ = false;
+    shortReads_ = 0;
+    return true;
+  }
+
+  void setSocket(std::shared_ptr<folly::AsyncTransportWrapper> socket) {
+    DCHECK(!socket_);
+    socket_ = std::move(socket);
+    if (zeroCopyThreshold_ > 0) {
+      setZeroCopyThreshold(zeroCopyThreshold_);
+    }
+  }
+
+  // Passes on bytes read from the socket before this handler took it over,
+  // e.g. by AcceptSteeringHandler, as if it had read them itself, so that
+  // what the decoders leave of them is ahead of the next read
+  void readPrefetched(std::unique_ptr<folly::IOBuf> buf) {
+    auto ctx = getContext();
+    if (!ctx || !buf || buf->computeChainDataLength() == 0) {
+      return;
+    }
+    PipelineGuard guard(ctx);
+    bufQueue_.append(std::move(buf));
+    ctx->fireRead(bufQueue_);
+  }
+
   void transportActive(Context* ctx) override {
     ctx->getPipeline()->setTransport(socket_);
     attachReadCallback();
@@ -76,8 +256,20 @@ class AsyncSocketHandler
     ctx->getPipeline()->setTransport(nullptr);
   }
 
+  void attachPipeline(Context* ctx) override {
+    auto pipeline = ctx->getPipeline();
+    readsPausedByPipeline_ = pipeline->isReadPaused();
+    pipeline->setReadPauseCallback([this](bool paused) {
+      readsPausedByPipeline_ = paused;
+      updateReadCallback();
+    });
+  }
+
   void detachPipeline(Context* ctx) override {
     detachReadCallback();
+    stopBufferLimitPoll();
+    releaseBufferCharge();
+    ctx->getPipeline()->setReadPauseCallback(nullptr);
   }
 
   folly::Future<folly::Unit> write(
@@ -95,12 +287,44 @@ class AsyncSocketHandler
           "socket is closed in write()"));
     }
 
-    auto cb = new WriteCallback();
+    auto tracker = getWriteTracker(ctx);
+    if (useZeroCopy(*buf)) {
+      auto cb = new ZeroCopyWriteCallback(tracker, std::move(buf));
+      auto future = cb->promise_.getFuture();
+      writeChain(ctx, cb, cb->borrowBuffers(), zeroCopyWriteFlags());
+      return future;
+    }
+    auto cb = new WriteCallback(tracker);
     auto future = cb->promise_.getFuture();
-    socket_->writeChain(cb, std::move(buf), ctx->getWriteFlags());
+    writeChain(ctx, cb, std::move(buf));
     return future;
   };
 
+  void writeNoFuture(
+      Context* ctx,
+      std::unique_ptr<folly::IOBuf> buf) override {
+    refreshTimeout();
+    if (UNLIKELY(!buf)) {
+      return;
+    }
+
+    if (!socket_->good()) {
+      VLOG(5) << "socket is closed in writeNoFuture()";
+      ctx->getPipeline()->notifyWriteError(
+          folly::make_exception_wrapper<folly::AsyncSocketException>(
+              folly::AsyncSocketException::AsyncSocketExceptionType::NOT_OPEN,
+              "socket is closed in writeNoFuture()"));
+      return;
+    }
+
+    // The tracker doubles as the callback shared by every future-less write.
+    // Zero-copy buffers are kept alive by the socket, as there is no Future
+    // to hold back.
+    auto flags = useZeroCopy(*buf) ? zeroCopyWriteFlags()
+                                   : folly::WriteFlags::NONE;
+    writeChain(ctx, getWriteTracker(ctx), std::move(buf), flags);
+  }
+
   folly::Future<folly::Unit> writeException(Context* ctx,
                                             folly::exception_wrapper) override {
     return shutdown(ctx, true);
@@ -124,10 +348,40 @@ class AsyncSocketHandler
   }
 
   void getReadBuffer(void** bufReturn, size_t* lenReturn) override {
-    const auto readBufferSettings = getContext()->getReadBufferSettings();
-    const auto ret = bufQueue_.preallocate(
-        readBufferSettings.first,
-        readBufferSettings.second);
+    auto ctx = getContext();
+    const auto readBufferSettings = ctx->getReadBufferSettings();
+    const auto limits = ctx->getPipeline()->getAdaptiveReadBufferLimits();
+    if (limits.second == 0) {
+      readAllocation_ = 0;
+    } else if (readAllocation_ == 0) {
+      readAllocation_ = std::min(
+          std::max(readBufferSettings.second, limits.first), limits.second);
+    }
+
+    std::pair<void*, uint64_t> ret;
+    const auto hint = readHint(ctx, readBufferSettings, limits);
+    hintedRead_ = hint > 0;
+    if (hintedRead_) {
+      // Read the rest of a partially received frame at once
+      ret = bufQueue_.preallocate(hint, hint, hint);
+    } else if (readAllocation_ == 0) {
+      auto pool = ctx->getPipeline()->getReadBufferPool();
+      if (pool && pool->getBufferSize() >= readBufferSettings.first &&
+          bufQueue_.tailroom() < readBufferSettings.first) {
+        bufQueue_.append(pool->get(), false);
+      }
+      ret = bufQueue_.preallocate(
+          readBufferSettings.first,
+          readBufferSettings.second);
+    } else {
+      // Cap the read at the current allocation so that a full read means
+      // the allocation is too small
+      ret = bufQueue_.preallocate(
+          std::min(readBufferSettings.first, readAllocation_),
+          readAllocation_,
+          readAllocation_);
+    }
+    lastReadBufferLength_ = ret.second;
     *bufReturn = ret.first;
     *lenReturn = ret.second;
   }
@@ -135,7 +389,36 @@ class AsyncSocketHandler
   void readDataAvailable(size_t len) noexcept override {
     refreshTimeout();
     bufQueue_.postallocate(len);
-    getContext()->fireRead(bufQueue_);
+    readStats_.reads++;
+    readStats_.bytes += len;
+    if (auto metrics = EventBaseMetrics::local()) {
+      metrics->addBytesRead(len);
+    }
+    if (len >= lastReadBufferLength_) {
+      readStats_.fullReads++;
+    }
+
+    auto ctx = getContext();
+    auto& accounting = ctx->getPipeline()->getBufferAccount().getAccounting();
+    const bool account = accounting.isEnabled();
+    if (readAllocation_ == 0 && !releaseIdleBuffers_ && !account) {
+      ctx->fireRead(bufQueue_);
+      return;
+    }
+
+    if (readAllocation_ > 0 && !hintedRead_) {
+      adjustReadAllocation(ctx, len);
+    }
+    // Keep the pipeline (and so this handler) alive to tidy up after the read
+    PipelineGuard guard(ctx);
+    ctx->fireRead(bufQueue_);
+    compactReadBuffer(ctx);
+    if (account && getContext()) {
+      updateBufferCharge();
+      if (pauseReadsOverBufferLimit_ && accounting.isOverLimit()) {
+        pauseReadsForBufferLimit();
+      }
+    }
   }
 
   void readEOF() noexcept override {
@@ -149,6 +432,99 @@ class AsyncSocketHandler
   }
 
  private:
+  // Reads while the transport is active, unless they are paused by the
+  // pipeline or for being over the write watermark
+  void updateReadCallback() {
+    if (!socket_) {
+      return;
+    }
+    const bool read = readsWanted_ && socket_->good() &&
+      !readsPausedForWrite_ && !readsPausedByPipeline_ &&
+      !readsPausedForBufferLimit_;
+    if (read != (socket_->getReadCallback() == this)) {
+      socket_->setReadCB(read ? this : nullptr);
+    }
+  }
+
+  // Charges the pipeline's buffer account with what was read but not
+  // consumed yet, and what was written but is still queued in the socket
+  void updateBufferCharge() {
+    auto ctx = getContext();
+    if (!ctx) {
+      return;
+    }
+    auto& account = ctx->getPipeline()->getBufferAccount();
+    if (bufferCharge_ == 0 && !account.getAccounting().isEnabled()) {
+      return;
+    }
+    uint64_t bytes = bufQueue_.chainLength();
+    if (socket_ && socket_->good()) {
+      const uint64_t written = socket_->getAppBytesWritten();
+      if (queuedBytes_ > written) {
+        bytes += queuedBytes_ - written;
+      }
+    }
+    account.add(int64_t(bytes) - int64_t(bufferCharge_));
+    bufferCharge_ = bytes;
+  }
+
+  void releaseBufferCharge() {
+    auto ctx = getContext();
+    if (ctx && bufferCharge_ > 0) {
+      ctx->getPipeline()->getBufferAccount().add(-int64_t(bufferCharge_));
+    }
+    bufferCharge_ = 0;
+  }
+
+  // Polls the accounting until it's back under its limit, as whatever
+  // brings it there happens on other connections
+  class BufferLimitPoll : public folly::AsyncTimeout {
+   public:
+    BufferLimitPoll(AsyncSocketHandler* handler, folly::EventBase* evb)
+      : folly::AsyncTimeout(evb), handler_(handler) {}
+
+    void timeoutExpired() noexcept override {
+      handler_->pollBufferLimit();
+    }
+
+   private:
+    friend class AsyncSocketHandler;
+
+    AsyncSocketHandler* handler_;
+  };
+
+  // Milliseconds
+  static constexpr uint32_t kBufferLimitPollInterval = 10;
+
+  void pauseReadsForBufferLimit() {
+    if (readsPausedForBufferLimit_ || !socket_->getEventBase()) {
+      return;
+    }
+    readsPausedForBufferLimit_ = true;
+    updateReadCallback();
+    if (!bufferLimitPoll_) {
+      bufferLimitPoll_.reset(
+          new BufferLimitPoll(this, socket_->getEventBase()));
+    }
+    bufferLimitPoll_->scheduleTimeout(kBufferLimitPollInterval);
+  }
+
+  void pollBufferLimit() {
+    auto ctx = getContext();
+    if (ctx && ctx->getPipeline()->getBufferAccount()
+                   .getAccounting().isOverLimit()) {
+      bufferLimitPoll_->scheduleTimeout(kBufferLimitPollInterval);
+      return;
+    }
+    readsPausedForBufferLimit_ = false;
+    updateReadCallback();
+  }
+
+  void stopBufferLimitPoll() {
+    bufferLimitPoll_.reset();
+    readsPausedForBufferLimit_ = false;
+  }
+
   void refreshTimeout() {
     auto manager = getContext()->getPipeline()->getPipelineManager();
     if (manager) {
@@ -156,6 +532,172 @@ class AsyncSocketHandler
     }
   }
 
+  // The read size the decoder asked for through setReadBytesNeeded(), if
+  // it is more than a regular read would get, or 0
+  uint64_t readHint(
+      Context* ctx,
+      std::pair<uint64_t, uint64_t> readBufferSettings,
+      std::pair<uint64_t, uint64_t> limits) {
+    const uint64_t regular =
+      readAllocation_ > 0 ? readAllocation_ : readBufferSettings.second;
+    const uint64_t cap = limits.second > 0 ? limits.second : 65536;
+    const uint64_t hint =
+      std::min(ctx->getPipeline()->getReadBytesNeeded(), cap);
+    return hint > regular ? hint : 0;
+  }
+
+  // Double the allocation after a read that filled its buffer, halve it after
+  // two reads in a row that used less than half of it.
+  void adjustReadAllocation(Context* ctx, size_t len) {
+    const auto limits = ctx->getPipeline()->getAdaptiveReadBufferLimits();
+    if (len >= lastReadBufferLength_) {
+      shortReads_ = 0;
+      readAllocation_ = std::min(readAllocation_ * 2, limits.second);
+    } else if (len < readAllocation_ / 2) {
+      if (++shortReads_ >= 2) {
+        shortReads_ = 0;
+        readAllocation_ = std::max(readAllocation_ / 2, limits.first);
+      }
+    } else {
+      shortReads_ = 0;
+    }
+  }
+
+  // A small partial frame left behind by the handlers would otherwise pin a
+  // whole, possibly large, read buffer until the rest of it arrives, which
+  // on idle connections may be never. Copy it out into a right-sized buffer.
+  void compactReadBuffer(Context* ctx) {
+    const auto front = bufQueue_.front();
+    if (!front) {
+      return;
+    }
+    if (releaseIdleBuffers_) {
+      const auto len = bufQueue_.chainLength();
+      if (len == 0) {
+        bufQueue_.move();
+      } else if (2 * len < readBufferCapacity()) {
+        copyOutReadBuffer(len);
+      }
+      return;
+    }
+    if (front->isChained()) {
+      return;
+    }
+    const auto minAllocation =
+      ctx->getPipeline()->getAdaptiveReadBufferLimits().first;
+    const auto len = front->length();
+    if (len >= minAllocation || front->capacity() < 2 * minAllocation) {
+      return;
+    }
+    copyOutReadBuffer(len);
+  }
+
+  size_t readBufferCapacity() const {
+    size_t bytes = 0;
+    if (auto front = bufQueue_.front()) {
+      auto buf = front;
+      do {
+        bytes += buf->capacity();
+        buf = buf->next();
+      } while (buf != front);
+    }
+    return bytes;
+  }
+
+  void copyOutReadBuffer(size_t len) {
+    auto rest = bufQueue_.move();
+    auto copy = folly::IOBuf::create(len);
+    folly::io::Cursor(rest.get()).pull(copy->writableData(), len);
+    copy->append(len);
+    bufQueue_.append(std::move(copy));
+  }
+
+  class WriteTracker;
+
+  WriteTracker* getWriteTracker(Context* ctx) {
+    if (!writeTracker_) {
+      writeTracker_.reset(new WriteTracker(this, ctx->getPipelineShared()));
+    }
+    return writeTracker_.get();
+  }
+
+  bool useZeroCopy(const folly::IOBuf& buf) const {
+    return zeroCopyThreshold_ > 0 &&
+      buf.computeChainDataLength() >= zeroCopyThreshold_;
+  }
+
+  static folly::WriteFlags zeroCopyWriteFlags() {
+#if FOLLY_HAVE_MSG_ERRQUEUE
+    return folly::WriteFlags::WRITE_MSG_ZEROCOPY;
+#else
+    return folly::WriteFlags::NONE;
+#endif
+  }
+
+  void writeChain(
+      Context* ctx,
+      folly::AsyncTransportWrapper::WriteCallback* cb,
+      std::unique_ptr<folly::IOBuf> buf,
+      folly::WriteFlags extraFlags = folly::WriteFlags::NONE) {
+    RequestTrace::record("socket write");
+    auto pipeline = ctx->getPipeline();
+    const bool trackBytes = pipeline->getWriteBufferWatermarks().second > 0;
+    const bool account =
+      pipeline->getBufferAccount().getAccounting().isEnabled();
+    auto metrics = EventBaseMetrics::local();
+    if (trackBytes || account || metrics) {
+      const auto len = buf->computeChainDataLength();
+      if (trackBytes || account) {
+        queuedBytes_ = std::max<uint64_t>(
+            queuedBytes_, socket_->getAppBytesWritten()) + len;
+      }
+      if (metrics) {
+        metrics->addBytesWritten(len);
+      }
+    }
+    writeTracker_->writeStarted();
+    socket_->writeChain(cb, std::move(buf), ctx->getWriteFlags() | extraFlags);
+    if (trackBytes) {
+      updateWritability();
+    }
+    if (account) {
+      updateBufferCharge();
+    }
+  }
+
+  // Compares the bytes handed to the socket but not yet written to the kernel
+  // against the pipeline's watermarks, and fires writabilityChanged() when
+  // crossing them.
+  void updateWritability() {
+    auto ctx = getContext();
+    if (!ctx) {
+      return;
+    }
+    auto pipeline = ctx->getPipeline();
+    const auto watermarks = pipeline->getWriteBufferWatermarks();
+    bool writable;
+    if (watermarks.second == 0 || !socket_) {
+      writable = true;
+    } else {
+      const uint64_t written = socket_->getAppBytesWritten();
+      const uint64_t pending = queuedBytes_ > written
+        ? queuedBytes_ - written : 0;
+      writable = pipeline->isWritable()
+        ? pending <= watermarks.second
+        : pending <= watermarks.first;
+    }
+    if (writable == pipeline->isWritable()) {
+      return;
+    }
+
+    pipeline->setWritable(writable);
+    if (pauseReadsWhileUnwritable_) {
+      readsPausedForWrite_ = !writable;
+      updateReadCallback();
+    }
+    ctx->fireWritabilityChanged(writable);
+  }
+
   folly::Future<folly::Unit> shutdown(Context* ctx, bool closeWithReset) {
     if (socket_) {
       detachReadCallback();
@@ -172,9 +714,77 @@ class AsyncSocketHandler
     return folly::makeFuture();
   }
 
+  // Shared by all writes of this handler. It counts the writes still queued
+  // in the socket, reports their completions back to the handler, and serves
+  // as the write callback for future-less writes, reporting their errors to
+  // the pipeline. It may outlive the handler while writes are still queued,
+  // in which case it deletes itself once the last of them completes.
+  class WriteTracker : private folly::AsyncTransportWrapper::WriteCallback {
+   public:
+    WriteTracker(
+        AsyncSocketHandler* handler,
+        std::weak_ptr<PipelineBase> pipeline)
+      : handler_(handler), pipeline_(std::move(pipeline)) {}
+
+    // Called when the owning handler goes away
+    void release() {
+      handler_ = nullptr;
+      if (pending_ == 0) {
+        delete this;
+      }
+    }
+
+    void writeStarted() {
+      pending_++;
+    }
+
+    void writeFinished() {
+      DCHECK_GT(pending_, 0);
+      if (handler_) {
+        handler_->updateWritability();
+        handler_->updateBufferCharge();
+      }
+      if (--pending_ == 0 && !handler_) {
+        delete this;
+      }
+    }
+
+    void writeSuccess() noexcept override {
+      writeFinished();
+    }
+
+    void writeErr(size_t /* bytesWritten */,
+                  const folly::AsyncSocketException& ex)
+      noexcept override {
+      auto pipeline = pipeline_.lock();
+      if (pipeline) {
+        pipeline->notifyWriteError(
+            folly::make_exception_wrapper<folly::AsyncSocketException>(ex));
+      }
+      writeFinished();
+    }
+
+   private:
+    friend class AsyncSocketHandler;
+
+    AsyncSocketHandler* handler_;
+    std::weak_ptr<PipelineBase> pipeline_;
+    size_t pending_{0};
+  };
+
+  struct WriteTrackerDeleter {
+    void operator()(WriteTracker* tracker) const {
+      tracker->release();
+    }
+  };
+
   class WriteCallback : private folly::AsyncTransportWrapper::WriteCallback {
+   public:
+    explicit WriteCallback(WriteTracker* tracker) : tracker_(tracker) {}
+
     void writeSuccess() noexcept override {
       promise_.setValue();
+      tracker_->writeFinished();
       delete this;
     }
 
@@ -182,18 +792,121 @@ class AsyncSocketHandler
                   const folly::AsyncSocketException& ex)
       noexcept override {
       promise_.setException(ex);
+      tracker_->writeFinished();
       delete this;
     }
 
    private:
     friend class AsyncSocketHandler;
+    WriteTracker* tracker_;
+    folly::Promise<folly::Unit> promise_;
+  };
+
+  // Callback for zero-copy write()s. The socket is given IOBufs that point
+  // into the original buffers without owning them; once it has released all
+  // of them the kernel is done with the data, and the Future is fulfilled if
+  // the write succeeded.
+  class ZeroCopyWriteCallback
+    : private folly::AsyncTransportWrapper::WriteCallback {
+   public:
+    ZeroCopyWriteCallback(
+        WriteTracker* tracker,
+        std::unique_ptr<folly::IOBuf> buf)
+      : tracker_(tracker), buf_(std::move(buf)) {}
+
+    std::unique_ptr<folly::IOBuf> borrowBuffers() {
+      std::unique_ptr<folly::IOBuf> chain;
+      auto current = buf_.get();
+      do {
+        if (current->length() > 0) {
+          // Counted first as takeOwnership() releases it if it throws
+          borrowed_++;
+          auto borrowed = folly::IOBuf::takeOwnership(
+              const_cast<uint8_t*>(current->data()),
+              current->length(),
+              &ZeroCopyWriteCallback::bufferReleased,
+              this);
+          if (chain) {
+            chain->prependChain(std::move(borrowed));
+          } else {
+            chain = std::move(borrowed);
+          }
+        }
+        current = current->next();
+      } while (current != buf_.get());
+      return chain;
+    }
+
+    void writeSuccess() noexcept override {
+      written_ = true;
+      tracker_->writeFinished();
+      maybeFinish();
+    }
+
+    void writeErr(size_t bytesWritten,
+                  const folly::AsyncSocketException& ex)
+      noexcept override {
+      promise_.setException(ex);
+      written_ = true;
+      failed_ = true;
+      tracker_->writeFinished();
+      maybeFinish();
+    }
+
+   private:
+    friend class AsyncSocketHandler;
+
+    static void bufferReleased(void* /*buf*/, void* userData) {
+      auto self = static_cast<ZeroCopyWriteCallback*>(userData);
+      DCHECK_GT(self->borrowed_, 0);
+      self->borrowed_--;
+      self->maybeFinish();
+    }
+
+    void maybeFinish() {
+      if (written_ && borrowed_ == 0) {
+        if (!failed_) {
+          promise_.setValue();
+        }
+        delete this;
+      }
+    }
+
+    WriteTracker* tracker_;
+    std::unique_ptr<folly::IOBuf> buf_;
+    size_t borrowed_{0};
+    bool written_{false};
+    bool failed_{false};
     folly::Promise<folly::Unit> promise_;
   };
 
   folly::IOBufQueue bufQueue_{folly::IOBufQueue::cacheChainLength()};
+  std::unique_ptr<WriteTracker, WriteTrackerDeleter> writeTracker_;
   std::shared_ptr<folly::AsyncTransportWrapper> socket_{nullptr};
   bool firedInactive_{false};
   bool pipelineDeleted_{false};
+  bool pauseReadsWhileUnwritable_{false};
+  bool readsPausedForWrite_{false};
+  bool readsPausedByPipeline_{false};
+  // Between transportActive() and the transport going inactive
+  bool readsWanted_{false};
+  // Value of socket_->getAppBytesWritten() once everything we were asked to
+  // write has been written; only maintained when watermarks are set or
+  // buffers are accounted
+  uint64_t queuedBytes_{0};
+  // What updateBufferCharge() last added to the pipeline's buffer account
+  uint64_t bufferCharge_{0};
+  bool pauseReadsOverBufferLimit_{true};
+  bool readsPausedForBufferLimit_{false};
+  std::unique_ptr<BufferLimitPoll> bufferLimitPoll_;
+  ReadStats readStats_;
+  uint64_t readAllocation_{0};
+  uint64_t lastReadBufferLength_{0};
+  // Whether the last read buffer was sized from the decoder's hint
+  bool hintedRead_{false};
+  uint32_t shortReads_{0};
+  size_t zeroCopyThreshold_{0};
+  bool releaseIdleBuffers_{false};
 };
 
 } // namespace wangle
@@ -0,0 +1,76 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/BufferAccounting.h>
+
+#include <algorithm>
+
+namespace wangle {
+
+constexpr int64_t BufferAccounting::kBatchBytes;
+
+BufferAccounting& BufferAccounting::get() {
+  // Leaked, as connections may be torn down during static destruction
+  static auto accounting = new BufferAccounting();
+  return *accounting;
+}
+
+BufferAccounting::BufferAccounting(size_t numShards)
+  : shards_(std::max<size_t>(numShards, 1)) {}
+
+BufferAccounting::Shard& BufferAccounting::shard() {
+  static std::atomic<size_t> nextThread{0};
+  static thread_local size_t thread = nextThread++;
+  return shards_[thread % shards_.size()];
+}
+
+void BufferAccounting::add(int64_t bytes) {
+  auto& s = shard();
+  const auto pending =
+    s.bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  const auto batch = batchBytes_.load(std::memory_order_relaxed);
+  if (pending >= batch || pending <= -batch) {
+    const auto moved = s.bytes.exchange(0, std::memory_order_relaxed);
+    updateOverLimit(
+        total_.fetch_add(moved, std::memory_order_relaxed) + moved);
+  }
+}
+
+uint64_t BufferAccounting::getBytes() const {
+  int64_t total = total_.load(std::memory_order_relaxed);
+  for (const auto& s : shards_) {
+    total += s.bytes.load(std::memory_order_relaxed);
+  }
+  return total > 0 ? uint64_t(total) : 0;
+}
+
+void BufferAccounting::setLimit(uint64_t bytes) {
+  limit_.store(bytes, std::memory_order_relaxed);
+  int64_t batch = kBatchBytes;
+  if (bytes > 0) {
+    batch = std::max<int64_t>(
+        std::min<int64_t>(batch, bytes / (2 * shards_.size())), 1);
+  }
+  batchBytes_.store(batch, std::memory_order_relaxed);
+  updateOverLimit(int64_t(getBytes()));
+}
+
+void BufferAccounting::updateOverLimit(int64_t total) {
+  const auto limit = int64_t(limit_.load(std::memory_order_relaxed));
+  if (limit == 0) {
+    overLimit_.store(false, std::memory_order_relaxed);
+  } else if (total > limit) {
+    overLimit_.store(true, std::memory_order_relaxed);
+  } else if (total <= limit - limit / 8) {
+    overLimit_.store(false, std::memory_order_relaxed);
+  }
+}
+
+} // namespace wangle
@@ -0,0 +1,128 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/detail/CacheLocality.h>
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace wangle {
+
+/*
+ * Counts the bytes connections hold buffered, process-wide: what
+ * AsyncSocketHandler read but the decoders haven't consumed yet, the
+ * writes it queued in the socket, and what OutputBufferingHandler holds
+ * until its next flush. Each pipeline counts its own in an Account (see
+ * PipelineBase::getBufferAccount()). Counting is off, sparing connections
+ * its cost, until it's enabled or a limit is set.
+ *
+ * With a limit set, isOverLimit() turns true once the total goes over it,
+ * and false again once it's back under seven eighths of it. Meanwhile
+ * AsyncSocketHandlers stop reading after each read, until it clears, and
+ * acceptors with ServerSocketConfig::bufferLimitShedBatchSize set drop
+ * idle connections.
+ *
+ * Threads add to a shard each, moved to the total once it reaches
+ * kBatchBytes, or less with a low limit, so that isOverLimit() lags behind
+ * the buffers by at most half the limit.
+ */
+class BufferAccounting {
+ public:
+  static constexpr int64_t kBatchBytes = 64 * 1024;
+
+  // The process-wide accounting
+  static BufferAccounting& get();
+
+  explicit BufferAccounting(size_t numShards = 64);
+
+  BufferAccounting(const BufferAccounting&) = delete;
+  BufferAccounting& operator=(const BufferAccounting&) = delete;
+
+  void add(int64_t bytes);
+
+  // Sums the shards, so exact but slower than isOverLimit()
+  uint64_t getBytes() const;
+
+  void setEnabled(bool enabled) {
+    enabled_.store(enabled, std::memory_order_relaxed);
+  }
+
+  bool isEnabled() const {
+    return enabled_.load(std::memory_order_relaxed) ||
+      limit_.load(std::memory_order_relaxed) > 0;
+  }
+
+  // 0, the default, means no limit
+  void setLimit(uint64_t bytes);
+
+  uint64_t getLimit() const {
+    return limit_.load(std::memory_order_relaxed);
+  }
+
+  bool isOverLimit() const {
+    return overLimit_.load(std::memory_order_relaxed);
+  }
+
+  // The bytes one connection holds buffered, also counted in its
+  // accounting. Not thread safe, like the pipeline it belongs to.
+  class Account {
+   public:
+    explicit Account(BufferAccounting& accounting = BufferAccounting::get())
+      : accounting_(&accounting) {}
+
+    ~Account() {
+      add(-bytes_);
+    }
+
+    Account(const Account&) = delete;
+    Account& operator=(const Account&) = delete;
+
+    void add(int64_t bytes) {
+      if (bytes != 0) {
+        bytes_ += bytes;
+        accounting_->add(bytes);
+      }
+    }
+
+    uint64_t getBytes() const {
+      return uint64_t(bytes_);
+    }
+
+    BufferAccounting& getAccounting() const {
+      return *accounting_;
+    }
+
+   private:
+    BufferAccounting* accounting_;
+    int64_t bytes_{0};
+  };
+
+ private:
+  struct FOLLY_ALIGN_TO_AVOID_FALSE_SHARING Shard {
+    // Not yet moved to total_
+    std::atomic<int64_t> bytes{0};
+  };
+
+  Shard& shard();
+
+  void updateOverLimit(int64_t total);
+
+  std::vector<Shard> shards_;
+  std::atomic<int64_t> total_{0};
+  std::atomic<int64_t> batchBytes_{kBatchBytes};
+  std::atomic<bool> enabled_{false};
+  std::atomic<uint64_t> limit_{0};
+  std::atomic<bool> overLimit_{false};
+};
+
+} // namespace wangle
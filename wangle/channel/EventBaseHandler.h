@@ -10,17 +10,63 @@
 
 #pragma once
 
+#include <wangle/channel/Handler.h>
+#include <folly/futures/Promise.h>
+#include <folly/io/async/AsyncSocketException.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
 namespace wangle {
 
+// Lets a pipeline be written to and closed from any thread, by running the
+// writes and closes of other threads on the transport's EventBase.
+//
+// By default the writing thread waits for the EventBase to run its write.
+// Queued, it doesn't: writes and closes from other threads are pushed on a
+// lock-free queue, which the EventBase drains once per loop, coalescing the
+// writes queued in between into one so that the socket sends them in one
+// writev(). Their Futures are completed on the EventBase, once that write
+// is.
 class EventBaseHandler : public OutboundBytesToBytesHandler {
  public:
+  explicit EventBaseHandler(bool queued = false) : queued_(queued) {}
+
+  EventBaseHandler(EventBaseHandler&& other) noexcept
+    : queued_(other.queued_) {
+    DCHECK(!other.queue_.load());
+  }
+
+  ~EventBaseHandler() {
+    // Left if the EventBase went away without draining them
+    auto op = queue_.exchange(nullptr);
+    while (op) {
+      auto next = op->next;
+      op->promise.setException(folly::AsyncSocketException(
+          folly::AsyncSocketException::NOT_OPEN,
+          "EventBase destroyed before the write ran"));
+      delete op;
+      op = next;
+    }
+  }
+
   folly::Future<folly::Unit> write(
       Context* ctx,
       std::unique_ptr<folly::IOBuf> buf) override {
     folly::Future<folly::Unit> retval;
     DCHECK(ctx->getTransport());
     DCHECK(ctx->getTransport()->getEventBase());
-    ctx->getTransport()->getEventBase()->runImmediatelyOrRunInEventBaseThreadAndWait([&](){
+    auto evb = ctx->getTransport()->getEventBase();
+    if (queued_) {
+      if (!evb->isInEventBaseThread()) {
+        return enqueue(ctx, evb, std::move(buf), false);
+      }
+      // After what other threads queued before
+      drain(ctx);
+      return ctx->fireWrite(std::move(buf));
+    }
+    evb->runImmediatelyOrRunInEventBaseThreadAndWait([&](){
         retval = ctx->fireWrite(std::move(buf));
     });
     return retval;
@@ -29,12 +75,115 @@ class EventBaseHandler : public OutboundBytesToBytesHandler {
   folly::Future<folly::Unit> close(Context* ctx) override {
     DCHECK(ctx->getTransport());
     DCHECK(ctx->getTransport()->getEventBase());
+    auto evb = ctx->getTransport()->getEventBase();
+    if (queued_) {
+      if (!evb->isInEventBaseThread()) {
+        return enqueue(ctx, evb, nullptr, true);
+      }
+      drain(ctx);
+      return ctx->fireClose();
+    }
     folly::Future<folly::Unit> retval;
-    ctx->getTransport()->getEventBase()->runImmediatelyOrRunInEventBaseThreadAndWait([&](){
+    evb->runImmediatelyOrRunInEventBaseThreadAndWait([&](){
         retval = ctx->fireClose();
     });
     return retval;
   }
+
+ private:
+  // A write, or a close, queued by another thread
+  struct Op {
+    std::unique_ptr<folly::IOBuf> buf;
+    bool close;
+    folly::Promise<folly::Unit> promise;
+    Op* next;
+  };
+
+  typedef std::vector<folly::Promise<folly::Unit>> Promises;
+
+  folly::Future<folly::Unit> enqueue(
+      Context* ctx,
+      folly::EventBase* evb,
+      std::unique_ptr<folly::IOBuf> buf,
+      bool close) {
+    auto op = new Op();
+    op->buf = std::move(buf);
+    op->close = close;
+    auto future = op->promise.getFuture();
+    op->next = queue_.load(std::memory_order_relaxed);
+    while (!queue_.compare_exchange_weak(op->next, op,
+                                         std::memory_order_release,
+                                         std::memory_order_relaxed)) {
+    }
+    if (!op->next) {
+      // First since the last drain. The pipeline, and so this handler, is
+      // kept until it's drained.
+      auto pipeline = ctx->getPipelineShared();
+      evb->runInEventBaseThread([this, ctx, pipeline](){
+          drain(ctx);
+      });
+    }
+    return future;
+  }
+
+  // On the EventBase
+  void drain(Context* ctx) {
+    auto head = queue_.exchange(nullptr, std::memory_order_acquire);
+    if (!head) {
+      return;
+    }
+    // Pushed last first
+    std::vector<Op*> ops;
+    for (auto op = head; op; op = op->next) {
+      ops.push_back(op);
+    }
+    std::unique_ptr<folly::IOBuf> chain;
+    auto promises = std::make_shared<Promises>();
+    for (auto it = ops.rbegin(); it != ops.rend(); ++it) {
+      std::unique_ptr<Op> op(*it);
+      if (op->close) {
+        flush(ctx, std::move(chain), std::move(promises));
+        promises = std::make_shared<Promises>();
+        promises->push_back(std::move(op->promise));
+        complete(ctx->fireClose(), std::move(promises));
+        promises = std::make_shared<Promises>();
+        continue;
+      }
+      if (op->buf) {
+        if (chain) {
+          chain->prependChain(std::move(op->buf));
+        } else {
+          chain = std::move(op->buf);
+        }
+      }
+      promises->push_back(std::move(op->promise));
+    }
+    flush(ctx, std::move(chain), std::move(promises));
+  }
+
+  // Writes chain, completing the Futures of the writes in it with its own
+  static void flush(Context* ctx,
+                    std::unique_ptr<folly::IOBuf> chain,
+                    std::shared_ptr<Promises> promises) {
+    if (promises->empty()) {
+      return;
+    }
+    complete(chain ? ctx->fireWrite(std::move(chain)) : folly::makeFuture(),
+             std::move(promises));
+  }
+
+  static void complete(folly::Future<folly::Unit> future,
+                       std::shared_ptr<Promises> promises) {
+    future.then([promises](folly::Try<folly::Unit>&& t) {
+      for (auto& promise : *promises) {
+        promise.setTry(folly::Try<folly::Unit>(t));
+      }
+    });
+  }
+
+  const bool queued_;
+  // Most recently queued first
+  std::atomic<Op*> queue_{nullptr};
 };
 
 } // namespace
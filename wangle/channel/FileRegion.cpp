@@ -11,6 +11,12 @@
 #include <wangle/channel/FileRegion.h>
 
 #ifdef SPLICE_F_NONBLOCK
+#include <folly/MoveWrapper.h>
+#include <folly/io/async/AsyncSSLSocket.h>
+#include <wangle/channel/PipePool.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
 using namespace folly;
 using namespace wangle;
 
@@ -29,6 +35,164 @@ Singleton<IOThreadPoolExecutor, FileRegionReadPool> readPool(
 
 namespace wangle {
 
+constexpr size_t FileRegion::kDefaultChunkSize;
+
+// State of one transferChunked(), shared by the read pool and EventBase
+// callbacks so that it outlives the FileRegion
+class FileRegion::ChunkedTransfer
+  : public std::enable_shared_from_this<ChunkedTransfer> {
+ public:
+  ChunkedTransfer(int fd, off_t offset, size_t count, size_t chunkSize,
+                  EventBase* evb, ChunkWriter write)
+    : fd_(fd), offset_(offset), remaining_(count), chunkSize_(chunkSize),
+      evb_(evb), write_(std::move(write)) {}
+
+  Future<Unit> start() {
+    auto f = promise_.getFuture();
+    if (remaining_ == 0) {
+      promise_.setValue();
+    } else {
+      readChunk();
+    }
+    return f;
+  }
+
+ private:
+  // On the read pool
+  void readChunk() {
+    auto self = shared_from_this();
+    readPool.try_get()->add([self] {
+      const size_t len = std::min(self->chunkSize_, self->remaining_);
+      auto buf = IOBuf::create(len);
+      ssize_t n;
+      do {
+        n = ::pread(self->fd_, buf->writableData(), len, self->offset_);
+      } while (n == -1 && errno == EINTR);
+      if (n <= 0) {
+        auto ew = make_exception_wrapper<AsyncSocketException>(
+            n == 0 ? AsyncSocketException::END_OF_FILE
+                   : AsyncSocketException::INTERNAL_ERROR,
+            n == 0 ? "file shorter than region" : "pread failed",
+            n == 0 ? 0 : errno);
+        self->evb_->runInEventBaseThread([self, ew] {
+          self->promise_.setException(ew);
+        });
+        return;
+      }
+      buf->append(n);
+      auto wrapped = makeMoveWrapper(std::move(buf));
+      self->evb_->runInEventBaseThread([self, wrapped]() mutable {
+        self->writeChunk(std::move(*wrapped));
+      });
+    });
+  }
+
+  // On evb
+  void writeChunk(std::unique_ptr<IOBuf> buf) {
+    const size_t len = buf->length();
+    offset_ += len;
+    remaining_ -= len;
+    auto self = shared_from_this();
+    write_(std::move(buf)).then([self](Try<Unit>&& t) {
+      if (t.hasException()) {
+        self->promise_.setException(std::move(t.exception()));
+      } else if (self->remaining_ == 0) {
+        self->promise_.setValue();
+      } else {
+        self->readChunk();
+      }
+    });
+  }
+
+  const int fd_;
+  off_t offset_;
+  size_t remaining_;
+  const size_t chunkSize_;
+  EventBase* const evb_;
+  ChunkWriter write_;
+  Promise<Unit> promise_;
+};
+
+Future<Unit> FileRegion::transferTo(
+    std::shared_ptr<AsyncTransport> transport) {
+  auto socket = std::dynamic_pointer_cast<AsyncSocket>(transport);
+  if (!socket || dynamic_cast<AsyncSSLSocket*>(socket.get())) {
+    // The data has to go through the transport's own write path
+    auto wrapper = std::dynamic_pointer_cast<AsyncTransportWrapper>(
+        transport);
+    CHECK(wrapper);
+    auto writer = [wrapper](std::unique_ptr<IOBuf> buf) {
+      auto cb = new WriteCallback();
+      auto f = cb->promise_.getFuture();
+      wrapper->writeChain(cb, std::move(buf));
+      return f;
+    };
+    return transferChunked(wrapper->getEventBase(), std::move(writer));
+  }
+
+  auto cb = new WriteCallback();
+  auto f = cb->promise_.getFuture();
+  AsyncSocket::WriteRequest* req;
+  if (canSendfile()) {
+    req = new SendfileWriteRequest(socket.get(), cb, fd_, offset_, count_);
+  } else {
+    req = new FileWriteRequest(socket.get(), cb, fd_, offset_, count_);
+  }
+  socket->writeRequest(req);
+  return f;
+}
+
+Future<Unit> FileRegion::transferChunked(
+    EventBase* evb,
+    ChunkWriter write,
+    size_t chunkSize) {
+  CHECK_GT(chunkSize, 0);
+  auto transfer = std::make_shared<ChunkedTransfer>(
+      fd_, offset_, count_, chunkSize, evb, std::move(write));
+  return transfer->start();
+}
+
+bool FileRegion::canSendfile() const {
+  struct stat st;
+  return ::fstat(fd_, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+FileRegion::SendfileWriteRequest::SendfileWriteRequest(AsyncSocket* socket,
+    WriteCallback* callback, int fd, off_t offset, size_t count)
+  : WriteRequest(socket, callback),
+    fd_(fd), offset_(offset), count_(count) {
+}
+
+void FileRegion::SendfileWriteRequest::destroy() {
+  delete this;
+}
+
+bool FileRegion::SendfileWriteRequest::performWrite() {
+  ssize_t sent = ::sendfile(socket_->getFd(), fd_, &offset_,
+                            count_ - totalBytesWritten_);
+  if (sent == -1) {
+    return errno == EAGAIN;
+  }
+  if (sent == 0) {
+    // The file is shorter than the region
+    return false;
+  }
+  bytesWritten(sent);
+  return true;
+}
+
+void FileRegion::SendfileWriteRequest::consume() {
+  // do nothing
+}
+
+bool FileRegion::SendfileWriteRequest::isComplete() {
+  return totalBytesWritten_ == count_;
+}
+
+void FileRegion::SendfileWriteRequest::start() {
+  socket_->writeRequestReady();
+}
+
 FileRegion::FileWriteRequest::FileWriteRequest(AsyncSocket* socket,
     WriteCallback* callback, int fd, off_t offset, size_t count)
   : WriteRequest(socket, callback),
@@ -111,20 +275,23 @@ void FileRegion::FileWriteRequest::start() {
     return;
 #else
     int pipeFds[2];
-    if (::pipe2(pipeFds, O_NONBLOCK) == -1) {
-      fail(__func__, AsyncSocketException(
-          AsyncSocketException::INTERNAL_ERROR,
-          "pipe2 failed", errno));
-      return;
-    }
+    if (!PipePool::local().get(pipeFds)) {
+      if (::pipe2(pipeFds, O_NONBLOCK) == -1) {
+        fail(__func__, AsyncSocketException(
+            AsyncSocketException::INTERNAL_ERROR,
+            "pipe2 failed", errno));
+        return;
+      }
 
 #ifdef F_SETPIPE_SZ
-    // Max size for unprevileged processes as set in /proc/sys/fs/pipe-max-size
-    // Ignore failures and just roll with it
-    // TODO maybe read max size from /proc?
-    fcntl(pipeFds[0], F_SETPIPE_SZ, 1048576);
-    fcntl(pipeFds[1], F_SETPIPE_SZ, 1048576);
+      // Max size for unprevileged processes as set in
+      // /proc/sys/fs/pipe-max-size
+      // Ignore failures and just roll with it
+      // TODO maybe read max size from /proc?
+      fcntl(pipeFds[0], F_SETPIPE_SZ, 1048576);
+      fcntl(pipeFds[1], F_SETPIPE_SZ, 1048576);
 #endif
+    }
 
     pipe_out_ = pipeFds[0];
 
@@ -139,13 +306,19 @@ void FileRegion::FileWriteRequest::start() {
 
 FileRegion::FileWriteRequest::~FileWriteRequest() {
   CHECK(readBase_->isInEventBaseThread());
+  bool reusePipe = false;
   socket_->getEventBase()->runInEventBaseThreadAndWait([&]{
     stopConsuming();
-    if (pipe_out_ > -1) {
+    // Only a pipe that everything was sent out of can be reused
+    reusePipe = pipe_out_ > -1 && readHandler_ && bytesInPipe_ == 0 &&
+      totalBytesWritten_ == count_;
+    if (pipe_out_ > -1 && !reusePipe) {
       ::close(pipe_out_);
     }
   });
-
+  if (reusePipe) {
+    PipePool::local().put(pipe_out_, readHandler_->releasePipe());
+  }
 }
 
 void FileRegion::FileWriteRequest::fail(
@@ -171,7 +344,16 @@ FileRegion::FileWriteRequest::FileReadHandler::FileReadHandler(
 FileRegion::FileWriteRequest::FileReadHandler::~FileReadHandler() {
   CHECK(req_->readBase_->isInEventBaseThread());
   unregisterHandler();
-  ::close(pipe_in_);
+  if (pipe_in_ > -1) {
+    ::close(pipe_in_);
+  }
+}
+
+int FileRegion::FileWriteRequest::FileReadHandler::releasePipe() {
+  unregisterHandler();
+  int fd = pipe_in_;
+  pipe_in_ = -1;
+  return fd;
 }
 
 void FileRegion::FileWriteRequest::FileReadHandler::handlerReady(
@@ -25,19 +25,32 @@ class FileRegion {
   FileRegion(int fd, off_t offset, size_t count)
     : fd_(fd), offset_(offset), count_(count) {}
 
+  static constexpr size_t kDefaultChunkSize = 64 * 1024;
+
+  // On plain sockets, regular files are sent with sendfile() straight from
+  // the socket's thread, and anything else is spliced through a pipe filled
+  // from a separate read pool so that blocking reads don't stall the
+  // socket's EventBase. Other transports, such as TLS sockets, which the
+  // kernel can't write for us, get transferChunked() into the transport.
   folly::Future<folly::Unit> transferTo(
-      std::shared_ptr<folly::AsyncTransport> transport) {
-    auto socket = std::dynamic_pointer_cast<folly::AsyncSocket>(
-        transport);
-    CHECK(socket);
-    auto cb = new WriteCallback();
-    auto f = cb->promise_.getFuture();
-    auto req = new FileWriteRequest(socket.get(), cb, fd_, offset_, count_);
-    socket->writeRequest(req);
-    return f;
-  }
+      std::shared_ptr<folly::AsyncTransport> transport);
+
+  typedef std::function<folly::Future<folly::Unit>(
+      std::unique_ptr<folly::IOBuf>)> ChunkWriter;
+
+  // Streams the region through write, e.g. a pipeline's or a handler
+  // context's write(), in chunks of at most chunkSize bytes read from the
+  // read pool. write is called on evb. Each chunk is only read once the
+  // write of the previous one has completed, so a transfer holds one chunk
+  // in memory whatever the size of the file.
+  folly::Future<folly::Unit> transferChunked(
+      folly::EventBase* evb,
+      ChunkWriter write,
+      size_t chunkSize = kDefaultChunkSize);
 
  private:
+  class ChunkedTransfer;
+
   class WriteCallback : private folly::AsyncSocket::WriteCallback {
     void writeSuccess() noexcept override {
       promise_.setValue();
@@ -55,10 +68,33 @@ class FileRegion {
     folly::Promise<folly::Unit> promise_;
   };
 
+  bool canSendfile() const;
+
   const int fd_;
   const off_t offset_;
   const size_t count_;
 
+  class SendfileWriteRequest : public folly::AsyncSocket::WriteRequest {
+   public:
+    SendfileWriteRequest(folly::AsyncSocket* socket, WriteCallback* callback,
+                         int fd, off_t offset, size_t count);
+
+    void destroy() override;
+
+    bool performWrite() override;
+
+    void consume() override;
+
+    bool isComplete() override;
+
+    void start() override;
+
+   private:
+    const int fd_;
+    off_t offset_;
+    const size_t count_;
+  };
+
   class FileWriteRequest : public folly::AsyncSocket::WriteRequest,
                            public folly::NotificationQueue<size_t>::Consumer {
    public:
@@ -85,6 +121,9 @@ class FileRegion {
 
       void handlerReady(uint16_t events) noexcept override;
 
+      // Hands over the pipe's write end instead of closing it
+      int releasePipe();
+
      private:
       FileWriteRequest* req_;
       int pipe_in_;
@@ -25,6 +25,13 @@ class HandlerBase {
   virtual void attachPipeline(Context* /*ctx*/) {}
   virtual void detachPipeline(Context* /*ctx*/) {}
 
+  // Return the handler to the state it was constructed in, so that its
+  // pipeline can be reused for another connection (see PipelineBase::reset).
+  // Handlers that can't be reused keep the default, which returns false.
+  virtual bool reset() {
+    return false;
+  }
+
   Context* getContext() {
     if (attachCount_ != 1) {
       return nullptr;
@@ -52,6 +59,14 @@ class Handler : public HandlerBase<HandlerContext<Rout, Wout>> {
   virtual ~Handler() = default;
 
   virtual void read(Context* ctx, Rin msg) = 0;
+  // Several messages produced by one upstream event (e.g. all frames decoded
+  // from one socket read). Override to process them in a single pass; by
+  // default each message is handed to read() in order.
+  virtual void readBatch(Context* ctx, MessageBatch<Rin> msgs) {
+    for (auto& msg : msgs) {
+      read(ctx, std::forward<Rin>(msg));
+    }
+  }
   virtual void readEOF(Context* ctx) {
     ctx->fireReadEOF();
   }
@@ -64,8 +79,20 @@ class Handler : public HandlerBase<HandlerContext<Rout, Wout>> {
   virtual void transportInactive(Context* ctx) {
     ctx->fireTransportInactive();
   }
+  // The transport crossed one of the pipeline's write buffer watermarks.
+  // See PipelineBase::setWriteBufferWatermarks()
+  virtual void writabilityChanged(Context* ctx, bool writable) {
+    ctx->fireWritabilityChanged(writable);
+  }
 
   virtual folly::Future<folly::Unit> write(Context* ctx, Win msg) = 0;
+  // Write without handing a Future back to the caller. The default falls back
+  // to write() and drops the Future; handlers on hot paths should override it
+  // to forward via ctx->fireWriteNoFuture() so no Promise is ever created.
+  // Transport errors are reported through PipelineBase::setWriteErrorCallback.
+  virtual void writeNoFuture(Context* ctx, Win msg) {
+    write(ctx, std::forward<Win>(msg));
+  }
   virtual folly::Future<folly::Unit> writeException(Context* ctx,
                                                    folly::exception_wrapper e) {
     return ctx->fireWriteException(std::move(e));
@@ -113,6 +140,12 @@ class InboundHandler : public HandlerBase<InboundHandlerContext<Rout>> {
   virtual ~InboundHandler() = default;
 
   virtual void read(Context* ctx, Rin msg) = 0;
+  // See Handler::readBatch()
+  virtual void readBatch(Context* ctx, MessageBatch<Rin> msgs) {
+    for (auto& msg : msgs) {
+      read(ctx, std::forward<Rin>(msg));
+    }
+  }
   virtual void readEOF(Context* ctx) {
     ctx->fireReadEOF();
   }
@@ -125,6 +158,11 @@ class InboundHandler : public HandlerBase<InboundHandlerContext<Rout>> {
   virtual void transportInactive(Context* ctx) {
     ctx->fireTransportInactive();
   }
+  // The transport crossed one of the pipeline's write buffer watermarks.
+  // See PipelineBase::setWriteBufferWatermarks()
+  virtual void writabilityChanged(Context* ctx, bool writable) {
+    ctx->fireWritabilityChanged(writable);
+  }
 };
 
 template <class Win, class Wout = Win>
@@ -140,6 +178,10 @@ class OutboundHandler : public HandlerBase<OutboundHandlerContext<Wout>> {
   virtual ~OutboundHandler() = default;
 
   virtual folly::Future<folly::Unit> write(Context* ctx, Win msg) = 0;
+  // See Handler::writeNoFuture()
+  virtual void writeNoFuture(Context* ctx, Win msg) {
+    write(ctx, std::forward<Win>(msg));
+  }
   virtual folly::Future<folly::Unit> writeException(
       Context* ctx, folly::exception_wrapper e) {
     return ctx->fireWriteException(std::move(e));
@@ -158,9 +200,17 @@ class HandlerAdapter : public Handler<R, R, W, W> {
     ctx->fireRead(std::forward<R>(msg));
   }
 
+  void readBatch(Context* ctx, MessageBatch<R> msgs) override {
+    ctx->fireReadBatch(msgs);
+  }
+
   folly::Future<folly::Unit> write(Context* ctx, W msg) override {
     return ctx->fireWrite(std::forward<W>(msg));
   }
+
+  void writeNoFuture(Context* ctx, W msg) override {
+    ctx->fireWriteNoFuture(std::forward<W>(msg));
+  }
 };
 
 typedef HandlerAdapter<folly::IOBufQueue&, std::unique_ptr<folly::IOBuf>>
@@ -12,12 +12,17 @@
 
 namespace wangle {
 
+namespace detail {
+class InstrumentedLinkBase;
+}
+
 class PipelineContext {
  public:
   virtual ~PipelineContext() = default;
 
   virtual void attachPipeline() = 0;
   virtual void detachPipeline() = 0;
+  virtual bool resetHandler() = 0;
 
   template <class H, class HandlerContext>
   void attachContext(H* handler, HandlerContext* ctx) {
@@ -32,6 +37,14 @@ class PipelineContext {
   virtual void setNextOut(PipelineContext* ctx) = 0;
 
   virtual HandlerDir getDirection() = 0;
+
+  // Builds the link that records HandlerStats for this context's handler,
+  // or returns null if this context can't be instrumented
+  virtual std::unique_ptr<detail::InstrumentedLinkBase> makeInstrumentedLink(
+      std::weak_ptr<PipelineBase> /*pipeline*/,
+      uint32_t /*sampleRate*/) {
+    return nullptr;
+  }
 };
 
 template <class In>
@@ -39,10 +52,12 @@ class InboundLink {
  public:
   virtual ~InboundLink() = default;
   virtual void read(In msg) = 0;
+  virtual void readBatch(MessageBatch<In> msgs) = 0;
   virtual void readEOF() = 0;
   virtual void readException(folly::exception_wrapper e) = 0;
   virtual void transportActive() = 0;
   virtual void transportInactive() = 0;
+  virtual void writabilityChanged(bool writable) = 0;
 };
 
 template <class Out>
@@ -50,11 +65,249 @@ class OutboundLink {
  public:
   virtual ~OutboundLink() = default;
   virtual folly::Future<folly::Unit> write(Out msg) = 0;
+  virtual void writeNoFuture(Out msg) = 0;
   virtual folly::Future<folly::Unit> writeException(
       folly::exception_wrapper e) = 0;
   virtual folly::Future<folly::Unit> close() = 0;
 };
 
+namespace detail {
+
+inline uint64_t messageBytes(const folly::IOBufQueue& queue) {
+  // chainLength() requires the queue to cache it
+  return queue.front() ? queue.front()->computeChainDataLength() : 0;
+}
+
+inline uint64_t messageBytes(const std::unique_ptr<folly::IOBuf>& buf) {
+  return buf ? buf->computeChainDataLength() : 0;
+}
+
+inline uint64_t messageBytes(const std::string& str) {
+  return str.size();
+}
+
+template <class T>
+inline uint64_t messageBytes(const T& /*msg*/) {
+  return 0;
+}
+
+// Sits between a context and the context of the handler it forwards to
+// while instrumentation is enabled, counting and timing each hop. Only
+// spliced in by finalize() when instrumentation is on, so that pipelines
+// without it link their contexts directly.
+class InstrumentedLinkBase : public PipelineContext {
+ public:
+  InstrumentedLinkBase(
+      PipelineContext* target,
+      std::weak_ptr<PipelineBase> pipeline,
+      uint32_t sampleRate,
+      std::string handler)
+    : pipelineRaw_(pipeline.lock().get()),
+      pipelineWeak_(std::move(pipeline)),
+      target_(target),
+      sampleRate_(sampleRate) {
+    stats_.handler = std::move(handler);
+  }
+
+  PipelineContext* target() const {
+    return target_;
+  }
+
+  const HandlerStats& stats() const {
+    return stats_;
+  }
+
+  void setSampleRate(uint32_t sampleRate) {
+    sampleRate_ = sampleRate;
+  }
+
+  // PipelineContext overrides; the pipeline never links to or attaches the
+  // link itself except through its target
+  void attachPipeline() override {}
+  void detachPipeline() override {}
+  bool resetHandler() override {
+    return true;
+  }
+  void setNextIn(PipelineContext* /*ctx*/) override {}
+  void setNextOut(PipelineContext* /*ctx*/) override {}
+  HandlerDir getDirection() override {
+    return target_->getDirection();
+  }
+
+ protected:
+  typedef std::chrono::steady_clock::time_point Sample;
+
+  // Returns the start time of the call if it is sampled, a zero time point
+  // otherwise
+  Sample beginCall(bool inbound, uint64_t messages, uint64_t bytes) {
+    ++(inbound ? stats_.inboundCalls : stats_.outboundCalls);
+    stats_.messages += messages;
+    stats_.bytes += bytes;
+    if (++calls_ % sampleRate_ != 0) {
+      return Sample();
+    }
+    return std::chrono::steady_clock::now();
+  }
+
+  void endCall(Sample start) {
+    if (start != Sample()) {
+      stats_.sampledCalls++;
+      stats_.sampledTime +=
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - start);
+    }
+  }
+
+  PipelineBase* pipelineRaw_;
+  std::weak_ptr<PipelineBase> pipelineWeak_;
+
+ private:
+  PipelineContext* target_;
+  uint32_t sampleRate_;
+  uint64_t calls_{0};
+  HandlerStats stats_;
+};
+
+template <class H, bool HasLink = H::dir != HandlerDir::OUT>
+class InstrumentedInboundLink
+  : public InstrumentedLinkBase,
+    public InboundLink<typename H::rin> {
+ public:
+  typedef typename H::rin Rin;
+
+  template <class... Args>
+  explicit InstrumentedInboundLink(Args&&... args)
+    : InstrumentedLinkBase(std::forward<Args>(args)...),
+      next_(dynamic_cast<InboundLink<Rin>*>(target())) {
+    CHECK(next_);
+  }
+
+  void read(Rin msg) override {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    auto sample = beginCall(true, 1, messageBytes(msg));
+    next_->read(std::forward<Rin>(msg));
+    endCall(sample);
+  }
+
+  void readBatch(MessageBatch<Rin> msgs) override {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    uint64_t bytes = 0;
+    for (auto& msg : msgs) {
+      bytes += messageBytes(msg);
+    }
+    auto sample = beginCall(true, msgs.size(), bytes);
+    next_->readBatch(msgs);
+    endCall(sample);
+  }
+
+  void readEOF() override {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    auto sample = beginCall(true, 0, 0);
+    next_->readEOF();
+    endCall(sample);
+  }
+
+  void readException(folly::exception_wrapper e) override {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    auto sample = beginCall(true, 0, 0);
+    next_->readException(std::move(e));
+    endCall(sample);
+  }
+
+  void transportActive() override {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    auto sample = beginCall(true, 0, 0);
+    next_->transportActive();
+    endCall(sample);
+  }
+
+  void transportInactive() override {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    auto sample = beginCall(true, 0, 0);
+    next_->transportInactive();
+    endCall(sample);
+  }
+
+  void writabilityChanged(bool writable) override {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    auto sample = beginCall(true, 0, 0);
+    next_->writabilityChanged(writable);
+    endCall(sample);
+  }
+
+ private:
+  InboundLink<Rin>* next_;
+};
+
+template <class H>
+class InstrumentedInboundLink<H, false> : public InstrumentedLinkBase {
+ public:
+  template <class... Args>
+  explicit InstrumentedInboundLink(Args&&... args)
+    : InstrumentedLinkBase(std::forward<Args>(args)...) {}
+};
+
+// The complete link for H: the outbound half layered over the inbound one
+template <class H, bool HasLink = H::dir != HandlerDir::IN>
+class InstrumentedLink
+  : public InstrumentedInboundLink<H>,
+    public OutboundLink<typename H::win> {
+ public:
+  typedef typename H::win Win;
+
+  template <class... Args>
+  explicit InstrumentedLink(Args&&... args)
+    : InstrumentedInboundLink<H>(std::forward<Args>(args)...),
+      next_(dynamic_cast<OutboundLink<Win>*>(this->target())) {
+    CHECK(next_);
+  }
+
+  folly::Future<folly::Unit> write(Win msg) override {
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
+    auto sample = this->beginCall(false, 1, messageBytes(msg));
+    auto future = next_->write(std::forward<Win>(msg));
+    this->endCall(sample);
+    return future;
+  }
+
+  void writeNoFuture(Win msg) override {
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
+    auto sample = this->beginCall(false, 1, messageBytes(msg));
+    next_->writeNoFuture(std::forward<Win>(msg));
+    this->endCall(sample);
+  }
+
+  folly::Future<folly::Unit> writeException(
+      folly::exception_wrapper e) override {
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
+    auto sample = this->beginCall(false, 0, 0);
+    auto future = next_->writeException(std::move(e));
+    this->endCall(sample);
+    return future;
+  }
+
+  folly::Future<folly::Unit> close() override {
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
+    auto sample = this->beginCall(false, 0, 0);
+    auto future = next_->close();
+    this->endCall(sample);
+    return future;
+  }
+
+ private:
+  OutboundLink<Win>* next_;
+};
+
+template <class H>
+class InstrumentedLink<H, false> : public InstrumentedInboundLink<H> {
+ public:
+  template <class... Args>
+  explicit InstrumentedLink(Args&&... args)
+    : InstrumentedInboundLink<H>(std::forward<Args>(args)...) {}
+};
+
+} // namespace detail
+
 template <class H, class Context>
 class ContextImplBase : public PipelineContext {
  public:
@@ -86,6 +339,10 @@ class ContextImplBase : public PipelineContext {
     attached_ = false;
   }
 
+  bool resetHandler() override {
+    return handler_->reset();
+  }
+
   void setNextIn(PipelineContext* ctx) override {
     if (!ctx) {
       nextIn_ = nullptr;
@@ -118,10 +375,29 @@ class ContextImplBase : public PipelineContext {
     return H::dir;
   }
 
+  // For PipelineBuilder, which checks the types at compile time instead
+  void linkNextIn(InboundLink<typename H::rout>* next) {
+    nextIn_ = next;
+  }
+
+  void linkNextOut(OutboundLink<typename H::wout>* next) {
+    nextOut_ = next;
+  }
+
+  std::unique_ptr<detail::InstrumentedLinkBase> makeInstrumentedLink(
+      std::weak_ptr<PipelineBase> pipeline,
+      uint32_t sampleRate) override {
+    return folly::make_unique<detail::InstrumentedLink<H>>(
+        this,
+        std::move(pipeline),
+        sampleRate,
+        folly::demangle(typeid(H)).toStdString());
+  }
+
  protected:
   Context* impl_;
   std::weak_ptr<PipelineBase> pipelineWeak_;
-  PipelineBase* pipelineRaw_;
+  PipelineBase* pipelineRaw_{nullptr};
   std::shared_ptr<H> handler_;
   InboundLink<typename H::rout>* nextIn_{nullptr};
   OutboundLink<typename H::wout>* nextOut_{nullptr};
@@ -161,7 +437,7 @@ class ContextImpl
 
   // HandlerContext overrides
   void fireRead(Rout msg) override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     if (this->nextIn_) {
       this->nextIn_->read(std::forward<Rout>(msg));
     } else {
@@ -169,8 +445,17 @@ class ContextImpl
     }
   }
 
+  void fireReadBatch(MessageBatch<Rout> msgs) override {
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
+    if (this->nextIn_) {
+      this->nextIn_->readBatch(msgs);
+    } else {
+      LOG(WARNING) << "readBatch reached end of pipeline";
+    }
+  }
+
   void fireReadEOF() override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     if (this->nextIn_) {
       this->nextIn_->readEOF();
     } else {
@@ -179,7 +464,7 @@ class ContextImpl
   }
 
   void fireReadException(folly::exception_wrapper e) override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     if (this->nextIn_) {
       this->nextIn_->readException(std::move(e));
     } else {
@@ -188,21 +473,28 @@ class ContextImpl
   }
 
   void fireTransportActive() override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     if (this->nextIn_) {
       this->nextIn_->transportActive();
     }
   }
 
   void fireTransportInactive() override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     if (this->nextIn_) {
       this->nextIn_->transportInactive();
     }
   }
 
+  void fireWritabilityChanged(bool writable) override {
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
+    if (this->nextIn_) {
+      this->nextIn_->writabilityChanged(writable);
+    }
+  }
+
   folly::Future<folly::Unit> fireWrite(Wout msg) override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     if (this->nextOut_) {
       return this->nextOut_->write(std::forward<Wout>(msg));
     } else {
@@ -211,9 +503,18 @@ class ContextImpl
     }
   }
 
+  void fireWriteNoFuture(Wout msg) override {
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
+    if (this->nextOut_) {
+      this->nextOut_->writeNoFuture(std::forward<Wout>(msg));
+    } else {
+      LOG(WARNING) << "write reached end of pipeline";
+    }
+  }
+
   folly::Future<folly::Unit> fireWriteException(
       folly::exception_wrapper e) override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     if (this->nextOut_) {
       return this->nextOut_->writeException(std::move(e));
     } else {
@@ -223,7 +524,7 @@ class ContextImpl
   }
 
   folly::Future<folly::Unit> fireClose() override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     if (this->nextOut_) {
       return this->nextOut_->close();
     } else {
@@ -260,44 +561,59 @@ class ContextImpl
 
   // InboundLink overrides
   void read(Rin msg) override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     this->handler_->read(this, std::forward<Rin>(msg));
   }
 
+  void readBatch(MessageBatch<Rin> msgs) override {
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
+    this->handler_->readBatch(this, msgs);
+  }
+
   void readEOF() override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     this->handler_->readEOF(this);
   }
 
   void readException(folly::exception_wrapper e) override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     this->handler_->readException(this, std::move(e));
   }
 
   void transportActive() override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     this->handler_->transportActive(this);
   }
 
   void transportInactive() override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     this->handler_->transportInactive(this);
   }
 
+  void writabilityChanged(bool writable) override {
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
+    this->handler_->writabilityChanged(this, writable);
+  }
+
   // OutboundLink overrides
   folly::Future<folly::Unit> write(Win msg) override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     return this->handler_->write(this, std::forward<Win>(msg));
   }
 
+  void writeNoFuture(Win msg) override {
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
+    this->handler_->writeNoFuture(this, std::forward<Win>(msg));
+  }
+
   folly::Future<folly::Unit> writeException(
       folly::exception_wrapper e) override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     return this->handler_->writeException(this, std::move(e));
   }
 
   folly::Future<folly::Unit> close() override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     return this->handler_->close(this);
   }
 };
@@ -330,7 +646,7 @@ class InboundContextImpl
 
   // InboundHandlerContext overrides
   void fireRead(Rout msg) override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     if (this->nextIn_) {
       this->nextIn_->read(std::forward<Rout>(msg));
     } else {
@@ -338,8 +654,17 @@ class InboundContextImpl
     }
   }
 
+  void fireReadBatch(MessageBatch<Rout> msgs) override {
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
+    if (this->nextIn_) {
+      this->nextIn_->readBatch(msgs);
+    } else {
+      LOG(WARNING) << "readBatch reached end of pipeline";
+    }
+  }
+
   void fireReadEOF() override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     if (this->nextIn_) {
       this->nextIn_->readEOF();
     } else {
@@ -348,7 +673,7 @@ class InboundContextImpl
   }
 
   void fireReadException(folly::exception_wrapper e) override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     if (this->nextIn_) {
       this->nextIn_->readException(std::move(e));
     } else {
@@ -357,19 +682,26 @@ class InboundContextImpl
   }
 
   void fireTransportActive() override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     if (this->nextIn_) {
       this->nextIn_->transportActive();
     }
   }
 
   void fireTransportInactive() override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     if (this->nextIn_) {
       this->nextIn_->transportInactive();
     }
   }
 
+  void fireWritabilityChanged(bool writable) override {
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
+    if (this->nextIn_) {
+      this->nextIn_->writabilityChanged(writable);
+    }
+  }
+
   PipelineBase* getPipeline() override {
     return this->pipelineRaw_;
   }
@@ -380,29 +712,39 @@ class InboundContextImpl
 
   // InboundLink overrides
   void read(Rin msg) override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     this->handler_->read(this, std::forward<Rin>(msg));
   }
 
+  void readBatch(MessageBatch<Rin> msgs) override {
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
+    this->handler_->readBatch(this, msgs);
+  }
+
   void readEOF() override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     this->handler_->readEOF(this);
   }
 
   void readException(folly::exception_wrapper e) override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     this->handler_->readException(this, std::move(e));
   }
 
   void transportActive() override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     this->handler_->transportActive(this);
   }
 
   void transportInactive() override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     this->handler_->transportInactive(this);
   }
+
+  void writabilityChanged(bool writable) override {
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
+    this->handler_->writabilityChanged(this, writable);
+  }
 };
 
 template <class H>
@@ -433,7 +775,7 @@ class OutboundContextImpl
 
   // OutboundHandlerContext overrides
   folly::Future<folly::Unit> fireWrite(Wout msg) override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     if (this->nextOut_) {
       return this->nextOut_->write(std::forward<Wout>(msg));
     } else {
@@ -442,9 +784,18 @@ class OutboundContextImpl
     }
   }
 
+  void fireWriteNoFuture(Wout msg) override {
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
+    if (this->nextOut_) {
+      this->nextOut_->writeNoFuture(std::forward<Wout>(msg));
+    } else {
+      LOG(WARNING) << "write reached end of pipeline";
+    }
+  }
+
   folly::Future<folly::Unit> fireWriteException(
       folly::exception_wrapper e) override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     if (this->nextOut_) {
       return this->nextOut_->writeException(std::move(e));
     } else {
@@ -454,7 +805,7 @@ class OutboundContextImpl
   }
 
   folly::Future<folly::Unit> fireClose() override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     if (this->nextOut_) {
       return this->nextOut_->close();
     } else {
@@ -473,18 +824,23 @@ class OutboundContextImpl
 
   // OutboundLink overrides
   folly::Future<folly::Unit> write(Win msg) override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     return this->handler_->write(this, std::forward<Win>(msg));
   }
 
+  void writeNoFuture(Win msg) override {
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
+    this->handler_->writeNoFuture(this, std::forward<Win>(msg));
+  }
+
   folly::Future<folly::Unit> writeException(
       folly::exception_wrapper e) override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     return this->handler_->writeException(this, std::move(e));
   }
 
   folly::Future<folly::Unit> close() override {
-    auto guard = this->pipelineWeak_.lock();
+    PipelineGuard guard(this->pipelineRaw_, this->pipelineWeak_);
     return this->handler_->close(this);
   }
 };
@@ -13,23 +13,114 @@
 #include <folly/io/async/AsyncTransport.h>
 #include <folly/futures/Future.h>
 #include <folly/ExceptionWrapper.h>
+#include <folly/Range.h>
+#include <folly/io/IOBufQueue.h>
+#include <chrono>
+#include <memory>
+#include <string>
 
 namespace wangle {
 
 class PipelineBase;
 
+// A contiguous run of inbound messages delivered in one readBatch() call.
+// Handlers may move out of the elements (or mutate them, for reference types).
+template <class T>
+using MessageBatch = folly::Range<typename std::remove_reference<T>::type*>;
+
+// Per-handler counters collected when pipeline instrumentation is enabled,
+// see PipelineBase::setInstrumentation()
+struct HandlerStats {
+  std::string handler;
+  uint64_t inboundCalls{0};
+  uint64_t outboundCalls{0};
+  // Messages passed to read(), readBatch() and write(), and their size when
+  // they are strings or IOBufs
+  uint64_t messages{0};
+  uint64_t bytes{0};
+  // Wall-clock time of the sampled calls, including the handlers downstream
+  uint64_t sampledCalls{0};
+  std::chrono::nanoseconds sampledTime{0};
+};
+
+/**
+ * Keeps a pipeline alive while an event goes through it, in case a handler
+ * deletes it on the way. Only the outermost guard of an event takes a
+ * reference: the ones nested in it, one per handler the event reaches, find
+ * the pipeline guarded already through a thread-local pointer, so that an
+ * event costs a single pair of atomic operations however many handlers it
+ * passes through. Handlers that use their context after firing an event
+ * can take one with their context.
+ */
+class PipelineGuard {
+ public:
+  PipelineGuard(PipelineBase* pipeline,
+                const std::weak_ptr<PipelineBase>& pipelineWeak)
+      : pipeline_(pipeline) {
+    if (enter()) {
+      ref_ = pipelineWeak.lock();
+    }
+  }
+
+  template <class Context>
+  explicit PipelineGuard(Context* ctx) : pipeline_(ctx->getPipeline()) {
+    if (enter()) {
+      ref_ = ctx->getPipelineShared();
+    }
+  }
+
+  // Before ref_ goes, which may delete the pipeline
+  ~PipelineGuard() {
+    if (outer_) {
+      guarded() = prev_;
+    }
+  }
+
+  PipelineGuard(const PipelineGuard&) = delete;
+  PipelineGuard& operator=(const PipelineGuard&) = delete;
+
+ private:
+  static PipelineBase*& guarded() {
+    static thread_local PipelineBase* pipeline = nullptr;
+    return pipeline;
+  }
+
+  // Whether no guard further up this thread's stack holds the pipeline
+  bool enter() {
+    auto& guarded = PipelineGuard::guarded();
+    if (!pipeline_) {
+      return true;
+    }
+    if (guarded == pipeline_) {
+      return false;
+    }
+    prev_ = guarded;
+    guarded = pipeline_;
+    outer_ = true;
+    return true;
+  }
+
+  PipelineBase* pipeline_;
+  PipelineBase* prev_{nullptr};
+  bool outer_{false};
+  std::shared_ptr<PipelineBase> ref_;
+};
+
 template <class In, class Out>
 class HandlerContext {
  public:
   virtual ~HandlerContext() = default;
 
   virtual void fireRead(In msg) = 0;
+  virtual void fireReadBatch(MessageBatch<In> msgs) = 0;
   virtual void fireReadEOF() = 0;
   virtual void fireReadException(folly::exception_wrapper e) = 0;
   virtual void fireTransportActive() = 0;
   virtual void fireTransportInactive() = 0;
+  virtual void fireWritabilityChanged(bool writable) = 0;
 
   virtual folly::Future<folly::Unit> fireWrite(Out msg) = 0;
+  virtual void fireWriteNoFuture(Out msg) = 0;
   virtual folly::Future<folly::Unit> fireWriteException(
       folly::exception_wrapper e) = 0;
   virtual folly::Future<folly::Unit> fireClose() = 0;
@@ -40,6 +131,15 @@ class HandlerContext {
     return getPipeline()->getTransport();
   }
 
+  // Stop the transport from reading until the matching resumeRead(); see
+  // PipelineBase::pauseRead()
+  void pauseRead() {
+    getPipeline()->pauseRead();
+  }
+  void resumeRead() {
+    getPipeline()->resumeRead();
+  }
+
   virtual void setWriteFlags(folly::WriteFlags flags) = 0;
   virtual folly::WriteFlags getWriteFlags() = 0;
 
@@ -65,10 +165,12 @@ class InboundHandlerContext {
   virtual ~InboundHandlerContext() = default;
 
   virtual void fireRead(In msg) = 0;
+  virtual void fireReadBatch(MessageBatch<In> msgs) = 0;
   virtual void fireReadEOF() = 0;
   virtual void fireReadException(folly::exception_wrapper e) = 0;
   virtual void fireTransportActive() = 0;
   virtual void fireTransportInactive() = 0;
+  virtual void fireWritabilityChanged(bool writable) = 0;
 
   virtual PipelineBase* getPipeline() = 0;
   virtual std::shared_ptr<PipelineBase> getPipelineShared() = 0;
@@ -76,6 +178,13 @@ class InboundHandlerContext {
     return getPipeline()->getTransport();
   }
 
+  void pauseRead() {
+    getPipeline()->pauseRead();
+  }
+  void resumeRead() {
+    getPipeline()->resumeRead();
+  }
+
   // TODO Need get/set writeFlags, readBufferSettings? Probably not.
   // Do we even really need them stored in the pipeline at all?
   // Could just always delegate to the socket impl
@@ -87,6 +196,7 @@ class OutboundHandlerContext {
   virtual ~OutboundHandlerContext() = default;
 
   virtual folly::Future<folly::Unit> fireWrite(Out msg) = 0;
+  virtual void fireWriteNoFuture(Out msg) = 0;
   virtual folly::Future<folly::Unit> fireWriteException(
       folly::exception_wrapper e) = 0;
   virtual folly::Future<folly::Unit> fireClose() = 0;
@@ -96,6 +206,13 @@ class OutboundHandlerContext {
   std::shared_ptr<folly::AsyncTransport> getTransport() {
     return getPipeline()->getTransport();
   }
+
+  void pauseRead() {
+    getPipeline()->pauseRead();
+  }
+  void resumeRead() {
+    getPipeline()->resumeRead();
+  }
 };
 
 // #include <windows.h> has blessed us with #define IN & OUT, typically mapped
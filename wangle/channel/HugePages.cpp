@@ -0,0 +1,104 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/HugePages.h>
+
+#include <glog/logging.h>
+
+#include <atomic>
+#include <new>
+#include <sys/mman.h>
+
+namespace wangle {
+
+namespace {
+
+std::atomic<uint64_t> mappedBytes[3];
+
+std::atomic<uint64_t>& counter(HugePageKind kind) {
+  return mappedBytes[static_cast<int>(kind)];
+}
+
+// Cleared the first time reserved hugepages run out, so that later regions
+// don't each pay for a failing mmap()
+std::atomic<bool> tryExplicit{true};
+
+void* mapAnonymous(size_t size, int flags) {
+  auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+  return p == MAP_FAILED ? nullptr : p;
+}
+
+} // namespace
+
+HugePageMapping mapHugePages(size_t size) {
+  HugePageMapping mapping;
+  mapping.size = (size + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+  if (mapping.size == 0) {
+    mapping.size = kHugePageSize;
+  }
+
+#ifdef MAP_HUGETLB
+  if (tryExplicit.load(std::memory_order_relaxed)) {
+    mapping.data = mapAnonymous(mapping.size, MAP_HUGETLB);
+    if (mapping.data) {
+      mapping.kind = HugePageKind::EXPLICIT;
+      counter(mapping.kind) += mapping.size;
+      return mapping;
+    }
+    VLOG(2) << "No reserved hugepages left, using transparent ones";
+    tryExplicit.store(false, std::memory_order_relaxed);
+  }
+#endif
+
+  // Over-map by a page so that the region can be aligned to one; transparent
+  // hugepages only back whole aligned pages
+  const auto mapped = mapping.size + kHugePageSize;
+  auto p = static_cast<char*>(mapAnonymous(mapped, 0));
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  auto addr = reinterpret_cast<uintptr_t>(p);
+  auto aligned = reinterpret_cast<char*>(
+      (addr + kHugePageSize - 1) & ~uintptr_t(kHugePageSize - 1));
+  if (aligned > p) {
+    munmap(p, aligned - p);
+  }
+  auto end = p + mapped;
+  if (end > aligned + mapping.size) {
+    munmap(aligned + mapping.size, end - (aligned + mapping.size));
+  }
+  mapping.data = aligned;
+  mapping.kind = HugePageKind::NORMAL;
+#ifdef MADV_HUGEPAGE
+  if (madvise(aligned, mapping.size, MADV_HUGEPAGE) == 0) {
+    mapping.kind = HugePageKind::TRANSPARENT;
+  }
+#endif
+  counter(mapping.kind) += mapping.size;
+  return mapping;
+}
+
+void unmapHugePages(const HugePageMapping& mapping) {
+  if (mapping.data) {
+    munmap(mapping.data, mapping.size);
+    counter(mapping.kind) -= mapping.size;
+  }
+}
+
+HugePageStats getHugePageStats() {
+  HugePageStats stats;
+  stats.explicitBytes = counter(HugePageKind::EXPLICIT).load();
+  stats.transparentBytes = counter(HugePageKind::TRANSPARENT).load();
+  stats.normalBytes = counter(HugePageKind::NORMAL).load();
+  return stats;
+}
+
+} // namespace wangle
@@ -0,0 +1,56 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace wangle {
+
+enum class HugePageKind {
+  // Reserved hugepages (hugetlbfs, vm.nr_hugepages)
+  EXPLICIT,
+  // Transparent hugepages, asked for with madvise(); the kernel may still
+  // back them with normal pages
+  TRANSPARENT,
+  NORMAL,
+};
+
+struct HugePageMapping {
+  void* data{nullptr};
+  size_t size{0};
+  HugePageKind kind{HugePageKind::NORMAL};
+};
+
+// Regions of the size ReadBufferPool carves hugepage-backed buffers from
+constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+
+/*
+ * Maps size bytes, rounded up to a multiple of kHugePageSize and aligned to
+ * it: from reserved hugepages if there are enough, else as transparent
+ * hugepages, else as normal pages. The pages are touched when first used,
+ * so by the thread that uses them, and on its NUMA node. Throws
+ * std::bad_alloc if nothing can be mapped.
+ */
+HugePageMapping mapHugePages(size_t size);
+
+void unmapHugePages(const HugePageMapping& mapping);
+
+// Bytes currently mapped by mapHugePages(), process-wide
+struct HugePageStats {
+  uint64_t explicitBytes{0};
+  uint64_t transparentBytes{0};
+  uint64_t normalBytes{0};
+};
+
+HugePageStats getHugePageStats();
+
+} // namespace wangle
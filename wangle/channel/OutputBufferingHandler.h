@@ -10,8 +10,12 @@
 
 #pragma once
 
+#include <chrono>
+
 #include <folly/futures/SharedPromise.h>
 #include <wangle/channel/Handler.h>
+#include <wangle/concurrent/RequestTrace.h>
+#include <folly/io/async/AsyncTimeout.h>
 #include <folly/io/async/EventBase.h>
 #include <folly/io/async/EventBaseManager.h>
 #include <folly/io/IOBuf.h>
@@ -23,11 +27,57 @@ namespace wangle {
  * OutputBufferingHandler buffers writes in order to minimize syscalls. The
  * transport will be written to once per event loop instead of on every write.
  *
+ * Buffered writes are flushed early once they exceed setMaxBufferedBytes() or
+ * setMaxBufferedSegments(). setFlushDelay() holds them across loops for up to
+ * the given time instead of flushing at the end of the current loop, and
+ * cork() holds them until uncork(), trading a bounded amount of latency for
+ * fewer, larger writes. Buffered writes are charged to the pipeline's
+ * buffer account until they're flushed. The flush is recorded for the
+ * RequestTrace of the first traced write it carries.
+ *
  * This handler may only be used in a single Pipeline.
  */
 class OutputBufferingHandler : public OutboundBytesToBytesHandler,
                                protected folly::EventBase::LoopCallback {
  public:
+  // 0 means no limit
+  void setMaxBufferedBytes(uint64_t bytes) {
+    maxBufferedBytes_ = bytes;
+  }
+
+  // 0 means no limit
+  void setMaxBufferedSegments(size_t segments) {
+    maxBufferedSegments_ = segments;
+  }
+
+  // Flush buffered writes this long after the first of them rather than at
+  // the end of the current loop. Timeouts have millisecond granularity.
+  void setFlushDelay(std::chrono::milliseconds delay) {
+    flushDelay_ = delay;
+  }
+
+  // While corked, writes are only flushed when they exceed the size limits,
+  // and then with WriteFlags::CORK so the transport keeps holding them too
+  void cork() {
+    corked_ = true;
+    cancelScheduledFlush();
+  }
+
+  // Flushes everything buffered while corked
+  void uncork() {
+    if (!corked_) {
+      return;
+    }
+    corked_ = false;
+    if (sends_) {
+      flush();
+    }
+  }
+
+  bool isCorked() const {
+    return corked_;
+  }
+
   folly::Future<folly::Unit> write(
       Context* ctx,
       std::unique_ptr<folly::IOBuf> buf) override {
@@ -36,45 +86,184 @@ class OutputBufferingHandler : public OutboundBytesToBytesHandler,
       return ctx->fireWrite(std::move(buf));
     } else {
       // Delay sends to optimize for fewer syscalls
-      if (!sends_) {
-        DCHECK(!isLoopCallbackScheduled());
-        // Buffer all the sends, and call writev once per event loop.
-        sends_ = std::move(buf);
-        ctx->getTransport()->getEventBase()->runInLoop(this);
-      } else {
-        DCHECK(isLoopCallbackScheduled());
-        sends_->prependChain(std::move(buf));
-      }
-      return sharedPromise_.getFuture();
+      enqueue(ctx, std::move(buf));
+      promisePending_ = true;
+      auto future = sharedPromise_.getFuture();
+      flushIfOverLimits();
+      return future;
+    }
+  }
+
+  void writeNoFuture(
+      Context* ctx,
+      std::unique_ptr<folly::IOBuf> buf) override {
+    CHECK(buf);
+    if (!queueSends_) {
+      ctx->fireWriteNoFuture(std::move(buf));
+    } else {
+      enqueue(ctx, std::move(buf));
+      flushIfOverLimits();
     }
   }
 
   void runLoopCallback() noexcept override {
-    folly::MoveWrapper<folly::SharedPromise<folly::Unit>> sharedPromise;
-    std::swap(*sharedPromise, sharedPromise_);
-    getContext()->fireWrite(std::move(sends_))
-      .then([sharedPromise](folly::Try<folly::Unit> t) mutable {
-        sharedPromise->setTry(std::move(t));
-      });
+    flush();
   }
 
   folly::Future<folly::Unit> close(Context* ctx) override {
-    if (isLoopCallbackScheduled()) {
-      cancelLoopCallback();
-    }
+    cancelScheduledFlush();
 
     // If there are sends queued, cancel them
     sharedPromise_.setException(
       folly::make_exception_wrapper<std::runtime_error>(
         "close() called while sends still pending"));
     sends_.reset();
+    traceId_ = 0;
+    bufferedBytes_ = 0;
+    bufferedSegments_ = 0;
+    releaseCharge(ctx);
     sharedPromise_ = folly::SharedPromise<folly::Unit>();
+    promisePending_ = false;
     return ctx->fireClose();
   }
 
+  void detachPipeline(Context* ctx) override {
+    releaseCharge(ctx);
+  }
+
   folly::SharedPromise<folly::Unit> sharedPromise_;
   std::unique_ptr<folly::IOBuf> sends_{nullptr};
   bool queueSends_{true};
+  // Whether a Future was handed out for the batch currently in sends_
+  bool promisePending_{false};
+
+ private:
+  class FlushTimeout : public folly::AsyncTimeout {
+   public:
+    FlushTimeout(OutputBufferingHandler* handler, folly::EventBase* evb)
+      : folly::AsyncTimeout(evb), handler_(handler) {}
+
+    void timeoutExpired() noexcept override {
+      handler_->flush();
+    }
+
+   private:
+    OutputBufferingHandler* handler_;
+  };
+
+  void enqueue(Context* ctx, std::unique_ptr<folly::IOBuf> buf) {
+    if (UNLIKELY(RequestTrace::isSet())) {
+      RequestTrace::record("buffered");
+      if (traceId_ == 0) {
+        traceId_ = RequestTrace::current();
+      }
+    }
+    // Counted without limits too, for limits set while writes are buffered
+    const auto len = buf->computeChainDataLength();
+    bufferedBytes_ += len;
+    bufferedSegments_ += buf->countChainElements();
+    auto& account = ctx->getPipeline()->getBufferAccount();
+    if (account.getAccounting().isEnabled()) {
+      account.add(len);
+      charged_ += len;
+    }
+    if (!sends_) {
+      // Buffer all the sends, and call writev once per event loop.
+      sends_ = std::move(buf);
+      if (!corked_) {
+        scheduleFlush(ctx);
+      }
+    } else {
+      sends_->prependChain(std::move(buf));
+    }
+  }
+
+  void scheduleFlush(Context* ctx) {
+    auto evb = ctx->getTransport()->getEventBase();
+    if (flushDelay_.count() > 0) {
+      if (!flushTimeout_) {
+        flushTimeout_ = folly::make_unique<FlushTimeout>(this, evb);
+      }
+      if (!flushTimeout_->isScheduled()) {
+        flushTimeout_->scheduleTimeout(flushDelay_);
+      }
+    } else if (!isLoopCallbackScheduled()) {
+      evb->runInLoop(this);
+    }
+  }
+
+  void cancelScheduledFlush() {
+    if (isLoopCallbackScheduled()) {
+      cancelLoopCallback();
+    }
+    if (flushTimeout_) {
+      flushTimeout_->cancelTimeout();
+    }
+  }
+
+  // Takes back what enqueue() charged, once the writes are passed on
+  void releaseCharge(Context* ctx) {
+    if (charged_ > 0) {
+      ctx->getPipeline()->getBufferAccount().add(-int64_t(charged_));
+      charged_ = 0;
+    }
+  }
+
+  void flushIfOverLimits() {
+    if ((maxBufferedBytes_ > 0 && bufferedBytes_ >= maxBufferedBytes_) ||
+        (maxBufferedSegments_ > 0 &&
+         bufferedSegments_ >= maxBufferedSegments_)) {
+      flush();
+    }
+  }
+
+  void flush() {
+    cancelScheduledFlush();
+    if (!sends_) {
+      return;
+    }
+    bufferedBytes_ = 0;
+    bufferedSegments_ = 0;
+
+    RequestTrace::Scope traceScope(traceId_);
+    traceId_ = 0;
+    RequestTrace::record("flushed");
+
+    auto ctx = getContext();
+    releaseCharge(ctx);
+    auto pipeline = ctx->getPipeline();
+    const auto flags = pipeline->getWriteFlags();
+    if (corked_) {
+      pipeline->setWriteFlags(flags | folly::WriteFlags::CORK);
+    }
+    if (!promisePending_) {
+      // Nobody is waiting on this batch, keep the whole path promise-free
+      ctx->fireWriteNoFuture(std::move(sends_));
+    } else {
+      promisePending_ = false;
+      folly::MoveWrapper<folly::SharedPromise<folly::Unit>> sharedPromise;
+      std::swap(*sharedPromise, sharedPromise_);
+      ctx->fireWrite(std::move(sends_))
+        .then([sharedPromise](folly::Try<folly::Unit> t) mutable {
+          sharedPromise->setTry(std::move(t));
+        });
+    }
+    if (corked_) {
+      pipeline->setWriteFlags(flags);
+    }
+  }
+
+  uint64_t maxBufferedBytes_{0};
+  size_t maxBufferedSegments_{0};
+  std::chrono::milliseconds flushDelay_{0};
+  bool corked_{false};
+  uint64_t bufferedBytes_{0};
+  size_t bufferedSegments_{0};
+  // Added to the pipeline's buffer account for the writes in sends_
+  uint64_t charged_{0};
+  // The RequestTrace of the first traced write in sends_, if any
+  uint64_t traceId_{0};
+  std::unique_ptr<FlushTimeout> flushTimeout_;
 };
 
 } // namespace wangle
@@ -0,0 +1,55 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/channel/PipePool.h>
+
+#include <folly/ThreadLocal.h>
+#include <unistd.h>
+
+namespace {
+
+folly::ThreadLocal<wangle::PipePool> pipePool;
+
+}
+
+namespace wangle {
+
+constexpr size_t PipePool::kMaxPipes;
+
+PipePool::~PipePool() {
+  for (auto& p : pipes_) {
+    ::close(p.first);
+    ::close(p.second);
+  }
+}
+
+PipePool& PipePool::local() {
+  return *pipePool;
+}
+
+bool PipePool::get(int fds[2]) {
+  if (pipes_.empty()) {
+    return false;
+  }
+  fds[0] = pipes_.back().first;
+  fds[1] = pipes_.back().second;
+  pipes_.pop_back();
+  return true;
+}
+
+void PipePool::put(int readFd, int writeFd) {
+  if (pipes_.size() >= kMaxPipes) {
+    ::close(readFd);
+    ::close(writeFd);
+    return;
+  }
+  pipes_.emplace_back(readFd, writeFd);
+}
+
+}
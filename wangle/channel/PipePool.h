@@ -0,0 +1,36 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <utility>
+#include <vector>
+
+namespace wangle {
+
+// Pipes left empty by finished splice transfers, kept by the thread that
+// created them so that transfers don't pay for pipe2() and F_SETPIPE_SZ
+// each time
+class PipePool {
+ public:
+  ~PipePool();
+
+  // This thread's pool
+  static PipePool& local();
+
+  bool get(int fds[2]);
+
+  void put(int readFd, int writeFd);
+
+ private:
+  static constexpr size_t kMaxPipes = 16;
+  std::vector<std::pair<int, int>> pipes_;
+};
+
+}
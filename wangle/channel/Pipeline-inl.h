@@ -97,6 +97,85 @@ PipelineBase& PipelineBase::remove(H* handler) {
   return removeHelper<H>(handler, true);
 }
 
+template <class H>
+size_t PipelineBase::indexOf(H* handler) {
+  typedef typename ContextType<H>::type Context;
+  for (size_t i = 0; i < ctxs_.size(); i++) {
+    auto ctx = dynamic_cast<Context*>(ctxs_[i].get());
+    if (ctx && ctx->getHandler() == handler) {
+      return i;
+    }
+  }
+  throw std::invalid_argument("No such handler in pipeline");
+}
+
+template <class H>
+PipelineBase& PipelineBase::insertHelper(
+    std::shared_ptr<H> handler,
+    size_t pos) {
+  typedef typename ContextType<H>::type Context;
+  insertContext(
+      std::make_shared<Context>(shared_from_this(), std::move(handler)), pos);
+  return *this;
+}
+
+template <class H>
+PipelineBase& PipelineBase::insertFront(std::shared_ptr<H> handler) {
+  return insertHelper(std::move(handler), 0);
+}
+
+template <class H>
+PipelineBase& PipelineBase::insertFront(H* handler) {
+  return insertFront(std::shared_ptr<H>(handler, [](H*){}));
+}
+
+template <class H>
+PipelineBase& PipelineBase::insertBack(std::shared_ptr<H> handler) {
+  return insertHelper(std::move(handler), ctxs_.size());
+}
+
+template <class H>
+PipelineBase& PipelineBase::insertBack(H* handler) {
+  return insertBack(std::shared_ptr<H>(handler, [](H*){}));
+}
+
+template <class H, class Neighbor>
+PipelineBase& PipelineBase::insertBefore(
+    Neighbor* neighbor,
+    std::shared_ptr<H> handler) {
+  return insertHelper(std::move(handler), indexOf(neighbor));
+}
+
+template <class H, class Neighbor>
+PipelineBase& PipelineBase::insertAfter(
+    Neighbor* neighbor,
+    std::shared_ptr<H> handler) {
+  return insertHelper(std::move(handler), indexOf(neighbor) + 1);
+}
+
+template <class H>
+PipelineBase& PipelineBase::unlinkHelper(H* handler, bool checkEqual) {
+  typedef typename ContextType<H>::type Context;
+  for (size_t i = 0; i < ctxs_.size(); i++) {
+    auto ctx = dynamic_cast<Context*>(ctxs_[i].get());
+    if (ctx && (!checkEqual || ctx->getHandler() == handler)) {
+      unlinkContext(i);
+      return *this;
+    }
+  }
+  throw std::invalid_argument("No such handler in pipeline");
+}
+
+template <class H>
+PipelineBase& PipelineBase::unlink(H* handler) {
+  return unlinkHelper<H>(handler, true);
+}
+
+template <class H>
+PipelineBase& PipelineBase::unlink() {
+  return unlinkHelper<H>(nullptr, false);
+}
+
 template <class H>
 H* PipelineBase::getHandler(int i) {
   return getContext<H>(i)->getHandler();
@@ -182,6 +261,16 @@ Pipeline<R, W>::read(R msg) {
   front_->read(std::forward<R>(msg));
 }
 
+template <class R, class W>
+template <class T>
+typename std::enable_if<!std::is_same<T, folly::Unit>::value>::type
+Pipeline<R, W>::readBatch(MessageBatch<R> msgs) {
+  if (!front_) {
+    throw std::invalid_argument("readBatch(): no inbound handler in Pipeline");
+  }
+  front_->readBatch(msgs);
+}
+
 template <class R, class W>
 template <class T>
 typename std::enable_if<!std::is_same<T, folly::Unit>::value>::type
@@ -210,6 +299,15 @@ Pipeline<R, W>::transportInactive() {
   }
 }
 
+template <class R, class W>
+template <class T>
+typename std::enable_if<!std::is_same<T, folly::Unit>::value>::type
+Pipeline<R, W>::writabilityChanged(bool writable) {
+  if (front_) {
+    front_->writabilityChanged(writable);
+  }
+}
+
 template <class R, class W>
 template <class T>
 typename std::enable_if<!std::is_same<T, folly::Unit>::value>::type
@@ -232,6 +330,17 @@ Pipeline<R, W>::write(W msg) {
   return back_->write(std::forward<W>(msg));
 }
 
+template <class R, class W>
+template <class T>
+typename std::enable_if<!std::is_same<T, folly::Unit>::value>::type
+Pipeline<R, W>::writeNoFuture(W msg) {
+  if (!back_) {
+    throw std::invalid_argument(
+        "writeNoFuture(): no outbound handler in Pipeline");
+  }
+  back_->writeNoFuture(std::forward<W>(msg));
+}
+
 template <class R, class W>
 template <class T>
 typename std::enable_if<!std::is_same<T, folly::Unit>::value,
@@ -255,23 +364,43 @@ Pipeline<R, W>::close() {
   return back_->close();
 }
 
+template <class R, class W>
+void Pipeline<R, W>::setFrontLink(PipelineContext* ctx) {
+  auto front = dynamic_cast<InboundLink<R>*>(ctx);
+  if (ctx && !front) {
+    throw std::invalid_argument("inbound type mismatch at pipeline front");
+  }
+  front_ = front;
+}
+
+template <class R, class W>
+void Pipeline<R, W>::setBackLink(PipelineContext* ctx) {
+  auto back = dynamic_cast<OutboundLink<W>*>(ctx);
+  if (ctx && !back) {
+    throw std::invalid_argument("outbound type mismatch at pipeline back");
+  }
+  back_ = back;
+}
+
 // TODO Have read/write/etc check that pipeline has been finalized
 template <class R, class W>
 void Pipeline<R, W>::finalize() {
+  updateInstrumentedLinks();
+
   front_ = nullptr;
   if (!inCtxs_.empty()) {
-    front_ = dynamic_cast<InboundLink<R>*>(inCtxs_.front());
+    front_ = dynamic_cast<InboundLink<R>*>(linkTo(inCtxs_.front()));
     for (size_t i = 0; i < inCtxs_.size() - 1; i++) {
-      inCtxs_[i]->setNextIn(inCtxs_[i+1]);
+      inCtxs_[i]->setNextIn(linkTo(inCtxs_[i+1]));
     }
     inCtxs_.back()->setNextIn(nullptr);
   }
 
   back_ = nullptr;
   if (!outCtxs_.empty()) {
-    back_ = dynamic_cast<OutboundLink<W>*>(outCtxs_.back());
+    back_ = dynamic_cast<OutboundLink<W>*>(linkTo(outCtxs_.back()));
     for (size_t i = outCtxs_.size() - 1; i > 0; i--) {
-      outCtxs_[i]->setNextOut(outCtxs_[i-1]);
+      outCtxs_[i]->setNextOut(linkTo(outCtxs_[i-1]));
     }
     outCtxs_.front()->setNextOut(nullptr);
   }
@@ -10,6 +10,8 @@
 
 #include <wangle/channel/Pipeline.h>
 
+#include <algorithm>
+
 using folly::WriteFlags;
 
 namespace wangle {
@@ -22,6 +24,18 @@ WriteFlags PipelineBase::getWriteFlags() {
   return writeFlags_;
 }
 
+void PipelineBase::setWriteErrorCallback(WriteErrorCallback cb) {
+  writeErrorCallback_ = std::move(cb);
+}
+
+void PipelineBase::notifyWriteError(folly::exception_wrapper e) {
+  if (writeErrorCallback_) {
+    writeErrorCallback_(std::move(e));
+  } else {
+    VLOG(5) << "Unhandled error in writeNoFuture(): " << e.what();
+  }
+}
+
 void PipelineBase::setReadBufferSettings(
     uint64_t minAvailable,
     uint64_t allocationSize) {
@@ -32,6 +46,104 @@ std::pair<uint64_t, uint64_t> PipelineBase::getReadBufferSettings() {
   return readBufferSettings_;
 }
 
+void PipelineBase::setAdaptiveReadBufferLimits(
+    uint64_t minAllocation,
+    uint64_t maxAllocation) {
+  DCHECK_LE(minAllocation, maxAllocation);
+  adaptiveReadBufferLimits_ = std::make_pair(minAllocation, maxAllocation);
+}
+
+std::pair<uint64_t, uint64_t> PipelineBase::getAdaptiveReadBufferLimits() {
+  return adaptiveReadBufferLimits_;
+}
+
+void PipelineBase::setWriteBufferWatermarks(uint64_t low, uint64_t high) {
+  DCHECK_LE(low, high);
+  writeBufferWatermarks_ = std::make_pair(low, high);
+}
+
+std::pair<uint64_t, uint64_t> PipelineBase::getWriteBufferWatermarks() {
+  return writeBufferWatermarks_;
+}
+
+void PipelineBase::setInstrumentation(uint32_t sampleRate) {
+  instrumentationSampleRate_ = sampleRate;
+}
+
+void PipelineBase::getHandlerStats(const HandlerStatsCallback& cb) {
+  for (auto& link : instrumentedLinks_) {
+    cb(link->stats());
+  }
+}
+
+void PipelineBase::updateInstrumentedLinks() {
+  std::vector<std::unique_ptr<detail::InstrumentedLinkBase>> links;
+  if (instrumentationSampleRate_ > 0) {
+    for (auto& ctx : ctxs_) {
+      auto it = std::find_if(
+          instrumentedLinks_.begin(),
+          instrumentedLinks_.end(),
+          [&](const std::unique_ptr<detail::InstrumentedLinkBase>& link) {
+            return link && link->target() == ctx.get();
+          });
+      if (it != instrumentedLinks_.end()) {
+        (*it)->setSampleRate(instrumentationSampleRate_);
+        links.push_back(std::move(*it));
+      } else {
+        auto link = ctx->makeInstrumentedLink(
+            shared_from_this(), instrumentationSampleRate_);
+        if (link) {
+          links.push_back(std::move(link));
+        }
+      }
+    }
+  }
+  instrumentedLinks_ = std::move(links);
+}
+
+PipelineArena& PipelineBase::getArena() {
+  if (!arena_) {
+    arena_ = arenaBlockPool_
+      ? folly::make_unique<PipelineArena>(arenaBlockPool_)
+      : folly::make_unique<PipelineArena>();
+  }
+  return *arena_;
+}
+
+PipelineContext* PipelineBase::linkTo(PipelineContext* ctx) {
+  for (auto& link : instrumentedLinks_) {
+    if (link->target() == ctx) {
+      return link.get();
+    }
+  }
+  return ctx;
+}
+
+void PipelineBase::pauseRead() {
+  if (readPauseCount_++ == 0 && readPauseCallback_) {
+    readPauseCallback_(true);
+  }
+}
+
+void PipelineBase::resumeRead() {
+  DCHECK_GT(readPauseCount_, 0) << "resumeRead() without pauseRead()";
+  if (readPauseCount_ == 0) {
+    return;
+  }
+  if (--readPauseCount_ == 0 && readPauseCallback_) {
+    readPauseCallback_(false);
+  }
+}
+
+void PipelineBase::requestFinished(uint32_t n) {
+  DCHECK_GE(numRequests_, n) << "requestFinished() without requestStarted()";
+  numRequests_ -= std::min(numRequests_, n);
+}
+
+void PipelineBase::setReadPauseCallback(ReadPauseCallback cb) {
+  readPauseCallback_ = std::move(cb);
+}
+
 void PipelineBase::setTransportInfo(std::shared_ptr<TransportInfo> tInfo) {
   transportInfo_ = tInfo;
 }
@@ -60,6 +172,145 @@ typename PipelineBase::ContextIterator PipelineBase::removeAt(
   return ctxs_.erase(it);
 }
 
+void PipelineBase::linkIn(size_t i) {
+  auto next = i < inCtxs_.size() ? linkTo(inCtxs_[i]) : nullptr;
+  if (i > 0) {
+    inCtxs_[i - 1]->setNextIn(next);
+  } else {
+    setFrontLink(next);
+  }
+}
+
+void PipelineBase::linkOut(size_t i) {
+  auto next = i > 0 ? linkTo(outCtxs_[i - 1]) : nullptr;
+  if (i < outCtxs_.size()) {
+    outCtxs_[i]->setNextOut(next);
+  } else {
+    setBackLink(next);
+  }
+}
+
+void PipelineBase::insertContext(
+    std::shared_ptr<PipelineContext> ctx,
+    size_t pos) {
+  const auto dir = ctx->getDirection();
+  const bool in = dir == HandlerDir::BOTH || dir == HandlerDir::IN;
+  const bool out = dir == HandlerDir::BOTH || dir == HandlerDir::OUT;
+
+  size_t inPos = 0;
+  size_t outPos = 0;
+  size_t linkPos = 0;
+  for (size_t i = 0; i < pos; i++) {
+    const auto d = ctxs_[i]->getDirection();
+    inPos += d != HandlerDir::OUT;
+    outPos += d != HandlerDir::IN;
+    linkPos += linkTo(ctxs_[i].get()) != ctxs_[i].get();
+  }
+
+  ctxs_.insert(ctxs_.begin() + pos, ctx);
+  if (in) {
+    inCtxs_.insert(inCtxs_.begin() + inPos, ctx.get());
+  }
+  if (out) {
+    outCtxs_.insert(outCtxs_.begin() + outPos, ctx.get());
+  }
+  if (instrumentationSampleRate_ > 0) {
+    auto link =
+        ctx->makeInstrumentedLink(shared_from_this(), instrumentationSampleRate_);
+    if (link) {
+      instrumentedLinks_.insert(
+          instrumentedLinks_.begin() + linkPos, std::move(link));
+    }
+  }
+
+  try {
+    if (in) {
+      linkIn(inPos + 1);
+      linkIn(inPos);
+    }
+    if (out) {
+      linkOut(outPos);
+      linkOut(outPos + 1);
+    }
+  } catch (...) {
+    // Put the neighbours' links back the way they were
+    if (in) {
+      inCtxs_.erase(inCtxs_.begin() + inPos);
+      linkIn(inPos);
+    }
+    if (out) {
+      outCtxs_.erase(outCtxs_.begin() + outPos);
+      linkOut(outPos);
+    }
+    eraseInstrumentedLink(ctx.get());
+    ctxs_.erase(ctxs_.begin() + pos);
+    throw;
+  }
+
+  ctx->attachPipeline();
+}
+
+void PipelineBase::unlinkContext(size_t pos) {
+  // Keep the context alive until we're done with it
+  auto ctx = ctxs_[pos];
+  const auto dir = ctx->getDirection();
+  const bool in = dir == HandlerDir::BOTH || dir == HandlerDir::IN;
+  const bool out = dir == HandlerDir::BOTH || dir == HandlerDir::OUT;
+
+  size_t inPos = 0;
+  size_t outPos = 0;
+  if (in) {
+    auto it = std::find(inCtxs_.begin(), inCtxs_.end(), ctx.get());
+    CHECK(it != inCtxs_.end());
+    inPos = it - inCtxs_.begin();
+    inCtxs_.erase(it);
+  }
+  if (out) {
+    auto it = std::find(outCtxs_.begin(), outCtxs_.end(), ctx.get());
+    CHECK(it != outCtxs_.end());
+    outPos = it - outCtxs_.begin();
+    outCtxs_.erase(it);
+  }
+
+  try {
+    if (in) {
+      linkIn(inPos);
+    }
+    if (out) {
+      linkOut(outPos);
+    }
+  } catch (...) {
+    if (in) {
+      inCtxs_.insert(inCtxs_.begin() + inPos, ctx.get());
+      linkIn(inPos);
+    }
+    if (out) {
+      outCtxs_.insert(outCtxs_.begin() + outPos, ctx.get());
+      linkOut(outPos + 1);
+    }
+    throw;
+  }
+
+  ctx->detachPipeline();
+  eraseInstrumentedLink(ctx.get());
+  if (owner_ == ctx) {
+    owner_.reset();
+  }
+  ctxs_.erase(ctxs_.begin() + pos);
+}
+
+void PipelineBase::eraseInstrumentedLink(PipelineContext* ctx) {
+  auto it = std::find_if(
+      instrumentedLinks_.begin(),
+      instrumentedLinks_.end(),
+      [&](const std::unique_ptr<detail::InstrumentedLinkBase>& link) {
+        return link->target() == ctx;
+      });
+  if (it != instrumentedLinks_.end()) {
+    instrumentedLinks_.erase(it);
+  }
+}
+
 PipelineBase& PipelineBase::removeFront() {
   if (ctxs_.empty()) {
     throw std::invalid_argument("No handlers in pipeline");
@@ -76,6 +327,25 @@ PipelineBase& PipelineBase::removeBack() {
   return *this;
 }
 
+bool PipelineBase::reset() {
+  manager_ = nullptr;
+  transport_.reset();
+  transportInfo_.reset();
+  writable_ = true;
+  readPauseCount_ = 0;
+  numRequests_ = 0;
+  bool reusable = true;
+  for (auto& ctx : ctxs_) {
+    if (!ctx->resetHandler()) {
+      reusable = false;
+    }
+  }
+  if (arena_) {
+    arena_->clear();
+  }
+  return reusable;
+}
+
 void PipelineBase::detachHandlers() {
   for (auto& ctx : ctxs_) {
     if (ctx != owner_) {
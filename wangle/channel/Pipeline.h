@@ -20,12 +20,15 @@
 #include <folly/io/async/DelayedDestruction.h>
 #include <wangle/acceptor/SecureTransportType.h>
 #include <wangle/acceptor/TransportInfo.h>
+#include <wangle/channel/BufferAccounting.h>
 #include <wangle/channel/HandlerContext.h>
+#include <wangle/channel/PipelineArena.h>
 
 namespace wangle {
 
 class PipelineBase;
 class Acceptor;
+class ReadBufferPool;
 
 class PipelineManager {
  public:
@@ -63,12 +66,125 @@ class PipelineBase : public std::enable_shared_from_this<PipelineBase> {
   void setWriteFlags(folly::WriteFlags flags);
   folly::WriteFlags getWriteFlags();
 
+  // Invoked for transport errors on writes issued through writeNoFuture(),
+  // since there is no Future to carry them.
+  typedef std::function<void(folly::exception_wrapper)> WriteErrorCallback;
+  void setWriteErrorCallback(WriteErrorCallback cb);
+  void notifyWriteError(folly::exception_wrapper e);
+
   void setReadBufferSettings(uint64_t minAvailable, uint64_t allocationSize);
   std::pair<uint64_t, uint64_t> getReadBufferSettings();
 
+  // Makes AsyncSocketHandler read into buffers from pool, when they are at
+  // least minAvailable and adaptive sizing is off, instead of allocating
+  // them. Null, the default, turns it off.
+  void setReadBufferPool(std::shared_ptr<ReadBufferPool> pool) {
+    readBufferPool_ = std::move(pool);
+  }
+
+  ReadBufferPool* getReadBufferPool() {
+    return readBufferPool_.get();
+  }
+
+  // Lets AsyncSocketHandler size each read buffer between minAllocation and
+  // maxAllocation depending on how much recent reads returned, starting from
+  // the allocation size above: it grows after reads that fill the buffer and
+  // shrinks after short ones. A maxAllocation of 0 (the default) disables it.
+  void setAdaptiveReadBufferLimits(
+      uint64_t minAllocation,
+      uint64_t maxAllocation);
+  std::pair<uint64_t, uint64_t> getAdaptiveReadBufferLimits();
+
+  // How many more inbound bytes the decoder needs before it can make
+  // progress, as reported by ByteToMessageDecoder. AsyncSocketHandler reads
+  // at least this much at once, up to the adaptive maxAllocation (or 64KB if
+  // adaptive sizing is off). 0 means unknown.
+  void setReadBytesNeeded(uint64_t bytes) {
+    readBytesNeeded_ = bytes;
+  }
+
+  uint64_t getReadBytesNeeded() {
+    return readBytesNeeded_;
+  }
+
+  // Outbound bytes queued in the transport beyond which the pipeline becomes
+  // unwritable, and at or below which it becomes writable again. Transport
+  // handlers such as AsyncSocketHandler track this and fire
+  // writabilityChanged() on transitions. A high watermark of 0 disables it.
+  void setWriteBufferWatermarks(uint64_t low, uint64_t high);
+  std::pair<uint64_t, uint64_t> getWriteBufferWatermarks();
+
+  bool isWritable() {
+    return writable_;
+  }
+
+  // Called by the transport handler
+  void setWritable(bool writable) {
+    writable_ = writable;
+  }
+
+  // Read backpressure: the transport handler stops reading from its
+  // transport while any pause is held, so a slow handler or overloaded
+  // executor downstream holds back the peer instead of buffering. Every
+  // pauseRead() must be matched by a resumeRead().
+  void pauseRead();
+  void resumeRead();
+
+  bool isReadPaused() {
+    return readPauseCount_ > 0;
+  }
+
+  // Requests being served, told by the handlers serving them, e.g. the
+  // server dispatchers, as each is dispatched and as its response is
+  // written or dropped. The connection counts as busy while there are any,
+  // see ServerAcceptor's ServerConnection::isBusy().
+  void requestStarted() {
+    numRequests_++;
+  }
+
+  void requestFinished(uint32_t n = 1);
+
+  uint32_t getNumRequests() const {
+    return numRequests_;
+  }
+
+  // Set by the transport handler to be told when reads get paused and resumed
+  typedef std::function<void(bool paused)> ReadPauseCallback;
+  void setReadPauseCallback(ReadPauseCallback cb);
+
+  // Opt-in per-handler instrumentation, taking effect at the next
+  // finalize(). Every handler then gets a link in front of it that counts
+  // the calls, messages and bytes it receives and times one call in
+  // sampleRate (for writes, only the synchronous part). A sampleRate of 0,
+  // the default, disables it and leaves the handlers linked directly, at no
+  // cost. Handlers of a FixedStaticPipeline are not instrumented.
+  void setInstrumentation(uint32_t sampleRate);
+
+  // Invokes cb with the stats of each instrumented handler, front to back
+  typedef std::function<void(const HandlerStats&)> HandlerStatsCallback;
+  void getHandlerStats(const HandlerStatsCallback& cb);
+
   void setTransportInfo(std::shared_ptr<TransportInfo> tInfo);
   std::shared_ptr<TransportInfo> getTransportInfo();
 
+  // Arena for per-connection handler state, created on first use. Everything
+  // in it is released at once when the pipeline is destroyed or reset() for
+  // reuse, so handlers must not keep pointers into it past either.
+  PipelineArena& getArena();
+
+  // Pool the arena takes its blocks from, e.g. one of hugepage-backed
+  // buffers (see ReadBufferPool). Must be set before the arena's first use.
+  void setArenaBlockPool(std::shared_ptr<ReadBufferPool> pool) {
+    arenaBlockPool_ = std::move(pool);
+  }
+
+  // The bytes the pipeline's handlers hold buffered, charged to the
+  // process-wide BufferAccounting. Handlers buffering data add to it, and
+  // take back what they added when they drop it or are detached.
+  BufferAccounting::Account& getBufferAccount() {
+    return bufferAccount_;
+  }
+
   template <class H>
   PipelineBase& addBack(std::shared_ptr<H> handler);
 
@@ -97,6 +213,36 @@ class PipelineBase : public std::enable_shared_from_this<PipelineBase> {
 
   PipelineBase& removeBack();
 
+  // Variants of addFront()/addBack() and remove() for a pipeline that is
+  // already finalized, possibly with traffic flowing: rather than needing a
+  // finalize(), they relink only the neighbours of the handler and attach or
+  // detach only the handler itself. Throw std::invalid_argument, leaving the
+  // pipeline as it was, if the handler's types don't fit with its
+  // neighbours' or the handler to insert next to isn't in the pipeline.
+  template <class H>
+  PipelineBase& insertFront(std::shared_ptr<H> handler);
+
+  template <class H>
+  PipelineBase& insertFront(H* handler);
+
+  template <class H>
+  PipelineBase& insertBack(std::shared_ptr<H> handler);
+
+  template <class H>
+  PipelineBase& insertBack(H* handler);
+
+  template <class H, class Neighbor>
+  PipelineBase& insertBefore(Neighbor* neighbor, std::shared_ptr<H> handler);
+
+  template <class H, class Neighbor>
+  PipelineBase& insertAfter(Neighbor* neighbor, std::shared_ptr<H> handler);
+
+  template <class H>
+  PipelineBase& unlink(H* handler);
+
+  template <class H>
+  PipelineBase& unlink();
+
   template <class H>
   H* getHandler(int i);
 
@@ -118,17 +264,44 @@ class PipelineBase : public std::enable_shared_from_this<PipelineBase> {
 
   virtual void finalize() = 0;
 
+  // Prepares the pipeline to be reused for another connection: drops the
+  // transport, transport info, manager and read pauses, and asks every
+  // handler to reset().
+  // Settings such as write flags and buffer sizes are kept, and the arena is
+  // cleared once the handlers are reset. Returns false if
+  // some handler can't be reset, in which case the pipeline must not be
+  // reused.
+  bool reset();
+
  protected:
   template <class Context>
   void addContextFront(Context* ctx);
 
   void detachHandlers();
 
+  // (Re)creates the instrumented links for the current handlers, keeping the
+  // stats of handlers that were already instrumented
+  void updateInstrumentedLinks();
+
+  // The link the previous handler should forward to in order to reach ctx
+  PipelineContext* linkTo(PipelineContext* ctx);
+
+  // Set the first inbound and last outbound link, for insert*() and
+  // unlink(). Throw std::invalid_argument on a type mismatch.
+  virtual void setFrontLink(PipelineContext* ctx) = 0;
+  virtual void setBackLink(PipelineContext* ctx) = 0;
+
+  // Declared ahead of the contexts so that it outlives their handlers
+  std::unique_ptr<PipelineArena> arena_;
+
   std::vector<std::shared_ptr<PipelineContext>> ctxs_;
   std::vector<PipelineContext*> inCtxs_;
   std::vector<PipelineContext*> outCtxs_;
 
  private:
+  template <class R, class W, class LastIn, class LastOut>
+  friend class PipelineBuilder;
+
   PipelineManager* manager_{nullptr};
   std::shared_ptr<folly::AsyncTransport> transport_;
   std::shared_ptr<TransportInfo> transportInfo_;
@@ -139,13 +312,46 @@ class PipelineBase : public std::enable_shared_from_this<PipelineBase> {
   template <class H>
   PipelineBase& removeHelper(H* handler, bool checkEqual);
 
+  template <class H>
+  size_t indexOf(H* handler);
+
+  template <class H>
+  PipelineBase& insertHelper(std::shared_ptr<H> handler, size_t pos);
+
+  template <class H>
+  PipelineBase& unlinkHelper(H* handler, bool checkEqual);
+
+  // Links ctx, already in ctxs_ at pos, in between its neighbours
+  void insertContext(std::shared_ptr<PipelineContext> ctx, size_t pos);
+  void unlinkContext(size_t pos);
+
+  // Point the inbound handler before inCtxs_[i] (or the front) at it, and
+  // outCtxs_[i] (or the back) at the outbound handler before it
+  void linkIn(size_t i);
+  void linkOut(size_t i);
+  void eraseInstrumentedLink(PipelineContext* ctx);
+
   typedef std::vector<std::shared_ptr<PipelineContext>>::iterator
     ContextIterator;
 
   ContextIterator removeAt(const ContextIterator& it);
 
   folly::WriteFlags writeFlags_{folly::WriteFlags::NONE};
+  WriteErrorCallback writeErrorCallback_;
   std::pair<uint64_t, uint64_t> readBufferSettings_{2048, 2048};
+  std::pair<uint64_t, uint64_t> adaptiveReadBufferLimits_{0, 0};
+  std::shared_ptr<ReadBufferPool> readBufferPool_;
+  std::shared_ptr<ReadBufferPool> arenaBlockPool_;
+  uint64_t readBytesNeeded_{0};
+  std::pair<uint64_t, uint64_t> writeBufferWatermarks_{0, 0};
+  bool writable_{true};
+  uint32_t readPauseCount_{0};
+  uint32_t numRequests_{0};
+  ReadPauseCallback readPauseCallback_;
+  BufferAccounting::Account bufferAccount_;
+  uint32_t instrumentationSampleRate_{0};
+  std::vector<std::unique_ptr<detail::InstrumentedLinkBase>>
+    instrumentedLinks_;
 
   std::shared_ptr<PipelineContext> owner_;
 };
@@ -164,7 +370,10 @@ class Pipeline : public PipelineBase {
   using Ptr = std::shared_ptr<Pipeline>;
 
   static Ptr create() {
-    return std::shared_ptr<Pipeline>(new Pipeline());
+    // Derived only to reach the protected constructor, so the pipeline and
+    // its control block share one allocation
+    struct Shared : Pipeline {};
+    return std::make_shared<Shared>();
   }
 
   ~Pipeline();
@@ -173,6 +382,10 @@ class Pipeline : public PipelineBase {
   typename std::enable_if<!std::is_same<T, folly::Unit>::value>::type
   read(R msg);
 
+  template <class T = R>
+  typename std::enable_if<!std::is_same<T, folly::Unit>::value>::type
+  readBatch(MessageBatch<R> msgs);
+
   template <class T = R>
   typename std::enable_if<!std::is_same<T, folly::Unit>::value>::type
   readEOF();
@@ -189,11 +402,21 @@ class Pipeline : public PipelineBase {
   typename std::enable_if<!std::is_same<T, folly::Unit>::value>::type
   transportInactive();
 
+  template <class T = R>
+  typename std::enable_if<!std::is_same<T, folly::Unit>::value>::type
+  writabilityChanged(bool writable);
+
   template <class T = W>
   typename std::enable_if<!std::is_same<T, folly::Unit>::value,
                           folly::Future<folly::Unit>>::type
   write(W msg);
 
+  // Fire-and-forget variant of write(). No Future is built along the path
+  // for handlers that implement writeNoFuture(); see Handler.h.
+  template <class T = W>
+  typename std::enable_if<!std::is_same<T, folly::Unit>::value>::type
+  writeNoFuture(W msg);
+
   template <class T = W>
   typename std::enable_if<!std::is_same<T, folly::Unit>::value,
                           folly::Future<folly::Unit>>::type
@@ -210,7 +433,13 @@ class Pipeline : public PipelineBase {
   Pipeline();
   explicit Pipeline(bool isStatic);
 
+  void setFrontLink(PipelineContext* ctx) override;
+  void setBackLink(PipelineContext* ctx) override;
+
  private:
+  template <class, class, class, class>
+  friend class PipelineBuilder;
+
   bool isStatic_{false};
 
   InboundLink<R>* front_{nullptr};
@@ -238,6 +467,23 @@ class PipelineFactory {
   virtual typename Pipeline::Ptr newPipeline(
       std::shared_ptr<folly::AsyncTransportWrapper>) = 0;
 
+  // Pipeline recycling, used by ServerAcceptor to avoid building a new
+  // pipeline for every connection. When a connection's pipeline is deleted,
+  // recyclePipeline() is offered it; returning true (typically the result of
+  // PipelineBase::reset()) keeps it in a per-EventBase pool, and a later
+  // connection is given it through reusePipeline() instead of newPipeline().
+  // reusePipeline() should attach the new transport to the pipeline's
+  // handlers and return it.
+  virtual bool recyclePipeline(Pipeline* /*pipeline*/) {
+    return false;
+  }
+
+  virtual typename Pipeline::Ptr reusePipeline(
+      typename Pipeline::Ptr /*pipeline*/,
+      std::shared_ptr<folly::AsyncTransportWrapper> transport) {
+    return newPipeline(std::move(transport));
+  }
+
   virtual ~PipelineFactory() = default;
 };
 
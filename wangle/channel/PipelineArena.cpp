@@ -0,0 +1,136 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/PipelineArena.h>
+
+#include <wangle/channel/ReadBufferPool.h>
+
+#include <glog/logging.h>
+#include <cstdint>
+
+namespace wangle {
+
+namespace {
+
+char* alignUp(char* p, size_t align) {
+  auto addr = reinterpret_cast<uintptr_t>(p);
+  return reinterpret_cast<char*>((addr + align - 1) & ~(uintptr_t(align) - 1));
+}
+
+}
+
+constexpr size_t PipelineArena::kDefaultBlockSize;
+
+PipelineArena::PipelineArena(size_t blockSize) : blockSize_(blockSize) {
+  CHECK_GT(blockSize_, 0);
+}
+
+PipelineArena::PipelineArena(std::shared_ptr<ReadBufferPool> blockPool)
+  : blockPool_(std::move(blockPool)),
+    blockSize_(blockPool_->getBufferSize()) {}
+
+PipelineArena::~PipelineArena() {
+  clear();
+  if (!blockPool_) {
+    for (auto& block : blocks_) {
+      ::operator delete(block.data);
+    }
+  }
+}
+
+void* PipelineArena::allocate(size_t size, size_t align) {
+  DCHECK(align > 0 && (align & (align - 1)) == 0)
+    << "alignment must be a power of two";
+  if (size == 0) {
+    size = 1;
+  }
+  bytesUsed_ += size;
+
+  if (ptr_) {
+    char* p = alignUp(ptr_, align);
+    if (p + size <= end_) {
+      ptr_ = p + size;
+      return p;
+    }
+  }
+
+  if (size + align > blockSize_) {
+    char* data = newBlock(size + align);
+    largeBlocks_.push_back(Block{data, size + align});
+    return alignUp(data, align);
+  }
+
+  // Move on to the next standard block, reusing one from before the last
+  // clear() if there is one
+  size_t next = ptr_ ? current_ + 1 : 0;
+  if (next == blocks_.size()) {
+    blocks_.push_back(Block{newStandardBlock(), blockSize_});
+  }
+  current_ = next;
+  end_ = blocks_[current_].data + blockSize_;
+  char* p = alignUp(blocks_[current_].data, align);
+  ptr_ = p + size;
+  return p;
+}
+
+void PipelineArena::clear() {
+  runDestructors();
+  for (auto& block : largeBlocks_) {
+    ::operator delete(block.data);
+  }
+  largeBlocks_.clear();
+  current_ = 0;
+  ptr_ = nullptr;
+  end_ = nullptr;
+  bytesUsed_ = 0;
+}
+
+size_t PipelineArena::totalSize() const {
+  size_t total = 0;
+  for (auto& block : blocks_) {
+    total += block.size;
+  }
+  for (auto& block : largeBlocks_) {
+    total += block.size;
+  }
+  return total;
+}
+
+void PipelineArena::registerDestructor(void* obj, void (*destroy)(void*)) {
+  auto d = static_cast<Destructor*>(
+      allocate(sizeof(Destructor), alignof(Destructor)));
+  d->destroy = destroy;
+  d->obj = obj;
+  d->next = destructors_;
+  destructors_ = d;
+}
+
+void PipelineArena::runDestructors() {
+  // Most recently created first
+  while (destructors_) {
+    auto d = destructors_;
+    destructors_ = d->next;
+    d->destroy(d->obj);
+  }
+}
+
+char* PipelineArena::newBlock(size_t size) {
+  return static_cast<char*>(::operator new(size));
+}
+
+char* PipelineArena::newStandardBlock() {
+  if (!blockPool_) {
+    return newBlock(blockSize_);
+  }
+  pooledBlocks_.push_back(blockPool_->get());
+  return reinterpret_cast<char*>(pooledBlocks_.back()->writableData());
+}
+
+} // namespace wangle
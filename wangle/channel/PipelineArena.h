@@ -0,0 +1,107 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/io/IOBuf.h>
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace wangle {
+
+class ReadBufferPool;
+
+/*
+ * Bump allocator for state that lives as long as a connection, such as
+ * handler scratch buffers and small request objects. Memory is carved out of
+ * fixed-size blocks (larger requests get a block of their own) and is never
+ * freed individually: clear() releases everything at once, running the
+ * destructors of objects made with create() and keeping the standard-sized
+ * blocks for reuse, and destroying the arena frees the blocks.
+ *
+ * Standard blocks may come from a ReadBufferPool instead, e.g. one of
+ * hugepage-backed buffers (see PipelineBase::setArenaBlockPool()), making
+ * them blocks of the pool's buffer size.
+ *
+ * Not thread safe; use it from the pipeline's EventBase thread only.
+ */
+class PipelineArena {
+ public:
+  static constexpr size_t kDefaultBlockSize = 4096;
+
+  explicit PipelineArena(size_t blockSize = kDefaultBlockSize);
+  explicit PipelineArena(std::shared_ptr<ReadBufferPool> blockPool);
+  ~PipelineArena();
+
+  PipelineArena(const PipelineArena&) = delete;
+  PipelineArena& operator=(const PipelineArena&) = delete;
+
+  void* allocate(size_t size, size_t align = alignof(std::max_align_t));
+
+  // Constructs a T in the arena. Its destructor, if it has one that does
+  // anything, runs at clear() or destruction of the arena.
+  template <class T, class... Args>
+  T* create(Args&&... args) {
+    void* mem = allocate(sizeof(T), alignof(T));
+    T* obj = new (mem) T(std::forward<Args>(args)...);
+    if (!std::is_trivially_destructible<T>::value) {
+      registerDestructor(obj, [](void* p) { static_cast<T*>(p)->~T(); });
+    }
+    return obj;
+  }
+
+  void clear();
+
+  // Bytes handed out since the last clear()
+  size_t bytesUsed() const {
+    return bytesUsed_;
+  }
+
+  // Bytes held in blocks, including free ones
+  size_t totalSize() const;
+
+ private:
+  struct Block {
+    char* data;
+    size_t size;
+  };
+
+  struct Destructor {
+    void (*destroy)(void*);
+    void* obj;
+    Destructor* next;
+  };
+
+  void registerDestructor(void* obj, void (*destroy)(void*));
+  void runDestructors();
+  char* newBlock(size_t size);
+  char* newStandardBlock();
+
+  const std::shared_ptr<ReadBufferPool> blockPool_;
+  const size_t blockSize_;
+  // Standard-sized blocks, blocks_[0, current_] in use
+  std::vector<Block> blocks_;
+  // Owning blocks_, if from blockPool_
+  std::vector<std::unique_ptr<folly::IOBuf>> pooledBlocks_;
+  size_t current_{0};
+  // Blocks for allocations larger than blockSize_, freed by clear()
+  std::vector<Block> largeBlocks_;
+  char* ptr_{nullptr};
+  char* end_{nullptr};
+  Destructor* destructors_{nullptr};
+  size_t bytesUsed_{0};
+};
+
+} // namespace wangle
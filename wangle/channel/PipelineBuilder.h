@@ -0,0 +1,228 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <type_traits>
+
+#include <wangle/channel/Pipeline.h>
+
+namespace wangle {
+
+namespace detail {
+
+// What the inbound handler after LastIn reads: what LastIn fires, or what
+// the pipeline is read with if it's the first one
+template <class R, class LastIn>
+struct NextInbound {
+  typedef typename LastIn::rout type;
+};
+
+template <class R>
+struct NextInbound<R, void> {
+  typedef R type;
+};
+
+// Whether the outbound handler writing Wout out can come after LastOut,
+// that is, whether LastOut writes Wout in
+template <class LastOut, class Wout>
+struct OutboundFits : std::is_same<typename LastOut::win, Wout> {};
+
+template <class Wout>
+struct OutboundFits<void, Wout> : std::true_type {};
+
+template <class H>
+struct BuilderContext {
+  typedef typename ContextType<H>::type type;
+};
+
+template <>
+struct BuilderContext<void> {
+  typedef PipelineContext type;
+};
+
+} // namespace detail
+
+/*
+ * Builds a Pipeline front to back like its addBack(), for the pipelines a
+ * PipelineFactory builds for every connection. The types of adjacent
+ * handlers are checked at compile time (a mismatch is a static_assert
+ * rather than std::invalid_argument from finalize()) and the contexts are
+ * linked as they are added, so finalize() needs none of the dynamic_casts
+ * Pipeline::finalize() resolves the links with. For example:
+ *
+ *   auto pipeline = DefaultPipeline::create();
+ *   PipelineBuilder<folly::IOBufQueue&, std::unique_ptr<folly::IOBuf>>(
+ *       pipeline)
+ *     .addBack(AsyncSocketHandler(sock))
+ *     .addBack(LineBasedFrameDecoder(8192))
+ *     .addBack(StringCodec())
+ *     .addBack(EchoHandler())
+ *     .finalize();
+ *
+ * The pipeline must be empty to begin with. It's a regular Pipeline once
+ * built: handlers can be added and removed and it can be finalized again,
+ * the usual way. With instrumentation on, finalize() falls back to
+ * Pipeline::finalize(), which splices the instrumented links in.
+ */
+template <class R, class W, class LastIn = void, class LastOut = void>
+class PipelineBuilder {
+  typedef typename detail::BuilderContext<LastIn>::type LastInContext;
+  typedef typename detail::BuilderContext<LastOut>::type LastOutContext;
+  typedef std::integral_constant<bool, !std::is_void<LastIn>::value>
+    HasLastIn;
+  typedef std::integral_constant<bool, !std::is_void<LastOut>::value>
+    HasLastOut;
+
+  template <class H>
+  using Next = PipelineBuilder<
+    R, W,
+    typename std::conditional<H::dir != HandlerDir::OUT, H, LastIn>::type,
+    typename std::conditional<H::dir != HandlerDir::IN, H, LastOut>::type>;
+
+ public:
+  explicit PipelineBuilder(typename Pipeline<R, W>::Ptr pipeline)
+      : pipeline_(std::move(pipeline)) {
+    static_assert(!HasLastIn::value && !HasLastOut::value,
+                  "PipelineBuilder starts with an empty pipeline");
+    CHECK(pipeline_->ctxs_.empty());
+  }
+
+  template <class H>
+  Next<H> addBack(std::shared_ptr<H> handler) {
+    static_assert(H::dir == HandlerDir::OUT ||
+                  std::is_same<typename H::rin,
+                               typename detail::NextInbound<
+                                 R, LastIn>::type>::value,
+                  "inbound type mismatch: the handler doesn't read what the "
+                  "one before it fires");
+    static_assert(H::dir == HandlerDir::IN ||
+                  detail::OutboundFits<LastOut, typename H::wout>::value,
+                  "outbound type mismatch: the handler doesn't write what "
+                  "the one before it takes");
+    typedef typename ContextType<H>::type Context;
+    auto ctx = std::make_shared<Context>(pipeline_, std::move(handler));
+    auto raw = ctx.get();
+    pipeline_->addHelper(std::move(ctx), false);
+    auto lastIn = addIn(
+        raw, std::integral_constant<bool, H::dir != HandlerDir::OUT>());
+    auto lastOut = addOut(
+        raw, std::integral_constant<bool, H::dir != HandlerDir::IN>());
+    return Next<H>(pipeline_, front_, lastIn, lastOut);
+  }
+
+  template <class H>
+  Next<H> addBack(H&& handler) {
+    return addBack(std::make_shared<H>(std::forward<H>(handler)));
+  }
+
+  template <class H>
+  Next<H> addBack(H* handler) {
+    return addBack(std::shared_ptr<H>(handler, [](H*){}));
+  }
+
+  typename Pipeline<R, W>::Ptr finalize() {
+    static_assert(detail::OutboundFits<LastOut, W>::value,
+                  "outbound type mismatch at pipeline back");
+    if (pipeline_->instrumentationSampleRate_ > 0) {
+      pipeline_->finalize();
+      return pipeline_;
+    }
+
+    pipeline_->front_ = front_;
+    pipeline_->back_ = backLink(HasLastOut());
+    if (!front_) {
+      detail::logWarningIfNotUnit<R>(
+          "No inbound handler in Pipeline, inbound operations will throw "
+          "std::invalid_argument");
+    }
+    if (!pipeline_->back_) {
+      detail::logWarningIfNotUnit<W>(
+          "No outbound handler in Pipeline, outbound operations will throw "
+          "std::invalid_argument");
+    }
+
+    auto& ctxs = pipeline_->ctxs_;
+    for (auto it = ctxs.rbegin(); it != ctxs.rend(); it++) {
+      (*it)->attachPipeline();
+    }
+    return pipeline_;
+  }
+
+ private:
+  template <class, class, class, class>
+  friend class PipelineBuilder;
+
+  PipelineBuilder(typename Pipeline<R, W>::Ptr pipeline,
+                  InboundLink<R>* front,
+                  LastInContext* lastIn,
+                  LastOutContext* lastOut)
+      : pipeline_(std::move(pipeline)),
+        front_(front),
+        lastIn_(lastIn),
+        lastOut_(lastOut) {}
+
+  // An inbound handler goes after lastIn_, or first
+  template <class Context>
+  Context* addIn(Context* ctx, std::true_type) {
+    linkIn(ctx, HasLastIn());
+    return ctx;
+  }
+
+  template <class Context>
+  LastInContext* addIn(Context* /*ctx*/, std::false_type) {
+    return lastIn_;
+  }
+
+  template <class Context>
+  void linkIn(Context* ctx, std::true_type) {
+    lastIn_->linkNextIn(ctx);
+  }
+
+  template <class Context>
+  void linkIn(Context* ctx, std::false_type) {
+    front_ = ctx;
+  }
+
+  // An outbound handler writes out to lastOut_, if any
+  template <class Context>
+  Context* addOut(Context* ctx, std::true_type) {
+    linkOut(ctx, HasLastOut());
+    return ctx;
+  }
+
+  template <class Context>
+  LastOutContext* addOut(Context* /*ctx*/, std::false_type) {
+    return lastOut_;
+  }
+
+  template <class Context>
+  void linkOut(Context* ctx, std::true_type) {
+    ctx->linkNextOut(lastOut_);
+  }
+
+  template <class Context>
+  void linkOut(Context* /*ctx*/, std::false_type) {}
+
+  OutboundLink<W>* backLink(std::true_type) {
+    return lastOut_;
+  }
+
+  OutboundLink<W>* backLink(std::false_type) {
+    return nullptr;
+  }
+
+  typename Pipeline<R, W>::Ptr pipeline_;
+  InboundLink<R>* front_{nullptr};
+  LastInContext* lastIn_{nullptr};
+  LastOutContext* lastOut_{nullptr};
+};
+
+} // namespace wangle
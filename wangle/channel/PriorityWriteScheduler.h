@@ -0,0 +1,265 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_map>
+
+#include <folly/MoveWrapper.h>
+#include <folly/Optional.h>
+#include <folly/futures/Future.h>
+#include <folly/io/IOBuf.h>
+#include <folly/io/IOBufQueue.h>
+#include <folly/io/async/EventBase.h>
+#include <wangle/channel/Handler.h>
+
+namespace wangle {
+
+/*
+ * A write on one of the logical streams of a multiplexed connection.
+ * Streams of a lower priority value go first; streams of the same priority
+ * share the connection in proportion to their weights.
+ */
+struct StreamWrite {
+  uint32_t streamId{0};
+  uint8_t priority{0};
+  // 1 to 256
+  uint16_t weight{16};
+  std::unique_ptr<folly::IOBuf> buf;
+};
+
+/*
+ * PriorityWriteScheduler interleaves the writes of the streams of a
+ * multiplexed connection, so that a large response on one stream doesn't
+ * hold back small ones on the others behind it the way writing in arrival
+ * order does. Writes are split into chunks of up to chunkSize bytes; each
+ * stream's chunks go out in order, and the streams' chunks are interleaved
+ * by strict priority and, within a priority, by weighted fair queueing.
+ * With a framer, chunks are handed to it to be framed for the protocol,
+ * last being set on the last chunk of a write.
+ *
+ * Queued chunks are written once per event loop, for as long as the
+ * pipeline stays writable, and again once it becomes writable; set the
+ * pipeline's write buffer watermarks (see
+ * PipelineBase::setWriteBufferWatermarks()) so that the transport doesn't
+ * queue more than it must, or it gets everything at once, in order. A
+ * write's Future completes when the transport's for its last chunk does.
+ * A stream's priority and weight are those of the write that started its
+ * backlog.
+ *
+ * Put it between the protocol's codec and the transport handler. This
+ * handler may only be used in a single Pipeline.
+ */
+class PriorityWriteScheduler
+    : public Handler<folly::IOBufQueue&, folly::IOBufQueue&,
+                     StreamWrite, std::unique_ptr<folly::IOBuf>>,
+      protected folly::EventBase::LoopCallback {
+ public:
+  typedef std::function<std::unique_ptr<folly::IOBuf>(
+      uint32_t streamId, std::unique_ptr<folly::IOBuf> chunk, bool last)>
+    Framer;
+
+  struct Options {
+    uint64_t chunkSize{16384};
+    // Or the chunks go out as they are
+    Framer framer;
+  };
+
+  PriorityWriteScheduler() = default;
+
+  explicit PriorityWriteScheduler(Options options)
+    : options_(std::move(options)) {}
+
+  PriorityWriteScheduler(PriorityWriteScheduler&& other)
+    : options_(std::move(other.options_)) {}
+
+  // Bytes written to the scheduler but not yet passed on
+  uint64_t getQueuedBytes() const {
+    return queuedBytes_;
+  }
+
+  // Streams with writes queued
+  size_t getNumStreams() const {
+    return streams_.size();
+  }
+
+  void read(Context* ctx, folly::IOBufQueue& q) override {
+    ctx->fireRead(q);
+  }
+
+  void writabilityChanged(Context* ctx, bool writable) override {
+    if (writable && !ready_.empty()) {
+      scheduleDrain(ctx);
+    }
+    ctx->fireWritabilityChanged(writable);
+  }
+
+  folly::Future<folly::Unit> write(Context* ctx, StreamWrite msg) override {
+    folly::Promise<folly::Unit> promise;
+    auto future = promise.getFuture();
+    enqueue(ctx, std::move(msg), std::move(promise));
+    return future;
+  }
+
+  void writeNoFuture(Context* ctx, StreamWrite msg) override {
+    enqueue(ctx, std::move(msg), folly::none);
+  }
+
+  void runLoopCallback() noexcept override {
+    drain();
+  }
+
+  folly::Future<folly::Unit> close(Context* ctx) override {
+    failPending();
+    return ctx->fireClose();
+  }
+
+  void detachPipeline(Context* /* ctx */) override {
+    failPending();
+  }
+
+ private:
+  struct PendingWrite {
+    folly::IOBufQueue data{folly::IOBufQueue::cacheChainLength()};
+    // None for writeNoFuture()
+    folly::Optional<folly::Promise<folly::Unit>> promise;
+  };
+
+  struct Stream {
+    uint8_t priority;
+    uint16_t weight;
+    // Virtual time at which its next chunk is due
+    uint64_t pass;
+    std::deque<PendingWrite> writes;
+  };
+
+  // Ordered by (priority, pass, stream id)
+  typedef std::tuple<uint8_t, uint64_t, uint32_t> ReadyKey;
+
+  // In virtual time, a chunk costs its length scaled down by its weight
+  static constexpr uint64_t kWeightScale = 256;
+
+  void enqueue(
+      Context* ctx,
+      StreamWrite msg,
+      folly::Optional<folly::Promise<folly::Unit>> promise) {
+    PendingWrite write;
+    if (msg.buf) {
+      write.data.append(std::move(msg.buf));
+    }
+    write.promise = std::move(promise);
+    queuedBytes_ += write.data.chainLength();
+
+    auto it = streams_.find(msg.streamId);
+    if (it == streams_.end()) {
+      Stream stream;
+      stream.priority = msg.priority;
+      stream.weight = std::max<uint16_t>(
+          1, std::min<uint16_t>(msg.weight, 256));
+      // Joins the others where they are, rather than catching up on the
+      // time it was idle
+      stream.pass = virtualTime_[stream.priority];
+      it = streams_.emplace(msg.streamId, std::move(stream)).first;
+      ready_.emplace(it->second.priority, it->second.pass, msg.streamId);
+    }
+    it->second.writes.push_back(std::move(write));
+    scheduleDrain(ctx);
+  }
+
+  void scheduleDrain(Context* ctx) {
+    if (!isLoopCallbackScheduled()) {
+      ctx->getTransport()->getEventBase()->runInLoop(this);
+    }
+  }
+
+  // Passes on the next chunk of the stream first in line until there are
+  // none left or the pipeline becomes unwritable
+  void drain() {
+    auto ctx = getContext();
+    PipelineGuard guard(ctx);
+    while (!ready_.empty() && ctx->getPipeline()->isWritable()) {
+      const auto key = *ready_.begin();
+      ready_.erase(ready_.begin());
+      const auto priority = std::get<0>(key);
+      const auto pass = std::get<1>(key);
+      const auto streamId = std::get<2>(key);
+      auto it = streams_.find(streamId);
+      auto& stream = it->second;
+      auto& write = stream.writes.front();
+
+      const auto len =
+        std::min<uint64_t>(write.data.chainLength(), options_.chunkSize);
+      auto chunk = len > 0 ? write.data.split(len) : folly::IOBuf::create(0);
+      const bool last = write.data.empty();
+      folly::Optional<folly::Promise<folly::Unit>> promise;
+      if (last) {
+        promise = std::move(write.promise);
+        stream.writes.pop_front();
+      }
+      queuedBytes_ -= len;
+      virtualTime_[priority] = pass;
+      if (stream.writes.empty()) {
+        streams_.erase(it);
+      } else {
+        stream.pass = pass + std::max<uint64_t>(
+            1, len * kWeightScale / stream.weight);
+        ready_.emplace(priority, stream.pass, streamId);
+      }
+
+      if (options_.framer) {
+        chunk = options_.framer(streamId, std::move(chunk), last);
+      }
+      if (promise) {
+        auto p = folly::makeMoveWrapper(std::move(*promise));
+        ctx->fireWrite(std::move(chunk))
+          .then([p](folly::Try<folly::Unit> t) mutable {
+            p->setTry(std::move(t));
+          });
+      } else {
+        ctx->fireWriteNoFuture(std::move(chunk));
+      }
+    }
+  }
+
+  void failPending() {
+    if (isLoopCallbackScheduled()) {
+      cancelLoopCallback();
+    }
+    auto streams = std::move(streams_);
+    streams_.clear();
+    ready_.clear();
+    queuedBytes_ = 0;
+    for (auto& stream : streams) {
+      for (auto& write : stream.second.writes) {
+        if (write.promise) {
+          write.promise->setException(std::runtime_error(
+              "close() called while stream writes were pending"));
+        }
+      }
+    }
+  }
+
+  Options options_;
+  std::unordered_map<uint32_t, Stream> streams_;
+  std::set<ReadyKey> ready_;
+  // The pass of the last chunk passed on, per priority
+  std::map<uint8_t, uint64_t> virtualTime_;
+  uint64_t queuedBytes_{0};
+};
+
+} // namespace wangle
@@ -0,0 +1,434 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/channel/ProxyRelay.h>
+
+#include <folly/io/IOBufQueue.h>
+#include <folly/io/async/AsyncSSLSocket.h>
+#include <folly/io/async/AsyncSocket.h>
+#include <folly/io/async/EventHandler.h>
+#include <wangle/channel/PipePool.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace folly;
+
+namespace wangle {
+
+constexpr size_t ProxyRelay::kDefaultBufferSize;
+
+// The bytes read from src, written to dst
+class ProxyRelay::Direction {
+ public:
+  Direction(ProxyRelay* relay,
+            AsyncTransportWrapper* src,
+            AsyncTransportWrapper* dst)
+    : relay_(relay), src_(src), dst_(dst) {}
+
+  virtual ~Direction() = default;
+
+  virtual void start() = 0;
+
+  // For good: the transports are not touched any more
+  virtual void stop() = 0;
+
+  uint64_t getBytes() const {
+    return bytes_;
+  }
+
+ protected:
+  // Once src's EOF was reached and everything read was written
+  void done() {
+    dst_->shutdownWrite();
+    relay_->directionDone();
+  }
+
+  void fail(const AsyncSocketException& ex) {
+    relay_->finish(Try<Unit>(make_exception_wrapper<AsyncSocketException>(ex)));
+  }
+
+  ProxyRelay* const relay_;
+  AsyncTransportWrapper* const src_;
+  AsyncTransportWrapper* const dst_;
+  uint64_t bytes_{0};
+};
+
+// Through IOBufs, for any transport
+class ProxyRelay::BufferedDirection
+  : public ProxyRelay::Direction,
+    public AsyncTransportWrapper::ReadCallback {
+ public:
+  BufferedDirection(ProxyRelay* relay,
+                    AsyncTransportWrapper* src,
+                    AsyncTransportWrapper* dst,
+                    size_t bufferSize)
+    : Direction(relay, src, dst), bufferSize_(bufferSize) {}
+
+  void start() override {
+    src_->setReadCB(this);
+  }
+
+  void stop() override {
+    stopped_ = true;
+    if (src_->getReadCallback() == this) {
+      src_->setReadCB(nullptr);
+    }
+  }
+
+  void getReadBuffer(void** bufReturn, size_t* lenReturn) override {
+    auto ret = readBuf_.preallocate(kMinReadSize, kReadAllocationSize);
+    *bufReturn = ret.first;
+    *lenReturn = ret.second;
+  }
+
+  void readDataAvailable(size_t len) noexcept override {
+    auto guard = relay_->shared_from_this();
+    readBuf_.postallocate(len);
+    bytes_ += len;
+    inFlight_ += len;
+    dst_->writeChain(new WriteCallback(this, guard, len), readBuf_.move());
+    if (!stopped_ && inFlight_ >= bufferSize_ &&
+        src_->getReadCallback() == this) {
+      // Until dst catches up
+      src_->setReadCB(nullptr);
+    }
+  }
+
+  void readEOF() noexcept override {
+    auto guard = relay_->shared_from_this();
+    eof_ = true;
+    src_->setReadCB(nullptr);
+    maybeDone();
+  }
+
+  void readErr(const AsyncSocketException& ex) noexcept override {
+    auto guard = relay_->shared_from_this();
+    fail(ex);
+  }
+
+ private:
+  static constexpr size_t kMinReadSize = 2048;
+  static constexpr size_t kReadAllocationSize = 16 * 1024;
+
+  // One per write, holding the relay for the transport may only call back
+  // after it finished
+  class WriteCallback : public AsyncTransportWrapper::WriteCallback {
+   public:
+    WriteCallback(BufferedDirection* direction,
+                  std::shared_ptr<ProxyRelay> relay,
+                  size_t len)
+      : direction_(direction), relay_(std::move(relay)), len_(len) {}
+
+    void writeSuccess() noexcept override {
+      direction_->writeDone(len_);
+      delete this;
+    }
+
+    void writeErr(size_t /* bytesWritten */,
+                  const AsyncSocketException& ex) noexcept override {
+      direction_->inFlight_ -= len_;
+      if (!direction_->stopped_) {
+        direction_->fail(ex);
+      }
+      delete this;
+    }
+
+   private:
+    BufferedDirection* direction_;
+    std::shared_ptr<ProxyRelay> relay_;
+    const size_t len_;
+  };
+
+  void writeDone(size_t len) {
+    inFlight_ -= len;
+    if (stopped_) {
+      return;
+    }
+    if (!eof_ && inFlight_ < bufferSize_ && !src_->getReadCallback()) {
+      src_->setReadCB(this);
+    }
+    maybeDone();
+  }
+
+  void maybeDone() {
+    if (eof_ && inFlight_ == 0 && !stopped_) {
+      stopped_ = true;
+      done();
+    }
+  }
+
+  const size_t bufferSize_;
+  IOBufQueue readBuf_{IOBufQueue::cacheChainLength()};
+  // Bytes written to dst but not sent yet
+  size_t inFlight_{0};
+  bool eof_{false};
+  bool stopped_{false};
+};
+
+constexpr size_t ProxyRelay::BufferedDirection::kMinReadSize;
+constexpr size_t ProxyRelay::BufferedDirection::kReadAllocationSize;
+
+#ifdef SPLICE_F_NONBLOCK
+// From one socket's fd to the other's through a pipe, reading and writing
+// as they're ready with handlers of its own, as the AsyncSockets aren't
+// reading or writing
+class ProxyRelay::SpliceDirection : public ProxyRelay::Direction {
+ public:
+  SpliceDirection(ProxyRelay* relay,
+                  AsyncSocket* src,
+                  AsyncSocket* dst,
+                  size_t bufferSize)
+    : Direction(relay, src, dst),
+      srcFd_(src->getFd()),
+      dstFd_(dst->getFd()),
+      bufferSize_(bufferSize),
+      readHandler_(this, src->getEventBase(), src->getFd()),
+      writeHandler_(this, dst->getEventBase(), dst->getFd()) {}
+
+  ~SpliceDirection() {
+    stop();
+    if (pipe_[0] == -1) {
+      return;
+    }
+    // A pipe with bytes left in it would hand them to the next transfer
+    if (inPipe_ == 0) {
+      PipePool::local().put(pipe_[0], pipe_[1]);
+    } else {
+      ::close(pipe_[0]);
+      ::close(pipe_[1]);
+    }
+  }
+
+  // False if there's no pipe to be had
+  bool init() {
+    if (!PipePool::local().get(pipe_)) {
+      if (::pipe2(pipe_, O_NONBLOCK | O_CLOEXEC) == -1) {
+        pipe_[0] = pipe_[1] = -1;
+        return false;
+      }
+    }
+#ifdef F_SETPIPE_SZ
+    // Failures leave the pipe's own size, which F_GETPIPE_SZ tells
+    fcntl(pipe_[1], F_SETPIPE_SZ, bufferSize_);
+    auto size = fcntl(pipe_[1], F_GETPIPE_SZ);
+    if (size > 0) {
+      pipeSize_ = std::min(bufferSize_, size_t(size));
+    }
+#endif
+    return true;
+  }
+
+  void start() override {
+    pump();
+  }
+
+  void stop() override {
+    stopped_ = true;
+    readHandler_.unregisterHandler();
+    writeHandler_.unregisterHandler();
+  }
+
+ private:
+  // Default size of a pipe
+  static constexpr size_t kDefaultPipeSize = 64 * 1024;
+  // Splices per pump(), not to starve the EventBase's other sockets
+  static constexpr int kMaxSplicesPerPump = 16;
+
+  class FdHandler : public EventHandler {
+   public:
+    FdHandler(SpliceDirection* direction, EventBase* evb, int fd)
+      : EventHandler(evb, fd), direction_(direction) {}
+
+    void handlerReady(uint16_t /* events */) noexcept override {
+      auto guard = direction_->relay_->shared_from_this();
+      direction_->pump();
+    }
+
+   private:
+    SpliceDirection* direction_;
+  };
+
+  void pump() {
+    bool readBlocked = false;
+    bool writeBlocked = false;
+    for (int i = 0; i < kMaxSplicesPerPump; i++) {
+      if (!eof_ && !readBlocked && inPipe_ < pipeSize_) {
+        auto n = ::splice(srcFd_, nullptr, pipe_[1], nullptr,
+                          pipeSize_ - inPipe_,
+                          SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+        if (n > 0) {
+          inPipe_ += n;
+        } else if (n == 0) {
+          eof_ = true;
+        } else if (errno == EAGAIN || errno == EINTR) {
+          readBlocked = true;
+        } else {
+          fail(AsyncSocketException(
+            AsyncSocketException::INTERNAL_ERROR, "splice from socket failed",
+            errno));
+          return;
+        }
+      }
+      if (inPipe_ == 0) {
+        break;
+      }
+      auto n = ::splice(pipe_[0], nullptr, dstFd_, nullptr,
+                        inPipe_, SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+      if (n == -1) {
+        if (errno != EAGAIN && errno != EINTR) {
+          fail(AsyncSocketException(
+            AsyncSocketException::INTERNAL_ERROR, "splice to socket failed",
+            errno));
+          return;
+        }
+        writeBlocked = true;
+        break;
+      }
+      inPipe_ -= n;
+      bytes_ += n;
+    }
+    if (eof_ && inPipe_ == 0) {
+      stop();
+      done();
+      return;
+    }
+    // A pipe dst isn't taking bytes out of may be full well before
+    // pipeSize_, pipes holding a page per splice, so src waits for it
+    setInterest(readHandler_, EventHandler::READ,
+                !eof_ && (inPipe_ == 0 || !writeBlocked));
+    setInterest(writeHandler_, EventHandler::WRITE, inPipe_ > 0);
+  }
+
+  void setInterest(FdHandler& handler, uint16_t events, bool interested) {
+    if (stopped_ || interested == handler.isHandlerRegistered()) {
+      return;
+    }
+    if (!interested) {
+      handler.unregisterHandler();
+    } else if (!handler.registerHandler(events | EventHandler::PERSIST)) {
+      fail(AsyncSocketException(
+        AsyncSocketException::INTERNAL_ERROR, "registerHandler failed"));
+    }
+  }
+
+  const int srcFd_;
+  const int dstFd_;
+  const size_t bufferSize_;
+  int pipe_[2]{-1, -1};
+  size_t pipeSize_{kDefaultPipeSize};
+  size_t inPipe_{0};
+  bool eof_{false};
+  bool stopped_{false};
+  FdHandler readHandler_;
+  FdHandler writeHandler_;
+};
+
+constexpr size_t ProxyRelay::SpliceDirection::kDefaultPipeSize;
+constexpr int ProxyRelay::SpliceDirection::kMaxSplicesPerPump;
+#endif
+
+ProxyRelay::ProxyRelay(std::shared_ptr<AsyncTransportWrapper> a,
+                       std::shared_ptr<AsyncTransportWrapper> b,
+                       Options options)
+  : a_(std::move(a)), b_(std::move(b)), options_(options) {
+  CHECK(a_ && b_);
+  CHECK_GT(options_.bufferSize, 0);
+}
+
+ProxyRelay::~ProxyRelay() {
+  if (aToB_) {
+    aToB_->stop();
+    bToA_->stop();
+  }
+}
+
+Future<Unit> ProxyRelay::start() {
+  CHECK(!aToB_) << "already started";
+  auto evb = a_->getEventBase();
+  CHECK(evb && evb == b_->getEventBase());
+  DCHECK(evb->isInEventBaseThread());
+  DCHECK(!a_->getReadCallback() && !b_->getReadCallback());
+  self_ = shared_from_this();
+  auto future = promise_.getFuture();
+
+#ifdef SPLICE_F_NONBLOCK
+  if (options_.splice && canSplice()) {
+    auto a = static_cast<AsyncSocket*>(a_.get());
+    auto b = static_cast<AsyncSocket*>(b_.get());
+    std::unique_ptr<SpliceDirection> aToB(
+      new SpliceDirection(this, a, b, options_.bufferSize));
+    std::unique_ptr<SpliceDirection> bToA(
+      new SpliceDirection(this, b, a, options_.bufferSize));
+    if (aToB->init() && bToA->init()) {
+      aToB_ = std::move(aToB);
+      bToA_ = std::move(bToA);
+      spliced_ = true;
+    } else {
+      VLOG(4) << "Relaying through buffers, pipe2 failed: errno " << errno;
+    }
+  }
+#endif
+  if (!spliced_) {
+    aToB_.reset(new BufferedDirection(
+      this, a_.get(), b_.get(), options_.bufferSize));
+    bToA_.reset(new BufferedDirection(
+      this, b_.get(), a_.get(), options_.bufferSize));
+  }
+
+  aToB_->start();
+  if (!finished_) {
+    bToA_->start();
+  }
+  return future;
+}
+
+void ProxyRelay::stop() {
+  if (aToB_) {
+    finish(Try<Unit>(Unit()));
+  }
+}
+
+uint64_t ProxyRelay::getBytesFromA() const {
+  return aToB_ ? aToB_->getBytes() : 0;
+}
+
+uint64_t ProxyRelay::getBytesFromB() const {
+  return bToA_ ? bToA_->getBytes() : 0;
+}
+
+bool ProxyRelay::canSplice() const {
+  auto a = dynamic_cast<AsyncSocket*>(a_.get());
+  auto b = dynamic_cast<AsyncSocket*>(b_.get());
+  // A write still pending in a socket would get mixed up with ours
+  return a && b &&
+    !dynamic_cast<AsyncSSLSocket*>(a) && !dynamic_cast<AsyncSSLSocket*>(b) &&
+    a->getFd() != -1 && b->getFd() != -1 &&
+    a->isDetachable() && b->isDetachable();
+}
+
+void ProxyRelay::directionDone() {
+  if (++directionsDone_ == 2) {
+    finish(Try<Unit>(Unit()));
+  }
+}
+
+void ProxyRelay::finish(Try<Unit> result) {
+  if (finished_) {
+    return;
+  }
+  finished_ = true;
+  aToB_->stop();
+  bToA_->stop();
+  promise_.setTry(std::move(result));
+  // The callers of finish() hold their own reference
+  self_.reset();
+}
+
+}
@@ -0,0 +1,101 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/futures/Future.h>
+#include <folly/futures/Promise.h>
+#include <folly/io/async/AsyncTransport.h>
+
+#include <memory>
+
+namespace wangle {
+
+/**
+ * Relays the bytes read from each of two transports to the other, the way
+ * a TCP proxy does, until both have reached EOF.
+ *
+ * Between plain AsyncSockets, the bytes are spliced through a pipe from one
+ * socket to the other without being copied to userspace. Otherwise, e.g.
+ * for TLS sockets, they're read into IOBufs and written to the other
+ * transport. Either way, no more than bufferSize bytes read from one
+ * transport are waiting to be written to the other: reading stops until
+ * it's written them, so a slow reader slows down the writer at the other
+ * end. The EOF of one transport is relayed by shutting down writing on the
+ * other once everything it sent was written; TLS sockets can't half close,
+ * so that closes them.
+ *
+ * The transports must be on the same EventBase, with no read callback and
+ * no write pending, e.g. those of pipelines stopped with
+ * transportInactive(), and the relay must be owned by a shared_ptr. They're
+ * left open when it's done, for their owners to close.
+ */
+class ProxyRelay : public std::enable_shared_from_this<ProxyRelay> {
+ public:
+  static constexpr size_t kDefaultBufferSize = 64 * 1024;
+
+  struct Options {
+    // Per direction. The kernel rounds pipe sizes up to pages.
+    size_t bufferSize{kDefaultBufferSize};
+    // Whether to splice between plain sockets
+    bool splice{true};
+  };
+
+  ProxyRelay(std::shared_ptr<folly::AsyncTransportWrapper> a,
+             std::shared_ptr<folly::AsyncTransportWrapper> b,
+             Options options = Options());
+
+  ~ProxyRelay();
+
+  /**
+   * Starts relaying, on the transports' EventBase. The Future completes
+   * there once both EOFs were relayed, or with the first error either way,
+   * after which the relay no longer touches the transports.
+   */
+  folly::Future<folly::Unit> start();
+
+  /**
+   * Stops relaying, e.g. before closing the transports when the
+   * connection timed out, completing the Future of start().
+   */
+  void stop();
+
+  bool isSpliced() const {
+    return spliced_;
+  }
+
+  uint64_t getBytesFromA() const;
+  uint64_t getBytesFromB() const;
+
+ private:
+  class Direction;
+  class BufferedDirection;
+  class SpliceDirection;
+
+  bool canSplice() const;
+
+  // Called by each direction once it relayed its EOF
+  void directionDone();
+
+  void finish(folly::Try<folly::Unit> result);
+
+  std::shared_ptr<folly::AsyncTransportWrapper> a_;
+  std::shared_ptr<folly::AsyncTransportWrapper> b_;
+  const Options options_;
+  bool spliced_{false};
+  std::unique_ptr<Direction> aToB_;
+  std::unique_ptr<Direction> bToA_;
+  size_t directionsDone_{0};
+  bool finished_{false};
+  folly::Promise<folly::Unit> promise_;
+  // Keeps the relay alive while it runs
+  std::shared_ptr<ProxyRelay> self_;
+};
+
+}
@@ -0,0 +1,326 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+
+#include <folly/MoveWrapper.h>
+#include <folly/Optional.h>
+#include <folly/futures/Future.h>
+#include <folly/io/IOBuf.h>
+#include <folly/io/IOBufQueue.h>
+#include <folly/io/async/AsyncSocket.h>
+#include <folly/io/async/HHWheelTimer.h>
+#include <wangle/acceptor/ManagedConnection.h>
+#include <wangle/acceptor/SocketOptions.h>
+#include <wangle/channel/Handler.h>
+#include <wangle/channel/TokenBucket.h>
+
+namespace wangle {
+
+/*
+ * RateLimitHandler holds a connection to read and write bandwidth limits,
+ * each from a bucket of the connection's own and optionally one shared
+ * with other connections, e.g. those of a tenant, which may be on other
+ * threads.
+ *
+ * Reads that leave a bucket in debt pause reading from the transport
+ * (see PipelineBase::pauseRead()) until it's out of it, so the peer is
+ * held back by TCP rather than buffered for. Writes made while a bucket is
+ * in debt are queued, in order, and passed on whole once it's out of it;
+ * their Futures complete when the transport's do. Waits are timed on the
+ * HHWheelTimer of the connection's ConnectionManager when the pipeline is
+ * a ManagedConnection's, on one of the handler's own otherwise.
+ *
+ * With kernelPacing, the connection's own write limit is left to the
+ * kernel (SO_MAX_PACING_RATE) when the transport is a socket that takes
+ * it, pacing packets rather than writes without any queueing here. A
+ * shared write bucket is still enforced here.
+ *
+ * Put it right after the transport handler. This handler may only be used
+ * in a single Pipeline.
+ */
+class RateLimitHandler : public BytesToBytesHandler {
+ public:
+  typedef TokenBucket::Clock Clock;
+
+  struct Options {
+    // Bytes per second for this connection, 0 for no limit, and bytes it
+    // may send or receive at once. A 0 burst is a tenth of a second's worth.
+    uint64_t readRate{0};
+    uint64_t readBurst{0};
+    uint64_t writeRate{0};
+    uint64_t writeBurst{0};
+    // Shared with other connections, or null
+    std::shared_ptr<TokenBucket> sharedReadBucket;
+    std::shared_ptr<TokenBucket> sharedWriteBucket;
+    bool kernelPacing{false};
+  };
+
+  struct Stats {
+    // Times reading was paused, and writes that were queued
+    uint64_t readPauses{0};
+    uint64_t queuedWrites{0};
+    bool kernelPaced{false};
+  };
+
+  explicit RateLimitHandler(Options options) : options_(std::move(options)) {
+    if (options_.readRate > 0) {
+      readBucket_.reset(new TokenBucket(
+          options_.readRate, burst(options_.readRate, options_.readBurst)));
+    }
+    if (options_.writeRate > 0) {
+      writeBucket_.reset(new TokenBucket(
+          options_.writeRate, burst(options_.writeRate, options_.writeBurst)));
+    }
+  }
+
+  RateLimitHandler(RateLimitHandler&& other)
+    : RateLimitHandler(std::move(other.options_)) {}
+
+  ~RateLimitHandler() {
+    refill_.cancelTimeout();
+  }
+
+  const Stats& getStats() const {
+    return stats_;
+  }
+
+  void transportActive(Context* ctx) override {
+    if (options_.kernelPacing && writeBucket_) {
+      auto sock = std::dynamic_pointer_cast<folly::AsyncSocket>(
+          ctx->getTransport());
+      if (sock && setMaxPacingRate(sock->getFd(), options_.writeRate)) {
+        writeBucket_.reset();
+        stats_.kernelPaced = true;
+      }
+    }
+    ctx->fireTransportActive();
+  }
+
+  void read(Context* ctx, folly::IOBufQueue& q) override {
+    // The bytes the handlers after this one left in q were counted already
+    const auto len = q.chainLength();
+    const auto bytes = len > unconsumed_ ? len - unconsumed_ : 0;
+    const auto now = Clock::now();
+    consume(readBucket_.get(), bytes, now);
+    consume(options_.sharedReadBucket.get(), bytes, now);
+    PipelineGuard guard(ctx);
+    const auto wait = getReadWait(now);
+    if (wait > Clock::duration::zero() && !readsPaused_) {
+      readsPaused_ = true;
+      stats_.readPauses++;
+      ctx->pauseRead();
+      scheduleRefill(ctx, now, wait);
+    }
+    ctx->fireRead(q);
+    unconsumed_ = q.chainLength();
+  }
+
+  folly::Future<folly::Unit> write(
+      Context* ctx,
+      std::unique_ptr<folly::IOBuf> buf) override {
+    const auto now = Clock::now();
+    if (pending_.empty() && getWriteWait(now) == Clock::duration::zero()) {
+      takeWrite(*buf, now);
+      return ctx->fireWrite(std::move(buf));
+    }
+    folly::Promise<folly::Unit> promise;
+    auto future = promise.getFuture();
+    queueWrite(ctx, std::move(buf), std::move(promise));
+    return future;
+  }
+
+  void writeNoFuture(
+      Context* ctx,
+      std::unique_ptr<folly::IOBuf> buf) override {
+    const auto now = Clock::now();
+    if (pending_.empty() && getWriteWait(now) == Clock::duration::zero()) {
+      takeWrite(*buf, now);
+      ctx->fireWriteNoFuture(std::move(buf));
+      return;
+    }
+    queueWrite(ctx, std::move(buf), folly::none);
+  }
+
+  folly::Future<folly::Unit> close(Context* ctx) override {
+    failPending();
+    refill_.cancelTimeout();
+    return ctx->fireClose();
+  }
+
+  void detachPipeline(Context* /* ctx */) override {
+    failPending();
+    refill_.cancelTimeout();
+  }
+
+ private:
+  struct PendingWrite {
+    std::unique_ptr<folly::IOBuf> buf;
+    // None for writeNoFuture()
+    folly::Optional<folly::Promise<folly::Unit>> promise;
+  };
+
+  class Refill : public folly::HHWheelTimer::Callback {
+   public:
+    explicit Refill(RateLimitHandler* handler) : handler_(handler) {}
+
+    void timeoutExpired() noexcept override {
+      handler_->refill();
+    }
+
+   private:
+    RateLimitHandler* handler_;
+  };
+
+  static double burst(uint64_t rate, uint64_t burst) {
+    return burst > 0 ? burst : rate / 10.0;
+  }
+
+  static void consume(
+      TokenBucket* bucket,
+      uint64_t bytes,
+      Clock::time_point now) {
+    if (bucket && bytes > 0) {
+      bucket->consume(bytes, now);
+    }
+  }
+
+  static Clock::duration getWait(TokenBucket* bucket, Clock::time_point now) {
+    return bucket ? bucket->getWait(now) : Clock::duration::zero();
+  }
+
+  Clock::duration getReadWait(Clock::time_point now) const {
+    return std::max(getWait(readBucket_.get(), now),
+                    getWait(options_.sharedReadBucket.get(), now));
+  }
+
+  Clock::duration getWriteWait(Clock::time_point now) const {
+    return std::max(getWait(writeBucket_.get(), now),
+                    getWait(options_.sharedWriteBucket.get(), now));
+  }
+
+  void takeWrite(const folly::IOBuf& buf, Clock::time_point now) {
+    if (writeBucket_ || options_.sharedWriteBucket) {
+      const auto len = buf.computeChainDataLength();
+      consume(writeBucket_.get(), len, now);
+      consume(options_.sharedWriteBucket.get(), len, now);
+    }
+  }
+
+  void queueWrite(
+      Context* ctx,
+      std::unique_ptr<folly::IOBuf> buf,
+      folly::Optional<folly::Promise<folly::Unit>> promise) {
+    stats_.queuedWrites++;
+    pending_.push_back(PendingWrite{std::move(buf), std::move(promise)});
+    if (pending_.size() == 1) {
+      const auto now = Clock::now();
+      scheduleRefill(ctx, now, getWriteWait(now));
+    }
+  }
+
+  // Passes on the writes and resumes the reads whose buckets are out of
+  // debt, and waits again for the others
+  void refill() {
+    auto ctx = getContext();
+    PipelineGuard guard(ctx);
+    refillAt_ = Clock::time_point::max();
+    const auto now = Clock::now();
+    auto wait = Clock::duration::zero();
+    if (readsPaused_) {
+      wait = getReadWait(now);
+      if (wait == Clock::duration::zero()) {
+        readsPaused_ = false;
+        ctx->resumeRead();
+      }
+    }
+    while (!pending_.empty() &&
+           getWriteWait(now) == Clock::duration::zero()) {
+      auto write = std::move(pending_.front());
+      pending_.pop_front();
+      takeWrite(*write.buf, now);
+      if (write.promise) {
+        auto promise = folly::makeMoveWrapper(std::move(*write.promise));
+        ctx->fireWrite(std::move(write.buf))
+          .then([promise](folly::Try<folly::Unit> t) mutable {
+            promise->setTry(std::move(t));
+          });
+      } else {
+        ctx->fireWriteNoFuture(std::move(write.buf));
+      }
+    }
+    if (!pending_.empty()) {
+      const auto writeWait = getWriteWait(now);
+      wait = wait == Clock::duration::zero()
+        ? writeWait : std::min(wait, writeWait);
+    }
+    if (wait > Clock::duration::zero()) {
+      scheduleRefill(ctx, now, wait);
+    }
+  }
+
+  // Unless a refill is already due by then
+  void scheduleRefill(
+      Context* ctx,
+      Clock::time_point now,
+      Clock::duration wait) {
+    if (refill_.isScheduled()) {
+      if (refillAt_ <= now + wait) {
+        return;
+      }
+      refill_.cancelTimeout();
+    }
+    refillAt_ = now + wait;
+    // Rounded up, so that the bucket is out of debt when it fires
+    const auto timeout = std::chrono::duration_cast<std::chrono::milliseconds>(
+        wait + std::chrono::milliseconds(1) - Clock::duration(1));
+    auto conn = dynamic_cast<ManagedConnection*>(
+        ctx->getPipeline()->getPipelineManager());
+    if (conn && conn->getConnectionManager()) {
+      conn->scheduleTimeout(&refill_, timeout);
+      return;
+    }
+    if (!timer_) {
+      timer_.reset(
+          new folly::HHWheelTimer(ctx->getTransport()->getEventBase()));
+    }
+    timer_->scheduleTimeout(&refill_, timeout);
+  }
+
+  void failPending() {
+    auto pending = std::move(pending_);
+    pending_.clear();
+    for (auto& write : pending) {
+      if (write.promise) {
+        write.promise->setException(std::runtime_error(
+            "close() called while rate limited writes were pending"));
+      }
+    }
+  }
+
+  Options options_;
+  std::unique_ptr<TokenBucket> readBucket_;
+  std::unique_ptr<TokenBucket> writeBucket_;
+  // What the handlers after this one left in the read queue last time
+  uint64_t unconsumed_{0};
+  bool readsPaused_{false};
+  std::deque<PendingWrite> pending_;
+  Refill refill_{this};
+  Clock::time_point refillAt_{Clock::time_point::max()};
+  folly::HHWheelTimer::UniquePtr timer_;
+  Stats stats_;
+};
+
+} // namespace wangle
@@ -0,0 +1,165 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/ReadBufferPool.h>
+
+#include <wangle/channel/HugePages.h>
+
+#include <glog/logging.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+namespace wangle {
+
+// Header in front of the data of each buffer
+struct alignas(16) ReadBufferPool::Buffer {
+  Cache* home;
+  Buffer* next;
+};
+
+// A thread's buffers. It lives until the thread exits and every buffer it
+// allocated is freed, so frees from other threads can always reach it.
+struct ReadBufferPool::Cache {
+  Cache(size_t size, size_t max, bool huge)
+    : bufferSize(size), maxCached(max), hugePages(huge) {}
+
+  ~Cache() {
+    if (hugePages) {
+      // The buffers are all in the regions
+      for (auto& region : regions) {
+        unmapHugePages(region);
+      }
+      return;
+    }
+    for (auto buffer : free) {
+      std::free(buffer);
+    }
+    auto buffer = returned.load();
+    while (buffer) {
+      auto next = buffer->next;
+      std::free(buffer);
+      buffer = next;
+    }
+  }
+
+  // Carves a buffer out of the current region, mapping a new one once it's
+  // used up
+  Buffer* carve() {
+    // Keeping buffers cache line aligned
+    const size_t stride = (sizeof(Buffer) + bufferSize + 63) & ~size_t(63);
+    if (regionEnd - regionPtr < ptrdiff_t(stride)) {
+      regions.push_back(mapHugePages(stride));
+      regionPtr = static_cast<char*>(regions.back().data);
+      regionEnd = regionPtr + regions.back().size;
+    }
+    auto buffer = reinterpret_cast<Buffer*>(regionPtr);
+    regionPtr += stride;
+    return buffer;
+  }
+
+  const size_t bufferSize;
+  const size_t maxCached;
+  const bool hugePages;
+  // Only used by the owning thread
+  std::vector<Buffer*> free;
+  std::vector<HugePageMapping> regions;
+  char* regionPtr{nullptr};
+  char* regionEnd{nullptr};
+  // Freed buffers not picked up yet, pushed by any thread
+  std::atomic<Buffer*> returned{nullptr};
+  std::atomic<size_t> numReturned{0};
+  // One for the owning thread, one per buffer out
+  std::atomic<size_t> refs{1};
+};
+
+constexpr size_t ReadBufferPool::kDefaultBufferSize;
+constexpr size_t ReadBufferPool::kDefaultMaxCachedPerThread;
+
+ReadBufferPool::ReadBufferPool(
+    size_t bufferSize,
+    size_t maxCachedPerThread,
+    bool hugePages)
+  : bufferSize_(bufferSize),
+    maxCached_(maxCachedPerThread),
+    hugePages_(hugePages) {
+  CHECK_GT(bufferSize_, 0);
+}
+
+ReadBufferPool::Holder::~Holder() {
+  if (cache) {
+    unref(cache);
+  }
+}
+
+std::unique_ptr<folly::IOBuf> ReadBufferPool::get() {
+  auto& holder = *holder_;
+  if (!holder.cache) {
+    holder.cache = new Cache(bufferSize_, maxCached_, hugePages_);
+  }
+  auto cache = holder.cache;
+
+  if (cache->free.empty()) {
+    // Popping them all at once means there is no ABA problem
+    auto buffer = cache->returned.exchange(nullptr);
+    while (buffer) {
+      auto next = buffer->next;
+      cache->numReturned--;
+      if (cache->hugePages || cache->free.size() < maxCached_) {
+        cache->free.push_back(buffer);
+      } else {
+        std::free(buffer);
+      }
+      buffer = next;
+    }
+  }
+
+  Buffer* buffer;
+  if (!cache->free.empty()) {
+    buffer = cache->free.back();
+    cache->free.pop_back();
+  } else {
+    buffer = cache->hugePages
+      ? cache->carve()
+      : static_cast<Buffer*>(std::malloc(sizeof(Buffer) + bufferSize_));
+    if (!buffer) {
+      throw std::bad_alloc();
+    }
+    buffer->home = cache;
+  }
+  cache->refs++;
+  return folly::IOBuf::takeOwnership(
+      buffer + 1, bufferSize_, 0, &ReadBufferPool::freeBuffer, buffer);
+}
+
+void ReadBufferPool::freeBuffer(void* /* data */, void* userData) {
+  auto buffer = static_cast<Buffer*>(userData);
+  auto home = buffer->home;
+  if (!home->hugePages &&
+      home->numReturned.load(std::memory_order_relaxed) >= home->maxCached) {
+    std::free(buffer);
+  } else {
+    home->numReturned++;
+    buffer->next = home->returned.load();
+    while (!home->returned.compare_exchange_weak(buffer->next, buffer)) {
+    }
+  }
+  unref(home);
+}
+
+void ReadBufferPool::unref(Cache* cache) {
+  if (--cache->refs == 0) {
+    delete cache;
+  }
+}
+
+} // namespace wangle
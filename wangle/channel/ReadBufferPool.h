@@ -0,0 +1,80 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/ThreadLocal.h>
+#include <folly/io/IOBuf.h>
+
+#include <memory>
+
+namespace wangle {
+
+/*
+ * Fixed-size read buffers cached per thread, for AsyncSocketHandler (see
+ * PipelineBase::setReadBufferPool()). Each IO thread allocates, and so first
+ * touches, its own buffers, and a buffer freed on another thread, e.g. after
+ * its data was handed to a CPU pool, goes back to the cache of the thread
+ * that allocated it, which picks it up when its own cache runs dry. Threads
+ * then rarely call the allocator for reads and keep their buffers on their
+ * NUMA node.
+ *
+ * Each thread caches up to about maxCachedPerThread buffers; more are freed.
+ *
+ * With hugePages, each thread instead carves its buffers out of 2MB regions
+ * of its own, backed by hugepages where the system has them (see
+ * mapHugePages()), so that the buffers IO threads touch take few TLB
+ * entries. As such buffers can't be freed one by one, every one is cached
+ * for reuse, and a thread's regions are only unmapped once it has exited
+ * and all its buffers are freed.
+ */
+class ReadBufferPool {
+ public:
+  static constexpr size_t kDefaultBufferSize = 16 * 1024;
+  static constexpr size_t kDefaultMaxCachedPerThread = 64;
+
+  explicit ReadBufferPool(
+      size_t bufferSize = kDefaultBufferSize,
+      size_t maxCachedPerThread = kDefaultMaxCachedPerThread,
+      bool hugePages = false);
+
+  // An empty IOBuf of getBufferSize() capacity, which may be freed on any
+  // thread, even after the pool is gone
+  std::unique_ptr<folly::IOBuf> get();
+
+  size_t getBufferSize() const {
+    return bufferSize_;
+  }
+
+  bool usesHugePages() const {
+    return hugePages_;
+  }
+
+ private:
+  struct Buffer;
+  struct Cache;
+
+  // Gives a thread's cache up when the thread exits
+  struct Holder {
+    ~Holder();
+
+    Cache* cache{nullptr};
+  };
+
+  static void freeBuffer(void* data, void* userData);
+  static void unref(Cache* cache);
+
+  const size_t bufferSize_;
+  const size_t maxCached_;
+  const bool hugePages_;
+  folly::ThreadLocal<Holder> holder_;
+};
+
+} // namespace wangle
@@ -0,0 +1,63 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <utility>
+
+#include <wangle/channel/Handler.h>
+#include <wangle/concurrent/RequestTrace.h>
+
+namespace wangle {
+
+/*
+ * RequestTraceSampler starts a RequestTrace for one in every oneIn
+ * messages read, counted per thread, and passes them on in its Scope, so
+ * that the handlers, dispatcher, service and executors after it record
+ * their stages for it, up to the write of the response.
+ *
+ * Put it right after the decoder, e.g.
+ *
+ *   pipeline->addBack(AsyncSocketHandler(sock));
+ *   pipeline->addBack(OutputBufferingHandler());
+ *   pipeline->addBack(LineBasedFrameDecoder());
+ *   pipeline->addBack(StringCodec());
+ *   pipeline->addBack(RequestTraceSampler<std::string>(1000));
+ *   pipeline->addBack(PipelinedServerDispatcher<std::string>(&service));
+ *
+ * and read the traces with RequestTrace::dump(). A message read in an
+ * existing trace keeps it. With oneIn 0, nothing is traced.
+ */
+template <typename Msg>
+class RequestTraceSampler : public InboundHandler<Msg> {
+ public:
+  typedef typename InboundHandler<Msg>::Context Context;
+
+  explicit RequestTraceSampler(uint32_t oneIn) : oneIn_(oneIn) {}
+
+  void setOneIn(uint32_t oneIn) {
+    oneIn_ = oneIn;
+  }
+
+  void read(Context* ctx, Msg msg) override {
+    auto traceId = RequestTrace::current();
+    if (LIKELY(traceId == 0)) {
+      traceId = RequestTrace::sample(oneIn_);
+    }
+    RequestTrace::Scope scope(traceId);
+    RequestTrace::record("decoded");
+    ctx->fireRead(std::forward<Msg>(msg));
+  }
+
+ private:
+  uint32_t oneIn_;
+};
+
+} // namespace wangle
@@ -10,8 +10,10 @@
 
 #pragma once
 
+#include <tuple>
 #include <type_traits>
 
+#include <folly/Optional.h>
 #include <wangle/channel/Pipeline.h>
 
 namespace wangle {
@@ -144,4 +146,476 @@ class StaticPipeline<R, W, Handler, Handlers...>
   typename ContextType<Handler>::type ctx_;
 };
 
+namespace detail {
+
+template <class... Handlers>
+struct FixedHandlerList {
+  static constexpr size_t size = sizeof...(Handlers);
+
+  template <size_t I>
+  using at = typename std::tuple_element<I, std::tuple<Handlers...>>::type;
+};
+
+// Index of the first handler at or after I that takes inbound events, or
+// List::size if there is none
+template <size_t I, class List, bool End = (I >= List::size)>
+struct FixedNextIn : std::integral_constant<size_t,
+    List::template at<I>::dir == HandlerDir::OUT
+      ? FixedNextIn<I + 1, List>::value
+      : I> {};
+
+template <size_t I, class List>
+struct FixedNextIn<I, List, true>
+    : std::integral_constant<size_t, List::size> {};
+
+// Index of the last handler before I that takes outbound events, or
+// List::size if there is none
+template <size_t I, class List, bool End = (I == 0)>
+struct FixedNextOut : std::integral_constant<size_t,
+    List::template at<I - 1>::dir == HandlerDir::IN
+      ? FixedNextOut<I - 1, List>::value
+      : I - 1> {};
+
+template <size_t I, class List>
+struct FixedNextOut<I, List, true>
+    : std::integral_constant<size_t, List::size> {};
+
+template <class H, bool HasLink = H::dir != HandlerDir::OUT>
+struct FixedInboundLink : public InboundLink<typename H::rin> {};
+
+template <class H>
+struct FixedInboundLink<H, false> {};
+
+template <class H, bool HasLink = H::dir != HandlerDir::IN>
+struct FixedOutboundLink : public OutboundLink<typename H::win> {};
+
+template <class H>
+struct FixedOutboundLink<H, false> {};
+
+// Stands in for the neighbour of the first/last handler
+struct FixedChainEnd {
+  template <class T>
+  void read(T&&) {
+    LOG(WARNING) << "read reached end of pipeline";
+  }
+
+  template <class T>
+  void readBatch(T) {
+    LOG(WARNING) << "readBatch reached end of pipeline";
+  }
+
+  void readEOF() {
+    LOG(WARNING) << "readEOF reached end of pipeline";
+  }
+
+  void readException(folly::exception_wrapper) {
+    LOG(WARNING) << "readException reached end of pipeline";
+  }
+
+  void transportActive() {}
+
+  void transportInactive() {}
+
+  void writabilityChanged(bool) {}
+
+  template <class T>
+  folly::Future<folly::Unit> write(T&&) {
+    LOG(WARNING) << "write reached end of pipeline";
+    return folly::makeFuture();
+  }
+
+  template <class T>
+  void writeNoFuture(T&&) {
+    LOG(WARNING) << "write reached end of pipeline";
+  }
+
+  folly::Future<folly::Unit> writeException(folly::exception_wrapper) {
+    LOG(WARNING) << "close reached end of pipeline";
+    return folly::makeFuture();
+  }
+
+  folly::Future<folly::Unit> close() {
+    LOG(WARNING) << "close reached end of pipeline";
+    return folly::makeFuture();
+  }
+};
+
+template <size_t I, class List>
+class FixedContextImpl;
+
+template <size_t I, class List>
+using FixedContextAt = typename std::conditional<
+  I == List::size,
+  FixedChainEnd,
+  FixedContextImpl<I, List>>::type;
+
+// Holds the contexts of a FixedStaticPipeline; FixedChain<I, List> is a base
+// of FixedChain<0, List> for every I, so any context can be reached from the
+// root with a static_cast.
+template <size_t I, class List, bool End = (I == List::size)>
+struct FixedChain : public FixedChain<I + 1, List> {
+  FixedContextImpl<I, List> ctx;
+};
+
+template <size_t I, class List>
+struct FixedChain<I, List, true> {
+  FixedChainEnd ctx;
+};
+
+/*
+ * Context of the I'th handler of a FixedStaticPipeline. Neighbouring contexts
+ * are addressed by their concrete (final) type, so hops between handlers are
+ * direct calls the compiler can inline. Handler methods are still invoked
+ * virtually; declare a handler final to let those be inlined too.
+ */
+template <size_t I, class List>
+class FixedContextImpl final
+  : public List::template at<I>::Context,
+    public PipelineContext,
+    public FixedInboundLink<typename List::template at<I>>,
+    public FixedOutboundLink<typename List::template at<I>> {
+ public:
+  typedef typename List::template at<I> H;
+  typedef typename H::rin Rin;
+  typedef typename H::rout Rout;
+  typedef typename H::win Win;
+  typedef typename H::wout Wout;
+  static const HandlerDir dir = H::dir;
+
+  FixedContextImpl() = default;
+  FixedContextImpl(const FixedContextImpl&) = delete;
+  FixedContextImpl& operator=(const FixedContextImpl&) = delete;
+
+  template <class HandlerArg>
+  typename std::enable_if<std::is_same<
+    typename std::remove_reference<HandlerArg>::type,
+    H
+  >::value>::type
+  setHandler(HandlerArg&& arg) {
+    storage_.emplace(std::forward<HandlerArg>(arg));
+    handler_ = &(*storage_);
+  }
+
+  template <class HandlerArg>
+  typename std::enable_if<std::is_same<
+    typename std::decay<HandlerArg>::type,
+    std::shared_ptr<H>
+  >::value>::type
+  setHandler(HandlerArg&& arg) {
+    handlerPtr_ = std::forward<HandlerArg>(arg);
+    handler_ = handlerPtr_.get();
+  }
+
+  template <class HandlerArg>
+  typename std::enable_if<std::is_same<
+    typename std::decay<HandlerArg>::type,
+    H*
+  >::value>::type
+  setHandler(HandlerArg&& arg) {
+    handler_ = arg;
+  }
+
+  void initialize(
+      std::weak_ptr<PipelineBase> pipeline,
+      FixedChain<0, List>* chain) {
+    CHECK(handler_);
+    pipelineWeak_ = pipeline;
+    pipelineRaw_ = pipeline.lock().get();
+    chain_ = chain;
+  }
+
+  H* getHandler() {
+    return handler_;
+  }
+
+  // PipelineContext overrides
+  void attachPipeline() override {
+    if (!attached_) {
+      this->attachContext(handler_, static_cast<typename H::Context*>(this));
+      handler_->attachPipeline(this);
+      attached_ = true;
+    }
+  }
+
+  void detachPipeline() override {
+    handler_->detachPipeline(this);
+    attached_ = false;
+  }
+
+  bool resetHandler() override {
+    return handler_->reset();
+  }
+
+  // Links are fixed at compile time
+  void setNextIn(PipelineContext* /*ctx*/) override {}
+  void setNextOut(PipelineContext* /*ctx*/) override {}
+
+  HandlerDir getDirection() override {
+    return H::dir;
+  }
+
+  // HandlerContext overrides
+  void fireRead(Rout msg) {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    nextIn().read(std::forward<Rout>(msg));
+  }
+
+  void fireReadBatch(MessageBatch<Rout> msgs) {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    nextIn().readBatch(msgs);
+  }
+
+  void fireReadEOF() {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    nextIn().readEOF();
+  }
+
+  void fireReadException(folly::exception_wrapper e) {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    nextIn().readException(std::move(e));
+  }
+
+  void fireTransportActive() {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    nextIn().transportActive();
+  }
+
+  void fireTransportInactive() {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    nextIn().transportInactive();
+  }
+
+  void fireWritabilityChanged(bool writable) {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    nextIn().writabilityChanged(writable);
+  }
+
+  folly::Future<folly::Unit> fireWrite(Wout msg) {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    return nextOut().write(std::forward<Wout>(msg));
+  }
+
+  void fireWriteNoFuture(Wout msg) {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    nextOut().writeNoFuture(std::forward<Wout>(msg));
+  }
+
+  folly::Future<folly::Unit> fireWriteException(folly::exception_wrapper e) {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    return nextOut().writeException(std::move(e));
+  }
+
+  folly::Future<folly::Unit> fireClose() {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    return nextOut().close();
+  }
+
+  PipelineBase* getPipeline() {
+    return pipelineRaw_;
+  }
+
+  std::shared_ptr<PipelineBase> getPipelineShared() {
+    return pipelineWeak_.lock();
+  }
+
+  void setWriteFlags(folly::WriteFlags flags) {
+    pipelineRaw_->setWriteFlags(flags);
+  }
+
+  folly::WriteFlags getWriteFlags() {
+    return pipelineRaw_->getWriteFlags();
+  }
+
+  void setReadBufferSettings(uint64_t minAvailable, uint64_t allocationSize) {
+    pipelineRaw_->setReadBufferSettings(minAvailable, allocationSize);
+  }
+
+  std::pair<uint64_t, uint64_t> getReadBufferSettings() {
+    return pipelineRaw_->getReadBufferSettings();
+  }
+
+  // InboundLink overrides
+  void read(Rin msg) {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    handler_->read(this, std::forward<Rin>(msg));
+  }
+
+  void readBatch(MessageBatch<Rin> msgs) {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    handler_->readBatch(this, msgs);
+  }
+
+  void readEOF() {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    handler_->readEOF(this);
+  }
+
+  void readException(folly::exception_wrapper e) {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    handler_->readException(this, std::move(e));
+  }
+
+  void transportActive() {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    handler_->transportActive(this);
+  }
+
+  void transportInactive() {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    handler_->transportInactive(this);
+  }
+
+  void writabilityChanged(bool writable) {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    handler_->writabilityChanged(this, writable);
+  }
+
+  // OutboundLink overrides
+  folly::Future<folly::Unit> write(Win msg) {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    return handler_->write(this, std::forward<Win>(msg));
+  }
+
+  void writeNoFuture(Win msg) {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    handler_->writeNoFuture(this, std::forward<Win>(msg));
+  }
+
+  folly::Future<folly::Unit> writeException(folly::exception_wrapper e) {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    return handler_->writeException(this, std::move(e));
+  }
+
+  folly::Future<folly::Unit> close() {
+    PipelineGuard guard(pipelineRaw_, pipelineWeak_);
+    return handler_->close(this);
+  }
+
+ private:
+  static constexpr size_t kNextIn = FixedNextIn<I + 1, List>::value;
+  static constexpr size_t kNextOut = FixedNextOut<I, List>::value;
+
+  FixedContextAt<kNextIn, List>& nextIn() {
+    return static_cast<FixedChain<kNextIn, List>&>(*chain_).ctx;
+  }
+
+  FixedContextAt<kNextOut, List>& nextOut() {
+    return static_cast<FixedChain<kNextOut, List>&>(*chain_).ctx;
+  }
+
+  typename std::conditional<std::is_abstract<H>::value,
+                            folly::Unit,
+                            folly::Optional<H>>::type storage_;
+  std::shared_ptr<H> handlerPtr_;
+  H* handler_{nullptr};
+  std::weak_ptr<PipelineBase> pipelineWeak_;
+  PipelineBase* pipelineRaw_{nullptr};
+  FixedChain<0, List>* chain_{nullptr};
+  bool attached_{false};
+};
+
+} // namespace detail
+
+/*
+ * FixedStaticPipeline is constructed like StaticPipeline, but the links
+ * between its handlers are resolved at compile time: each context calls its
+ * neighbour by concrete type instead of through InboundLink/OutboundLink, and
+ * type mismatches between adjacent handlers are compile errors rather than
+ * std::invalid_argument from finalize(). Only the entry points from the
+ * Pipeline<R, W> interface (read(), write(), ...) remain virtual calls.
+ *
+ * Handlers cannot be added to or removed from a FixedStaticPipeline, and
+ * handlers must be retrieved with its own getHandler<H>().
+ */
+template <class R, class W, class... Handlers>
+class FixedStaticPipeline : public Pipeline<R, W> {
+  typedef detail::FixedHandlerList<Handlers...> List;
+
+ public:
+  using Ptr = std::shared_ptr<FixedStaticPipeline>;
+
+  template <class... HandlerArgs>
+  static Ptr create(HandlerArgs&&... handlers) {
+    auto ptr = std::shared_ptr<FixedStaticPipeline>(
+        new FixedStaticPipeline(std::forward<HandlerArgs>(handlers)...));
+    ptr->initialize();
+    return ptr;
+  }
+
+  ~FixedStaticPipeline() {
+    Pipeline<R, W>::detachHandlers();
+  }
+
+  // Returns the first handler of type H, or nullptr
+  template <class H>
+  H* getHandler() {
+    return getHandlerFrom<H, 0>(
+        std::integral_constant<bool, (List::size > 0)>());
+  }
+
+ protected:
+  template <class... HandlerArgs>
+  explicit FixedStaticPipeline(HandlerArgs&&... handlers)
+    : Pipeline<R, W>(true) {
+    static_assert(sizeof...(HandlerArgs) == sizeof...(Handlers),
+                  "FixedStaticPipeline needs exactly one argument per handler");
+    setHandlers<0>(std::forward<HandlerArgs>(handlers)...);
+  }
+
+ private:
+  template <size_t I>
+  detail::FixedContextImpl<I, List>& context() {
+    return static_cast<detail::FixedChain<I, List>&>(chain_).ctx;
+  }
+
+  template <size_t I>
+  void setHandlers() {}
+
+  template <size_t I, class HandlerArg, class... HandlerArgs>
+  void setHandlers(HandlerArg&& handler, HandlerArgs&&... handlers) {
+    context<I>().setHandler(std::forward<HandlerArg>(handler));
+    setHandlers<I + 1>(std::forward<HandlerArgs>(handlers)...);
+  }
+
+  void initialize() {
+    addContexts<0>(std::integral_constant<bool, (List::size > 0)>());
+    Pipeline<R, W>::finalize();
+  }
+
+  template <size_t I>
+  void addContexts(std::false_type) {}
+
+  // Registers contexts back to front, so ctxs_ ends up in handler order
+  template <size_t I>
+  void addContexts(std::true_type) {
+    addContexts<I + 1>(std::integral_constant<bool, (I + 1 < List::size)>());
+    context<I>().initialize(this->shared_from_this(), &chain_);
+    this->addContextFront(&context<I>());
+  }
+
+  template <class H, size_t I>
+  H* getHandlerFrom(std::false_type) {
+    return nullptr;
+  }
+
+  template <class H, size_t I>
+  H* getHandlerFrom(std::true_type) {
+    return getHandlerAt<H, I>(
+        std::is_same<H, typename List::template at<I>>());
+  }
+
+  template <class H, size_t I>
+  H* getHandlerAt(std::true_type) {
+    return context<I>().getHandler();
+  }
+
+  template <class H, size_t I>
+  H* getHandlerAt(std::false_type) {
+    return getHandlerFrom<H, I + 1>(
+        std::integral_constant<bool, (I + 1 < List::size)>());
+  }
+
+  detail::FixedChain<0, List> chain_;
+};
+
 } // namespace wangle
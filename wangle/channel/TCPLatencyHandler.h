@@ -0,0 +1,216 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <folly/io/IOBuf.h>
+#include <folly/io/IOBufQueue.h>
+#include <folly/io/async/AsyncSocket.h>
+#include <folly/io/async/EventBase.h>
+#include <wangle/channel/Handler.h>
+
+namespace wangle {
+
+struct TCPLatencyStats {
+  // Reads ACKed at once for their response not being written in the loop
+  // that read them
+  uint64_t quickAcks{0};
+  // Writes corked for not being responses, and times they were pushed out
+  uint64_t corkedWrites{0};
+  uint64_t pushes{0};
+};
+
+/*
+ * TCPLatencyHandler keeps delayed ACKs and Nagle's algorithm from
+ * stalling request/response traffic, which they can for up to 40ms on
+ * small messages, while leaving bulk transfers alone:
+ *
+ * - A small read whose response isn't written by the end of the event
+ *   loop that read it (e.g. because it's computed on another thread), is
+ *   ACKed at once with TCP_QUICKACK, rather than the kernel holding the
+ *   ACK back for the response to carry it. A client whose request spans
+ *   segments doesn't wait on the ACK to send the rest. Linux turns quick
+ *   ACKs off again by itself, so it's set for each such read. Responses
+ *   written in the same loop still carry their ACK, and reads over
+ *   maxQuickAckReadBytes, which are bulk uploads, are ACKed as usual.
+ * - The socket is TCP_NODELAY, so that responses go out as soon as
+ *   they're written. Writes made while no response is pending, which are
+ *   streamed or pushed data, are corked (WriteFlags::CORK) so that the
+ *   kernel sends them in full segments, and pushed out at the end of the
+ *   loop by setting TCP_NODELAY again.
+ *
+ * Over transports other than sockets, everything passes through.
+ *
+ * Put it right after the transport handler, below any write buffering
+ * handler such as OutputBufferingHandler, so that it sees the writes as
+ * they are made to the transport. This handler may only be used in a
+ * single Pipeline.
+ */
+class TCPLatencyHandler : public BytesToBytesHandler,
+                          protected folly::EventBase::LoopCallback {
+ public:
+  struct Options {
+    bool quickAck{true};
+    uint64_t maxQuickAckReadBytes{16384};
+    bool noDelay{true};
+    bool corkNonResponses{true};
+  };
+
+  TCPLatencyHandler() = default;
+
+  explicit TCPLatencyHandler(Options options) : options_(options) {}
+
+  TCPLatencyHandler(TCPLatencyHandler&& other)
+    : options_(other.options_) {}
+
+  const TCPLatencyStats& getStats() const {
+    return stats_;
+  }
+
+  // Whether a request was read that no write answered yet
+  bool isResponsePending() const {
+    return responsePending_;
+  }
+
+  void transportActive(Context* ctx) override {
+    if (options_.noDelay) {
+      setOption(ctx, TCP_NODELAY);
+    }
+    ctx->fireTransportActive();
+  }
+
+  void read(Context* ctx, folly::IOBufQueue& q) override {
+    // Only the bytes the handlers after this one didn't leave last time
+    const auto len = q.chainLength();
+    const auto bytes = len > unconsumed_ ? len - unconsumed_ : 0;
+    if (bytes > 0) {
+      responsePending_ = true;
+      quickAckPending_ =
+        options_.quickAck && bytes <= options_.maxQuickAckReadBytes;
+      if (quickAckPending_) {
+        schedule(ctx);
+      }
+    }
+    ctx->fireRead(q);
+    unconsumed_ = q.chainLength();
+  }
+
+  folly::Future<folly::Unit> write(
+      Context* ctx,
+      std::unique_ptr<folly::IOBuf> buf) override {
+    if (!shouldCork()) {
+      responded();
+      return ctx->fireWrite(std::move(buf));
+    }
+    auto pipeline = ctx->getPipeline();
+    const auto flags = pipeline->getWriteFlags();
+    corked(ctx);
+    pipeline->setWriteFlags(flags | folly::WriteFlags::CORK);
+    auto future = ctx->fireWrite(std::move(buf));
+    pipeline->setWriteFlags(flags);
+    return future;
+  }
+
+  void writeNoFuture(
+      Context* ctx,
+      std::unique_ptr<folly::IOBuf> buf) override {
+    if (!shouldCork()) {
+      responded();
+      ctx->fireWriteNoFuture(std::move(buf));
+      return;
+    }
+    auto pipeline = ctx->getPipeline();
+    const auto flags = pipeline->getWriteFlags();
+    corked(ctx);
+    pipeline->setWriteFlags(flags | folly::WriteFlags::CORK);
+    ctx->fireWriteNoFuture(std::move(buf));
+    pipeline->setWriteFlags(flags);
+  }
+
+  void runLoopCallback() noexcept override {
+    auto ctx = getContext();
+    if (quickAckPending_) {
+      quickAckPending_ = false;
+      stats_.quickAcks++;
+#ifdef TCP_QUICKACK
+      setOption(ctx, TCP_QUICKACK);
+#endif
+    }
+    if (pushPending_) {
+      pushPending_ = false;
+      stats_.pushes++;
+      setOption(ctx, TCP_NODELAY);
+    }
+  }
+
+  folly::Future<folly::Unit> close(Context* ctx) override {
+    cancel();
+    return ctx->fireClose();
+  }
+
+  void detachPipeline(Context* /* ctx */) override {
+    cancel();
+  }
+
+ private:
+  bool shouldCork() const {
+    return options_.corkNonResponses && !responsePending_;
+  }
+
+  // A response goes out, and carries the ACK
+  void responded() {
+    responsePending_ = false;
+    quickAckPending_ = false;
+  }
+
+  void corked(Context* ctx) {
+    stats_.corkedWrites++;
+    pushPending_ = true;
+    schedule(ctx);
+  }
+
+  void schedule(Context* ctx) {
+    if (!isLoopCallbackScheduled()) {
+      ctx->getTransport()->getEventBase()->runInLoop(this);
+    }
+  }
+
+  void cancel() {
+    if (isLoopCallbackScheduled()) {
+      cancelLoopCallback();
+    }
+    quickAckPending_ = false;
+    pushPending_ = false;
+  }
+
+  // Failures only cost latency, and are expected of sockets other than TCP
+  static void setOption(Context* ctx, int option) {
+    auto sock = dynamic_cast<folly::AsyncSocket*>(ctx->getTransport().get());
+    if (!sock || sock->getFd() < 0) {
+      return;
+    }
+    int one = 1;
+    setsockopt(sock->getFd(), IPPROTO_TCP, option, &one, sizeof(one));
+  }
+
+  Options options_;
+  // What the handlers after this one left in the read queue last time
+  uint64_t unconsumed_{0};
+  bool responsePending_{false};
+  bool quickAckPending_{false};
+  bool pushPending_{false};
+  TCPLatencyStats stats_;
+};
+
+} // namespace wangle
@@ -0,0 +1,168 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+
+#include <folly/io/IOBuf.h>
+#include <folly/io/async/AsyncSSLSocket.h>
+#include <wangle/channel/Handler.h>
+
+namespace wangle {
+
+struct TLSRecordSizingStats {
+  // Records written at the small and at the large record size, counting
+  // each write as whole records
+  uint64_t smallRecords{0};
+  uint64_t largeRecords{0};
+  uint64_t smallRecordBytes{0};
+  uint64_t largeRecordBytes{0};
+  // Times the connection went back to small records for being idle
+  uint64_t idleResets{0};
+};
+
+/*
+ * TLSRecordSizingHandler sizes the TLS records of an AsyncSSLSocket
+ * transport to the point of the connection: a new connection, or one
+ * that was idle, gets records that fit in a packet, so that the client
+ * can decrypt and use the first bytes without waiting for the rest of a
+ * 16KB record to arrive; once setRampBytes() bytes were written, or
+ * setRampTime() passed, since then, records grow to the maximum size,
+ * which costs less CPU and framing per byte for bulk transfers. An idle
+ * time of setIdleReset() starts over with small records.
+ *
+ * The record size is set with SSL_set_max_send_fragment() before
+ * passing each write on, so a write crossing the threshold is still sent
+ * in small records. Over other transports the writes pass through, with
+ * the stats counted as if they were TLS.
+ *
+ * Put it after any write buffering handler, so that it sees the writes
+ * as they are made to the transport. This handler may only be used in a
+ * single Pipeline.
+ */
+class TLSRecordSizingHandler : public OutboundBytesToBytesHandler {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  // A TCP segment, minus the TLS record overhead
+  static constexpr size_t kDefaultSmallRecordSize = 1369;
+  static constexpr size_t kDefaultLargeRecordSize = 16384;
+  static constexpr size_t kDefaultRampBytes = 1024 * 1024;
+
+  void setRecordSizes(size_t small, size_t large) {
+    smallRecordSize_ = std::max<size_t>(small, 512);
+    largeRecordSize_ = std::max(smallRecordSize_,
+                                std::min<size_t>(large, 16384));
+  }
+
+  void setRampBytes(size_t bytes) {
+    rampBytes_ = bytes;
+  }
+
+  void setRampTime(std::chrono::milliseconds time) {
+    rampTime_ = time;
+  }
+
+  void setIdleReset(std::chrono::milliseconds time) {
+    idleReset_ = time;
+  }
+
+  bool isRampedUp() const {
+    return rampedUp_;
+  }
+
+  const TLSRecordSizingStats& getStats() const {
+    return stats_;
+  }
+
+  folly::Future<folly::Unit> write(
+      Context* ctx,
+      std::unique_ptr<folly::IOBuf> buf) override {
+    account(ctx, buf.get());
+    return ctx->fireWrite(std::move(buf));
+  }
+
+  void writeNoFuture(
+      Context* ctx,
+      std::unique_ptr<folly::IOBuf> buf) override {
+    account(ctx, buf.get());
+    ctx->fireWriteNoFuture(std::move(buf));
+  }
+
+ private:
+  void account(Context* ctx, const folly::IOBuf* buf) {
+    const auto length = buf ? buf->computeChainDataLength() : 0;
+    if (length == 0) {
+      return;
+    }
+    const auto now = Clock::now();
+    if (!started_ || now - lastWrite_ >= idleReset_) {
+      if (started_) {
+        stats_.idleResets++;
+      }
+      started_ = true;
+      rampedUp_ = false;
+      bytesSinceStart_ = 0;
+      start_ = now;
+    }
+    lastWrite_ = now;
+    if (!rampedUp_ && now - start_ >= rampTime_) {
+      rampedUp_ = true;
+    }
+
+    const auto recordSize = rampedUp_ ? largeRecordSize_ : smallRecordSize_;
+    applyRecordSize(ctx, recordSize);
+    const auto records = (length + recordSize - 1) / recordSize;
+    if (rampedUp_) {
+      stats_.largeRecords += records;
+      stats_.largeRecordBytes += length;
+    } else {
+      stats_.smallRecords += records;
+      stats_.smallRecordBytes += length;
+      bytesSinceStart_ += length;
+      // For the next writes
+      rampedUp_ = bytesSinceStart_ >= rampBytes_;
+    }
+  }
+
+  void applyRecordSize(Context* ctx, size_t recordSize) {
+    if (recordSize == appliedRecordSize_) {
+      return;
+    }
+    appliedRecordSize_ = recordSize;
+#ifdef SSL_CTRL_SET_MAX_SEND_FRAGMENT
+    auto sslSocket = dynamic_cast<folly::AsyncSSLSocket*>(
+      ctx->getTransport().get());
+    auto ssl = sslSocket ? const_cast<SSL*>(sslSocket->getSSL()) : nullptr;
+    if (ssl) {
+      SSL_set_max_send_fragment(ssl, long(recordSize));
+    }
+#endif
+  }
+
+  size_t smallRecordSize_{kDefaultSmallRecordSize};
+  size_t largeRecordSize_{kDefaultLargeRecordSize};
+  size_t rampBytes_{kDefaultRampBytes};
+  std::chrono::milliseconds rampTime_{1000};
+  std::chrono::milliseconds idleReset_{1000};
+
+  bool started_{false};
+  bool rampedUp_{false};
+  size_t bytesSinceStart_{0};
+  Clock::time_point start_;
+  Clock::time_point lastWrite_;
+  // 0 until set on the transport
+  size_t appliedRecordSize_{0};
+  TLSRecordSizingStats stats_;
+};
+
+} // namespace wangle
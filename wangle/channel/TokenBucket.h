@@ -0,0 +1,87 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace wangle {
+
+/*
+ * A token bucket refilled at rate tokens per second, holding up to burst
+ * of them, which may go into debt: consume() always takes what it's asked
+ * for and says how long until the bucket is out of debt again, so that
+ * the caller, e.g. RateLimitHandler, can wait that long before the next
+ * take. The average rate is kept however big each take is.
+ *
+ * Lock-free, so that one bucket can limit connections of several threads,
+ * e.g. all those of a tenant. The state is the time at which the bucket
+ * was, or will be, empty.
+ */
+class TokenBucket {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  TokenBucket(double rate, double burst)
+    : nanosPerToken_(1e9 / std::max(rate, 1e-9)),
+      burstNanos_(int64_t(std::max(burst, 0.0) * nanosPerToken_)),
+      // Starts full
+      emptyAt_(nanos(Clock::now()) - burstNanos_) {}
+
+  TokenBucket(const TokenBucket&) = delete;
+  TokenBucket& operator=(const TokenBucket&) = delete;
+
+  double getRate() const {
+    return 1e9 / nanosPerToken_;
+  }
+
+  // Takes n tokens, returning how long until the bucket is out of the debt
+  // that leaves it in, if any
+  Clock::duration consume(double n, Clock::time_point now = Clock::now()) {
+    const auto nowNanos = nanos(now);
+    const auto cost = int64_t(n * nanosPerToken_);
+    auto emptyAt = emptyAt_.load(std::memory_order_relaxed);
+    int64_t next;
+    do {
+      next = std::max(emptyAt, nowNanos - burstNanos_) + cost;
+    } while (!emptyAt_.compare_exchange_weak(
+        emptyAt, next, std::memory_order_relaxed));
+    return std::chrono::nanoseconds(std::max<int64_t>(next - nowNanos, 0));
+  }
+
+  // How long until the bucket is out of debt, 0 if it isn't in debt
+  Clock::duration getWait(Clock::time_point now = Clock::now()) const {
+    const auto emptyAt = emptyAt_.load(std::memory_order_relaxed);
+    return std::chrono::nanoseconds(std::max<int64_t>(
+        emptyAt - nanos(now), 0));
+  }
+
+  // Negative while in debt
+  double getAvailable(Clock::time_point now = Clock::now()) const {
+    const auto emptyAt = emptyAt_.load(std::memory_order_relaxed);
+    const auto elapsed = std::min(nanos(now) - emptyAt, burstNanos_);
+    return elapsed / nanosPerToken_;
+  }
+
+ private:
+  static int64_t nanos(Clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        time.time_since_epoch()).count();
+  }
+
+  const double nanosPerToken_;
+  const int64_t burstNanos_;
+  std::atomic<int64_t> emptyAt_;
+};
+
+} // namespace wangle
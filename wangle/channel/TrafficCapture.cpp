@@ -0,0 +1,179 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/TrafficCapture.h>
+
+#include <folly/Exception.h>
+#include <folly/FileUtil.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace wangle {
+
+namespace {
+
+const char kMagic[] = {'W', 'C', 'A', 'P'};
+const uint8_t kVersion = 1;
+
+// Unsigned LEB128, like VarintLengthFieldPrepender's
+size_t encodeVarint(uint64_t value, uint8_t* out) {
+  size_t len = 0;
+  while (value >= 0x80) {
+    out[len++] = 0x80 | (value & 0x7f);
+    value >>= 7;
+  }
+  out[len++] = value;
+  return len;
+}
+
+// False if data ends before the varint does
+bool decodeVarint(folly::StringPiece& data, uint64_t& value) {
+  value = 0;
+  for (size_t i = 0; i < data.size() && i < 10; i++) {
+    const uint8_t byte = data[i];
+    value |= uint64_t(byte & 0x7f) << (7 * i);
+    if (!(byte & 0x80)) {
+      data.advance(i + 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+TrafficCapture::TrafficCapture(
+    const std::string& path,
+    uint32_t sampleRate,
+    uint64_t maxBytes)
+  : sampleRate_(std::max<uint32_t>(sampleRate, 1)),
+    maxBytes_(maxBytes),
+    file_(fopen(path.c_str(), "wb")) {
+  if (!file_) {
+    folly::throwSystemError("fopen() failed for " + path);
+  }
+  fwrite(kMagic, 1, sizeof(kMagic), file_);
+  fwrite(&kVersion, 1, 1, file_);
+}
+
+TrafficCapture::~TrafficCapture() {
+  fclose(file_);
+}
+
+uint64_t TrafficCapture::openSession() {
+  if (connections_.fetch_add(1, std::memory_order_relaxed) % sampleRate_ ||
+      (maxBytes_ && getBytes() >= maxBytes_)) {
+    return 0;
+  }
+  std::lock_guard<std::mutex> guard(mutex_);
+  const auto session = nextSession_++;
+  writeRecord(OPEN, session);
+  return session;
+}
+
+void TrafficCapture::record(
+    uint64_t session,
+    std::chrono::microseconds offset,
+    folly::StringPiece data) {
+  // A session goes on past maxBytes, so that it isn't cut mid-message
+  std::lock_guard<std::mutex> guard(mutex_);
+  writeRecord(DATA, session, offset, data);
+}
+
+void TrafficCapture::closeSession(uint64_t session) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  writeRecord(CLOSE, session);
+  // So that whole sessions make it to the file even if the process doesn't
+  // exit cleanly
+  fflush(file_);
+}
+
+void TrafficCapture::flush() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  fflush(file_);
+}
+
+void TrafficCapture::writeRecord(
+    Record type,
+    uint64_t session,
+    std::chrono::microseconds offset,
+    folly::StringPiece data) {
+  uint8_t header[1 + 3 * 10];
+  size_t len = 0;
+  header[len++] = type;
+  len += encodeVarint(session, header + len);
+  if (type == DATA) {
+    len += encodeVarint(offset.count(), header + len);
+    len += encodeVarint(data.size(), header + len);
+  }
+  fwrite(header, 1, len, file_);
+  fwrite(data.data(), 1, data.size(), file_);
+  bytes_.fetch_add(len + data.size(), std::memory_order_relaxed);
+}
+
+std::vector<CapturedSession> TrafficCapture::read(const std::string& path) {
+  std::string contents;
+  if (!folly::readFile(path.c_str(), contents)) {
+    folly::throwSystemError("readFile() failed for " + path);
+  }
+  folly::StringPiece data(contents);
+  if (data.size() < sizeof(kMagic) + 1 ||
+      !data.startsWith(folly::StringPiece(kMagic, sizeof(kMagic))) ||
+      uint8_t(data[sizeof(kMagic)]) != kVersion) {
+    throw std::runtime_error(path + " is not a traffic capture");
+  }
+  data.advance(sizeof(kMagic) + 1);
+
+  std::vector<CapturedSession> sessions;
+  // Of each session number, its place in sessions
+  std::unordered_map<uint64_t, size_t> index;
+  while (!data.empty()) {
+    auto record = data;
+    const uint8_t type = record[0];
+    record.advance(1);
+    uint64_t session;
+    if (!decodeVarint(record, session)) {
+      break;
+    }
+    if (type == OPEN) {
+      index[session] = sessions.size();
+      sessions.emplace_back();
+    } else if (type == DATA || type == CLOSE) {
+      auto it = index.find(session);
+      if (it == index.end()) {
+        throw std::runtime_error(path + " has a record of no session");
+      }
+      auto& s = sessions[it->second];
+      if (type == CLOSE) {
+        s.closed = true;
+      } else {
+        uint64_t offset;
+        uint64_t len;
+        if (!decodeVarint(record, offset) || !decodeVarint(record, len) ||
+            record.size() < len) {
+          break;
+        }
+        CapturedChunk chunk;
+        chunk.offset = std::chrono::microseconds(offset);
+        chunk.data = record.subpiece(0, len).str();
+        s.chunks.push_back(std::move(chunk));
+        record.advance(len);
+      }
+    } else {
+      throw std::runtime_error(path + " has a record of unknown type");
+    }
+    data = record;
+  }
+  return sessions;
+}
+
+} // namespace wangle
@@ -0,0 +1,185 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/Range.h>
+#include <folly/io/Cursor.h>
+#include <wangle/channel/Handler.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace wangle {
+
+// One read of a captured connection, at its offset from the connection's
+// start
+struct CapturedChunk {
+  std::chrono::microseconds offset{0};
+  std::string data;
+};
+
+struct CapturedSession {
+  std::vector<CapturedChunk> chunks;
+  // False if the capture ended before the connection did
+  bool closed{false};
+};
+
+/*
+ * A file of the bytes connections read, chunk by chunk as the transport
+ * delivered them, for TrafficReplay to play back through a pipeline. One
+ * connection in sampleRate is captured, whole, until the file holds
+ * maxBytes (0 for no limit). Thread safe, so one capture can be shared by
+ * the pipelines of all IO threads; captured connections take a lock for
+ * each read.
+ *
+ * The file is "WCAP" and a version byte, followed by records of a type
+ * byte, the session as a varint and, for data, the offset in microseconds
+ * and the length as varints, then the bytes. Sessions are numbered from 1
+ * in the order they were opened, and their records interleave.
+ */
+class TrafficCapture {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  // Throws std::system_error if path can't be opened for writing
+  explicit TrafficCapture(
+      const std::string& path,
+      uint32_t sampleRate = 1,
+      uint64_t maxBytes = 0);
+  ~TrafficCapture();
+
+  TrafficCapture(const TrafficCapture&) = delete;
+  TrafficCapture& operator=(const TrafficCapture&) = delete;
+
+  // The new session, or 0 if the connection isn't sampled or the file is
+  // full
+  uint64_t openSession();
+
+  void record(
+      uint64_t session,
+      std::chrono::microseconds offset,
+      folly::StringPiece data);
+
+  void closeSession(uint64_t session);
+
+  // Writes out what is buffered
+  void flush();
+
+  uint64_t getBytes() const {
+    return bytes_.load(std::memory_order_relaxed);
+  }
+
+  // The sessions of a capture file, in the order they were opened. Throws
+  // std::system_error if it can't be read, std::runtime_error if it isn't a
+  // capture; a capture cut short, e.g. by a crash, keeps its whole records.
+  static std::vector<CapturedSession> read(const std::string& path);
+
+ private:
+  enum Record : uint8_t {
+    OPEN = 1,
+    DATA = 2,
+    CLOSE = 3,
+  };
+
+  void writeRecord(
+      Record type,
+      uint64_t session,
+      std::chrono::microseconds offset = std::chrono::microseconds(0),
+      folly::StringPiece data = folly::StringPiece());
+
+  const uint32_t sampleRate_;
+  const uint64_t maxBytes_;
+  std::atomic<uint64_t> connections_{0};
+  std::atomic<uint64_t> bytes_{0};
+  std::mutex mutex_;
+  FILE* file_;
+  uint64_t nextSession_{1};
+};
+
+/*
+ * Records what the transport handler in front of it reads into a
+ * TrafficCapture, passing it all on. Add it right after the transport
+ * handler, e.g. AsyncSocketHandler. This handler may only be used in a
+ * single Pipeline.
+ */
+class TrafficCaptureHandler : public BytesToBytesHandler {
+ public:
+  explicit TrafficCaptureHandler(std::shared_ptr<TrafficCapture> capture)
+    : capture_(std::move(capture)) {}
+
+  ~TrafficCaptureHandler() {
+    close();
+  }
+
+  void transportActive(Context* ctx) override {
+    if (!session_) {
+      session_ = capture_->openSession();
+      start_ = TrafficCapture::Clock::now();
+      unconsumed_ = 0;
+    }
+    ctx->fireTransportActive();
+  }
+
+  void read(Context* ctx, folly::IOBufQueue& q) override {
+    // The bytes the handlers after this one left in q were recorded already
+    const auto len = q.chainLength();
+    if (session_ && len > unconsumed_) {
+      folly::io::Cursor cursor(q.front());
+      cursor.skip(unconsumed_);
+      capture_->record(
+          session_,
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              TrafficCapture::Clock::now() - start_),
+          cursor.readFixedString(len - unconsumed_));
+    }
+    ctx->fireRead(q);
+    unconsumed_ = q.chainLength();
+  }
+
+  void readEOF(Context* ctx) override {
+    close();
+    ctx->fireReadEOF();
+  }
+
+  void transportInactive(Context* ctx) override {
+    close();
+    ctx->fireTransportInactive();
+  }
+
+  void detachPipeline(Context* /*ctx*/) override {
+    close();
+  }
+
+  bool reset() override {
+    close();
+    return true;
+  }
+
+ private:
+  void close() {
+    if (session_) {
+      capture_->closeSession(session_);
+      session_ = 0;
+    }
+  }
+
+  std::shared_ptr<TrafficCapture> capture_;
+  uint64_t session_{0};
+  TrafficCapture::Clock::time_point start_;
+  uint64_t unconsumed_{0};
+};
+
+} // namespace wangle
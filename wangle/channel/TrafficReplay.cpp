@@ -0,0 +1,108 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/TrafficReplay.h>
+
+namespace wangle {
+
+namespace {
+
+// Stands in for the transport at the front of replayed pipelines
+class ReplayTransportHandler : public BytesToBytesHandler {
+ public:
+  explicit ReplayTransportHandler(TrafficReplayStats* stats)
+    : stats_(stats) {}
+
+  folly::Future<folly::Unit> write(
+      Context* /*ctx*/,
+      std::unique_ptr<folly::IOBuf> buf) override {
+    writeNoFuture(nullptr, std::move(buf));
+    return folly::makeFuture();
+  }
+
+  void writeNoFuture(
+      Context* /*ctx*/,
+      std::unique_ptr<folly::IOBuf> buf) override {
+    if (buf) {
+      stats_->bytesWritten += buf->computeChainDataLength();
+    }
+  }
+
+  folly::Future<folly::Unit> close(Context* /*ctx*/) override {
+    closed_ = true;
+    return folly::makeFuture();
+  }
+
+  bool isClosed() const {
+    return closed_;
+  }
+
+ private:
+  TrafficReplayStats* stats_;
+  bool closed_{false};
+};
+
+void addStats(HandlerStats& total, const HandlerStats& stats) {
+  total.inboundCalls += stats.inboundCalls;
+  total.outboundCalls += stats.outboundCalls;
+  total.messages += stats.messages;
+  total.bytes += stats.bytes;
+  total.sampledCalls += stats.sampledCalls;
+  total.sampledTime += stats.sampledTime;
+}
+
+} // namespace
+
+TrafficReplayStats TrafficReplay::run(
+    PipelineFactory<DefaultPipeline>& factory,
+    uint32_t sampleRate) const {
+  TrafficReplayStats stats;
+  const auto start = std::chrono::steady_clock::now();
+  for (const auto& session : sessions_) {
+    auto pipeline = factory.newPipeline(nullptr);
+    auto transport = std::make_shared<ReplayTransportHandler>(&stats);
+    pipeline->addFront(transport);
+    pipeline->setInstrumentation(sampleRate);
+    pipeline->finalize();
+
+    pipeline->transportActive();
+    folly::IOBufQueue q(folly::IOBufQueue::cacheChainLength());
+    for (const auto& chunk : session.chunks) {
+      if (transport->isClosed()) {
+        break;
+      }
+      // Copied like a transport's read, as handlers may change it in place
+      q.append(folly::IOBuf::copyBuffer(chunk.data));
+      pipeline->read(q);
+      stats.chunks++;
+      stats.bytesRead += chunk.data.size();
+    }
+    if (session.closed && !transport->isClosed()) {
+      pipeline->readEOF();
+    }
+    pipeline->transportInactive();
+
+    size_t i = 0;
+    pipeline->getHandlerStats([&](const HandlerStats& handler) {
+      if (i == stats.handlers.size()) {
+        stats.handlers.push_back(handler);
+      } else {
+        addStats(stats.handlers[i], handler);
+      }
+      i++;
+    });
+    stats.sessions++;
+  }
+  stats.elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start);
+  return stats;
+}
+
+} // namespace wangle
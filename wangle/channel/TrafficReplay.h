@@ -0,0 +1,65 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/channel/Pipeline.h>
+#include <wangle/channel/TrafficCapture.h>
+
+#include <chrono>
+#include <vector>
+
+namespace wangle {
+
+struct TrafficReplayStats {
+  uint64_t sessions{0};
+  uint64_t chunks{0};
+  uint64_t bytesRead{0};
+  uint64_t bytesWritten{0};
+  // Of the whole replay, including building the pipelines
+  std::chrono::nanoseconds elapsed{0};
+  // Summed over the sessions, front to back. The time of a handler includes
+  // that of the handlers it calls, see PipelineBase::setInstrumentation().
+  std::vector<HandlerStats> handlers;
+};
+
+/*
+ * Plays captured connections (see TrafficCapture) back through the
+ * pipelines of a factory, one after the other and as fast as they take
+ * them, so that handlers can be benchmarked on the fragmentation and mix of
+ * real traffic, the same way every run.
+ *
+ * Each session gets a new pipeline from newPipeline(nullptr), in front of
+ * which the replay puts a handler of its own standing in for the
+ * transport: it reads the captured chunks in, and takes the writes,
+ * completing them at once. Factories should then leave out their transport
+ * handler, e.g. AsyncSocketHandler, and handlers that need a transport or
+ * an EventBase can't be replayed.
+ */
+class TrafficReplay {
+ public:
+  explicit TrafficReplay(std::vector<CapturedSession> sessions)
+    : sessions_(std::move(sessions)) {}
+
+  // Times one handler call in sampleRate; 1, timing them all, suits replays,
+  // which have no network time to hide the cost in
+  TrafficReplayStats run(
+      PipelineFactory<DefaultPipeline>& factory,
+      uint32_t sampleRate = 1) const;
+
+  const std::vector<CapturedSession>& getSessions() const {
+    return sessions_;
+  }
+
+ private:
+  std::vector<CapturedSession> sessions_;
+};
+
+} // namespace wangle
@@ -0,0 +1,215 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+
+#include <folly/futures/SharedPromise.h>
+#include <wangle/channel/Handler.h>
+#include <wangle/channel/ReadBufferPool.h>
+#include <folly/io/async/EventBase.h>
+#include <folly/io/IOBuf.h>
+
+namespace wangle {
+
+/*
+ * WriteCoalescingHandler batches writes until the end of the event loop like
+ * OutputBufferingHandler, but also compacts them for writev(): buffers
+ * shorter than setCopyThreshold() (headers, length prefixes, small payload
+ * pieces) are copied next to each other into one contiguous buffer, while
+ * larger ones are chained by reference. A batch is flushed early once it has
+ * setMaxSegments() buffers, which bounds the iovec count of each write.
+ *
+ * The copy buffer is reused across batches: each flush hands out a clone of
+ * the bytes written so far and keeps appending after them, so a new block is
+ * only allocated when the current one is full.
+ *
+ * This handler may only be used in a single Pipeline.
+ */
+class WriteCoalescingHandler : public OutboundBytesToBytesHandler,
+                               protected folly::EventBase::LoopCallback {
+ public:
+  static constexpr size_t kDefaultCopyThreshold = 1024;
+  static constexpr size_t kDefaultMaxSegments = 64;
+  static constexpr size_t kDefaultBlockSize = 16384;
+
+  // Buffers shorter than this are copied
+  void setCopyThreshold(size_t bytes) {
+    copyThreshold_ = bytes;
+  }
+
+  // 0 means no limit
+  void setMaxSegments(size_t segments) {
+    maxSegments_ = segments;
+  }
+
+  // Size of the blocks small buffers are copied into
+  void setBlockSize(size_t bytes) {
+    blockSize_ = std::max<size_t>(bytes, 1);
+  }
+
+  folly::Future<folly::Unit> write(
+      Context* ctx,
+      std::unique_ptr<folly::IOBuf> buf) override {
+    CHECK(buf);
+    enqueue(ctx, std::move(buf));
+    promisePending_ = true;
+    auto future = sharedPromise_.getFuture();
+    flushIfOverLimit();
+    return future;
+  }
+
+  void writeNoFuture(
+      Context* ctx,
+      std::unique_ptr<folly::IOBuf> buf) override {
+    CHECK(buf);
+    enqueue(ctx, std::move(buf));
+    flushIfOverLimit();
+  }
+
+  void runLoopCallback() noexcept override {
+    flush();
+  }
+
+  folly::Future<folly::Unit> close(Context* ctx) override {
+    if (isLoopCallbackScheduled()) {
+      cancelLoopCallback();
+    }
+
+    // If there are sends queued, cancel them
+    sharedPromise_.setException(
+      folly::make_exception_wrapper<std::runtime_error>(
+        "close() called while sends still pending"));
+    sends_.reset();
+    if (block_) {
+      block_->trimStart(block_->length());
+    }
+    segments_ = 0;
+    sharedPromise_ = folly::SharedPromise<folly::Unit>();
+    promisePending_ = false;
+    return ctx->fireClose();
+  }
+
+ private:
+  void enqueue(Context* ctx, std::unique_ptr<folly::IOBuf> buf) {
+    if (!sends_ && !pendingCopies() && !isLoopCallbackScheduled()) {
+      ctx->getTransport()->getEventBase()->runInLoop(this);
+    }
+
+    while (buf) {
+      auto rest = buf->pop();
+      const auto length = buf->length();
+      if (length > 0 && length < copyThreshold_) {
+        copy(buf->data(), length);
+      } else if (length > 0) {
+        emitCopies();
+        append(std::move(buf));
+      }
+      buf = std::move(rest);
+    }
+  }
+
+  void copy(const uint8_t* data, size_t length) {
+    if (!block_ || block_->tailroom() < length) {
+      emitCopies();
+      block_ = newBlock(length);
+    }
+    if (!pendingCopies()) {
+      // The copies since the last buffer chained by reference are one more
+      // segment of the batch
+      segments_++;
+    }
+    memcpy(block_->writableTail(), data, length);
+    block_->append(length);
+  }
+
+  // From the pipeline's ReadBufferPool if it's hugepage-backed, so that
+  // writes are copied into the same few pages as reads
+  std::unique_ptr<folly::IOBuf> newBlock(size_t length) {
+    auto pool = getContext()->getPipeline()->getReadBufferPool();
+    if (pool && pool->usesHugePages() && pool->getBufferSize() >= length) {
+      return pool->get();
+    }
+    return folly::IOBuf::create(std::max(blockSize_, length));
+  }
+
+  bool pendingCopies() const {
+    return block_ && block_->length() > 0;
+  }
+
+  // Chains a clone of the bytes copied since the last call, leaving the
+  // rest of the block for the next copies
+  void emitCopies() {
+    if (!pendingCopies()) {
+      return;
+    }
+    auto copies = block_->cloneOne();
+    block_->trimStart(block_->length());
+    append(std::move(copies), false);
+  }
+
+  void append(std::unique_ptr<folly::IOBuf> buf, bool newSegment = true) {
+    if (newSegment) {
+      segments_++;
+    }
+    if (!sends_) {
+      sends_ = std::move(buf);
+    } else {
+      sends_->prependChain(std::move(buf));
+    }
+  }
+
+  void flushIfOverLimit() {
+    if (maxSegments_ > 0 && segments_ >= maxSegments_) {
+      flush();
+    }
+  }
+
+  void flush() {
+    if (isLoopCallbackScheduled()) {
+      cancelLoopCallback();
+    }
+    emitCopies();
+    if (!sends_) {
+      return;
+    }
+    segments_ = 0;
+
+    auto ctx = getContext();
+    if (!promisePending_) {
+      ctx->fireWriteNoFuture(std::move(sends_));
+    } else {
+      promisePending_ = false;
+      folly::MoveWrapper<folly::SharedPromise<folly::Unit>> sharedPromise;
+      std::swap(*sharedPromise, sharedPromise_);
+      ctx->fireWrite(std::move(sends_))
+        .then([sharedPromise](folly::Try<folly::Unit> t) mutable {
+          sharedPromise->setTry(std::move(t));
+        });
+    }
+  }
+
+  size_t copyThreshold_{kDefaultCopyThreshold};
+  size_t maxSegments_{kDefaultMaxSegments};
+  size_t blockSize_{kDefaultBlockSize};
+
+  folly::SharedPromise<folly::Unit> sharedPromise_;
+  // Whether a Future was handed out for the batch currently in sends_
+  bool promisePending_{false};
+  std::unique_ptr<folly::IOBuf> sends_;
+  // Block small buffers are copied into. Its data are the copies not yet
+  // chained onto sends_; the bytes before it belong to earlier batches.
+  std::unique_ptr<folly::IOBuf> block_;
+  size_t segments_{0};
+};
+
+} // namespace wangle
@@ -9,6 +9,8 @@
  */
 #pragma once
 
+#include <algorithm>
+
 namespace wangle {
 
 template <typename T, typename R>
@@ -17,14 +19,21 @@ void BroadcastHandler<T, R>::read(Context* ctx, T data) {
   forEachSubscriber([&](Subscriber<T, R>* s) {
     s->onNext(data);
   });
+  if (replayMaxMessages_ > 0) {
+    replayBytes_ += messageSize(data);
+    replay_.push_back(std::move(data));
+    trimReplay();
+  }
 }
 
 template <typename T, typename R>
 void BroadcastHandler<T, R>::readEOF(Context* ctx) {
+  replay_.clear();
+  replayBytes_ = 0;
   forEachSubscriber([&](Subscriber<T, R>* s) {
     s->onCompleted();
   });
-  subscribers_.clear();
+  clearSubscribers();
   closeIfIdle();
 }
 
@@ -34,36 +43,123 @@ void BroadcastHandler<T, R>::readException(Context* ctx,
   LOG(ERROR) << "Error while reading from upstream for broadcast: "
              << exceptionStr(ex);
 
+  replay_.clear();
+  replayBytes_ = 0;
   forEachSubscriber([&](Subscriber<T, R>* s) {
     s->onError(ex);
   });
-  subscribers_.clear();
+  clearSubscribers();
   closeIfIdle();
 }
 
 template <typename T, typename R>
 uint64_t BroadcastHandler<T, R>::subscribe(Subscriber<T, R>* subscriber) {
   auto subscriptionId = nextSubscriptionId_++;
-  subscribers_[subscriptionId] = subscriber;
+  subscribers_.push_back(SubscriberEntry{subscriptionId, subscriber});
+  numSubscribers_++;
   onSubscribe(subscriber);
+  if (!replay_.empty()) {
+    replay(subscriptionId, subscriber);
+  }
   return subscriptionId;
 }
 
+template <typename T, typename R>
+void BroadcastHandler<T, R>::replay(uint64_t subscriptionId,
+                                    Subscriber<T, R>* subscriber) {
+  // The subscriber may unsubscribe from onNext(), closing the pipeline
+  std::shared_ptr<PipelineBase> guard;
+  if (this->getContext()) {
+    guard = this->getContext()->getPipelineShared();
+  }
+  auto subscribed = [&] {
+    auto iter = std::lower_bound(
+        subscribers_.begin(),
+        subscribers_.end(),
+        subscriptionId,
+        [](const SubscriberEntry& entry, uint64_t id) {
+          return entry.id < id;
+        });
+    return iter != subscribers_.end() && iter->id == subscriptionId &&
+        iter->subscriber;
+  };
+  // The buffer can't change meanwhile: nothing is read in between
+  for (size_t i = 0; i < replay_.size() && subscribed(); i++) {
+    subscriber->onNext(replay_[i]);
+  }
+}
+
+template <typename T, typename R>
+void BroadcastHandler<T, R>::setReplayBuffer(size_t maxMessages,
+                                             uint64_t maxBytes) {
+  replayMaxMessages_ = maxMessages;
+  replayMaxBytes_ = maxBytes;
+  trimReplay();
+}
+
+template <typename T, typename R>
+void BroadcastHandler<T, R>::trimReplay() {
+  while (!replay_.empty() &&
+         (replay_.size() > replayMaxMessages_ ||
+          (replayMaxBytes_ > 0 && replayBytes_ > replayMaxBytes_))) {
+    replayBytes_ -= messageSize(replay_.front());
+    replay_.pop_front();
+  }
+}
+
+template <typename T, typename R>
+uint64_t BroadcastHandler<T, R>::messageSize(const T& data) {
+  // Unqualified so that overloads next to T's definition are found too
+  using detail::messageBytes;
+  return messageBytes(data);
+}
+
 template <typename T, typename R>
 void BroadcastHandler<T, R>::unsubscribe(uint64_t subscriptionId) {
-  auto iter = subscribers_.find(subscriptionId);
-  if (iter == subscribers_.end()) {
+  auto iter = std::lower_bound(
+      subscribers_.begin(),
+      subscribers_.end(),
+      subscriptionId,
+      [](const SubscriberEntry& entry, uint64_t id) { return entry.id < id; });
+  if (iter == subscribers_.end() || iter->id != subscriptionId ||
+      !iter->subscriber) {
     return;
   }
 
-  onUnsubscribe(iter->second);
-  subscribers_.erase(iter);
+  auto subscriber = iter->subscriber;
+  iter->subscriber = nullptr;
+  numSubscribers_--;
+  onUnsubscribe(subscriber);
+  maybeCompactSubscribers();
   closeIfIdle();
 }
 
+template <typename T, typename R>
+void BroadcastHandler<T, R>::clearSubscribers() {
+  for (auto& entry : subscribers_) {
+    entry.subscriber = nullptr;
+  }
+  numSubscribers_ = 0;
+  maybeCompactSubscribers();
+}
+
+template <typename T, typename R>
+void BroadcastHandler<T, R>::maybeCompactSubscribers() {
+  if (iterationDepth_ > 0 ||
+      (subscribers_.size() - numSubscribers_) * 2 <= subscribers_.size()) {
+    return;
+  }
+  subscribers_.erase(
+      std::remove_if(
+          subscribers_.begin(),
+          subscribers_.end(),
+          [](const SubscriberEntry& entry) { return !entry.subscriber; }),
+      subscribers_.end());
+}
+
 template <typename T, typename R>
 void BroadcastHandler<T, R>::closeIfIdle() {
-  if (subscribers_.empty()) {
+  if (numSubscribers_ == 0) {
     // No more subscribers. Clean up.
     // This will delete the broadcast from the pool.
     this->close(this->getContext());
@@ -14,6 +14,9 @@
 #include <wangle/channel/Pipeline.h>
 #include <wangle/channel/broadcast/Subscriber.h>
 
+#include <deque>
+#include <vector>
+
 namespace wangle {
 
 /**
@@ -26,7 +29,7 @@ class BroadcastHandler : public HandlerAdapter<T, std::unique_ptr<folly::IOBuf>>
   typedef typename HandlerAdapter<T, std::unique_ptr<folly::IOBuf>>::Context Context;
 
   virtual ~BroadcastHandler() {
-    CHECK(subscribers_.empty());
+    CHECK_EQ(0, numSubscribers_);
   }
 
   // BytesToBytesHandler implementation
@@ -70,18 +73,71 @@ class BroadcastHandler : public HandlerAdapter<T, std::unique_ptr<folly::IOBuf>>
    */
   virtual void onData(T& data) {}
 
+  /**
+   * Keeps the last maxMessages messages, and no more than maxBytes of them
+   * if maxBytes isn't 0, and replays them to each new subscriber before it
+   * gets live data, so that subscribers joining late needn't ask upstream
+   * for a snapshot. Messages are replayed as copies of T, which share their
+   * bytes when T is a SharedPayload. A maxMessages of 0, the default, turns
+   * it off.
+   */
+  void setReplayBuffer(size_t maxMessages, uint64_t maxBytes = 0);
+
+  size_t getReplayBufferSize() const {
+    return replay_.size();
+  }
+
  protected:
+  // Subscribers may subscribe or unsubscribe from inside f. Subscribers
+  // added during the iteration are not visited by it.
   template <typename FUNC> // FUNC: Subscriber<T, R>* -> void
   void forEachSubscriber(FUNC f) {
-    auto subscribers = subscribers_;
-    for (const auto& it : subscribers) {
-      f(it.second);
+    iterationDepth_++;
+    auto size = subscribers_.size();
+    for (size_t i = 0; i < size; i++) {
+      auto subscriber = subscribers_[i].subscriber;
+      if (subscriber) {
+        f(subscriber);
+      }
     }
+    iterationDepth_--;
+    maybeCompactSubscribers();
   }
 
+  size_t getSubscriberCount() const {
+    return numSubscribers_;
+  }
+
+  /**
+   * Size of a message for the replay buffer's byte limit. Subclasses can
+   * override for types whose size isn't known to detail::messageBytes().
+   */
+  virtual uint64_t messageSize(const T& data);
+
  private:
-  std::map<uint64_t, Subscriber<T, R>*> subscribers_;
+  struct SubscriberEntry {
+    uint64_t id;
+    // nullptr once unsubscribed, until the entry is compacted away
+    Subscriber<T, R>* subscriber;
+  };
+
+  void clearSubscribers();
+  void maybeCompactSubscribers();
+  void trimReplay();
+  void replay(uint64_t subscriptionId, Subscriber<T, R>* subscriber);
+
+  // Ordered by id, since ids only grow. Removal leaves a tombstone so that
+  // indices stay valid while forEachSubscriber() is running; tombstones are
+  // compacted in bulk once they make up half the vector.
+  std::vector<SubscriberEntry> subscribers_;
+  size_t numSubscribers_{0};
+  size_t iterationDepth_{0};
   uint64_t nextSubscriptionId_{0};
+
+  std::deque<T> replay_;
+  uint64_t replayBytes_{0};
+  size_t replayMaxMessages_{0};
+  uint64_t replayMaxBytes_{0};
 };
 
 template <typename T, typename R>
@@ -11,6 +11,204 @@
 
 namespace wangle {
 
+namespace detail {
+
+// Front of a relay pipeline. Nothing is written to a relay, and closing it
+// just hands the pipeline back to its BroadcastManager.
+template <typename T>
+class BroadcastRelayHandler
+    : public HandlerAdapter<T, std::unique_ptr<folly::IOBuf>> {
+ public:
+  typedef typename HandlerAdapter<T, std::unique_ptr<folly::IOBuf>>::Context
+      Context;
+
+  folly::Future<folly::Unit> close(Context* ctx) override {
+    ctx->getPipeline()->deletePipeline();
+    return folly::makeFuture();
+  }
+};
+
+} // namespace detail
+
+/**
+ * Subscribes to a broadcast on the origin's thread and forwards everything
+ * it receives to the relay pipeline on the relaying thread. Apart from the
+ * constructor, only used on the origin's thread; it keeps itself alive
+ * while subscribed.
+ */
+template <typename T, typename R>
+class BroadcastPool<T, R>::BroadcastManager::RelaySubscriber
+    : public Subscriber<T, R>,
+      public std::enable_shared_from_this<RelaySubscriber> {
+ public:
+  typedef Pipeline<T, std::unique_ptr<folly::IOBuf>> RelayPipeline;
+
+  RelaySubscriber(const R& routingData,
+                  folly::EventBase* relayEvb,
+                  std::weak_ptr<RelayPipeline> relayPipeline,
+                  BroadcastHandler<T, R>* relayHandler)
+      : routingData_(routingData),
+        relayEvb_(relayEvb),
+        relayPipeline_(relayPipeline),
+        relayHandler_(relayHandler) {}
+
+  void start(BroadcastPool<T, R>* originPool) {
+    auto self = this->shared_from_this();
+    originPool->getHandler(routingData_)
+        .then([self](BroadcastHandler<T, R>* handler) {
+          if (self->cancelled_) {
+            handler->closeIfIdle();
+            return;
+          }
+
+          self->handler_ = handler;
+          self->self_ = self;
+          self->subscriptionId_ = handler->subscribe(self.get());
+
+          // The relay's own subscribers may have gone away in the meantime
+          self->relay([](RelayPipeline*, BroadcastHandler<T, R>* relay) {
+            relay->closeIfIdle();
+          });
+        })
+        .onError([self](const std::exception& ex) {
+          auto ew = folly::make_exception_wrapper<std::exception>(ex);
+          self->relay([ew](RelayPipeline* pipeline, BroadcastHandler<T, R>*) {
+            pipeline->readException(ew);
+          });
+        });
+  }
+
+  // The relay went away
+  void cancel() {
+    cancelled_ = true;
+    if (handler_) {
+      auto handler = handler_;
+      handler_ = nullptr;
+      auto self = std::move(self_);
+      handler->unsubscribe(subscriptionId_);
+    }
+  }
+
+  // Subscriber implementation
+  void onNext(const T& data) override {
+    T copy(data);
+    relay([copy](RelayPipeline* pipeline, BroadcastHandler<T, R>*) mutable {
+      pipeline->read(std::move(copy));
+    });
+  }
+
+  void onError(folly::exception_wrapper ex) override {
+    auto self = std::move(self_);
+    handler_ = nullptr;
+    relay([ex](RelayPipeline* pipeline, BroadcastHandler<T, R>*) {
+      pipeline->readException(ex);
+    });
+  }
+
+  void onCompleted() override {
+    auto self = std::move(self_);
+    handler_ = nullptr;
+    relay([](RelayPipeline* pipeline, BroadcastHandler<T, R>*) {
+      pipeline->readEOF();
+    });
+  }
+
+  R& routingData() override {
+    return routingData_;
+  }
+
+ private:
+  // Runs f on the relaying thread if the relay still exists
+  template <typename F>
+  void relay(F f) {
+    auto relayPipeline = relayPipeline_;
+    auto relayHandler = relayHandler_;
+    relayEvb_->runInEventBaseThread(
+        [relayPipeline, relayHandler, f]() mutable {
+          auto pipeline = relayPipeline.lock();
+          if (pipeline) {
+            f(pipeline.get(), relayHandler);
+          }
+        });
+  }
+
+  R routingData_;
+  folly::EventBase* relayEvb_;
+  std::weak_ptr<RelayPipeline> relayPipeline_;
+  BroadcastHandler<T, R>* relayHandler_;
+
+  BroadcastHandler<T, R>* handler_{nullptr};
+  uint64_t subscriptionId_{0};
+  bool cancelled_{false};
+  std::shared_ptr<RelaySubscriber> self_;
+};
+
+/**
+ * An idle upstream connection, with the pipeline of the broadcast pipeline
+ * factory but no routing data yet. It leaves the pool as soon as it closes.
+ */
+template <typename T, typename R>
+class BroadcastPool<T, R>::WarmConnection : public PipelineManager {
+ public:
+  WarmConnection(BroadcastPool<T, R>* pool, const folly::SocketAddress& server)
+      : pool_(pool), server_(server), client_(pool->newClient()) {}
+
+  ~WarmConnection() {
+    if (client_ && client_->getPipeline()) {
+      client_->getPipeline()->setPipelineManager(nullptr);
+    }
+  }
+
+  void connect() {
+    // The connection may be gone, with the pool, by the time it's done
+    std::weak_ptr<bool> alive = alive_;
+    pool_->serverPool_->connectWarm(client_.get(), server_)
+        .then([this, alive](DefaultPipeline* pipeline) {
+          if (!alive.lock()) {
+            return;
+          }
+          pipeline->setPipelineManager(this);
+          connected_ = true;
+        })
+        .onError([this, alive](const std::exception& ex) {
+          if (!alive.lock()) {
+            return;
+          }
+          // Not retried until the server is asked for again, in case it's
+          // down
+          VLOG(4) << "Error opening warm connection to " << server_ << ": "
+                  << ex.what();
+          pool_->removeWarmConnection(this, false);
+        });
+  }
+
+  // PipelineManager implementation
+  void deletePipeline(PipelineBase* pipeline) override {
+    CHECK(client_->getPipeline() == pipeline);
+    pool_->removeWarmConnection(this, true);
+  }
+
+  const folly::SocketAddress& server() const {
+    return server_;
+  }
+
+  bool connected() const {
+    return connected_;
+  }
+
+  std::unique_ptr<ClientBootstrap<DefaultPipeline>> release() {
+    client_->getPipeline()->setPipelineManager(nullptr);
+    return std::move(client_);
+  }
+
+ private:
+  BroadcastPool<T, R>* pool_;
+  folly::SocketAddress server_;
+  std::unique_ptr<ClientBootstrap<DefaultPipeline>> client_;
+  bool connected_{false};
+  std::shared_ptr<bool> alive_{std::make_shared<bool>(true)};
+};
+
 template <typename T, typename R>
 folly::Future<BroadcastHandler<T, R>*>
 BroadcastPool<T, R>::BroadcastManager::getHandler() {
@@ -27,27 +225,17 @@ BroadcastPool<T, R>::BroadcastManager::getHandler() {
   // Kickoff connect request and fulfill all pending promises on completion
   connectStarted_ = true;
 
-  broadcastPool_->serverPool_->connect(&client_, routingData_)
+  auto warm = broadcastPool_->takeWarmConnection(routingData_);
+  if (warm) {
+    client_ = std::move(warm);
+    // The caller subscribes once this returns
+    handleConnected(client_->getPipeline(), false);
+    return future;
+  }
+
+  broadcastPool_->serverPool_->connect(client_.get(), routingData_)
       .then([this](DefaultPipeline* pipeline) {
-        pipeline->setPipelineManager(this);
-
-        auto pipelineFactory = broadcastPool_->broadcastPipelineFactory_;
-        try {
-          pipelineFactory->setRoutingData(pipeline, routingData_);
-        } catch (const std::exception& ex) {
-          handleConnectError(ex);
-          return;
-        }
-
-        auto handler = pipelineFactory->getBroadcastHandler(pipeline);
-        CHECK(handler);
-        sharedPromise_.setValue(handler);
-
-        // If all the observers go away before connect returns, then the
-        // BroadcastHandler will be idle without any subscribers. Close
-        // the pipeline and remove the broadcast from the pool so that
-        // connections are not leaked.
-        handler->closeIfIdle();
+        handleConnected(pipeline, true);
       })
       .onError([this](const std::exception& ex) {
         handleConnectError(ex);
@@ -56,10 +244,71 @@ BroadcastPool<T, R>::BroadcastManager::getHandler() {
   return future;
 }
 
+template <typename T, typename R>
+void BroadcastPool<T, R>::BroadcastManager::handleConnected(
+    DefaultPipeline* pipeline, bool closeIfIdle) {
+  pipeline->setPipelineManager(this);
+
+  auto pipelineFactory = broadcastPool_->broadcastPipelineFactory_;
+  try {
+    pipelineFactory->setRoutingData(pipeline, routingData_);
+  } catch (const std::exception& ex) {
+    handleConnectError(ex);
+    return;
+  }
+
+  auto handler = pipelineFactory->getBroadcastHandler(pipeline);
+  CHECK(handler);
+  broadcastPool_->configureHandler(handler);
+  sharedPromise_.setValue(handler);
+
+  // If all the observers go away before connect returns, then the
+  // BroadcastHandler will be idle without any subscribers. Close
+  // the pipeline and remove the broadcast from the pool so that
+  // connections are not leaked.
+  if (closeIfIdle) {
+    handler->closeIfIdle();
+  }
+}
+
+template <typename T, typename R>
+void BroadcastPool<T, R>::BroadcastManager::relayFrom(
+    const typename BroadcastHub<T, R>::Origin& origin) {
+  CHECK(!connectStarted_);
+  connectStarted_ = true;
+
+  relayPipeline_ = Pipeline<T, std::unique_ptr<folly::IOBuf>>::create();
+  relayPipeline_->addBack(detail::BroadcastRelayHandler<T>());
+  relayPipeline_->addBack(BroadcastHandler<T, R>());
+  relayPipeline_->finalize();
+  relayPipeline_->setPipelineManager(this);
+  auto handler = relayPipeline_->template getHandler<BroadcastHandler<T, R>>(1);
+  broadcastPool_->configureHandler(handler);
+
+  relaySubscriber_ = std::make_shared<RelaySubscriber>(
+      routingData_,
+      folly::EventBaseManager::get()->getEventBase(),
+      relayPipeline_,
+      handler);
+  originEvb_ = origin.evb;
+  auto subscriber = relaySubscriber_;
+  auto originPool = origin.pool;
+  originEvb_->runInEventBaseThread(
+      [subscriber, originPool] { subscriber->start(originPool); });
+
+  sharedPromise_.setValue(handler);
+}
+
 template <typename T, typename R>
 void BroadcastPool<T, R>::BroadcastManager::deletePipeline(
     PipelineBase* pipeline) {
-  CHECK(client_.getPipeline() == pipeline);
+  if (relayPipeline_) {
+    CHECK(relayPipeline_.get() == pipeline);
+    auto subscriber = relaySubscriber_;
+    originEvb_->runInEventBaseThread([subscriber] { subscriber->cancel(); });
+  } else {
+    CHECK(client_->getPipeline() == pipeline);
+  }
   broadcastPool_->deleteBroadcast(routingData_);
 }
 
@@ -76,16 +325,116 @@ void BroadcastPool<T, R>::BroadcastManager::handleConnectError(
 template <typename T, typename R>
 folly::Future<BroadcastHandler<T, R>*> BroadcastPool<T, R>::getHandler(
     const R& routingData) {
-  const auto& iter = broadcasts_.find(routingData);
-  if (iter != broadcasts_.end()) {
-    return iter->second->getHandler();
+  // One lookup whether or not the broadcast exists
+  auto result = broadcasts_.emplace(routingData, nullptr);
+  if (!result.second) {
+    return result.first->second->getHandler();
   }
 
-  auto broadcast = folly::make_unique<BroadcastManager>(this, routingData);
-  auto broadcastPtr = broadcast.get();
-  broadcasts_.insert(std::make_pair(routingData, std::move(broadcast)));
+  result.first->second =
+      folly::make_unique<BroadcastManager>(this, routingData);
+  auto broadcastPtr = result.first->second.get();
+
+  if (hub_) {
+    typename BroadcastHub<T, R>::Origin self{
+        this, folly::EventBaseManager::get()->getEventBase()};
+    auto origin = hub_->getOrigin(routingData, self);
+    if (origin.pool != this) {
+      broadcastPtr->relayFrom(origin);
+    }
+  }
 
   return broadcastPtr->getHandler();
 }
 
+template <typename T, typename R>
+void BroadcastPool<T, R>::warmUp(const folly::SocketAddress& server) {
+  auto& conns = warm_[server];
+  std::vector<WarmConnection*> added;
+  while (conns.size() < warmPerServer_) {
+    conns.push_back(folly::make_unique<WarmConnection>(this, server));
+    added.push_back(conns.back().get());
+  }
+  if (conns.empty()) {
+    warm_.erase(server);
+    return;
+  }
+  // Once they are all in, as any of them may fail, and go, right away
+  for (auto conn : added) {
+    conn->connect();
+  }
+}
+
+template <typename T, typename R>
+size_t BroadcastPool<T, R>::getNumWarmConnections(
+    const folly::SocketAddress& server) {
+  auto iter = warm_.find(server);
+  if (iter == warm_.end()) {
+    return 0;
+  }
+  return std::count_if(
+      iter->second.begin(),
+      iter->second.end(),
+      [](const std::unique_ptr<WarmConnection>& c) { return c->connected(); });
+}
+
+template <typename T, typename R>
+std::unique_ptr<ClientBootstrap<DefaultPipeline>>
+BroadcastPool<T, R>::takeWarmConnection(const R& routingData) {
+  if (warmPerServer_ == 0) {
+    return nullptr;
+  }
+  auto server = serverPool_->getServer(routingData);
+  if (!server) {
+    return nullptr;
+  }
+
+  std::unique_ptr<ClientBootstrap<DefaultPipeline>> client;
+  auto iter = warm_.find(*server);
+  if (iter != warm_.end()) {
+    auto& conns = iter->second;
+    auto conn = std::find_if(
+        conns.begin(),
+        conns.end(),
+        [](const std::unique_ptr<WarmConnection>& c) {
+          return c->connected();
+        });
+    if (conn != conns.end()) {
+      client = (*conn)->release();
+      conns.erase(conn);
+    }
+  }
+  // Replaces the one taken, or opens the first ones
+  warmUp(*server);
+  return client;
+}
+
+template <typename T, typename R>
+void BroadcastPool<T, R>::removeWarmConnection(WarmConnection* conn,
+                                               bool replace) {
+  auto iter = warm_.find(conn->server());
+  if (iter == warm_.end()) {
+    return;
+  }
+  auto& conns = iter->second;
+  auto it = std::find_if(
+      conns.begin(),
+      conns.end(),
+      [conn](const std::unique_ptr<WarmConnection>& c) {
+        return c.get() == conn;
+      });
+  if (it == conns.end()) {
+    return;
+  }
+  // Destroyed last, as the caller may be its own
+  auto owned = std::move(*it);
+  conns.erase(it);
+  if (conns.empty()) {
+    warm_.erase(iter);
+  }
+  if (replace) {
+    warmUp(owned->server());
+  }
+}
+
 } // namespace wangle
@@ -9,13 +9,37 @@
  */
 #pragma once
 
+#include <folly/Optional.h>
+#include <folly/SocketAddress.h>
 #include <folly/ThreadLocal.h>
 #include <folly/futures/SharedPromise.h>
+#include <folly/io/async/EventBaseManager.h>
 #include <wangle/bootstrap/ClientBootstrap.h>
 #include <wangle/channel/broadcast/BroadcastHandler.h>
 
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
 namespace wangle {
 
+template <typename T, typename R>
+class BroadcastPool;
+
+/**
+ * Hash for routing data in BroadcastPool and BroadcastHub. Specialize it
+ * for routing data types that std::hash doesn't support, or to use a
+ * cheaper hash.
+ */
+template <typename R>
+struct RoutingDataHash {
+  size_t operator()(const R& routingData) const {
+    return std::hash<R>()(routingData);
+  }
+};
+
 template <typename R>
 class ServerPool {
  public:
@@ -28,6 +52,67 @@ class ServerPool {
   virtual folly::Future<DefaultPipeline*> connect(
       ClientBootstrap<DefaultPipeline>* client,
       const R& routingData) noexcept = 0;
+
+  /**
+   * The upstream server connect() would pick for routingData, if known
+   * without connecting. BroadcastPool keeps warm connections to the
+   * servers returned here, see BroadcastPool::setWarmConnections().
+   */
+  virtual folly::Optional<folly::SocketAddress> getServer(
+      const R& /*routingData*/) {
+    return folly::none;
+  }
+
+  /**
+   * Connects to server ahead of any routing data, for a warm connection;
+   * the routing data is set on its pipeline once a broadcast takes it.
+   * Override to set up the client the way connect() does, e.g. for TLS.
+   */
+  virtual folly::Future<DefaultPipeline*> connectWarm(
+      ClientBootstrap<DefaultPipeline>* client,
+      const folly::SocketAddress& server) noexcept {
+    return client->connect(server);
+  }
+};
+
+/**
+ * Shared by the thread-local BroadcastPools of several IO threads so that
+ * there is at most one upstream connection per routing data across all of
+ * them. The first pool to request a broadcast becomes its origin and
+ * connects upstream; the other pools relay the origin's data to their own
+ * subscribers, which costs one hop to each relaying thread per message.
+ *
+ * T must be copyable; use a cheaply copied type such as SharedPayload.
+ */
+template <typename T, typename R>
+class BroadcastHub {
+ public:
+  struct Origin {
+    BroadcastPool<T, R>* pool;
+    folly::EventBase* evb;
+  };
+
+  /**
+   * Returns the origin of the broadcast for routingData, making the
+   * candidate the origin if there is none yet.
+   */
+  Origin getOrigin(const R& routingData, const Origin& candidate) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    return origins_.insert(std::make_pair(routingData, candidate))
+        .first->second;
+  }
+
+  void removeOrigin(const R& routingData, BroadcastPool<T, R>* pool) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto iter = origins_.find(routingData);
+    if (iter != origins_.end() && iter->second.pool == pool) {
+      origins_.erase(iter);
+    }
+  }
+
+ private:
+  std::mutex mutex_;
+  std::unordered_map<R, Origin, RoutingDataHash<R>> origins_;
 };
 
 /**
@@ -35,7 +120,8 @@ class ServerPool {
  * for any unique routing data. Creates and maintains upstream connections
  * and broadcast pipeliens as necessary.
  *
- * Meant to be used as a thread-local instance.
+ * Meant to be used as a thread-local instance. Give the pools of all threads
+ * the same BroadcastHub to share upstream connections between them.
  */
 template <typename T, typename R>
 class BroadcastPool {
@@ -43,37 +129,64 @@ class BroadcastPool {
   class BroadcastManager : PipelineManager {
    public:
     BroadcastManager(BroadcastPool<T, R>* broadcastPool, const R& routingData)
-        : broadcastPool_(broadcastPool), routingData_(routingData) {
-      client_.pipelineFactory(broadcastPool_->broadcastPipelineFactory_);
-    }
+        : broadcastPool_(broadcastPool),
+          routingData_(routingData),
+          client_(broadcastPool_->newClient()) {}
 
     virtual ~BroadcastManager() {
-      if (client_.getPipeline()) {
-        client_.getPipeline()->setPipelineManager(nullptr);
+      if (client_->getPipeline()) {
+        client_->getPipeline()->setPipelineManager(nullptr);
+      }
+      if (relayPipeline_) {
+        relayPipeline_->setPipelineManager(nullptr);
       }
     }
 
     folly::Future<BroadcastHandler<T, R>*> getHandler();
 
+    /**
+     * Instead of connecting upstream, subscribe to the broadcast of
+     * another thread's pool and relay its data to a local BroadcastHandler.
+     */
+    void relayFrom(const typename BroadcastHub<T, R>::Origin& origin);
+
     // PipelineManager implementation
     void deletePipeline(PipelineBase* pipeline) override;
 
    private:
+    class RelaySubscriber;
+
+    void handleConnected(DefaultPipeline* pipeline, bool closeIfIdle);
     void handleConnectError(const std::exception& ex) noexcept;
 
     BroadcastPool<T, R>* broadcastPool_{nullptr};
     R routingData_;
-    ClientBootstrap<DefaultPipeline> client_;
+    // Replaced by a warm connection's, if one is taken
+    std::unique_ptr<ClientBootstrap<DefaultPipeline>> client_;
 
     bool connectStarted_{false};
     folly::SharedPromise<BroadcastHandler<T, R>*> sharedPromise_;
+
+    // Set when relaying another thread's broadcast
+    std::shared_ptr<Pipeline<T, std::unique_ptr<folly::IOBuf>>> relayPipeline_;
+    std::shared_ptr<RelaySubscriber> relaySubscriber_;
+    folly::EventBase* originEvb_{nullptr};
   };
 
   BroadcastPool(std::shared_ptr<ServerPool<R>> serverPool,
-                std::shared_ptr<BroadcastPipelineFactory<T, R>> pipelineFactory)
-      : serverPool_(serverPool), broadcastPipelineFactory_(pipelineFactory) {}
+                std::shared_ptr<BroadcastPipelineFactory<T, R>> pipelineFactory,
+                std::shared_ptr<BroadcastHub<T, R>> hub = nullptr)
+      : serverPool_(serverPool),
+        broadcastPipelineFactory_(pipelineFactory),
+        hub_(hub) {}
 
-  virtual ~BroadcastPool() {}
+  virtual ~BroadcastPool() {
+    if (hub_) {
+      for (const auto& broadcast : broadcasts_) {
+        hub_->removeOrigin(broadcast.first, this);
+      }
+    }
+  }
 
   // Non-copyable
   BroadcastPool(const BroadcastPool&) = delete;
@@ -105,12 +218,78 @@ class BroadcastPool {
     return (broadcasts_.find(routingData) != broadcasts_.end());
   }
 
+  /**
+   * Keeps perServer idle connections open to each upstream server the
+   * ServerPool names (see ServerPool::getServer()), so that a new
+   * broadcast takes one instead of waiting for a connect and handshake.
+   * A server's connections are opened the first time a broadcast is
+   * requested from it, or by warmUp(), and replaced in the background as
+   * they are taken or close. Those failing to connect are only opened again
+   * the next time a broadcast asks for the server, in case it's down. 0,
+   * the default, turns it off.
+   */
+  void setWarmConnections(size_t perServer) {
+    warmPerServer_ = perServer;
+  }
+
+  /**
+   * Gives the BroadcastHandler of every broadcast created from now on,
+   * relays included, a replay buffer for late subscribers (see
+   * BroadcastHandler::setReplayBuffer()). A maxMessages of 0, the default,
+   * leaves the handlers as the pipeline factory made them.
+   */
+  void setReplayBuffer(size_t maxMessages, uint64_t maxBytes = 0) {
+    replayMaxMessages_ = maxMessages;
+    replayMaxBytes_ = maxBytes;
+  }
+
+  // Opens warm connections to server up to the number set above
+  void warmUp(const folly::SocketAddress& server);
+
+  // Warm connections to server ready to be taken
+  size_t getNumWarmConnections(const folly::SocketAddress& server);
+
  private:
-  void deleteBroadcast(const R& routingData) { broadcasts_.erase(routingData); }
+  class WarmConnection;
+
+  void configureHandler(BroadcastHandler<T, R>* handler) {
+    if (replayMaxMessages_ > 0) {
+      handler->setReplayBuffer(replayMaxMessages_, replayMaxBytes_);
+    }
+  }
+
+  std::unique_ptr<ClientBootstrap<DefaultPipeline>> newClient() {
+    auto client = folly::make_unique<ClientBootstrap<DefaultPipeline>>();
+    client->pipelineFactory(broadcastPipelineFactory_);
+    return client;
+  }
+
+  // The client of a connected warm connection to the server of
+  // routingData, if there is one
+  std::unique_ptr<ClientBootstrap<DefaultPipeline>> takeWarmConnection(
+      const R& routingData);
+
+  // Opening another in its place if replace
+  void removeWarmConnection(WarmConnection* conn, bool replace);
+
+  void deleteBroadcast(const R& routingData) {
+    if (hub_) {
+      hub_->removeOrigin(routingData, this);
+    }
+    broadcasts_.erase(routingData);
+  }
 
   std::shared_ptr<ServerPool<R>> serverPool_;
   std::shared_ptr<BroadcastPipelineFactory<T, R>> broadcastPipelineFactory_;
-  std::map<R, std::unique_ptr<BroadcastManager>> broadcasts_;
+  std::shared_ptr<BroadcastHub<T, R>> hub_;
+  std::unordered_map<R, std::unique_ptr<BroadcastManager>, RoutingDataHash<R>>
+      broadcasts_;
+  size_t warmPerServer_{0};
+  size_t replayMaxMessages_{0};
+  uint64_t replayMaxBytes_{0};
+  std::unordered_map<folly::SocketAddress,
+                     std::vector<std::unique_ptr<WarmConnection>>>
+      warm_;
 };
 
 } // namespace wangle
@@ -81,9 +81,54 @@ void ObservingHandler<T, R>::readException(Context* ctx,
 
 template <typename T, typename R>
 void ObservingHandler<T, R>::onNext(const T& data) {
+  auto bytes = messageSize(data);
+  if (slowSubscriberPolicy_ == SlowSubscriberPolicy::UNBOUNDED ||
+      (queued_.empty() &&
+       (pendingBytes_ == 0 || pendingBytes_ + bytes <= maxPendingBytes_))) {
+    writeData(data, bytes);
+    return;
+  }
+
+  switch (slowSubscriberPolicy_) {
+    case SlowSubscriberPolicy::DISCONNECT:
+      LOG(WARNING) << "Closing slow broadcast subscriber with "
+                   << pendingBytes_ << " bytes pending";
+      this->close(this->getContext());
+      return;
+    case SlowSubscriberPolicy::COALESCE_LATEST:
+      droppedMessages_ += queued_.size();
+      queued_.clear();
+      queuedBytes_ = 0;
+      break;
+    default:
+      break;
+  }
+
+  queued_.emplace_back(data, bytes);
+  queuedBytes_ += bytes;
+  // Always keep the newest message, even if it is over the budget alone
+  while (queuedBytes_ > maxPendingBytes_ && queued_.size() > 1) {
+    queuedBytes_ -= queued_.front().second;
+    queued_.pop_front();
+    droppedMessages_++;
+  }
+}
+
+template <typename T, typename R>
+void ObservingHandler<T, R>::writeData(const T& data, uint64_t bytes) {
   auto ctx = this->getContext();
   auto deleted = deleted_;
+  // The write can complete before write() returns
+  pendingBytes_ += bytes;
   this->write(ctx, data)
+      .then([this, deleted, bytes] {
+        if (*deleted) {
+          return;
+        }
+
+        pendingBytes_ -= bytes;
+        flushQueued();
+      })
       .onError([this, ctx, deleted](const std::exception& ex) {
         if (*deleted) {
           return;
@@ -115,4 +160,45 @@ R& ObservingHandler<T, R>::routingData() {
   return routingData_;
 }
 
+template <typename T, typename R>
+void ObservingHandler<T, R>::setSlowSubscriberPolicy(
+    SlowSubscriberPolicy policy,
+    uint64_t maxPendingBytes) {
+  slowSubscriberPolicy_ = policy;
+  maxPendingBytes_ = maxPendingBytes;
+  if (policy == SlowSubscriberPolicy::UNBOUNDED) {
+    flushQueued();
+  }
+}
+
+template <typename T, typename R>
+uint64_t ObservingHandler<T, R>::messageSize(const T& data) {
+  // Unqualified so that overloads next to T's definition are found too
+  using detail::messageBytes;
+  return messageBytes(data);
+}
+
+template <typename T, typename R>
+void ObservingHandler<T, R>::flushQueued() {
+  // Writes that complete inline come back here; let the outer loop go on
+  if (flushing_) {
+    return;
+  }
+  flushing_ = true;
+  auto deleted = deleted_;
+  while (!queued_.empty() &&
+         (slowSubscriberPolicy_ == SlowSubscriberPolicy::UNBOUNDED ||
+          pendingBytes_ == 0 ||
+          pendingBytes_ + queued_.front().second <= maxPendingBytes_)) {
+    auto entry = std::move(queued_.front());
+    queued_.pop_front();
+    queuedBytes_ -= entry.second;
+    writeData(entry.first, entry.second);
+    if (*deleted) {
+      return;
+    }
+  }
+  flushing_ = false;
+}
+
 } // namespace wangle
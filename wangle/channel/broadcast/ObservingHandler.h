@@ -14,8 +14,25 @@
 #include <wangle/channel/broadcast/BroadcastPool.h>
 #include <wangle/channel/broadcast/Subscriber.h>
 
+#include <deque>
+
 namespace wangle {
 
+/**
+ * What an ObservingHandler does with broadcast data while its connection
+ * has more than the subscriber's byte budget waiting to be written.
+ */
+enum class SlowSubscriberPolicy {
+  // Keep writing. Memory is bounded only by the transport.
+  UNBOUNDED,
+  // Hold messages back, dropping the oldest ones over the budget
+  DROP_OLDEST,
+  // Hold back only the most recent message
+  COALESCE_LATEST,
+  // Close the connection
+  DISCONNECT,
+};
+
 /**
  * A Handler-Observer adaptor that can be used for subscribing to broadcasts.
  * Maintains a thread-local BroadcastPool from which a BroadcastHandler is
@@ -49,7 +66,37 @@ class ObservingHandler : public HandlerAdapter<folly::IOBufQueue&, T>,
   void onCompleted() override;
   R& routingData() override;
 
+  /**
+   * Limits the bytes of broadcast data this subscriber's connection may
+   * have waiting, as measured by writes that have not completed yet. Once
+   * the budget is used up, the policy decides what happens to new data.
+   */
+  void setSlowSubscriberPolicy(SlowSubscriberPolicy policy,
+                               uint64_t maxPendingBytes);
+
+  uint64_t getPendingBytes() const {
+    return pendingBytes_;
+  }
+
+  uint64_t getQueuedBytes() const {
+    return queuedBytes_;
+  }
+
+  uint64_t getDroppedMessages() const {
+    return droppedMessages_;
+  }
+
+ protected:
+  /**
+   * Size of a message for the byte budget. Subclasses can override for
+   * types whose size isn't known to detail::messageBytes().
+   */
+  virtual uint64_t messageSize(const T& data);
+
  private:
+  void writeData(const T& data, uint64_t bytes);
+  void flushQueued();
+
   R routingData_;
   BroadcastPool<T, R>* broadcastPool_{nullptr};
 
@@ -57,6 +104,16 @@ class ObservingHandler : public HandlerAdapter<folly::IOBufQueue&, T>,
   uint64_t subscriptionId_{0};
   bool paused_{false};
 
+  SlowSubscriberPolicy slowSubscriberPolicy_{SlowSubscriberPolicy::UNBOUNDED};
+  uint64_t maxPendingBytes_{0};
+  // Bytes written whose write futures haven't completed
+  uint64_t pendingBytes_{0};
+  // Data held back while over the budget, with its size
+  std::deque<std::pair<T, uint64_t>> queued_;
+  uint64_t queuedBytes_{0};
+  uint64_t droppedMessages_{0};
+  bool flushing_{false};
+
   // True iff the handler has been deleted
   std::shared_ptr<bool> deleted_{new bool(false)};
 };
@@ -83,6 +140,7 @@ class ObservingPipelineFactory
     pipeline->addBack(AsyncSocketHandler(socket));
     auto handler =
         std::make_shared<ObservingHandler<T, R>>(routingData, broadcastPool());
+    handler->setSlowSubscriberPolicy(slowSubscriberPolicy_, maxPendingBytes_);
     pipeline->addBack(handler);
     pipeline->finalize();
 
@@ -91,10 +149,23 @@ class ObservingPipelineFactory
     return pipeline;
   }
 
+  // Applied to the ObservingHandler of each new pipeline
+  void setSlowSubscriberPolicy(SlowSubscriberPolicy policy,
+                               uint64_t maxPendingBytes) {
+    slowSubscriberPolicy_ = policy;
+    maxPendingBytes_ = maxPendingBytes;
+  }
+
+  // Share upstream connections between the broadcast pools of all threads.
+  // Must be set before the first pipeline is created.
+  void setBroadcastHub(std::shared_ptr<BroadcastHub<T, R>> hub) {
+    broadcastHub_ = hub;
+  }
+
   virtual BroadcastPool<T, R>* broadcastPool() {
     if (!broadcastPool_) {
-      broadcastPool_.reset(
-          new BroadcastPool<T, R>(serverPool_, broadcastPipelineFactory_));
+      broadcastPool_.reset(new BroadcastPool<T, R>(
+          serverPool_, broadcastPipelineFactory_, broadcastHub_));
     }
     return broadcastPool_.get();
   }
@@ -102,7 +173,10 @@ class ObservingPipelineFactory
  protected:
   std::shared_ptr<ServerPool<R>> serverPool_;
   std::shared_ptr<BroadcastPipelineFactory<T, R>> broadcastPipelineFactory_;
+  std::shared_ptr<BroadcastHub<T, R>> broadcastHub_;
   folly::ThreadLocalPtr<BroadcastPool<T, R>> broadcastPool_;
+  SlowSubscriberPolicy slowSubscriberPolicy_{SlowSubscriberPolicy::UNBOUNDED};
+  uint64_t maxPendingBytes_{0};
 };
 
 } // namespace wangle
@@ -0,0 +1,76 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/io/IOBuf.h>
+#include <wangle/codec/MessageToByteEncoder.h>
+
+#include <memory>
+
+namespace wangle {
+
+/**
+ * Immutable bytes for broadcasting to many subscribers. Copies share one
+ * IOBuf chain, so handing a payload to every subscriber only bumps a
+ * reference count. A subscriber that needs to write the bytes out calls
+ * clone(), which shares the underlying buffers rather than copying them.
+ *
+ * Use it as the T of BroadcastHandler and ObservingHandler, with a
+ * SharedPayloadEncoder in the observing pipeline.
+ */
+class SharedPayload {
+ public:
+  SharedPayload() = default;
+
+  explicit SharedPayload(std::unique_ptr<folly::IOBuf> buf)
+      : length_(buf ? buf->computeChainDataLength() : 0),
+        buf_(std::move(buf)) {}
+
+  const folly::IOBuf* get() const {
+    return buf_.get();
+  }
+
+  const folly::IOBuf* operator->() const {
+    return buf_.get();
+  }
+
+  explicit operator bool() const {
+    return buf_ != nullptr;
+  }
+
+  size_t length() const {
+    return length_;
+  }
+
+  std::unique_ptr<folly::IOBuf> clone() const {
+    return buf_ ? buf_->clone() : nullptr;
+  }
+
+ private:
+  size_t length_{0};
+  std::shared_ptr<const folly::IOBuf> buf_;
+};
+
+// Found by the pipeline's instrumentation and ObservingHandler's byte budget
+inline uint64_t messageBytes(const SharedPayload& payload) {
+  return payload.length();
+}
+
+/**
+ * Writes a SharedPayload to the transport, cloning it once.
+ */
+class SharedPayloadEncoder : public MessageToByteEncoder<SharedPayload> {
+ public:
+  std::unique_ptr<folly::IOBuf> encode(SharedPayload& payload) override {
+    return payload.clone();
+  }
+};
+
+} // namespace wangle
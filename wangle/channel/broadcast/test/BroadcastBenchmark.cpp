@@ -0,0 +1,180 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <folly/Benchmark.h>
+#include <folly/Conv.h>
+#include <gflags/gflags.h>
+#include <wangle/channel/broadcast/BroadcastHandler.h>
+#include <wangle/channel/broadcast/BroadcastPool.h>
+#include <wangle/codec/ByteToMessageDecoder.h>
+
+#include <deque>
+
+using namespace wangle;
+using folly::BenchmarkSuspender;
+
+namespace {
+
+class NoopSubscriber : public Subscriber<int, std::string> {
+ public:
+  void onNext(const int&) override {}
+  void onError(folly::exception_wrapper) override {}
+  void onCompleted() override {}
+  std::string& routingData() override {
+    return routingData_;
+  }
+
+ private:
+  std::string routingData_;
+};
+
+// Never closes, so that broadcasts can live outside of a real connection
+class BenchmarkBroadcastHandler : public BroadcastHandler<int, std::string> {
+ public:
+  void closeIfIdle() override {}
+};
+
+class NoopDecoder : public ByteToMessageDecoder<int> {
+ public:
+  bool decode(Context*, folly::IOBufQueue&, int&, size_t&) override {
+    return false;
+  }
+};
+
+// Connects instantly to an in-memory broadcast pipeline
+class BenchmarkServerPool : public ServerPool<std::string> {
+ public:
+  folly::Future<DefaultPipeline*> connect(
+      ClientBootstrap<DefaultPipeline>*,
+      const std::string&) noexcept override {
+    auto pipeline = DefaultPipeline::create();
+    pipeline->addBack(NoopDecoder());
+    pipeline->addBack(BenchmarkBroadcastHandler());
+    pipeline->finalize();
+    pipelines.push_back(pipeline);
+    return folly::makeFuture(pipeline.get());
+  }
+
+  std::vector<DefaultPipeline::Ptr> pipelines;
+};
+
+class BenchmarkPipelineFactory
+    : public BroadcastPipelineFactory<int, std::string> {
+ public:
+  DefaultPipeline::Ptr newPipeline(
+      std::shared_ptr<folly::AsyncTransportWrapper>) override {
+    return nullptr;
+  }
+
+  BroadcastHandler<int, std::string>* getBroadcastHandler(
+      DefaultPipeline* pipeline) noexcept override {
+    return pipeline->getHandler<BenchmarkBroadcastHandler>(1);
+  }
+
+  void setRoutingData(DefaultPipeline*, const std::string&) override {}
+};
+
+std::vector<std::string> makeKeys(size_t n) {
+  std::vector<std::string> keys;
+  keys.reserve(n);
+  for (size_t i = 0; i < n; i++) {
+    keys.push_back(folly::to<std::string>("/broadcast/", i));
+  }
+  return keys;
+}
+
+}
+
+// Subscribe and unsubscribe on a broadcast that has n other subscribers
+void subscribeUnsubscribe(uint iters, size_t n) {
+  BenchmarkSuspender bs;
+  BenchmarkBroadcastHandler handler;
+  NoopSubscriber subscriber;
+  std::vector<uint64_t> ids;
+  for (size_t i = 0; i < n; i++) {
+    ids.push_back(handler.subscribe(&subscriber));
+  }
+  bs.dismiss();
+
+  for (uint iter = 0; iter < iters; iter++) {
+    handler.unsubscribe(handler.subscribe(&subscriber));
+  }
+
+  bs.rehire();
+  for (auto id : ids) {
+    handler.unsubscribe(id);
+  }
+}
+
+// Unsubscribe the subscriber that has been there longest
+void unsubscribeOldest(uint iters, size_t n) {
+  BenchmarkSuspender bs;
+  BenchmarkBroadcastHandler handler;
+  NoopSubscriber subscriber;
+  std::deque<uint64_t> ids;
+  for (size_t i = 0; i < n; i++) {
+    ids.push_back(handler.subscribe(&subscriber));
+  }
+  bs.dismiss();
+
+  for (uint iter = 0; iter < iters; iter++) {
+    handler.unsubscribe(ids.front());
+    ids.pop_front();
+    ids.push_back(handler.subscribe(&subscriber));
+  }
+
+  bs.rehire();
+  for (auto id : ids) {
+    handler.unsubscribe(id);
+  }
+}
+
+// Look up existing broadcasts in a pool holding n of them
+void getHandler(uint iters, size_t n) {
+  BenchmarkSuspender bs;
+  auto serverPool = std::make_shared<BenchmarkServerPool>();
+  NoopSubscriber subscriber;
+  auto keys = makeKeys(n);
+  {
+    BroadcastPool<int, std::string> pool(
+        serverPool, std::make_shared<BenchmarkPipelineFactory>());
+    for (const auto& key : keys) {
+      pool.getHandler(key).then([&](BroadcastHandler<int, std::string>* h) {
+        h->subscribe(&subscriber);
+      });
+    }
+    bs.dismiss();
+
+    for (uint iter = 0; iter < iters; iter++) {
+      pool.getHandler(keys[iter % n]);
+    }
+
+    bs.rehire();
+  }
+  for (auto& pipeline : serverPool->pipelines) {
+    pipeline->getHandler<BenchmarkBroadcastHandler>(1)->readEOF(nullptr);
+  }
+}
+
+BENCHMARK_PARAM(subscribeUnsubscribe, 1);
+BENCHMARK_RELATIVE_PARAM(subscribeUnsubscribe, 100000);
+BENCHMARK_PARAM(unsubscribeOldest, 1);
+BENCHMARK_RELATIVE_PARAM(unsubscribeOldest, 100000);
+
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_PARAM(getHandler, 1);
+BENCHMARK_RELATIVE_PARAM(getHandler, 100000);
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  folly::runBenchmarks();
+  return 0;
+}
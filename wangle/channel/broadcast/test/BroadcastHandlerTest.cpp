@@ -7,6 +7,7 @@
  *  of patent rights can be found in the PATENTS file in the same directory.
  *
  */
+#include <wangle/channel/broadcast/SharedPayload.h>
 #include <wangle/channel/broadcast/test/Mocks.h>
 #include <wangle/channel/test/MockHandler.h>
 
@@ -314,3 +315,140 @@ TEST_F(BroadcastHandlerTest, OnError) {
   // The handler should be deleted now
   handler->readException(nullptr, make_exception_wrapper<std::exception>());
 }
+
+TEST_F(BroadcastHandlerTest, UnsubscribeDuringBroadcast) {
+  EXPECT_CALL(*decoder, decode(_, _, _, _))
+      .WillRepeatedly(
+          Invoke([&](MockByteToMessageDecoder<std::string>::Context*,
+                     IOBufQueue& q,
+                     std::string& data,
+                     size_t&) {
+            auto buf = q.move();
+            if (buf) {
+              buf->coalesce();
+              data = buf->moveToFbString().toStdString();
+              return true;
+            }
+            return false;
+          }));
+
+  StrictMock<MockSubscriber<std::string, std::string>> subscriber2;
+
+  EXPECT_EQ(handler->subscribe(&subscriber0), 0);
+  EXPECT_EQ(handler->subscribe(&subscriber1), 1);
+
+  // subscriber0 removes the next subscriber and adds a new one while the
+  // data is being broadcast. Neither of them should see it.
+  EXPECT_CALL(subscriber0, onNext("data1"))
+      .WillOnce(InvokeWithoutArgs([&] {
+        handler->unsubscribe(1);
+        EXPECT_EQ(handler->subscribe(&subscriber2), 2);
+      }));
+
+  IOBufQueue q;
+  q.append(IOBuf::copyBuffer("data1"));
+  pipeline->read(q);
+  q.clear();
+  EXPECT_EQ(2, handler->getSubscriberCount());
+
+  EXPECT_CALL(subscriber0, onNext("data2")).Times(1);
+  EXPECT_CALL(subscriber2, onNext("data2")).Times(1);
+
+  q.append(IOBuf::copyBuffer("data2"));
+  pipeline->read(q);
+  q.clear();
+
+  // Unsubscribing twice is a no-op
+  handler->unsubscribe(1);
+  handler->unsubscribe(0);
+  EXPECT_EQ(1, handler->getSubscriberCount());
+
+  EXPECT_CALL(*handler, mockClose(_))
+      .WillOnce(InvokeWithoutArgs([this] {
+        pipeline.reset();
+        return makeMoveWrapper(makeFuture());
+      }));
+
+  handler->unsubscribe(2);
+  Mock::VerifyAndClear(&subscriber2);
+}
+
+TEST_F(BroadcastHandlerTest, ReplayBuffer) {
+  // Test that a late subscriber gets the last messages before live data
+  EXPECT_CALL(*decoder, decode(_, _, _, _))
+      .WillRepeatedly(
+          Invoke([&](MockByteToMessageDecoder<std::string>::Context*,
+                     IOBufQueue& q,
+                     std::string& data,
+                     size_t&) {
+            auto buf = q.move();
+            if (buf) {
+              buf->coalesce();
+              data = buf->moveToFbString().toStdString();
+              return true;
+            }
+            return false;
+          }));
+
+  // Three messages but ten bytes at most, so two of these
+  handler->setReplayBuffer(3, 10);
+
+  InSequence dummy;
+
+  EXPECT_EQ(handler->subscribe(&subscriber0), 0);
+
+  EXPECT_CALL(subscriber0, onNext("data1")).Times(1);
+  EXPECT_CALL(subscriber0, onNext("data2")).Times(1);
+  EXPECT_CALL(subscriber0, onNext("data3")).Times(1);
+
+  IOBufQueue q;
+  for (auto data : {"data1", "data2", "data3"}) {
+    q.append(IOBuf::copyBuffer(data));
+    pipeline->read(q);
+    q.clear();
+  }
+  EXPECT_EQ(2, handler->getReplayBufferSize());
+
+  // Replayed on subscribing
+  EXPECT_CALL(subscriber1, onNext("data2")).Times(1);
+  EXPECT_CALL(subscriber1, onNext("data3")).Times(1);
+  EXPECT_EQ(handler->subscribe(&subscriber1), 1);
+
+  EXPECT_CALL(subscriber0, onNext("data4")).Times(1);
+  EXPECT_CALL(subscriber1, onNext("data4")).Times(1);
+
+  q.append(IOBuf::copyBuffer("data4"));
+  pipeline->read(q);
+  q.clear();
+  EXPECT_EQ(2, handler->getReplayBufferSize());
+
+  handler->unsubscribe(0);
+
+  EXPECT_CALL(*handler, mockClose(_))
+      .WillOnce(InvokeWithoutArgs([this] {
+        pipeline.reset();
+        return makeMoveWrapper(makeFuture());
+      }));
+
+  handler->unsubscribe(1);
+}
+
+TEST(SharedPayloadTest, CloneSharesBuffer) {
+  auto buf = IOBuf::copyBuffer("hello");
+  buf->prependChain(IOBuf::copyBuffer(" world"));
+  auto data = buf->data();
+
+  SharedPayload payload(std::move(buf));
+  auto copy = payload;
+  EXPECT_EQ(payload.get(), copy.get());
+  EXPECT_EQ(11, copy.length());
+
+  auto clone = copy.clone();
+  EXPECT_EQ(data, clone->data());
+  EXPECT_EQ(11, clone->computeChainDataLength());
+  EXPECT_EQ("hello world", clone->moveToFbString().toStdString());
+  EXPECT_EQ(11, payload->computeChainDataLength());
+
+  EXPECT_FALSE(SharedPayload());
+  EXPECT_FALSE(SharedPayload().clone());
+}
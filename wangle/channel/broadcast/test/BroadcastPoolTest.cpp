@@ -12,6 +12,9 @@
 #include <wangle/channel/broadcast/BroadcastPool.h>
 #include <wangle/channel/broadcast/test/Mocks.h>
 
+#include <chrono>
+#include <thread>
+
 using namespace wangle;
 using namespace folly;
 using namespace testing;
@@ -47,16 +50,25 @@ class BroadcastPoolTest : public Test {
    public:
     DefaultPipeline::Ptr newPipeline(
         std::shared_ptr<AsyncTransportWrapper> sock) override {
+      accepted++;
+      if (closeFirst-- > 0) {
+        sock->closeNow();
+      }
       auto pipeline = DefaultPipeline::create();
       pipeline->addBack(new BytesToBytesHandler());
       pipeline->finalize();
       return pipeline;
     }
+
+    // Of the connections accepted from now on, the number to close at once
+    std::atomic<int> closeFirst{0};
+    std::atomic<int> accepted{0};
   };
 
   void startServer() {
     server = folly::make_unique<ServerBootstrap<DefaultPipeline>>();
-    server->childPipeline(std::make_shared<ServerPipelineFactory>());
+    serverPipelineFactory = std::make_shared<ServerPipelineFactory>();
+    server->childPipeline(serverPipelineFactory);
     server->bind(0);
     server->getSockets()[0]->getAddress(addr.get());
   }
@@ -70,6 +82,7 @@ class BroadcastPoolTest : public Test {
   std::shared_ptr<StrictMock<MockBroadcastPipelineFactory>> pipelineFactory;
   NiceMock<MockSubscriber<int, std::string>> subscriber;
   std::unique_ptr<ServerBootstrap<DefaultPipeline>> server;
+  std::shared_ptr<ServerPipelineFactory> serverPipelineFactory;
   std::shared_ptr<SocketAddress> addr;
 };
 
@@ -433,6 +446,71 @@ TEST_F(BroadcastPoolTest, SubscriberDeletionBeforeConnect) {
   handler->readEOF(handler->getContext());
 }
 
+TEST_F(BroadcastPoolTest, WarmConnections) {
+  // Test that a new broadcast takes a warm connection, which is replaced
+  std::string routingData = "url1";
+  BroadcastHandler<int, std::string>* handler = nullptr;
+  auto base = EventBaseManager::get()->getEventBase();
+
+  pool->setWarmConnections(2);
+  pool->warmUp(*addr);
+  while (pool->getNumWarmConnections(*addr) < 2) {
+    base->loopOnce(); // Do async connects
+  }
+
+  // No connect to wait for
+  EXPECT_CALL(*pipelineFactory, setRoutingData(_, "url1")).Times(1);
+  pool->getHandler(routingData)
+      .then([&](BroadcastHandler<int, std::string>* h) {
+        handler = h;
+        handler->subscribe(&subscriber);
+      });
+  EXPECT_TRUE(handler != nullptr);
+  EXPECT_TRUE(pool->isBroadcasting(routingData));
+  EXPECT_EQ(1, pool->getNumWarmConnections(*addr));
+
+  while (pool->getNumWarmConnections(*addr) < 2) {
+    base->loopOnce(); // Do async connect
+  }
+
+  // Cleanup
+  handler->readEOF(handler->getContext());
+  EXPECT_FALSE(pool->isBroadcasting(routingData));
+  EXPECT_EQ(2, pool->getNumWarmConnections(*addr));
+}
+
+TEST_F(BroadcastPoolTest, WarmConnectionClosedIsReplaced) {
+  // Test that a warm connection closed by the server is opened again
+  auto base = EventBaseManager::get()->getEventBase();
+  serverPipelineFactory->closeFirst = 1;
+
+  pool->setWarmConnections(2);
+  pool->warmUp(*addr);
+  for (int i = 0; i < 300; i++) {
+    if (serverPipelineFactory->accepted == 3 &&
+        pool->getNumWarmConnections(*addr) == 2) {
+      break;
+    }
+    base->loopOnce(EVLOOP_NONBLOCK);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(3, serverPipelineFactory->accepted);
+  EXPECT_EQ(2, pool->getNumWarmConnections(*addr));
+}
+
+TEST_F(BroadcastPoolTest, WarmConnectionOutlivedByConnect) {
+  // Test that a connect finishing after the pool is gone is ignored
+  auto base = EventBaseManager::get()->getEventBase();
+
+  pool->setWarmConnections(2);
+  pool->warmUp(*addr);
+  pool.reset();
+  for (int i = 0; i < 10; i++) {
+    base->loopOnce(EVLOOP_NONBLOCK);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+}
+
 TEST_F(BroadcastPoolTest, ThreadLocalPool) {
   // Test that thread-local broadcast pool works correctly
   MockObservingPipelineFactory factory1(serverPool, pipelineFactory);
@@ -506,3 +584,90 @@ TEST_F(BroadcastPoolTest, ThreadLocalPool) {
   pipeline2->readEOF();
   pipeline4->readEOF();
 }
+
+TEST_F(BroadcastPoolTest, SharedUpstream) {
+  // Test two pools sharing one upstream connection through a hub
+  auto hub = std::make_shared<BroadcastHub<int, std::string>>();
+  auto origin = folly::make_unique<BroadcastPool<int, std::string>>(
+      serverPool, pipelineFactory, hub);
+  auto relay = folly::make_unique<BroadcastPool<int, std::string>>(
+      serverPool, pipelineFactory, hub);
+  NiceMock<MockSubscriber<int, std::string>> relaySubscriber;
+  BroadcastHandler<int, std::string>* originHandler = nullptr;
+  BroadcastHandler<int, std::string>* relayHandler = nullptr;
+  auto base = EventBaseManager::get()->getEventBase();
+
+  // Only the origin connects upstream
+  EXPECT_CALL(*pipelineFactory, setRoutingData(_, "url1")).Times(1);
+  origin->getHandler("url1")
+      .then([&](BroadcastHandler<int, std::string>* h) {
+        originHandler = h;
+        originHandler->subscribe(&subscriber);
+      });
+  base->loopOnce(); // Do async connect
+  EXPECT_TRUE(originHandler != nullptr);
+
+  // The relay's handler is available right away
+  relay->getHandler("url1")
+      .then([&](BroadcastHandler<int, std::string>* h) {
+        relayHandler = h;
+        relayHandler->subscribe(&relaySubscriber);
+      });
+  EXPECT_TRUE(relayHandler != nullptr);
+  EXPECT_TRUE(relayHandler != originHandler);
+  EXPECT_TRUE(relay->isBroadcasting("url1"));
+  base->loopOnce(); // Subscribe to the origin
+
+  EXPECT_CALL(subscriber, onNext(1)).Times(1);
+  EXPECT_CALL(relaySubscriber, onNext(1)).Times(1);
+  originHandler->read(originHandler->getContext(), 1);
+  base->loopOnce(); // Relay the data
+
+  // Completion of the upstream is relayed too, removing both broadcasts
+  EXPECT_CALL(subscriber, onCompleted()).Times(1);
+  EXPECT_CALL(relaySubscriber, onCompleted()).Times(1);
+  originHandler->readEOF(originHandler->getContext());
+  EXPECT_FALSE(origin->isBroadcasting("url1"));
+  base->loopOnce();
+  EXPECT_FALSE(relay->isBroadcasting("url1"));
+}
+
+TEST_F(BroadcastPoolTest, SharedUpstreamRelayClosed) {
+  // When the relay's subscribers go away, so does its subscription to
+  // the origin
+  auto hub = std::make_shared<BroadcastHub<int, std::string>>();
+  auto origin = folly::make_unique<BroadcastPool<int, std::string>>(
+      serverPool, pipelineFactory, hub);
+  auto relay = folly::make_unique<BroadcastPool<int, std::string>>(
+      serverPool, pipelineFactory, hub);
+  NiceMock<MockSubscriber<int, std::string>> relaySubscriber;
+  BroadcastHandler<int, std::string>* originHandler = nullptr;
+  BroadcastHandler<int, std::string>* relayHandler = nullptr;
+  uint64_t subscriptionId = 0;
+  auto base = EventBaseManager::get()->getEventBase();
+
+  EXPECT_CALL(*pipelineFactory, setRoutingData(_, "url1")).Times(1);
+  origin->getHandler("url1")
+      .then([&](BroadcastHandler<int, std::string>* h) {
+        originHandler = h;
+        originHandler->subscribe(&subscriber);
+      });
+  base->loopOnce(); // Do async connect
+
+  relay->getHandler("url1")
+      .then([&](BroadcastHandler<int, std::string>* h) {
+        relayHandler = h;
+        subscriptionId = relayHandler->subscribe(&relaySubscriber);
+      });
+  base->loopOnce(); // Subscribe to the origin
+  EXPECT_EQ(2, originHandler->getSubscriberCount());
+
+  relayHandler->unsubscribe(subscriptionId);
+  EXPECT_FALSE(relay->isBroadcasting("url1"));
+  base->loopOnce(); // Unsubscribe from the origin
+  EXPECT_EQ(1, originHandler->getSubscriberCount());
+  EXPECT_TRUE(origin->isBroadcasting("url1"));
+
+  // Cleanup
+  originHandler->readEOF(originHandler->getContext());
+}
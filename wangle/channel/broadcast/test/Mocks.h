@@ -65,6 +65,11 @@ class MockServerPool : public ServerPool<std::string> {
                         : client->connect(*addr_);
   }
 
+  folly::Optional<folly::SocketAddress> getServer(
+      const std::string& routingData) override {
+    return *addr_;
+  }
+
   void failConnect() { failConnect_ = true; }
 
  private:
@@ -104,6 +109,12 @@ class MockObservingHandler : public ObservingHandler<int, std::string> {
   folly::Future<folly::Unit> close(Context* ctx) override {
     return mockClose(ctx).move();
   }
+
+ protected:
+  // Each message counts as one byte of the slow subscriber budget
+  uint64_t messageSize(const int& data) override {
+    return 1;
+  }
 };
 
 class MockBroadcastHandler : public BroadcastHandler<int, std::string> {
@@ -351,3 +351,152 @@ TEST_F(ObservingHandlerTest, WriteErrorHandlerDeletion) {
   pipeline.reset();
   promise.setException(std::exception());
 }
+
+TEST_F(ObservingHandlerTest, SlowSubscriberDropOldest) {
+  InSequence dummy;
+
+  EXPECT_CALL(*prevHandler, transportActive(_))
+      .WillOnce(Invoke([&](MockBytesToBytesHandler::Context* ctx) {
+        ctx->fireTransportActive();
+      }));
+  EXPECT_CALL(*prevHandler, transportInactive(_)).WillOnce(Return());
+  EXPECT_CALL(pool, mockGetHandler(_))
+      .WillOnce(Return(MoveWrapper<Future<BroadcastHandler<int, std::string>*>>(
+          broadcastHandler.get())));
+  EXPECT_CALL(*broadcastHandler, subscribe(_)).Times(1);
+  EXPECT_CALL(*prevHandler, transportActive(_))
+      .WillOnce(Invoke([&](MockBytesToBytesHandler::Context* ctx) {
+        ctx->fireTransportActive();
+      }));
+
+  // Initialize the pipeline
+  pipeline->transportActive();
+
+  observingHandler->setSlowSubscriberPolicy(SlowSubscriberPolicy::DROP_OLDEST,
+                                            2);
+
+  Promise<Unit> write1;
+  Promise<Unit> write2;
+  EXPECT_CALL(*observingHandler, mockWrite(_, 1))
+      .WillOnce(Return(makeMoveWrapper(write1.getFuture())));
+  EXPECT_CALL(*observingHandler, mockWrite(_, 2))
+      .WillOnce(Return(makeMoveWrapper(write2.getFuture())));
+
+  // The budget is used up by the first two messages. 3 is dropped to make
+  // room for 4 and 5.
+  for (int i = 1; i <= 5; i++) {
+    observingHandler->onNext(i);
+  }
+  EXPECT_EQ(2, observingHandler->getPendingBytes());
+  EXPECT_EQ(2, observingHandler->getQueuedBytes());
+  EXPECT_EQ(1, observingHandler->getDroppedMessages());
+
+  EXPECT_CALL(*observingHandler, mockWrite(_, 4))
+      .WillOnce(Return(makeMoveWrapper(makeFuture())));
+  EXPECT_CALL(*observingHandler, mockWrite(_, 5))
+      .WillOnce(Return(makeMoveWrapper(makeFuture())));
+
+  // Completing a write lets the queued messages through
+  write1.setValue();
+  EXPECT_EQ(1, observingHandler->getPendingBytes());
+  EXPECT_EQ(0, observingHandler->getQueuedBytes());
+
+  write2.setValue();
+  EXPECT_EQ(0, observingHandler->getPendingBytes());
+
+  EXPECT_CALL(*observingHandler, mockClose(_))
+      .WillOnce(Return(makeMoveWrapper(makeFuture())));
+
+  // Finish the broadcast
+  observingHandler->onCompleted();
+}
+
+TEST_F(ObservingHandlerTest, SlowSubscriberCoalesceLatest) {
+  InSequence dummy;
+
+  EXPECT_CALL(*prevHandler, transportActive(_))
+      .WillOnce(Invoke([&](MockBytesToBytesHandler::Context* ctx) {
+        ctx->fireTransportActive();
+      }));
+  EXPECT_CALL(*prevHandler, transportInactive(_)).WillOnce(Return());
+  EXPECT_CALL(pool, mockGetHandler(_))
+      .WillOnce(Return(MoveWrapper<Future<BroadcastHandler<int, std::string>*>>(
+          broadcastHandler.get())));
+  EXPECT_CALL(*broadcastHandler, subscribe(_)).Times(1);
+  EXPECT_CALL(*prevHandler, transportActive(_))
+      .WillOnce(Invoke([&](MockBytesToBytesHandler::Context* ctx) {
+        ctx->fireTransportActive();
+      }));
+
+  // Initialize the pipeline
+  pipeline->transportActive();
+
+  observingHandler->setSlowSubscriberPolicy(
+      SlowSubscriberPolicy::COALESCE_LATEST, 1);
+
+  Promise<Unit> write1;
+  EXPECT_CALL(*observingHandler, mockWrite(_, 1))
+      .WillOnce(Return(makeMoveWrapper(write1.getFuture())));
+
+  for (int i = 1; i <= 4; i++) {
+    observingHandler->onNext(i);
+  }
+  EXPECT_EQ(1, observingHandler->getQueuedBytes());
+  EXPECT_EQ(2, observingHandler->getDroppedMessages());
+
+  // Only the latest message is written once the connection catches up
+  EXPECT_CALL(*observingHandler, mockWrite(_, 4))
+      .WillOnce(Return(makeMoveWrapper(makeFuture())));
+  write1.setValue();
+  EXPECT_EQ(0, observingHandler->getPendingBytes());
+  EXPECT_EQ(0, observingHandler->getQueuedBytes());
+
+  EXPECT_CALL(*observingHandler, mockClose(_))
+      .WillOnce(Return(makeMoveWrapper(makeFuture())));
+
+  // Finish the broadcast
+  observingHandler->onCompleted();
+}
+
+TEST_F(ObservingHandlerTest, SlowSubscriberDisconnect) {
+  InSequence dummy;
+
+  EXPECT_CALL(*prevHandler, transportActive(_))
+      .WillOnce(Invoke([&](MockBytesToBytesHandler::Context* ctx) {
+        ctx->fireTransportActive();
+      }));
+  EXPECT_CALL(*prevHandler, transportInactive(_)).WillOnce(Return());
+  EXPECT_CALL(pool, mockGetHandler(_))
+      .WillOnce(Return(MoveWrapper<Future<BroadcastHandler<int, std::string>*>>(
+          broadcastHandler.get())));
+  EXPECT_CALL(*broadcastHandler, subscribe(_)).Times(1);
+  EXPECT_CALL(*prevHandler, transportActive(_))
+      .WillOnce(Invoke([&](MockBytesToBytesHandler::Context* ctx) {
+        ctx->fireTransportActive();
+      }));
+
+  // Initialize the pipeline
+  pipeline->transportActive();
+
+  observingHandler->setSlowSubscriberPolicy(SlowSubscriberPolicy::DISCONNECT,
+                                            1);
+
+  Promise<Unit> write1;
+  EXPECT_CALL(*observingHandler, mockWrite(_, 1))
+      .WillOnce(Return(makeMoveWrapper(write1.getFuture())));
+  observingHandler->onNext(1);
+
+  // Over the budget
+  EXPECT_CALL(*observingHandler, mockClose(_))
+      .WillOnce(Return(makeMoveWrapper(makeFuture())));
+  observingHandler->onNext(2);
+
+  write1.setValue();
+  EXPECT_EQ(0, observingHandler->getPendingBytes());
+
+  EXPECT_CALL(*observingHandler, mockClose(_))
+      .WillOnce(Return(makeMoveWrapper(makeFuture())));
+
+  // Finish the broadcast
+  observingHandler->onCompleted();
+}
@@ -9,10 +9,15 @@
  */
 
 #include <gtest/gtest.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <vector>
 #include <wangle/channel/AsyncSocketHandler.h>
 #include <wangle/channel/Pipeline.h>
+#include <wangle/channel/ReadBufferPool.h>
 #include <wangle/channel/test/MockHandler.h>
 #include <wangle/channel/test/MockPipeline.h>
+#include <wangle/concurrent/RequestTrace.h>
 
 using namespace folly;
 using namespace testing;
@@ -77,3 +82,380 @@ TEST(AsyncSocketHandlerTest, TransportActiveInactive) {
   EXPECT_CALL(*handler, transportInactive(_)).Times(0);
   pipeline->close();
 }
+
+TEST(AsyncSocketHandlerTest, WriteNoFutureErrOnClosedSocket) {
+  EventBase evb;
+  auto socket = AsyncSocket::newSocket(&evb);
+  auto pipeline = DefaultPipeline::create();
+  pipeline->addBack(AsyncSocketHandler(socket)).finalize();
+
+  int errors = 0;
+  pipeline->setWriteErrorCallback([&](exception_wrapper ew) {
+    EXPECT_TRUE(ew.is_compatible_with<AsyncSocketException>());
+    errors++;
+  });
+  pipeline->writeNoFuture(IOBuf::copyBuffer("hello"));
+  pipeline->writeNoFuture(IOBuf::copyBuffer("world"));
+  EXPECT_EQ(2, errors);
+}
+
+TEST(AsyncSocketHandlerTest, WriteBufferWatermarks) {
+  EventBase evb;
+  int fds[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  auto socket = AsyncSocket::newSocket(&evb, fds[0]);
+  auto handler = std::make_shared<NiceMock<MockBytesToBytesHandler>>();
+  ON_CALL(*handler, write(_, _)).WillByDefault(
+      Invoke([](MockBytesToBytesHandler::Context* ctx,
+                std::shared_ptr<IOBuf> buf) {
+        return makeMoveWrapper(ctx->fireWrite(buf->clone()));
+      }));
+  std::vector<bool> changes;
+  ON_CALL(*handler, writabilityChanged(_, _)).WillByDefault(
+      Invoke([&](MockBytesToBytesHandler::Context*, bool writable) {
+        changes.push_back(writable);
+      }));
+  auto pipeline = DefaultPipeline::create();
+  pipeline->setWriteBufferWatermarks(1024, 64 * 1024);
+  pipeline->addBack(AsyncSocketHandler(socket));
+  pipeline->addBack(handler);
+  pipeline->finalize();
+
+  // Far more than the socket buffer can take, so most of it stays queued
+  pipeline->writeNoFuture(IOBuf::copyBuffer(std::string(8 << 20, 'x')));
+  EXPECT_FALSE(pipeline->isWritable());
+  EXPECT_EQ(std::vector<bool>({false}), changes);
+
+  char buf[64 * 1024];
+  while (!pipeline->isWritable()) {
+    ASSERT_GT(::read(fds[1], buf, sizeof(buf)), 0);
+    evb.loopOnce(EVLOOP_NONBLOCK);
+  }
+  EXPECT_EQ(std::vector<bool>({false, true}), changes);
+  ::close(fds[1]);
+}
+
+TEST(AsyncSocketHandlerTest, AdaptiveReadBuffer) {
+  EventBase evb;
+  int fds[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  auto socket = AsyncSocket::newSocket(&evb, fds[0]);
+  auto handler = std::make_shared<NiceMock<MockBytesToBytesHandler>>();
+  ON_CALL(*handler, read(_, _)).WillByDefault(
+      Invoke([](MockBytesToBytesHandler::Context*, IOBufQueue& q) {
+        q.move();
+      }));
+  auto pipeline = DefaultPipeline::create();
+  pipeline->setReadBufferSettings(1024, 2048);
+  pipeline->setAdaptiveReadBufferLimits(1024, 64 * 1024);
+  pipeline->addBack(AsyncSocketHandler(socket));
+  pipeline->addBack(handler);
+  pipeline->finalize();
+  pipeline->transportActive();
+  auto socketHandler = pipeline->getHandler<AsyncSocketHandler>();
+
+  // Bulk transfer: reads keep filling the buffer, so it grows to the max
+  std::string chunk(32 * 1024, 'x');
+  for (int i = 0; i < 32; i++) {
+    ASSERT_EQ(chunk.size(), ::write(fds[1], chunk.data(), chunk.size()));
+    while (socketHandler->getReadStats().bytes < (i + 1) * chunk.size()) {
+      evb.loopOnce();
+    }
+  }
+  EXPECT_EQ(64 * 1024, socketHandler->getReadAllocationSize());
+  EXPECT_GT(socketHandler->getReadStats().fullReads, 0);
+
+  // Trickle: short reads shrink it back down to the min
+  for (int i = 0; i < 16; i++) {
+    auto reads = socketHandler->getReadStats().reads;
+    ASSERT_EQ(1, ::write(fds[1], "x", 1));
+    while (socketHandler->getReadStats().reads == reads) {
+      evb.loopOnce();
+    }
+  }
+  EXPECT_EQ(1024, socketHandler->getReadAllocationSize());
+  ::close(fds[1]);
+}
+
+TEST(AsyncSocketHandlerTest, ReadBufferPool) {
+  EventBase evb;
+  int fds[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  auto socket = AsyncSocket::newSocket(&evb, fds[0]);
+  size_t capacity = 0;
+  auto handler = std::make_shared<NiceMock<MockBytesToBytesHandler>>();
+  ON_CALL(*handler, read(_, _)).WillByDefault(
+      Invoke([&](MockBytesToBytesHandler::Context*, IOBufQueue& q) {
+        capacity = q.front()->capacity();
+        q.move();
+      }));
+  auto pipeline = DefaultPipeline::create();
+  pipeline->setReadBufferSettings(1024, 2048);
+  pipeline->setReadBufferPool(std::make_shared<ReadBufferPool>(4096));
+  pipeline->addBack(AsyncSocketHandler(socket));
+  pipeline->addBack(handler);
+  pipeline->finalize();
+  pipeline->transportActive();
+  auto socketHandler = pipeline->getHandler<AsyncSocketHandler>();
+
+  ASSERT_EQ(1, ::write(fds[1], "x", 1));
+  while (socketHandler->getReadStats().reads == 0) {
+    evb.loopOnce();
+  }
+  EXPECT_EQ(4096, capacity);
+  ::close(fds[1]);
+}
+
+TEST(AsyncSocketHandlerTest, ReadBytesNeeded) {
+  EventBase evb;
+  int fds[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  auto socket = AsyncSocket::newSocket(&evb, fds[0]);
+  const size_t frameLength = 16 * 1024;
+  auto handler = std::make_shared<NiceMock<MockBytesToBytesHandler>>();
+  ON_CALL(*handler, read(_, _)).WillByDefault(
+      Invoke([&](MockBytesToBytesHandler::Context* ctx, IOBufQueue& q) {
+        // Wait for the whole frame like a length-prefixed decoder would
+        if (q.chainLength() < frameLength) {
+          ctx->getPipeline()->setReadBytesNeeded(frameLength - q.chainLength());
+        } else {
+          ctx->getPipeline()->setReadBytesNeeded(0);
+          q.move();
+        }
+      }));
+  auto pipeline = DefaultPipeline::create();
+  pipeline->setReadBufferSettings(1024, 2048);
+  pipeline->addBack(AsyncSocketHandler(socket));
+  pipeline->addBack(handler);
+  pipeline->finalize();
+  pipeline->transportActive();
+  auto socketHandler = pipeline->getHandler<AsyncSocketHandler>();
+
+  // The first read is the regular size, the second one gets the rest
+  std::string frame(frameLength, 'x');
+  ASSERT_EQ(frame.size(), ::write(fds[1], frame.data(), frame.size()));
+  while (socketHandler->getReadStats().bytes < frameLength) {
+    evb.loopOnce();
+  }
+  EXPECT_EQ(2, socketHandler->getReadStats().reads);
+  ::close(fds[1]);
+}
+
+TEST(AsyncSocketHandlerTest, ZeroCopyWrite) {
+  EventBase evb;
+  int fds[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  ASSERT_EQ(0, ::fcntl(fds[1], F_SETFL, O_NONBLOCK));
+  auto socket = AsyncSocket::newSocket(&evb, fds[0]);
+  auto pipeline = DefaultPipeline::create();
+  pipeline->addBack(AsyncSocketHandler(socket));
+  pipeline->finalize();
+  auto socketHandler = pipeline->getHandler<AsyncSocketHandler>();
+
+  // Whether or not the socket takes zero-copy writes, both sizes of write
+  // must complete with all of their data delivered
+  socketHandler->setZeroCopyThreshold(64 * 1024);
+  const size_t largeSize = 256 * 1024;
+  auto small = pipeline->write(IOBuf::copyBuffer("x"));
+  auto large = pipeline->write(IOBuf::copyBuffer(std::string(largeSize, 'y')));
+
+  char buf[64 * 1024];
+  size_t total = 0;
+  while (total < largeSize + 1 || !large.isReady()) {
+    auto n = ::read(fds[1], buf, sizeof(buf));
+    if (n > 0) {
+      total += n;
+    }
+    evb.loopOnce(EVLOOP_NONBLOCK);
+  }
+  EXPECT_EQ(largeSize + 1, total);
+  EXPECT_TRUE(small.isReady());
+  EXPECT_FALSE(large.hasException());
+
+  EXPECT_TRUE(socketHandler->setZeroCopyThreshold(0));
+  ::close(fds[1]);
+}
+
+TEST(AsyncSocketHandlerTest, PauseRead) {
+  EventBase evb;
+  int fds[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  auto socket = AsyncSocket::newSocket(&evb, fds[0]);
+  auto handler = std::make_shared<NiceMock<MockBytesToBytesHandler>>();
+  ON_CALL(*handler, read(_, _)).WillByDefault(
+      Invoke([](MockBytesToBytesHandler::Context*, IOBufQueue& q) {
+        q.move();
+      }));
+  auto pipeline = DefaultPipeline::create();
+  pipeline->addBack(AsyncSocketHandler(socket));
+  pipeline->addBack(handler);
+  pipeline->finalize();
+  auto socketHandler = pipeline->getHandler<AsyncSocketHandler>();
+
+  // Pauses can be taken before the transport is active and nest
+  auto ctx = handler->getContext();
+  ctx->pauseRead();
+  pipeline->transportActive();
+  ctx->pauseRead();
+  EXPECT_FALSE(socket->getReadCallback());
+
+  ASSERT_EQ(1, ::write(fds[1], "x", 1));
+  evb.loopOnce(EVLOOP_NONBLOCK);
+  ctx->resumeRead();
+  evb.loopOnce(EVLOOP_NONBLOCK);
+  EXPECT_EQ(0, socketHandler->getReadStats().reads);
+  EXPECT_TRUE(pipeline->isReadPaused());
+
+  ctx->resumeRead();
+  EXPECT_FALSE(pipeline->isReadPaused());
+  while (socketHandler->getReadStats().reads == 0) {
+    evb.loopOnce();
+  }
+  EXPECT_EQ(1, socketHandler->getReadStats().bytes);
+  ::close(fds[1]);
+}
+
+TEST(AsyncSocketHandlerTest, ReleaseIdleBuffers) {
+  EventBase evb;
+  int fds[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  auto socket = AsyncSocket::newSocket(&evb, fds[0]);
+  // Waits for messages of 16 bytes
+  auto handler = std::make_shared<NiceMock<MockBytesToBytesHandler>>();
+  ON_CALL(*handler, read(_, _)).WillByDefault(
+      Invoke([](MockBytesToBytesHandler::Context*, IOBufQueue& q) {
+        while (q.chainLength() >= 16) {
+          q.trimStart(16);
+        }
+      }));
+  auto pipeline = DefaultPipeline::create();
+  pipeline->setReadBufferSettings(16 * 1024, 16 * 1024);
+  pipeline->addBack(AsyncSocketHandler(socket));
+  pipeline->addBack(handler);
+  pipeline->finalize();
+  auto socketHandler = pipeline->getHandler<AsyncSocketHandler>();
+  socketHandler->setReleaseIdleBuffers(true);
+  pipeline->transportActive();
+
+  // Half a message is kept in a buffer of its size
+  ASSERT_EQ(8, ::write(fds[1], "12345678", 8));
+  while (socketHandler->getReadStats().reads == 0) {
+    evb.loopOnce();
+  }
+  EXPECT_GT(1024, socketHandler->getBufferMemoryUsage());
+  EXPECT_LE(8, socketHandler->getBufferMemoryUsage());
+
+  // And nothing once it's complete
+  ASSERT_EQ(8, ::write(fds[1], "12345678", 8));
+  while (socketHandler->getReadStats().reads == 1) {
+    evb.loopOnce();
+  }
+  EXPECT_EQ(0, socketHandler->getBufferMemoryUsage());
+  ::close(fds[1]);
+}
+
+TEST(AsyncSocketHandlerTest, BufferLimit) {
+  auto& accounting = BufferAccounting::get();
+  const auto before = accounting.getBytes();
+  accounting.setLimit(before + 64);
+
+  EventBase evb;
+  int fds[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  auto socket = AsyncSocket::newSocket(&evb, fds[0]);
+  // Keeps everything it's given
+  auto handler = std::make_shared<NiceMock<MockBytesToBytesHandler>>();
+  auto pipeline = DefaultPipeline::create();
+  pipeline->addBack(AsyncSocketHandler(socket));
+  pipeline->addBack(handler);
+  pipeline->finalize();
+  auto socketHandler = pipeline->getHandler<AsyncSocketHandler>();
+  pipeline->transportActive();
+
+  ASSERT_EQ(8, ::write(fds[1], "12345678", 8));
+  while (socketHandler->getReadStats().reads == 0) {
+    evb.loopOnce();
+  }
+  EXPECT_EQ(8, pipeline->getBufferAccount().getBytes());
+  EXPECT_EQ(before + 8, accounting.getBytes());
+  EXPECT_FALSE(accounting.isOverLimit());
+  EXPECT_TRUE(socket->getReadCallback());
+
+  // Over the limit, reads stop until it's raised
+  std::string data(100, 'x');
+  ASSERT_EQ(100, ::write(fds[1], data.data(), data.size()));
+  while (socketHandler->getReadStats().bytes < 108) {
+    evb.loopOnce();
+  }
+  EXPECT_EQ(108, pipeline->getBufferAccount().getBytes());
+  EXPECT_TRUE(accounting.isOverLimit());
+  EXPECT_FALSE(socket->getReadCallback());
+
+  accounting.setLimit(before + 1024);
+  EXPECT_FALSE(accounting.isOverLimit());
+  while (!socket->getReadCallback()) {
+    evb.loopOnce();
+  }
+
+  // Everything is taken back with the pipeline
+  pipeline.reset();
+  EXPECT_EQ(before, accounting.getBytes());
+  accounting.setLimit(0);
+  ::close(fds[1]);
+}
+
+TEST(AsyncSocketHandlerTest, BufferLimitNotPausing) {
+  auto& accounting = BufferAccounting::get();
+  const auto before = accounting.getBytes();
+  accounting.setLimit(before + 64);
+
+  EventBase evb;
+  int fds[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  auto socket = AsyncSocket::newSocket(&evb, fds[0]);
+  auto handler = std::make_shared<NiceMock<MockBytesToBytesHandler>>();
+  // Set before the handler is moved into the pipeline
+  AsyncSocketHandler socketHandler(socket);
+  socketHandler.setPauseReadsOverBufferLimit(false);
+  auto pipeline = DefaultPipeline::create();
+  pipeline->addBack(std::move(socketHandler));
+  pipeline->addBack(handler);
+  pipeline->finalize();
+  pipeline->transportActive();
+
+  std::string data(100, 'x');
+  ASSERT_EQ(100, ::write(fds[1], data.data(), data.size()));
+  auto readStats = [&] {
+    return pipeline->getHandler<AsyncSocketHandler>()->getReadStats();
+  };
+  while (readStats().bytes < 100) {
+    evb.loopOnce();
+  }
+  EXPECT_TRUE(accounting.isOverLimit());
+  EXPECT_TRUE(socket->getReadCallback());
+
+  pipeline.reset();
+  accounting.setLimit(0);
+  ::close(fds[1]);
+}
+
+TEST(AsyncSocketHandlerTest, RequestTrace) {
+  EventBase evb;
+  int fds[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  auto socket = AsyncSocket::newSocket(&evb, fds[0]);
+  auto pipeline = DefaultPipeline::create();
+  pipeline->addBack(AsyncSocketHandler(socket));
+  pipeline->finalize();
+
+  const auto id = RequestTrace::sample(1);
+  {
+    RequestTrace::Scope scope(id);
+    pipeline->writeNoFuture(IOBuf::copyBuffer("traced"));
+  }
+  pipeline->writeNoFuture(IOBuf::copyBuffer("untraced"));
+  auto events = RequestTrace::getEvents(id);
+  ASSERT_EQ(1, events.size());
+  EXPECT_STREQ("socket write", events[0].stage);
+  ::close(fds[1]);
+}
@@ -0,0 +1,71 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <wangle/channel/BufferAccounting.h>
+
+#include <thread>
+#include <vector>
+
+using namespace wangle;
+
+TEST(BufferAccountingTest, Accounts) {
+  BufferAccounting accounting;
+  {
+    BufferAccounting::Account a(accounting);
+    BufferAccounting::Account b(accounting);
+    a.add(100);
+    b.add(50);
+    a.add(-30);
+    EXPECT_EQ(70, a.getBytes());
+    EXPECT_EQ(120, accounting.getBytes());
+  }
+  // Destroyed accounts take their bytes back
+  EXPECT_EQ(0, accounting.getBytes());
+}
+
+TEST(BufferAccountingTest, Limit) {
+  BufferAccounting accounting(4);
+  accounting.setLimit(800);
+  BufferAccounting::Account account(accounting);
+  account.add(800);
+  EXPECT_FALSE(accounting.isOverLimit());
+  account.add(200);
+  EXPECT_TRUE(accounting.isOverLimit());
+  // Until back under seven eighths of it
+  account.add(-200);
+  EXPECT_TRUE(accounting.isOverLimit());
+  account.add(-200);
+  EXPECT_FALSE(accounting.isOverLimit());
+
+  account.add(400);
+  EXPECT_TRUE(accounting.isOverLimit());
+  accounting.setLimit(0);
+  EXPECT_FALSE(accounting.isOverLimit());
+}
+
+TEST(BufferAccountingTest, ManyThreads) {
+  BufferAccounting accounting;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; i++) {
+    threads.emplace_back([&] {
+      for (int j = 0; j < 10000; j++) {
+        accounting.add(1000);
+      }
+      for (int j = 0; j < 5000; j++) {
+        accounting.add(-1000);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(8 * 5000 * 1000, accounting.getBytes());
+}
@@ -0,0 +1,61 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <folly/Conv.h>
+#include <folly/io/async/ScopedEventBaseThread.h>
+#include <wangle/channel/AsyncSocketHandler.h>
+#include <wangle/channel/EventBaseHandler.h>
+#include <wangle/channel/Pipeline.h>
+
+using namespace folly;
+using namespace wangle;
+
+TEST(EventBaseHandlerTest, QueuedWritesAndClose) {
+  // Writes and a close from another thread than the socket's arrive in
+  // order, the close after the writes queued before it
+  ScopedEventBaseThread evbThread;
+  auto evb = evbThread.getEventBase();
+  int fds[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  DefaultPipeline::Ptr pipeline;
+  evb->runInEventBaseThreadAndWait([&] {
+    pipeline = DefaultPipeline::create();
+    pipeline->addBack(AsyncSocketHandler(AsyncSocket::newSocket(evb, fds[0])));
+    pipeline->addBack(EventBaseHandler(true));
+    pipeline->finalize();
+    pipeline->transportActive();
+  });
+
+  std::string expected;
+  std::vector<Future<Unit>> futures;
+  for (int i = 0; i < 100; i++) {
+    auto data = to<std::string>(i, ",");
+    expected += data;
+    futures.push_back(pipeline->write(IOBuf::copyBuffer(data)));
+  }
+  futures.push_back(pipeline->close());
+  for (auto& t : collectAll(futures).get()) {
+    EXPECT_FALSE(t.hasException());
+  }
+
+  std::string received;
+  char buf[4096];
+  ssize_t n;
+  while ((n = ::read(fds[1], buf, sizeof(buf))) > 0) {
+    received.append(buf, n);
+  }
+  EXPECT_EQ(expected, received);
+  ::close(fds[1]);
+  evb->runInEventBaseThreadAndWait([&] {
+    pipeline.reset();
+  });
+}
@@ -104,4 +104,40 @@ TEST_F(FileRegionTest, Repeated) {
   }
   ASSERT_EQ(receivedBytes, sendCount*count);
 }
+
+TEST_F(FileRegionTest, Chunked) {
+  const size_t count = 1000000;
+  std::string data(count, 0);
+  for (size_t i = 0; i < count; i++) {
+    data[i] = i % 251;
+  }
+  ASSERT_EQ(count, write(fd, data.data(), count));
+
+  const size_t offset = 10;
+  const size_t chunkSize = 4096;
+  std::string received;
+  size_t writes = 0;
+  FileRegion fileRegion(fd, offset, count - offset);
+  auto f = fileRegion.transferChunked(
+      &evb,
+      [&](std::unique_ptr<IOBuf> buf) {
+        EXPECT_LE(buf->computeChainDataLength(), chunkSize);
+        received += buf->moveToFbString().toStdString();
+        writes++;
+        return makeFuture();
+      },
+      chunkSize);
+  ASSERT_NO_THROW(f.getVia(&evb));
+  EXPECT_EQ(data.substr(offset), received);
+  EXPECT_EQ((count - offset + chunkSize - 1) / chunkSize, writes);
+}
+
+TEST_F(FileRegionTest, ChunkedPastEndOfFile) {
+  ASSERT_EQ(3, write(fd, "abc", 3));
+  FileRegion fileRegion(fd, 0, 10);
+  auto f = fileRegion.transferChunked(
+      &evb,
+      [](std::unique_ptr<IOBuf>) { return makeFuture(); });
+  EXPECT_THROW(f.getVia(&evb), AsyncSocketException);
+}
 #endif
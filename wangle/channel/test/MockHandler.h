@@ -71,6 +71,7 @@ class MockBytesToBytesHandler : public BytesToBytesHandler {
 
   MOCK_METHOD1(transportActive, void(Context*));
   MOCK_METHOD1(transportInactive, void(Context*));
+  MOCK_METHOD2(writabilityChanged, void(Context*, bool));
   MOCK_METHOD2(read, void(Context*, folly::IOBufQueue&));
   MOCK_METHOD1(readEOF, void(Context*));
   MOCK_METHOD2(readException, void(Context*, folly::exception_wrapper));
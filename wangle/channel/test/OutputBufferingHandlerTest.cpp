@@ -11,6 +11,7 @@
 #include <wangle/channel/StaticPipeline.h>
 #include <wangle/channel/OutputBufferingHandler.h>
 #include <wangle/channel/test/MockHandler.h>
+#include <wangle/concurrent/RequestTrace.h>
 #include <folly/io/async/AsyncSocket.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
@@ -58,3 +59,189 @@ TEST(OutputBufferingHandlerTest, Basic) {
   eb.loopOnce();
   EXPECT_TRUE(f.isReady());
 }
+
+TEST(OutputBufferingHandlerTest, WriteNoFuture) {
+  MockBytesHandler mockHandler;
+  EXPECT_CALL(mockHandler, attachPipeline(_));
+  auto pipeline = StaticPipeline<IOBufQueue&, std::unique_ptr<IOBuf>,
+    MockBytesHandler,
+    OutputBufferingHandler>::create(
+      &mockHandler,
+      OutputBufferingHandler());
+
+  EventBase eb;
+  auto socket = AsyncSocket::newSocket(&eb);
+  pipeline->setTransport(socket);
+
+  // Future-less writes are batched the same way as regular ones
+  pipeline->writeNoFuture(IOBuf::copyBuffer("hello"));
+  pipeline->writeNoFuture(IOBuf::copyBuffer("world"));
+  EXPECT_CALL(mockHandler, write_(_, IOBufContains("helloworld")));
+  eb.loopOnce();
+
+  // Mixing in a regular write still completes its Future
+  pipeline->writeNoFuture(IOBuf::copyBuffer("foo"));
+  auto f = pipeline->write(IOBuf::copyBuffer("bar"));
+  EXPECT_FALSE(f.isReady());
+  EXPECT_CALL(mockHandler, write_(_, IOBufContains("foobar")));
+  eb.loopOnce();
+  EXPECT_TRUE(f.isReady());
+  EXPECT_CALL(mockHandler, detachPipeline(_));
+}
+
+TEST(OutputBufferingHandlerTest, FlushOnLimits) {
+  MockBytesHandler mockHandler;
+  EXPECT_CALL(mockHandler, attachPipeline(_));
+  OutputBufferingHandler bufferingHandler;
+  bufferingHandler.setMaxBufferedBytes(8);
+  bufferingHandler.setMaxBufferedSegments(3);
+  auto pipeline = StaticPipeline<IOBufQueue&, std::unique_ptr<IOBuf>,
+    MockBytesHandler,
+    OutputBufferingHandler>::create(
+      &mockHandler,
+      &bufferingHandler);
+
+  EventBase eb;
+  auto socket = AsyncSocket::newSocket(&eb);
+  pipeline->setTransport(socket);
+
+  // Byte limit reached on the second write
+  pipeline->write(IOBuf::copyBuffer("hello"));
+  EXPECT_CALL(mockHandler, write_(_, IOBufContains("helloworld")));
+  pipeline->write(IOBuf::copyBuffer("world"));
+  Mock::VerifyAndClearExpectations(&mockHandler);
+
+  // Segment limit reached on the third write
+  pipeline->write(IOBuf::copyBuffer("a"));
+  pipeline->write(IOBuf::copyBuffer("b"));
+  EXPECT_CALL(mockHandler, write_(_, IOBufContains("abc")));
+  pipeline->write(IOBuf::copyBuffer("c"));
+
+  // Nothing left for the loop callback
+  eb.loopOnce();
+  EXPECT_CALL(mockHandler, detachPipeline(_));
+}
+
+TEST(OutputBufferingHandlerTest, Cork) {
+  MockBytesHandler mockHandler;
+  EXPECT_CALL(mockHandler, attachPipeline(_));
+  OutputBufferingHandler bufferingHandler;
+  auto pipeline = StaticPipeline<IOBufQueue&, std::unique_ptr<IOBuf>,
+    MockBytesHandler,
+    OutputBufferingHandler>::create(
+      &mockHandler,
+      &bufferingHandler);
+
+  EventBase eb;
+  auto socket = AsyncSocket::newSocket(&eb);
+  pipeline->setTransport(socket);
+
+  bufferingHandler.cork();
+  auto f1 = pipeline->write(IOBuf::copyBuffer("hello"));
+  eb.loopOnce();
+  auto f2 = pipeline->write(IOBuf::copyBuffer("world"));
+  eb.loopOnce();
+  EXPECT_FALSE(f1.isReady());
+  EXPECT_FALSE(f2.isReady());
+
+  // Size-triggered flushes while corked carry WriteFlags::CORK
+  bufferingHandler.setMaxBufferedBytes(16);
+  EXPECT_CALL(mockHandler, write_(_, IOBufContains("helloworld!!!!!!")))
+    .WillOnce(Invoke([](MockBytesHandler::Context* ctx, std::unique_ptr<IOBuf>&) {
+      EXPECT_TRUE(isSet(ctx->getWriteFlags(), WriteFlags::CORK));
+    }));
+  pipeline->write(IOBuf::copyBuffer("!!!!!!"));
+  EXPECT_TRUE(f1.isReady());
+  EXPECT_TRUE(f2.isReady());
+  EXPECT_EQ(WriteFlags::NONE, pipeline->getWriteFlags());
+
+  auto f3 = pipeline->write(IOBuf::copyBuffer("foo"));
+  EXPECT_CALL(mockHandler, write_(_, IOBufContains("foo")))
+    .WillOnce(Invoke([](MockBytesHandler::Context* ctx, std::unique_ptr<IOBuf>&) {
+      EXPECT_FALSE(isSet(ctx->getWriteFlags(), WriteFlags::CORK));
+    }));
+  bufferingHandler.uncork();
+  EXPECT_TRUE(f3.isReady());
+  EXPECT_CALL(mockHandler, detachPipeline(_));
+}
+
+TEST(OutputBufferingHandlerTest, BufferAccount) {
+  BufferAccounting::get().setEnabled(true);
+  MockBytesHandler mockHandler;
+  EXPECT_CALL(mockHandler, attachPipeline(_));
+  auto pipeline = StaticPipeline<IOBufQueue&, std::unique_ptr<IOBuf>,
+    MockBytesHandler,
+    OutputBufferingHandler>::create(
+      &mockHandler,
+      OutputBufferingHandler());
+
+  EventBase eb;
+  auto socket = AsyncSocket::newSocket(&eb);
+  pipeline->setTransport(socket);
+
+  // Charged until flushed
+  pipeline->writeNoFuture(IOBuf::copyBuffer("hello"));
+  pipeline->writeNoFuture(IOBuf::copyBuffer("world"));
+  EXPECT_EQ(10, pipeline->getBufferAccount().getBytes());
+  EXPECT_CALL(mockHandler, write_(_, IOBufContains("helloworld")));
+  eb.loopOnce();
+  EXPECT_EQ(0, pipeline->getBufferAccount().getBytes());
+  EXPECT_CALL(mockHandler, detachPipeline(_));
+  BufferAccounting::get().setEnabled(false);
+}
+
+TEST(OutputBufferingHandlerTest, RequestTrace) {
+  MockBytesHandler mockHandler;
+  EXPECT_CALL(mockHandler, attachPipeline(_));
+  auto pipeline = StaticPipeline<IOBufQueue&, std::unique_ptr<IOBuf>,
+    MockBytesHandler,
+    OutputBufferingHandler>::create(
+      &mockHandler,
+      OutputBufferingHandler());
+
+  EventBase eb;
+  auto socket = AsyncSocket::newSocket(&eb);
+  pipeline->setTransport(socket);
+
+  const auto first = RequestTrace::sample(1);
+  const auto second = RequestTrace::sample(1);
+  pipeline->writeNoFuture(IOBuf::copyBuffer("a"));
+  {
+    RequestTrace::Scope scope(first);
+    pipeline->writeNoFuture(IOBuf::copyBuffer("b"));
+  }
+  {
+    RequestTrace::Scope scope(second);
+    pipeline->writeNoFuture(IOBuf::copyBuffer("c"));
+  }
+  EXPECT_FALSE(RequestTrace::isSet());
+
+  // Flushed in the trace of the first traced write
+  uint64_t flushTrace = 0;
+  EXPECT_CALL(mockHandler, write_(_, IOBufContains("abc")))
+    .WillOnce(InvokeWithoutArgs([&] {
+      flushTrace = RequestTrace::current();
+    }));
+  eb.loopOnce();
+  EXPECT_EQ(first, flushTrace);
+  EXPECT_FALSE(RequestTrace::isSet());
+
+  auto events = RequestTrace::getEvents(first);
+  ASSERT_EQ(2, events.size());
+  EXPECT_STREQ("buffered", events[0].stage);
+  EXPECT_STREQ("flushed", events[1].stage);
+  events = RequestTrace::getEvents(second);
+  ASSERT_EQ(1, events.size());
+  EXPECT_STREQ("buffered", events[0].stage);
+
+  // Not carried over to the next flush
+  EXPECT_CALL(mockHandler, write_(_, IOBufContains("d")))
+    .WillOnce(InvokeWithoutArgs([&] {
+      flushTrace = RequestTrace::current();
+    }));
+  pipeline->writeNoFuture(IOBuf::copyBuffer("d"));
+  eb.loopOnce();
+  EXPECT_EQ(0, flushTrace);
+  EXPECT_EQ(2, RequestTrace::getEvents(first).size());
+  EXPECT_CALL(mockHandler, detachPipeline(_));
+}
@@ -0,0 +1,117 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/Handler.h>
+#include <wangle/channel/Pipeline.h>
+#include <wangle/channel/PipelineArena.h>
+#include <wangle/channel/ReadBufferPool.h>
+#include <gtest/gtest.h>
+#include <cstring>
+
+using namespace wangle;
+
+namespace {
+
+struct Counted {
+  explicit Counted(int* destroyed) : destroyed_(destroyed) {}
+  ~Counted() {
+    (*destroyed_)++;
+  }
+  int* destroyed_;
+};
+
+}
+
+TEST(PipelineArenaTest, Alignment) {
+  PipelineArena arena(256);
+  arena.allocate(1);
+  for (size_t align : {1, 2, 8, 16, 64}) {
+    auto p = reinterpret_cast<uintptr_t>(arena.allocate(3, align));
+    EXPECT_EQ(0, p % align);
+  }
+  EXPECT_EQ(16, arena.bytesUsed());
+}
+
+TEST(PipelineArenaTest, BlocksReusedAfterClear) {
+  PipelineArena arena(256);
+  for (int i = 0; i < 10; i++) {
+    arena.allocate(100);
+  }
+  auto total = arena.totalSize();
+  EXPECT_EQ(5 * 256, total);
+
+  arena.clear();
+  EXPECT_EQ(0, arena.bytesUsed());
+  for (int i = 0; i < 10; i++) {
+    arena.allocate(100);
+  }
+  EXPECT_EQ(total, arena.totalSize());
+}
+
+TEST(PipelineArenaTest, BlockPool) {
+  auto pool = std::make_shared<ReadBufferPool>(512, 8, true);
+  void* block;
+  {
+    PipelineArena arena(pool);
+    block = arena.allocate(100);
+    arena.allocate(500);
+    EXPECT_EQ(2 * 512, arena.totalSize());
+  }
+  // The arena's blocks went back to the pool
+  auto first = pool->get();
+  auto second = pool->get();
+  EXPECT_TRUE(first->writableData() == block ||
+              second->writableData() == block);
+}
+
+TEST(PipelineArenaTest, LargeAllocations) {
+  PipelineArena arena(256);
+  auto small = static_cast<char*>(arena.allocate(10));
+  auto large = static_cast<char*>(arena.allocate(1000));
+  // The current block is still used for small allocations
+  auto small2 = static_cast<char*>(arena.allocate(10));
+  EXPECT_EQ(small + 16, small2);
+  memset(large, 0, 1000);
+  EXPECT_GT(arena.totalSize(), 1000);
+
+  arena.clear();
+  EXPECT_EQ(256, arena.totalSize());
+}
+
+TEST(PipelineArenaTest, Destructors) {
+  int destroyed = 0;
+  {
+    PipelineArena arena;
+    arena.create<Counted>(&destroyed);
+    arena.create<Counted>(&destroyed);
+    auto n = arena.create<int>(42);
+    EXPECT_EQ(42, *n);
+
+    arena.clear();
+    EXPECT_EQ(2, destroyed);
+    arena.create<Counted>(&destroyed);
+  }
+  EXPECT_EQ(3, destroyed);
+}
+
+TEST(PipelineArenaTest, ClearedOnPipelineReset) {
+  int destroyed = 0;
+  auto pipeline = Pipeline<int, int>::create();
+  pipeline->getArena().create<Counted>(&destroyed);
+  EXPECT_EQ(&pipeline->getArena(), &pipeline->getArena());
+
+  pipeline->reset();
+  EXPECT_EQ(1, destroyed);
+  EXPECT_EQ(0, pipeline->getArena().bytesUsed());
+
+  pipeline->getArena().create<Counted>(&destroyed);
+  pipeline.reset();
+  EXPECT_EQ(2, destroyed);
+}
@@ -10,6 +10,7 @@
 
 #include <wangle/channel/Handler.h>
 #include <wangle/channel/Pipeline.h>
+#include <wangle/channel/PipelineBuilder.h>
 #include <wangle/channel/StaticPipeline.h>
 #include <wangle/channel/AsyncSocketHandler.h>
 #include <wangle/channel/OutputBufferingHandler.h>
@@ -112,6 +113,50 @@ TEST(PipelineTest, FireActions) {
   }
 }
 
+TEST(PipelineTest, FixedStaticPipelineFireActions) {
+  IntHandler handler1;
+  IntHandler2 handler2;
+
+  {
+    InSequence sequence;
+    EXPECT_CALL(handler2, attachPipeline(_));
+    EXPECT_CALL(handler1, attachPipeline(_));
+  }
+
+  auto pipeline =
+    FixedStaticPipeline<int, int, IntHandler, IntHandler2>::create(
+        &handler1, &handler2);
+  EXPECT_EQ(&handler1, pipeline->getHandler<IntHandler>());
+  EXPECT_EQ(&handler2, pipeline->getHandler<IntHandler2>());
+
+  EXPECT_CALL(handler1, read_(_, _)).WillOnce(FireRead());
+  EXPECT_CALL(handler2, read_(_, _)).Times(1);
+  pipeline->read(1);
+
+  EXPECT_CALL(handler1, readEOF(_)).WillOnce(FireReadEOF());
+  EXPECT_CALL(handler2, readEOF(_)).Times(1);
+  pipeline->readEOF();
+
+  EXPECT_CALL(handler2, write_(_, _)).WillOnce(FireWrite());
+  EXPECT_CALL(handler1, write_(_, _)).Times(1);
+  EXPECT_NO_THROW(pipeline->write(1).value());
+
+  EXPECT_CALL(handler2, close_(_)).WillOnce(FireClose());
+  EXPECT_CALL(handler1, close_(_)).Times(1);
+  EXPECT_NO_THROW(pipeline->close().value());
+
+  // Reaching either end of the chain only logs a warning
+  EXPECT_CALL(handler2, read_(_, _)).WillOnce(FireRead());
+  EXPECT_CALL(handler1, read_(_, _)).WillOnce(FireRead());
+  pipeline->read(1);
+
+  {
+    InSequence sequence;
+    EXPECT_CALL(handler1, detachPipeline(_));
+    EXPECT_CALL(handler2, detachPipeline(_));
+  }
+}
+
 // Test that nothing bad happens when actions reach the end of the pipeline
 // (a warning will be logged, however)
 TEST(PipelineTest, ReachEndOfPipeline) {
@@ -137,6 +182,52 @@ TEST(PipelineTest, ReachEndOfPipeline) {
   EXPECT_CALL(handler, detachPipeline(_));
 }
 
+class BatchCountingHandler : public InboundHandler<int> {
+ public:
+  void read(Context*, int msg) override {
+    sum += msg;
+  }
+
+  void readBatch(Context*, MessageBatch<int> msgs) override {
+    batches++;
+    for (auto msg : msgs) {
+      sum += msg;
+    }
+  }
+
+  int batches{0};
+  int sum{0};
+};
+
+// Test that batches pass through handlers that don't override readBatch()
+// one message at a time, and reach the ones that do in a single call
+TEST(PipelineTest, ReadBatch) {
+  IntHandler handler1;
+  BatchCountingHandler handler2;
+
+  EXPECT_CALL(handler1, attachPipeline(_));
+  auto pipeline = Pipeline<int, int>::create();
+  (*pipeline)
+    .addBack(&handler1)
+    .addBack(&handler2)
+    .finalize();
+
+  std::vector<int> msgs{1, 2, 3};
+  EXPECT_CALL(handler1, read_(_, _)).Times(3).WillRepeatedly(FireRead());
+  pipeline->readBatch(range(msgs));
+  EXPECT_EQ(0, handler2.batches);
+  EXPECT_EQ(6, handler2.sum);
+
+  EXPECT_CALL(handler1, detachPipeline(_));
+  (*pipeline)
+    .remove(&handler1)
+    .finalize();
+
+  pipeline->readBatch(range(msgs));
+  EXPECT_EQ(1, handler2.batches);
+  EXPECT_EQ(12, handler2.sum);
+}
+
 // Test having the last read handler turn around and write
 TEST(PipelineTest, TurnAround) {
   IntHandler handler1;
@@ -300,6 +391,35 @@ TEST(Pipeline, DynamicConstruction) {
   }
 }
 
+TEST(Pipeline, Builder) {
+  IntHandler handler1, handler2;
+  EXPECT_CALL(handler1, attachPipeline(_));
+  EXPECT_CALL(handler2, attachPipeline(_));
+  auto pipeline = Pipeline<int, int>::create();
+  // ItI <-> ItS <-> StI <-> ItI, checked at compile time
+  PipelineBuilder<int, int>(pipeline)
+    .addBack(&handler1)
+    .addBack(IntToStringHandler{})
+    .addBack(StringToIntHandler{})
+    .addBack(&handler2)
+    .finalize();
+
+  EXPECT_CALL(handler1, read_(_, _)).WillOnce(FireRead());
+  EXPECT_CALL(handler2, read_(_, _)).Times(0);
+  pipeline->read(1);
+
+  EXPECT_CALL(handler2, write_(_, _)).WillOnce(FireWrite());
+  EXPECT_CALL(handler1, write_(_, _)).Times(0);
+  EXPECT_NO_THROW(pipeline->write(1).value());
+
+  // Still a Pipeline like any other
+  pipeline->remove<StringToIntHandler>();
+  EXPECT_THROW(pipeline->finalize(), std::invalid_argument);
+
+  EXPECT_CALL(handler1, detachPipeline(_));
+  EXPECT_CALL(handler2, detachPipeline(_));
+}
+
 TEST(Pipeline, RemovePointer) {
   IntHandler handler1, handler2;
   EXPECT_CALL(handler1, attachPipeline(_));
@@ -388,6 +508,109 @@ TEST(Pipeline, RemoveType) {
 // Pipeline lifetime used to be managed by DelayedDestruction, which is not
 // thread safe. This test would fail. Mandatory shared_ptr ownership fixes the
 // issue.
+TEST(Pipeline, InsertAndUnlink) {
+  IntHandler handler1, handler2, handler3;
+  EXPECT_CALL(handler1, attachPipeline(_));
+  EXPECT_CALL(handler3, attachPipeline(_));
+  auto pipeline = Pipeline<int, int>::create();
+  (*pipeline)
+    .addBack(&handler1)
+    .addBack(&handler3)
+    .finalize();
+
+  // Only the new handler is attached
+  EXPECT_CALL(handler2, attachPipeline(_));
+  pipeline->insertAfter(
+      &handler1, std::shared_ptr<IntHandler>(&handler2, [](IntHandler*){}));
+  EXPECT_EQ(&handler2, pipeline->getHandler<IntHandler>(1));
+
+  EXPECT_CALL(handler1, read_(_, _)).WillOnce(FireRead());
+  EXPECT_CALL(handler2, read_(_, _)).WillOnce(FireRead());
+  EXPECT_CALL(handler3, read_(_, _)).Times(1);
+  pipeline->read(1);
+
+  EXPECT_CALL(handler3, write_(_, _)).WillOnce(FireWrite());
+  EXPECT_CALL(handler2, write_(_, _)).WillOnce(FireWrite());
+  EXPECT_CALL(handler1, write_(_, _)).Times(1);
+  EXPECT_NO_THROW(pipeline->write(1).value());
+
+  // Unlink the front and back, leaving handler2 on its own
+  EXPECT_CALL(handler1, detachPipeline(_));
+  pipeline->unlink(&handler1);
+  EXPECT_CALL(handler3, detachPipeline(_));
+  pipeline->unlink(&handler3);
+
+  EXPECT_CALL(handler2, read_(_, _)).Times(1);
+  pipeline->read(1);
+  EXPECT_CALL(handler2, write_(_, _)).Times(1);
+  EXPECT_NO_THROW(pipeline->write(1).value());
+
+  // And back again
+  EXPECT_CALL(handler1, attachPipeline(_));
+  pipeline->insertFront(&handler1);
+  EXPECT_CALL(handler3, attachPipeline(_));
+  pipeline->insertBack(&handler3);
+
+  EXPECT_CALL(handler1, read_(_, _)).WillOnce(FireRead());
+  EXPECT_CALL(handler2, read_(_, _)).WillOnce(FireRead());
+  EXPECT_CALL(handler3, read_(_, _)).Times(1);
+  pipeline->read(1);
+
+  EXPECT_CALL(handler1, detachPipeline(_));
+  EXPECT_CALL(handler2, detachPipeline(_));
+  EXPECT_CALL(handler3, detachPipeline(_));
+}
+
+TEST(Pipeline, InsertTypeMismatch) {
+  auto pipeline = Pipeline<std::string, std::string>::create();
+  auto handler = std::make_shared<StringHandler>();
+  (*pipeline)
+    .addBack(StringHandler())
+    .addBack(handler)
+    .finalize();
+
+  EXPECT_THROW(
+      pipeline->insertFront(std::make_shared<IntToStringHandler>()),
+      std::invalid_argument);
+  EXPECT_THROW(
+      pipeline->insertBack(std::make_shared<StringToIntHandler>()),
+      std::invalid_argument);
+  EXPECT_THROW(
+      pipeline->insertBefore(
+          handler.get(), std::make_shared<StringToIntHandler>()),
+      std::invalid_argument);
+  EXPECT_THROW(
+      pipeline->insertAfter(
+          (StringToIntHandler*)nullptr, std::make_shared<StringHandler>()),
+      std::invalid_argument);
+
+  // Nothing was changed
+  EXPECT_EQ(handler.get(), pipeline->getHandler<StringHandler>(1));
+  EXPECT_FALSE(pipeline->getContext<IntToStringHandler>());
+  EXPECT_FALSE(pipeline->getContext<StringToIntHandler>());
+  EXPECT_NO_THROW(pipeline->read("hello"));
+  EXPECT_NO_THROW(pipeline->write("hello").value());
+}
+
+TEST(Pipeline, UnlinkTypeMismatch) {
+  // StI <-> ItS
+  auto pipeline = Pipeline<std::string, std::string>::create();
+  (*pipeline)
+    .addBack(StringToIntHandler())
+    .addBack(IntToStringHandler())
+    .finalize();
+
+  // ItS can't be at the front of the pipeline
+  EXPECT_THROW(pipeline->unlink<StringToIntHandler>(), std::invalid_argument);
+  EXPECT_TRUE(pipeline->getContext<StringToIntHandler>());
+  EXPECT_NO_THROW(pipeline->read("hello"));
+
+  // but a StS can be inserted in front
+  pipeline->insertFront(std::make_shared<StringHandler>());
+  EXPECT_TRUE(pipeline->getHandler<StringHandler>(0));
+  EXPECT_NO_THROW(pipeline->read("hello"));
+}
+
 TEST(Pipeline, Concurrent) {
   NiceMock<MockHandlerAdapter<int, int>> handler1, handler2;
   auto pipeline = Pipeline<int, int>::create();
@@ -406,3 +629,113 @@ TEST(Pipeline, Concurrent) {
   spam();
   t.join();
 }
+
+class ResettableHandler : public HandlerAdapter<int, int> {
+ public:
+  bool reset() override {
+    resets++;
+    return true;
+  }
+
+  int resets{0};
+};
+
+TEST(Pipeline, Reset) {
+  ResettableHandler handler1, handler2;
+  auto pipeline = Pipeline<int, int>::create();
+  (*pipeline)
+    .addBack(&handler1)
+    .addBack(&handler2)
+    .finalize();
+  pipeline->setTransportInfo(std::make_shared<TransportInfo>());
+  pipeline->setWritable(false);
+
+  EXPECT_TRUE(pipeline->reset());
+  EXPECT_EQ(1, handler1.resets);
+  EXPECT_EQ(1, handler2.resets);
+  EXPECT_FALSE(pipeline->getTransportInfo());
+  EXPECT_TRUE(pipeline->isWritable());
+
+  // A handler that doesn't support reset() makes the pipeline non-reusable
+  (*pipeline)
+    .addBack(ConcreteHandler<int>())
+    .finalize();
+  EXPECT_FALSE(pipeline->reset());
+  EXPECT_EQ(2, handler1.resets);
+  EXPECT_EQ(2, handler2.resets);
+}
+
+class ForwardingHandler : public HandlerAdapter<int, int> {
+ public:
+  void read(Context* ctx, int msg) override {
+    ctx->fireRead(msg);
+    // Still alive, whatever the handlers after this one did
+    EXPECT_EQ(uint64_t(msg), ctx->getPipeline()->getReadBytesNeeded());
+  }
+};
+
+class DeletingHandler : public HandlerAdapter<int, int> {
+ public:
+  void read(Context* ctx, int msg) override {
+    ctx->getPipeline()->setReadBytesNeeded(msg);
+    // Held by the test and by the guard of the event, not by every hop
+    refs = ctx->getPipelineShared().use_count() - 1;
+    owner.reset();
+  }
+
+  std::shared_ptr<Pipeline<int, int>> owner;
+  long refs{0};
+};
+
+TEST(Pipeline, DeletedMidEvent) {
+  auto pipeline = Pipeline<int, int>::create();
+  std::weak_ptr<Pipeline<int, int>> weak = pipeline;
+  auto deleting = std::make_shared<DeletingHandler>();
+  (*pipeline)
+    .addBack(ForwardingHandler())
+    .addBack(ForwardingHandler())
+    .addBack(deleting)
+    .finalize();
+  auto raw = pipeline.get();
+  deleting->owner = std::move(pipeline);
+
+  raw->read(42);
+  EXPECT_EQ(2, deleting->refs);
+  EXPECT_TRUE(weak.expired());
+}
+
+TEST(Pipeline, Instrumentation) {
+  auto pipeline = Pipeline<std::string, std::string>::create();
+  pipeline->setInstrumentation(2);
+  (*pipeline)
+    .addBack(StringHandler())
+    .addBack(StringHandler())
+    .finalize();
+
+  pipeline->read("abc");
+  pipeline->read("de");
+  pipeline->write("f");
+  pipeline->readEOF();
+
+  std::vector<HandlerStats> stats;
+  pipeline->getHandlerStats([&](const HandlerStats& s) {
+    stats.push_back(s);
+  });
+  ASSERT_EQ(2, stats.size());
+  for (auto& s : stats) {
+    EXPECT_EQ(3, s.inboundCalls);
+    EXPECT_EQ(1, s.outboundCalls);
+    EXPECT_EQ(3, s.messages);
+    EXPECT_EQ(6, s.bytes);
+    // One call in two is timed
+    EXPECT_EQ(2, s.sampledCalls);
+  }
+
+  // Disabling removes the links again
+  pipeline->setInstrumentation(0);
+  pipeline->finalize();
+  pipeline->read("abc");
+  size_t count = 0;
+  pipeline->getHandlerStats([&](const HandlerStats&) { count++; });
+  EXPECT_EQ(0, count);
+}
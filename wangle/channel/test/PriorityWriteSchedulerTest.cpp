@@ -0,0 +1,158 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/StaticPipeline.h>
+#include <wangle/channel/PriorityWriteScheduler.h>
+#include <wangle/channel/test/MockHandler.h>
+#include <folly/Conv.h>
+#include <folly/io/async/AsyncSocket.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+using namespace folly;
+using namespace wangle;
+using namespace testing;
+
+typedef StrictMock<MockHandlerAdapter<
+  IOBufQueue&,
+  std::unique_ptr<IOBuf>>>
+MockBytesHandler;
+
+typedef StaticPipeline<IOBufQueue&, StreamWrite,
+  MockBytesHandler,
+  PriorityWriteScheduler>
+SchedulerPipeline;
+
+MATCHER_P(IOBufContains, str, "") { return arg->moveToFbString() == str; }
+
+namespace {
+
+StreamWrite streamWrite(
+    uint32_t streamId,
+    const std::string& data,
+    uint8_t priority = 0,
+    uint16_t weight = 16) {
+  StreamWrite write;
+  write.streamId = streamId;
+  write.priority = priority;
+  write.weight = weight;
+  write.buf = IOBuf::copyBuffer(data);
+  return write;
+}
+
+PriorityWriteScheduler::Options chunkSize(uint64_t size) {
+  PriorityWriteScheduler::Options options;
+  options.chunkSize = size;
+  return options;
+}
+
+} // namespace
+
+TEST(PriorityWriteSchedulerTest, Interleave) {
+  MockBytesHandler mockHandler;
+  EXPECT_CALL(mockHandler, attachPipeline(_));
+  auto pipeline = SchedulerPipeline::create(
+      &mockHandler, PriorityWriteScheduler(chunkSize(4)));
+
+  EventBase eb;
+  auto socket = AsyncSocket::newSocket(&eb);
+  pipeline->setTransport(socket);
+
+  // The small write gets in after the first chunk of the large one
+  auto f1 = pipeline->write(streamWrite(1, std::string(12, 'a')));
+  auto f3 = pipeline->write(streamWrite(3, "bb"));
+  EXPECT_EQ(14, pipeline->getHandler<PriorityWriteScheduler>()
+      ->getQueuedBytes());
+  {
+    InSequence seq;
+    EXPECT_CALL(mockHandler, write_(_, IOBufContains("aaaa")));
+    EXPECT_CALL(mockHandler, write_(_, IOBufContains("bb")));
+    EXPECT_CALL(mockHandler, write_(_, IOBufContains("aaaa"))).Times(2);
+  }
+  EXPECT_FALSE(f1.isReady());
+  eb.loopOnce();
+  EXPECT_TRUE(f1.isReady());
+  EXPECT_TRUE(f3.isReady());
+  EXPECT_EQ(0, pipeline->getHandler<PriorityWriteScheduler>()
+      ->getNumStreams());
+  EXPECT_CALL(mockHandler, detachPipeline(_));
+}
+
+TEST(PriorityWriteSchedulerTest, PriorityAndWeight) {
+  MockBytesHandler mockHandler;
+  EXPECT_CALL(mockHandler, attachPipeline(_));
+  auto pipeline = SchedulerPipeline::create(
+      &mockHandler, PriorityWriteScheduler(chunkSize(4)));
+
+  EventBase eb;
+  auto socket = AsyncSocket::newSocket(&eb);
+  pipeline->setTransport(socket);
+
+  // Stream 1 gets twice stream 2's share, both after stream 5
+  pipeline->writeNoFuture(streamWrite(1, std::string(16, 'a'), 1, 32));
+  pipeline->writeNoFuture(streamWrite(2, std::string(16, 'b'), 1, 16));
+  pipeline->writeNoFuture(streamWrite(5, "c", 0));
+  {
+    InSequence seq;
+    EXPECT_CALL(mockHandler, write_(_, IOBufContains("c")));
+    EXPECT_CALL(mockHandler, write_(_, IOBufContains("aaaa")));
+    EXPECT_CALL(mockHandler, write_(_, IOBufContains("bbbb")));
+    EXPECT_CALL(mockHandler, write_(_, IOBufContains("aaaa"))).Times(2);
+    EXPECT_CALL(mockHandler, write_(_, IOBufContains("bbbb")));
+    EXPECT_CALL(mockHandler, write_(_, IOBufContains("aaaa")));
+    EXPECT_CALL(mockHandler, write_(_, IOBufContains("bbbb"))).Times(2);
+  }
+  eb.loopOnce();
+  EXPECT_CALL(mockHandler, detachPipeline(_));
+}
+
+TEST(PriorityWriteSchedulerTest, Writability) {
+  MockBytesHandler mockHandler;
+  EXPECT_CALL(mockHandler, attachPipeline(_));
+  auto options = chunkSize(2);
+  options.framer = [](uint32_t streamId,
+                      std::unique_ptr<IOBuf> chunk,
+                      bool last) {
+    auto frame = IOBuf::copyBuffer(
+        folly::to<std::string>(streamId, last ? "!" : ":"));
+    frame->prependChain(std::move(chunk));
+    return frame;
+  };
+  auto pipeline = SchedulerPipeline::create(
+      &mockHandler, PriorityWriteScheduler(std::move(options)));
+
+  EventBase eb;
+  auto socket = AsyncSocket::newSocket(&eb);
+  pipeline->setTransport(socket);
+
+  // Nothing goes out while the pipeline is unwritable
+  pipeline->setWritable(false);
+  auto f = pipeline->write(streamWrite(7, "xyz"));
+  eb.loopOnce();
+  EXPECT_FALSE(f.isReady());
+
+  pipeline->setWritable(true);
+  pipeline->getContext<MockBytesHandler>()->fireWritabilityChanged(true);
+  {
+    InSequence seq;
+    EXPECT_CALL(mockHandler, write_(_, IOBufContains("7:xy")));
+    EXPECT_CALL(mockHandler, write_(_, IOBufContains("7!z")));
+  }
+  eb.loopOnce();
+  EXPECT_TRUE(f.isReady());
+
+  // Pending writes fail on close
+  auto f2 = pipeline->write(streamWrite(7, "abc"));
+  EXPECT_CALL(mockHandler, close_(_));
+  pipeline->close();
+  EXPECT_TRUE(f2.hasException());
+  eb.loopOnce();
+  EXPECT_CALL(mockHandler, detachPipeline(_));
+}
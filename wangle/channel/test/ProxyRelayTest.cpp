@@ -0,0 +1,108 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <sys/socket.h>
+#include <folly/io/async/AsyncSocket.h>
+#include <folly/io/async/EventBase.h>
+#include <wangle/channel/ProxyRelay.h>
+
+using namespace folly;
+using namespace wangle;
+
+namespace {
+
+// A client and a server, each connected to a socket of the relay's
+class ProxyRelayTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    int fds[2];
+    ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    client_ = fds[0];
+    a_ = AsyncSocket::newSocket(&evb_, fds[1]);
+    ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    server_ = fds[0];
+    b_ = AsyncSocket::newSocket(&evb_, fds[1]);
+  }
+
+  void TearDown() override {
+    ::close(client_);
+    ::close(server_);
+  }
+
+  void send(int fd, const std::string& data) {
+    ASSERT_EQ(data.size(), ::write(fd, data.data(), data.size()));
+  }
+
+  // Everything up to EOF
+  std::string receive(int fd) {
+    std::string data;
+    char buf[4096];
+    ssize_t n;
+    while ((n = ::read(fd, buf, sizeof(buf))) > 0) {
+      data.append(buf, n);
+    }
+    return data;
+  }
+
+  // Relays a request and a response, each direction half closed after it
+  void relay(ProxyRelay::Options options, bool spliced) {
+    auto relay = std::make_shared<ProxyRelay>(a_, b_, options);
+    bool done = false;
+    relay->start().then([&] { done = true; });
+    EXPECT_EQ(spliced, relay->isSpliced());
+
+    send(client_, "request");
+    ::shutdown(client_, SHUT_WR);
+    while (relay->getBytesFromA() < 7) {
+      evb_.loopOnce();
+    }
+    send(server_, "response");
+    ::shutdown(server_, SHUT_WR);
+    while (!done) {
+      evb_.loopOnce();
+    }
+
+    EXPECT_EQ("request", receive(server_));
+    EXPECT_EQ("response", receive(client_));
+    EXPECT_EQ(8, relay->getBytesFromB());
+  }
+
+  EventBase evb_;
+  int client_;
+  int server_;
+  std::shared_ptr<AsyncSocket> a_;
+  std::shared_ptr<AsyncSocket> b_;
+};
+
+}
+
+#ifdef SPLICE_F_NONBLOCK
+TEST_F(ProxyRelayTest, Splice) {
+  relay(ProxyRelay::Options(), true);
+}
+#endif
+
+TEST_F(ProxyRelayTest, Buffered) {
+  ProxyRelay::Options options;
+  options.splice = false;
+  relay(options, false);
+}
+
+TEST_F(ProxyRelayTest, Stop) {
+  auto relay = std::make_shared<ProxyRelay>(a_, b_);
+  bool done = false;
+  relay->start().then([&] { done = true; });
+  relay->stop();
+  EXPECT_TRUE(done);
+  // The sockets are the caller's again
+  EXPECT_TRUE(a_->good());
+  EXPECT_EQ(nullptr, a_->getReadCallback());
+}
@@ -0,0 +1,123 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/StaticPipeline.h>
+#include <wangle/channel/RateLimitHandler.h>
+#include <wangle/channel/test/MockHandler.h>
+#include <folly/io/async/AsyncSocket.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+using namespace folly;
+using namespace wangle;
+using namespace testing;
+
+typedef StrictMock<MockHandlerAdapter<
+  IOBufQueue&,
+  std::unique_ptr<IOBuf>>>
+MockBytesHandler;
+
+MATCHER_P(IOBufContains, str, "") { return arg->moveToFbString() == str; }
+
+TEST(TokenBucketTest, Debt) {
+  TokenBucket bucket(1000, 100);
+  auto now = TokenBucket::Clock::now();
+  EXPECT_DOUBLE_EQ(1000, bucket.getRate());
+  EXPECT_DOUBLE_EQ(100, bucket.getAvailable(now));
+
+  // Emptying it leaves no debt, going over waits for the difference
+  EXPECT_EQ(TokenBucket::Clock::duration::zero(), bucket.consume(100, now));
+  EXPECT_EQ(std::chrono::milliseconds(50), bucket.consume(50, now));
+  EXPECT_EQ(std::chrono::milliseconds(50), bucket.getWait(now));
+  EXPECT_NEAR(-50, bucket.getAvailable(now), 1e-6);
+
+  // Refills at the rate, up to the burst
+  now += std::chrono::milliseconds(100);
+  EXPECT_NEAR(50, bucket.getAvailable(now), 1e-6);
+  now += std::chrono::seconds(10);
+  EXPECT_NEAR(100, bucket.getAvailable(now), 1e-6);
+  EXPECT_EQ(TokenBucket::Clock::duration::zero(), bucket.getWait(now));
+}
+
+TEST(RateLimitHandlerTest, QueuedWrites) {
+  MockBytesHandler mockHandler;
+  EXPECT_CALL(mockHandler, attachPipeline(_));
+  RateLimitHandler::Options options;
+  options.writeRate = 1000;
+  options.writeBurst = 100;
+  auto pipeline = StaticPipeline<IOBufQueue&, std::unique_ptr<IOBuf>,
+    MockBytesHandler,
+    RateLimitHandler>::create(
+      &mockHandler,
+      RateLimitHandler(options));
+
+  EventBase eb;
+  auto socket = AsyncSocket::newSocket(&eb);
+  pipeline->setTransport(socket);
+
+  // The burst goes through, and so does the write that puts it in debt
+  EXPECT_CALL(mockHandler, write_(_, IOBufContains(std::string(100, 'a'))));
+  EXPECT_CALL(mockHandler, write_(_, IOBufContains(std::string(20, 'b'))));
+  EXPECT_TRUE(pipeline->write(IOBuf::copyBuffer(std::string(100, 'a')))
+      .isReady());
+  EXPECT_TRUE(pipeline->write(IOBuf::copyBuffer(std::string(20, 'b')))
+      .isReady());
+
+  // Until it's out of debt, writes wait, in order
+  auto f1 = pipeline->write(IOBuf::copyBuffer("c"));
+  auto f2 = pipeline->write(IOBuf::copyBuffer("d"));
+  EXPECT_FALSE(f1.isReady());
+  EXPECT_FALSE(f2.isReady());
+  {
+    InSequence seq;
+    EXPECT_CALL(mockHandler, write_(_, IOBufContains("c")));
+    EXPECT_CALL(mockHandler, write_(_, IOBufContains("d")));
+  }
+  auto start = std::chrono::steady_clock::now();
+  while (!f2.isReady()) {
+    eb.loopOnce();
+  }
+  EXPECT_GE(std::chrono::steady_clock::now() - start,
+            std::chrono::milliseconds(15));
+  EXPECT_TRUE(f1.isReady());
+  EXPECT_EQ(2, pipeline->getHandler<RateLimitHandler>(1)->
+      getStats().queuedWrites);
+
+  EXPECT_CALL(mockHandler, detachPipeline(_));
+}
+
+TEST(RateLimitHandlerTest, CloseFailsQueuedWrites) {
+  MockBytesHandler mockHandler;
+  EXPECT_CALL(mockHandler, attachPipeline(_));
+  auto bucket = std::make_shared<TokenBucket>(1, 1);
+  RateLimitHandler::Options options;
+  options.sharedWriteBucket = bucket;
+  auto pipeline = StaticPipeline<IOBufQueue&, std::unique_ptr<IOBuf>,
+    MockBytesHandler,
+    RateLimitHandler>::create(
+      &mockHandler,
+      RateLimitHandler(options));
+
+  EventBase eb;
+  auto socket = AsyncSocket::newSocket(&eb);
+  pipeline->setTransport(socket);
+
+  // Shared buckets are enforced like the connection's own
+  bucket->consume(10);
+  auto f = pipeline->write(IOBuf::copyBuffer("hello"));
+  EXPECT_FALSE(f.isReady());
+
+  EXPECT_CALL(mockHandler, close_(_));
+  pipeline->close();
+  EXPECT_TRUE(f.isReady());
+  EXPECT_TRUE(f.hasException());
+
+  EXPECT_CALL(mockHandler, detachPipeline(_));
+}
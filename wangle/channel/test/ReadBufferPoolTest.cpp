@@ -0,0 +1,80 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <wangle/channel/HugePages.h>
+#include <wangle/channel/ReadBufferPool.h>
+
+#include <cstdlib>
+#include <thread>
+
+using namespace folly;
+using namespace wangle;
+
+TEST(ReadBufferPoolTest, ReusesBuffers) {
+  ReadBufferPool pool(1024);
+  auto buf = pool.get();
+  EXPECT_EQ(1024, buf->capacity());
+  EXPECT_EQ(0, buf->length());
+  auto data = buf->writableData();
+  buf.reset();
+  EXPECT_EQ(data, pool.get()->writableData());
+}
+
+TEST(ReadBufferPoolTest, ReturnsToHomeThread) {
+  ReadBufferPool pool(1024);
+  auto buf = pool.get();
+  auto data = buf->writableData();
+  std::thread([&] {
+    // Freed here, but cached for the main thread
+    buf.reset();
+    EXPECT_NE(data, pool.get()->writableData());
+  }).join();
+  EXPECT_EQ(data, pool.get()->writableData());
+}
+
+TEST(ReadBufferPoolTest, OutlivesPool) {
+  std::unique_ptr<IOBuf> buf;
+  std::unique_ptr<IOBuf> other;
+  {
+    ReadBufferPool pool(1024);
+    buf = pool.get();
+    std::thread([&] { other = pool.get(); }).join();
+  }
+  buf.reset();
+  other.reset();
+}
+
+TEST(ReadBufferPoolTest, HugePages) {
+  auto before = getHugePageStats();
+  {
+    ReadBufferPool pool(1024, 1, true);
+    EXPECT_TRUE(pool.usesHugePages());
+    // Carved from one region, whatever pages back it
+    auto first = pool.get();
+    auto second = pool.get();
+    EXPECT_EQ(1024, first->capacity());
+    auto distance = std::abs(second->writableData() - first->writableData());
+    EXPECT_LT(size_t(distance), kHugePageSize);
+    auto after = getHugePageStats();
+    EXPECT_EQ(before.explicitBytes + before.transparentBytes +
+                before.normalBytes + kHugePageSize,
+              after.explicitBytes + after.transparentBytes +
+                after.normalBytes);
+
+    // Cached beyond maxCachedPerThread, as they can't be freed
+    auto data = first->writableData();
+    first.reset();
+    second.reset();
+    auto again = pool.get();
+    auto more = pool.get();
+    EXPECT_TRUE(again->writableData() == data || more->writableData() == data);
+  }
+}
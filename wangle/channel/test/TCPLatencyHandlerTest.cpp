@@ -0,0 +1,116 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/StaticPipeline.h>
+#include <wangle/channel/TCPLatencyHandler.h>
+#include <wangle/channel/test/MockHandler.h>
+#include <folly/io/async/AsyncSocket.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+using namespace folly;
+using namespace wangle;
+using namespace testing;
+
+typedef StrictMock<MockHandlerAdapter<
+  IOBufQueue&,
+  std::unique_ptr<IOBuf>>>
+MockBytesHandler;
+
+// Consumes what it reads, as a decoder would
+class ConsumingHandler : public InboundBytesToBytesHandler {
+ public:
+  void read(Context* /* ctx */, IOBufQueue& q) override {
+    q.move();
+  }
+};
+
+typedef StaticPipeline<IOBufQueue&, std::unique_ptr<IOBuf>,
+  MockBytesHandler,
+  TCPLatencyHandler,
+  ConsumingHandler>
+LatencyPipeline;
+
+class TCPLatencyHandlerTest : public Test {
+ protected:
+  void SetUp() override {
+    EXPECT_CALL(mockHandler_, attachPipeline(_));
+    pipeline_ = LatencyPipeline::create(
+        &mockHandler_, TCPLatencyHandler(), ConsumingHandler());
+    pipeline_->setTransport(AsyncSocket::newSocket(&eb_));
+    handler_ = pipeline_->getHandler<TCPLatencyHandler>();
+  }
+
+  void TearDown() override {
+    EXPECT_CALL(mockHandler_, detachPipeline(_));
+    pipeline_.reset();
+  }
+
+  void read(size_t bytes) {
+    IOBufQueue q(IOBufQueue::cacheChainLength());
+    q.append(IOBuf::copyBuffer(std::string(bytes, 'r')));
+    pipeline_->getContext<MockBytesHandler>()->fireRead(q);
+  }
+
+  // The write flags the transport is written with
+  WriteFlags write(size_t bytes) {
+    auto flags = WriteFlags::NONE;
+    EXPECT_CALL(mockHandler_, write_(_, _))
+      .WillOnce(Invoke([&](MockBytesHandler::Context* ctx,
+                           std::unique_ptr<IOBuf>&) {
+        flags = ctx->getPipeline()->getWriteFlags();
+      }));
+    pipeline_->write(IOBuf::copyBuffer(std::string(bytes, 'w')));
+    return flags;
+  }
+
+  EventBase eb_;
+  MockBytesHandler mockHandler_;
+  std::shared_ptr<LatencyPipeline> pipeline_;
+  TCPLatencyHandler* handler_;
+};
+
+TEST_F(TCPLatencyHandlerTest, QuickAck) {
+  // A response in the same loop carries the ACK
+  read(100);
+  EXPECT_TRUE(handler_->isResponsePending());
+  EXPECT_EQ(WriteFlags::NONE, write(100));
+  EXPECT_FALSE(handler_->isResponsePending());
+  eb_.loopOnce();
+  EXPECT_EQ(0, handler_->getStats().quickAcks);
+
+  // A later one doesn't
+  read(100);
+  eb_.loopOnce();
+  EXPECT_EQ(1, handler_->getStats().quickAcks);
+  EXPECT_TRUE(handler_->isResponsePending());
+  EXPECT_EQ(WriteFlags::NONE, write(100));
+
+  // Nor is a bulk upload ACKed at once
+  read(100000);
+  eb_.loopOnce(EVLOOP_NONBLOCK);
+  EXPECT_EQ(1, handler_->getStats().quickAcks);
+}
+
+TEST_F(TCPLatencyHandlerTest, CorkNonResponses) {
+  // Streamed data is corked, and pushed out once per loop
+  EXPECT_EQ(WriteFlags::CORK, write(100));
+  EXPECT_EQ(WriteFlags::CORK, write(100));
+  EXPECT_EQ(WriteFlags::NONE, pipeline_->getWriteFlags());
+  EXPECT_EQ(2, handler_->getStats().corkedWrites);
+  eb_.loopOnce();
+  EXPECT_EQ(1, handler_->getStats().pushes);
+
+  // Responses aren't
+  read(10);
+  EXPECT_EQ(WriteFlags::NONE, write(100));
+  EXPECT_EQ(WriteFlags::CORK, write(100));
+  EXPECT_EQ(3, handler_->getStats().corkedWrites);
+}
@@ -0,0 +1,91 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/StaticPipeline.h>
+#include <wangle/channel/TLSRecordSizingHandler.h>
+#include <wangle/channel/test/MockHandler.h>
+#include <folly/io/async/AsyncSocket.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <thread>
+
+using namespace folly;
+using namespace wangle;
+using namespace testing;
+
+typedef NiceMock<MockHandlerAdapter<
+  IOBufQueue&,
+  std::unique_ptr<IOBuf>>>
+MockBytesHandler;
+
+TEST(TLSRecordSizingHandlerTest, RampsUpAfterBytes) {
+  MockBytesHandler mockHandler;
+  TLSRecordSizingHandler sizingHandler;
+  sizingHandler.setRecordSizes(1000, 16000);
+  sizingHandler.setRampBytes(3000);
+  sizingHandler.setRampTime(std::chrono::milliseconds(60000));
+  sizingHandler.setIdleReset(std::chrono::milliseconds(60000));
+  auto pipeline = StaticPipeline<IOBufQueue&, std::unique_ptr<IOBuf>,
+    MockBytesHandler,
+    TLSRecordSizingHandler>::create(
+      &mockHandler,
+      &sizingHandler);
+
+  EventBase eb;
+  auto socket = AsyncSocket::newSocket(&eb);
+  pipeline->setTransport(socket);
+
+  EXPECT_CALL(mockHandler, write_(_, _)).Times(3);
+  pipeline->writeNoFuture(IOBuf::copyBuffer(std::string(2500, 'x')));
+  EXPECT_FALSE(sizingHandler.isRampedUp());
+  // Crossing the threshold, still in small records
+  pipeline->writeNoFuture(IOBuf::copyBuffer(std::string(1000, 'x')));
+  EXPECT_TRUE(sizingHandler.isRampedUp());
+  pipeline->writeNoFuture(IOBuf::copyBuffer(std::string(20000, 'x')));
+  EXPECT_TRUE(sizingHandler.isRampedUp());
+
+  auto& stats = sizingHandler.getStats();
+  EXPECT_EQ(4u, stats.smallRecords);
+  EXPECT_EQ(3500u, stats.smallRecordBytes);
+  EXPECT_EQ(2u, stats.largeRecords);
+  EXPECT_EQ(20000u, stats.largeRecordBytes);
+  EXPECT_EQ(0u, stats.idleResets);
+}
+
+TEST(TLSRecordSizingHandlerTest, IdleResets) {
+  MockBytesHandler mockHandler;
+  TLSRecordSizingHandler sizingHandler;
+  sizingHandler.setRampBytes(0);
+  sizingHandler.setIdleReset(std::chrono::milliseconds(10));
+  auto pipeline = StaticPipeline<IOBufQueue&, std::unique_ptr<IOBuf>,
+    MockBytesHandler,
+    TLSRecordSizingHandler>::create(
+      &mockHandler,
+      &sizingHandler);
+
+  EventBase eb;
+  auto socket = AsyncSocket::newSocket(&eb);
+  pipeline->setTransport(socket);
+
+  EXPECT_CALL(mockHandler, write_(_, _)).Times(3);
+  auto& stats = sizingHandler.getStats();
+  // The first write of a burst is always small
+  pipeline->writeNoFuture(IOBuf::copyBuffer("a"));
+  EXPECT_EQ(1u, stats.smallRecords);
+  pipeline->writeNoFuture(IOBuf::copyBuffer("b"));
+  EXPECT_EQ(1u, stats.largeRecords);
+  /* sleep override */
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  pipeline->writeNoFuture(IOBuf::copyBuffer("c"));
+  EXPECT_EQ(2u, stats.smallRecords);
+  EXPECT_EQ(1u, stats.largeRecords);
+  EXPECT_EQ(1u, stats.idleResets);
+}
@@ -0,0 +1,111 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/TrafficCapture.h>
+#include <wangle/channel/TrafficReplay.h>
+#include <wangle/codec/LineBasedFrameDecoder.h>
+
+#include <folly/experimental/TestUtil.h>
+#include <gtest/gtest.h>
+
+using namespace folly;
+using namespace wangle;
+
+namespace {
+
+// Takes what it's given, nothing more, like a decoder waiting for the rest
+class PartialConsumer : public BytesToBytesHandler {
+ public:
+  void read(Context* /*ctx*/, IOBufQueue& q) override {
+    q.trimStart(std::min<size_t>(q.chainLength(), 2));
+  }
+};
+
+class EchoHandler : public HandlerAdapter<std::unique_ptr<IOBuf>> {
+ public:
+  void read(Context* ctx, std::unique_ptr<IOBuf> line) override {
+    write(ctx, std::move(line));
+  }
+};
+
+class EchoPipelineFactory : public PipelineFactory<DefaultPipeline> {
+ public:
+  DefaultPipeline::Ptr newPipeline(
+      std::shared_ptr<AsyncTransportWrapper> /*sock*/) override {
+    auto pipeline = DefaultPipeline::create();
+    pipeline->addBack(LineBasedFrameDecoder(1024, false));
+    pipeline->addBack(EchoHandler());
+    pipeline->finalize();
+    return pipeline;
+  }
+};
+
+} // namespace
+
+TEST(TrafficCaptureTest, CaptureAndRead) {
+  test::TemporaryDirectory tmpdir;
+  auto path = tmpdir.path().string() + "/capture";
+  auto capture = std::make_shared<TrafficCapture>(path, 2);
+
+  // Every other connection is captured
+  for (int i = 0; i < 3; i++) {
+    auto pipeline = DefaultPipeline::create();
+    pipeline->addBack(TrafficCaptureHandler(capture));
+    pipeline->addBack(PartialConsumer());
+    pipeline->finalize();
+    pipeline->transportActive();
+
+    // Only the bytes new to the queue are recorded
+    IOBufQueue q(IOBufQueue::cacheChainLength());
+    q.append(IOBuf::copyBuffer("abcd"));
+    pipeline->read(q);
+    q.append(IOBuf::copyBuffer("ef"));
+    pipeline->read(q);
+    if (i < 2) {
+      pipeline->readEOF();
+    }
+  }
+  capture.reset();
+
+  auto sessions = TrafficCapture::read(path);
+  ASSERT_EQ(2, sessions.size());
+  EXPECT_TRUE(sessions[0].closed);
+  ASSERT_EQ(2, sessions[0].chunks.size());
+  EXPECT_EQ("abcd", sessions[0].chunks[0].data);
+  EXPECT_EQ("ef", sessions[0].chunks[1].data);
+  EXPECT_LE(sessions[0].chunks[0].offset, sessions[0].chunks[1].offset);
+  // Destroying the pipeline closes the session too
+  EXPECT_TRUE(sessions[1].closed);
+  EXPECT_EQ(2, sessions[1].chunks.size());
+}
+
+TEST(TrafficCaptureTest, Replay) {
+  CapturedSession session;
+  for (auto data : {"hello\nwor", "ld\n", "partial"}) {
+    CapturedChunk chunk;
+    chunk.data = data;
+    session.chunks.push_back(std::move(chunk));
+  }
+  session.closed = true;
+  TrafficReplay replay({session, session});
+
+  EchoPipelineFactory factory;
+  auto stats = replay.run(factory);
+  EXPECT_EQ(2, stats.sessions);
+  EXPECT_EQ(6, stats.chunks);
+  EXPECT_EQ(2 * 19, stats.bytesRead);
+  EXPECT_EQ(2 * 12, stats.bytesWritten);
+
+  // The replay's transport, then the factory's handlers
+  ASSERT_EQ(3, stats.handlers.size());
+  EXPECT_EQ(6, stats.handlers[1].messages);
+  EXPECT_EQ(4, stats.handlers[2].messages);
+  EXPECT_EQ(4, stats.handlers[0].outboundCalls);
+}
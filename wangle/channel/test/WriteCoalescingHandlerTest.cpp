@@ -0,0 +1,148 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/channel/StaticPipeline.h>
+#include <wangle/channel/WriteCoalescingHandler.h>
+#include <wangle/channel/test/MockHandler.h>
+#include <folly/io/async/AsyncSocket.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+using namespace folly;
+using namespace wangle;
+using namespace testing;
+
+typedef StrictMock<MockHandlerAdapter<
+  IOBufQueue&,
+  std::unique_ptr<IOBuf>>>
+MockBytesHandler;
+
+MATCHER_P(IOBufContains, str, "") { return arg->moveToFbString() == str; }
+MATCHER_P(IOBufSegments, n, "") { return arg->countChainElements() == n; }
+
+TEST(WriteCoalescingHandlerTest, CopiesSmallWrites) {
+  MockBytesHandler mockHandler;
+  EXPECT_CALL(mockHandler, attachPipeline(_));
+  WriteCoalescingHandler coalescingHandler;
+  coalescingHandler.setCopyThreshold(8);
+  auto pipeline = StaticPipeline<IOBufQueue&, std::unique_ptr<IOBuf>,
+    MockBytesHandler,
+    WriteCoalescingHandler>::create(
+      &mockHandler,
+      &coalescingHandler);
+
+  EventBase eb;
+  auto socket = AsyncSocket::newSocket(&eb);
+  pipeline->setTransport(socket);
+
+  // Small buffers around a large one end up in two copies and one reference
+  auto header = IOBuf::copyBuffer("hdr");
+  header->prependChain(IOBuf::copyBuffer("len"));
+  auto f1 = pipeline->write(std::move(header));
+  auto f2 = pipeline->write(IOBuf::copyBuffer("large payload"));
+  pipeline->writeNoFuture(IOBuf::copyBuffer("a"));
+  pipeline->writeNoFuture(IOBuf::copyBuffer("b"));
+  EXPECT_FALSE(f1.isReady());
+  EXPECT_FALSE(f2.isReady());
+  EXPECT_CALL(mockHandler, write_(_, IOBufSegments(3)))
+    .WillOnce(Invoke([](MockBytesHandler::Context*,
+                        std::unique_ptr<IOBuf>& buf) {
+      EXPECT_EQ("hdrlenlarge payloadab", buf->moveToFbString());
+    }));
+  eb.loopOnce();
+  EXPECT_TRUE(f1.isReady());
+  EXPECT_TRUE(f2.isReady());
+
+  // The next batch reuses the same block
+  pipeline->write(IOBuf::copyBuffer("foo"));
+  EXPECT_CALL(mockHandler, write_(_, IOBufContains("foo")));
+  eb.loopOnce();
+  EXPECT_CALL(mockHandler, detachPipeline(_));
+}
+
+TEST(WriteCoalescingHandlerTest, BlockFull) {
+  MockBytesHandler mockHandler;
+  EXPECT_CALL(mockHandler, attachPipeline(_));
+  WriteCoalescingHandler coalescingHandler;
+  coalescingHandler.setBlockSize(4);
+  auto pipeline = StaticPipeline<IOBufQueue&, std::unique_ptr<IOBuf>,
+    MockBytesHandler,
+    WriteCoalescingHandler>::create(
+      &mockHandler,
+      &coalescingHandler);
+
+  EventBase eb;
+  auto socket = AsyncSocket::newSocket(&eb);
+  pipeline->setTransport(socket);
+
+  // Each copy that does not fit starts a new block
+  pipeline->writeNoFuture(IOBuf::copyBuffer("abc"));
+  pipeline->writeNoFuture(IOBuf::copyBuffer("de"));
+  pipeline->writeNoFuture(IOBuf::copyBuffer("fghij"));
+  EXPECT_CALL(mockHandler, write_(_, IOBufSegments(3)))
+    .WillOnce(Invoke([](MockBytesHandler::Context*,
+                        std::unique_ptr<IOBuf>& buf) {
+      EXPECT_EQ("abcdefghij", buf->moveToFbString());
+    }));
+  eb.loopOnce();
+  EXPECT_CALL(mockHandler, detachPipeline(_));
+}
+
+TEST(WriteCoalescingHandlerTest, FlushOnMaxSegments) {
+  MockBytesHandler mockHandler;
+  EXPECT_CALL(mockHandler, attachPipeline(_));
+  WriteCoalescingHandler coalescingHandler;
+  coalescingHandler.setCopyThreshold(2);
+  coalescingHandler.setMaxSegments(3);
+  auto pipeline = StaticPipeline<IOBufQueue&, std::unique_ptr<IOBuf>,
+    MockBytesHandler,
+    WriteCoalescingHandler>::create(
+      &mockHandler,
+      &coalescingHandler);
+
+  EventBase eb;
+  auto socket = AsyncSocket::newSocket(&eb);
+  pipeline->setTransport(socket);
+
+  // Consecutive copies count as a single segment
+  pipeline->write(IOBuf::copyBuffer("a"));
+  pipeline->write(IOBuf::copyBuffer("b"));
+  pipeline->write(IOBuf::copyBuffer("large"));
+  EXPECT_CALL(mockHandler, write_(_, IOBufContains("ablargemore")));
+  pipeline->write(IOBuf::copyBuffer("more"));
+  Mock::VerifyAndClearExpectations(&mockHandler);
+
+  // Nothing left for the loop callback
+  eb.loopOnce();
+  EXPECT_CALL(mockHandler, detachPipeline(_));
+}
+
+TEST(WriteCoalescingHandlerTest, Close) {
+  MockBytesHandler mockHandler;
+  EXPECT_CALL(mockHandler, attachPipeline(_));
+  auto pipeline = StaticPipeline<IOBufQueue&, std::unique_ptr<IOBuf>,
+    MockBytesHandler,
+    WriteCoalescingHandler>::create(
+      &mockHandler,
+      WriteCoalescingHandler());
+
+  EventBase eb;
+  auto socket = AsyncSocket::newSocket(&eb);
+  pipeline->setTransport(socket);
+
+  auto f = pipeline->write(IOBuf::copyBuffer("hello"));
+  EXPECT_CALL(mockHandler, close_(_));
+  pipeline->close();
+  EXPECT_TRUE(f.hasException());
+
+  // Nothing is written once closed
+  eb.loopOnce();
+  EXPECT_CALL(mockHandler, detachPipeline(_));
+}
@@ -0,0 +1,196 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include <folly/DynamicConverter.h>
+#include <folly/Range.h>
+#include <folly/json.h>
+
+namespace wangle {
+
+/**
+ * How a key or value is written in a binary cache log: as is for strings,
+ * in host byte order for arithmetic types, and as the JSON of its
+ * toDynamic() otherwise. Specialize it for other types stored often.
+ */
+template<typename T, typename Enable = void>
+struct BinaryCacheCodec {
+  static void encode(const T& item, std::string& out) {
+    folly::json::serialization_opts opts;
+    opts.allow_non_string_keys = true;
+    out.append(folly::json::serialize(folly::toDynamic(item), opts)
+                 .toStdString());
+  }
+
+  static T decode(folly::ByteRange in) {
+    folly::json::serialization_opts opts;
+    opts.allow_non_string_keys = true;
+    return folly::convertTo<T>(folly::parseJson(
+      folly::StringPiece(reinterpret_cast<const char*>(in.data()), in.size()),
+      opts));
+  }
+};
+
+template<>
+struct BinaryCacheCodec<std::string> {
+  static void encode(const std::string& item, std::string& out) {
+    out.append(item);
+  }
+
+  static std::string decode(folly::ByteRange in) {
+    return std::string(reinterpret_cast<const char*>(in.data()), in.size());
+  }
+};
+
+template<typename T>
+struct BinaryCacheCodec<
+    T, typename std::enable_if<std::is_arithmetic<T>::value>::type> {
+  static void encode(const T& item, std::string& out) {
+    out.append(reinterpret_cast<const char*>(&item), sizeof(item));
+  }
+
+  static T decode(folly::ByteRange in) {
+    if (in.size() != sizeof(T)) {
+      throw std::out_of_range("bad size for an arithmetic type");
+    }
+    T item;
+    memcpy(&item, in.data(), sizeof(item));
+    return item;
+  }
+};
+
+/**
+ * The encoding of the records of a binary cache log. A log is a header,
+ * then records, each a type byte followed by the key and, for puts, the
+ * value, each preceded by its length as a uint32 in host byte order.
+ *
+ * A snapshot is a log of puts only, from the least recently used entry
+ * on, so that replaying it rebuilds the LRU order as well.
+ */
+class BinaryCacheLog {
+ public:
+  enum class RecordType : uint8_t {
+    PUT = 1,
+    REMOVE = 2,
+    CLEAR = 3,
+  };
+
+  static folly::StringPiece header() {
+    return folly::StringPiece("WCLOG001", 8);
+  }
+
+  static bool hasHeader(folly::ByteRange data) {
+    auto h = header();
+    return data.size() >= h.size() &&
+      memcmp(data.data(), h.data(), h.size()) == 0;
+  }
+
+  template<typename K, typename V>
+  static void appendPut(const K& key, const V& val, std::string& out) {
+    out.push_back(static_cast<char>(RecordType::PUT));
+    appendItem(key, out);
+    appendItem(val, out);
+  }
+
+  template<typename K>
+  static void appendRemove(const K& key, std::string& out) {
+    out.push_back(static_cast<char>(RecordType::REMOVE));
+    appendItem(key, out);
+  }
+
+  static void appendClear(std::string& out) {
+    out.push_back(static_cast<char>(RecordType::CLEAR));
+  }
+
+  /**
+   * Calls onPut(K, V), onRemove(K) and onClear() for each record of the
+   * log, in order, stopping at a truncated or unknown record, such as the
+   * tail an interrupted append leaves. Throws what the codecs throw.
+   *
+   * @param nRecords set to the number of records read
+   * @returns boolean, true if the whole log was read, false otherwise
+   */
+  template<typename K, typename V,
+           typename PutFn, typename RemoveFn, typename ClearFn>
+  static bool replay(folly::ByteRange data,
+                     PutFn&& onPut,
+                     RemoveFn&& onRemove,
+                     ClearFn&& onClear,
+                     size_t* nRecords) {
+    *nRecords = 0;
+    if (!hasHeader(data)) {
+      return false;
+    }
+    data.advance(header().size());
+    while (!data.empty()) {
+      auto type = static_cast<RecordType>(data[0]);
+      auto record = data.subpiece(1);
+      folly::ByteRange key;
+      folly::ByteRange val;
+      switch (type) {
+        case RecordType::PUT:
+          if (!readItem(record, key) || !readItem(record, val)) {
+            return false;
+          }
+          onPut(BinaryCacheCodec<K>::decode(key),
+                BinaryCacheCodec<V>::decode(val));
+          break;
+        case RecordType::REMOVE:
+          if (!readItem(record, key)) {
+            return false;
+          }
+          onRemove(BinaryCacheCodec<K>::decode(key));
+          break;
+        case RecordType::CLEAR:
+          onClear();
+          break;
+        default:
+          return false;
+      }
+      data = record;
+      ++*nRecords;
+    }
+    return true;
+  }
+
+ private:
+  template<typename T>
+  static void appendItem(const T& item, std::string& out) {
+    auto lengthAt = out.size();
+    uint32_t length = 0;
+    out.append(reinterpret_cast<const char*>(&length), sizeof(length));
+    BinaryCacheCodec<T>::encode(item, out);
+    length = static_cast<uint32_t>(out.size() - lengthAt - sizeof(length));
+    memcpy(&out[lengthAt], &length, sizeof(length));
+  }
+
+  static bool readItem(folly::ByteRange& data, folly::ByteRange& item) {
+    uint32_t length;
+    if (data.size() < sizeof(length)) {
+      return false;
+    }
+    memcpy(&length, data.data(), sizeof(length));
+    data.advance(sizeof(length));
+    if (data.size() < length) {
+      return false;
+    }
+    item = data.subpiece(0, length);
+    data.advance(length);
+    return true;
+  }
+};
+
+}
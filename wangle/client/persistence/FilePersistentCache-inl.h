@@ -13,33 +13,100 @@
 #include <folly/DynamicConverter.h>
 #include <folly/FileUtil.h>
 #include <folly/json.h>
+#include <folly/Memory.h>
+#include <folly/MemoryMapping.h>
 #include <folly/ScopeGuard.h>
+#include <algorithm>
+#include <cstdio>
 #include <functional>
+#include <iterator>
 #include <sys/time.h>
+#include <unistd.h>
 
 namespace wangle {
 
+template<typename K, typename V, typename MutexT>
+constexpr size_t FilePersistentCache<K, V, MutexT>::kMinCompactionRecords;
+
+template<typename K, typename V, typename MutexT>
+constexpr size_t FilePersistentCache<K, V, MutexT>::kCompactionRatio;
+
 template<typename K, typename V, typename MutexT>
 FilePersistentCache<K, V, MutexT>::FilePersistentCache(const std::string& file,
     const std::size_t cacheCapacity,
     const std::chrono::seconds& syncInterval,
-    const int nSyncRetries):
+    const int nSyncRetries,
+    const PersistentCacheFormat format,
+    const std::size_t nShards,
+    std::shared_ptr<PersistentCacheSyncer> syncer):
   file_(file),
-  cache_(cacheCapacity),
-  pendingUpdates_(0),
+  shards_(makeShards(cacheCapacity, nShards)),
+  format_(format),
   stopSyncer_(false),
   syncInterval_(syncInterval),
   nSyncRetries_(nSyncRetries),
   nSyncFailures_(0),
-  syncer_(&FilePersistentCache<K, V, MutexT>::syncThreadMain, this) {
+  sharedSyncer_(std::move(syncer)) {
 
   // load the cache. be silent if load fails, we just drop the cache
   // and start from scratch.
   load();
+
+  if (sharedSyncer_) {
+    syncTask_ = sharedSyncer_->add([this] { syncOrGiveUp(); }, syncInterval_);
+  } else {
+    syncer_ = std::thread(
+      &FilePersistentCache<K, V, MutexT>::syncThreadMain, this);
+  }
+}
+
+template<typename K, typename V, typename MutexT>
+std::vector<std::unique_ptr<
+  typename FilePersistentCache<K, V, MutexT>::Shard>>
+FilePersistentCache<K, V, MutexT>::makeShards(
+    const std::size_t cacheCapacity,
+    const std::size_t nShards) {
+  const auto n = std::max<std::size_t>(nShards, 1);
+  std::vector<std::unique_ptr<Shard>> shards;
+  for (std::size_t i = 0; i < n; ++i) {
+    // each with an even part of the capacity, rounded up
+    shards.emplace_back(folly::make_unique<Shard>((cacheCapacity + n - 1) / n));
+  }
+  return shards;
+}
+
+template<typename K, typename V, typename MutexT>
+typename FilePersistentCache<K, V, MutexT>::Shard&
+FilePersistentCache<K, V, MutexT>::shardFor(const K& key) {
+  if (shards_.size() == 1) {
+    return *shards_[0];
+  }
+  // std::hash is the identity for integers, so mix it before taking a
+  // remainder
+  auto hash = folly::hash::twang_mix64(std::hash<K>()(key));
+  return *shards_[hash % shards_.size()];
+}
+
+template<typename K, typename V, typename MutexT>
+unsigned long FilePersistentCache<K, V, MutexT>::pendingUpdates() {
+  unsigned long nPending = 0;
+  for (auto& shard : shards_) {
+    typename wangle::CacheLockGuard<MutexT>::Read readLock(shard->lock);
+    nPending += shard->pendingUpdates;
+  }
+  return nPending;
 }
 
 template<typename K, typename V, typename MutexT>
 FilePersistentCache<K, V, MutexT>::~FilePersistentCache() {
+  if (sharedSyncer_) {
+    sharedSyncer_->remove(syncTask_);
+    while (pendingUpdates() > 0) {
+      syncOrGiveUp();
+    }
+    return;
+  }
+
   {
     // tell syncer to wake up and quit
     std::lock_guard<std::mutex> lock(stopSyncerMutex_);
@@ -53,10 +120,11 @@ FilePersistentCache<K, V, MutexT>::~FilePersistentCache() {
 
 template<typename K, typename V, typename MutexT>
 folly::Optional<V> FilePersistentCache<K, V, MutexT>::get(const K& key) {
-  typename wangle::CacheLockGuard<MutexT>::Write writeLock(cacheLock_);
+  auto& shard = shardFor(key);
+  typename wangle::CacheLockGuard<MutexT>::Write writeLock(shard.lock);
 
-  auto itr = cache_.find(key);
-  if (itr != cache_.end()) {
+  auto itr = shard.cache.find(key);
+  if (itr != shard.cache.end()) {
     return folly::Optional<V>(itr->second);
   }
   return folly::Optional<V>();
@@ -64,19 +132,29 @@ folly::Optional<V> FilePersistentCache<K, V, MutexT>::get(const K& key) {
 
 template<typename K, typename V, typename MutexT>
 void FilePersistentCache<K, V, MutexT>::put(const K& key, const V& val) {
-  typename wangle::CacheLockGuard<MutexT>::Write writeLock(cacheLock_);
-
-  cache_.set(key, val);
-  ++pendingUpdates_;
+  auto& shard = shardFor(key);
+  typename wangle::CacheLockGuard<MutexT>::Write writeLock(shard.lock);
+
+  shard.cache.set(key, val);
+  ++shard.pendingUpdates;
+  if (format_ == PersistentCacheFormat::BINARY_LOG) {
+    shard.pendingRecords.push_back(
+      LogRecord{BinaryCacheLog::RecordType::PUT, key, val});
+  }
 }
 
 template<typename K, typename V, typename MutexT>
 bool FilePersistentCache<K, V, MutexT>::remove(const K& key) {
-  typename wangle::CacheLockGuard<MutexT>::Write writeLock(cacheLock_);
+  auto& shard = shardFor(key);
+  typename wangle::CacheLockGuard<MutexT>::Write writeLock(shard.lock);
 
-  size_t nErased = cache_.erase(key);
+  size_t nErased = shard.cache.erase(key);
   if (nErased > 0) {
-    ++pendingUpdates_;
+    ++shard.pendingUpdates;
+    if (format_ == PersistentCacheFormat::BINARY_LOG) {
+      shard.pendingRecords.push_back(
+        LogRecord{BinaryCacheLog::RecordType::REMOVE, key, folly::none});
+    }
     return true;
   }
   return false;
@@ -96,26 +174,11 @@ void FilePersistentCache<K, V, MutexT>::sync() {
   std::unique_lock<std::mutex> stopSyncerLock(stopSyncerMutex_);
 
   while (true) {
-    if (stopSyncer_) {
-      typename wangle::CacheLockGuard<MutexT>::Read readLock(cacheLock_);
-      if (pendingUpdates_ == 0) {
-        break;
-      }
+    if (stopSyncer_ && pendingUpdates() == 0) {
+      break;
     }
 
-    if (!syncNow()) {
-      LOG(ERROR) << "Persisting to cache failed " << nSyncFailures_ << " times";
-      // track failures and give up if we tried too many times
-      ++nSyncFailures_;
-      if (nSyncFailures_ == nSyncRetries_) {
-        LOG(ERROR) << "Giving up after " << nSyncFailures_ << " failures";
-        typename wangle::CacheLockGuard<MutexT>::Write writeLock(cacheLock_);
-        pendingUpdates_ = 0;
-        nSyncFailures_ = 0;
-      }
-    } else {
-      nSyncFailures_ = 0;
-    }
+    syncOrGiveUp();
 
     if (!stopSyncer_) {
       stopSyncerCV_.wait_for(stopSyncerLock, syncInterval_);
@@ -123,23 +186,55 @@ void FilePersistentCache<K, V, MutexT>::sync() {
   }
 }
 
+template<typename K, typename V, typename MutexT>
+void FilePersistentCache<K, V, MutexT>::syncOrGiveUp() {
+  if (!syncNow()) {
+    LOG(ERROR) << "Persisting to cache failed " << nSyncFailures_ << " times";
+    // track failures and give up if we tried too many times
+    ++nSyncFailures_;
+    if (nSyncFailures_ >= nSyncRetries_) {
+      LOG(ERROR) << "Giving up after " << nSyncFailures_ << " failures";
+      for (auto& shard : shards_) {
+        typename wangle::CacheLockGuard<MutexT>::Write writeLock(shard->lock);
+        shard->pendingUpdates = 0;
+        shard->pendingRecords.clear();
+      }
+      nSyncFailures_ = 0;
+    }
+  } else {
+    nSyncFailures_ = 0;
+  }
+}
+
 template<typename K, typename V, typename MutexT>
 bool FilePersistentCache<K, V, MutexT>::syncNow() {
-  folly::Optional<std::string> serializedCache;
-  unsigned long queuedUpdates = 0;
-  // serialize the current contents of cache under lock
-  {
-    typename wangle::CacheLockGuard<MutexT>::Read readLock(cacheLock_);
+  if (format_ == PersistentCacheFormat::BINARY_LOG) {
+    return syncLog();
+  }
 
-    if (pendingUpdates_ == 0) {
-      return true;
-    }
-    serializedCache = serializeCache();
-    if (!serializedCache.hasValue()) {
-      LOG(ERROR) << "Failed to serialize cache";
-      return false;
+  if (pendingUpdates() == 0) {
+    return true;
+  }
+
+  std::vector<std::pair<K, V>> entries;
+  std::vector<unsigned long> queuedUpdates;
+  unsigned long nQueued = 0;
+  // copy the current contents of the cache under lock, and serialize
+  // the copy once the lock is released
+  for (auto& shard : shards_) {
+    typename wangle::CacheLockGuard<MutexT>::Read readLock(shard->lock);
+
+    queuedUpdates.push_back(shard->pendingUpdates);
+    nQueued += shard->pendingUpdates;
+    for (const auto& kv : shard->cache) {
+      entries.emplace_back(kv.first, kv.second);
     }
-    queuedUpdates = pendingUpdates_;
+  }
+
+  folly::Optional<std::string> serializedCache = serializeCache(entries);
+  if (!serializedCache.hasValue()) {
+    LOG(ERROR) << "Failed to serialize cache";
+    return false;
   }
 
   // do the actual file write
@@ -147,24 +242,123 @@ bool FilePersistentCache<K, V, MutexT>::syncNow() {
 
   // if we succeeded in peristing, update pending update count
   if (persisted) {
-    typename wangle::CacheLockGuard<MutexT>::Write writeLock(cacheLock_);
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      auto& shard = *shards_[i];
+      typename wangle::CacheLockGuard<MutexT>::Write writeLock(shard.lock);
 
-    pendingUpdates_ -= queuedUpdates;
-    DCHECK(pendingUpdates_ >= 0);
+      shard.pendingUpdates -= queuedUpdates[i];
+    }
   } else {
-    LOG(ERROR) << "Failed to persist " << queuedUpdates << " updates";
+    LOG(ERROR) << "Failed to persist " << nQueued << " updates";
   }
 
   return persisted;
 }
 
-// serializes the cache_, must be called under lock
+template<typename K, typename V, typename MutexT>
+bool FilePersistentCache<K, V, MutexT>::syncLog() {
+  std::lock_guard<std::mutex> logGuard(logLock_);
+
+  unsigned long nQueued = 0;
+  size_t nRecords = 0;
+  size_t nEntries = 0;
+  bool compact = compactLog_;
+  for (auto& shard : shards_) {
+    typename wangle::CacheLockGuard<MutexT>::Read readLock(shard->lock);
+
+    nQueued += shard->pendingUpdates;
+    nRecords += shard->pendingRecords.size();
+    nEntries += shard->cache.size();
+    compact = compact || shard->cleared;
+  }
+  if (nQueued == 0) {
+    return true;
+  }
+  compact = compact || logRecords_ + nRecords > std::max(
+    kMinCompactionRecords, kCompactionRatio * nEntries);
+
+  std::vector<LogRecord> records;
+  std::vector<std::pair<K, V>> entries;
+  std::vector<unsigned long> queuedUpdates;
+  // take the changes, or a copy of the cache to compact to, under each
+  // shard's lock in turn. Keys don't move between shards, so the order of
+  // the shards doesn't matter.
+  for (auto& shard : shards_) {
+    typename wangle::CacheLockGuard<MutexT>::Write writeLock(shard->lock);
+
+    queuedUpdates.push_back(shard->pendingUpdates);
+    if (compact) {
+      // least recently used first, for load to rebuild the LRU order
+      for (auto itr = shard->cache.rbegin(); itr != shard->cache.rend();
+           ++itr) {
+        entries.emplace_back(itr->first, itr->second);
+      }
+      shard->cleared = false;
+    } else {
+      records.insert(records.end(),
+                     std::make_move_iterator(shard->pendingRecords.begin()),
+                     std::make_move_iterator(shard->pendingRecords.end()));
+    }
+    // in the snapshot, or in records, now
+    shard->pendingRecords.clear();
+  }
+  // until this sync succeeds, the records taken are in neither the log
+  // nor the shards
+  compactLog_ = true;
+
+  bool persisted = false;
+  try {
+    std::string serialized;
+    if (compact) {
+      serialized.append(BinaryCacheLog::header().str());
+      for (const auto& kv : entries) {
+        BinaryCacheLog::appendPut(kv.first, kv.second, serialized);
+      }
+      persisted = persistAtomically(std::move(serialized));
+    } else {
+      for (const auto& record : records) {
+        switch (record.type) {
+          case BinaryCacheLog::RecordType::PUT:
+            BinaryCacheLog::appendPut(record.key, *record.val, serialized);
+            break;
+          case BinaryCacheLog::RecordType::REMOVE:
+            BinaryCacheLog::appendRemove(record.key, serialized);
+            break;
+          case BinaryCacheLog::RecordType::CLEAR:
+            BinaryCacheLog::appendClear(serialized);
+            break;
+        }
+      }
+      persisted = append(serialized);
+    }
+  } catch (const std::exception& err) {
+    LOG(ERROR) << "Serialization of cache failed with error: " << err.what();
+  }
+
+  if (persisted) {
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      auto& shard = *shards_[i];
+      typename wangle::CacheLockGuard<MutexT>::Write writeLock(shard.lock);
+
+      shard.pendingUpdates -= queuedUpdates[i];
+    }
+    logRecords_ = compact ? entries.size() : logRecords_ + records.size();
+    compactLog_ = false;
+  } else {
+    LOG(ERROR) << "Failed to persist " << nQueued << " updates";
+  }
+
+  return persisted;
+}
+
+// serializes a copy of the cache's entries, without holding any lock
 template<typename K, typename V, typename MutexT>
 folly::Optional<std::string>
-FilePersistentCache<K, V, MutexT>::serializeCache() {
+FilePersistentCache<K, V, MutexT>::serializeCache(
+    const std::vector<std::pair<K, V>>& entries) {
   try {
     folly::dynamic dynObj = folly::dynamic::array;
-    for (const auto& kv : cache_) {
+    for (const auto& kv : entries) {
       dynObj.push_back(folly::toDynamic(std::make_pair(kv.first, kv.second)));
     }
     folly::json::serialization_opts opts;
@@ -191,23 +385,21 @@ bool FilePersistentCache<K, V, MutexT>::deserializeCache(
     LOG(ERROR) << "Deserialization of cache failed with parse error: "
                 << err.what();
 
-    // If parsing fails we haven't taken the lock yet so do so here.
-    typename wangle::CacheLockGuard<MutexT>::Write writeLock(cacheLock_);
-
-    cache_.clear();
+    clearShards();
     return false;
   }
 
   bool error = true;
   DCHECK(cacheFromString);
-  typename wangle::CacheLockGuard<MutexT>::Write writeLock(cacheLock_);
 
   try {
     for (const auto& kv : *cacheFromString) {
-      cache_.set(
-        folly::convertTo<K>(kv[0]),
-        folly::convertTo<V>(kv[1])
-      );
+      auto key = folly::convertTo<K>(kv[0]);
+      auto val = folly::convertTo<V>(kv[1]);
+      auto& shard = shardFor(key);
+      typename wangle::CacheLockGuard<MutexT>::Write writeLock(shard.lock);
+
+      shard.cache.set(std::move(key), std::move(val));
     }
     error = false;
   } catch (const folly::TypeError& err) {
@@ -225,7 +417,7 @@ bool FilePersistentCache<K, V, MutexT>::deserializeCache(
   }
 
   if (error) {
-    cache_.clear();
+    clearShards();
     return false;
   }
 
@@ -234,14 +426,21 @@ bool FilePersistentCache<K, V, MutexT>::deserializeCache(
 
 template<typename K, typename V, typename MutexT>
 bool FilePersistentCache<K, V, MutexT>::persist(std::string&& serializedCache) {
+  return persistTo(file_, std::move(serializedCache));
+}
+
+template<typename K, typename V, typename MutexT>
+bool FilePersistentCache<K, V, MutexT>::persistTo(
+    const std::string& file,
+    std::string&& serializedCache) {
   bool persisted = false;
   const auto fd = folly::openNoInt(
-                    file_.c_str(),
+                    file.c_str(),
                     O_WRONLY | O_CREAT | O_TRUNC,
                     S_IRUSR | S_IWUSR
                   );
   if (fd == -1) {
-    LOG(ERROR) << "Failed to open " << file_ << ": errno " << errno;
+    LOG(ERROR) << "Failed to open " << file << ": errno " << errno;
     return false;
   }
   const auto nWritten = folly::writeFull(
@@ -252,7 +451,46 @@ bool FilePersistentCache<K, V, MutexT>::persist(std::string&& serializedCache) {
   persisted = nWritten >= 0 &&
     (static_cast<size_t>(nWritten) == serializedCache.size());
   if (!persisted) {
-    LOG(ERROR) << "Failed to write to " << file_ << ":";
+    LOG(ERROR) << "Failed to write to " << file << ":";
+    if (nWritten == -1) {
+      LOG(ERROR) << "write failed with errno " << errno;
+    }
+  }
+  if (folly::closeNoInt(fd) != 0) {
+    LOG(ERROR) << "Failed to close " << file << ": errno " << errno;
+    persisted = false;
+  }
+  return persisted;
+}
+
+template<typename K, typename V, typename MutexT>
+bool FilePersistentCache<K, V, MutexT>::persistAtomically(
+    std::string&& serializedCache) {
+  auto tmpFile = file_ + ".tmp";
+  if (!persistTo(tmpFile, std::move(serializedCache))) {
+    unlink(tmpFile.c_str());
+    return false;
+  }
+  if (rename(tmpFile.c_str(), file_.c_str()) != 0) {
+    LOG(ERROR) << "Failed to rename " << tmpFile << ": errno " << errno;
+    unlink(tmpFile.c_str());
+    return false;
+  }
+  return true;
+}
+
+template<typename K, typename V, typename MutexT>
+bool FilePersistentCache<K, V, MutexT>::append(const std::string& records) {
+  const auto fd = folly::openNoInt(file_.c_str(), O_WRONLY | O_APPEND);
+  if (fd == -1) {
+    LOG(ERROR) << "Failed to open " << file_ << ": errno " << errno;
+    return false;
+  }
+  const auto nWritten = folly::writeFull(fd, records.data(), records.size());
+  bool persisted = nWritten >= 0 &&
+    (static_cast<size_t>(nWritten) == records.size());
+  if (!persisted) {
+    LOG(ERROR) << "Failed to append to " << file_ << ":";
     if (nWritten == -1) {
       LOG(ERROR) << "write failed with errno " << errno;
     }
@@ -264,8 +502,90 @@ bool FilePersistentCache<K, V, MutexT>::persist(std::string&& serializedCache) {
   return persisted;
 }
 
+template<typename K, typename V, typename MutexT>
+bool FilePersistentCache<K, V, MutexT>::replayLog(folly::ByteRange log) {
+  size_t nRecords = 0;
+  bool complete = false;
+  try {
+    complete = BinaryCacheLog::replay<K, V>(
+      log,
+      [this](K&& key, V&& val) {
+        auto& shard = shardFor(key);
+        typename wangle::CacheLockGuard<MutexT>::Write writeLock(shard.lock);
+
+        shard.cache.set(std::move(key), std::move(val));
+      },
+      [this](K&& key) {
+        auto& shard = shardFor(key);
+        typename wangle::CacheLockGuard<MutexT>::Write writeLock(shard.lock);
+
+        shard.cache.erase(key);
+      },
+      [this]() {
+        clearShards();
+      },
+      &nRecords);
+  } catch (const std::exception& err) {
+    LOG(ERROR) << "Replay of cache log failed with error: " << err.what();
+    clearShards();
+    compactLog_ = true;
+    return false;
+  }
+  logRecords_ = nRecords;
+  if (!complete) {
+    // appending after a torn record would hide the records appended
+    LOG(ERROR) << "Cache log " << file_ << " is truncated after "
+               << nRecords << " records";
+    compactLog_ = true;
+  }
+  return complete;
+}
+
+template<typename K, typename V, typename MutexT>
+bool FilePersistentCache<K, V, MutexT>::loadLog() noexcept {
+  // keeps the syncer thread from writing the log until it is loaded
+  std::lock_guard<std::mutex> logGuard(logLock_);
+
+  std::unique_ptr<folly::MemoryMapping> mapping;
+  try {
+    mapping = folly::make_unique<folly::MemoryMapping>(file_.c_str());
+  } catch (const std::exception&) {
+    // as for the JSON format, start with an empty cache (and log)
+    compactLog_ = true;
+    return false;
+  }
+
+  auto log = mapping->range();
+  if (BinaryCacheLog::hasHeader(log)) {
+    mapping->hintLinearScan();
+    return replayLog(log);
+  }
+
+  // possibly a JSON file from before, to rewrite as a log on first sync
+  compactLog_ = true;
+  {
+    auto& shard = *shards_[0];
+    typename wangle::CacheLockGuard<MutexT>::Write writeLock(shard.lock);
+    ++shard.pendingUpdates;
+  }
+  try {
+    if (deserializeCache(std::string(
+          reinterpret_cast<const char*>(log.data()), log.size()))) {
+      return true;
+    }
+  } catch (const std::exception& err) {
+    LOG(ERROR) << "Deserialization of cache failed with error: "
+               << err.what();
+  }
+  return false;
+}
+
 template<typename K, typename V, typename MutexT>
 bool FilePersistentCache<K, V, MutexT>::load() noexcept {
+  if (format_ == PersistentCacheFormat::BINARY_LOG) {
+    return loadLog();
+  }
+
   std::string serializedCache;
   // not being able to read the backing storage means we just
   // start with an empty cache. Failing to deserialize, or write,
@@ -284,17 +604,36 @@ bool FilePersistentCache<K, V, MutexT>::load() noexcept {
 
 template<typename K, typename V, typename MutexT>
 void FilePersistentCache<K, V, MutexT>::clear() {
-  typename wangle::CacheLockGuard<MutexT>::Write writeLock(cacheLock_);
+  for (auto& shard : shards_) {
+    typename wangle::CacheLockGuard<MutexT>::Write writeLock(shard->lock);
+
+    shard->cache.clear();
+    ++shard->pendingUpdates;
+    if (format_ == PersistentCacheFormat::BINARY_LOG) {
+      shard->pendingRecords.clear();
+      shard->cleared = true;
+    }
+  }
+}
 
-  cache_.clear();
-  ++pendingUpdates_;
+template<typename K, typename V, typename MutexT>
+void FilePersistentCache<K, V, MutexT>::clearShards() {
+  for (auto& shard : shards_) {
+    typename wangle::CacheLockGuard<MutexT>::Write writeLock(shard->lock);
+
+    shard->cache.clear();
+  }
 }
 
 template<typename K, typename V, typename MutexT>
 size_t FilePersistentCache<K, V, MutexT>::size() {
-  typename wangle::CacheLockGuard<MutexT>::Read readLock(cacheLock_);
+  size_t size = 0;
+  for (auto& shard : shards_) {
+    typename wangle::CacheLockGuard<MutexT>::Read readLock(shard->lock);
 
-  return cache_.size();
+    size += shard->cache.size();
+  }
+  return size;
 }
 
 }
@@ -13,13 +13,18 @@
 #include <condition_variable>
 #include <future>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 #include <boost/noncopyable.hpp>
 #include <folly/EvictingCacheMap.h>
 #include <folly/dynamic.h>
+#include <folly/Hash.h>
+#include <wangle/client/persistence/BinaryCacheLog.h>
 #include <wangle/client/persistence/PersistentCache.h>
+#include <wangle/client/persistence/PersistentCacheSyncer.h>
 
 namespace wangle {
 
@@ -36,6 +41,17 @@ struct CacheLockGuard<std::mutex> {
   using Write = std::lock_guard<std::mutex>;
 };
 
+/**
+ * How a FilePersistentCache stores its entries in its file
+ */
+enum class PersistentCacheFormat {
+  // The whole cache as a JSON array, rewritten on each sync
+  JSON,
+  // A BinaryCacheLog the changes are appended to on each sync, compacted
+  // into a snapshot of the cache once it is a few times larger than that
+  BINARY_LOG,
+};
+
 /**
  * A PersistentCache implementation that used a regular file for
  * storage. In memory structure fronts the file and the cache
@@ -47,7 +63,9 @@ struct CacheLockGuard<std::mutex> {
  * NOTE NOTE NOTE: Although this class aims to be a cache for arbitrary,
  * it relies heavily on folly::toJson, folly::dynamic and convertTo for
  * serialization and deserialization. So It may not suit your need until
- * true support arbitrary types is written.
+ * true support arbitrary types is written. The BINARY_LOG format writes
+ * strings and arithmetic types as is, and other types as JSON, see
+ * BinaryCacheCodec.
  */
 template<typename K, typename V, typename MutexT = std::mutex>
 class FilePersistentCache : public PersistentCache<K, V>,
@@ -63,6 +81,16 @@ class FilePersistentCache : public PersistentCache<K, V>,
      * @param cacheCapacity max number of elements to hold in the cache.
      * @param syncInterval how often to sync to the file (in seconds).
      * @param nSyncRetries how many times to retry to sync on failure.
+     * @param format how to store the entries in the file. A BINARY_LOG
+     *               cache loads a JSON file too, and then rewrites it as a
+     *               binary snapshot on its first sync.
+     * @param nShards how many parts to split the cache into, each with its
+     *                own lock and a share of cacheCapacity, so that threads
+     *                using different keys don't wait on each other. LRU
+     *                eviction is then within a shard.
+     * @param syncer runs the periodic syncs if set, e.g.
+     *               PersistentCacheSyncer::getDefault(), rather than a
+     *               thread of the cache's own.
      *
      * Loads the cache and starts of the syncer thread that periodically
      * syncs the cache to file.
@@ -79,13 +107,16 @@ class FilePersistentCache : public PersistentCache<K, V>,
     explicit FilePersistentCache(const std::string& file,
         const std::size_t cacheCapacity,
         const std::chrono::seconds& syncInterval = std::chrono::seconds(5),
-        const int nSyncRetries = 3);
+        const int nSyncRetries = 3,
+        const PersistentCacheFormat format = PersistentCacheFormat::JSON,
+        const std::size_t nShards = 1,
+        std::shared_ptr<PersistentCacheSyncer> syncer = nullptr);
 
     /**
      * FilePersistentCache Destructor
      *
      * Signals the syncer thread to stop, waits for any pending syncs to
-     * be done.
+     * be done. With a shared syncer, does the last syncs itself.
      */
     ~FilePersistentCache() override;
 
@@ -115,6 +146,12 @@ class FilePersistentCache : public PersistentCache<K, V>,
     void sync();
     static void* syncThreadMain(void* arg);
 
+    /**
+     * One periodic sync: syncs to the file, counting the failures, and
+     * dropping the pending updates after nSyncRetries_ of them in a row.
+     */
+    void syncOrGiveUp();
+
     /**
      * Helper to sync routine above that actualy does the serialization
      * and writes to file.
@@ -124,15 +161,40 @@ class FilePersistentCache : public PersistentCache<K, V>,
      */
     bool syncNow();
 
+    /**
+     * syncNow for the BINARY_LOG format: appends the pending records to the
+     * log, or replaces it with a snapshot of the cache if it got too long.
+     */
+    bool syncLog();
+
+    /**
+     * Helper to load routine above for the BINARY_LOG format. Maps the
+     * file rather than reading it in, and replays the log from the mapping,
+     * so that a large cache loads without a copy of its file in memory.
+     *
+     * @returns boolean, true on successful load, false otherwise
+     */
+    bool loadLog() noexcept;
+
+    /**
+     * Helper to loadLog routine above, called with logLock_ held
+     *
+     * @returns boolean, true if the log was read whole, false otherwise
+     */
+    bool replayLog(folly::ByteRange log);
+
     /**
      * Helper to syncNow routine above that serializes data
      *
-     * Attempts to serialize cache_. Uses toDynamic and toJson from folly.
+     * Attempts to serialize a copy of the cache's entries, taken by syncNow
+     * so that the lock is not held while serializing. Uses toDynamic and
+     * toJson from folly.
      *
      * @returns Optional<std::string>, the string if serialization succeeded, no
      *                            value on failure
      */
-    folly::Optional<std::string> serializeCache();
+    folly::Optional<std::string> serializeCache(
+      const std::vector<std::pair<K, V>>& entries);
 
     /**
      * Helper to load routine above that deserializes data
@@ -155,19 +217,84 @@ class FilePersistentCache : public PersistentCache<K, V>,
      */
     bool persist(std::string&& serializedCache);
 
+    /**
+     * Helper to persist routine above that writes to the given file
+     */
+    bool persistTo(const std::string& file, std::string&& serializedCache);
+
+    /**
+     * Like persist, but writes to a temporary file renamed over the file
+     * once written, so that a failed write leaves the old file in place
+     */
+    bool persistAtomically(std::string&& serializedCache);
+
+    /**
+     * Appends to the file, which must already be a BinaryCacheLog
+     */
+    bool append(const std::string& records);
+
+    // A change of the cache, not yet appended to the log
+    struct LogRecord {
+      BinaryCacheLog::RecordType type;
+      K key;
+      folly::Optional<V> val;
+    };
+
+    // pendingUpdates below is really tied to cache, so modify them together
+    // always under the same lock
+    struct Shard {
+      explicit Shard(std::size_t capacity) : cache(capacity) {}
+
+      // in-memory LRU evicting cache table
+      folly::EvictingCacheMap<K, V> cache;
+      // tracks pendingUpdates
+      unsigned long pendingUpdates{0};
+      // for locking cache and pendingUpdates
+      MutexT lock;
+      // changes since the last sync in the BINARY_LOG format
+      std::vector<LogRecord> pendingRecords;
+      // cleared since the last sync in the BINARY_LOG format, so the next
+      // sync must replace the log rather than append to it
+      bool cleared{false};
+    };
+
+    static std::vector<std::unique_ptr<Shard>> makeShards(
+      std::size_t cacheCapacity,
+      std::size_t nShards);
+
+    Shard& shardFor(const K& key);
+
+    /**
+     * Empties the shards, without counting it as an update, e.g. when a
+     * load fails
+     */
+    void clearShards();
+
+    /**
+     * Pending updates of all the shards, which are locked in turn
+     */
+    unsigned long pendingUpdates();
+
+    // The log is compacted once it has this many records, and more than
+    // kCompactionRatio times as many as the cache has entries
+    static constexpr size_t kMinCompactionRecords = 1024;
+    static constexpr size_t kCompactionRatio = 2;
+
   private:
     // path to the file on disk
     const std::string file_;
 
-    // pendingUpdates_ below is really tied to cache_, so modify them together
-    // always under the same lock
+    std::vector<std::unique_ptr<Shard>> shards_;
 
-    // in-memory LRU evicting cache table
-    folly::EvictingCacheMap<K, V> cache_;
-    // tracks pendingUpdates_
-    unsigned long pendingUpdates_;
-    // for locking cache_ and pendingUpdates_
-    MutexT cacheLock_;
+    const PersistentCacheFormat format_;
+    // for the state of the log below, which the syncer thread and load
+    // share; taken before any shard's lock
+    std::mutex logLock_;
+    // records in the log, for deciding when to compact it
+    size_t logRecords_{0};
+    // the file isn't a whole log, e.g. after a failed append, so the next
+    // sync must replace it
+    bool compactLog_{false};
 
     // used to signal syncer thread
     bool stopSyncer_;
@@ -183,6 +310,10 @@ class FilePersistentCache : public PersistentCache<K, V>,
     // tracks no. of consecutive sync failures
     int nSyncFailures_;
 
+    // runs the periodic syncs instead of syncer_, if set
+    const std::shared_ptr<PersistentCacheSyncer> sharedSyncer_;
+    PersistentCacheSyncer::TaskId syncTask_{0};
+
     // thread for periodic sync
     std::thread syncer_;
 };
@@ -0,0 +1,108 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/client/persistence/PersistentCacheSyncer.h>
+
+#include <algorithm>
+
+#include <folly/Singleton.h>
+#include <folly/ThreadName.h>
+
+namespace {
+
+folly::Singleton<wangle::PersistentCacheSyncer> defaultSyncer;
+
+}
+
+namespace wangle {
+
+PersistentCacheSyncer::PersistentCacheSyncer()
+    : thread_(&PersistentCacheSyncer::run, this) {
+  folly::setThreadName(thread_.native_handle(), "CacheSyncer");
+}
+
+PersistentCacheSyncer::~PersistentCacheSyncer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+    cv_.notify_all();
+  }
+  thread_.join();
+}
+
+std::shared_ptr<PersistentCacheSyncer> PersistentCacheSyncer::getDefault() {
+  return defaultSyncer.try_get();
+}
+
+PersistentCacheSyncer::TaskId PersistentCacheSyncer::add(
+    std::function<void()> task,
+    std::chrono::milliseconds interval) {
+  // a task running back to back would starve the others
+  Clock::duration period = std::max(interval, std::chrono::milliseconds(1));
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto id = nextId_++;
+  tasks_[id] = Task{std::move(task), period, nextTick(Clock::now(), period)};
+  cv_.notify_all();
+  return id;
+}
+
+void PersistentCacheSyncer::remove(TaskId id) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  tasks_.erase(id);
+  if (std::this_thread::get_id() == thread_.get_id()) {
+    return;
+  }
+  cv_.wait(lock, [this, id] { return running_ != id; });
+}
+
+PersistentCacheSyncer::Clock::time_point PersistentCacheSyncer::nextTick(
+    Clock::time_point now,
+    Clock::duration interval) {
+  auto sinceEpoch = now.time_since_epoch();
+  return Clock::time_point(
+    (sinceEpoch / interval + 1) * interval);
+}
+
+void PersistentCacheSyncer::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_) {
+    auto now = Clock::now();
+    auto wakeup = Clock::time_point::max();
+    auto due = tasks_.end();
+    for (auto itr = tasks_.begin(); itr != tasks_.end(); ++itr) {
+      if (itr->second.next <= now) {
+        due = itr;
+        break;
+      }
+      wakeup = std::min(wakeup, itr->second.next);
+    }
+
+    if (due == tasks_.end()) {
+      if (wakeup == Clock::time_point::max()) {
+        cv_.wait(lock);
+      } else {
+        cv_.wait_until(lock, wakeup);
+      }
+      continue;
+    }
+
+    auto id = due->first;
+    // a copy, as the task may be removed while running
+    auto func = due->second.func;
+    due->second.next = nextTick(now, due->second.interval);
+    running_ = id;
+    lock.unlock();
+    func();
+    lock.lock();
+    running_ = 0;
+    cv_.notify_all();
+  }
+}
+
+}
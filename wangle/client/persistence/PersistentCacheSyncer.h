@@ -0,0 +1,90 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <boost/noncopyable.hpp>
+
+namespace wangle {
+
+/**
+ * A thread running the periodic syncs of many persistent caches, instead
+ * of a thread for each, see FilePersistentCache's syncer argument.
+ *
+ * A task runs every interval, at multiples of the interval, so that the
+ * caches syncing as often sync in the same wakeup, one after the other.
+ * Their writes reach the disk together rather than spread out, and never
+ * interleave. Tasks are run one at a time, so a slow one delays the
+ * others.
+ */
+class PersistentCacheSyncer : private boost::noncopyable {
+ public:
+  typedef uint64_t TaskId;
+
+  PersistentCacheSyncer();
+
+  /**
+   * Stops the thread, without running the tasks left, which should have
+   * been removed already.
+   */
+  ~PersistentCacheSyncer();
+
+  /**
+   * A syncer shared by the whole process, created on first use.
+   * Null during shutdown.
+   */
+  static std::shared_ptr<PersistentCacheSyncer> getDefault();
+
+  /**
+   * Runs task every interval, from the next multiple of it on
+   *
+   * @returns TaskId, to remove the task with
+   */
+  TaskId add(std::function<void()> task, std::chrono::milliseconds interval);
+
+  /**
+   * Stops running the task, waiting for it to finish if it is running,
+   * unless called from the task itself.
+   */
+  void remove(TaskId id);
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Task {
+    std::function<void()> func;
+    Clock::duration interval;
+    Clock::time_point next;
+  };
+
+  static Clock::time_point nextTick(Clock::time_point now,
+                                    Clock::duration interval);
+
+  void run();
+
+  std::mutex mutex_;
+  // signals new tasks, finished tasks and stopping
+  std::condition_variable cv_;
+  std::map<TaskId, Task> tasks_;
+  TaskId nextId_{1};
+  // the task running, if any
+  TaskId running_{0};
+  bool stop_{false};
+  std::thread thread_;
+};
+
+}
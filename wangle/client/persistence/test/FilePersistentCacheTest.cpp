@@ -7,6 +7,7 @@
  *  of patent rights can be found in the PATENTS file in the same directory.
  *
  */
+#include <folly/Baton.h>
 #include <folly/futures/Barrier.h>
 #include <wangle/client/persistence/FilePersistentCache.h>
 #include <wangle/client/persistence/SharedMutexCacheLockGuard.h>
@@ -86,8 +87,97 @@ TYPED_TEST(FilePersistentCacheTest, stringNestedKeyValGetPutTest) {
   testSimplePutGet<KeyType, ValType, TypeParam>(keys, values);
 }
 
+TYPED_TEST(FilePersistentCacheTest, binaryLogGetPutTest) {
+  const auto format = PersistentCacheFormat::BINARY_LOG;
+  testSimplePutGet<string, string, TypeParam>(
+    {"key1", "key2"}, {"value1", "value2"}, format);
+  testSimplePutGet<int, double, TypeParam>({1, 2}, {3.0, 4.0}, format);
+  // through the JSON codec
+  testSimplePutGet<pair<string, string>, map<string, list<string>>, TypeParam>(
+    {make_pair("cool", "what the=?"), make_pair("not_cool", "how on earth?")},
+    {{{"NYC", {"fma", "shijin"}}}, {{"MPK", {"subodh", "blake"}}}},
+    format);
+}
+
+TYPED_TEST(FilePersistentCacheTest, binaryLogCompactionTest) {
+  using CacheType = FilePersistentCache<int, int, TypeParam>;
+  string filename = getPersistentCacheFilename();
+  const auto format = PersistentCacheFormat::BINARY_LOG;
+  {
+    CacheType cache(filename, 10, chrono::seconds(150), 3, format);
+    for (int i = 0; i < 5000; ++i) {
+      cache.put(i % 20, i);
+    }
+    cache.remove(19);
+  }
+  string log;
+  EXPECT_TRUE(folly::readFile(filename.c_str(), log));
+  // a snapshot of the 10 entries left rather than the 5001 records
+  EXPECT_LT(log.size(), 200u);
+  {
+    CacheType cache(filename, 10, chrono::seconds(150), 3, format);
+    EXPECT_EQ(cache.size(), 9);
+    EXPECT_FALSE(cache.get(19).hasValue());
+    EXPECT_EQ(cache.get(18).value(), 4998);
+    // the LRU order survives the snapshot: 10 is the least recently used
+    cache.put(100, 100);
+    EXPECT_FALSE(cache.get(10).hasValue());
+    EXPECT_EQ(cache.get(11).value(), 4991);
+  }
+  EXPECT_TRUE(unlink(filename.c_str()) != -1);
+}
+
+TYPED_TEST(FilePersistentCacheTest, binaryLogReadsJsonFileTest) {
+  using CacheType = FilePersistentCache<string, string, TypeParam>;
+  string filename = getPersistentCacheFilename();
+  string content = "[[\"key1\",\"value1\"], [\"key2\",\"value2\"]]";
+  EXPECT_TRUE(folly::writeFile(content, filename.c_str()));
+  const auto format = PersistentCacheFormat::BINARY_LOG;
+  {
+    CacheType cache(filename, 10, chrono::seconds(150), 3, format);
+    EXPECT_EQ(cache.size(), 2);
+    EXPECT_EQ(cache.get("key1").value(), "value1");
+  }
+  string log;
+  EXPECT_TRUE(folly::readFile(filename.c_str(), log));
+  EXPECT_TRUE(BinaryCacheLog::hasHeader(folly::ByteRange(
+    reinterpret_cast<const unsigned char*>(log.data()), log.size())));
+  {
+    CacheType cache(filename, 10, chrono::seconds(150), 3, format);
+    EXPECT_EQ(cache.size(), 2);
+    EXPECT_EQ(cache.get("key2").value(), "value2");
+  }
+  EXPECT_TRUE(unlink(filename.c_str()) != -1);
+}
+
+TYPED_TEST(FilePersistentCacheTest, binaryLogTruncatedTest) {
+  using CacheType = FilePersistentCache<string, string, TypeParam>;
+  string filename = getPersistentCacheFilename();
+  string log = BinaryCacheLog::header().str();
+  BinaryCacheLog::appendPut(string("key1"), string("value1"), log);
+  BinaryCacheLog::appendPut(string("key2"), string("value2"), log);
+  // as an interrupted append leaves it
+  log.resize(log.size() - 3);
+  EXPECT_TRUE(folly::writeFile(log, filename.c_str()));
+  const auto format = PersistentCacheFormat::BINARY_LOG;
+  {
+    CacheType cache(filename, 10, chrono::seconds(150), 3, format);
+    EXPECT_EQ(cache.size(), 1);
+    EXPECT_EQ(cache.get("key1").value(), "value1");
+    cache.put("key3", "value3");
+  }
+  {
+    CacheType cache(filename, 10, chrono::seconds(150), 3, format);
+    EXPECT_EQ(cache.size(), 2);
+    EXPECT_EQ(cache.get("key1").value(), "value1");
+    EXPECT_EQ(cache.get("key3").value(), "value3");
+  }
+  EXPECT_TRUE(unlink(filename.c_str()) != -1);
+}
+
 template<typename K, typename V, typename MutexT>
-void testEmptyFile() {
+void testEmptyFile(
+    PersistentCacheFormat format = PersistentCacheFormat::JSON) {
   string filename = getPersistentCacheFilename();
   size_t cacheCapacity = 10;
   int fd = folly::openNoInt(
@@ -97,7 +187,7 @@ void testEmptyFile() {
           );
   EXPECT_TRUE(fd != -1);
   using CacheType = FilePersistentCache<K, V, MutexT>;
-  CacheType cache(filename, cacheCapacity, chrono::seconds(1));
+  CacheType cache(filename, cacheCapacity, chrono::seconds(1), 3, format);
   EXPECT_EQ(cache.size(), 0);
   EXPECT_TRUE(folly::closeNoInt(fd) != -1);
   EXPECT_TRUE(unlink(filename.c_str()) != -1);
@@ -115,6 +205,10 @@ TYPED_TEST(FilePersistentCacheTest, stringNestedValEmptyFile) {
   testEmptyFile<KeyType, ValType, TypeParam>();
 }
 
+TYPED_TEST(FilePersistentCacheTest, binaryLogEmptyFile) {
+  testEmptyFile<string, string, TypeParam>(PersistentCacheFormat::BINARY_LOG);
+}
+
 //TODO_ranjeeth : integrity, should we sign the file somehow t3623725
 template<typename K, typename V, typename MutexT>
 void testInvalidFile(const std::string& content) {
@@ -315,3 +409,73 @@ TYPED_TEST(FilePersistentCacheTest, threadstress) {
     EXPECT_EQ(*val, i);
   }
 }
+
+TYPED_TEST(FilePersistentCacheTest, shardedPutGetTest) {
+  using CacheType = FilePersistentCache<int, string, TypeParam>;
+  for (auto format : {PersistentCacheFormat::JSON,
+                      PersistentCacheFormat::BINARY_LOG}) {
+    string filename = getPersistentCacheFilename();
+    {
+      CacheType cache(filename, 1000, chrono::seconds(150), 3, format, 4);
+      for (int i = 0; i < 100; ++i) {
+        cache.put(i, folly::to<string>("value", i));
+      }
+      EXPECT_TRUE(cache.remove(0));
+      EXPECT_EQ(cache.size(), 99);
+    }
+    {
+      CacheType cache(filename, 1000, chrono::seconds(150), 3, format, 4);
+      EXPECT_EQ(cache.size(), 99);
+      EXPECT_FALSE(cache.get(0).hasValue());
+      for (int i = 1; i < 100; ++i) {
+        EXPECT_EQ(cache.get(i).value(), folly::to<string>("value", i));
+      }
+      cache.clear();
+      EXPECT_EQ(cache.size(), 0);
+    }
+    {
+      // from a file written with another number of shards
+      CacheType cache(filename, 1000, chrono::seconds(150), 3, format);
+      EXPECT_EQ(cache.size(), 0);
+    }
+    EXPECT_TRUE(unlink(filename.c_str()) != -1);
+  }
+}
+
+TYPED_TEST(FilePersistentCacheTest, sharedSyncerTest) {
+  using CacheType = FilePersistentCache<string, int, TypeParam>;
+  auto syncer = std::make_shared<PersistentCacheSyncer>();
+  vector<string> filenames;
+  {
+    vector<std::unique_ptr<CacheType>> caches;
+    for (int i = 0; i < 3; ++i) {
+      filenames.push_back(getPersistentCacheFilename());
+      caches.push_back(folly::make_unique<CacheType>(
+        filenames.back(), 10, chrono::seconds(150), 3,
+        PersistentCacheFormat::JSON, 1, syncer));
+      caches.back()->put("key", i);
+    }
+    // the last syncs are made by the destructors
+  }
+  for (int i = 0; i < 3; ++i) {
+    CacheType cache(filenames[i], 10, chrono::seconds(150));
+    EXPECT_EQ(cache.get("key").value(), i);
+    EXPECT_TRUE(unlink(filenames[i].c_str()) != -1);
+  }
+}
+
+TEST(PersistentCacheSyncerTest, runsTasksUntilRemoved) {
+  PersistentCacheSyncer syncer;
+  std::atomic<int> runs(0);
+  folly::Baton<> ran;
+  auto id = syncer.add([&] {
+    if (++runs == 3) {
+      ran.post();
+    }
+  }, chrono::milliseconds(10));
+  EXPECT_TRUE(ran.timed_wait(chrono::steady_clock::now() + chrono::seconds(5)));
+  syncer.remove(id);
+  auto after = runs.load();
+  /* sleep override */ std::this_thread::sleep_for(chrono::milliseconds(50));
+  EXPECT_EQ(runs.load(), after);
+}
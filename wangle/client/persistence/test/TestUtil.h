@@ -25,12 +25,14 @@ std::string getPersistentCacheFilename();
 template<typename K, typename V, typename MutexT = std::mutex>
 void testSimplePutGet(
     const std::vector<K>& keys,
-    const std::vector<V>& values) {
+    const std::vector<V>& values,
+    PersistentCacheFormat format = PersistentCacheFormat::JSON) {
   std::string filename = getPersistentCacheFilename();
   typedef FilePersistentCache<K, V, MutexT> CacheType;
   size_t cacheCapacity = 10;
   {
-    CacheType cache(filename, cacheCapacity, std::chrono::seconds(150));
+    CacheType cache(
+      filename, cacheCapacity, std::chrono::seconds(150), 3, format);
     EXPECT_FALSE(cache.get(keys[0]).hasValue());
     EXPECT_FALSE(cache.get(keys[1]).hasValue());
     cache.put(keys[0], values[0]);
@@ -40,7 +42,8 @@ void testSimplePutGet(
     EXPECT_EQ(cache.get(keys[1]).value(), values[1]);
   }
   {
-    CacheType cache(filename, cacheCapacity, std::chrono::seconds(150));
+    CacheType cache(
+      filename, cacheCapacity, std::chrono::seconds(150), 3, format);
     EXPECT_EQ(cache.size(), 2);
     EXPECT_EQ(cache.get(keys[0]).value(), values[0]);
     EXPECT_EQ(cache.get(keys[1]).value(), values[1]);
@@ -51,7 +54,8 @@ void testSimplePutGet(
     EXPECT_FALSE(cache.get(keys[1]).hasValue());
   }
   {
-    CacheType cache(filename, cacheCapacity, std::chrono::seconds(150));
+    CacheType cache(
+      filename, cacheCapacity, std::chrono::seconds(150), 3, format);
     EXPECT_EQ(cache.size(), 1);
     EXPECT_EQ(cache.get(keys[0]).value(), values[0]);
     EXPECT_FALSE(cache.get(keys[1]).hasValue());
@@ -61,7 +65,8 @@ void testSimplePutGet(
     EXPECT_FALSE(cache.get(keys[1]).hasValue());
   }
   {
-    CacheType cache(filename, cacheCapacity, std::chrono::seconds(150));
+    CacheType cache(
+      filename, cacheCapacity, std::chrono::seconds(150), 3, format);
     EXPECT_EQ(cache.size(), 0);
     EXPECT_FALSE(cache.get(keys[0]).hasValue());
     EXPECT_FALSE(cache.get(keys[1]).hasValue());
@@ -10,8 +10,71 @@
 //
 #include <wangle/client/ssl/SSLSessionCacheData.h>
 
+#include <cstring>
+#include <stdexcept>
+
 using namespace std::chrono;
 
+namespace {
+
+void appendBytes(const folly::fbstring& bytes, std::string& out) {
+  uint32_t length = static_cast<uint32_t>(bytes.size());
+  out.append(reinterpret_cast<const char*>(&length), sizeof(length));
+  out.append(bytes.data(), bytes.size());
+}
+
+template<typename T>
+T readValue(folly::ByteRange& in) {
+  T value;
+  if (in.size() < sizeof(value)) {
+    throw std::out_of_range("truncated SSLSessionCacheData");
+  }
+  memcpy(&value, in.data(), sizeof(value));
+  in.advance(sizeof(value));
+  return value;
+}
+
+folly::fbstring readBytes(folly::ByteRange& in) {
+  auto length = readValue<uint32_t>(in);
+  if (in.size() < length) {
+    throw std::out_of_range("truncated SSLSessionCacheData");
+  }
+  folly::fbstring bytes(reinterpret_cast<const char*>(in.data()), length);
+  in.advance(length);
+  return bytes;
+}
+
+}
+
+namespace wangle {
+
+constexpr uint8_t BinaryCacheCodec<SSLSessionCacheData>::kVersion;
+
+void BinaryCacheCodec<SSLSessionCacheData>::encode(
+    const SSLSessionCacheData& data,
+    std::string& out) {
+  out.push_back(static_cast<char>(kVersion));
+  int64_t rep = data.addedTime.time_since_epoch().count();
+  out.append(reinterpret_cast<const char*>(&rep), sizeof(rep));
+  appendBytes(data.sessionData, out);
+  appendBytes(data.serviceIdentity, out);
+}
+
+SSLSessionCacheData BinaryCacheCodec<SSLSessionCacheData>::decode(
+    folly::ByteRange in) {
+  if (readValue<uint8_t>(in) != kVersion) {
+    throw std::out_of_range("unknown SSLSessionCacheData version");
+  }
+  SSLSessionCacheData data;
+  data.addedTime = system_clock::time_point(
+    system_clock::duration(readValue<int64_t>(in)));
+  data.sessionData = readBytes(in);
+  data.serviceIdentity = readBytes(in);
+  return data;
+}
+
+}
+
 namespace folly {
 
 template<>
@@ -11,9 +11,12 @@
 #pragma once
 
 #include <chrono>
+#include <string>
 
 #include <folly/DynamicConverter.h>
 #include <folly/FBString.h>
+#include <folly/Range.h>
+#include <wangle/client/persistence/BinaryCacheLog.h>
 
 namespace wangle {
 
@@ -23,6 +26,18 @@ typedef struct SSLSessionCacheData {
   folly::fbstring serviceIdentity;
 } SSLSessionCacheData;
 
+// For the BINARY_LOG format of FilePersistentCache: a version byte, the
+// added time, then the session data and the service identity, each
+// preceded by its length, all in host byte order. The DER session data
+// is stored as is, rather than escaped in JSON.
+template<>
+struct BinaryCacheCodec<SSLSessionCacheData> {
+  static constexpr uint8_t kVersion = 1;
+
+  static void encode(const SSLSessionCacheData& data, std::string& out);
+  static SSLSessionCacheData decode(folly::ByteRange in);
+};
+
 } //proxygen
 
 namespace folly {
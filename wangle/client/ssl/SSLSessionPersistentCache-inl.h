@@ -33,7 +33,8 @@ SSLSessionPersistentCacheBase<K>::SSLSessionPersistentCacheBase(
   bool doTicketLifetimeExpiration) :
     SSLSessionPersistentCacheBase(
       std::make_shared<FilePersistentCache<K, SSLSessionCacheData>>(
-        filename, cacheCapacity, syncInterval),
+        filename, cacheCapacity, syncInterval, 3,
+        PersistentCacheFormat::BINARY_LOG),
       doTicketLifetimeExpiration) {}
 
 template<typename K>
@@ -9,27 +9,69 @@
  */
 #include <wangle/client/ssl/ThreadSafeSSLSessionCache.h>
 
+#include <functional>
+
 using folly::SharedMutex;
+using std::chrono::steady_clock;
 
 namespace wangle {
 
+constexpr size_t ThreadSafeSSLSessionCache::kVersionStripes;
+
 void ThreadSafeSSLSessionCache::setSSLSession(
   const std::string& identity,
   SSLSessionPtr session) noexcept {
   SharedMutex::WriteHolder lock(mutex_);
   delegate_->setSSLSession(identity, std::move(session));
+  invalidate(identity);
 }
 
 SSLSessionPtr ThreadSafeSSLSessionCache::getSSLSession(
     const std::string& identity) const noexcept {
-  SharedMutex::ReadHolder lock(mutex_);
-  return delegate_->getSSLSession(identity);
+  if (threadCacheSize_ == 0) {
+    SharedMutex::ReadHolder lock(mutex_);
+    return delegate_->getSSLSession(identity);
+  }
+
+  auto& cache = *threadCache_;
+  if (!cache.sessions) {
+    cache.sessions.reset(
+      new folly::EvictingCacheMap<std::string, ThreadEntry>(threadCacheSize_));
+  }
+  auto now = steady_clock::now();
+  // read before the delegate, so that a write after makes this copy stale
+  auto version = versionFor(identity).load(std::memory_order_acquire);
+  auto it = cache.sessions->find(identity);
+  if (it != cache.sessions->end()) {
+    auto& entry = it->second;
+    if (entry.version == version && now < entry.expiry) {
+      auto session = entry.session.get();
+      CRYPTO_add(&session->references, 1, CRYPTO_LOCK_SSL_SESSION);
+      return SSLSessionPtr(session);
+    }
+    cache.sessions->erase(identity);
+  }
+
+  SSLSessionPtr session;
+  {
+    SharedMutex::ReadHolder lock(mutex_);
+    session = delegate_->getSSLSession(identity);
+  }
+  if (session) {
+    CRYPTO_add(&session->references, 1, CRYPTO_LOCK_SSL_SESSION);
+    cache.sessions->set(
+      identity,
+      ThreadEntry{SSLSessionPtr(session.get()), version, now + threadCacheTTL_});
+  }
+  return session;
 }
 
 bool ThreadSafeSSLSessionCache::removeSSLSession(
     const std::string& identity) noexcept {
   SharedMutex::WriteHolder lock(mutex_);
-  return delegate_->removeSSLSession(identity);
+  auto removed = delegate_->removeSSLSession(identity);
+  invalidate(identity);
+  return removed;
 }
 
 bool ThreadSafeSSLSessionCache::supportsPersistence() const noexcept {
@@ -42,4 +84,16 @@ size_t ThreadSafeSSLSessionCache::size() const {
   return delegate_->size();
 }
 
+std::atomic<uint64_t>& ThreadSafeSSLSessionCache::versionFor(
+    const std::string& identity) const {
+  return versions_[std::hash<std::string>()(identity) % kVersionStripes];
+}
+
+void ThreadSafeSSLSessionCache::invalidate(
+    const std::string& identity) noexcept {
+  if (threadCacheSize_ > 0) {
+    versionFor(identity).fetch_add(1, std::memory_order_release);
+  }
+}
+
 }
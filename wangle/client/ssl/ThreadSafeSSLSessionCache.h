@@ -12,7 +12,13 @@
 #include <wangle/client/ssl/SSLSession.h>
 #include <wangle/client/ssl/SSLSessionCallbacks.h>
 
+#include <folly/EvictingCacheMap.h>
 #include <folly/SharedMutex.h>
+#include <folly/ThreadLocal.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
 
 namespace wangle {
 
@@ -20,6 +26,16 @@ namespace wangle {
   * A SSL session cache that can be used safely across threads.
   * This is useful for clients who cannot avoid sharing the cache
   * across threads. It uses a read/write lock for efficiency.
+  *
+  * Optionally, each thread getting sessions also keeps the last ones it
+  * got in a small cache of its own, so that repeated connects to the same
+  * identity don't touch the lock. A set or remove of an identity makes the
+  * threads' copies of it stale; a copy is also dropped after
+  * threadCacheTTL, and is then looked up again in the delegate, which
+  * gets to apply its own expiration (e.g. of ticket lifetimes).
+  * Keep the TTL well under the sessions' lifetimes.
+  * Threads get the same SSL_SESSION from their cache, each with its own
+  * reference.
   */
 class ThreadSafeSSLSessionCache : public SSLSessionCallbacks {
  public:
@@ -27,6 +43,14 @@ class ThreadSafeSSLSessionCache : public SSLSessionCallbacks {
        std::unique_ptr<SSLSessionCallbacks> delegate) :
      delegate_(std::move(delegate)) {}
 
+   ThreadSafeSSLSessionCache(
+       std::unique_ptr<SSLSessionCallbacks> delegate,
+       size_t threadCacheSize,
+       std::chrono::milliseconds threadCacheTTL) :
+     delegate_(std::move(delegate)),
+     threadCacheSize_(threadCacheSize),
+     threadCacheTTL_(threadCacheTTL) {}
+
    // From SSLSessionCallbacks
    void setSSLSession(
      const std::string& identity, SSLSessionPtr session) noexcept override;
@@ -37,8 +61,35 @@ class ThreadSafeSSLSessionCache : public SSLSessionCallbacks {
    size_t size() const override;
 
  private:
+   // Identities are spread over this many versions
+   static constexpr size_t kVersionStripes = 64;
+
+   struct ThreadEntry {
+     SSLSessionPtr session;
+     // of the identity's stripe when the session was got
+     uint64_t version;
+     std::chrono::steady_clock::time_point expiry;
+   };
+
+   struct ThreadCache {
+     std::unique_ptr<folly::EvictingCacheMap<std::string, ThreadEntry>>
+       sessions;
+   };
+
+   std::atomic<uint64_t>& versionFor(const std::string& identity) const;
+
+   // Makes the threads' copies of identity stale, under the write lock
+   void invalidate(const std::string& identity) noexcept;
+
    std::unique_ptr<SSLSessionCallbacks> delegate_;
    mutable folly::SharedMutex mutex_;
+
+   const size_t threadCacheSize_{0};
+   const std::chrono::milliseconds threadCacheTTL_{0};
+   mutable folly::ThreadLocal<ThreadCache> threadCache_;
+   // Bumped on each set or remove of the identities in the stripe, so that
+   // checking a thread's copy reads a counter rather than takes the lock
+   mutable std::array<std::atomic<uint64_t>, kVersionStripes> versions_{};
 };
 
 }
@@ -56,6 +56,31 @@ TEST_F(SSLSessionCacheDataTest, Basic) {
   EXPECT_EQ(deserializedData.serviceIdentity, data.serviceIdentity);
 }
 
+TEST_F(SSLSessionCacheDataTest, Binary) {
+  SSLSessionCacheData data;
+  data.sessionData = folly::fbstring("some\0session\xff data", 18);
+  data.addedTime = system_clock::now();
+  data.serviceIdentity = "some service";
+
+  std::string encoded;
+  BinaryCacheCodec<SSLSessionCacheData>::encode(data, encoded);
+  auto in = folly::ByteRange(
+    reinterpret_cast<const unsigned char*>(encoded.data()), encoded.size());
+  auto decodedData = BinaryCacheCodec<SSLSessionCacheData>::decode(in);
+
+  EXPECT_EQ(decodedData.sessionData, data.sessionData);
+  EXPECT_EQ(decodedData.addedTime, data.addedTime);
+  EXPECT_EQ(decodedData.serviceIdentity, data.serviceIdentity);
+
+  EXPECT_THROW(
+    BinaryCacheCodec<SSLSessionCacheData>::decode(in.subpiece(0, 20)),
+    std::out_of_range);
+  encoded[0] = 2;
+  EXPECT_THROW(
+    BinaryCacheCodec<SSLSessionCacheData>::decode(in),
+    std::out_of_range);
+}
+
 TEST_F(SSLSessionCacheDataTest, CloneSSLSession) {
   for (auto& it : sessions_) {
     auto sess = SSLSessionPtr(cloneSSLSession(it.first));
@@ -97,3 +97,48 @@ TEST_F(ThreadSafeSSLSessionCacheTest, ReadWrite) {
   reader.join();
   EXPECT_GE(readOps, writeOps);
 }
+
+TEST_F(ThreadSafeSSLSessionCacheTest, ThreadCache) {
+  // FakeSessionCallbacks gives a session once, so the later gets are from
+  // the thread's cache
+  cache_.reset(new ThreadSafeSSLSessionCache(
+        folly::make_unique<FakeSessionCallbacks>(), 10,
+        std::chrono::minutes(1)));
+  const std::string host = "host";
+
+  cache_->setSSLSession(host, createPersistentTestSession(sessions_[0]));
+  auto sess = cache_->getSSLSession(host);
+  ASSERT_TRUE(sess);
+  for (int i = 0; i < 3; ++i) {
+    auto again = cache_->getSSLSession(host);
+    EXPECT_EQ(again.get(), sess.get());
+  }
+
+  // other threads have caches of their own
+  std::thread other([&] () {
+    EXPECT_FALSE(cache_->getSSLSession(host));
+  });
+  other.join();
+
+  // a set makes the copy stale
+  cache_->setSSLSession(host, createPersistentTestSession(sessions_[1]));
+  auto newSess = cache_->getSSLSession(host);
+  ASSERT_TRUE(newSess);
+  EXPECT_NE(newSess.get(), sess.get());
+  EXPECT_EQ(cache_->getSSLSession(host).get(), newSess.get());
+
+  // and so does a remove
+  cache_->removeSSLSession(host);
+  EXPECT_FALSE(cache_->getSSLSession(host));
+}
+
+TEST_F(ThreadSafeSSLSessionCacheTest, ThreadCacheTTL) {
+  cache_.reset(new ThreadSafeSSLSessionCache(
+        folly::make_unique<FakeSessionCallbacks>(), 10,
+        std::chrono::milliseconds(0)));
+  const std::string host = "host";
+
+  cache_->setSSLSession(host, createPersistentTestSession(sessions_[0]));
+  EXPECT_TRUE(cache_->getSSLSession(host));
+  EXPECT_FALSE(cache_->getSSLSession(host));
+}
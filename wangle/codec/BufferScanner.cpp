@@ -0,0 +1,141 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/codec/BufferScanner.h>
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace wangle {
+
+using folly::IOBuf;
+using folly::IOBufQueue;
+using folly::StringPiece;
+
+BufferScanner::BufferScanner(const IOBufQueue& buf, uint64_t from)
+    : front_(buf.front()),
+      length_(front_ ? buf.chainLength() : 0),
+      scanned_(std::min(from, length_)) {
+  pos_.seg = front_;
+}
+
+void BufferScanner::seek(Position& pos, uint64_t offset) const {
+  while (offset >= pos.start + pos.seg->length() &&
+         pos.seg->next() != front_) {
+    pos.start += pos.seg->length();
+    pos.seg = pos.seg->next();
+  }
+  while (offset < pos.start) {
+    pos.seg = pos.seg->prev();
+    pos.start -= pos.seg->length();
+  }
+}
+
+template <class Find>
+int64_t BufferScanner::scan(uint64_t limit, Find find) {
+  limit = std::min(limit, length_);
+  if (scanned_ >= limit) {
+    return -1;
+  }
+  seek(pos_, scanned_);
+  while (true) {
+    auto data = pos_.seg->data();
+    const uint64_t segLength = pos_.seg->length();
+    const uint64_t start = scanned_ - pos_.start;
+    const uint64_t end = std::min(segLength, limit - pos_.start);
+    if (start < end) {
+      auto p = find(data + start, end - start);
+      if (p) {
+        const uint64_t offset = pos_.start + (p - data);
+        scanned_ = offset + 1;
+        return offset;
+      }
+    }
+    if (pos_.start + segLength >= limit || pos_.seg->next() == front_) {
+      scanned_ = limit;
+      return -1;
+    }
+    pos_.start += segLength;
+    pos_.seg = pos_.seg->next();
+    scanned_ = pos_.start;
+  }
+}
+
+int64_t BufferScanner::find(uint8_t b, uint64_t limit) {
+  return scan(limit, [b](const uint8_t* data, size_t n) {
+    return static_cast<const uint8_t*>(memchr(data, b, n));
+  });
+}
+
+int64_t BufferScanner::findFirstOf(StringPiece bytes, uint64_t limit) {
+  if (bytes.size() == 1) {
+    return find(uint8_t(bytes[0]), limit);
+  }
+  return scan(limit, [bytes](const uint8_t* data, size_t n) {
+    auto i = StringPiece(reinterpret_cast<const char*>(data), n)
+      .find_first_of(bytes);
+    return i == StringPiece::npos ? nullptr : data + i;
+  });
+}
+
+bool BufferScanner::peek(uint64_t offset, void* out, size_t n) const {
+  if (n == 0) {
+    return true;
+  }
+  if (offset + n > length_) {
+    return false;
+  }
+  auto p = pos_;
+  seek(p, offset);
+  auto dest = static_cast<uint8_t*>(out);
+  uint64_t i = offset - p.start;
+  while (n > 0) {
+    const size_t len = std::min<uint64_t>(p.seg->length() - i, n);
+    memcpy(dest, p.seg->data() + i, len);
+    dest += len;
+    n -= len;
+    p.seg = p.seg->next();
+    i = 0;
+  }
+  return true;
+}
+
+bool BufferScanner::matches(uint64_t offset, StringPiece bytes) const {
+  if (bytes.empty()) {
+    return true;
+  }
+  if (offset + bytes.size() > length_) {
+    return false;
+  }
+  auto p = pos_;
+  seek(p, offset);
+  uint64_t i = offset - p.start;
+  while (!bytes.empty()) {
+    const size_t len = std::min<uint64_t>(p.seg->length() - i, bytes.size());
+    if (memcmp(p.seg->data() + i, bytes.data(), len) != 0) {
+      return false;
+    }
+    bytes.advance(len);
+    p.seg = p.seg->next();
+    i = 0;
+  }
+  return true;
+}
+
+uint8_t BufferScanner::byteAt(uint64_t offset) const {
+  DCHECK_LT(offset, length_);
+  auto p = pos_;
+  seek(p, offset);
+  return p.seg->data()[offset - p.start];
+}
+
+} // namespace wangle
@@ -0,0 +1,112 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/Bits.h>
+#include <folly/Range.h>
+#include <folly/io/IOBufQueue.h>
+
+#include <algorithm>
+#include <cstdint>
+
+namespace wangle {
+
+/**
+ * Scans the bytes of an IOBufQueue segment by segment, for decoders
+ * looking for their frame boundaries: whole segments are searched at once,
+ * with memchr() for one byte and folly's find_first_of() (SSE4.2 where
+ * available) for any of several, rather than a byte at a time through a
+ * Cursor.
+ *
+ * Offsets are from the front of the queue. The scanner keeps its place in
+ * the chain, so finds moving forward, and peeks near the last match, cost
+ * nothing for the segments already passed. To resume a scan on the next
+ * read, keep the offset the last find stopped at (see getScanned()) and
+ * start the next scanner at it; it stays valid as long as the front of the
+ * queue isn't consumed.
+ *
+ * The queue must not change while a scanner is in use.
+ */
+class BufferScanner {
+ public:
+  explicit BufferScanner(const folly::IOBufQueue& buf, uint64_t from = 0);
+
+  uint64_t getLength() const {
+    return length_;
+  }
+
+  // The offset the next find starts at: past the last match or, if there
+  // was none, where the last find stopped
+  uint64_t getScanned() const {
+    return scanned_;
+  }
+
+  void setScanned(uint64_t offset) {
+    scanned_ = std::min(offset, length_);
+  }
+
+  // The offset of the next b before limit, or -1, in which case the next
+  // find starts at limit
+  int64_t find(uint8_t b, uint64_t limit = UINT64_MAX);
+
+  // The offset of the next of bytes before limit, or -1
+  int64_t findFirstOf(folly::StringPiece bytes, uint64_t limit = UINT64_MAX);
+
+  // Copies n bytes at offset to out; false if the queue ends first
+  bool peek(uint64_t offset, void* out, size_t n) const;
+
+  // Whether bytes are at offset
+  bool matches(uint64_t offset, folly::StringPiece bytes) const;
+
+  // The byte at offset, which must be within the queue
+  uint8_t byteAt(uint64_t offset) const;
+
+  // Fixed-size integers at offset, read in place unless they straddle
+  // segments; false if the queue ends first
+  template <class T>
+  bool peekBE(uint64_t offset, T& value) const {
+    if (!peek(offset, &value, sizeof(T))) {
+      return false;
+    }
+    value = folly::Endian::big(value);
+    return true;
+  }
+
+  template <class T>
+  bool peekLE(uint64_t offset, T& value) const {
+    if (!peek(offset, &value, sizeof(T))) {
+      return false;
+    }
+    value = folly::Endian::little(value);
+    return true;
+  }
+
+ private:
+  // A segment of the chain, and the offset it starts at
+  struct Position {
+    const folly::IOBuf* seg{nullptr};
+    uint64_t start{0};
+  };
+
+  // Moves pos to the segment holding offset, from wherever it is
+  void seek(Position& pos, uint64_t offset) const;
+
+  template <class Find>
+  int64_t scan(uint64_t limit, Find find);
+
+  const folly::IOBuf* front_;
+  uint64_t length_;
+  // Where the last find stopped
+  Position pos_;
+  uint64_t scanned_;
+};
+
+} // namespace wangle
@@ -10,6 +10,9 @@
 
 #pragma once
 
+#include <vector>
+
+#include <folly/Range.h>
 #include <wangle/channel/Handler.h>
 
 namespace wangle {
@@ -33,6 +36,13 @@ namespace wangle {
  *
  * To check for complete frames without modify the reader index, use
  * IOBufQueue.front(), without split() or pop_front().
+ *
+ * Batching
+ *
+ * By default every decoded message is passed on with its own fireRead().
+ * After setMaxBatchSize(n), all the messages decoded from one read() are
+ * collected and passed on with fireReadBatch(), at most n at a time, so
+ * handlers overriding readBatch() process them in a single pass.
  */
 template <typename M>
 class ByteToMessageDecoder : public InboundHandler<folly::IOBufQueue&, M> {
@@ -42,22 +52,73 @@ class ByteToMessageDecoder : public InboundHandler<folly::IOBufQueue&, M> {
   /**
    * Decode bytes from buf into result.
    *
+   * If buf has insufficient bytes and the decoder knows how many more it
+   * needs (e.g. the rest of a frame whose header was read), it should set
+   * needed to that count. decode() is then not called again until that many
+   * bytes have arrived, and the transport is told to read at least that much.
+   *
    * @return bool - Return true if decoding is successful, false if buf
    *                has insufficient bytes.
    */
   virtual bool decode(Context* ctx, folly::IOBufQueue& buf, M& result, size_t&) = 0;
 
+  // 0 (the default) disables batching
+  void setMaxBatchSize(size_t n) {
+    maxBatchSize_ = n;
+  }
+
   void read(Context* ctx, folly::IOBufQueue& q) override {
+    if (awaitedLength_ > 0) {
+      const auto len = q.chainLength();
+      // Unless the queue was emptied behind our back, there is nothing new
+      // to decode until it reaches the awaited length
+      if (len >= queuedLength_ && len < awaitedLength_) {
+        ctx->getPipeline()->setReadBytesNeeded(awaitedLength_ - len);
+        return;
+      }
+    }
+
     bool success = true;
+    size_t needed = 0;
     do {
       M result;
-      size_t needed = 0;
+      needed = 0;
       success = decode(ctx, q, result, needed);
-      if (success) {
+      if (success && maxBatchSize_ == 0) {
         ctx->fireRead(std::move(result));
+      } else if (success) {
+        batch_.push_back(std::move(result));
+        if (batch_.size() >= maxBatchSize_) {
+          fireBatch(ctx);
+        }
       }
     } while (success);
+    if (!batch_.empty()) {
+      fireBatch(ctx);
+    }
+    queuedLength_ = needed > 0 ? q.chainLength() : 0;
+    awaitedLength_ = queuedLength_ + needed;
+    ctx->getPipeline()->setReadBytesNeeded(needed);
+  }
+
+ private:
+  void fireBatch(Context* ctx) {
+    if (batch_.size() == 1) {
+      ctx->fireRead(std::move(batch_.front()));
+    } else {
+      ctx->fireReadBatch(folly::range(batch_));
+    }
+    batch_.clear();
   }
+
+  size_t maxBatchSize_{0};
+  // Decoded messages not passed on yet, kept to reuse its storage
+  std::vector<M> batch_;
+
+  // Queue length when decode() last failed, and the length it said it needs
+  // (0 if unknown)
+  uint64_t queuedLength_{0};
+  uint64_t awaitedLength_{0};
 };
 
 typedef ByteToMessageDecoder<std::unique_ptr<folly::IOBuf>> ByteToByteDecoder;
@@ -0,0 +1,259 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <folly/Benchmark.h>
+#include <gflags/gflags.h>
+#include <wangle/channel/Pipeline.h>
+#include <wangle/codec/FixedLengthFrameDecoder.h>
+#include <wangle/codec/LengthFieldBasedFrameDecoder.h>
+#include <wangle/codec/LengthFieldPrepender.h>
+#include <wangle/codec/LineBasedFrameDecoder.h>
+#include <wangle/codec/StringCodec.h>
+
+using namespace wangle;
+using folly::BenchmarkSuspender;
+using folly::IOBuf;
+using folly::IOBufQueue;
+
+namespace {
+
+// Every iteration decodes this much data
+constexpr size_t kStreamLength = 64 * 1024;
+constexpr size_t kMtu = 1460;
+
+enum class Framing {
+  LINE,
+  LENGTH_FIELD,
+  FIXED_LENGTH,
+};
+
+class FrameSink : public InboundHandler<std::unique_ptr<IOBuf>> {
+ public:
+  void read(Context*, std::unique_ptr<IOBuf>) override {
+    frames++;
+  }
+
+  size_t frames{0};
+};
+
+class BytesSink : public OutboundBytesToBytesHandler {
+ public:
+  folly::Future<folly::Unit> write(
+      Context*,
+      std::unique_ptr<IOBuf> buf) override {
+    bytes += buf->computeChainDataLength();
+    return folly::makeFuture();
+  }
+
+  size_t bytes{0};
+};
+
+class StringSink : public InboundHandler<std::string> {
+ public:
+  void read(Context*, std::string msg) override {
+    bytes += msg.size();
+  }
+
+  size_t bytes{0};
+};
+
+std::string makeStream(Framing framing, size_t frameLength) {
+  std::string frame;
+  switch (framing) {
+    case Framing::LINE:
+      frame = std::string(frameLength - 1, 'x') + "\n";
+      break;
+    case Framing::LENGTH_FIELD: {
+      const uint32_t length = frameLength - 4;
+      for (int shift = 24; shift >= 0; shift -= 8) {
+        frame.push_back(static_cast<char>(length >> shift));
+      }
+      frame += std::string(length, 'x');
+      break;
+    }
+    case Framing::FIXED_LENGTH:
+      frame = std::string(frameLength, 'x');
+      break;
+  }
+  std::string stream;
+  while (stream.size() + frame.size() <= kStreamLength) {
+    stream += frame;
+  }
+  return stream;
+}
+
+// Splits data into reads of readLength, each made of chainLength IOBufs
+std::vector<std::unique_ptr<IOBuf>> makeReads(
+    const std::string& data,
+    size_t readLength,
+    size_t chainLength = 1) {
+  std::vector<std::unique_ptr<IOBuf>> reads;
+  for (size_t pos = 0; pos < data.size(); pos += readLength) {
+    auto read = std::min(readLength, data.size() - pos);
+    auto segmentLength = std::max<size_t>(read / chainLength, 1);
+    std::unique_ptr<IOBuf> chain;
+    for (size_t seg = pos; seg < pos + read; seg += segmentLength) {
+      auto buf = IOBuf::copyBuffer(
+        data.data() + seg, std::min(segmentLength, pos + read - seg));
+      if (chain) {
+        chain->prependChain(std::move(buf));
+      } else {
+        chain = std::move(buf);
+      }
+    }
+    reads.push_back(std::move(chain));
+  }
+  return reads;
+}
+
+void decode(size_t iters, Framing framing, size_t frameLength,
+            size_t readLength) {
+  BenchmarkSuspender braces;
+  auto pipeline = Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>>::create();
+  switch (framing) {
+    case Framing::LINE:
+      pipeline->addBack(LineBasedFrameDecoder(frameLength));
+      break;
+    case Framing::LENGTH_FIELD:
+      pipeline->addBack(LengthFieldBasedFrameDecoder());
+      break;
+    case Framing::FIXED_LENGTH:
+      pipeline->addBack(FixedLengthFrameDecoder(frameLength));
+      break;
+  }
+  FrameSink sink;
+  pipeline->addBack(&sink);
+  pipeline->finalize();
+  auto reads = makeReads(makeStream(framing, frameLength), readLength);
+  IOBufQueue q(IOBufQueue::cacheChainLength());
+
+  braces.dismissing([&] {
+    while (iters--) {
+      for (auto& read : reads) {
+        q.append(read->clone());
+        pipeline->read(q);
+      }
+    }
+  });
+  folly::doNotOptimizeAway(sink.frames);
+}
+
+void prepend(size_t iters, size_t frameLength, size_t chainLength) {
+  BenchmarkSuspender braces;
+  auto pipeline = Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>>::create();
+  BytesSink sink;
+  (*pipeline)
+    .addBack(&sink)
+    .addBack(LengthFieldPrepender())
+    .finalize();
+  auto msg = std::move(
+    makeReads(std::string(frameLength, 'x'), frameLength, chainLength)[0]);
+
+  braces.dismissing([&] {
+    while (iters--) {
+      pipeline->write(msg->clone());
+    }
+  });
+  folly::doNotOptimizeAway(sink.bytes);
+}
+
+void stringRead(size_t iters, size_t frameLength, size_t chainLength) {
+  BenchmarkSuspender braces;
+  auto pipeline = Pipeline<std::unique_ptr<IOBuf>, std::string>::create();
+  StringSink sink;
+  (*pipeline)
+    .addBack(StringCodec())
+    .addBack(&sink)
+    .finalize();
+  auto msg = std::move(
+    makeReads(std::string(frameLength, 'x'), frameLength, chainLength)[0]);
+
+  braces.dismissing([&] {
+    while (iters--) {
+      pipeline->read(msg->clone());
+    }
+  });
+  folly::doNotOptimizeAway(sink.bytes);
+}
+
+void stringWrite(size_t iters, size_t frameLength) {
+  BenchmarkSuspender braces;
+  auto pipeline = Pipeline<std::unique_ptr<IOBuf>, std::string>::create();
+  class IOBufSink : public OutboundHandler<std::unique_ptr<IOBuf>> {
+   public:
+    folly::Future<folly::Unit> write(
+        Context*,
+        std::unique_ptr<IOBuf> buf) override {
+      bytes += buf->length();
+      return folly::makeFuture();
+    }
+
+    size_t bytes{0};
+  } sink;
+  (*pipeline)
+    .addBack(&sink)
+    .addBack(StringCodec())
+    .finalize();
+  const std::string msg(frameLength, 'x');
+
+  braces.dismissing([&] {
+    while (iters--) {
+      pipeline->write(msg);
+    }
+  });
+  folly::doNotOptimizeAway(sink.bytes);
+}
+
+}
+
+BENCHMARK_NAMED_PARAM(decode, line_64_1, Framing::LINE, 64, 1)
+BENCHMARK_NAMED_PARAM(decode, line_64_mtu, Framing::LINE, 64, kMtu)
+BENCHMARK_NAMED_PARAM(decode, line_64_64k, Framing::LINE, 64, 65536)
+BENCHMARK_NAMED_PARAM(decode, line_4k_1, Framing::LINE, 4096, 1)
+BENCHMARK_NAMED_PARAM(decode, line_4k_mtu, Framing::LINE, 4096, kMtu)
+BENCHMARK_NAMED_PARAM(decode, line_4k_64k, Framing::LINE, 4096, 65536)
+
+BENCHMARK_DRAW_LINE()
+
+BENCHMARK_NAMED_PARAM(decode, length_64_1, Framing::LENGTH_FIELD, 64, 1)
+BENCHMARK_NAMED_PARAM(decode, length_64_mtu, Framing::LENGTH_FIELD, 64, kMtu)
+BENCHMARK_NAMED_PARAM(decode, length_64_64k, Framing::LENGTH_FIELD, 64, 65536)
+BENCHMARK_NAMED_PARAM(decode, length_4k_1, Framing::LENGTH_FIELD, 4096, 1)
+BENCHMARK_NAMED_PARAM(decode, length_4k_mtu, Framing::LENGTH_FIELD, 4096, kMtu)
+BENCHMARK_NAMED_PARAM(decode, length_4k_64k, Framing::LENGTH_FIELD, 4096, 65536)
+
+BENCHMARK_DRAW_LINE()
+
+BENCHMARK_NAMED_PARAM(decode, fixed_64_1, Framing::FIXED_LENGTH, 64, 1)
+BENCHMARK_NAMED_PARAM(decode, fixed_64_mtu, Framing::FIXED_LENGTH, 64, kMtu)
+BENCHMARK_NAMED_PARAM(decode, fixed_64_64k, Framing::FIXED_LENGTH, 64, 65536)
+BENCHMARK_NAMED_PARAM(decode, fixed_4k_1, Framing::FIXED_LENGTH, 4096, 1)
+BENCHMARK_NAMED_PARAM(decode, fixed_4k_mtu, Framing::FIXED_LENGTH, 4096, kMtu)
+BENCHMARK_NAMED_PARAM(decode, fixed_4k_64k, Framing::FIXED_LENGTH, 4096, 65536)
+
+BENCHMARK_DRAW_LINE()
+
+BENCHMARK_NAMED_PARAM(prepend, 64_chain1, 64, 1)
+BENCHMARK_NAMED_PARAM(prepend, 64k_chain1, 65536, 1)
+BENCHMARK_NAMED_PARAM(prepend, 64k_chain16, 65536, 16)
+
+BENCHMARK_DRAW_LINE()
+
+BENCHMARK_NAMED_PARAM(stringRead, 64_chain1, 64, 1)
+BENCHMARK_NAMED_PARAM(stringRead, 64k_chain1, 65536, 1)
+BENCHMARK_NAMED_PARAM(stringRead, 64k_chain16, 65536, 16)
+BENCHMARK_NAMED_PARAM(stringWrite, 64, 64)
+BENCHMARK_NAMED_PARAM(stringWrite, 64k, 65536)
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  folly::runBenchmarks();
+  return 0;
+}
@@ -10,10 +10,19 @@
 
 #include <gtest/gtest.h>
 
+#include <wangle/codec/CompressionHandler.h>
+#include <wangle/codec/Crc32cFrameCodec.h>
+#include <wangle/codec/DelimiterBasedFrameDecoder.h>
 #include <wangle/codec/FixedLengthFrameDecoder.h>
+#include <wangle/codec/LengthFieldBasedChunkDecoder.h>
 #include <wangle/codec/LengthFieldBasedFrameDecoder.h>
 #include <wangle/codec/LengthFieldPrepender.h>
 #include <wangle/codec/LineBasedFrameDecoder.h>
+#include <wangle/codec/SerializeHandler.h>
+#include <wangle/codec/StaticLengthFieldBasedFrameDecoder.h>
+#include <wangle/codec/StringViewCodec.h>
+#include <wangle/codec/VarintFrameDecoder.h>
+#include <wangle/codec/VarintLengthFieldPrepender.h>
 
 using namespace folly;
 using namespace wangle;
@@ -48,6 +57,50 @@ class BytesReflector
   }
 };
 
+class BatchTester
+    : public InboundHandler<std::unique_ptr<IOBuf>> {
+ public:
+  void read(Context* ctx, std::unique_ptr<IOBuf> buf) override {
+    reads++;
+    frames++;
+  }
+
+  void readBatch(Context* ctx,
+                 MessageBatch<std::unique_ptr<IOBuf>> bufs) override {
+    batches++;
+    frames += bufs.size();
+  }
+
+  int reads{0};
+  int batches{0};
+  int frames{0};
+};
+
+TEST(FixedLengthFrameDecoder, Batch) {
+  auto pipeline = Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>>::create();
+  FixedLengthFrameDecoder decoder(3);
+  decoder.setMaxBatchSize(4);
+  BatchTester tester;
+
+  (*pipeline)
+    .addBack(&decoder)
+    .addBack(&tester)
+    .finalize();
+
+  IOBufQueue q(IOBufQueue::cacheChainLength());
+
+  // Frames decoded by one read come in batches of at most 4, and a lone one
+  // in a regular read()
+  auto buf = IOBuf::create(28);
+  buf->append(28);
+  q.append(std::move(buf));
+  pipeline->read(q);
+  EXPECT_EQ(2, tester.batches);
+  EXPECT_EQ(1, tester.reads);
+  EXPECT_EQ(9, tester.frames);
+  EXPECT_EQ(1, q.chainLength());
+}
+
 TEST(FixedLengthFrameDecoder, FailWhenLengthFieldEndOffset) {
   auto pipeline = Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>>::create();
   int called = 0;
@@ -125,6 +178,53 @@ TEST(LengthFieldFramePipeline, LittleEndian) {
   EXPECT_EQ(called, 1);
 }
 
+class BytesCapture
+    : public BytesToBytesHandler {
+ public:
+  Future<Unit> write(Context* ctx, std::unique_ptr<IOBuf> buf) override {
+    written = std::move(buf);
+    return makeFuture();
+  }
+
+  std::unique_ptr<IOBuf> written;
+};
+
+TEST(LengthFieldPrepender, Headroom) {
+  auto pipeline = Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>>::create();
+  BytesCapture capture;
+
+  (*pipeline)
+    .addBack(&capture)
+    .addBack(LengthFieldPrepender())
+    .finalize();
+
+  // Written into the headroom when there is enough
+  auto buf = IOBuf::create(10);
+  buf->advance(4);
+  buf->append(2);
+  pipeline->write(std::move(buf));
+  ASSERT_NE(nullptr, capture.written);
+  EXPECT_FALSE(capture.written->isChained());
+  EXPECT_EQ(6, capture.written->length());
+  EXPECT_EQ(2, Cursor(capture.written.get()).readBE<uint32_t>());
+
+  // Otherwise chained in front
+  buf = IOBuf::create(2);
+  buf->append(2);
+  pipeline->write(std::move(buf));
+  EXPECT_EQ(2, capture.written->countChainElements());
+  EXPECT_EQ(2, Cursor(capture.written.get()).readBE<uint32_t>());
+
+  // Shared buffers are left alone
+  buf = IOBuf::create(10);
+  buf->advance(4);
+  buf->append(2);
+  auto clone = buf->clone();
+  pipeline->write(std::move(buf));
+  EXPECT_EQ(2, capture.written->countChainElements());
+  EXPECT_EQ(4, clone->headroom());
+}
+
 TEST(LengthFieldFrameDecoder, Simple) {
   auto pipeline = Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>>::create();
   int called = 0;
@@ -348,6 +448,223 @@ TEST(LengthFieldFrameDecoder, StripPrePostHeaderFrameInclHeader) {
   EXPECT_EQ(called, 1);
 }
 
+TEST(StaticLengthFieldFrameDecoder, StripPrePostHeader) {
+  auto pipeline = Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>>::create();
+  int called = 0;
+
+  (*pipeline)
+    .addBack(StaticLengthFieldBasedFrameDecoder<uint16_t, true, 2, 2, 4>(10))
+    .addBack(FrameTester([&](std::unique_ptr<IOBuf> buf) {
+        auto sz = buf->computeChainDataLength();
+        called++;
+        EXPECT_EQ(sz, 3);
+      }))
+    .finalize();
+
+  auto bufFrame = IOBuf::create(6);
+  bufFrame->append(6);
+  RWPrivateCursor c(bufFrame.get());
+  c.write((uint16_t)100); // pre header
+  c.writeBE((uint16_t)1); // frame size
+  c.write((uint16_t)100); // post header
+  auto bufData = IOBuf::create(1);
+  bufData->append(1);
+
+  IOBufQueue q(IOBufQueue::cacheChainLength());
+
+  q.append(std::move(bufFrame));
+  pipeline->read(q);
+  EXPECT_EQ(called, 0);
+
+  q.append(std::move(bufData));
+  pipeline->read(q);
+  EXPECT_EQ(called, 1);
+}
+
+TEST(StaticLengthFieldFrameDecoder, SplitLittleEndianHeader) {
+  auto pipeline = Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>>::create();
+  int called = 0;
+
+  (*pipeline)
+    .addBack(StaticLengthFieldBasedFrameDecoder<uint32_t, false>())
+    .addBack(FrameTester([&](std::unique_ptr<IOBuf> buf) {
+        auto sz = buf->computeChainDataLength();
+        called++;
+        EXPECT_EQ(sz, 2);
+      }))
+    .finalize();
+
+  auto bufFrame = IOBuf::create(4);
+  bufFrame->append(4);
+  RWPrivateCursor c(bufFrame.get());
+  c.writeLE((uint32_t)2);
+  auto bufTail = bufFrame->clone();
+  bufFrame->trimEnd(1);
+  bufTail->trimStart(3);
+  auto bufData = IOBuf::create(2);
+  bufData->append(2);
+
+  IOBufQueue q(IOBufQueue::cacheChainLength());
+
+  q.append(std::move(bufFrame));
+  pipeline->read(q);
+  EXPECT_EQ(called, 0);
+
+  q.append(std::move(bufTail));
+  q.append(std::move(bufData));
+  pipeline->read(q);
+  EXPECT_EQ(called, 1);
+}
+
+TEST(LengthFieldFrameDecoder, BytesNeeded) {
+  auto pipeline = Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>>::create();
+  int called = 0;
+
+  (*pipeline)
+    .addBack(LengthFieldBasedFrameDecoder())
+    .addBack(FrameTester([&](std::unique_ptr<IOBuf> buf) {
+        auto sz = buf->computeChainDataLength();
+        called++;
+        EXPECT_EQ(sz, 10);
+      }))
+    .finalize();
+
+  IOBufQueue q(IOBufQueue::cacheChainLength());
+
+  // Partial length field
+  auto buf = IOBuf::create(1);
+  buf->append(1);
+  RWPrivateCursor c(buf.get());
+  c.write<uint8_t>(0);
+  q.append(std::move(buf));
+  pipeline->read(q);
+  EXPECT_EQ(3, pipeline->getReadBytesNeeded());
+
+  // Rest of the length field and part of the frame
+  buf = IOBuf::create(7);
+  buf->append(7);
+  RWPrivateCursor c1(buf.get());
+  c1.writeBE<uint16_t>(0);
+  c1.write<uint8_t>(10);
+  q.append(std::move(buf));
+  pipeline->read(q);
+  EXPECT_EQ(6, pipeline->getReadBytesNeeded());
+
+  buf = IOBuf::create(5);
+  buf->append(5);
+  q.append(std::move(buf));
+  pipeline->read(q);
+  EXPECT_EQ(1, pipeline->getReadBytesNeeded());
+  EXPECT_EQ(called, 0);
+
+  buf = IOBuf::create(1);
+  buf->append(1);
+  q.append(std::move(buf));
+  pipeline->read(q);
+  EXPECT_EQ(0, pipeline->getReadBytesNeeded());
+  EXPECT_EQ(called, 1);
+}
+
+class ChunkTester : public InboundHandler<FrameChunk> {
+ public:
+  void read(Context* ctx, FrameChunk chunk) override {
+    chunks.push_back(std::move(chunk));
+  }
+
+  void readException(Context* ctx, exception_wrapper w) override {
+    exceptions++;
+  }
+
+  std::vector<FrameChunk> chunks;
+  int exceptions{0};
+};
+
+TEST(LengthFieldChunkDecoder, Streaming) {
+  auto pipeline = Pipeline<IOBufQueue&, FrameChunk>::create();
+  ChunkTester tester;
+
+  (*pipeline)
+    .addBack(LengthFieldBasedChunkDecoder())
+    .addBack(&tester)
+    .finalize();
+
+  IOBufQueue q(IOBufQueue::cacheChainLength());
+
+  // The first chunk comes with the length field
+  auto buf = IOBuf::create(4);
+  buf->append(4);
+  RWPrivateCursor c(buf.get());
+  c.writeBE<uint32_t>(10);
+  q.append(std::move(buf));
+  pipeline->read(q);
+  ASSERT_EQ(1, tester.chunks.size());
+  EXPECT_TRUE(tester.chunks[0].first);
+  EXPECT_FALSE(tester.chunks[0].isLast());
+  EXPECT_EQ(10, tester.chunks[0].frameLength);
+  EXPECT_EQ(0, tester.chunks[0].data->computeChainDataLength());
+
+  // Followed by the body as it arrives
+  buf = IOBuf::create(6);
+  buf->append(6);
+  q.append(std::move(buf));
+  pipeline->read(q);
+  ASSERT_EQ(2, tester.chunks.size());
+  EXPECT_FALSE(tester.chunks[1].first);
+  EXPECT_EQ(0, tester.chunks[1].offset);
+  EXPECT_EQ(6, tester.chunks[1].data->computeChainDataLength());
+  EXPECT_EQ(0, q.chainLength());
+
+  // The end of the frame and the whole of the next one in one read
+  buf = IOBuf::create(12);
+  buf->append(12);
+  RWPrivateCursor c1(buf.get());
+  c1.skip(4);
+  c1.writeBE<uint32_t>(4);
+  q.append(std::move(buf));
+  pipeline->read(q);
+  ASSERT_EQ(4, tester.chunks.size());
+  EXPECT_EQ(6, tester.chunks[2].offset);
+  EXPECT_TRUE(tester.chunks[2].isLast());
+  EXPECT_TRUE(tester.chunks[3].first);
+  EXPECT_TRUE(tester.chunks[3].isLast());
+  EXPECT_EQ(4, tester.chunks[3].frameLength);
+  EXPECT_EQ(0, tester.exceptions);
+}
+
+TEST(LengthFieldChunkDecoder, FailFrameTooLarge) {
+  auto pipeline = Pipeline<IOBufQueue&, FrameChunk>::create();
+  ChunkTester tester;
+
+  (*pipeline)
+    .addBack(LengthFieldBasedChunkDecoder(4, 10))
+    .addBack(&tester)
+    .finalize();
+
+  IOBufQueue q(IOBufQueue::cacheChainLength());
+
+  // Skipped as it arrives, then decoding goes on with the next frame
+  auto buf = IOBuf::create(8);
+  buf->append(8);
+  RWPrivateCursor c(buf.get());
+  c.writeBE<uint32_t>(20);
+  q.append(std::move(buf));
+  pipeline->read(q);
+  EXPECT_EQ(1, tester.exceptions);
+  EXPECT_EQ(0, q.chainLength());
+
+  buf = IOBuf::create(22);
+  buf->append(22);
+  RWPrivateCursor c1(buf.get());
+  c1.skip(16);
+  c1.writeBE<uint32_t>(2);
+  q.append(std::move(buf));
+  pipeline->read(q);
+  EXPECT_EQ(1, tester.exceptions);
+  ASSERT_EQ(1, tester.chunks.size());
+  EXPECT_EQ(2, tester.chunks[0].frameLength);
+  EXPECT_TRUE(tester.chunks[0].isLast());
+}
+
 TEST(LengthFieldFrameDecoder, FailTestLengthFieldEndOffset) {
   auto pipeline = Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>>::create();
   int called = 0;
@@ -629,3 +946,560 @@ TEST(LineBasedFrameDecoder, CarriageNewLineOnly) {
   pipeline->read(q);
   EXPECT_EQ(called, 1);
 }
+
+TEST(LineBasedFrameDecoder, ByteAtATime) {
+  auto pipeline = Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>>::create();
+  std::vector<std::string> lines;
+
+  (*pipeline)
+    .addBack(LineBasedFrameDecoder(10))
+    .addBack(FrameTester([&](std::unique_ptr<IOBuf> buf) {
+        ASSERT_NE(nullptr, buf);
+        lines.push_back(buf->moveToFbString().toStdString());
+      }))
+    .finalize();
+
+  // Terminators split across reads are still found when the search resumes
+  IOBufQueue q(IOBufQueue::cacheChainLength());
+  for (char b : std::string("ab\r\ncd\nefg\r\n\r\n")) {
+    q.append(IOBuf::copyBuffer(&b, 1));
+    pipeline->read(q);
+  }
+  ASSERT_EQ(4, lines.size());
+  EXPECT_EQ("ab", lines[0]);
+  EXPECT_EQ("cd", lines[1]);
+  EXPECT_EQ("efg", lines[2]);
+  EXPECT_EQ("", lines[3]);
+  EXPECT_EQ(0, q.chainLength());
+}
+
+TEST(LineBasedFrameDecoder, ResumeAfterFail) {
+  auto pipeline = Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>>::create();
+  int failed = 0;
+  std::vector<std::string> lines;
+
+  (*pipeline)
+    .addBack(LineBasedFrameDecoder(4))
+    .addBack(FrameTester([&](std::unique_ptr<IOBuf> buf) {
+        if (!buf) {
+          failed++;
+        } else {
+          lines.push_back(buf->moveToFbString().toStdString());
+        }
+      }))
+    .finalize();
+
+  // The over-long line is discarded up to its terminator, and the search
+  // for the next one starts over
+  IOBufQueue q(IOBufQueue::cacheChainLength());
+  q.append(IOBuf::copyBuffer("abc"));
+  pipeline->read(q);
+  q.append(IOBuf::copyBuffer("defg"));
+  pipeline->read(q);
+  EXPECT_EQ(1, failed);
+  q.append(IOBuf::copyBuffer("h\nij"));
+  pipeline->read(q);
+  q.append(IOBuf::copyBuffer("\n"));
+  pipeline->read(q);
+  EXPECT_EQ(1, failed);
+  ASSERT_EQ(1, lines.size());
+  EXPECT_EQ("ij", lines[0]);
+}
+
+TEST(BufferScanner, AcrossSegments) {
+  IOBufQueue q(IOBufQueue::cacheChainLength());
+  q.append(IOBuf::copyBuffer("abc"));
+  q.append(IOBuf::create(0));
+  q.append(IOBuf::copyBuffer("d\x01"));
+  q.append(IOBuf::copyBuffer("\x02\x03\x04xyz\n"));
+
+  BufferScanner scanner(q);
+  EXPECT_EQ(12, scanner.getLength());
+  EXPECT_EQ(3, scanner.find('d'));
+  EXPECT_EQ(-1, scanner.find('d'));
+  EXPECT_EQ(12, scanner.getScanned());
+
+  BufferScanner any(q, 1);
+  EXPECT_EQ(2, any.findFirstOf("zc"));
+  EXPECT_EQ(10, any.findFirstOf("zc"));
+  EXPECT_EQ(-1, any.findFirstOf("a\n", 11));
+  EXPECT_EQ(11, any.getScanned());
+  EXPECT_EQ(11, any.findFirstOf("a\n"));
+
+  uint32_t value = 0;
+  EXPECT_TRUE(any.peekBE(4, value));
+  EXPECT_EQ(0x01020304, value);
+  EXPECT_TRUE(any.peekLE(4, value));
+  EXPECT_EQ(0x04030201, value);
+  EXPECT_FALSE(any.peekBE(9, value));
+  EXPECT_TRUE(any.matches(2, "cd"));
+  EXPECT_FALSE(any.matches(2, "ce"));
+  EXPECT_FALSE(any.matches(11, "\n\n"));
+  EXPECT_EQ('a', any.byteAt(0));
+}
+
+TEST(BufferScanner, Empty) {
+  IOBufQueue q(IOBufQueue::cacheChainLength());
+  BufferScanner scanner(q, 5);
+  EXPECT_EQ(0, scanner.getScanned());
+  EXPECT_EQ(-1, scanner.find('a'));
+  uint8_t b;
+  EXPECT_FALSE(scanner.peekBE(0, b));
+}
+
+TEST(DelimiterBasedFrameDecoder, MultipleDelimiters) {
+  auto pipeline = Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>>::create();
+  std::vector<std::string> frames;
+
+  (*pipeline)
+    .addBack(DelimiterBasedFrameDecoder(10, {"\r\n", std::string(1, '\0')}))
+    .addBack(FrameTester([&](std::unique_ptr<IOBuf> buf) {
+        ASSERT_NE(nullptr, buf);
+        frames.push_back(buf->moveToFbString().toStdString());
+      }))
+    .finalize();
+
+  IOBufQueue q(IOBufQueue::cacheChainLength());
+  q.append(IOBuf::copyBuffer(std::string("ab\0cd\r", 6)));
+  pipeline->read(q);
+  ASSERT_EQ(1, frames.size());
+  EXPECT_EQ("ab", frames[0]);
+
+  // A delimiter split across buffers is matched when the rest arrives
+  q.append(IOBuf::copyBuffer("\nef"));
+  pipeline->read(q);
+  ASSERT_EQ(2, frames.size());
+  EXPECT_EQ("cd", frames[1]);
+  EXPECT_EQ(2, q.chainLength());
+}
+
+TEST(DelimiterBasedFrameDecoder, SaveDelimiter) {
+  auto pipeline = Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>>::create();
+  std::vector<std::string> frames;
+
+  (*pipeline)
+    .addBack(DelimiterBasedFrameDecoder(10, {"||", "|"}, false))
+    .addBack(FrameTester([&](std::unique_ptr<IOBuf> buf) {
+        ASSERT_NE(nullptr, buf);
+        frames.push_back(buf->moveToFbString().toStdString());
+      }))
+    .finalize();
+
+  // The first delimiter listed wins when several match at the same offset
+  IOBufQueue q(IOBufQueue::cacheChainLength());
+  q.append(IOBuf::copyBuffer("a||b|"));
+  pipeline->read(q);
+  ASSERT_EQ(2, frames.size());
+  EXPECT_EQ("a||", frames[0]);
+  EXPECT_EQ("b|", frames[1]);
+}
+
+TEST(DelimiterBasedFrameDecoder, Fail) {
+  auto pipeline = Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>>::create();
+  int failed = 0;
+  std::vector<std::string> frames;
+
+  (*pipeline)
+    .addBack(DelimiterBasedFrameDecoder(4, {"\n"}))
+    .addBack(FrameTester([&](std::unique_ptr<IOBuf> buf) {
+        if (!buf) {
+          failed++;
+        } else {
+          frames.push_back(buf->moveToFbString().toStdString());
+        }
+      }))
+    .finalize();
+
+  // The over-long frame is discarded up to its delimiter
+  IOBufQueue q(IOBufQueue::cacheChainLength());
+  q.append(IOBuf::copyBuffer("abcdefg"));
+  pipeline->read(q);
+  EXPECT_EQ(1, failed);
+  q.append(IOBuf::copyBuffer("h\nij\n"));
+  pipeline->read(q);
+  q.append(IOBuf::copyBuffer("kl\n"));
+  pipeline->read(q);
+  EXPECT_EQ(1, failed);
+  ASSERT_EQ(2, frames.size());
+  EXPECT_EQ("ij", frames[0]);
+  EXPECT_EQ("kl", frames[1]);
+}
+
+TEST(VarintFramePipeline, RoundTrip) {
+  auto pipeline = Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>>::create();
+  std::vector<size_t> sizes;
+
+  (*pipeline)
+    .addBack(BytesReflector())
+    .addBack(VarintLengthFieldPrepender())
+    .addBack(VarintFrameDecoder())
+    .addBack(FrameTester([&](std::unique_ptr<IOBuf> buf) {
+        ASSERT_NE(nullptr, buf);
+        sizes.push_back(buf->computeChainDataLength());
+      }))
+    .finalize();
+
+  for (size_t size : {0, 1, 127, 128, 300, 20000}) {
+    auto buf = IOBuf::create(size);
+    buf->append(size);
+    pipeline->write(std::move(buf));
+  }
+  EXPECT_EQ((std::vector<size_t>{0, 1, 127, 128, 300, 20000}), sizes);
+}
+
+TEST(Crc32cFramePipeline, RoundTrip) {
+  auto pipeline = Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>>::create();
+  std::vector<std::string> received;
+
+  (*pipeline)
+    .addBack(BytesReflector())
+    .addBack(Crc32cFramePrepender())
+    .addBack(Crc32cFrameDecoder())
+    .addBack(FrameTester([&](std::unique_ptr<IOBuf> buf) {
+        ASSERT_NE(nullptr, buf);
+        received.push_back(buf->moveToFbString().toStdString());
+      }))
+    .finalize();
+
+  pipeline->write(IOBuf::create(0));
+  auto chain = IOBuf::copyBuffer("hello, ");
+  chain->prependChain(IOBuf::copyBuffer("world", 0, 4));
+  pipeline->write(std::move(chain));
+
+  ASSERT_EQ(2, received.size());
+  EXPECT_EQ("", received[0]);
+  EXPECT_EQ("hello, world", received[1]);
+}
+
+TEST(Crc32cFrameDecoder, Corrupted) {
+  auto pipeline = Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>>::create();
+  BytesCapture capture;
+  int called = 0;
+  int failed = 0;
+
+  (*pipeline)
+    .addBack(&capture)
+    .addBack(Crc32cFramePrepender())
+    .addBack(Crc32cFrameDecoder())
+    .addBack(FrameTester([&](std::unique_ptr<IOBuf> buf) {
+        if (buf) {
+          called++;
+        } else {
+          failed++;
+        }
+      }))
+    .finalize();
+
+  pipeline->write(IOBuf::copyBuffer("hello, world"));
+  auto encoded = std::move(capture.written);
+  ASSERT_NE(nullptr, encoded);
+  encoded->coalesce();
+  EXPECT_EQ(4 + 12 + 4, encoded->length());
+
+  auto corrupted = encoded->clone();
+  corrupted->unshare();
+  corrupted->writableData()[6] ^= 1;
+
+  IOBufQueue q(IOBufQueue::cacheChainLength());
+  q.append(std::move(encoded));
+  pipeline->read(q);
+  q.append(std::move(corrupted));
+  pipeline->read(q);
+  EXPECT_EQ(1, called);
+  EXPECT_EQ(1, failed);
+}
+
+TEST(VarintLengthFieldPrepender, Encoding) {
+  auto pipeline = Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>>::create();
+  BytesCapture capture;
+
+  (*pipeline)
+    .addBack(&capture)
+    .addBack(VarintLengthFieldPrepender())
+    .finalize();
+
+  // 300 takes two bytes, written into the headroom
+  auto buf = IOBuf::create(310);
+  buf->advance(10);
+  buf->append(300);
+  pipeline->write(std::move(buf));
+  ASSERT_NE(nullptr, capture.written);
+  EXPECT_FALSE(capture.written->isChained());
+  Cursor c(capture.written.get());
+  EXPECT_EQ(0xac, c.read<uint8_t>());
+  EXPECT_EQ(0x02, c.read<uint8_t>());
+}
+
+TEST(VarintFrameDecoder, SplitLengthField) {
+  auto pipeline = Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>>::create();
+  int called = 0;
+
+  (*pipeline)
+    .addBack(VarintFrameDecoder())
+    .addBack(FrameTester([&](std::unique_ptr<IOBuf> buf) {
+        auto sz = buf->computeChainDataLength();
+        called++;
+        EXPECT_EQ(sz, 300);
+      }))
+    .finalize();
+
+  IOBufQueue q(IOBufQueue::cacheChainLength());
+
+  auto buf = IOBuf::create(1);
+  buf->append(1);
+  RWPrivateCursor c(buf.get());
+  c.write<uint8_t>(0xac);
+  q.append(std::move(buf));
+  pipeline->read(q);
+  EXPECT_EQ(called, 0);
+
+  buf = IOBuf::create(1);
+  buf->append(1);
+  RWPrivateCursor c1(buf.get());
+  c1.write<uint8_t>(0x02);
+  q.append(std::move(buf));
+  pipeline->read(q);
+  EXPECT_EQ(300, pipeline->getReadBytesNeeded());
+
+  buf = IOBuf::create(300);
+  buf->append(300);
+  q.append(std::move(buf));
+  pipeline->read(q);
+  EXPECT_EQ(called, 1);
+  EXPECT_EQ(0, q.chainLength());
+}
+
+TEST(VarintFrameDecoder, FailFrameTooLarge) {
+  auto pipeline = Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>>::create();
+  int failed = 0;
+  std::vector<std::string> frames;
+
+  (*pipeline)
+    .addBack(VarintFrameDecoder(10))
+    .addBack(FrameTester([&](std::unique_ptr<IOBuf> buf) {
+        if (!buf) {
+          failed++;
+        } else {
+          frames.push_back(buf->moveToFbString().toStdString());
+        }
+      }))
+    .finalize();
+
+  // The oversized frame is skipped as it arrives
+  IOBufQueue q(IOBufQueue::cacheChainLength());
+  q.append(IOBuf::copyBuffer(std::string("\x14") + std::string(5, 'x')));
+  pipeline->read(q);
+  EXPECT_EQ(1, failed);
+  EXPECT_EQ(0, q.chainLength());
+
+  q.append(IOBuf::copyBuffer(std::string(15, 'x') + "\x02hi"));
+  pipeline->read(q);
+  EXPECT_EQ(1, failed);
+  ASSERT_EQ(1, frames.size());
+  EXPECT_EQ("hi", frames[0]);
+}
+
+TEST(VarintFrameDecoder, FailMalformed) {
+  auto pipeline = Pipeline<IOBufQueue&, std::unique_ptr<IOBuf>>::create();
+  int failed = 0;
+
+  (*pipeline)
+    .addBack(VarintFrameDecoder())
+    .addBack(FrameTester([&](std::unique_ptr<IOBuf> buf) {
+        ASSERT_EQ(nullptr, buf);
+        failed++;
+      }))
+    .finalize();
+
+  IOBufQueue q(IOBufQueue::cacheChainLength());
+  q.append(IOBuf::copyBuffer(std::string(11, '\xff')));
+  pipeline->read(q);
+  EXPECT_EQ(1, failed);
+  EXPECT_EQ(0, q.chainLength());
+}
+
+class IOBufCapture
+    : public HandlerAdapter<std::unique_ptr<IOBuf>> {
+ public:
+  Future<Unit> write(Context* ctx, std::unique_ptr<IOBuf> buf) override {
+    written = std::move(buf);
+    return makeFuture();
+  }
+
+  std::unique_ptr<IOBuf> written;
+};
+
+class StringViewTester : public InboundHandler<StringView> {
+ public:
+  void read(Context* ctx, StringView msg) override {
+    received = std::move(msg);
+  }
+
+  StringView received;
+};
+
+TEST(StringViewCodec, NoCopies) {
+  auto pipeline = Pipeline<std::unique_ptr<IOBuf>, fbstring>::create();
+  IOBufCapture capture;
+  StringViewTester tester;
+
+  (*pipeline)
+    .addBack(&capture)
+    .addBack(StringViewCodec())
+    .addBack(&tester)
+    .finalize();
+
+  // Reads point into the received buffer
+  auto buf = IOBuf::copyBuffer("hello");
+  auto data = reinterpret_cast<const char*>(buf->data());
+  pipeline->read(std::move(buf));
+  EXPECT_EQ("hello", tester.received.str());
+  EXPECT_EQ(data, tester.received.str().data());
+
+  // Writes hand the string's storage down
+  fbstring msg(100, 'x');
+  data = msg.data();
+  pipeline->write(std::move(msg));
+  ASSERT_NE(nullptr, capture.written);
+  EXPECT_EQ(100, capture.written->length());
+  EXPECT_EQ(data, reinterpret_cast<const char*>(capture.written->data()));
+}
+
+class IOBufReflector
+    : public HandlerAdapter<std::unique_ptr<IOBuf>> {
+ public:
+  Future<Unit> write(Context* ctx, std::unique_ptr<IOBuf> buf) override {
+    bytes += buf->computeChainDataLength();
+    ctx->fireRead(std::move(buf));
+    return makeFuture();
+  }
+
+  uint64_t bytes{0};
+};
+
+TEST(CompressionHandler, RoundTrip) {
+  auto pipeline = Pipeline<std::unique_ptr<IOBuf>, std::unique_ptr<IOBuf>>::
+    create();
+  IOBufReflector reflector;
+  CompressionHandler compression(io::CodecType::ZLIB, 100);
+  std::vector<std::string> received;
+
+  (*pipeline)
+    .addBack(&reflector)
+    .addBack(&compression)
+    .addBack(FrameTester([&](std::unique_ptr<IOBuf> buf) {
+        ASSERT_NE(nullptr, buf);
+        received.push_back(buf->moveToFbString().toStdString());
+      }))
+    .finalize();
+
+  auto tinfo = std::make_shared<TransportInfo>();
+  pipeline->setTransportInfo(tinfo);
+  pipeline->transportActive();
+  EXPECT_EQ(compression.getCompressionInfo(), tinfo->protocolInfo);
+
+  // Below the threshold the message only gets a flag byte
+  pipeline->write(IOBuf::copyBuffer("short"));
+  EXPECT_EQ(6, reflector.bytes);
+
+  std::string large(4096, 'a');
+  pipeline->write(IOBuf::copyBuffer(large));
+  EXPECT_LT(reflector.bytes, 6 + 100);
+
+  ASSERT_EQ(2, received.size());
+  EXPECT_EQ("short", received[0]);
+  EXPECT_EQ(large, received[1]);
+
+  auto info = compression.getCompressionInfo();
+  EXPECT_EQ(4101, info->egressUncompressed);
+  EXPECT_EQ(reflector.bytes, info->egressCompressed);
+  EXPECT_EQ(4101, info->ingressUncompressed);
+  EXPECT_EQ(reflector.bytes, info->ingressCompressed);
+}
+
+TEST(CompressionHandler, Malformed) {
+  auto pipeline = Pipeline<std::unique_ptr<IOBuf>, std::unique_ptr<IOBuf>>::
+    create();
+  int failed = 0;
+
+  (*pipeline)
+    .addBack(CompressionHandler(io::CodecType::ZLIB))
+    .addBack(FrameTester([&](std::unique_ptr<IOBuf> buf) {
+        ASSERT_EQ(nullptr, buf);
+        failed++;
+      }))
+    .finalize();
+
+  pipeline->read(IOBuf::copyBuffer("\x07"));
+  pipeline->read(IOBuf::create(0));
+  EXPECT_EQ(2, failed);
+}
+
+struct Point {
+  uint32_t x{0};
+  uint32_t y{0};
+};
+
+class PointSerializeHandler : public SerializeHandler<Point, Point> {
+ public:
+  PointSerializeHandler() : SerializeHandler<Point, Point>(8, 64) {}
+
+  bool deserialize(Cursor& cursor, Point& msg) override {
+    msg.x = cursor.readBE<uint32_t>();
+    msg.y = cursor.readBE<uint32_t>();
+    return cursor.isAtEnd();
+  }
+
+  void serialize(const Point& msg, QueueAppender& out) override {
+    out.writeBE(msg.x);
+    out.writeBE(msg.y);
+  }
+};
+
+class PointTester : public InboundHandler<Point> {
+ public:
+  void read(Context* ctx, Point msg) override {
+    received.push_back(msg);
+  }
+
+  void readException(Context* ctx, exception_wrapper w) override {
+    failed++;
+  }
+
+  std::vector<Point> received;
+  int failed{0};
+};
+
+TEST(SerializeHandler, NoCopies) {
+  auto pipeline = Pipeline<std::unique_ptr<IOBuf>, Point>::create();
+  IOBufCapture capture;
+  PointTester tester;
+
+  (*pipeline)
+    .addBack(&capture)
+    .addBack(PointSerializeHandler())
+    .addBack(&tester)
+    .finalize();
+
+  pipeline->write(Point{1, 2});
+  auto written = std::move(capture.written);
+  ASSERT_NE(nullptr, written);
+  EXPECT_FALSE(written->isChained());
+  EXPECT_EQ(8, written->headroom());
+  EXPECT_EQ(8, written->length());
+
+  // Deserialized from the cursor, across the chain
+  auto tail = written->clone();
+  written->trimEnd(5);
+  tail->trimStart(3);
+  written->prependChain(std::move(tail));
+  pipeline->read(std::move(written));
+  ASSERT_EQ(1, tester.received.size());
+  EXPECT_EQ(1, tester.received[0].x);
+  EXPECT_EQ(2, tester.received[0].y);
+
+  pipeline->read(IOBuf::copyBuffer("short"));
+  pipeline->read(IOBuf::copyBuffer("much too long"));
+  EXPECT_EQ(1, tester.received.size());
+  EXPECT_EQ(2, tester.failed);
+}
@@ -0,0 +1,144 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/codec/CompressionHandler.h>
+
+#include <folly/io/Cursor.h>
+
+using folly::Future;
+using folly::Unit;
+using folly::IOBuf;
+using folly::io::Cursor;
+
+namespace wangle {
+
+namespace {
+
+enum : uint8_t {
+  kUncompressed = 0,
+  kCompressed = 1,
+};
+
+}
+
+CompressionHandler::CompressionHandler(
+    folly::io::CodecType type,
+    uint64_t minCompressSize,
+    int level)
+    : codec_(folly::io::getCodec(type, level))
+    , minCompressSize_(minCompressSize)
+    , info_(std::make_shared<CompressionInfo>()) {}
+
+void CompressionHandler::read(Context* ctx, std::unique_ptr<IOBuf> msg) {
+  std::unique_ptr<IOBuf> payload;
+  const auto length = msg->computeChainDataLength();
+  try {
+    Cursor c(msg.get());
+    auto flag = c.read<uint8_t>();
+    if (flag == kUncompressed) {
+      c.clone(payload, c.totalLength());
+    } else if (flag == kCompressed) {
+      uint64_t uncompressedLength = 0;
+      for (int shift = 0; ; shift += 7) {
+        if (shift > 63) {
+          throw std::runtime_error("Malformed uncompressed length");
+        }
+        auto b = c.read<uint8_t>();
+        uncompressedLength |= uint64_t(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+          break;
+        }
+      }
+      std::unique_ptr<IOBuf> compressed;
+      c.clone(compressed, c.totalLength());
+      payload = codec_->uncompress(compressed.get(), uncompressedLength);
+    } else {
+      throw std::runtime_error("Unknown compression flag");
+    }
+  } catch (const std::exception& e) {
+    ctx->fireReadException(
+      folly::make_exception_wrapper<std::runtime_error>(e.what()));
+    return;
+  }
+
+  info_->ingressCompressed += length;
+  info_->ingressUncompressed += payload->computeChainDataLength();
+  ctx->fireRead(std::move(payload));
+}
+
+Future<Unit> CompressionHandler::write(
+    Context* ctx, std::unique_ptr<IOBuf> msg) {
+  std::unique_ptr<IOBuf> encoded;
+  try {
+    encoded = encode(std::move(msg));
+  } catch (const std::exception& e) {
+    return folly::makeFuture<Unit>(
+      folly::make_exception_wrapper<std::runtime_error>(e.what()));
+  }
+  return ctx->fireWrite(std::move(encoded));
+}
+
+void CompressionHandler::writeNoFuture(
+    Context* ctx, std::unique_ptr<IOBuf> msg) {
+  std::unique_ptr<IOBuf> encoded;
+  try {
+    encoded = encode(std::move(msg));
+  } catch (const std::exception& e) {
+    ctx->getPipeline()->notifyWriteError(
+      folly::make_exception_wrapper<std::runtime_error>(e.what()));
+    return;
+  }
+  ctx->fireWriteNoFuture(std::move(encoded));
+}
+
+void CompressionHandler::transportActive(Context* ctx) {
+  auto tinfo = ctx->getPipeline()->getTransportInfo();
+  if (tinfo && !tinfo->protocolInfo) {
+    tinfo->protocolInfo = info_;
+  }
+  ctx->fireTransportActive();
+}
+
+std::unique_ptr<IOBuf> CompressionHandler::encode(std::unique_ptr<IOBuf> msg) {
+  const uint64_t length = msg->computeChainDataLength();
+  // Flag byte and up to 10 bytes of varint
+  auto header = IOBuf::create(11);
+  uint8_t* p = header->writableTail();
+
+  std::unique_ptr<IOBuf> compressed;
+  if (length >= minCompressSize_) {
+    compressed = codec_->compress(msg.get());
+    if (compressed->computeChainDataLength() >= length) {
+      // Not worth uncompressing on the other end
+      compressed.reset();
+    }
+  }
+
+  if (compressed) {
+    *p++ = kCompressed;
+    uint64_t value = length;
+    while (value >= 0x80) {
+      *p++ = 0x80 | (value & 0x7f);
+      value >>= 7;
+    }
+    *p++ = value;
+    msg = std::move(compressed);
+  } else {
+    *p++ = kUncompressed;
+  }
+  header->append(p - header->writableTail());
+  header->prependChain(std::move(msg));
+
+  info_->egressUncompressed += length;
+  info_->egressCompressed += header->computeChainDataLength();
+  return header;
+}
+
+} // namespace wangle
@@ -0,0 +1,77 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/io/Compression.h>
+#include <wangle/acceptor/TransportInfo.h>
+#include <wangle/channel/Handler.h>
+
+namespace wangle {
+
+/**
+ * Byte counters of a CompressionHandler. Compressed sizes count the bytes
+ * passed to and from the framing handlers, headers included, so they
+ * include messages that were sent uncompressed.
+ */
+struct CompressionInfo : public ProtocolInfo {
+  uint64_t ingressCompressed{0};
+  uint64_t ingressUncompressed{0};
+  uint64_t egressCompressed{0};
+  uint64_t egressUncompressed{0};
+};
+
+/**
+ * A handler that compresses framed messages on write and decompresses them
+ * on read, with any codec folly::io supports (ZSTD, LZ4, ...). It belongs
+ * between a frame decoder / prepender pair and the message handlers, on
+ * both ends of the connection.
+ *
+ * The codec is created once per handler, so its state is set up once per
+ * connection rather than once per message. Messages shorter than
+ * minCompressSize, or that do not get smaller, are sent as they are. Each
+ * message is prefixed with a flag byte and, when compressed, the
+ * uncompressed length as a varint.
+ *
+ * The counters are published in the pipeline's TransportInfo::protocolInfo
+ * when the transport becomes active, unless it is already set.
+ */
+class CompressionHandler : public HandlerAdapter<std::unique_ptr<folly::IOBuf>> {
+ public:
+  explicit CompressionHandler(
+      folly::io::CodecType type,
+      uint64_t minCompressSize = 512,
+      int level = folly::io::COMPRESSION_LEVEL_DEFAULT);
+
+  void read(Context* ctx, std::unique_ptr<folly::IOBuf> msg) override;
+
+  folly::Future<folly::Unit> write(
+      Context* ctx,
+      std::unique_ptr<folly::IOBuf> msg) override;
+
+  void writeNoFuture(
+      Context* ctx,
+      std::unique_ptr<folly::IOBuf> msg) override;
+
+  void transportActive(Context* ctx) override;
+
+  std::shared_ptr<const CompressionInfo> getCompressionInfo() const {
+    return info_;
+  }
+
+ private:
+  std::unique_ptr<folly::IOBuf> encode(std::unique_ptr<folly::IOBuf> msg);
+
+  std::unique_ptr<folly::io::Codec> codec_;
+  uint64_t minCompressSize_;
+  std::shared_ptr<CompressionInfo> info_;
+};
+
+} // namespace wangle
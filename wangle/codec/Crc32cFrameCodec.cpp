@@ -0,0 +1,92 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/codec/Crc32cFrameCodec.h>
+
+#include <folly/Checksum.h>
+
+using folly::Future;
+using folly::Unit;
+using folly::IOBuf;
+using folly::IOBufQueue;
+
+namespace wangle {
+
+constexpr size_t Crc32cFramePrepender::kChecksumLength;
+
+Future<Unit> Crc32cFramePrepender::write(
+    Context* ctx, std::unique_ptr<IOBuf> buf) {
+  const uint32_t crc =
+    Crc32cFrameDecoder::checksum(buf.get(), buf->computeChainDataLength());
+
+  IOBuf* last = buf->prev();
+  if (last->tailroom() < kChecksumLength || last->isSharedOne()) {
+    buf->prependChain(IOBuf::create(kChecksumLength));
+    last = buf->prev();
+  }
+  last->append(kChecksumLength);
+  folly::io::RWPrivateCursor c(last);
+  c.skip(last->length() - kChecksumLength);
+  c.writeBE(crc);
+
+  return LengthFieldPrepender::write(ctx, std::move(buf));
+}
+
+bool Crc32cFrameDecoder::decode(Context* ctx,
+                                IOBufQueue& buf,
+                                std::unique_ptr<IOBuf>& result,
+                                size_t& needed) {
+  if (!LengthFieldBasedFrameDecoder::decode(ctx, buf, result, needed)) {
+    return false;
+  }
+
+  const uint64_t length = result->computeChainDataLength();
+  if (length < Crc32cFramePrepender::kChecksumLength) {
+    result.reset();
+    ctx->fireReadException(folly::make_exception_wrapper<std::runtime_error>(
+                             "Frame too small for checksum"));
+    return false;
+  }
+
+  const uint64_t dataLength = length - Crc32cFramePrepender::kChecksumLength;
+  folly::io::Cursor c(result.get());
+  c.skip(dataLength);
+  if (c.readBE<uint32_t>() != checksum(result.get(), dataLength)) {
+    result.reset();
+    ctx->fireReadException(folly::make_exception_wrapper<std::runtime_error>(
+                             "Frame checksum mismatch"));
+    return false;
+  }
+
+  // Strip the trailer, which may itself be split across IOBufs
+  size_t trim = Crc32cFramePrepender::kChecksumLength;
+  IOBuf* last = result->prev();
+  while (trim > 0) {
+    const size_t n = std::min<size_t>(trim, last->length());
+    last->trimEnd(n);
+    trim -= n;
+    last = last->prev();
+  }
+  return true;
+}
+
+uint32_t Crc32cFrameDecoder::checksum(const IOBuf* buf, uint64_t length) {
+  uint32_t crc = ~0U;
+  const IOBuf* seg = buf;
+  while (length > 0) {
+    const uint64_t n = std::min<uint64_t>(length, seg->length());
+    crc = folly::crc32c(seg->data(), n, crc);
+    length -= n;
+    seg = seg->next();
+  }
+  return crc;
+}
+
+} // namespace wangle
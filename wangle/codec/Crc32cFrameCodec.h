@@ -0,0 +1,81 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/codec/LengthFieldBasedFrameDecoder.h>
+#include <wangle/codec/LengthFieldPrepender.h>
+
+namespace wangle {
+
+/**
+ * A LengthFieldPrepender that also appends a CRC32C of the message, as a
+ * 4 byte big endian trailer covered by the length field:
+ *
+ * +--------+----------------+--------+
+ * | Length | Actual Content | CRC32C |
+ * +--------+----------------+--------+
+ *
+ * The checksum is computed segment by segment over the IOBuf chain, without
+ * coalescing it, using the CPU's CRC32 instructions when available. The
+ * trailer goes into the last IOBuf's tailroom when there is enough of it.
+ *
+ * @see Crc32cFrameDecoder
+ */
+class Crc32cFramePrepender : public LengthFieldPrepender {
+ public:
+  static constexpr size_t kChecksumLength = 4;
+
+  explicit Crc32cFramePrepender(int lengthFieldLength = 4,
+                                int lengthAdjustment = 0,
+                                bool lengthIncludesLengthField = false,
+                                bool networkByteOrder = true)
+      : LengthFieldPrepender(lengthFieldLength,
+                             lengthAdjustment,
+                             lengthIncludesLengthField,
+                             networkByteOrder) {}
+
+  folly::Future<folly::Unit> write(
+      Context* ctx,
+      std::unique_ptr<folly::IOBuf> buf) override;
+};
+
+/**
+ * A LengthFieldBasedFrameDecoder that verifies and strips the CRC32C
+ * trailer added by Crc32cFramePrepender. The checksum covers the bytes of
+ * the decoded frame, so the length field should be stripped from it as it
+ * is by default. Frames that fail verification are dropped and a read
+ * exception is fired.
+ */
+class Crc32cFrameDecoder : public LengthFieldBasedFrameDecoder {
+ public:
+  explicit Crc32cFrameDecoder(uint32_t lengthFieldLength = 4,
+                              uint32_t maxFrameLength = UINT_MAX,
+                              uint32_t lengthFieldOffset = 0,
+                              int32_t lengthAdjustment = 0,
+                              uint32_t initialBytesToStrip = 4,
+                              bool networkByteOrder = true)
+      : LengthFieldBasedFrameDecoder(lengthFieldLength,
+                                     maxFrameLength,
+                                     lengthFieldOffset,
+                                     lengthAdjustment,
+                                     initialBytesToStrip,
+                                     networkByteOrder) {}
+
+  bool decode(Context* ctx,
+              folly::IOBufQueue& buf,
+              std::unique_ptr<folly::IOBuf>& result,
+              size_t& needed) override;
+
+  // CRC32C of the first length bytes of the chain
+  static uint32_t checksum(const folly::IOBuf* buf, uint64_t length);
+};
+
+} // namespace wangle
@@ -0,0 +1,128 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/codec/DelimiterBasedFrameDecoder.h>
+
+#include <wangle/codec/BufferScanner.h>
+
+#include <algorithm>
+
+namespace wangle {
+
+using folly::IOBuf;
+using folly::IOBufQueue;
+
+DelimiterBasedFrameDecoder::DelimiterBasedFrameDecoder(
+    uint32_t maxLength,
+    std::vector<std::string> delimiters,
+    bool stripDelimiter)
+    : maxLength_(maxLength)
+    , delimiters_(std::move(delimiters))
+    , stripDelimiter_(stripDelimiter) {
+  CHECK(!delimiters_.empty());
+  for (size_t d = 0; d < delimiters_.size(); d++) {
+    const auto& delim = delimiters_[d];
+    CHECK(!delim.empty());
+    maxDelimiterLength_ = std::max(maxDelimiterLength_, delim.size());
+    auto k = firstBytes_.find(delim[0]);
+    if (k == std::string::npos) {
+      k = firstBytes_.size();
+      firstBytes_.push_back(delim[0]);
+      delimitersByFirstByte_.emplace_back();
+    }
+    delimitersByFirstByte_[k].push_back(d);
+  }
+}
+
+bool DelimiterBasedFrameDecoder::decode(Context* ctx,
+                                        IOBufQueue& buf,
+                                        std::unique_ptr<IOBuf>& result,
+                                        size_t&) {
+  size_t delimiter = 0;
+  if (!discarding_) {
+    int64_t pos = findDelimiter(buf, uint64_t(maxLength_) + 1, delimiter);
+    if (pos >= 0) {
+      const auto delimLength = delimiters_[delimiter].size();
+      if (stripDelimiter_) {
+        result = pos > 0 ? buf.split(pos) : IOBuf::create(0);
+        buf.trimStart(delimLength);
+      } else {
+        result = buf.split(pos + delimLength);
+      }
+      return true;
+    }
+
+    // Every position up to maxLength could be checked for every delimiter
+    auto len = buf.chainLength();
+    if (len >= uint64_t(maxLength_) + maxDelimiterLength_) {
+      buf.trimStart(len);
+      scanned_ = 0;
+      discarding_ = true;
+      fail(ctx, "over " + folly::to<std::string>(len));
+    }
+    return false;
+  } else {
+    int64_t pos = findDelimiter(buf, buf.chainLength(), delimiter);
+    if (pos >= 0) {
+      buf.trimStart(pos + delimiters_[delimiter].size());
+      discarding_ = false;
+    } else {
+      // Keep what may be the start of a delimiter
+      auto len = buf.chainLength();
+      if (len >= maxDelimiterLength_) {
+        buf.trimStart(len - (maxDelimiterLength_ - 1));
+      }
+      scanned_ = 0;
+    }
+    return false;
+  }
+}
+
+void DelimiterBasedFrameDecoder::fail(Context* ctx, std::string len) {
+  ctx->fireReadException(
+    folly::make_exception_wrapper<std::runtime_error>(
+      "frame length " + len +
+      " exceeds max " + folly::to<std::string>(maxLength_)));
+}
+
+int64_t DelimiterBasedFrameDecoder::findDelimiter(IOBufQueue& buf,
+                                                  uint64_t limit,
+                                                  size_t& delimiter) {
+  if (!buf.front()) {
+    scanned_ = 0;
+    return -1;
+  }
+  const uint64_t length = buf.chainLength();
+  if (scanned_ > length) {
+    scanned_ = 0;
+  }
+  limit = std::min(limit, length);
+
+  BufferScanner scanner(buf, scanned_);
+  int64_t pos;
+  while ((pos = scanner.findFirstOf(firstBytes_, limit)) >= 0) {
+    const auto k = firstBytes_.find(char(scanner.byteAt(pos)));
+    for (auto d : delimitersByFirstByte_[k]) {
+      if (scanner.matches(pos, delimiters_[d])) {
+        scanned_ = 0;
+        delimiter = d;
+        return pos;
+      }
+    }
+  }
+
+  // Delimiters starting in the last few bytes may just be incomplete
+  const uint64_t complete =
+    length >= maxDelimiterLength_ ? length - (maxDelimiterLength_ - 1) : 0;
+  scanned_ = std::min(limit, complete);
+  return -1;
+}
+
+} // namespace wangle
@@ -0,0 +1,71 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <wangle/codec/ByteToMessageDecoder.h>
+
+namespace wangle {
+
+/**
+ * A decoder that splits the received IOBufQueue on one or more delimiters of
+ * any length, e.g. both "\0" and "\r\n":
+ *
+ *   DelimiterBasedFrameDecoder(8192, {std::string(1, '\0'), "\r\n"})
+ *
+ * Frames end at the first delimiter found. When several delimiters match at
+ * the same position the first one in the list wins, so list longer
+ * delimiters before their prefixes.
+ *
+ * Frames longer than maxLength are discarded up to the next delimiter, and
+ * an exception is fired for each of them.
+ */
+class DelimiterBasedFrameDecoder : public ByteToByteDecoder {
+ public:
+  DelimiterBasedFrameDecoder(uint32_t maxLength,
+                             std::vector<std::string> delimiters,
+                             bool stripDelimiter = true);
+
+  bool decode(Context* ctx,
+              folly::IOBufQueue& buf,
+              std::unique_ptr<folly::IOBuf>& result,
+              size_t&) override;
+
+ private:
+  // Returns the offset of the first delimiter starting before limit and sets
+  // delimiter to its index, or returns -1. A BufferScanner searches for the
+  // delimiters' first bytes, delimiters are matched across segment
+  // boundaries, and the search resumes where the previous call left off.
+  int64_t findDelimiter(folly::IOBufQueue& buf,
+                        uint64_t limit,
+                        size_t& delimiter);
+
+  void fail(Context* ctx, std::string len);
+
+  uint32_t maxLength_;
+  std::vector<std::string> delimiters_;
+  bool stripDelimiter_;
+  size_t maxDelimiterLength_{0};
+
+  // Distinct first bytes of the delimiters, and which delimiters start with
+  // each of them, in list order
+  std::string firstBytes_;
+  std::vector<std::vector<size_t>> delimitersByFirstByte_;
+
+  bool discarding_{false};
+
+  // Bytes at the front of the queue known not to start a delimiter
+  uint64_t scanned_{0};
+};
+
+} // namespace wangle
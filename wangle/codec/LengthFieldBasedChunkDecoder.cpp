@@ -0,0 +1,116 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/codec/LengthFieldBasedChunkDecoder.h>
+
+#include <algorithm>
+
+#include <wangle/codec/LengthFieldBasedFrameDecoder.h>
+
+using folly::IOBuf;
+using folly::IOBufQueue;
+
+namespace wangle {
+
+LengthFieldBasedChunkDecoder::LengthFieldBasedChunkDecoder(
+  uint32_t lengthFieldLength,
+  uint64_t maxFrameLength,
+  uint32_t lengthFieldOffset,
+  int32_t lengthAdjustment,
+  uint32_t initialBytesToStrip,
+  bool networkByteOrder)
+    : lengthFieldLength_(lengthFieldLength)
+    , maxFrameLength_(maxFrameLength)
+    , lengthFieldOffset_(lengthFieldOffset)
+    , lengthAdjustment_(lengthAdjustment)
+    , initialBytesToStrip_(initialBytesToStrip)
+    , networkByteOrder_(networkByteOrder)
+    , lengthFieldEndOffset_(lengthFieldOffset + lengthFieldLength) {
+  CHECK(maxFrameLength > 0);
+  CHECK(lengthFieldOffset <= maxFrameLength - lengthFieldLength);
+}
+
+bool LengthFieldBasedChunkDecoder::decode(Context* ctx,
+                                          IOBufQueue& buf,
+                                          FrameChunk& result,
+                                          size_t& needed) {
+  if (remaining_ == 0 && !firstChunkPending_) {
+    discarding_ = false;
+    if (!decodeHeader(ctx, buf, needed)) {
+      return false;
+    }
+  }
+
+  const auto len = std::min<uint64_t>(remaining_, buf.chainLength());
+  if (discarding_) {
+    buf.trimStart(len);
+    remaining_ -= len;
+    // Go on with the next frame, if any of it is there
+    return remaining_ == 0 && buf.chainLength() > 0 &&
+      decode(ctx, buf, result, needed);
+  }
+
+  // Bodies are not waited for: whatever arrives is passed on, so there is
+  // no needed hint to give
+  if (len == 0 && !firstChunkPending_) {
+    return false;
+  }
+  result.frameLength = frameLength_;
+  result.offset = offset_;
+  result.data = len > 0 ? buf.split(len) : IOBuf::create(0);
+  result.first = firstChunkPending_;
+  offset_ += len;
+  remaining_ -= len;
+  firstChunkPending_ = false;
+  return true;
+}
+
+bool LengthFieldBasedChunkDecoder::decodeHeader(Context* ctx,
+                                                IOBufQueue& buf,
+                                                size_t& needed) {
+  const uint64_t headerLength =
+    std::max(lengthFieldEndOffset_, initialBytesToStrip_);
+  if (buf.chainLength() < headerLength) {
+    needed = headerLength - buf.chainLength();
+    return false;
+  }
+
+  uint64_t frameLength = LengthFieldBasedFrameDecoder::getUnadjustedFrameLength(
+    buf, lengthFieldOffset_, lengthFieldLength_, networkByteOrder_);
+
+  frameLength += lengthAdjustment_ + lengthFieldEndOffset_;
+
+  if (frameLength < lengthFieldEndOffset_) {
+    buf.trimStart(lengthFieldEndOffset_);
+    ctx->fireReadException(folly::make_exception_wrapper<std::runtime_error>(
+                             "Frame too small"));
+    return false;
+  }
+
+  if (frameLength > maxFrameLength_ || initialBytesToStrip_ > frameLength) {
+    remaining_ = frameLength;
+    discarding_ = true;
+    ctx->fireReadException(folly::make_exception_wrapper<std::runtime_error>(
+                             frameLength > maxFrameLength_ ?
+                             "Frame larger than " +
+                             folly::to<std::string>(maxFrameLength_) :
+                             "InitialBytesToSkip larger than frame"));
+    return true;
+  }
+
+  buf.trimStart(initialBytesToStrip_);
+  frameLength_ = frameLength - initialBytesToStrip_;
+  offset_ = 0;
+  remaining_ = frameLength_;
+  firstChunkPending_ = true;
+  return true;
+}
+
+} // namespace wangle
@@ -0,0 +1,84 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/codec/ByteToMessageDecoder.h>
+
+namespace wangle {
+
+/**
+ * A piece of a frame passed on by LengthFieldBasedChunkDecoder. The first
+ * chunk of every frame is passed on as soon as the length field has been
+ * read, even if no other byte of the frame has arrived yet, and the last one
+ * ends at frameLength.
+ */
+struct FrameChunk {
+  // Length of the whole frame, as it is passed on
+  uint64_t frameLength{0};
+  // Offset of data in the frame
+  uint64_t offset{0};
+  std::unique_ptr<folly::IOBuf> data;
+  bool first{false};
+
+  bool isLast() const {
+    return offset + (data ? data->computeChainDataLength() : 0) == frameLength;
+  }
+};
+
+/**
+ * A streaming variant of LengthFieldBasedFrameDecoder, taking the same
+ * parameters. Instead of buffering each frame until it is complete, it
+ * passes on every frame as FrameChunks of whatever has arrived, so frames of
+ * any size can be piped elsewhere with bounded memory.
+ *
+ * Frames larger than maxFrameLength are skipped as they arrive, and an
+ * exception is fired for each of them.
+ */
+class LengthFieldBasedChunkDecoder : public ByteToMessageDecoder<FrameChunk> {
+ public:
+  explicit LengthFieldBasedChunkDecoder(
+      uint32_t lengthFieldLength = 4,
+      uint64_t maxFrameLength = UINT64_MAX,
+      uint32_t lengthFieldOffset = 0,
+      int32_t lengthAdjustment = 0,
+      uint32_t initialBytesToStrip = 4,
+      bool networkByteOrder = true);
+
+  bool decode(Context* ctx,
+              folly::IOBufQueue& buf,
+              FrameChunk& result,
+              size_t& needed) override;
+
+ private:
+  // Reads the next frame's length field, returns false if it had to wait
+  bool decodeHeader(Context* ctx, folly::IOBufQueue& buf, size_t& needed);
+
+  uint32_t lengthFieldLength_;
+  uint64_t maxFrameLength_;
+  uint32_t lengthFieldOffset_;
+  int32_t lengthAdjustment_;
+  uint32_t initialBytesToStrip_;
+  bool networkByteOrder_;
+
+  uint32_t lengthFieldEndOffset_;
+
+  // Current frame: its length as passed on, how much of it was passed on,
+  // and how much is left
+  uint64_t frameLength_{0};
+  uint64_t offset_{0};
+  uint64_t remaining_{0};
+  // Whether the chunk at offset 0 of the current frame is still to be passed
+  // on, and whether the current frame is being skipped instead
+  bool firstChunkPending_{false};
+  bool discarding_{false};
+};
+
+} // namespace wangle
@@ -10,11 +10,29 @@
 
 #include <wangle/codec/LengthFieldBasedFrameDecoder.h>
 
+#include <wangle/codec/BufferScanner.h>
+
 using folly::IOBuf;
 using folly::IOBufQueue;
 
 namespace wangle {
 
+namespace {
+
+template <class T>
+uint64_t peekLength(const BufferScanner& scanner, uint64_t offset,
+                    bool networkByteOrder) {
+  T length = 0;
+  if (networkByteOrder) {
+    scanner.peekBE(offset, length);
+  } else {
+    scanner.peekLE(offset, length);
+  }
+  return length;
+}
+
+} // namespace
+
 LengthFieldBasedFrameDecoder::LengthFieldBasedFrameDecoder(
   uint32_t lengthFieldLength,
   uint32_t maxFrameLength,
@@ -36,9 +54,10 @@ LengthFieldBasedFrameDecoder::LengthFieldBasedFrameDecoder(
 bool LengthFieldBasedFrameDecoder::decode(Context* ctx,
                                           IOBufQueue& buf,
                                           std::unique_ptr<IOBuf>& result,
-                                          size_t&) {
+                                          size_t& needed) {
   // discarding too long frame
   if (buf.chainLength() < lengthFieldEndOffset_) {
+    needed = lengthFieldEndOffset_ - buf.chainLength();
     return false;
   }
 
@@ -63,6 +82,7 @@ bool LengthFieldBasedFrameDecoder::decode(Context* ctx,
   }
 
   if (buf.chainLength() < frameLength) {
+    needed = frameLength - buf.chainLength();
     return false;
   }
 
@@ -81,44 +101,22 @@ bool LengthFieldBasedFrameDecoder::decode(Context* ctx,
 
 uint64_t LengthFieldBasedFrameDecoder::getUnadjustedFrameLength(
   IOBufQueue& buf, int offset, int length, bool networkByteOrder) {
-  folly::io::Cursor c(buf.front());
-  uint64_t frameLength;
-
-  c.skip(offset);
+  BufferScanner scanner(buf);
+  uint64_t frameLength = 0;
 
   switch(length) {
-    case 1:{
-      if (networkByteOrder) {
-        frameLength = c.readBE<uint8_t>();
-      } else {
-        frameLength = c.readLE<uint8_t>();
-      }
+    case 1:
+      frameLength = peekLength<uint8_t>(scanner, offset, networkByteOrder);
       break;
-    }
-    case 2:{
-      if (networkByteOrder) {
-        frameLength = c.readBE<uint16_t>();
-      } else {
-        frameLength = c.readLE<uint16_t>();
-      }
+    case 2:
+      frameLength = peekLength<uint16_t>(scanner, offset, networkByteOrder);
       break;
-    }
-    case 4:{
-      if (networkByteOrder) {
-        frameLength = c.readBE<uint32_t>();
-      } else {
-        frameLength = c.readLE<uint32_t>();
-      }
+    case 4:
+      frameLength = peekLength<uint32_t>(scanner, offset, networkByteOrder);
       break;
-    }
-    case 8:{
-      if (networkByteOrder) {
-        frameLength = c.readBE<uint64_t>();
-      } else {
-        frameLength = c.readLE<uint64_t>();
-      }
+    case 8:
+      frameLength = peekLength<uint64_t>(scanner, offset, networkByteOrder);
       break;
-    }
   }
 
   return frameLength;
@@ -173,6 +173,8 @@ namespace wangle {
  * +------+--------+------+----------------+      +------+----------------+
  *
  * @see LengthFieldPrepender
+ * @see LengthFieldBasedChunkDecoder to pass on large frames as they arrive
+ * @see StaticLengthFieldBasedFrameDecoder for a layout fixed at compile time
  */
 class LengthFieldBasedFrameDecoder : public ByteToByteDecoder {
  public:
@@ -186,13 +188,14 @@ class LengthFieldBasedFrameDecoder : public ByteToByteDecoder {
   bool decode(Context* ctx,
               folly::IOBufQueue& buf,
               std::unique_ptr<folly::IOBuf>& result,
-              size_t&) override;
+              size_t& needed) override;
 
- private:
-
-  uint64_t getUnadjustedFrameLength(
+  // Reads the length field of the given size at offset of buf
+  static uint64_t getUnadjustedFrameLength(
     folly::IOBufQueue& buf, int offset, int length, bool networkByteOrder);
 
+ private:
+
   uint32_t lengthFieldLength_;
   uint32_t maxFrameLength_;
   uint32_t lengthFieldOffset_;
@@ -16,6 +16,8 @@ using folly::IOBuf;
 
 namespace wangle {
 
+constexpr size_t LengthFieldPrepender::kMaxLengthFieldLength;
+
 LengthFieldPrepender::LengthFieldPrepender(
     int lengthFieldLength,
     int lengthAdjustment,
@@ -42,8 +44,18 @@ Future<Unit> LengthFieldPrepender::write(
     throw std::runtime_error("Length field < 0");
   }
 
-  auto len = IOBuf::create(lengthFieldLength_);
-  len->append(lengthFieldLength_);
+  std::unique_ptr<IOBuf> len;
+  if (buf->headroom() >= static_cast<uint64_t>(lengthFieldLength_) &&
+      !buf->isSharedOne()) {
+    // Write the length field into the payload's headroom, saving an
+    // allocation and a chain element
+    buf->prepend(lengthFieldLength_);
+    len = std::move(buf);
+  } else {
+    len = IOBuf::create(lengthFieldLength_);
+    len->append(lengthFieldLength_);
+    len->prependChain(std::move(buf));
+  }
   folly::io::RWPrivateCursor c(len.get());
 
   switch (lengthFieldLength_) {
@@ -90,7 +102,6 @@ Future<Unit> LengthFieldPrepender::write(
     }
   }
 
-  len->prependChain(std::move(buf));
   return ctx->fireWrite(std::move(len));
 }
 
@@ -40,9 +40,15 @@ namespace wangle {
  * + 0x000E | "HELLO, WORLD" |
  * +--------+----------------+
  *
+ * The length field is written into the headroom of the message's first
+ * IOBuf when there is enough of it and the buffer isn't shared, and into a
+ * separate IOBuf chained in front otherwise. Serializers can reserve
+ * kMaxLengthFieldLength bytes of headroom to always take the first path.
  */
 class LengthFieldPrepender : public OutboundBytesToBytesHandler {
  public:
+  static constexpr size_t kMaxLengthFieldLength = 8;
+
   explicit LengthFieldPrepender(int lengthFieldLength = 4,
                                 int lengthAdjustment = 0,
                                 bool lengthIncludesLengthField = false,
@@ -10,6 +10,10 @@
 
 #include <wangle/codec/LineBasedFrameDecoder.h>
 
+#include <wangle/codec/BufferScanner.h>
+
+#include <algorithm>
+
 namespace wangle {
 
 using folly::io::Cursor;
@@ -36,6 +40,7 @@ bool LineBasedFrameDecoder::decode(Context* ctx,
       auto delimLength = c.read<char>() == '\r' ? 2 : 1;
       if (eol > maxLength_) {
         buf.split(eol + delimLength);
+        scanned_ = 0;
         fail(ctx, folly::to<std::string>(eol));
         return false;
       }
@@ -56,6 +61,7 @@ bool LineBasedFrameDecoder::decode(Context* ctx,
       if (len > maxLength_) {
         discardedBytes_ = len;
         buf.trimStart(len);
+        scanned_ = 0;
         discarding_ = true;
         fail(ctx, "over " + folly::to<std::string>(len));
       }
@@ -72,6 +78,7 @@ bool LineBasedFrameDecoder::decode(Context* ctx,
     } else {
       discardedBytes_ = buf.chainLength();
       buf.move();
+      scanned_ = 0;
     }
 
     return false;
@@ -86,17 +93,36 @@ void LineBasedFrameDecoder::fail(Context* ctx, std::string len) {
 }
 
 int64_t LineBasedFrameDecoder::findEndOfLine(IOBufQueue& buf) {
-  Cursor c(buf.front());
-  for (uint32_t i = 0; i < maxLength_ && i < buf.chainLength(); i++) {
-    auto b = c.read<char>();
-    if (b == '\n' && terminatorType_ != TerminatorType::CARRIAGENEWLINE) {
-      return i;
-    } else if (terminatorType_ != TerminatorType::NEWLINE &&
-               b == '\r' && !c.isAtEnd() && c.read<char>() == '\n') {
-      return i;
+  if (!buf.front()) {
+    scanned_ = 0;
+    return -1;
+  }
+  const uint64_t length = buf.chainLength();
+  if (scanned_ > length) {
+    scanned_ = 0;
+  }
+  // A terminator must start within maxLength_ bytes, so the "\n" of a
+  // "\r\n" may be one byte past that
+  const uint64_t limit = std::min<uint64_t>(length, uint64_t(maxLength_) + 1);
+
+  BufferScanner scanner(buf, scanned_);
+  int64_t nl;
+  while ((nl = scanner.find('\n', limit)) >= 0) {
+    const uint64_t pos = nl;
+    const bool carriage = pos > 0 && scanner.byteAt(pos - 1) == '\r';
+    if (carriage && terminatorType_ != TerminatorType::NEWLINE) {
+      if (pos - 1 < maxLength_) {
+        scanned_ = 0;
+        return pos - 1;
+      }
+    } else if (terminatorType_ != TerminatorType::CARRIAGENEWLINE &&
+               pos < maxLength_) {
+      scanned_ = 0;
+      return pos;
     }
   }
 
+  scanned_ = limit;
   return -1;
 }
 
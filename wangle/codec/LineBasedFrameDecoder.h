@@ -41,6 +41,9 @@ class LineBasedFrameDecoder : public ByteToByteDecoder {
 
  private:
 
+  // Returns the offset of the first terminator in buf, or -1. The search,
+  // with a BufferScanner, resumes after the bytes already searched by the
+  // previous call so a line arriving in many reads is scanned once.
   int64_t findEndOfLine(folly::IOBufQueue& buf);
 
   void fail(Context* ctx, std::string len);
@@ -52,6 +55,9 @@ class LineBasedFrameDecoder : public ByteToByteDecoder {
   uint32_t discardedBytes_{0};
 
   TerminatorType terminatorType_;
+
+  // Bytes at the front of the queue already known not to hold a terminator
+  uint64_t scanned_{0};
 };
 
 } // namespace wangle
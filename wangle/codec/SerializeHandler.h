@@ -0,0 +1,85 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/io/Cursor.h>
+#include <folly/io/IOBufQueue.h>
+#include <wangle/channel/Handler.h>
+#include <wangle/codec/LengthFieldPrepender.h>
+
+namespace wangle {
+
+/**
+ * A handler that converts framed IOBufs to messages and back without
+ * intermediate copies. Subclasses implement deserialize(), which reads a
+ * message straight from a Cursor over the received chain, and serialize(),
+ * which writes a message through a QueueAppender.
+ *
+ * The first IOBuf written is allocated with headroom bytes in front, so a
+ * LengthFieldPrepender below this handler can write its length field in
+ * place rather than chaining another IOBuf. growth is the size of each
+ * buffer the appender allocates; messages of up to that size are written
+ * into a single IOBuf.
+ */
+template <typename Rout, typename Win>
+class SerializeHandler : public Handler<std::unique_ptr<folly::IOBuf>, Rout,
+                                        Win, std::unique_ptr<folly::IOBuf>> {
+ public:
+  typedef typename Handler<
+    std::unique_ptr<folly::IOBuf>, Rout,
+    Win, std::unique_ptr<folly::IOBuf>>::Context Context;
+
+  explicit SerializeHandler(
+      uint64_t headroom = LengthFieldPrepender::kMaxLengthFieldLength,
+      uint64_t growth = 4096)
+      : headroom_(headroom), growth_(growth) {}
+
+  // Returns false if the message is malformed. Reading past the end of the
+  // cursor throws, which is handled the same way.
+  virtual bool deserialize(folly::io::Cursor& cursor, Rout& msg) = 0;
+
+  virtual void serialize(const Win& msg, folly::io::QueueAppender& out) = 0;
+
+  void read(Context* ctx, std::unique_ptr<folly::IOBuf> buf) override {
+    Rout msg;
+    bool ok;
+    try {
+      folly::io::Cursor cursor(buf.get());
+      ok = deserialize(cursor, msg);
+    } catch (const std::exception& e) {
+      ctx->fireReadException(
+        folly::make_exception_wrapper<std::runtime_error>(e.what()));
+      return;
+    }
+    if (!ok) {
+      ctx->fireReadException(folly::make_exception_wrapper<std::runtime_error>(
+                               "Malformed message"));
+      return;
+    }
+    ctx->fireRead(std::move(msg));
+  }
+
+  folly::Future<folly::Unit> write(Context* ctx, Win msg) override {
+    folly::IOBufQueue queue;
+    auto head = folly::IOBuf::create(headroom_ + growth_);
+    head->advance(headroom_);
+    queue.append(std::move(head));
+    folly::io::QueueAppender out(&queue, growth_);
+    serialize(msg, out);
+    return ctx->fireWrite(queue.move());
+  }
+
+ private:
+  uint64_t headroom_;
+  uint64_t growth_;
+};
+
+} // namespace wangle
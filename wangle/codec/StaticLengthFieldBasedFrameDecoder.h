@@ -0,0 +1,122 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/Bits.h>
+#include <folly/Likely.h>
+#include <folly/io/Cursor.h>
+#include <wangle/codec/ByteToMessageDecoder.h>
+
+namespace wangle {
+
+/**
+ * LengthFieldBasedFrameDecoder with the header layout fixed at compile time.
+ * The length field is a LengthType (uint8_t, uint16_t, uint32_t or uint64_t),
+ * so when the header is contiguous reading it is a single load and byte swap.
+ * The parameters mean the same as LengthFieldBasedFrameDecoder's; the
+ * defaults match its defaults.
+ *
+ * typedef StaticLengthFieldBasedFrameDecoder<uint16_t> ShortFrameDecoder;
+ * pipeline->addBack(ShortFrameDecoder(maxFrameLength));
+ *
+ * @see LengthFieldBasedFrameDecoder to pick the layout at runtime
+ */
+template <class LengthType,
+          bool NetworkByteOrder = true,
+          uint32_t LengthFieldOffset = 0,
+          int32_t LengthAdjustment = 0,
+          uint32_t InitialBytesToStrip = sizeof(LengthType)>
+class StaticLengthFieldBasedFrameDecoder : public ByteToByteDecoder {
+  static_assert(std::is_unsigned<LengthType>::value,
+                "LengthType must be an unsigned integer");
+
+ public:
+  static constexpr uint32_t kLengthFieldEndOffset =
+    LengthFieldOffset + sizeof(LengthType);
+
+  explicit StaticLengthFieldBasedFrameDecoder(
+    uint64_t maxFrameLength = UINT_MAX)
+      : maxFrameLength_(maxFrameLength) {
+    CHECK(maxFrameLength > 0);
+    CHECK(LengthFieldOffset <= maxFrameLength - sizeof(LengthType));
+  }
+
+  bool decode(Context* ctx,
+              folly::IOBufQueue& buf,
+              std::unique_ptr<folly::IOBuf>& result,
+              size_t& needed) override {
+    if (buf.chainLength() < kLengthFieldEndOffset) {
+      needed = kLengthFieldEndOffset - buf.chainLength();
+      return false;
+    }
+
+    uint64_t frameLength = getUnadjustedFrameLength(buf);
+    frameLength += int64_t(LengthAdjustment) + kLengthFieldEndOffset;
+
+    if (frameLength < kLengthFieldEndOffset) {
+      buf.trimStart(kLengthFieldEndOffset);
+      ctx->fireReadException(folly::make_exception_wrapper<std::runtime_error>(
+                               "Frame too small"));
+      return false;
+    }
+
+    if (frameLength > maxFrameLength_) {
+      buf.trimStart(frameLength);
+      ctx->fireReadException(folly::make_exception_wrapper<std::runtime_error>(
+                               "Frame larger than " +
+                               folly::to<std::string>(maxFrameLength_)));
+      return false;
+    }
+
+    if (buf.chainLength() < frameLength) {
+      needed = frameLength - buf.chainLength();
+      return false;
+    }
+
+    if (InitialBytesToStrip > frameLength) {
+      buf.trimStart(frameLength);
+      ctx->fireReadException(folly::make_exception_wrapper<std::runtime_error>(
+                               "InitialBytesToSkip larger than frame"));
+      return false;
+    }
+
+    buf.trimStart(InitialBytesToStrip);
+    result = buf.split(frameLength - InitialBytesToStrip);
+    return true;
+  }
+
+  static uint64_t getUnadjustedFrameLength(folly::IOBufQueue& buf) {
+    const folly::IOBuf* front = buf.front();
+    LengthType length;
+    if (LIKELY(front->length() >= kLengthFieldEndOffset)) {
+      length = folly::loadUnaligned<LengthType>(
+        front->data() + LengthFieldOffset);
+    } else {
+      // The header is split across IOBufs
+      folly::io::Cursor c(front);
+      c.skip(LengthFieldOffset);
+      length = c.read<LengthType>();
+    }
+    return NetworkByteOrder ? folly::Endian::big(length)
+                            : folly::Endian::little(length);
+  }
+
+ private:
+  uint64_t maxFrameLength_;
+};
+
+template <class LengthType, bool NetworkByteOrder, uint32_t LengthFieldOffset,
+          int32_t LengthAdjustment, uint32_t InitialBytesToStrip>
+constexpr uint32_t StaticLengthFieldBasedFrameDecoder<
+  LengthType, NetworkByteOrder, LengthFieldOffset, LengthAdjustment,
+  InitialBytesToStrip>::kLengthFieldEndOffset;
+
+} // namespace wangle
@@ -11,6 +11,7 @@
 #pragma once
 
 #include <wangle/channel/Handler.h>
+#include <wangle/codec/LengthFieldPrepender.h>
 
 namespace wangle {
 
@@ -33,7 +34,9 @@ class StringCodec : public Handler<std::unique_ptr<folly::IOBuf>, std::string,
   }
 
   folly::Future<folly::Unit> write(Context* ctx, std::string msg) override {
-    auto buf = folly::IOBuf::copyBuffer(msg.data(), msg.length());
+    // Leave room for a length field in front
+    auto buf = folly::IOBuf::copyBuffer(
+      msg.data(), msg.length(), LengthFieldPrepender::kMaxLengthFieldLength);
     return ctx->fireWrite(std::move(buf));
   }
 };
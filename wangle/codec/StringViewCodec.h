@@ -0,0 +1,99 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/FBString.h>
+#include <folly/Range.h>
+#include <wangle/channel/Handler.h>
+
+namespace wangle {
+
+/*
+ * A received string that points into the IOBuf it arrived in, which it keeps
+ * alive. Only chained IOBufs are copied, to make the string contiguous.
+ */
+class StringView {
+ public:
+  StringView() = default;
+
+  explicit StringView(std::unique_ptr<folly::IOBuf> buf)
+      : buf_(std::move(buf)) {
+    if (buf_) {
+      buf_->coalesce();
+    }
+  }
+
+  folly::StringPiece str() const {
+    if (!buf_) {
+      return folly::StringPiece();
+    }
+    return folly::StringPiece(
+      reinterpret_cast<const char*>(buf_->data()), buf_->length());
+  }
+
+  /* implicit */ operator folly::StringPiece() const {
+    return str();
+  }
+
+  size_t size() const {
+    return buf_ ? buf_->length() : 0;
+  }
+
+  // Copies the string, for handlers that need to own it
+  std::string toString() const {
+    return str().str();
+  }
+
+  std::unique_ptr<folly::IOBuf> releaseBuffer() {
+    return std::move(buf_);
+  }
+
+ private:
+  std::unique_ptr<folly::IOBuf> buf_;
+};
+
+/*
+ * StringViewCodec converts a pipeline from IOBufs to strings like
+ * StringCodec, without copying them: reads are handed on as StringViews
+ * into the received buffer, and written fbstrings become the IOBuf's buffer.
+ */
+class StringViewCodec : public Handler<std::unique_ptr<folly::IOBuf>,
+                                       StringView,
+                                       folly::fbstring,
+                                       std::unique_ptr<folly::IOBuf>> {
+ public:
+  typedef typename Handler<
+   std::unique_ptr<folly::IOBuf>, StringView,
+   folly::fbstring, std::unique_ptr<folly::IOBuf>>::Context Context;
+
+  void read(Context* ctx, std::unique_ptr<folly::IOBuf> buf) override {
+    if (buf) {
+      ctx->fireRead(StringView(std::move(buf)));
+    }
+  }
+
+  folly::Future<folly::Unit> write(Context* ctx, folly::fbstring msg) override {
+    return ctx->fireWrite(toIOBuf(std::move(msg)));
+  }
+
+  // Moves the string onto the heap and wraps its storage in an IOBuf
+  static std::unique_ptr<folly::IOBuf> toIOBuf(folly::fbstring msg) {
+    auto str = new folly::fbstring(std::move(msg));
+    return folly::IOBuf::takeOwnership(
+      const_cast<char*>(str->data()), str->size(),
+      [](void*, void* userData) {
+        delete static_cast<folly::fbstring*>(userData);
+      },
+      str);
+  }
+};
+
+} // namespace wangle
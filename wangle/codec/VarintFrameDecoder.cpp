@@ -0,0 +1,106 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/codec/VarintFrameDecoder.h>
+
+#include <algorithm>
+
+using folly::IOBuf;
+using folly::IOBufQueue;
+
+namespace wangle {
+
+VarintFrameDecoder::VarintFrameDecoder(uint32_t maxFrameLength,
+                                       bool stripLengthField)
+    : maxFrameLength_(maxFrameLength)
+    , stripLengthField_(stripLengthField) {
+  CHECK(maxFrameLength > 0);
+}
+
+bool VarintFrameDecoder::decode(Context* ctx,
+                                IOBufQueue& buf,
+                                std::unique_ptr<IOBuf>& result,
+                                size_t& needed) {
+  if (bytesToDiscard_ > 0) {
+    auto len = std::min<uint64_t>(bytesToDiscard_, buf.chainLength());
+    buf.trimStart(len);
+    bytesToDiscard_ -= len;
+    if (bytesToDiscard_ > 0) {
+      return false;
+    }
+  }
+
+  uint64_t length;
+  int headerLength = readVarint(buf, length);
+  if (headerLength == 0) {
+    needed = 1;
+    return false;
+  }
+  if (headerLength < 0) {
+    // There is no way to find the next frame
+    buf.move();
+    ctx->fireReadException(folly::make_exception_wrapper<std::runtime_error>(
+                             "Malformed varint length field"));
+    return false;
+  }
+
+  if (length > maxFrameLength_ || length + headerLength > maxFrameLength_) {
+    bytesToDiscard_ = length + headerLength;
+    auto len = std::min<uint64_t>(bytesToDiscard_, buf.chainLength());
+    buf.trimStart(len);
+    bytesToDiscard_ -= len;
+    ctx->fireReadException(folly::make_exception_wrapper<std::runtime_error>(
+                             "Frame larger than " +
+                             folly::to<std::string>(maxFrameLength_)));
+    return false;
+  }
+
+  const uint64_t frameLength = length + headerLength;
+  if (buf.chainLength() < frameLength) {
+    needed = frameLength - buf.chainLength();
+    return false;
+  }
+
+  if (stripLengthField_) {
+    buf.trimStart(headerLength);
+    result = length > 0 ? buf.split(length) : IOBuf::create(0);
+  } else {
+    result = buf.split(frameLength);
+  }
+  return true;
+}
+
+int VarintFrameDecoder::readVarint(IOBufQueue& buf, uint64_t& value) {
+  value = 0;
+  int i = 0;
+  const IOBuf* front = buf.front();
+  const IOBuf* seg = front;
+  if (!seg) {
+    return 0;
+  }
+  // At most 10 bytes for 64 bits, the last of which may only hold one bit
+  do {
+    for (size_t j = 0; j < seg->length(); j++) {
+      const uint8_t b = seg->data()[j];
+      if (i == 9 && b > 1) {
+        return -1;
+      }
+      value |= uint64_t(b & 0x7f) << (7 * i);
+      i++;
+      if (!(b & 0x80)) {
+        return i;
+      }
+    }
+    seg = seg->next();
+  } while (seg != front);
+  return 0;
+}
+
+} // namespace wangle
@@ -0,0 +1,56 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/codec/ByteToMessageDecoder.h>
+
+namespace wangle {
+
+/**
+ * A decoder that splits the received IOBufs by a varint length prefix, as
+ * used by protobuf-style delimited streams: every frame is the base 128
+ * varint encoding of the payload length followed by the payload.
+ *
+ * +--------+----------------+      +----------------+
+ * | 0x0C   | "HELLO, WORLD" |----->| "HELLO, WORLD" |
+ * +--------+----------------+      +----------------+
+ *
+ * The varint is read in place even when it is split across IOBufs. Frames
+ * (length field included) larger than maxFrameLength are skipped as they
+ * arrive, without buffering them, and an exception is fired for each.
+ * Unless stripLengthField is false, the length field is removed from the
+ * frames passed on.
+ *
+ * @see VarintLengthFieldPrepender
+ */
+class VarintFrameDecoder : public ByteToByteDecoder {
+ public:
+  explicit VarintFrameDecoder(uint32_t maxFrameLength = UINT_MAX,
+                              bool stripLengthField = true);
+
+  bool decode(Context* ctx,
+              folly::IOBufQueue& buf,
+              std::unique_ptr<folly::IOBuf>& result,
+              size_t& needed) override;
+
+ private:
+  // Returns the length of the varint at the front of buf and sets value, 0
+  // if it is incomplete, or -1 if it is malformed
+  int readVarint(folly::IOBufQueue& buf, uint64_t& value);
+
+  uint32_t maxFrameLength_;
+  bool stripLengthField_;
+
+  // Rest of an oversized frame still to be skipped
+  uint64_t bytesToDiscard_{0};
+};
+
+} // namespace wangle
@@ -0,0 +1,47 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/codec/VarintLengthFieldPrepender.h>
+
+#include <cstring>
+
+using folly::Future;
+using folly::Unit;
+using folly::IOBuf;
+
+namespace wangle {
+
+constexpr size_t VarintLengthFieldPrepender::kMaxLengthFieldLength;
+
+Future<Unit> VarintLengthFieldPrepender::write(
+    Context* ctx, std::unique_ptr<IOBuf> buf) {
+  uint8_t field[kMaxLengthFieldLength];
+  size_t fieldLength = 0;
+  uint64_t length = buf->computeChainDataLength();
+  while (length >= 0x80) {
+    field[fieldLength++] = 0x80 | (length & 0x7f);
+    length >>= 7;
+  }
+  field[fieldLength++] = length;
+
+  std::unique_ptr<IOBuf> out;
+  if (buf->headroom() >= fieldLength && !buf->isSharedOne()) {
+    buf->prepend(fieldLength);
+    out = std::move(buf);
+  } else {
+    out = IOBuf::create(fieldLength);
+    out->append(fieldLength);
+    out->prependChain(std::move(buf));
+  }
+  memcpy(out->writableData(), field, fieldLength);
+  return ctx->fireWrite(std::move(out));
+}
+
+} // namespace wangle
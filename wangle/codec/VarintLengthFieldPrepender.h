@@ -0,0 +1,39 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/channel/Handler.h>
+
+namespace wangle {
+
+/**
+ * An encoder that prepends the length of the message as a base 128 varint,
+ * taking one byte for messages up to 127 bytes, two up to 16383 and so on.
+ *
+ * +----------------+      +--------+----------------+
+ * | "HELLO, WORLD" |----->| 0x0C   | "HELLO, WORLD" |
+ * +----------------+      +--------+----------------+
+ *
+ * Like LengthFieldPrepender, the length is written into the message's
+ * headroom when there is enough of it and the buffer isn't shared.
+ *
+ * @see VarintFrameDecoder
+ */
+class VarintLengthFieldPrepender : public OutboundBytesToBytesHandler {
+ public:
+  static constexpr size_t kMaxLengthFieldLength = 10;
+
+  folly::Future<folly::Unit> write(
+      Context* ctx,
+      std::unique_ptr<folly::IOBuf> buf) override;
+};
+
+} // namespace wangle
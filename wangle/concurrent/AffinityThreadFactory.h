@@ -0,0 +1,124 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/concurrent/ThreadFactory.h>
+#include <folly/Conv.h>
+#include <folly/FileUtil.h>
+#include <folly/MoveWrapper.h>
+#include <folly/String.h>
+#include <glog/logging.h>
+
+#include <atomic>
+#include <cstring>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace wangle {
+
+/**
+ * A ThreadFactory that pins each thread to a set of CPUs. Threads are
+ * given the sets in turn, so one set per core pins each thread to a core
+ * and one set per NUMA node (see getNumaNodes()) spreads the threads evenly
+ * over the nodes. Memory a thread touches first, such as its EventBase and
+ * its connections' buffers, is then allocated on its own node.
+ *
+ * Affinity is only supported on linux; elsewhere threads are not pinned.
+ */
+class AffinityThreadFactory : public ThreadFactory {
+ public:
+  explicit AffinityThreadFactory(std::shared_ptr<ThreadFactory> factory,
+                                 std::vector<std::vector<size_t>> cpuSets)
+    : factory_(std::move(factory))
+    , cpuSets_(std::move(cpuSets)) {
+    CHECK(!cpuSets_.empty());
+  }
+
+  std::thread newThread(folly::Func&& func) override {
+    folly::MoveWrapper<folly::Func> movedFunc(std::move(func));
+    const auto& cpus = cpuSets_[next_++ % cpuSets_.size()];
+    return factory_->newThread([cpus, movedFunc] () {
+      setAffinity(cpus);
+      (*movedFunc)();
+    });
+  }
+
+  // Pins the calling thread
+  static void setAffinity(const std::vector<size_t>& cpus) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : cpus) {
+      CPU_SET(cpu, &set);
+    }
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err != 0) {
+      LOG(ERROR) << "pthread_setaffinity_np failed with error " <<
+        strerror(err);
+    }
+#endif
+  }
+
+  // The CPUs of each NUMA node, or of a single node with all CPUs if the
+  // system doesn't say
+  static std::vector<std::vector<size_t>> getNumaNodes() {
+    std::vector<std::vector<size_t>> nodes;
+    std::string cpuList;
+    while (folly::readFile(
+             folly::to<std::string>("/sys/devices/system/node/node",
+                                    nodes.size(), "/cpulist").c_str(),
+             cpuList)) {
+      nodes.push_back(parseCpuList(cpuList));
+    }
+    if (nodes.empty() || nodes[0].empty()) {
+      std::vector<size_t> all;
+      for (size_t cpu = 0; cpu < std::thread::hardware_concurrency(); cpu++) {
+        all.push_back(cpu);
+      }
+      nodes.assign(1, all);
+    }
+    return nodes;
+  }
+
+  // Parses the kernel's CPU list format, e.g. "0-11,24-35"
+  static std::vector<size_t> parseCpuList(folly::StringPiece list) {
+    std::vector<size_t> cpus;
+    std::vector<folly::StringPiece> ranges;
+    folly::split(',', folly::trimWhitespace(list), ranges, true);
+    for (auto range : ranges) {
+      folly::StringPiece first, last;
+      if (folly::split('-', range, first, last)) {
+        for (auto cpu = folly::to<size_t>(first);
+             cpu <= folly::to<size_t>(last); cpu++) {
+          cpus.push_back(cpu);
+        }
+      } else {
+        cpus.push_back(folly::to<size_t>(range));
+      }
+    }
+    return cpus;
+  }
+
+  size_t getNumCpuSets() const {
+    return cpuSets_.size();
+  }
+
+ private:
+  std::shared_ptr<ThreadFactory> factory_;
+  std::vector<std::vector<size_t>> cpuSets_;
+  std::atomic<size_t> next_{0};
+};
+
+} // namespace wangle
@@ -11,6 +11,12 @@
 #pragma once
 #include <folly/futures/Future.h>
 #include <wangle/concurrent/GlobalExecutor.h>
+#include <wangle/concurrent/ThreadPoolExecutor.h>
+
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <vector>
 
 namespace wangle {
 
@@ -19,5 +25,99 @@ auto async(F&& fn) {
   return folly::via<F>(getCPUExecutor().get(), std::forward<F>(fn));
 }
 
+namespace detail {
+
+// One chunk per thread of the CPU executor if it is a thread pool
+inline size_t asyncNumChunks(
+    folly::Executor* executor,
+    size_t n,
+    size_t numChunks) {
+  if (numChunks == 0) {
+    auto pool = dynamic_cast<ThreadPoolExecutor*>(executor);
+    numChunks = pool ? pool->numThreads() : 1;
+  }
+  return std::max<size_t>(1, std::min(n, numChunks));
+}
+
+// Runs chunkFn(first, last) on the CPU executor for each chunk of the n
+// elements from begin, and collects the results
+template <class It, class ChunkFn>
+auto asyncChunks(It begin, size_t n, size_t numChunks, ChunkFn chunkFn) {
+  auto executor = getCPUExecutor();
+  const size_t chunks = asyncNumChunks(executor.get(), n, numChunks);
+  using Result = decltype(chunkFn(begin, begin));
+  std::vector<folly::Future<typename folly::Unit::Lift<Result>::type>> futures;
+  futures.reserve(chunks);
+  It first = begin;
+  for (size_t i = 0; i < chunks; i++) {
+    // The first n % chunks chunks have one more element
+    It last = std::next(first, n / chunks + (i < n % chunks ? 1 : 0));
+    futures.push_back(folly::via(executor.get(), [chunkFn, first, last] {
+      return chunkFn(first, last);
+    }));
+    first = last;
+  }
+  return folly::collectAll(futures.begin(), futures.end());
+}
+
+} // namespace detail
+
+/**
+ * Calls fn on every element of range on the CPU executor, and returns the
+ * results in order once all are done. Elements are split into numChunks
+ * contiguous chunks, by default one per CPU thread, and each chunk is a
+ * single task, so there is one Future and one executor hop per chunk rather
+ * than per element.
+ *
+ * fn is called concurrently from several threads. range must stay alive
+ * until the Future completes. If fn throws, the Future fails with the
+ * exception of the first chunk that threw.
+ */
+template <class Range, class F>
+auto asyncMap(Range& range, F&& fn, size_t numChunks = 0) {
+  using It = decltype(std::begin(range));
+  using Result = typename std::decay<decltype(fn(*std::begin(range)))>::type;
+  auto f = std::make_shared<typename std::decay<F>::type>(std::forward<F>(fn));
+  const size_t n = std::distance(std::begin(range), std::end(range));
+  return detail::asyncChunks(std::begin(range), n, numChunks,
+      [f](It first, It last) {
+        std::vector<Result> results;
+        results.reserve(std::distance(first, last));
+        for (; first != last; ++first) {
+          results.push_back((*f)(*first));
+        }
+        return results;
+      })
+    .then([n](std::vector<folly::Try<std::vector<Result>>>&& chunks) {
+      std::vector<Result> results;
+      results.reserve(n);
+      for (auto& chunk : chunks) {
+        for (auto& result : chunk.value()) {
+          results.push_back(std::move(result));
+        }
+      }
+      return results;
+    });
+}
+
+// Like asyncMap(), for functions called for their side effects
+template <class Range, class F>
+folly::Future<folly::Unit> asyncAll(Range& range, F&& fn,
+                                    size_t numChunks = 0) {
+  using It = decltype(std::begin(range));
+  auto f = std::make_shared<typename std::decay<F>::type>(std::forward<F>(fn));
+  const size_t n = std::distance(std::begin(range), std::end(range));
+  return detail::asyncChunks(std::begin(range), n, numChunks,
+      [f](It first, It last) {
+        for (; first != last; ++first) {
+          (*f)(*first);
+        }
+      })
+    .then([](std::vector<folly::Try<folly::Unit>>&& chunks) {
+      for (auto& chunk : chunks) {
+        chunk.throwIfFailed();
+      }
+    });
+}
 
 } //namespace wangle
@@ -12,6 +12,9 @@
 
 #include <glog/logging.h>
 
+#include <chrono>
+#include <vector>
+
 namespace wangle {
 
 // Some queue implementations (for example, LifoSemMPMCQueue or
@@ -27,6 +30,33 @@ class BlockingQueue {
   virtual void addWithPriority(T item, int8_t priority) {
     add(std::move(item));
   }
+  // Adds all items at once, so implementations can wake consumers together
+  virtual void addBatch(std::vector<T> items) {
+    for (auto& item : items) {
+      add(std::move(item));
+    }
+  }
+  // Like add(), but return false if the queue is full instead of throwing or
+  // blocking. item is only moved from if it was added. Unbounded queues
+  // needn't override these.
+  virtual bool tryAdd(T&& item) {
+    add(std::move(item));
+    return true;
+  }
+  virtual bool tryAddWithPriority(T&& item, int8_t priority) {
+    return tryAdd(std::move(item));
+  }
+  // Like tryAdd(), but wait up to timeout for room. Queues that can't wait
+  // give up at once.
+  virtual bool addFor(T&& item, std::chrono::milliseconds timeout) {
+    return tryAdd(std::move(item));
+  }
+  virtual bool addWithPriorityFor(
+      T&& item,
+      int8_t priority,
+      std::chrono::milliseconds timeout) {
+    return addFor(std::move(item), timeout);
+  }
   virtual uint8_t getNumPriorities() {
     return 1;
   }
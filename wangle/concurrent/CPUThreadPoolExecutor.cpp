@@ -82,6 +82,15 @@ void CPUThreadPoolExecutor::add(
       CPUTask(std::move(func), expiration, std::move(expireCallback)));
 }
 
+void CPUThreadPoolExecutor::addBatch(std::vector<Func> funcs) {
+  std::vector<CPUTask> tasks;
+  tasks.reserve(funcs.size());
+  for (auto& func : funcs) {
+    tasks.emplace_back(std::move(func), std::chrono::milliseconds(0), nullptr);
+  }
+  taskQueue_->addBatch(std::move(tasks));
+}
+
 void CPUThreadPoolExecutor::addWithPriority(Func func, int8_t priority) {
   add(std::move(func), priority, std::chrono::milliseconds(0));
 }
@@ -97,6 +106,27 @@ void CPUThreadPoolExecutor::add(
       priority);
 }
 
+bool CPUThreadPoolExecutor::tryAdd(Func&& func, int8_t priority) {
+  CPUTask task(std::move(func), std::chrono::milliseconds(0), nullptr);
+  if (taskQueue_->tryAddWithPriority(std::move(task), priority)) {
+    return true;
+  }
+  func = std::move(task.func_);
+  return false;
+}
+
+bool CPUThreadPoolExecutor::addFor(
+    Func&& func,
+    std::chrono::milliseconds timeout,
+    int8_t priority) {
+  CPUTask task(std::move(func), std::chrono::milliseconds(0), nullptr);
+  if (taskQueue_->addWithPriorityFor(std::move(task), priority, timeout)) {
+    return true;
+  }
+  func = std::move(task.func_);
+  return false;
+}
+
 uint8_t CPUThreadPoolExecutor::getNumPriorities() const {
   return taskQueue_->getNumPriorities();
 }
@@ -119,7 +149,8 @@ void CPUThreadPoolExecutor::threadRun(std::shared_ptr<Thread> thread) {
       stoppedThreads_.add(thread);
       return;
     } else {
-      runTask(thread, std::move(task));
+      runTask(
+          thread.get(), std::move(task), shedOnOverload_ ? &codel_ : nullptr);
     }
 
     if (UNLIKELY(threadsToStop_ > 0 && !isJoin_)) {
@@ -21,7 +21,8 @@ namespace wangle {
  * Because of this contention can be quite high,
  * since all the worker threads and all the producer threads hit
  * the same queue. MPMC queue excels in this situation but dictates a max queue
- * size
+ * size. Pass a WorkStealingQueue as taskQueue to give each worker thread its
+ * own queue instead.
  *
  * @note LifoSem wakes up threads in Lifo order - i.e. there are only few
  * threads as necessary running, and we always try to reuse the same few threads
@@ -32,6 +33,11 @@ namespace wangle {
  *
  * @note stop() will finish all outstanding tasks at exit
  *
+ * @note With setShedOnOverload(true), every dequeued task's queueing delay is
+ * fed to a Codel instance. While it reports overload, tasks that waited
+ * longer than its slough timeout are expired - their expire callback runs
+ * instead of the task - so the pool sheds load adaptively.
+ *
  * @note Supports priorities - priorities are implemented as multiple queues -
  * each worker thread checks the highest priority queue first. Threads
  * themselves don't have priorities set, so a series of long running low
@@ -74,6 +80,8 @@ CPUThreadPoolExecutor(
       std::chrono::milliseconds expiration,
       folly::Func expireCallback = nullptr) override;
 
+  void addBatch(std::vector<folly::Func> funcs) override;
+
   void addWithPriority(folly::Func func, int8_t priority) override;
   void add(
       folly::Func func,
@@ -81,8 +89,29 @@ CPUThreadPoolExecutor(
       std::chrono::milliseconds expiration,
       folly::Func expireCallback = nullptr);
 
+  // Return false if the queue is full, instead of throwing or blocking as
+  // add() does. func is only moved from if it was added, so it can be
+  // retried later or rejected cheaply.
+  bool tryAdd(
+      folly::Func&& func,
+      int8_t priority = folly::Executor::MID_PRI);
+  // Like tryAdd(), but wait up to timeout for room in the queue
+  bool addFor(
+      folly::Func&& func,
+      std::chrono::milliseconds timeout,
+      int8_t priority = folly::Executor::MID_PRI);
+
   uint8_t getNumPriorities() const override;
 
+  void setShedOnOverload(bool shed) {
+    shedOnOverload_ = shed;
+  }
+
+  // Tracks queueing delay while shedding is enabled, e.g. for getLoad()
+  Codel& getCodel() {
+    return codel_;
+  }
+
   struct CPUTask : public ThreadPoolExecutor::Task {
     // Must be noexcept move constructible so it can be used in MPMCQueue
     explicit CPUTask(
@@ -95,8 +124,7 @@ CPUThreadPoolExecutor(
       : Task(nullptr, std::chrono::milliseconds(0), nullptr),
         poison(true) {}
     CPUTask(CPUTask&& o) noexcept : Task(std::move(o)), poison(o.poison) {}
-    CPUTask(const CPUTask&) = default;
-    CPUTask& operator=(const CPUTask&) = default;
+    CPUTask& operator=(CPUTask&&) = default;
     bool poison;
   };
 
@@ -112,6 +140,8 @@ CPUThreadPoolExecutor(
 
   std::unique_ptr<BlockingQueue<CPUTask>> taskQueue_;
   std::atomic<ssize_t> threadsToStop_{0};
+  std::atomic<bool> shedOnOverload_{false};
+  Codel codel_;
 };
 
 } // namespace wangle
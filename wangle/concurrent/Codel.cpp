@@ -30,55 +30,97 @@ namespace wangle {
   int32_t FLAGS_codel_target_delay = 5;
 #endif
 
+constexpr size_t Codel::kNumShards;
+constexpr uint64_t Codel::kDelayBits;
+constexpr uint64_t Codel::kMaxDelay;
+constexpr uint64_t Codel::kEpochMask;
+
+namespace {
+
+int64_t nowNs() {
+  return std::chrono::duration_cast<nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+size_t shardIndex(size_t numShards) {
+  static std::atomic<size_t> nextIndex{0};
+  static thread_local size_t index = nextIndex++;
+  return index % numShards;
+}
+
+} // namespace
+
 Codel::Codel()
-    : codelMinDelay_(0),
-      codelIntervalTime_(std::chrono::steady_clock::now()),
+    : codelIntervalTime_(nowNs()),
+      epoch_(1),
       codelResetDelay_(true),
       overloaded_(false) {}
 
 bool Codel::overloaded(std::chrono::nanoseconds delay) {
-  bool ret = false;
-  auto now = std::chrono::steady_clock::now();
-
-  // Avoid another thread updating the value at the same time we are using it
-  // to calculate the overloaded state
-  auto minDelay = codelMinDelay_;
+  auto now = nowNs();
 
-  if (now  > codelIntervalTime_ &&
+  auto intervalTime = codelIntervalTime_.load(std::memory_order_relaxed);
+  if (now > intervalTime &&
       // testing before exchanging is more cacheline-friendly
-      (!codelResetDelay_.load(std::memory_order_acquire)
-       && !codelResetDelay_.exchange(true))) {
-    codelIntervalTime_ = now + getInterval();
-
-    if (minDelay > getTargetDelay()) {
-      overloaded_ = true;
-    } else {
-      overloaded_ = false;
+      !codelResetDelay_.load(std::memory_order_acquire) &&
+      codelIntervalTime_.compare_exchange_strong(
+        intervalTime,
+        now + std::chrono::duration_cast<nanoseconds>(getInterval()).count())) {
+    // We won the interval; nobody else gets here until the next one
+    auto epoch = epoch_.load(std::memory_order_relaxed);
+    auto minDelay = nanoseconds(mergeShards(epoch));
+    overloaded_.store(minDelay > getTargetDelay(), std::memory_order_relaxed);
+    // Tag 0 is never used, so shards nobody has written to never match
+    if (((epoch + 1) & kEpochMask) == 0) {
+      epoch++;
     }
+    epoch_.store(epoch + 1, std::memory_order_release);
+    codelResetDelay_.store(true, std::memory_order_release);
   }
-  // Care must be taken that only a single thread resets codelMinDelay_,
-  // and that it happens after the interval reset above
+
+  // Only a single thread starts the new interval's minimum, after the
+  // interval reset above
   if (codelResetDelay_.load(std::memory_order_acquire) &&
       codelResetDelay_.exchange(false)) {
-    codelMinDelay_ = delay;
+    recordDelay(epoch_.load(std::memory_order_acquire), delay);
     // More than one request must come in during an interval before codel
     // starts dropping requests
     return false;
-  } else if(delay < codelMinDelay_) {
-    codelMinDelay_ = delay;
   }
+  recordDelay(epoch_.load(std::memory_order_acquire), delay);
 
   // Here is where we apply different logic than codel proper. Instead of
   // adapting the interval until the next drop, we slough off requests with
   // queueing delay > 2*target_delay while in the overloaded regime. This
   // empirically works better for our services than the codel approach of
   // increasingly often dropping packets.
-  if (overloaded_ && delay > getSloughTimeout()) {
-    ret = true;
-  }
+  return overloaded_.load(std::memory_order_relaxed) &&
+    delay > getSloughTimeout();
+}
 
-  return ret;
+void Codel::recordDelay(uint64_t epoch, nanoseconds delay) {
+  const uint64_t tag = (epoch & kEpochMask) << kDelayBits;
+  const uint64_t value = tag |
+    std::min<uint64_t>(std::max<int64_t>(delay.count(), 0), kMaxDelay);
+  auto& shard = shards_[shardIndex(kNumShards)].minDelay;
+  auto old = shard.load(std::memory_order_relaxed);
+  // Only write when this is the shard's first delay of the interval or a new
+  // minimum, which is rare once the interval is under way
+  while (((old & ~kMaxDelay) != tag || value < old) &&
+         !shard.compare_exchange_weak(old, value, std::memory_order_relaxed)) {
+  }
+}
 
+uint64_t Codel::mergeShards(uint64_t epoch) {
+  const uint64_t tag = (epoch & kEpochMask) << kDelayBits;
+  uint64_t minDelay = kMaxDelay + 1;
+  for (auto& shard : shards_) {
+    auto value = shard.minDelay.load(std::memory_order_relaxed);
+    if ((value & ~kMaxDelay) == tag) {
+      minDelay = std::min(minDelay, value & kMaxDelay);
+    }
+  }
+  return minDelay > kMaxDelay ? 0 : minDelay;
 }
 
 int Codel::getLoad() {
@@ -88,7 +130,7 @@ int Codel::getLoad() {
 }
 
 nanoseconds Codel::getMinDelay() {
-  return codelMinDelay_;
+  return nanoseconds(mergeShards(epoch_.load(std::memory_order_acquire)));
 }
 
 milliseconds Codel::getInterval() {
@@ -12,6 +12,7 @@
 
 #include <atomic>
 #include <chrono>
+#include <cstdint>
 
 #ifndef NO_LIB_GFLAGS
   #include <gflags/gflags.h>
@@ -46,6 +47,10 @@ namespace wangle {
 /// You can also ask for an instantaneous load estimate and the minimum delay
 /// observed during this interval.
 ///
+/// overloaded() may be called from many threads at once, e.g. by every
+/// consumer of a queue on every dequeue. Outside of the one call per interval
+/// that ends it, it only reads shared state and updates a per thread shard.
+///
 ///
 /// 1. http://queue.acm.org/detail.cfm?id=2209336
 /// 2. https://en.wikipedia.org/wiki/CoDel
@@ -76,14 +81,37 @@ class Codel {
   std::chrono::milliseconds getSloughTimeout();
 
  private:
-  std::chrono::nanoseconds codelMinDelay_;
-  std::chrono::time_point<std::chrono::steady_clock> codelIntervalTime_;
+  // Each thread records the minimum delay it sees in one of kNumShards
+  // shards, so threads calling overloaded() on every dequeue don't write to
+  // a shared cache line. The thread that ends an interval merges the shards.
+  static constexpr size_t kNumShards = 16;
+
+  // A shard holds the low kEpochBits of the interval sequence number it was
+  // written in and the minimum delay in ns, saturated at kMaxDelay
+  static constexpr uint64_t kDelayBits = 40;
+  static constexpr uint64_t kMaxDelay = (uint64_t(1) << kDelayBits) - 1;
+  static constexpr uint64_t kEpochMask = (uint64_t(1) << (64 - kDelayBits)) - 1;
+
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> minDelay{0};
+  };
+
+  void recordDelay(uint64_t epoch, std::chrono::nanoseconds delay);
+
+  // Minimum delay seen during the given interval, or 0 if there was none
+  uint64_t mergeShards(uint64_t epoch);
+
+  // Read by every call and written once per interval
+  std::atomic<int64_t> codelIntervalTime_;
+  std::atomic<uint64_t> epoch_;
 
   // flag to make overloaded() thread-safe, since we only want
   // to reset the delay once per time period
   std::atomic<bool> codelResetDelay_;
 
-  bool overloaded_;
+  std::atomic<bool> overloaded_;
+
+  Shard shards_[kNumShards];
 };
 
 } // namespace wangle
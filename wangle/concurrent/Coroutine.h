@@ -0,0 +1,281 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+// Only available to code built with coroutine support (e.g. -std=c++20);
+// wangle itself doesn't need it. Tested with BUILD_COROUTINE_TESTS.
+#if defined(__cpp_impl_coroutine)
+
+#include <folly/Executor.h>
+#include <folly/futures/Future.h>
+#include <folly/futures/Promise.h>
+
+#include <coroutine>
+#include <cstdlib>
+#include <exception>
+#include <new>
+#include <type_traits>
+
+namespace wangle {
+
+/**
+ * Lets functions returning folly::Future, such as Service::operator() or
+ * handlers chaining Pipeline::write(), be written as coroutines:
+ *
+ *   folly::Future<Resp> MyService::operator()(Req req) {
+ *     co_await *cpuExecutor_;               // continue on a CPU thread
+ *     auto resp = compute(req);
+ *     co_await *ioExecutor_;                // back to an IO thread
+ *     co_await backend_(std::move(resp));   // wait for a Future
+ *     co_return resp;
+ *   }
+ *
+ * Inside such a coroutine, co_await on a Future suspends until it completes
+ * and resumes wherever it was completed, without suspending at all if it is
+ * already complete; co_await on a folly::Executor resumes on one of the
+ * executor's threads. An exception escaping the coroutine fails the Future
+ * it returned.
+ *
+ * Each step costs one tiny continuation instead of a Future and a callback,
+ * and coroutine frames come from the CoroutineFrameAllocator of the thread
+ * that creates them, so on an IO thread, from its EventBase's cache.
+ */
+
+/**
+ * Caches freed coroutine frames per thread, by size class. Frames freed on
+ * another thread than the one they were allocated on go to that thread's
+ * cache, which is fine as long as threads keep to a few sizes.
+ */
+class CoroutineFrameAllocator {
+ public:
+  static constexpr size_t kGranularity = 64;
+  static constexpr size_t kNumClasses = 16;
+  static constexpr size_t kMaxCachedPerClass = 64;
+
+  static void* allocate(size_t size) {
+    const size_t c = sizeClass(size);
+    if (c < kNumClasses) {
+      auto& list = cache().lists[c];
+      if (list.head) {
+        auto frame = list.head;
+        list.head = frame->next;
+        list.size--;
+        return frame;
+      }
+      size = (c + 1) * kGranularity;
+    }
+    auto p = std::malloc(size);
+    if (!p) {
+      throw std::bad_alloc();
+    }
+    return p;
+  }
+
+  static void deallocate(void* p, size_t size) {
+    const size_t c = sizeClass(size);
+    if (c < kNumClasses) {
+      auto& list = cache().lists[c];
+      if (list.size < kMaxCachedPerClass) {
+        auto frame = static_cast<Frame*>(p);
+        frame->next = list.head;
+        list.head = frame;
+        list.size++;
+        return;
+      }
+    }
+    std::free(p);
+  }
+
+ private:
+  struct Frame {
+    Frame* next;
+  };
+
+  struct FreeList {
+    Frame* head{nullptr};
+    size_t size{0};
+  };
+
+  struct Cache {
+    ~Cache() {
+      for (auto& list : lists) {
+        while (list.head) {
+          auto next = list.head->next;
+          std::free(list.head);
+          list.head = next;
+        }
+      }
+    }
+
+    FreeList lists[kNumClasses];
+  };
+
+  static size_t sizeClass(size_t size) {
+    return (size + kGranularity - 1) / kGranularity - 1;
+  }
+
+  static Cache& cache() {
+    static thread_local Cache cache;
+    return cache;
+  }
+};
+
+namespace detail {
+
+template <class T>
+class FutureAwaiter {
+ public:
+  explicit FutureAwaiter(folly::Future<T>&& future)
+    : future_(std::move(future)) {}
+
+  bool await_ready() {
+    return future_.isReady();
+  }
+
+  void await_suspend(std::coroutine_handle<> h) {
+    suspended_ = true;
+    // If the future completes meanwhile, the coroutine, and this awaiter
+    // with it, may be gone by the time then() returns
+    auto future = std::move(future_);
+    future.then([this, h](folly::Try<T>&& result) {
+      result_ = std::move(result);
+      h.resume();
+    });
+  }
+
+  T await_resume() {
+    if (suspended_) {
+      return std::move(result_.value());
+    }
+    return std::move(future_.value());
+  }
+
+ private:
+  folly::Future<T> future_;
+  folly::Try<T> result_;
+  bool suspended_{false};
+};
+
+class ExecutorAwaiter {
+ public:
+  explicit ExecutorAwaiter(folly::Executor& executor) : executor_(executor) {}
+
+  bool await_ready() {
+    return false;
+  }
+
+  void await_suspend(std::coroutine_handle<> h) {
+    executor_.add([h] { h.resume(); });
+  }
+
+  void await_resume() {}
+
+ private:
+  folly::Executor& executor_;
+};
+
+template <class T>
+struct IsFuture : std::false_type {};
+
+template <class T>
+struct IsFuture<folly::Future<T>> : std::true_type {};
+
+class FuturePromiseBase {
+ public:
+  static void* operator new(size_t size) {
+    return CoroutineFrameAllocator::allocate(size);
+  }
+
+  static void operator delete(void* p, size_t size) {
+    CoroutineFrameAllocator::deallocate(p, size);
+  }
+
+  std::suspend_never initial_suspend() noexcept {
+    return {};
+  }
+
+  std::suspend_never final_suspend() noexcept {
+    return {};
+  }
+
+  template <class T>
+  FutureAwaiter<T> await_transform(folly::Future<T>&& future) {
+    return FutureAwaiter<T>(std::move(future));
+  }
+
+  ExecutorAwaiter await_transform(folly::Executor& executor) {
+    return ExecutorAwaiter(executor);
+  }
+
+  // Anything else is awaited as it is
+  template <
+      class A,
+      class = typename std::enable_if<
+          !IsFuture<typename std::decay<A>::type>::value &&
+          !std::is_base_of<folly::Executor,
+                           typename std::decay<A>::type>::value>::type>
+  A&& await_transform(A&& awaitable) {
+    return std::forward<A>(awaitable);
+  }
+};
+
+template <class T>
+class FuturePromise : public FuturePromiseBase {
+ public:
+  folly::Future<T> get_return_object() {
+    return promise_.getFuture();
+  }
+
+  template <class U>
+  void return_value(U&& value) {
+    promise_.setValue(std::forward<U>(value));
+  }
+
+  void unhandled_exception() {
+    promise_.setException(std::current_exception());
+  }
+
+ private:
+  folly::Promise<T> promise_;
+};
+
+template <>
+class FuturePromise<folly::Unit> : public FuturePromiseBase {
+ public:
+  folly::Future<folly::Unit> get_return_object() {
+    return promise_.getFuture();
+  }
+
+  void return_void() {
+    promise_.setValue();
+  }
+
+  void unhandled_exception() {
+    promise_.setException(std::current_exception());
+  }
+
+ private:
+  folly::Promise<folly::Unit> promise_;
+};
+
+} // namespace detail
+} // namespace wangle
+
+namespace std {
+
+template <class T, class... Args>
+struct coroutine_traits<folly::Future<T>, Args...> {
+  using promise_type = wangle::detail::FuturePromise<T>;
+};
+
+} // namespace std
+
+#endif
@@ -0,0 +1,184 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+#include <wangle/concurrent/BlockingQueue.h>
+#include <wangle/concurrent/CPUThreadPoolExecutor.h>
+#include <folly/LifoSem.h>
+#include <folly/Memory.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace wangle {
+
+/**
+ * A CPUThreadPoolExecutor queue that hands out tasks earliest deadline
+ * first. A task's deadline is its enqueue time plus its expiration, or plus
+ * defaultDeadline if it has none. Under overload, the tasks that can still
+ * make their deadline run first, and those that can't come out as soon as
+ * they are due and are expired by the pool (which calls their expire
+ * callback) instead of being run late.
+ *
+ * Tasks are spread over numShards heaps, each producer thread sticking to
+ * one. take() pops the heap with the earliest head, so ordering is exact
+ * within a heap and nearly so across them. Priorities are ignored.
+ */
+class DeadlineQueue : public BlockingQueue<CPUThreadPoolExecutor::CPUTask> {
+ public:
+  using CPUTask = CPUThreadPoolExecutor::CPUTask;
+
+  explicit DeadlineQueue(
+      size_t capacity = CPUThreadPoolExecutor::kDefaultMaxQueueSize,
+      std::chrono::milliseconds defaultDeadline = std::chrono::seconds(1),
+      size_t numShards = 8)
+      : capacity_(capacity),
+        defaultDeadline_(defaultDeadline),
+        shards_(numShards) {
+    CHECK_GT(numShards, 0);
+    for (auto& s : shards_) {
+      s = folly::make_unique<Shard>();
+    }
+  }
+
+  void add(CPUTask item) override {
+    if (item.poison) {
+      // Threads stop once the tasks already queued have run
+      size_++;
+      poisons_++;
+    } else {
+      if (size_.fetch_add(1) >= capacity_) {
+        size_--;
+        throw std::runtime_error("DeadlineQueue full, can't add item");
+      }
+      push(std::move(item));
+    }
+    sem_.post();
+  }
+
+  bool tryAdd(CPUTask&& item) override {
+    if (item.poison) {
+      add(std::move(item));
+      return true;
+    }
+    if (size_.fetch_add(1) >= capacity_) {
+      size_--;
+      return false;
+    }
+    push(std::move(item));
+    sem_.post();
+    return true;
+  }
+
+  CPUTask take() override {
+    sem_.wait();
+    size_--;
+    CPUTask item;
+    if (!pop(item)) {
+      // Items are pushed before sem_ is posted, so this is a poison
+      CHECK(poisons_-- > 0);
+    }
+    return item;
+  }
+
+  size_t size() override {
+    return size_.load();
+  }
+
+ private:
+  static constexpr int64_t kEmpty = std::numeric_limits<int64_t>::max();
+
+  struct Entry {
+    int64_t deadline;
+    uint64_t seq;
+    CPUTask task;
+
+    // Heap order, earliest deadline on top
+    bool operator<(const Entry& o) const {
+      return deadline != o.deadline ? deadline > o.deadline : seq > o.seq;
+    }
+  };
+
+  struct FOLLY_ALIGN_TO_AVOID_FALSE_SHARING Shard {
+    std::mutex mutex;
+    std::vector<Entry> heap;
+    uint64_t seq{0};
+    // Deadline of the top of the heap, or kEmpty
+    std::atomic<int64_t> head{kEmpty};
+  };
+
+  int64_t deadlineOf(const CPUTask& task) const {
+    auto expiration = task.expiration_ &&
+        task.expiration_->expiration > std::chrono::milliseconds(0) ?
+      task.expiration_->expiration : defaultDeadline_;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        (task.enqueueTime_ + expiration).time_since_epoch()).count();
+  }
+
+  Shard& producerShard() {
+    static std::atomic<size_t> nextThread{0};
+    static thread_local size_t thread = nextThread++;
+    return *shards_[thread % shards_.size()];
+  }
+
+  void push(CPUTask task) {
+    const int64_t deadline = deadlineOf(task);
+    auto& s = producerShard();
+    std::lock_guard<std::mutex> g(s.mutex);
+    s.heap.push_back(Entry{deadline, s.seq++, std::move(task)});
+    std::push_heap(s.heap.begin(), s.heap.end());
+    s.head = s.heap.front().deadline;
+  }
+
+  bool pop(CPUTask& task) {
+    while (true) {
+      Shard* best = nullptr;
+      int64_t bestDeadline = kEmpty;
+      for (auto& s : shards_) {
+        const int64_t head = s->head.load();
+        if (head < bestDeadline) {
+          best = s.get();
+          bestDeadline = head;
+        }
+      }
+      if (!best) {
+        return false;
+      }
+      std::lock_guard<std::mutex> g(best->mutex);
+      if (best->heap.empty()) {
+        // Taken by another consumer since we looked
+        continue;
+      }
+      std::pop_heap(best->heap.begin(), best->heap.end());
+      task = std::move(best->heap.back().task);
+      best->heap.pop_back();
+      if (best->heap.empty()) {
+        best->head = kEmpty;
+      } else {
+        best->head = best->heap.front().deadline;
+      }
+      return true;
+    }
+  }
+
+  const size_t capacity_;
+  const std::chrono::milliseconds defaultDeadline_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::atomic<size_t> size_{0};
+  std::atomic<size_t> poisons_{0};
+  folly::LifoSem sem_;
+};
+
+} // namespace wangle
@@ -0,0 +1,46 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/concurrent/EventBaseMetrics.h>
+
+#include <algorithm>
+
+namespace wangle {
+
+namespace {
+
+// A plain pointer, so that looking it up on every read stays cheap
+thread_local EventBaseMetrics* localMetrics = nullptr;
+
+}
+
+EventBaseMetrics* EventBaseMetrics::local() {
+  return localMetrics;
+}
+
+void EventBaseMetrics::setLocal(EventBaseMetrics* metrics) {
+  localMetrics = metrics;
+}
+
+EventBaseMetrics::Snapshot EventBaseMetrics::getSnapshot() const {
+  Snapshot snapshot;
+  snapshot.connections = uint64_t(
+      std::max<int64_t>(connections_.load(std::memory_order_relaxed), 0));
+  snapshot.handshakes = uint64_t(
+      std::max<int64_t>(handshakes_.load(std::memory_order_relaxed), 0));
+  snapshot.bytesRead = bytesRead_.load(std::memory_order_relaxed);
+  snapshot.bytesWritten = bytesWritten_.load(std::memory_order_relaxed);
+  snapshot.busyTime = std::chrono::microseconds(
+      busyTime_.load(std::memory_order_relaxed));
+  snapshot.loops = loops_.load(std::memory_order_relaxed);
+  return snapshot;
+}
+
+} // namespace wangle
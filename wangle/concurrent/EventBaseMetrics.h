@@ -0,0 +1,98 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace wangle {
+
+/**
+ * What one IO thread is doing, for an admin endpoint to compare threads
+ * and spot the hot ones. The thread's connection managers, acceptors,
+ * socket handlers and loop update the metrics of the thread they run in,
+ * found through local(), as a few relaxed atomic operations on counters no
+ * other thread writes; any thread reads them with getSnapshot().
+ *
+ * IOThreadPoolExecutor threads have metrics; other threads have none, and
+ * nothing is counted in them.
+ */
+class EventBaseMetrics {
+ public:
+  struct Snapshot {
+    uint64_t threadId{0};
+    // Connections held by the thread's ConnectionManagers
+    uint64_t connections{0};
+    // TLS handshakes the thread's acceptors are running
+    uint64_t handshakes{0};
+    // Tasks passed to add() that haven't run yet
+    uint64_t pendingTasks{0};
+    // Through the thread's AsyncSocketHandlers, since it started
+    uint64_t bytesRead{0};
+    uint64_t bytesWritten{0};
+    // Time the loop spent handling events rather than waiting, since the
+    // thread started, and the loop iterations that took
+    std::chrono::microseconds busyTime{0};
+    uint64_t loops{0};
+  };
+
+  // This thread's, or nullptr
+  static EventBaseMetrics* local();
+
+  // Sets this thread's, nullptr to unset them
+  static void setLocal(EventBaseMetrics* metrics);
+
+  // Gauges, which a connection taken over from another thread's manager
+  // decrements from this thread
+  void addConnections(int64_t n) {
+    connections_.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  void addHandshakes(int64_t n) {
+    handshakes_.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  // Counters, only ever changed by the owning thread
+  void addBytesRead(uint64_t n) {
+    increment(bytesRead_, n);
+  }
+
+  void addBytesWritten(uint64_t n) {
+    increment(bytesWritten_, n);
+  }
+
+  void addLoop(std::chrono::microseconds busyTime) {
+    increment(busyTime_, busyTime.count());
+    increment(loops_, 1);
+  }
+
+  // All but threadId and pendingTasks, which the pool knows
+  Snapshot getSnapshot() const;
+
+ private:
+  template <class T>
+  static void increment(std::atomic<T>& counter, T n) {
+    // No read-modify-write needed with a single writer
+    counter.store(
+        counter.load(std::memory_order_relaxed) + n,
+        std::memory_order_relaxed);
+  }
+
+  std::atomic<int64_t> connections_{0};
+  std::atomic<int64_t> handshakes_{0};
+  std::atomic<uint64_t> bytesRead_{0};
+  std::atomic<uint64_t> bytesWritten_{0};
+  std::atomic<int64_t> busyTime_{0};
+  std::atomic<uint64_t> loops_{0};
+};
+
+} // namespace wangle
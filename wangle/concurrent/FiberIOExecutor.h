@@ -10,7 +10,13 @@
 
 #pragma once
 
+#include <atomic>
+#include <memory>
+
+#include <folly/MoveWrapper.h>
+#include <folly/ScopeGuard.h>
 #include <folly/experimental/fibers/FiberManagerMap.h>
+#include <folly/io/async/EventBase.h>
 #include <wangle/concurrent/IOExecutor.h>
 
 namespace wangle {
@@ -21,24 +27,107 @@ namespace wangle {
  *
  * A FiberIOExecutor wraps an IOExecutor, but executes funcs on the FiberManager
  * mapped to the underlying IOExector's event base.
+ *
+ * The options size the FiberManagers: stackSize, maxFibersPoolSize, which
+ * caps the stacks each EventBase keeps for reuse (so the pool takes at most
+ * the IO thread count times that many stacks), and useGuardPages. They only
+ * apply to the EventBases whose FiberManager this creates, i.e. those no
+ * other user of getFiberManager() got to first.
  */
 class FiberIOExecutor : public IOExecutor {
  public:
+  typedef folly::fibers::FiberManager::Options Options;
+
+  struct FiberStats {
+    // Funcs started and not yet finished, e.g. waiting on a Baton
+    uint64_t activeFibers{0};
+    uint64_t peakActiveFibers{0};
+    // Funcs that got a pooled fiber, and ones whose fiber was allocated
+    uint64_t poolHits{0};
+    uint64_t poolMisses{0};
+    // The most stack a fiber was seen to use, in bytes, as sampled when
+    // funcs are added. Only measured with Options::recordStackEvery set.
+    uint64_t stackHighWatermark{0};
+  };
+
   explicit FiberIOExecutor(
-      const std::shared_ptr<IOExecutor>& ioExecutor)
-      : ioExecutor_(ioExecutor) {}
+      const std::shared_ptr<IOExecutor>& ioExecutor,
+      Options options = Options())
+      : ioExecutor_(ioExecutor),
+        state_(std::make_shared<State>(options)) {}
 
   virtual void add(std::function<void()> f) override {
     auto eventBase = ioExecutor_->getEventBase();
-    getFiberManager(*eventBase).add(std::move(f));
+    if (eventBase->isInEventBaseThread()) {
+      addFiber(eventBase, state_, std::move(f));
+      return;
+    }
+    // FiberManager::add() is only for its own thread
+    auto func = folly::makeMoveWrapper(std::move(f));
+    auto state = state_;
+    eventBase->runInEventBaseThread([eventBase, state, func]() mutable {
+      addFiber(eventBase, state, std::move(*func));
+    });
   }
 
-  virtual EventBase* getEventBase() override {
+  virtual folly::EventBase* getEventBase() override {
     return ioExecutor_->getEventBase();
   }
 
+  // Of every func added, on any of the EventBases
+  FiberStats getFiberStats() const {
+    FiberStats stats;
+    stats.activeFibers = state_->activeFibers;
+    stats.peakActiveFibers = state_->peakActiveFibers;
+    stats.poolHits = state_->poolHits;
+    stats.poolMisses = state_->poolMisses;
+    stats.stackHighWatermark = state_->stackHighWatermark;
+    return stats;
+  }
+
  private:
+  // Shared with the funcs, which may outlive the executor
+  struct State {
+    explicit State(Options opts) : options(opts) {}
+
+    const Options options;
+    std::atomic<uint64_t> activeFibers{0};
+    std::atomic<uint64_t> peakActiveFibers{0};
+    std::atomic<uint64_t> poolHits{0};
+    std::atomic<uint64_t> poolMisses{0};
+    std::atomic<uint64_t> stackHighWatermark{0};
+  };
+
+  static void addFiber(
+      folly::EventBase* eventBase,
+      const std::shared_ptr<State>& state,
+      std::function<void()> f) {
+    auto& fm = folly::fibers::getFiberManager(*eventBase, state->options);
+    // add() takes its fiber from the pool right away, if there's one
+    if (fm.fibersPoolSize() > 0) {
+      state->poolHits++;
+    } else {
+      state->poolMisses++;
+    }
+    updateMax(state->peakActiveFibers, ++state->activeFibers);
+    updateMax(state->stackHighWatermark, fm.stackHighWatermark());
+    auto func = folly::makeMoveWrapper(std::move(f));
+    fm.add([state, func]() mutable {
+      SCOPE_EXIT {
+        state->activeFibers--;
+      };
+      (*func)();
+    });
+  }
+
+  static void updateMax(std::atomic<uint64_t>& max, uint64_t value) {
+    auto current = max.load();
+    while (value > current && !max.compare_exchange_weak(current, value)) {
+    }
+  }
+
   std::shared_ptr<IOExecutor> ioExecutor_;
+  std::shared_ptr<State> state_;
 };
 
 } // namespace wangle
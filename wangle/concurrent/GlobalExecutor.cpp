@@ -13,11 +13,18 @@
 #include <wangle/concurrent/IOThreadPoolExecutor.h>
 #include <folly/futures/InlineExecutor.h>
 
+#include <atomic>
+
 using namespace folly;
 using namespace wangle;
 
 namespace {
 
+// Bumped whenever the global executor may have changed, so threads know
+// their cached copy of it is stale
+std::atomic<uint64_t> globalCPUExecutorEpoch{1};
+std::atomic<uint64_t> globalIOExecutorEpoch{1};
+
 // lock protecting global CPU executor
 struct CPUExecutorLock {};
 Singleton<RWSpinLock, CPUExecutorLock> globalCPUExecutorLock;
@@ -49,7 +56,7 @@ Singleton<std::shared_ptr<IOThreadPoolExecutor>> globalIOThreadPool(
 namespace wangle {
 
 template <class Exe, class DefaultExe, class LockTag>
-std::shared_ptr<Exe> getExecutor(
+std::shared_ptr<Exe> getExecutorSlow(
     Singleton<std::weak_ptr<Exe>>& sExecutor,
     Singleton<std::shared_ptr<DefaultExe>>& sDefaultExecutor,
     Singleton<RWSpinLock, LockTag>& sExecutorLock) {
@@ -75,36 +82,70 @@ std::shared_ptr<Exe> getExecutor(
   return executor;
 }
 
+// A thread's copy of a global executor, valid while epoch matches
+template <class Exe>
+struct CachedExecutor {
+  uint64_t epoch{0};
+  std::weak_ptr<Exe> executor;
+};
+
+template <class Exe, class DefaultExe, class LockTag>
+std::shared_ptr<Exe> getExecutor(
+    Singleton<std::weak_ptr<Exe>>& sExecutor,
+    Singleton<std::shared_ptr<DefaultExe>>& sDefaultExecutor,
+    Singleton<RWSpinLock, LockTag>& sExecutorLock,
+    std::atomic<uint64_t>& sEpoch) {
+  // Steady state: no lock and no singleton lookup
+  static thread_local CachedExecutor<Exe> cache;
+  const auto epoch = sEpoch.load(std::memory_order_acquire);
+  std::shared_ptr<Exe> executor;
+  if (cache.epoch == epoch && (executor = cache.executor.lock())) {
+    return executor;
+  }
+
+  executor = getExecutorSlow(sExecutor, sDefaultExecutor, sExecutorLock);
+  // Another set may have raced with the lookup, in which case the next call
+  // looks again
+  cache.epoch = epoch;
+  cache.executor = executor;
+  return executor;
+}
+
 template <class Exe, class LockTag>
 void setExecutor(
     std::shared_ptr<Exe> executor,
     Singleton<std::weak_ptr<Exe>>& sExecutor,
-    Singleton<RWSpinLock, LockTag>& sExecutorLock) {
+    Singleton<RWSpinLock, LockTag>& sExecutorLock,
+    std::atomic<uint64_t>& sEpoch) {
   auto lock = sExecutorLock.try_get();
   RWSpinLock::WriteHolder guard(*lock);
   std::weak_ptr<Exe> executor_weak = executor;
   sExecutor.try_get().get()->swap(executor_weak);
+  sEpoch.fetch_add(1, std::memory_order_release);
 }
 
 std::shared_ptr<Executor> getCPUExecutor() {
   return getExecutor(
       globalCPUExecutor,
       globalInlineExecutor,
-      globalCPUExecutorLock);
+      globalCPUExecutorLock,
+      globalCPUExecutorEpoch);
 }
 
 void setCPUExecutor(std::shared_ptr<Executor> executor) {
   setExecutor(
       std::move(executor),
       globalCPUExecutor,
-      globalCPUExecutorLock);
+      globalCPUExecutorLock,
+      globalCPUExecutorEpoch);
 }
 
 std::shared_ptr<IOExecutor> getIOExecutor() {
   return getExecutor(
       globalIOExecutor,
       globalIOThreadPool,
-      globalIOExecutorLock);
+      globalIOExecutorLock,
+      globalIOExecutorEpoch);
 }
 
 EventBase* getEventBase() {
@@ -115,7 +156,8 @@ void setIOExecutor(std::shared_ptr<IOExecutor> executor) {
   setExecutor(
       std::move(executor),
       globalIOExecutor,
-      globalIOExecutorLock);
+      globalIOExecutorLock,
+      globalIOExecutorEpoch);
 }
 
 } // namespace wangle
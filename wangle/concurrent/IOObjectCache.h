@@ -13,6 +13,12 @@
 #include <folly/ThreadLocal.h>
 #include <folly/io/async/EventBase.h>
 #include <wangle/concurrent/GlobalExecutor.h>
+#include <wangle/concurrent/IOThreadPoolExecutor.h>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <set>
 
 namespace wangle {
 
@@ -31,6 +37,10 @@ namespace wangle {
  * clients that are only ever called from within other threads without the
  * calling thread needing to know anything about the IO threads that the clients
  * will do their work on.
+ *
+ * When the global IOExecutor is an IOThreadPoolExecutor, each calling thread
+ * keeps its objects in a vector indexed by the IO thread's slot, and drops
+ * the objects of IO threads that have stopped on its next get().
  */
 template <class T>
 class IOObjectCache {
@@ -41,16 +51,57 @@ class IOObjectCache {
   explicit IOObjectCache(TFactory factory)
     : factory_(std::move(factory)) {}
 
+  ~IOObjectCache() {
+    std::vector<std::weak_ptr<IOExecutor>> pools;
+    {
+      std::lock_guard<std::mutex> g(threads_->mutex);
+      pools.swap(threads_->pools);
+    }
+    for (auto& weak : pools) {
+      if (auto pool = std::dynamic_pointer_cast<IOThreadPoolExecutor>(
+            weak.lock())) {
+        pool->removeObserver(threads_);
+      }
+    }
+  }
+
   std::shared_ptr<T> get() {
     CHECK(factory_);
-    auto eb = getIOExecutor()->getEventBase();
+    auto executor = getIOExecutor();
+    auto pool = dynamic_cast<IOThreadPoolExecutor*>(executor.get());
+    if (!pool) {
+      auto eb = executor->getEventBase();
+      CHECK(eb);
+      auto it = cache_->objects.find(eb);
+      if (it == cache_->objects.end()) {
+        auto p = cache_->objects.insert(std::make_pair(eb, factory_(eb)));
+        it = p.first;
+      }
+      return it->second;
+    }
+
+    // Objects of IO threads are stored by the thread's slot, and dropped
+    // from every calling thread once their IO thread has stopped
+    auto& cache = *cache_;
+    if (threads_->epoch.load(std::memory_order_relaxed) != cache.epoch) {
+      sweep(cache);
+    }
+    auto thread = pool->getThread();
+    const auto slot = IOThreadPoolExecutor::getSlot(thread.get());
+    const auto id = IOThreadPoolExecutor::getThreadId(thread.get());
+    if (slot < cache.slots.size() && cache.slots[slot].threadId == id) {
+      return cache.slots[slot].object;
+    }
+
+    watch(executor);
+    auto eb = IOThreadPoolExecutor::getEventBase(thread.get());
     CHECK(eb);
-    auto it = cache_->find(eb);
-    if (it == cache_->end()) {
-      auto p = cache_->insert(std::make_pair(eb, factory_(eb)));
-      it = p.first;
+    if (slot >= cache.slots.size()) {
+      cache.slots.resize(slot + 1);
     }
-    return it->second;
+    cache.slots[slot].threadId = id;
+    cache.slots[slot].object = factory_(eb);
+    return cache.slots[slot].object;
   };
 
   void setFactory(TFactory factory) {
@@ -58,7 +109,73 @@ class IOObjectCache {
   }
 
  private:
-  folly::ThreadLocal<std::map<folly::EventBase*, std::shared_ptr<T>>> cache_;
+  // Tracks the running threads of the pools objects were created for
+  class Threads : public ThreadPoolExecutor::Observer {
+   public:
+    void threadStarted(ThreadPoolExecutor::ThreadHandle* h) override {
+      std::lock_guard<std::mutex> g(mutex);
+      running.insert(IOThreadPoolExecutor::getThreadId(h));
+    }
+
+    void threadStopped(ThreadPoolExecutor::ThreadHandle* h) override {
+      std::lock_guard<std::mutex> g(mutex);
+      running.erase(IOThreadPoolExecutor::getThreadId(h));
+      epoch++;
+    }
+
+    std::mutex mutex;
+    std::set<uint64_t> running;
+    std::vector<std::weak_ptr<IOExecutor>> pools;
+    // Bumped when a thread stops, so callers know to sweep their objects
+    std::atomic<uint64_t> epoch{0};
+  };
+
+  struct Slot {
+    uint64_t threadId{0};
+    std::shared_ptr<T> object;
+  };
+
+  struct Cache {
+    std::vector<Slot> slots;
+    uint64_t epoch{0};
+    // For IOExecutors other than IOThreadPoolExecutor
+    std::map<folly::EventBase*, std::shared_ptr<T>> objects;
+  };
+
+  void sweep(Cache& cache) {
+    std::lock_guard<std::mutex> g(threads_->mutex);
+    cache.epoch = threads_->epoch.load();
+    for (auto& slot : cache.slots) {
+      if (slot.object && !threads_->running.count(slot.threadId)) {
+        slot = Slot();
+      }
+    }
+  }
+
+  // Starts tracking the threads of pool, if not already
+  void watch(const std::shared_ptr<IOExecutor>& pool) {
+    {
+      std::lock_guard<std::mutex> g(threads_->mutex);
+      auto& pools = threads_->pools;
+      pools.erase(std::remove_if(pools.begin(), pools.end(),
+                                 [](const std::weak_ptr<IOExecutor>& p) {
+                                   return p.expired();
+                                 }),
+                  pools.end());
+      for (auto& p : pools) {
+        if (p.lock() == pool) {
+          return;
+        }
+      }
+      pools.push_back(pool);
+    }
+    // Calls threadStarted() for the running threads
+    std::dynamic_pointer_cast<IOThreadPoolExecutor>(pool)->addObserver(
+      threads_);
+  }
+
+  folly::ThreadLocal<Cache> cache_;
+  std::shared_ptr<Threads> threads_{std::make_shared<Threads>()};
   TFactory factory_;
 };
 
@@ -10,7 +10,10 @@
 
 #include <wangle/concurrent/IOThreadPoolExecutor.h>
 
+#include <folly/Conv.h>
+#include <folly/Malloc.h>
 #include <folly/MoveWrapper.h>
+#include <folly/Random.h>
 #include <glog/logging.h>
 
 #include <folly/detail/MemoryIdler.h>
@@ -30,7 +33,10 @@ using folly::RWSpinLock;
 class MemoryIdlerTimeout
     : public AsyncTimeout , public EventBase::LoopCallback {
  public:
-  explicit MemoryIdlerTimeout(EventBase* b) : AsyncTimeout(b), base_(b) {}
+  MemoryIdlerTimeout(
+      EventBase* b,
+      const IOThreadPoolExecutor::MemoryIdlerOptions& options)
+    : AsyncTimeout(b), base_(b), options_(options) {}
 
   void timeoutExpired() noexcept override { idled = true; }
 
@@ -38,10 +44,15 @@ class MemoryIdlerTimeout
     if (idled) {
       MemoryIdler::flushLocalMallocCaches();
       MemoryIdler::unmapUnusedStack(MemoryIdler::kDefaultStackToRetain);
+      if (options_.purgeArena) {
+        purgeArena();
+      }
 
       idled = false;
     } else {
       std::chrono::steady_clock::duration idleTimeout =
+        options_.idleTimeout > std::chrono::milliseconds(0) ?
+        options_.idleTimeout :
         MemoryIdler::defaultIdleTimeout.load(
           std::memory_order_acquire);
 
@@ -55,21 +66,81 @@ class MemoryIdlerTimeout
     base_->runBeforeLoop(this);
   }
  private:
+  // Returns the dirty pages of this thread's arena to the OS
+  static void purgeArena() {
+    if (!folly::usingJEMalloc()) {
+      return;
+    }
+    unsigned arena;
+    size_t len = sizeof(arena);
+    if (mallctl("thread.arena", &arena, &len, nullptr, 0) != 0) {
+      return;
+    }
+    auto name = folly::to<std::string>("arena.", arena, ".purge");
+    mallctl(name.c_str(), nullptr, nullptr, nullptr, 0);
+  }
+
   EventBase* base_;
+  const IOThreadPoolExecutor::MemoryIdlerOptions options_;
   bool idled{false};
 } ;
 
+// Records how long each iteration of a thread's loop is busy
+class LoopObserver : public folly::EventBaseObserver {
+ public:
+  LoopObserver(
+      IOThreadPoolExecutor* pool,
+      IOThreadPoolExecutor::IOThread* ioThread)
+    : pool_(pool), ioThread_(ioThread) {}
+
+  uint32_t getSampleRate() const override {
+    return 1;
+  }
+
+  void loopSample(int64_t busyTime, int64_t /* idleTime */) override {
+    const std::chrono::microseconds busy(busyTime);
+    ioThread_->loopTimes.add(busy);
+    ioThread_->metrics.addLoop(busy);
+    const auto threshold = pool_->stallThreshold_.load();
+    if (threshold > 0 && busy >= std::chrono::milliseconds(threshold)) {
+      ioThread_->stalls++;
+      LOG(WARNING) << "IO thread " << ioThread_->id << " was busy for "
+                   << busy.count() << "us without polling its sockets";
+    }
+  }
+
+ private:
+  IOThreadPoolExecutor* pool_;
+  IOThreadPoolExecutor::IOThread* ioThread_;
+};
+
 IOThreadPoolExecutor::IOThreadPoolExecutor(
     size_t numThreads,
     std::shared_ptr<ThreadFactory> threadFactory,
-    EventBaseManager* ebm)
+    EventBaseManager* ebm,
+    MemoryIdlerOptions memoryIdlerOptions,
+    BusyPollOptions busyPollOptions)
   : ThreadPoolExecutor(numThreads, std::move(threadFactory)),
     nextThread_(0),
-    eventBaseManager_(ebm) {
+    eventBaseManager_(ebm),
+    memoryIdlerOptions_(memoryIdlerOptions),
+    busyPollOptions_(busyPollOptions) {
   addThreads(numThreads);
   CHECK(threadList_.get().size() == numThreads);
 }
 
+folly::AsyncSocket::OptionMap
+IOThreadPoolExecutor::BusyPollOptions::socketOption() const {
+  folly::AsyncSocket::OptionMap options;
+#ifdef SO_BUSY_POLL
+  if (socketBusyPoll > std::chrono::microseconds(0)) {
+    options[folly::AsyncSocket::OptionKey{SOL_SOCKET, SO_BUSY_POLL}] =
+      socketBusyPoll.count();
+  }
+#endif
+  return options;
+}
+
 IOThreadPoolExecutor::~IOThreadPoolExecutor() {
   stop();
 }
@@ -82,37 +153,208 @@ void IOThreadPoolExecutor::add(
     Func func,
     std::chrono::milliseconds expiration,
     Func expireCallback) {
-  RWSpinLock::ReadHolder{&threadListLock_};
-  if (threadList_.get().empty()) {
-    throw std::runtime_error("No threads available");
+  add(std::move(func), MID_PRI, expiration, std::move(expireCallback));
+}
+
+void IOThreadPoolExecutor::addWithPriority(Func func, int8_t priority) {
+  add(std::move(func), priority, std::chrono::milliseconds(0));
+}
+
+void IOThreadPoolExecutor::add(
+    Func func,
+    int8_t priority,
+    std::chrono::milliseconds expiration,
+    Func expireCallback) {
+  std::shared_ptr<IOThread> ioThread;
+  while (true) {
+    ioThread = pickThread();
+    if (!ioThread) {
+      throw std::runtime_error("No threads available");
+    }
+    // Once pendingTasks is raised an exiting thread waits for the task, so
+    // only threads that were exiting before need to be skipped. They drop
+    // out of the thread list shortly.
+    ioThread->pendingTasks++;
+    if (LIKELY(!ioThread->exiting) || ioThread == *thisThread_) {
+      break;
+    }
+    // Taken back from its loop, which the exiting thread may be blocked
+    // in, so that it wakes up to see the count drop
+    auto t = ioThread;
+    if (!ioThread->eventBase->runInEventBaseThread(
+          [t] { t->pendingTasks--; })) {
+      ioThread->pendingTasks--;
+    }
+  }
+
+  Task task(std::move(func), expiration, std::move(expireCallback));
+  if (LIKELY(taskQueue(ioThread.get(), priority).write(std::move(task)))) {
+    // Small enough for folly::Func to store inline. Each callback runs the
+    // best task queued when it runs: one callback per queued task, or with
+    // batching, one drain for all the tasks queued in the meantime.
+    IOThread* thread = ioThread.get();
+    if (maxBatchedTasks_ > 0) {
+      // The drain already queued, if any, takes this task too. Tasks are
+      // counted until run, so if the drain can't be queued, the task and
+      // any others added meanwhile wait for the next drain or the exit.
+      if (!ioThread->drainScheduled.exchange(true) &&
+          !ioThread->eventBase->runInEventBaseThread(
+            [this, thread] { drainTasks(thread); })) {
+        ioThread->drainScheduled = false;
+      }
+      return;
+    }
+    if (!ioThread->eventBase->runInEventBaseThread(
+          [this, thread] { runQueuedTask(thread); })) {
+      // The task can't be taken back out, so it runs with a later callback
+      // or when the thread exits
+      ioThread->pendingTasks--;
+    }
+    return;
   }
-  auto ioThread = pickThread();
 
-  auto moveTask = folly::makeMoveWrapper(
-      Task(std::move(func), expiration, std::move(expireCallback)));
-  auto wrappedFunc = [ioThread, moveTask] () mutable {
-    runTask(ioThread, std::move(*moveTask));
+  // The queue is full; fall back to queueing the task itself
+  auto moveTask = folly::makeMoveWrapper(std::move(task));
+  auto wrappedFunc = [this, ioThread, moveTask] () mutable {
+    runTask(ioThread.get(), std::move(*moveTask));
     ioThread->pendingTasks--;
   };
 
-  ioThread->pendingTasks++;
   if (!ioThread->eventBase->runInEventBaseThread(std::move(wrappedFunc))) {
     ioThread->pendingTasks--;
     throw std::runtime_error("Unable to run func in event base thread");
   }
 }
 
+folly::MPMCQueue<IOThreadPoolExecutor::Task>&
+IOThreadPoolExecutor::taskQueue(IOThread* ioThread, int8_t priority) {
+  if (priority > MID_PRI) {
+    return ioThread->hiPriTasks;
+  }
+  return priority < MID_PRI ? ioThread->loPriTasks : ioThread->tasks;
+}
+
+bool IOThreadPoolExecutor::takeTask(IOThread* ioThread, Task& task) {
+  return ioThread->hiPriTasks.read(task) ||
+    ioThread->tasks.read(task) ||
+    ioThread->loPriTasks.read(task);
+}
+
+void IOThreadPoolExecutor::runQueuedTask(IOThread* ioThread) {
+  Task task;
+  if (takeTask(ioThread, task)) {
+    runTask(ioThread, std::move(task));
+  }
+  ioThread->pendingTasks--;
+}
+
+void IOThreadPoolExecutor::runPendingTasks(IOThread* ioThread) {
+  if (maxBatchedTasks_ == 0) {
+    // Each task's callback is queued by the time it's counted, or it's
+    // uncounted right after
+    while (ioThread->pendingTasks > 0) {
+      ioThread->eventBase->loopOnce();
+    }
+    return;
+  }
+  // Batched tasks may be counted without a drain queued for them, so they
+  // are taken from the lanes here; the count may also be ahead of a task
+  // still being added, which is polled for
+  Task task;
+  while (ioThread->pendingTasks > 0) {
+    if (takeTask(ioThread, task)) {
+      runTask(ioThread, std::move(task));
+      ioThread->pendingTasks--;
+    } else {
+      ioThread->eventBase->loopOnce(EVLOOP_NONBLOCK);
+    }
+  }
+}
+
+void IOThreadPoolExecutor::drainTasks(IOThread* ioThread) {
+  // Cleared first, so that a task added from now on, which this drain may
+  // not see, queues another one
+  ioThread->drainScheduled = false;
+  const uint32_t maxTasks = maxBatchedTasks_;
+  Task task;
+  for (uint32_t i = 0; i < maxTasks; i++) {
+    if (!takeTask(ioThread, task)) {
+      return;
+    }
+    runTask(ioThread, std::move(task));
+    ioThread->pendingTasks--;
+  }
+  // The rest wait for this iteration's IO, without another wakeup
+  if (!ioThread->drainScheduled.exchange(true)) {
+    ioThread->eventBase->runInLoop([this, ioThread] { drainTasks(ioThread); });
+  }
+}
+
+void IOThreadPoolExecutor::busyPollLoop(IOThread* ioThread) {
+  EventBase* eventBase = ioThread->eventBase;
+  const auto spinTime = busyPollOptions_.spinTime;
+  auto spinUntil = std::chrono::steady_clock::now() + spinTime;
+  while (ioThread->shouldRun) {
+    const bool busy = ioThread->pendingTasks > 0;
+    eventBase->loopOnce(EVLOOP_NONBLOCK);
+    const auto now = std::chrono::steady_clock::now();
+    if (busy) {
+      spinUntil = now + spinTime;
+    } else if (now >= spinUntil) {
+      // A nonblocking loop may have swallowed terminateLoopSoon(), which is
+      // only called once shouldRun is false
+      if (!ioThread->shouldRun) {
+        break;
+      }
+      eventBase->loopOnce();
+      spinUntil = std::chrono::steady_clock::now() + spinTime;
+    }
+  }
+}
+
+// Takes no locks unless the thread list changed since this thread last used
+// it, so it is safe to call concurrently with setNumThreads()
+const std::vector<ThreadPoolExecutor::ThreadPtr>&
+IOThreadPoolExecutor::getThreads() {
+  auto& cache = *threadListCache_;
+  const auto version = threadList_.version();
+  if (UNLIKELY(cache.version != version)) {
+    cache.threads = threadList_.snapshot();
+    cache.version = version;
+  }
+  return *cache.threads;
+}
+
 std::shared_ptr<IOThreadPoolExecutor::IOThread>
 IOThreadPoolExecutor::pickThread() {
   if (*thisThread_) {
     return *thisThread_;
   }
-  auto thread = threadList_.get()[nextThread_++ % threadList_.get().size()];
+  const auto& threads = getThreads();
+  const size_t n = threads.size();
+  if (n == 0) {
+    return nullptr;
+  }
+  if (threadSelection_ == ThreadSelection::TWO_CHOICES && n > 1) {
+    const auto a = folly::Random::rand32(n);
+    auto b = folly::Random::rand32(n - 1);
+    if (b >= a) {
+      b++;
+    }
+    auto threadA = std::static_pointer_cast<IOThread>(threads[a]);
+    auto threadB = std::static_pointer_cast<IOThread>(threads[b]);
+    return threadA->pendingTasks <= threadB->pendingTasks ? threadA : threadB;
+  }
+  auto thread = threads[nextThread_++ % n];
   return std::static_pointer_cast<IOThread>(thread);
 }
 
 EventBase* IOThreadPoolExecutor::getEventBase() {
-  return pickThread()->eventBase;
+  auto ioThread = pickThread();
+  if (!ioThread) {
+    throw std::runtime_error("No threads available");
+  }
+  return ioThread->eventBase;
 }
 
 EventBase* IOThreadPoolExecutor::getEventBase(
@@ -126,10 +368,81 @@ EventBase* IOThreadPoolExecutor::getEventBase(
   return nullptr;
 }
 
+std::shared_ptr<ThreadPoolExecutor::ThreadHandle>
+IOThreadPoolExecutor::getThread() {
+  auto ioThread = pickThread();
+  if (!ioThread) {
+    throw std::runtime_error("No threads available");
+  }
+  return ioThread;
+}
+
+size_t IOThreadPoolExecutor::getSlot(ThreadPoolExecutor::ThreadHandle* h) {
+  auto thread = dynamic_cast<IOThread*>(h);
+  CHECK(thread);
+  return thread->slot;
+}
+
+uint64_t IOThreadPoolExecutor::getThreadId(
+    ThreadPoolExecutor::ThreadHandle* h) {
+  auto thread = dynamic_cast<IOThread*>(h);
+  CHECK(thread);
+  return thread->id;
+}
+
+size_t IOThreadPoolExecutor::allocateSlot() {
+  std::lock_guard<std::mutex> g(slotsMutex_);
+  auto it = std::find(slotsInUse_.begin(), slotsInUse_.end(), false);
+  const size_t slot = it - slotsInUse_.begin();
+  if (it == slotsInUse_.end()) {
+    slotsInUse_.push_back(true);
+  } else {
+    *it = true;
+  }
+  return slot;
+}
+
+void IOThreadPoolExecutor::releaseSlot(size_t slot) {
+  std::lock_guard<std::mutex> g(slotsMutex_);
+  slotsInUse_[slot] = false;
+}
+
+std::vector<IOThreadPoolExecutor::LoopStats>
+IOThreadPoolExecutor::getLoopStats() {
+  RWSpinLock::ReadHolder r{&threadListLock_};
+  std::vector<LoopStats> stats(threadList_.get().size());
+  for (size_t i = 0; i < stats.size(); i++) {
+    auto ioThread = std::static_pointer_cast<IOThread>(threadList_.get()[i]);
+    stats[i].threadId = ioThread->id;
+    ioThread->loopTimes.snapshot(stats[i].loopTime);
+    ioThread->waitTimes.snapshot(stats[i].waitTime);
+    stats[i].stalls = ioThread->stalls;
+  }
+  return stats;
+}
+
+std::vector<EventBaseMetrics::Snapshot>
+IOThreadPoolExecutor::getEventBaseMetrics() {
+  // Without threadListLock_, so polling never holds up adding threads
+  auto threads = threadList_.snapshot();
+  std::vector<EventBaseMetrics::Snapshot> metrics;
+  metrics.reserve(threads->size());
+  for (auto& thread : *threads) {
+    auto ioThread = std::static_pointer_cast<IOThread>(thread);
+    metrics.push_back(ioThread->metrics.getSnapshot());
+    metrics.back().threadId = ioThread->id;
+    metrics.back().pendingTasks = ioThread->pendingTasks;
+  }
+  return metrics;
+}
+
 EventBaseManager* IOThreadPoolExecutor::getEventBaseManager() {
   return eventBaseManager_;
 }
 
+const size_t IOThreadPoolExecutor::kTaskQueueSize = 1 << 10;
+const size_t IOThreadPoolExecutor::kPriorityTaskQueueSize = 1 << 8;
+
 std::shared_ptr<ThreadPoolExecutor::Thread>
 IOThreadPoolExecutor::makeThread() {
   return std::make_shared<IOThread>(this);
@@ -139,23 +452,45 @@ void IOThreadPoolExecutor::threadRun(ThreadPtr thread) {
   const auto ioThread = std::static_pointer_cast<IOThread>(thread);
   ioThread->eventBase = eventBaseManager_->getEventBase();
   thisThread_.reset(new std::shared_ptr<IOThread>(ioThread));
+  EventBaseMetrics::setLocal(&ioThread->metrics);
+
+  std::unique_ptr<MemoryIdlerTimeout> idler;
+  if (memoryIdlerOptions_.enabled) {
+    idler.reset(
+        new MemoryIdlerTimeout(ioThread->eventBase, memoryIdlerOptions_));
+    ioThread->eventBase->runBeforeLoop(idler.get());
+  }
 
-  auto idler = new MemoryIdlerTimeout(ioThread->eventBase);
-  ioThread->eventBase->runBeforeLoop(idler);
+  ioThread->eventBase->setObserver(
+      std::make_shared<LoopObserver>(this, ioThread.get()));
 
   ioThread->eventBase->runInEventBaseThread(
       [thread]{ thread->startupBaton.post(); });
   while (ioThread->shouldRun) {
-    ioThread->eventBase->loopForever();
+    if (busyPollOptions_.spinTime > std::chrono::microseconds(0)) {
+      busyPollLoop(ioThread.get());
+    } else {
+      ioThread->eventBase->loopForever();
+    }
   }
   if (isJoin_) {
-    while (ioThread->pendingTasks > 0) {
-      ioThread->eventBase->loopOnce();
-    }
+    runPendingTasks(ioThread.get());
+  }
+  // Run what add() calls racing with the shutdown managed to queue
+  ioThread->exiting = true;
+  runPendingTasks(ioThread.get());
+  Task task;
+  while (takeTask(ioThread.get(), task)) {
+    runTask(ioThread.get(), std::move(task));
   }
+  releaseSlot(ioThread->slot);
   stoppedThreads_.add(ioThread);
 
+  // Unlinks it from the loop
+  idler.reset();
+  ioThread->eventBase->setObserver(nullptr);
   ioThread->eventBase = nullptr;
+  EventBaseMetrics::setLocal(nullptr);
   eventBaseManager_->clearEventBase();
 }
 
@@ -10,7 +10,9 @@
 
 #pragma once
 
+#include <folly/io/async/AsyncSocket.h>
 #include <folly/io/async/EventBaseManager.h>
+#include <wangle/concurrent/EventBaseMetrics.h>
 #include <wangle/concurrent/IOExecutor.h>
 #include <wangle/concurrent/ThreadPoolExecutor.h>
 
@@ -25,29 +27,86 @@ namespace wangle {
  * we don't make any additional syscalls to wake up the loop,
  * just put the new task in the queue.
  * If any thread has been waiting for more than a few seconds,
- * its stack is madvised away. Currently however tasks are scheduled round
- * robin on the queues, so unless there is no work going on,
- * this isn't very effective.
+ * its stack is madvised away (see MemoryIdlerOptions). Currently however
+ * tasks are scheduled round robin on the queues, so unless there is no work
+ * going on, this isn't very effective.
  * Since there is one queue per thread, there is hardly any contention
  * on the queues - so a simple spinlock around an std::deque is used for
  * the tasks. There is no max queue size.
  * By default, there is one thread per core - it usually doesn't make sense to
  * have more IO threads than this, assuming they don't block.
  *
+ * @note With BusyPollOptions::spinTime set, threads poll their loop without
+ * blocking for up to spinTime after the last work they saw before going
+ * back to epoll_wait, trading a core per thread for the wakeup latency.
+ *
+ * @note Tasks passed to add() wait in per thread lanes, one for each of high,
+ * medium (the default) and low priority. Each time the loop runs one, it
+ * takes it from the highest non-empty lane, so a health check added with
+ * HI_PRI overtakes bulk tasks already queued on its thread. Tasks are still
+ * run at most a few per loop iteration, interleaved with IO.
+ *
+ * @note With setMaxBatchedTasks(), the tasks queued on a thread while it
+ * isn't draining them share one callback, and so one eventfd write and
+ * wakeup, rather than taking one each: when a CPU pool hands many results
+ * to one IO thread at once, the thread wakes up once for all of them.
+ *
  * @note ::getEventBase() will return an EventBase you can schedule IO work on
  * directly, chosen round-robin.
  *
+ * @note With ThreadSelection::TWO_CHOICES, add() and getEventBase() pick
+ * two threads at random and use the one with fewer pending tasks, so a loop
+ * stuck on heavy work stops receiving new work. Only tasks passed to add()
+ * count as pending.
+ *
  * @note N.B. For this thread pool, stop() behaves like join() because
  * outstanding tasks belong to the event base and will be executed upon its
  * destruction.
  */
 class IOThreadPoolExecutor : public ThreadPoolExecutor, public IOExecutor {
  public:
+  enum class ThreadSelection {
+    ROUND_ROBIN,
+    TWO_CHOICES,
+  };
+
+  // What a thread gives back once its loop has been idle for a while
+  struct MemoryIdlerOptions {
+    MemoryIdlerOptions() {}
+
+    // If false, threads keep everything, and their loops don't pay for
+    // watching for idleness
+    bool enabled{true};
+    // 0 means folly::detail::MemoryIdler::defaultIdleTimeout
+    std::chrono::milliseconds idleTimeout{0};
+    // Also purge the dirty pages of the thread's jemalloc arena
+    bool purgeArena{false};
+  };
+
+  // How long a thread spins on its loop before blocking in epoll_wait
+  struct BusyPollOptions {
+    BusyPollOptions() {}
+
+    // 0 disables spinning. The spin restarts whenever the thread finds
+    // tasks queued by add(), and after every blocking wait.
+    std::chrono::microseconds spinTime{0};
+    // If non-zero, the SO_BUSY_POLL value for sockets served by the pool,
+    // so the kernel polls the NIC too. It needs CAP_NET_ADMIN, and the pool
+    // doesn't create sockets itself: pass socketOption() to
+    // ServerSocketConfig::setSocketOptions() or AsyncSocket::connect().
+    std::chrono::microseconds socketBusyPoll{0};
+
+    // Empty if socketBusyPoll is 0
+    folly::AsyncSocket::OptionMap socketOption() const;
+  };
+
   explicit IOThreadPoolExecutor(
       size_t numThreads,
       std::shared_ptr<ThreadFactory> threadFactory =
           std::make_shared<NamedThreadFactory>("IOThreadPool"),
-      folly::EventBaseManager* ebm = folly::EventBaseManager::get());
+      folly::EventBaseManager* ebm = folly::EventBaseManager::get(),
+      MemoryIdlerOptions memoryIdlerOptions = MemoryIdlerOptions(),
+      BusyPollOptions busyPollOptions = BusyPollOptions());
 
   ~IOThreadPoolExecutor();
 
@@ -57,32 +116,149 @@ class IOThreadPoolExecutor : public ThreadPoolExecutor, public IOExecutor {
       std::chrono::milliseconds expiration,
       folly::Func expireCallback = nullptr) override;
 
+  // Negative priorities are low, positive ones high (see getNumPriorities())
+  void addWithPriority(folly::Func func, int8_t priority) override;
+  void add(
+      folly::Func func,
+      int8_t priority,
+      std::chrono::milliseconds expiration,
+      folly::Func expireCallback = nullptr);
+
+  uint8_t getNumPriorities() const override {
+    return 3;
+  }
+
   folly::EventBase* getEventBase() override;
 
   static folly::EventBase* getEventBase(ThreadPoolExecutor::ThreadHandle*);
 
+  // Picks a thread the way getEventBase() does, for callers that keep per
+  // thread state. Throws if there are no threads.
+  std::shared_ptr<ThreadHandle> getThread();
+
+  // A small index, unique among the running threads of the pool, for
+  // keeping per thread state in flat arrays. Stopped threads' slots are
+  // reused, so state should also be keyed on getThreadId(), which is never
+  // reused.
+  static size_t getSlot(ThreadPoolExecutor::ThreadHandle*);
+  static uint64_t getThreadId(ThreadPoolExecutor::ThreadHandle*);
+
   folly::EventBaseManager* getEventBaseManager();
 
+  void setThreadSelection(ThreadSelection threadSelection) {
+    threadSelection_ = threadSelection;
+  }
+
+  struct LoopStats {
+    uint64_t threadId{0};
+    // Time each loop iteration spent handling events, without waiting
+    LatencyHistogram loopTime;
+    // Time tasks passed to add() waited before running
+    LatencyHistogram waitTime;
+    // Iterations that took longer than the stall threshold
+    uint64_t stalls{0};
+  };
+
+  // One entry per running thread, in thread id order
+  std::vector<LoopStats> getLoopStats();
+
+  // One entry per running thread, in thread id order. Cheap enough to poll
+  // often: only reads a few counters of each thread.
+  std::vector<EventBaseMetrics::Snapshot> getEventBaseMetrics();
+
+  // Loop iterations taking longer than this are counted as stalls and
+  // logged with the thread's id, or none if 0 (the default). A stall
+  // means every connection of the thread waited that long.
+  void setStallThreshold(std::chrono::milliseconds threshold) {
+    stallThreshold_ = threshold.count();
+  }
+
+  // Tasks a thread runs per drain of its lanes, at most, before letting the
+  // rest wait for the IO of the next loop iteration; 0 (the default) for a
+  // callback per task. Set before any task is added.
+  void setMaxBatchedTasks(uint32_t maxTasks) {
+    maxBatchedTasks_ = maxTasks;
+  }
+
  private:
   struct FOLLY_ALIGN_TO_AVOID_FALSE_SHARING IOThread : public Thread {
     IOThread(IOThreadPoolExecutor* pool)
       : Thread(pool),
         shouldRun(true),
-        pendingTasks(0) {};
+        exiting(false),
+        pendingTasks(0),
+        eventBase(nullptr),
+        hiPriTasks(kPriorityTaskQueueSize),
+        tasks(kTaskQueueSize),
+        loPriTasks(kPriorityTaskQueueSize),
+        slot(pool->allocateSlot()) {};
     std::atomic<bool> shouldRun;
+    // Set once the thread only waits for pendingTasks to reach 0
+    std::atomic<bool> exiting;
     std::atomic<size_t> pendingTasks;
     folly::EventBase* eventBase;
+    // Tasks added through add(), each run by one small callback queued on
+    // eventBase, so the EventBase's queue doesn't hold (and allocate) the
+    // whole task. Each callback runs the oldest task of the highest lane.
+    folly::MPMCQueue<Task> hiPriTasks;
+    folly::MPMCQueue<Task> tasks;
+    folly::MPMCQueue<Task> loPriTasks;
+    // With batching, whether a drain of the lanes is queued on eventBase
+    // and hasn't started yet
+    std::atomic<bool> drainScheduled{false};
+    const size_t slot;
+    LatencyHistogram::Writer loopTimes;
+    std::atomic<uint64_t> stalls{0};
+    EventBaseMetrics metrics;
+  };
+
+  friend class LoopObserver;
+
+  static const size_t kTaskQueueSize;
+  static const size_t kPriorityTaskQueueSize;
+
+  static folly::MPMCQueue<Task>& taskQueue(IOThread* ioThread, int8_t priority);
+  // Takes the next task to run, highest priority first
+  static bool takeTask(IOThread* ioThread, Task& task);
+
+  void runQueuedTask(IOThread* ioThread);
+  // Loops until every task counted in pendingTasks has run
+  void runPendingTasks(IOThread* ioThread);
+  // Runs up to maxBatchedTasks_ queued tasks
+  void drainTasks(IOThread* ioThread);
+  // Runs the thread's loop until it is stopped, spinning between waits
+  void busyPollLoop(IOThread* ioThread);
+
+  // The lowest slot no running thread has
+  size_t allocateSlot();
+  void releaseSlot(size_t slot);
+
+  // A thread's copy of the thread list, refreshed when the list changes
+  struct CachedThreadList {
+    uint64_t version{0};
+    ThreadList::Snapshot threads{
+      std::make_shared<const std::vector<ThreadPtr>>()};
   };
 
   ThreadPtr makeThread() override;
+  const std::vector<ThreadPtr>& getThreads();
   std::shared_ptr<IOThread> pickThread();
   void threadRun(ThreadPtr thread) override;
   void stopThreads(size_t n) override;
   uint64_t getPendingTaskCount() override;
 
   size_t nextThread_;
+  std::atomic<ThreadSelection> threadSelection_{ThreadSelection::ROUND_ROBIN};
   folly::ThreadLocal<std::shared_ptr<IOThread>> thisThread_;
+  folly::ThreadLocal<CachedThreadList> threadListCache_;
   folly::EventBaseManager* eventBaseManager_;
+  const MemoryIdlerOptions memoryIdlerOptions_;
+  const BusyPollOptions busyPollOptions_;
+  // In milliseconds
+  std::atomic<int64_t> stallThreshold_{0};
+  std::atomic<uint32_t> maxBatchedTasks_{0};
+  std::mutex slotsMutex_;
+  std::vector<bool> slotsInUse_;
 };
 
 } // namespace wangle
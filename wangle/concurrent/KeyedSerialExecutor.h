@@ -0,0 +1,167 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+#include <folly/Executor.h>
+#include <folly/Memory.h>
+#include <glog/logging.h>
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+namespace wangle {
+
+/**
+ * Runs the functions added for each key one at a time, in the order they
+ * were added, on a parent executor such as a CPUThreadPoolExecutor.
+ * Functions of different keys run in parallel. This gives per connection
+ * (or per user, per shard...) ordering to work offloaded from IO threads
+ * without pinning each connection to a thread or locking around the work.
+ *
+ * A key with queued functions has a strand, which is in the parent's queue
+ * at most once: the pool task drains up to maxBatch functions of the key
+ * and re-adds itself if more arrived meanwhile, so a burst for a key costs
+ * one pool task rather than one per function. No lock is held while
+ * functions run. Strands are dropped as soon as their queue is empty.
+ *
+ * Pending functions keep the executor's state alive, so the
+ * KeyedSerialExecutor itself may be destroyed while they run, but the
+ * parent must outlive them. As strands re-add themselves, a parent that is
+ * joined may stop before running all of them.
+ */
+template <class Key, class Hash = std::hash<Key>>
+class KeyedSerialExecutor {
+ public:
+  explicit KeyedSerialExecutor(
+      std::shared_ptr<folly::Executor> parent,
+      size_t maxBatch = 64,
+      size_t numShards = 16)
+    : state_(std::make_shared<State>(std::move(parent), maxBatch,
+                                     numShards)) {}
+
+  void add(const Key& key, folly::Func func) {
+    auto& shard = state_->shardOf(key);
+    Strand* strand;
+    {
+      std::lock_guard<std::mutex> g(shard.mutex);
+      auto& s = shard.strands[key];
+      if (!s) {
+        s = folly::make_unique<Strand>(key);
+      }
+      s->funcs.push_back(std::move(func));
+      if (s->scheduled) {
+        return;
+      }
+      s->scheduled = true;
+      strand = s.get();
+    }
+    try {
+      schedule(state_, strand);
+    } catch (...) {
+      // Nothing will ever run the strand
+      std::lock_guard<std::mutex> g(shard.mutex);
+      shard.strands.erase(key);
+      throw;
+    }
+  }
+
+  // The number of keys with queued or running functions
+  size_t numStrands() const {
+    size_t n = 0;
+    for (auto& shard : state_->shards) {
+      std::lock_guard<std::mutex> g(shard.mutex);
+      n += shard.strands.size();
+    }
+    return n;
+  }
+
+ private:
+  struct Strand {
+    explicit Strand(const Key& k) : key(k) {}
+
+    const Key key;
+    std::deque<folly::Func> funcs;
+    // Whether a pool task owns the strand
+    bool scheduled{false};
+  };
+
+  struct Shard {
+    mutable std::mutex mutex;
+    std::unordered_map<Key, std::unique_ptr<Strand>, Hash> strands;
+  };
+
+  struct State {
+    State(std::shared_ptr<folly::Executor> p, size_t batch, size_t n)
+      : parent(std::move(p)), maxBatch(batch), shards(n) {
+      CHECK(parent);
+      CHECK_GT(maxBatch, 0);
+      CHECK_GT(n, 0);
+    }
+
+    Shard& shardOf(const Key& key) {
+      return shards[Hash()(key) % shards.size()];
+    }
+
+    const std::shared_ptr<folly::Executor> parent;
+    const size_t maxBatch;
+    std::vector<Shard> shards;
+  };
+
+  // The strand's funcs only change under its shard's lock, and only the
+  // pool task that owns it pops them, so the strand stays put until that
+  // task erases it
+  static void schedule(const std::shared_ptr<State>& state, Strand* strand) {
+    state->parent->add([state, strand] { run(state, strand); });
+  }
+
+  static void run(const std::shared_ptr<State>& statePtr, Strand* strand) {
+    auto& state = *statePtr;
+    auto& shard = state.shardOf(strand->key);
+    std::vector<folly::Func> batch;
+    batch.reserve(state.maxBatch);
+    {
+      std::lock_guard<std::mutex> g(shard.mutex);
+      while (!strand->funcs.empty() && batch.size() < state.maxBatch) {
+        batch.push_back(std::move(strand->funcs.front()));
+        strand->funcs.pop_front();
+      }
+    }
+    for (auto& func : batch) {
+      try {
+        func();
+      } catch (const std::exception& e) {
+        LOG(ERROR) << "KeyedSerialExecutor: func threw unhandled " <<
+                      typeid(e).name() << " exception: " << e.what();
+      } catch (...) {
+        LOG(ERROR) << "KeyedSerialExecutor: func threw unhandled "
+                      "non-exception object";
+      }
+    }
+    {
+      std::lock_guard<std::mutex> g(shard.mutex);
+      if (strand->funcs.empty()) {
+        // Not by reference: the erase destroys strand->key
+        const Key key = strand->key;
+        shard.strands.erase(key);
+        return;
+      }
+    }
+    // Back of the parent's queue, so other work gets a turn
+    schedule(statePtr, strand);
+  }
+
+  std::shared_ptr<State> state_;
+};
+
+} // namespace wangle
@@ -0,0 +1,126 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace wangle {
+
+/**
+ * A histogram of durations with log-linear buckets, as HdrHistogram does:
+ * each power of two is split into kSubBuckets buckets, so any recorded
+ * value is known to within 1/kSubBuckets (12.5%) from 1ns to centuries,
+ * in under 4KB of counts.
+ */
+class LatencyHistogram {
+ public:
+  static constexpr size_t kSubBucketBits = 3;
+  static constexpr size_t kSubBuckets = 1 << kSubBucketBits;
+  // Durations are signed, so values have at most 63 bits
+  static constexpr size_t kNumBuckets = (63 - kSubBucketBits + 1) * kSubBuckets;
+
+  LatencyHistogram() {
+    counts_.fill(0);
+  }
+
+  void add(std::chrono::nanoseconds value) {
+    counts_[bucketOf(value)]++;
+  }
+
+  void merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < kNumBuckets; i++) {
+      counts_[i] += other.counts_[i];
+    }
+  }
+
+  uint64_t count() const {
+    uint64_t n = 0;
+    for (auto c : counts_) {
+      n += c;
+    }
+    return n;
+  }
+
+  // The lower bound of the bucket holding the pct'th percentile, or 0 if
+  // the histogram is empty
+  std::chrono::nanoseconds getPercentile(double pct) const {
+    const uint64_t total = count();
+    if (total == 0) {
+      return std::chrono::nanoseconds(0);
+    }
+    uint64_t rank = pct >= 100 ? total : uint64_t(total * pct / 100);
+    rank = std::max<uint64_t>(rank, 1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kNumBuckets; i++) {
+      seen += counts_[i];
+      if (seen >= rank) {
+        return std::chrono::nanoseconds(lowerBound(i));
+      }
+    }
+    return std::chrono::nanoseconds(lowerBound(kNumBuckets - 1));
+  }
+
+  static size_t bucketOf(std::chrono::nanoseconds value) {
+    const uint64_t v = value.count() > 0 ? value.count() : 0;
+    if (v < kSubBuckets) {
+      return v;
+    }
+    const size_t exp = 63 - __builtin_clzll(v);
+    return (exp - kSubBucketBits + 1) * kSubBuckets +
+      ((v >> (exp - kSubBucketBits)) & (kSubBuckets - 1));
+  }
+
+  static int64_t lowerBound(size_t bucket) {
+    if (bucket < kSubBuckets) {
+      return bucket;
+    }
+    const size_t exp = bucket / kSubBuckets + kSubBucketBits - 1;
+    return int64_t((kSubBuckets + bucket % kSubBuckets) <<
+                   (exp - kSubBucketBits));
+  }
+
+  /**
+   * The same buckets, written by a single thread and read from any. Adding a
+   * value is a relaxed load and store, with no locked instruction.
+   */
+  class Writer {
+   public:
+    Writer() {
+      for (auto& c : counts_) {
+        c.store(0, std::memory_order_relaxed);
+      }
+    }
+
+    void add(std::chrono::nanoseconds value) {
+      auto& c = counts_[bucketOf(value)];
+      c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    // Adds what has been written so far to out
+    void snapshot(LatencyHistogram& out) const {
+      for (size_t i = 0; i < kNumBuckets; i++) {
+        out.counts_[i] += counts_[i].load(std::memory_order_relaxed);
+      }
+    }
+
+   private:
+    std::array<std::atomic<uint64_t>, kNumBuckets> counts_;
+  };
+
+ private:
+  std::array<uint64_t, kNumBuckets> counts_;
+};
+
+} // namespace wangle
@@ -12,6 +12,7 @@
 #include <wangle/concurrent/BlockingQueue.h>
 #include <folly/LifoSem.h>
 #include <folly/MPMCQueue.h>
+#include <folly/ScopeGuard.h>
 
 namespace wangle {
 
@@ -34,6 +35,45 @@ class LifoSemMPMCQueue : public BlockingQueue<T> {
     sem_.post();
   }
 
+  void addBatch(std::vector<T> items) override {
+    size_t written = 0;
+    SCOPE_EXIT {
+      if (written > 0) {
+        sem_.post(written);
+      }
+    };
+    for (auto& item : items) {
+      switch (kBehavior) { // static
+      case QueueBehaviorIfFull::THROW:
+        if (!queue_.write(std::move(item))) {
+          throw std::runtime_error("LifoSemMPMCQueue full, can't add item");
+        }
+        break;
+      case QueueBehaviorIfFull::BLOCK:
+        queue_.blockingWrite(std::move(item));
+        break;
+      }
+      written++;
+    }
+  }
+
+  bool tryAdd(T&& item) override {
+    if (!queue_.write(std::move(item))) {
+      return false;
+    }
+    sem_.post();
+    return true;
+  }
+
+  bool addFor(T&& item, std::chrono::milliseconds timeout) override {
+    if (!queue_.tryWriteUntil(
+          std::chrono::steady_clock::now() + timeout, std::move(item))) {
+      return false;
+    }
+    sem_.post();
+    return true;
+  }
+
   T take() override {
     T item;
     while (!queue_.read(item)) {
@@ -12,15 +12,27 @@
 #include <wangle/concurrent/BlockingQueue.h>
 #include <folly/LifoSem.h>
 #include <folly/MPMCQueue.h>
+#include <folly/ScopeGuard.h>
+
+#include <atomic>
 
 namespace wangle {
 
+/**
+ * A BlockingQueue with one MPMCQueue per priority. A bitmap of the
+ * priorities that have items lets take() go straight to the highest of
+ * them, however many priorities there are.
+ *
+ * With setAging(n), every nth take() serves the lowest priority that has
+ * items instead, so low priority items still get at least 1/n of the takes
+ * under sustained high priority load.
+ */
 template <class T, QueueBehaviorIfFull kBehavior = QueueBehaviorIfFull::THROW>
 class PriorityLifoSemMPMCQueue : public BlockingQueue<T> {
  public:
   explicit PriorityLifoSemMPMCQueue(uint8_t numPriorities, size_t capacity) {
     queues_.reserve(numPriorities);
-    for (int8_t i = 0; i < numPriorities; i++) {
+    for (size_t i = 0; i < numPriorities; i++) {
       queues_.emplace_back(capacity);
     }
   }
@@ -35,11 +47,103 @@ class PriorityLifoSemMPMCQueue : public BlockingQueue<T> {
   }
 
   void addWithPriority(T item, int8_t priority) override {
+    write(std::move(item), getQueue(priority));
+    sem_.post();
+  }
+
+  bool tryAdd(T&& item) override {
+    return tryAddWithPriority(std::move(item), folly::Executor::MID_PRI);
+  }
+
+  bool tryAddWithPriority(T&& item, int8_t priority) override {
+    const size_t queue = getQueue(priority);
+    if (!queues_[queue].write(std::move(item))) {
+      return false;
+    }
+    markNonEmpty(queue);
+    sem_.post();
+    return true;
+  }
+
+  bool addFor(T&& item, std::chrono::milliseconds timeout) override {
+    return addWithPriorityFor(
+        std::move(item), folly::Executor::MID_PRI, timeout);
+  }
+
+  bool addWithPriorityFor(
+      T&& item,
+      int8_t priority,
+      std::chrono::milliseconds timeout) override {
+    const size_t queue = getQueue(priority);
+    if (!queues_[queue].tryWriteUntil(
+          std::chrono::steady_clock::now() + timeout, std::move(item))) {
+      return false;
+    }
+    markNonEmpty(queue);
+    sem_.post();
+    return true;
+  }
+
+  // Adds at medium priority
+  void addBatch(std::vector<T> items) override {
+    const size_t queue = getQueue(folly::Executor::MID_PRI);
+    size_t written = 0;
+    SCOPE_EXIT {
+      if (written > 0) {
+        sem_.post(written);
+      }
+    };
+    for (auto& item : items) {
+      write(std::move(item), queue);
+      written++;
+    }
+  }
+
+  T take() override {
+    T item;
+    while (true) {
+      const bool lowest = aging_ > 0 &&
+        takes_.fetch_add(1, std::memory_order_relaxed) % aging_ == 0;
+      int queue;
+      while ((queue = lowest ? lowestNonEmpty() : highestNonEmpty()) >= 0) {
+        if (queues_[queue].read(item)) {
+          return item;
+        }
+        markEmpty(queue);
+      }
+      sem_.wait();
+    }
+  }
+
+  size_t size() override {
+    size_t size = 0;
+    for (size_t w = 0; w < kWords; w++) {
+      auto bits = nonEmpty_[w].load(std::memory_order_relaxed);
+      while (bits) {
+        const size_t bit = __builtin_ctzll(bits);
+        bits &= bits - 1;
+        size += queues_[w * 64 + bit].size();
+      }
+    }
+    return size;
+  }
+
+  // Serve the lowest non-empty priority every n takes, or never if n is 0
+  void setAging(uint32_t n) {
+    aging_ = n;
+  }
+
+ private:
+  size_t getQueue(int8_t priority) {
     int mid = getNumPriorities() / 2;
     size_t queue = priority < 0 ?
                    std::max(0, mid + priority) :
                    std::min(getNumPriorities() - 1, mid + priority);
     CHECK_LT(queue, queues_.size());
+    return queue;
+  }
+
+  void write(T item, size_t queue) {
     switch (kBehavior) { // static
     case QueueBehaviorIfFull::THROW:
       if (!queues_[queue].write(std::move(item))) {
@@ -50,32 +154,59 @@ class PriorityLifoSemMPMCQueue : public BlockingQueue<T> {
       queues_[queue].blockingWrite(std::move(item));
       break;
     }
-    sem_.post();
+    markNonEmpty(queue);
   }
 
-  T take() override {
-    T item;
-    while (true) {
-      for (auto it = queues_.rbegin(); it != queues_.rend(); it++) {
-        if (it->read(item)) {
-          return item;
-        }
+  // Called after writing to queue and before sem_ is posted, so the consumer
+  // woken up finds it. Testing first keeps the cache line shared while the
+  // queue stays non-empty.
+  void markNonEmpty(size_t queue) {
+    auto& word = nonEmpty_[queue / 64];
+    const uint64_t bit = uint64_t(1) << (queue % 64);
+    if (!(word.load() & bit)) {
+      word.fetch_or(bit);
+    }
+  }
+
+  void markEmpty(size_t queue) {
+    auto& word = nonEmpty_[queue / 64];
+    const uint64_t bit = uint64_t(1) << (queue % 64);
+    word.fetch_and(~bit);
+    // A write may have raced with the failed read; its writer may have seen
+    // the bit still set and not set it again
+    if (!queues_[queue].isEmpty()) {
+      word.fetch_or(bit);
+    }
+  }
+
+  int highestNonEmpty() {
+    for (size_t w = kWords; w-- > 0; ) {
+      const auto bits = nonEmpty_[w].load();
+      if (bits) {
+        return w * 64 + 63 - __builtin_clzll(bits);
       }
-      sem_.wait();
     }
+    return -1;
   }
 
-  size_t size() override {
-    size_t size = 0;
-    for (auto& q : queues_) {
-      size += q.size();
+  int lowestNonEmpty() {
+    for (size_t w = 0; w < kWords; w++) {
+      const auto bits = nonEmpty_[w].load();
+      if (bits) {
+        return w * 64 + __builtin_ctzll(bits);
+      }
     }
-    return size;
+    return -1;
   }
 
- private:
+  // Enough for any uint8_t number of priorities
+  static constexpr size_t kWords = 4;
+
   folly::LifoSem sem_;
   std::vector<folly::MPMCQueue<T>> queues_;
+  std::atomic<uint64_t> nonEmpty_[kWords] = {};
+  std::atomic<uint32_t> aging_{0};
+  std::atomic<uint64_t> takes_{0};
 };
 
 } // namespace wangle
@@ -0,0 +1,142 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/concurrent/RequestTrace.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include <folly/Format.h>
+
+namespace wangle {
+
+const size_t RequestTrace::kRingSize = 4096;
+
+namespace {
+
+struct Ring {
+  explicit Ring(uint64_t id) : thread(id), events(RequestTrace::kRingSize) {}
+
+  // Only ever contended by getEvents()
+  std::mutex mutex;
+  const uint64_t thread;
+  std::vector<RequestTrace::Event> events;
+  // Events recorded since the thread started
+  uint64_t recorded{0};
+};
+
+struct Registry {
+  std::mutex mutex;
+  // Those of exited threads expire with them
+  std::vector<std::weak_ptr<Ring>> rings;
+  uint64_t nextThread{0};
+};
+
+// Leaked, for threads exiting after static destruction
+Registry& registry() {
+  static auto registry = new Registry();
+  return *registry;
+}
+
+Ring& localRing() {
+  static thread_local std::shared_ptr<Ring> ring;
+  if (UNLIKELY(!ring)) {
+    auto& reg = registry();
+    std::lock_guard<std::mutex> g(reg.mutex);
+    ring = std::make_shared<Ring>(reg.nextThread++);
+    reg.rings.erase(
+      std::remove_if(reg.rings.begin(), reg.rings.end(),
+                     [](const std::weak_ptr<Ring>& r) { return r.expired(); }),
+      reg.rings.end());
+    reg.rings.push_back(ring);
+  }
+  return *ring;
+}
+
+std::atomic<uint64_t> nextTraceId{1};
+
+}
+
+uint64_t RequestTrace::sample(uint32_t oneIn) {
+  static thread_local uint32_t skip = 0;
+  if (oneIn == 0) {
+    return 0;
+  }
+  if (skip > 0) {
+    skip--;
+    return 0;
+  }
+  skip = oneIn - 1;
+  return nextTraceId.fetch_add(1, std::memory_order_relaxed);
+}
+
+void RequestTrace::recordEvent(uint64_t traceId, const char* stage) {
+  auto& ring = localRing();
+  std::lock_guard<std::mutex> g(ring.mutex);
+  ring.events[ring.recorded % kRingSize] =
+    Event{traceId, stage, Clock::now(), ring.thread};
+  ring.recorded++;
+}
+
+std::vector<RequestTrace::Event> RequestTrace::getEvents(uint64_t traceId) {
+  std::vector<std::shared_ptr<Ring>> rings;
+  {
+    auto& reg = registry();
+    std::lock_guard<std::mutex> g(reg.mutex);
+    for (auto& r : reg.rings) {
+      if (auto ring = r.lock()) {
+        rings.push_back(std::move(ring));
+      }
+    }
+  }
+
+  std::vector<Event> events;
+  for (auto& ring : rings) {
+    std::lock_guard<std::mutex> g(ring->mutex);
+    // Oldest first, for events recorded within a clock tick to stay in
+    // order through the stable sort
+    const auto n = std::min<uint64_t>(ring->recorded, kRingSize);
+    const auto oldest = ring->recorded - n;
+    for (uint64_t i = oldest; i < ring->recorded; i++) {
+      const auto& event = ring->events[i % kRingSize];
+      if (traceId == 0 || event.traceId == traceId) {
+        events.push_back(event);
+      }
+    }
+  }
+  std::stable_sort(events.begin(), events.end(),
+                   [](const Event& a, const Event& b) {
+                     return a.traceId != b.traceId ?
+                       a.traceId < b.traceId : a.time < b.time;
+                   });
+  return events;
+}
+
+std::string RequestTrace::dump(uint64_t traceId) {
+  std::string out;
+  uint64_t current = 0;
+  Clock::time_point start;
+  for (const auto& event : getEvents(traceId)) {
+    if (event.traceId != current) {
+      current = event.traceId;
+      start = event.time;
+    }
+    const auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+      event.time - start).count();
+    out += folly::sformat("trace {} +{}us thread {} {}\n",
+                          event.traceId, us, event.thread, event.stage);
+  }
+  return out;
+}
+
+} // namespace wangle
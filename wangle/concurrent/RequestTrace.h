@@ -0,0 +1,112 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <folly/Likely.h>
+
+namespace wangle {
+
+/**
+ * The trace of the request a thread is working for, if it was sampled, to
+ * break a slow request's latency down by stage in production. Traces are
+ * started by sample(), e.g. by a RequestTraceSampler right after the
+ * decoder, and opened with a RequestTrace::Scope around the calls made for
+ * the request; the stages it goes through record() their name and the
+ * time, on their thread, into a ring of that thread's last events, which
+ * getEvents() and dump() read from every thread on demand.
+ *
+ * The trace is carried the way RequestDeadline is: ThreadPoolExecutor
+ * tasks, ExecutorFilter and the server dispatchers take it across the
+ * hops they make, up to the write of the response, and
+ * OutputBufferingHandler across its flush. Other code continuing a
+ * request in another thread or callback takes current() with it and opens
+ * a Scope there.
+ *
+ * Untraced requests only cost a thread local read per stage.
+ */
+class RequestTrace {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Event {
+    uint64_t traceId;
+    // A string literal, such as "decoded"
+    const char* stage;
+    Clock::time_point time;
+    // Numbered from 0 in the order threads first recorded an event
+    uint64_t thread;
+  };
+
+  // Events each thread keeps, its oldest overwritten first
+  static const size_t kRingSize;
+
+  // The id of this thread's trace, or 0
+  static uint64_t current() {
+    return slot();
+  }
+
+  static bool isSet() {
+    return current() != 0;
+  }
+
+  // The id of a new trace for one in every oneIn calls on this thread, and
+  // 0 for the others; 0 for all of them if oneIn is 0
+  static uint64_t sample(uint32_t oneIn);
+
+  // Records stage for this thread's trace, if any
+  static void record(const char* stage) {
+    if (UNLIKELY(isSet())) {
+      recordEvent(current(), stage);
+    }
+  }
+
+  // The events still in the rings of the threads alive, by trace, then
+  // time; only those of traceId unless it's 0
+  static std::vector<Event> getEvents(uint64_t traceId = 0);
+
+  // A line per event, each with the time since the trace's first event
+  static std::string dump(uint64_t traceId = 0);
+
+  /**
+   * Sets this thread's trace until destroyed, 0 for none
+   */
+  class Scope {
+   public:
+    explicit Scope(uint64_t traceId) : previous_(slot()) {
+      slot() = traceId;
+    }
+
+    ~Scope() {
+      slot() = previous_;
+    }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+   private:
+    const uint64_t previous_;
+  };
+
+ private:
+  static void recordEvent(uint64_t traceId, const char* stage);
+
+  static uint64_t& slot() {
+    static thread_local uint64_t traceId = 0;
+    return traceId;
+  }
+};
+
+} // namespace wangle
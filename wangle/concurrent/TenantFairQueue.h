@@ -0,0 +1,180 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+#include <wangle/concurrent/BlockingQueue.h>
+#include <wangle/concurrent/CPUThreadPoolExecutor.h>
+#include <folly/LifoSem.h>
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace wangle {
+
+/**
+ * A CPUThreadPoolExecutor queue that shares the pool between tenants, so
+ * that one flooding it with tasks only delays its own. Each tenant with
+ * tasks has a queue of its own, and take() goes round them by deficit
+ * round robin with tasks as the unit: a tenant's turn is weight tasks,
+ * taken in the order it added them, or as many as it has. A tenant that
+ * keeps the queue full waits for its turn like the others, and, with a
+ * tenant capacity, is refused once it has that many tasks queued, rather
+ * than filling the queue for everyone.
+ *
+ * Tasks go to the tenant of the TenantScope alive on the thread adding
+ * them, or tenant 0. Priorities are ignored.
+ */
+class TenantFairQueue : public BlockingQueue<CPUThreadPoolExecutor::CPUTask> {
+ public:
+  using CPUTask = CPUThreadPoolExecutor::CPUTask;
+
+  // Sets the tenant of the tasks added on this thread while it's alive
+  class TenantScope {
+   public:
+    explicit TenantScope(uint64_t tenant) : previous_(currentTenant()) {
+      currentTenant() = tenant;
+    }
+
+    ~TenantScope() {
+      currentTenant() = previous_;
+    }
+
+    TenantScope(const TenantScope&) = delete;
+    TenantScope& operator=(const TenantScope&) = delete;
+
+   private:
+    const uint64_t previous_;
+  };
+
+  // tenantCapacity of 0 for tenants to be only limited by capacity
+  explicit TenantFairQueue(
+      size_t capacity = CPUThreadPoolExecutor::kDefaultMaxQueueSize,
+      size_t tenantCapacity = 0)
+      : capacity_(capacity),
+        tenantCapacity_(tenantCapacity) {}
+
+  // The tasks a tenant takes per turn, 1 by default
+  void setWeight(uint64_t tenant, uint32_t weight) {
+    CHECK_GT(weight, 0);
+    std::lock_guard<std::mutex> g(mutex_);
+    weights_[tenant] = weight;
+    auto it = tenants_.find(tenant);
+    if (it != tenants_.end()) {
+      it->second.weight = weight;
+    }
+  }
+
+  void add(CPUTask item) override {
+    if (!tryAdd(std::move(item))) {
+      throw std::runtime_error("TenantFairQueue full, can't add item");
+    }
+  }
+
+  bool tryAdd(CPUTask&& item) override {
+    if (item.poison) {
+      // Threads stop once the tasks already queued have run
+      {
+        std::lock_guard<std::mutex> g(mutex_);
+        poisons_++;
+      }
+      sem_.post();
+      return true;
+    }
+    const uint64_t tenant = currentTenant();
+    {
+      std::lock_guard<std::mutex> g(mutex_);
+      if (size_ >= capacity_) {
+        return false;
+      }
+      auto& t = tenants_[tenant];
+      if (tenantCapacity_ > 0 && t.tasks.size() >= tenantCapacity_) {
+        return false;
+      }
+      if (t.tasks.empty()) {
+        // Starts out with a full turn at the end of the round
+        auto weight = weights_.find(tenant);
+        t.weight = weight != weights_.end() ? weight->second : 1;
+        t.deficit = 0;
+        active_.push_back(tenant);
+      }
+      t.tasks.push_back(std::move(item));
+      size_++;
+    }
+    sem_.post();
+    return true;
+  }
+
+  CPUTask take() override {
+    sem_.wait();
+    std::lock_guard<std::mutex> g(mutex_);
+    if (active_.empty()) {
+      // Tasks are queued before sem_ is posted, so this is a poison
+      CHECK(poisons_-- > 0);
+      return CPUTask();
+    }
+    auto it = tenants_.find(active_.front());
+    auto& t = it->second;
+    if (t.deficit == 0) {
+      t.deficit = t.weight;
+    }
+    CPUTask item = std::move(t.tasks.front());
+    t.tasks.pop_front();
+    size_--;
+    t.deficit--;
+    if (t.tasks.empty()) {
+      // Idle tenants don't bank turns, nor take up memory
+      active_.pop_front();
+      tenants_.erase(it);
+    } else if (t.deficit == 0) {
+      active_.push_back(active_.front());
+      active_.pop_front();
+    }
+    return item;
+  }
+
+  size_t size() override {
+    return size_.load();
+  }
+
+  // Tenants with tasks queued
+  size_t getNumTenants() {
+    std::lock_guard<std::mutex> g(mutex_);
+    return active_.size();
+  }
+
+ private:
+  struct Tenant {
+    std::deque<CPUTask> tasks;
+    uint32_t weight{1};
+    // Tasks left in its current turn
+    uint32_t deficit{0};
+  };
+
+  static uint64_t& currentTenant() {
+    static thread_local uint64_t tenant = 0;
+    return tenant;
+  }
+
+  const size_t capacity_;
+  const size_t tenantCapacity_;
+  std::mutex mutex_;
+  std::unordered_map<uint64_t, Tenant> tenants_;
+  // Tenants with tasks, in their round robin order, the current one first
+  std::deque<uint64_t> active_;
+  std::unordered_map<uint64_t, uint32_t> weights_;
+  std::atomic<size_t> size_{0};
+  size_t poisons_{0};
+  folly::LifoSem sem_;
+};
+
+} // namespace wangle
@@ -0,0 +1,93 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/concurrent/ThreadPoolAutoscaler.h>
+
+using std::chrono::nanoseconds;
+
+namespace wangle {
+
+ThreadPoolAutoscaler::ThreadPoolAutoscaler(ThreadPoolExecutor* pool,
+                                           Options options)
+    : pool_(pool),
+      options_(options) {
+  CHECK_GT(options_.minThreads, 0);
+  CHECK_LE(options_.minThreads, options_.maxThreads);
+  CHECK_GT(options_.growStep, 0);
+
+  auto n = std::min(std::max(pool_->numThreads(), options_.minThreads),
+                    options_.maxThreads);
+  pool_->setNumThreads(n);
+  numThreads_ = n;
+
+  subscription_ = pool_->subscribeToTaskStats(
+      Observer<ThreadPoolExecutor::TaskStats>::create(
+          [this](ThreadPoolExecutor::TaskStats stats) {
+        waitTimeSum_.fetch_add(stats.waitTime.count(),
+                               std::memory_order_relaxed);
+        taskCount_.fetch_add(1, std::memory_order_relaxed);
+      }));
+  thread_ = std::thread([this] { run(); });
+}
+
+ThreadPoolAutoscaler::~ThreadPoolAutoscaler() {
+  {
+    std::lock_guard<std::mutex> g(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+}
+
+void ThreadPoolAutoscaler::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!cv_.wait_for(lock, options_.period, [this] { return stopping_; })) {
+    lock.unlock();
+    adjust();
+    lock.lock();
+  }
+}
+
+void ThreadPoolAutoscaler::adjust() {
+  const uint64_t count = taskCount_.exchange(0, std::memory_order_relaxed);
+  const uint64_t sum = waitTimeSum_.exchange(0, std::memory_order_relaxed);
+  if (settling_) {
+    // Threads added last period haven't had time to drain the queue yet
+    settling_ = false;
+    return;
+  }
+
+  const nanoseconds meanWait(count > 0 ? sum / count : 0);
+  const nanoseconds target = options_.targetWaitTime;
+  const size_t n = numThreads_.load();
+
+  if (meanWait > target) {
+    idlePeriods_ = 0;
+    if (n < options_.maxThreads) {
+      const size_t grown = std::min(n + options_.growStep, options_.maxThreads);
+      pool_->setNumThreads(grown);
+      numThreads_ = grown;
+      settling_ = true;
+    }
+    return;
+  }
+
+  if (meanWait * 2 > target || pool_->getPoolStats().idleThreadCount == 0) {
+    idlePeriods_ = 0;
+    return;
+  }
+  if (++idlePeriods_ >= options_.shrinkAfter && n > options_.minThreads) {
+    pool_->setNumThreads(n - 1);
+    numThreads_ = n - 1;
+    idlePeriods_ = 0;
+  }
+}
+
+} // namespace wangle
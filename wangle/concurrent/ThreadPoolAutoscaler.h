@@ -0,0 +1,85 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/concurrent/ThreadPoolExecutor.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace wangle {
+
+/**
+ * Sizes a ThreadPoolExecutor from the time its tasks spend queued, as
+ * reported by TaskStats::waitTime.
+ *
+ * Once every period, the mean wait time of the tasks dequeued during that
+ * period is compared with the target. If it is above, growStep threads are
+ * added, up to maxThreads, and the pool is left to settle for a period. If
+ * it stays below half the target (or no task waited at all) while some
+ * threads are idle for shrinkAfter periods in a row, one thread is removed,
+ * down to minThreads. The gap between the two thresholds and the long
+ * shrink delay keep the pool from flapping around a steady load.
+ *
+ * The autoscaler owns the pool's size while it exists, so don't call
+ * setNumThreads() on the pool meanwhile, and destroy the autoscaler before
+ * joining the pool.
+ */
+class ThreadPoolAutoscaler {
+ public:
+  struct Options {
+    Options() {}
+
+    size_t minThreads{1};
+    size_t maxThreads{std::max(2u, std::thread::hardware_concurrency())};
+    std::chrono::milliseconds targetWaitTime{5};
+    std::chrono::milliseconds period{100};
+    size_t growStep{1};
+    size_t shrinkAfter{50};
+  };
+
+  explicit ThreadPoolAutoscaler(ThreadPoolExecutor* pool,
+                                Options options = Options());
+
+  ~ThreadPoolAutoscaler();
+
+  // The size the autoscaler last set the pool to
+  size_t getNumThreads() const {
+    return numThreads_.load();
+  }
+
+ private:
+  void run();
+  void adjust();
+
+  ThreadPoolExecutor* pool_;
+  const Options options_;
+
+  // Wait times of the tasks dequeued this period
+  std::atomic<uint64_t> waitTimeSum_{0};
+  std::atomic<uint64_t> taskCount_{0};
+
+  std::atomic<size_t> numThreads_;
+  size_t idlePeriods_{0};
+  bool settling_{false};
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stopping_{false};
+
+  Subscription<ThreadPoolExecutor::TaskStats> subscription_;
+  std::thread thread_;
+};
+
+} // namespace wangle
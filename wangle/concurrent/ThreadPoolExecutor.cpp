@@ -29,24 +29,33 @@ ThreadPoolExecutor::Task::Task(
     Func&& func,
     std::chrono::milliseconds expiration,
     Func&& expireCallback)
-    : func_(std::move(func)),
-      expiration_(expiration),
-      expireCallback_(std::move(expireCallback)) {
+    : func_(std::move(func)) {
+  if (expiration > std::chrono::milliseconds(0) || expireCallback) {
+    expiration_.reset(new Expiration{expiration, std::move(expireCallback)});
+  }
   // Assume that the task in enqueued on creation
   enqueueTime_ = std::chrono::steady_clock::now();
+  traceId_ = RequestTrace::current();
+  RequestTrace::record("queued");
 }
 
 void ThreadPoolExecutor::runTask(
-    const ThreadPtr& thread,
-    Task&& task) {
+    Thread* thread,
+    Task&& task,
+    Codel* codel) {
   thread->idle = false;
+  RequestTrace::Scope traceScope(task.traceId_);
+  RequestTrace::record("dequeued");
+  TaskStats stats;
   auto startTime = std::chrono::steady_clock::now();
-  task.stats_.waitTime = startTime - task.enqueueTime_;
-  if (task.expiration_ > std::chrono::milliseconds(0) &&
-      task.stats_.waitTime >= task.expiration_) {
-    task.stats_.expired = true;
-    if (task.expireCallback_ != nullptr) {
-      task.expireCallback_();
+  stats.waitTime = startTime - task.enqueueTime_;
+  if ((task.expiration_ &&
+       task.expiration_->expiration > std::chrono::milliseconds(0) &&
+       stats.waitTime >= task.expiration_->expiration) ||
+      (codel && codel->overloaded(stats.waitTime))) {
+    stats.expired = true;
+    if (task.expiration_ && task.expiration_->expireCallback != nullptr) {
+      task.expiration_->expireCallback();
     }
   } else {
     try {
@@ -58,19 +67,25 @@ void ThreadPoolExecutor::runTask(
       LOG(ERROR) << "ThreadPoolExecutor: func threw unhandled non-exception "
                     "object";
     }
-    task.stats_.runTime = std::chrono::steady_clock::now() - startTime;
+    stats.runTime = std::chrono::steady_clock::now() - startTime;
+    thread->runTimes.add(stats.runTime);
   }
+  thread->waitTimes.add(stats.waitTime);
   thread->idle = true;
-  thread->taskStatsSubject->onNext(std::move(task.stats_));
+  const auto sampleRate = taskStatsSampleRate_.load(std::memory_order_relaxed);
+  if (taskStatsSubscribed_.load(std::memory_order_relaxed) && sampleRate > 0 &&
+      thread->tasksRun++ % sampleRate == 0) {
+    thread->taskStatsSubject->onNext(std::move(stats));
+  }
 }
 
 size_t ThreadPoolExecutor::numThreads() {
-  RWSpinLock::ReadHolder{&threadListLock_};
+  RWSpinLock::ReadHolder r{&threadListLock_};
   return threadList_.get().size();
 }
 
 void ThreadPoolExecutor::setNumThreads(size_t n) {
-  RWSpinLock::WriteHolder{&threadListLock_};
+  RWSpinLock::WriteHolder w{&threadListLock_};
   const auto current = threadList_.get().size();
   if (n > current ) {
     addThreads(n - current);
@@ -91,10 +106,12 @@ void ThreadPoolExecutor::addThreads(size_t n) {
     // and then handling for that case
     thread->handle = threadFactory_->newThread(
         std::bind(&ThreadPoolExecutor::threadRun, this, thread));
-    threadList_.add(thread);
   }
+  // Only list threads once they are ready, as add() may pick any listed
+  // thread without taking threadListLock_
   for (auto& thread : newThreads) {
     thread->startupBaton.wait();
+    threadList_.add(thread);
   }
   for (auto& o : observers_) {
     for (auto& thread : newThreads) {
@@ -112,33 +129,45 @@ void ThreadPoolExecutor::removeThreads(size_t n, bool isJoin) {
   for (size_t i = 0; i < n; i++) {
     auto thread = stoppedThreads_.take();
     thread->handle.join();
+    {
+      std::lock_guard<std::mutex> g(retiredStatsMutex_);
+      thread->waitTimes.snapshot(retiredWaitTimes_);
+      thread->runTimes.snapshot(retiredRunTimes_);
+    }
     threadList_.remove(thread);
   }
   CHECK(stoppedThreads_.size() == 0);
 }
 
 void ThreadPoolExecutor::stop() {
-  RWSpinLock::WriteHolder{&threadListLock_};
+  RWSpinLock::WriteHolder w{&threadListLock_};
   removeThreads(threadList_.get().size(), false);
   CHECK(threadList_.get().size() == 0);
 }
 
 void ThreadPoolExecutor::join() {
-  RWSpinLock::WriteHolder{&threadListLock_};
+  RWSpinLock::WriteHolder w{&threadListLock_};
   removeThreads(threadList_.get().size(), true);
   CHECK(threadList_.get().size() == 0);
 }
 
 ThreadPoolExecutor::PoolStats ThreadPoolExecutor::getPoolStats() {
-  RWSpinLock::ReadHolder{&threadListLock_};
+  RWSpinLock::ReadHolder r{&threadListLock_};
   ThreadPoolExecutor::PoolStats stats;
   stats.threadCount = threadList_.get().size();
+  {
+    std::lock_guard<std::mutex> g(retiredStatsMutex_);
+    stats.waitTime = retiredWaitTimes_;
+    stats.runTime = retiredRunTimes_;
+  }
   for (auto thread : threadList_.get()) {
     if (thread->idle) {
       stats.idleThreadCount++;
     } else {
       stats.activeThreadCount++;
     }
+    thread->waitTimes.snapshot(stats.waitTime);
+    thread->runTimes.snapshot(stats.runTime);
   }
   stats.pendingTaskCount = getPendingTaskCount();
   stats.totalTaskCount = stats.pendingTaskCount + stats.activeThreadCount;
@@ -174,7 +203,7 @@ size_t ThreadPoolExecutor::StoppedThreadQueue::size() {
 }
 
 void ThreadPoolExecutor::addObserver(std::shared_ptr<Observer> o) {
-  RWSpinLock::ReadHolder{&threadListLock_};
+  RWSpinLock::WriteHolder w{&threadListLock_};
   observers_.push_back(o);
   for (auto& thread : threadList_.get()) {
     o->threadPreviouslyStarted(thread.get());
@@ -182,7 +211,7 @@ void ThreadPoolExecutor::addObserver(std::shared_ptr<Observer> o) {
 }
 
 void ThreadPoolExecutor::removeObserver(std::shared_ptr<Observer> o) {
-  RWSpinLock::ReadHolder{&threadListLock_};
+  RWSpinLock::WriteHolder w{&threadListLock_};
   for (auto& thread : threadList_.get()) {
     o->threadNotYetStopped(thread.get());
   }
@@ -10,8 +10,11 @@
 
 #pragma once
 #include <folly/Executor.h>
+#include <wangle/concurrent/Codel.h>
+#include <wangle/concurrent/LatencyHistogram.h>
 #include <wangle/concurrent/LifoSemMPMCQueue.h>
 #include <wangle/concurrent/NamedThreadFactory.h>
+#include <wangle/concurrent/RequestTrace.h>
 #include <wangle/deprecated/rx/Observable.h>
 #include <folly/Baton.h>
 #include <folly/Memory.h>
@@ -39,6 +42,14 @@ class ThreadPoolExecutor : public virtual folly::Executor {
       std::chrono::milliseconds expiration,
       folly::Func expireCallback) = 0;
 
+  // Adds all funcs at once. Pools backed by one task queue enqueue them
+  // together and wake up to funcs.size() idle threads in one go.
+  virtual void addBatch(std::vector<folly::Func> funcs) {
+    for (auto& func : funcs) {
+      add(std::move(func));
+    }
+  }
+
   void setThreadFactory(std::shared_ptr<ThreadFactory> threadFactory) {
     CHECK(numThreads() == 0);
     threadFactory_ = std::move(threadFactory);
@@ -63,6 +74,9 @@ class ThreadPoolExecutor : public virtual folly::Executor {
                   pendingTaskCount(0), totalTaskCount(0) {}
     size_t threadCount, idleThreadCount, activeThreadCount;
     uint64_t pendingTaskCount, totalTaskCount;
+    // Of every task run by the pool, including by threads since stopped.
+    // Expired tasks count towards waitTime only.
+    LatencyHistogram waitTime, runTime;
   };
 
   PoolStats getPoolStats();
@@ -74,11 +88,20 @@ class ThreadPoolExecutor : public virtual folly::Executor {
     std::chrono::nanoseconds runTime;
   };
 
+  // Until the first subscription, task stats are only kept in the
+  // histograms of getPoolStats()
   Subscription<TaskStats> subscribeToTaskStats(
       const ObserverPtr<TaskStats>& observer) {
+    taskStatsSubscribed_ = true;
     return taskStatsSubject_->subscribe(observer);
   }
 
+  // Publishes the stats of one in every n tasks of each thread to
+  // subscribers, or none if n is 0. Defaults to every task.
+  void setTaskStatsSampleRate(uint32_t n) {
+    taskStatsSampleRate_ = n;
+  }
+
   /**
    * Base class for threads created with ThreadPoolExecutor.
    * Some subclasses have methods that operate on these
@@ -128,26 +151,43 @@ class ThreadPoolExecutor : public virtual folly::Executor {
     static std::atomic<uint64_t> nextId;
     uint64_t id;
     std::thread handle;
-    bool idle;
+    std::atomic<bool> idle;
     folly::Baton<> startupBaton;
     std::shared_ptr<Subject<TaskStats>> taskStatsSubject;
+    LatencyHistogram::Writer waitTimes;
+    LatencyHistogram::Writer runTimes;
+    uint64_t tasksRun{0};
   };
 
   typedef std::shared_ptr<Thread> ThreadPtr;
 
+  // Kept small, as tasks are queued by value. The expiration is only
+  // allocated for tasks that have one or an expire callback.
   struct Task {
+    Task() = default;
     explicit Task(
         folly::Func&& func,
         std::chrono::milliseconds expiration,
         folly::Func&& expireCallback);
+
+    struct Expiration {
+      std::chrono::milliseconds expiration;
+      folly::Func expireCallback;
+    };
+
     folly::Func func_;
-    TaskStats stats_;
     std::chrono::steady_clock::time_point enqueueTime_;
-    std::chrono::milliseconds expiration_;
-    folly::Func expireCallback_;
+    std::unique_ptr<Expiration> expiration_;
+    // The RequestTrace of the thread that added it, run with it
+    uint64_t traceId_{0};
   };
 
-  static void runTask(const ThreadPtr& thread, Task&& task);
+  // Expires the task instead of running it if it waited past its expiration,
+  // or if codel is given and deems the pool overloaded
+  void runTask(
+      Thread* thread,
+      Task&& task,
+      Codel* codel = nullptr);
 
   // The function that will be bound to pool threads. It must call
   // thread->startupBaton.post() when it's ready to consume work.
@@ -178,6 +218,7 @@ class ThreadPoolExecutor : public virtual folly::Executor {
             return compare(ts1, ts2);
           });
       vec_.insert(it, state);
+      publish();
     }
 
     void remove(const ThreadPtr& state) {
@@ -189,18 +230,42 @@ class ThreadPoolExecutor : public virtual folly::Executor {
       CHECK(itPair.first != vec_.end());
       CHECK(std::next(itPair.first) == itPair.second);
       vec_.erase(itPair.first);
+      publish();
     }
 
     const std::vector<ThreadPtr>& get() const {
       return vec_;
     }
 
+    typedef std::shared_ptr<const std::vector<ThreadPtr>> Snapshot;
+
+    // An immutable copy of the list, safe to use without threadListLock_.
+    // It changes whenever version() does.
+    Snapshot snapshot() const {
+      std::lock_guard<std::mutex> g(snapshotMutex_);
+      return snapshot_;
+    }
+
+    uint64_t version() const {
+      return version_.load(std::memory_order_acquire);
+    }
+
    private:
+    void publish() {
+      auto snapshot = std::make_shared<const std::vector<ThreadPtr>>(vec_);
+      std::lock_guard<std::mutex> g(snapshotMutex_);
+      snapshot_ = std::move(snapshot);
+      version_.fetch_add(1, std::memory_order_release);
+    }
+
     static bool compare(const ThreadPtr& ts1, const ThreadPtr& ts2) {
       return ts1->id < ts2->id;
     }
 
     std::vector<ThreadPtr> vec_;
+    mutable std::mutex snapshotMutex_;
+    Snapshot snapshot_{std::make_shared<const std::vector<ThreadPtr>>()};
+    std::atomic<uint64_t> version_{0};
   };
 
   class StoppedThreadQueue : public BlockingQueue<ThreadPtr> {
@@ -222,6 +287,13 @@ class ThreadPoolExecutor : public virtual folly::Executor {
   std::atomic<bool> isJoin_; // whether the current downsizing is a join
 
   std::shared_ptr<Subject<TaskStats>> taskStatsSubject_;
+  std::atomic<bool> taskStatsSubscribed_{false};
+  std::atomic<uint32_t> taskStatsSampleRate_{1};
+
+  // Histograms of the threads that have been removed
+  std::mutex retiredStatsMutex_;
+  LatencyHistogram retiredWaitTimes_;
+  LatencyHistogram retiredRunTimes_;
   std::vector<std::shared_ptr<Observer>> observers_;
 };
 
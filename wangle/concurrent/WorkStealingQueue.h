@@ -0,0 +1,290 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+#include <wangle/concurrent/BlockingQueue.h>
+#include <folly/Executor.h>
+#include <folly/LifoSem.h>
+#include <folly/MPMCQueue.h>
+#include <folly/Memory.h>
+#include <folly/ScopeGuard.h>
+#include <folly/ThreadLocal.h>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace wangle {
+
+/**
+ * A BlockingQueue in which every consumer thread has its own deque. Items
+ * added by a consumer thread (e.g. a task submitting subtasks from a
+ * CPUThreadPoolExecutor thread) go to that thread's deque, other items to a
+ * shared MPMC queue. Consumers take from their own deque first, newest item
+ * first, then from the shared queue, then steal the oldest item of another
+ * consumer's deque. Producers and consumers only contend when stealing.
+ *
+ * Consumers claim a deque the first time they call take(), and give it back
+ * when they exit; items left in it are stolen by the others. Consumers
+ * beyond maxConsumers share the shared queue only.
+ *
+ * Priorities work as in PriorityLifoSemMPMCQueue: each deque and the shared
+ * queue are split by priority, and higher priorities are always taken
+ * first. The item limit kBehavior applies to is the shared queue's.
+ */
+template <class T, QueueBehaviorIfFull kBehavior = QueueBehaviorIfFull::THROW>
+class WorkStealingQueue : public BlockingQueue<T> {
+ public:
+  explicit WorkStealingQueue(size_t maxConsumers,
+                             uint8_t numPriorities = 1,
+                             size_t capacity = 1 << 14)
+      : workers_(maxConsumers) {
+    CHECK_GT(numPriorities, 0);
+    shared_.reserve(numPriorities);
+    for (uint8_t i = 0; i < numPriorities; i++) {
+      shared_.emplace_back(capacity);
+    }
+    for (auto& w : workers_) {
+      w = folly::make_unique<Worker>(numPriorities);
+    }
+  }
+
+  uint8_t getNumPriorities() override {
+    return shared_.size();
+  }
+
+  void add(T item) override {
+    addWithPriority(std::move(item), folly::Executor::MID_PRI);
+  }
+
+  void addWithPriority(T item, int8_t priority) override {
+    const size_t queue = getQueue(priority);
+    auto self = consumer_->index;
+    if (self >= 0) {
+      auto& w = *workers_[self];
+      std::lock_guard<std::mutex> g(w.mutex);
+      w.queues[queue].push_back(std::move(item));
+    } else {
+      write(std::move(item), queue);
+    }
+    sem_.post();
+  }
+
+  bool tryAdd(T&& item) override {
+    return tryAddWithPriority(std::move(item), folly::Executor::MID_PRI);
+  }
+
+  bool tryAddWithPriority(T&& item, int8_t priority) override {
+    return addWithPriorityFor(
+        std::move(item), priority, std::chrono::milliseconds(0));
+  }
+
+  bool addFor(T&& item, std::chrono::milliseconds timeout) override {
+    return addWithPriorityFor(
+        std::move(item), folly::Executor::MID_PRI, timeout);
+  }
+
+  // Consumer threads' deques are unbounded, so only other threads can wait
+  bool addWithPriorityFor(
+      T&& item,
+      int8_t priority,
+      std::chrono::milliseconds timeout) override {
+    const size_t queue = getQueue(priority);
+    auto self = consumer_->index;
+    if (self >= 0) {
+      auto& w = *workers_[self];
+      std::lock_guard<std::mutex> g(w.mutex);
+      w.queues[queue].push_back(std::move(item));
+    } else if (timeout == std::chrono::milliseconds(0)) {
+      if (!shared_[queue].write(std::move(item))) {
+        return false;
+      }
+    } else if (!shared_[queue].tryWriteUntil(
+                 std::chrono::steady_clock::now() + timeout,
+                 std::move(item))) {
+      return false;
+    }
+    sem_.post();
+    return true;
+  }
+
+  // Adds at medium priority
+  void addBatch(std::vector<T> items) override {
+    if (items.empty()) {
+      return;
+    }
+    const size_t queue = getQueue(folly::Executor::MID_PRI);
+    const size_t n = items.size();
+    auto self = consumer_->index;
+    if (self >= 0) {
+      auto& w = *workers_[self];
+      std::lock_guard<std::mutex> g(w.mutex);
+      for (auto& item : items) {
+        w.queues[queue].push_back(std::move(item));
+      }
+    } else {
+      size_t written = 0;
+      SCOPE_EXIT {
+        if (written > 0) {
+          sem_.post(written);
+        }
+      };
+      for (auto& item : items) {
+        write(std::move(item), queue);
+        written++;
+      }
+      return;
+    }
+    sem_.post(n);
+  }
+
+  T take() override {
+    auto self = claim();
+    T item;
+    while (true) {
+      for (size_t q = shared_.size(); q-- > 0; ) {
+        if (self >= 0 && popLocal(self, q, item)) {
+          return item;
+        }
+        if (shared_[q].read(item)) {
+          return item;
+        }
+        if (steal(self, q, item)) {
+          return item;
+        }
+      }
+      sem_.wait();
+    }
+  }
+
+  size_t size() override {
+    size_t size = 0;
+    for (auto& q : shared_) {
+      size += q.size();
+    }
+    for (size_t i = 0; i < numClaimed_.load(); i++) {
+      auto& w = *workers_[i];
+      std::lock_guard<std::mutex> g(w.mutex);
+      for (auto& q : w.queues) {
+        size += q.size();
+      }
+    }
+    return size;
+  }
+
+ private:
+  size_t getQueue(int8_t priority) {
+    int mid = getNumPriorities() / 2;
+    size_t queue = priority < 0 ?
+                   std::max(0, mid + priority) :
+                   std::min(getNumPriorities() - 1, mid + priority);
+    CHECK_LT(queue, shared_.size());
+    return queue;
+  }
+
+  // Adds to the shared queue
+  void write(T item, size_t queue) {
+    switch (kBehavior) { // static
+    case QueueBehaviorIfFull::THROW:
+      if (!shared_[queue].write(std::move(item))) {
+        throw std::runtime_error("WorkStealingQueue full, can't add item");
+      }
+      break;
+    case QueueBehaviorIfFull::BLOCK:
+      shared_[queue].blockingWrite(std::move(item));
+      break;
+    }
+  }
+
+  struct FOLLY_ALIGN_TO_AVOID_FALSE_SHARING Worker {
+    explicit Worker(uint8_t numPriorities) : queues(numPriorities) {}
+
+    std::mutex mutex;
+    std::vector<std::deque<T>> queues;
+    std::atomic<bool> claimed{false};
+  };
+
+  // Per thread; gives the deque back when the thread exits
+  struct Consumer {
+    ~Consumer() {
+      if (index >= 0) {
+        queue->workers_[index]->claimed.store(false);
+      }
+    }
+
+    WorkStealingQueue* queue{nullptr};
+    int index{-1};
+    bool tried{false};
+  };
+
+  int claim() {
+    auto& consumer = *consumer_;
+    if (!consumer.tried) {
+      consumer.tried = true;
+      for (size_t i = 0; i < workers_.size(); i++) {
+        bool expected = false;
+        if (workers_[i]->claimed.compare_exchange_strong(expected, true)) {
+          consumer.queue = this;
+          consumer.index = i;
+          // Deques past numClaimed_ are never looked at
+          size_t claimed = numClaimed_.load();
+          while (claimed <= i &&
+                 !numClaimed_.compare_exchange_weak(claimed, i + 1)) {
+          }
+          break;
+        }
+      }
+    }
+    return consumer.index;
+  }
+
+  bool popLocal(int self, size_t q, T& item) {
+    auto& w = *workers_[self];
+    std::lock_guard<std::mutex> g(w.mutex);
+    auto& deque = w.queues[q];
+    if (deque.empty()) {
+      return false;
+    }
+    item = std::move(deque.back());
+    deque.pop_back();
+    return true;
+  }
+
+  bool steal(int self, size_t q, T& item) {
+    const size_t n = numClaimed_.load();
+    const size_t start = self >= 0 ? self + 1 : 0;
+    for (size_t i = 0; i < n; i++) {
+      const size_t victim = (start + i) % n;
+      if (static_cast<int>(victim) == self) {
+        continue;
+      }
+      auto& w = *workers_[victim];
+      std::lock_guard<std::mutex> g(w.mutex);
+      if (w.queues[q].empty()) {
+        continue;
+      }
+      item = std::move(w.queues[q].front());
+      w.queues[q].pop_front();
+      return true;
+    }
+    return false;
+  }
+
+  folly::LifoSem sem_;
+  std::vector<folly::MPMCQueue<T>> shared_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<size_t> numClaimed_{0};
+  // Destroyed before workers_, as it refers to them
+  folly::ThreadLocal<Consumer> consumer_;
+};
+
+} // namespace wangle
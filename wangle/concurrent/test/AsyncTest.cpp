@@ -10,8 +10,12 @@
 
 #include <gtest/gtest.h>
 #include <wangle/concurrent/Async.h>
+#include <wangle/concurrent/CPUThreadPoolExecutor.h>
 #include <folly/futures/ManualExecutor.h>
 
+#include <atomic>
+#include <list>
+
 using namespace folly;
 using namespace wangle;
 
@@ -44,3 +48,45 @@ TEST(AsyncFunc, moveonly_lambda) {
   auto future = async(lambda);
   EXPECT_EQ(42, *future.get() );
 }
+
+TEST(AsyncFunc, async_map) {
+  auto pool = std::make_shared<CPUThreadPoolExecutor>(4);
+  auto oldX = getCPUExecutor();
+  setCPUExecutor(pool);
+  std::vector<int> in;
+  std::vector<int> expected;
+  for (int i = 0; i < 1000; i++) {
+    in.push_back(i);
+    expected.push_back(i * i);
+  }
+  EXPECT_EQ(expected, asyncMap(in, [](int i) { return i * i; }).get());
+  std::vector<int> empty;
+  EXPECT_TRUE(asyncMap(empty, [](int i) { return i; }).get().empty());
+  setCPUExecutor(oldX);
+}
+
+TEST(AsyncFunc, async_map_chunks) {
+  auto x = std::make_shared<ManualExecutor>();
+  auto oldX = getCPUExecutor();
+  setCPUExecutor(x);
+  std::list<std::string> in(10, "x");
+  auto f = asyncMap(in, [](const std::string& s) { return s.size(); }, 3);
+  EXPECT_FALSE(f.isReady());
+  // One task per chunk
+  EXPECT_EQ(3, x->run());
+  EXPECT_EQ(std::vector<size_t>(10, 1), f.value());
+  setCPUExecutor(oldX);
+}
+
+TEST(AsyncFunc, async_all) {
+  auto pool = std::make_shared<CPUThreadPoolExecutor>(4);
+  auto oldX = getCPUExecutor();
+  setCPUExecutor(pool);
+  std::vector<int> in(100, 1);
+  std::atomic<int> sum(0);
+  asyncAll(in, [&](int i) { sum += i; }).get();
+  EXPECT_EQ(100, sum);
+  auto f = asyncAll(in, [](int) { throw std::runtime_error("oops"); });
+  EXPECT_THROW(f.get(), std::runtime_error);
+  setCPUExecutor(oldX);
+}
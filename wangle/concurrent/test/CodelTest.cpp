@@ -12,6 +12,7 @@
 #include <wangle/concurrent/Codel.h>
 #include <gtest/gtest.h>
 #include <thread>
+#include <vector>
 
 using std::chrono::milliseconds;
 using std::this_thread::sleep_for;
@@ -82,3 +83,27 @@ TEST(CodelTest, getLoadSanity) {
   // this test demonstrates how silly getLoad() is, but silly isn't
   // necessarily useless
 }
+
+TEST(CodelTest, multiThreaded) {
+  wangle::Codel c;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; i++) {
+    threads.emplace_back([&c, i] {
+      for (int j = 0; j < 10000; j++) {
+        c.overloaded(milliseconds(6 + i + j % 3));
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  // The minimum is seen across all threads' delays
+  EXPECT_EQ(milliseconds(6), c.getMinDelay());
+  EXPECT_EQ(60, c.getLoad());
+  std::this_thread::sleep_for(milliseconds(110));
+  // Every delay in the previous interval exceeded the target
+  EXPECT_FALSE(c.overloaded(milliseconds(20)));
+  std::thread([&c] {
+    EXPECT_TRUE(c.overloaded(milliseconds(20)));
+  }).join();
+}
@@ -0,0 +1,133 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <wangle/concurrent/Coroutine.h>
+#include <wangle/concurrent/CPUThreadPoolExecutor.h>
+#include <folly/futures/ManualExecutor.h>
+
+#include <stdexcept>
+#include <thread>
+
+// Built with BUILD_COROUTINE_TESTS, which compiles it with coroutine
+// support; without, Coroutine.h would be empty and this test with it
+#if !defined(__cpp_impl_coroutine)
+#error "CoroutineTest.cpp must be built with coroutine support"
+#endif
+
+using namespace folly;
+using namespace wangle;
+
+namespace {
+
+Future<int> addOne(Future<int> f) {
+  auto x = co_await std::move(f);
+  co_return x + 1;
+}
+
+Future<Unit> setFlag(Future<Unit> f, bool& flag) {
+  co_await std::move(f);
+  flag = true;
+}
+
+Future<int> throwAfter(Future<int> f) {
+  co_await std::move(f);
+  throw std::runtime_error("after");
+}
+
+Future<std::thread::id> threadAfter(Executor& executor) {
+  co_await executor;
+  co_return std::this_thread::get_id();
+}
+
+Future<int> steps(ManualExecutor& executor, int n) {
+  int sum = 0;
+  for (int i = 0; i < n; i++) {
+    co_await executor;
+    sum += co_await makeFuture(i);
+  }
+  co_return sum;
+}
+
+}
+
+TEST(Coroutine, ReadyFutureDoesNotSuspend) {
+  auto f = addOne(makeFuture(41));
+  ASSERT_TRUE(f.isReady());
+  EXPECT_EQ(42, f.value());
+}
+
+TEST(Coroutine, ResumedWhenFutureCompletes) {
+  Promise<int> p;
+  auto f = addOne(p.getFuture());
+  EXPECT_FALSE(f.isReady());
+  p.setValue(41);
+  ASSERT_TRUE(f.isReady());
+  EXPECT_EQ(42, f.value());
+}
+
+TEST(Coroutine, Unit) {
+  Promise<Unit> p;
+  bool flag = false;
+  auto f = setFlag(p.getFuture(), flag);
+  EXPECT_FALSE(flag);
+  p.setValue();
+  EXPECT_TRUE(flag);
+  EXPECT_TRUE(f.isReady());
+}
+
+TEST(Coroutine, ExceptionsFailTheFuture) {
+  // Rethrown by co_await
+  auto failed = addOne(makeFuture<int>(std::logic_error("before")));
+  ASSERT_TRUE(failed.isReady());
+  EXPECT_THROW(failed.value(), std::logic_error);
+
+  // Or escaping the coroutine
+  Promise<int> p;
+  auto thrown = throwAfter(p.getFuture());
+  p.setValue(1);
+  ASSERT_TRUE(thrown.isReady());
+  EXPECT_THROW(thrown.value(), std::runtime_error);
+}
+
+TEST(Coroutine, ResumedOnExecutor) {
+  ManualExecutor executor;
+  auto f = steps(executor, 3);
+  EXPECT_FALSE(f.isReady());
+  // One resumption per co_await on the executor
+  EXPECT_EQ(1, executor.run());
+  EXPECT_EQ(1, executor.run());
+  EXPECT_FALSE(f.isReady());
+  EXPECT_EQ(1, executor.run());
+  ASSERT_TRUE(f.isReady());
+  EXPECT_EQ(0 + 1 + 2, f.value());
+
+  CPUThreadPoolExecutor pool(1);
+  auto id = threadAfter(pool).get();
+  EXPECT_NE(std::this_thread::get_id(), id);
+}
+
+TEST(Coroutine, FramesReused) {
+  auto p = CoroutineFrameAllocator::allocate(100);
+  CoroutineFrameAllocator::deallocate(p, 100);
+  // Same size class
+  auto q = CoroutineFrameAllocator::allocate(120);
+  EXPECT_EQ(p, q);
+  CoroutineFrameAllocator::deallocate(q, 120);
+
+  // Too big to cache
+  auto big = CoroutineFrameAllocator::allocate(
+    CoroutineFrameAllocator::kGranularity *
+    CoroutineFrameAllocator::kNumClasses + 1);
+  CoroutineFrameAllocator::deallocate(
+    big,
+    CoroutineFrameAllocator::kGranularity *
+    CoroutineFrameAllocator::kNumClasses + 1);
+}
@@ -11,6 +11,10 @@
 #include <gtest/gtest.h>
 #include <wangle/concurrent/GlobalExecutor.h>
 #include <wangle/concurrent/IOExecutor.h>
+#include <wangle/concurrent/IOObjectCache.h>
+#include <wangle/concurrent/IOThreadPoolExecutor.h>
+
+#include <thread>
 
 using namespace folly;
 using namespace wangle;
@@ -78,3 +82,51 @@ TEST(GlobalExecutorTest, GlobalIOExecutor) {
   // weak reference to dummy has expired
   getIOExecutor()->add(f);
 }
+
+TEST(GlobalExecutorTest, SetFromAnotherThread) {
+  class DummyExecutor : public folly::Executor {
+   public:
+    void add(folly::Func f) override {
+      count++;
+    }
+    int count{0};
+  };
+
+  auto first = std::make_shared<DummyExecutor>();
+  auto second = std::make_shared<DummyExecutor>();
+  setCPUExecutor(first);
+  // Cache the first executor in this thread
+  getCPUExecutor()->add([]{});
+  EXPECT_EQ(1, first->count);
+
+  std::thread([&] { setCPUExecutor(second); }).join();
+  getCPUExecutor()->add([]{});
+  EXPECT_EQ(1, first->count);
+  EXPECT_EQ(1, second->count);
+}
+
+TEST(GlobalExecutorTest, IOObjectCache) {
+  auto pool = std::make_shared<IOThreadPoolExecutor>(2);
+  setIOExecutor(pool);
+  int created = 0;
+  IOObjectCache<int> cache([&](folly::EventBase*) {
+    return std::make_shared<int>(created++);
+  });
+
+  std::vector<std::weak_ptr<int>> objects;
+  for (int i = 0; i < 10; i++) {
+    objects.push_back(cache.get());
+  }
+  EXPECT_EQ(2, created);
+
+  // The stopped thread's object is dropped on the next get()
+  pool->setNumThreads(1);
+  auto object = cache.get();
+  size_t alive = 0;
+  for (auto& o : objects) {
+    alive += !o.expired();
+  }
+  EXPECT_EQ(5, alive);
+  EXPECT_EQ(2, created);
+  pool->join();
+}
@@ -0,0 +1,112 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <wangle/concurrent/CPUThreadPoolExecutor.h>
+#include <wangle/concurrent/RequestTrace.h>
+#include <folly/Baton.h>
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <set>
+#include <thread>
+
+using namespace wangle;
+
+TEST(RequestTraceTest, Sample) {
+  std::thread t([] {
+    std::set<uint64_t> ids;
+    size_t sampled = 0;
+    for (int i = 0; i < 12; i++) {
+      if (auto id = RequestTrace::sample(4)) {
+        ids.insert(id);
+        sampled++;
+      }
+    }
+    EXPECT_EQ(3, sampled);
+    EXPECT_EQ(3, ids.size());
+    EXPECT_EQ(0, ids.count(0));
+    for (int i = 0; i < 12; i++) {
+      EXPECT_EQ(0, RequestTrace::sample(0));
+    }
+  });
+  t.join();
+}
+
+TEST(RequestTraceTest, Scope) {
+  EXPECT_FALSE(RequestTrace::isSet());
+  // Untraced, nothing is recorded
+  RequestTrace::record("ignored");
+  const auto id = RequestTrace::sample(1);
+  {
+    RequestTrace::Scope scope(id);
+    EXPECT_EQ(id, RequestTrace::current());
+    RequestTrace::record("first");
+    {
+      RequestTrace::Scope inner(0);
+      EXPECT_FALSE(RequestTrace::isSet());
+      RequestTrace::record("ignored");
+    }
+    RequestTrace::record("second");
+  }
+  EXPECT_FALSE(RequestTrace::isSet());
+
+  auto events = RequestTrace::getEvents(id);
+  ASSERT_EQ(2, events.size());
+  EXPECT_STREQ("first", events[0].stage);
+  EXPECT_STREQ("second", events[1].stage);
+  EXPECT_LE(events[0].time, events[1].time);
+  EXPECT_EQ(events[0].thread, events[1].thread);
+  for (const auto& event : RequestTrace::getEvents()) {
+    EXPECT_NE(0, strcmp("ignored", event.stage));
+  }
+
+  const auto dump = RequestTrace::dump(id);
+  EXPECT_NE(std::string::npos, dump.find("first"));
+  EXPECT_NE(std::string::npos, dump.find("second"));
+}
+
+TEST(RequestTraceTest, ThreadPoolExecutor) {
+  CPUThreadPoolExecutor pool(1);
+  const auto id = RequestTrace::sample(1);
+  folly::Baton<> done;
+  uint64_t seen = 0;
+  {
+    RequestTrace::Scope scope(id);
+    pool.add([&] {
+      seen = RequestTrace::current();
+      RequestTrace::record("ran");
+      done.post();
+    });
+  }
+  // Not carried over to untraced tasks
+  pool.add([] {
+    EXPECT_FALSE(RequestTrace::isSet());
+  });
+  done.wait();
+
+  EXPECT_EQ(id, seen);
+  // Before the pool's thread exits, along with its events
+  auto events = RequestTrace::getEvents(id);
+  ASSERT_EQ(3, events.size());
+  EXPECT_STREQ("queued", events[0].stage);
+  EXPECT_STREQ("dequeued", events[1].stage);
+  EXPECT_STREQ("ran", events[2].stage);
+  EXPECT_NE(events[0].thread, events[1].thread);
+  pool.join();
+}
+
+TEST(RequestTraceTest, Ring) {
+  const auto id = RequestTrace::sample(1);
+  RequestTrace::Scope scope(id);
+  for (size_t i = 0; i < RequestTrace::kRingSize + 10; i++) {
+    RequestTrace::record("stage");
+  }
+  EXPECT_EQ(RequestTrace::kRingSize, RequestTrace::getEvents(id).size());
+}
@@ -0,0 +1,206 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <folly/Benchmark.h>
+#include <folly/Baton.h>
+#include <folly/Memory.h>
+#include <gflags/gflags.h>
+#include <wangle/concurrent/CPUThreadPoolExecutor.h>
+#include <wangle/concurrent/FiberIOExecutor.h>
+#include <wangle/concurrent/IOThreadPoolExecutor.h>
+#include <wangle/concurrent/LifoSemMPMCQueue.h>
+#include <wangle/concurrent/PriorityLifoSemMPMCQueue.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace wangle;
+using folly::BenchmarkSuspender;
+
+namespace {
+
+enum class Kind {
+  // LifoSemMPMCQueue
+  CPU,
+  // PriorityLifoSemMPMCQueue, with tasks at every priority
+  CPU_PRIORITY,
+  IO,
+  FIBER_IO,
+};
+
+constexpr int8_t kNumPriorities = 3;
+
+// Producers block on a full queue rather than throw, as they outrun the
+// consumers by far more than the default queue size
+struct Pool {
+  Pool(Kind k, size_t numThreads) : kind(k) {
+    switch (kind) {
+      case Kind::CPU:
+        pool = std::make_shared<CPUThreadPoolExecutor>(
+          numThreads,
+          folly::make_unique<LifoSemMPMCQueue<
+            CPUThreadPoolExecutor::CPUTask, QueueBehaviorIfFull::BLOCK>>(
+              CPUThreadPoolExecutor::kDefaultMaxQueueSize));
+        break;
+      case Kind::CPU_PRIORITY:
+        pool = std::make_shared<CPUThreadPoolExecutor>(
+          numThreads,
+          folly::make_unique<PriorityLifoSemMPMCQueue<
+            CPUThreadPoolExecutor::CPUTask, QueueBehaviorIfFull::BLOCK>>(
+              kNumPriorities, CPUThreadPoolExecutor::kDefaultMaxQueueSize));
+        break;
+      case Kind::IO:
+      case Kind::FIBER_IO: {
+        auto io = std::make_shared<IOThreadPoolExecutor>(numThreads);
+        if (kind == Kind::FIBER_IO) {
+          fiber = std::make_shared<FiberIOExecutor>(io);
+        }
+        pool = std::move(io);
+        break;
+      }
+    }
+  }
+
+  ~Pool() {
+    pool->join();
+  }
+
+  void add(folly::Func func, size_t i) {
+    switch (kind) {
+      case Kind::CPU_PRIORITY:
+        pool->addWithPriority(
+          std::move(func), static_cast<int8_t>(i % kNumPriorities) - 1);
+        break;
+      case Kind::FIBER_IO:
+        fiber->add(std::move(func));
+        break;
+      default:
+        pool->add(std::move(func));
+        break;
+    }
+  }
+
+  const Kind kind;
+  std::shared_ptr<ThreadPoolExecutor> pool;
+  std::shared_ptr<FiberIOExecutor> fiber;
+};
+
+// The cost of add() alone, with the consumers draining concurrently
+void submit(size_t iters, Kind kind, size_t consumers) {
+  BenchmarkSuspender braces;
+  Pool pool(kind, consumers);
+  std::atomic<size_t> done{0};
+  folly::Baton<> drained;
+  auto task = [&] {
+    if (++done == iters) {
+      drained.post();
+    }
+  };
+
+  braces.dismissing([&] {
+    for (size_t i = 0; i < iters; i++) {
+      pool.add(task, i);
+    }
+  });
+  drained.wait();
+}
+
+// Tasks run per second, from submission by every producer to completion
+void throughput(size_t iters, Kind kind, size_t producers, size_t consumers) {
+  BenchmarkSuspender braces;
+  const size_t total = iters / producers * producers;
+  if (total == 0) {
+    return;
+  }
+  Pool pool(kind, consumers);
+  std::atomic<size_t> done{0};
+  folly::Baton<> drained;
+  auto task = [&] {
+    if (++done == total) {
+      drained.post();
+    }
+  };
+
+  braces.dismissing([&] {
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; p++) {
+      threads.emplace_back([&] {
+        for (size_t i = 0; i < iters / producers; i++) {
+          pool.add(task, i);
+        }
+      });
+    }
+    for (auto& t : threads) {
+      t.join();
+    }
+    drained.wait();
+  });
+}
+
+// The round trip to an idle pool: each task is only added once the previous
+// one has run, so consumers are asleep and have to be woken up every time
+void wakeup(size_t iters, Kind kind, size_t consumers) {
+  BenchmarkSuspender braces;
+  Pool pool(kind, consumers);
+
+  braces.dismissing([&] {
+    for (size_t i = 0; i < iters; i++) {
+      folly::Baton<> ran;
+      pool.add([&] { ran.post(); }, i);
+      ran.wait();
+    }
+  });
+}
+
+}
+
+BENCHMARK_NAMED_PARAM(submit, cpu_1c, Kind::CPU, 1)
+BENCHMARK_NAMED_PARAM(submit, cpu_8c, Kind::CPU, 8)
+BENCHMARK_NAMED_PARAM(submit, cpu_priority_1c, Kind::CPU_PRIORITY, 1)
+BENCHMARK_NAMED_PARAM(submit, cpu_priority_8c, Kind::CPU_PRIORITY, 8)
+BENCHMARK_NAMED_PARAM(submit, io_1c, Kind::IO, 1)
+BENCHMARK_NAMED_PARAM(submit, io_8c, Kind::IO, 8)
+BENCHMARK_NAMED_PARAM(submit, fiber_io_1c, Kind::FIBER_IO, 1)
+BENCHMARK_NAMED_PARAM(submit, fiber_io_8c, Kind::FIBER_IO, 8)
+
+BENCHMARK_DRAW_LINE()
+
+BENCHMARK_NAMED_PARAM(throughput, cpu_1p_1c, Kind::CPU, 1, 1)
+BENCHMARK_NAMED_PARAM(throughput, cpu_1p_8c, Kind::CPU, 1, 8)
+BENCHMARK_NAMED_PARAM(throughput, cpu_8p_1c, Kind::CPU, 8, 1)
+BENCHMARK_NAMED_PARAM(throughput, cpu_8p_8c, Kind::CPU, 8, 8)
+BENCHMARK_NAMED_PARAM(throughput, cpu_priority_1p_1c, Kind::CPU_PRIORITY, 1, 1)
+BENCHMARK_NAMED_PARAM(throughput, cpu_priority_1p_8c, Kind::CPU_PRIORITY, 1, 8)
+BENCHMARK_NAMED_PARAM(throughput, cpu_priority_8p_1c, Kind::CPU_PRIORITY, 8, 1)
+BENCHMARK_NAMED_PARAM(throughput, cpu_priority_8p_8c, Kind::CPU_PRIORITY, 8, 8)
+BENCHMARK_NAMED_PARAM(throughput, io_1p_1c, Kind::IO, 1, 1)
+BENCHMARK_NAMED_PARAM(throughput, io_1p_8c, Kind::IO, 1, 8)
+BENCHMARK_NAMED_PARAM(throughput, io_8p_1c, Kind::IO, 8, 1)
+BENCHMARK_NAMED_PARAM(throughput, io_8p_8c, Kind::IO, 8, 8)
+BENCHMARK_NAMED_PARAM(throughput, fiber_io_1p_1c, Kind::FIBER_IO, 1, 1)
+BENCHMARK_NAMED_PARAM(throughput, fiber_io_1p_8c, Kind::FIBER_IO, 1, 8)
+BENCHMARK_NAMED_PARAM(throughput, fiber_io_8p_1c, Kind::FIBER_IO, 8, 1)
+BENCHMARK_NAMED_PARAM(throughput, fiber_io_8p_8c, Kind::FIBER_IO, 8, 8)
+
+BENCHMARK_DRAW_LINE()
+
+BENCHMARK_NAMED_PARAM(wakeup, cpu_1c, Kind::CPU, 1)
+BENCHMARK_NAMED_PARAM(wakeup, cpu_8c, Kind::CPU, 8)
+BENCHMARK_NAMED_PARAM(wakeup, cpu_priority_1c, Kind::CPU_PRIORITY, 1)
+BENCHMARK_NAMED_PARAM(wakeup, io_1c, Kind::IO, 1)
+BENCHMARK_NAMED_PARAM(wakeup, io_8c, Kind::IO, 8)
+BENCHMARK_NAMED_PARAM(wakeup, fiber_io_1c, Kind::FIBER_IO, 1)
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  folly::runBenchmarks();
+  return 0;
+}
@@ -8,14 +8,26 @@
  *
  */
 
+#include <wangle/concurrent/AffinityThreadFactory.h>
 #include <wangle/concurrent/CPUThreadPoolExecutor.h>
+#include <wangle/concurrent/DeadlineQueue.h>
+#include <wangle/concurrent/FiberIOExecutor.h>
 #include <wangle/concurrent/FutureExecutor.h>
 #include <wangle/concurrent/IOThreadPoolExecutor.h>
+#include <wangle/concurrent/KeyedSerialExecutor.h>
 #include <wangle/concurrent/LifoSemMPMCQueue.h>
+#include <wangle/concurrent/PriorityLifoSemMPMCQueue.h>
 #include <wangle/concurrent/PriorityThreadFactory.h>
+#include <wangle/concurrent/TenantFairQueue.h>
+#include <wangle/concurrent/ThreadPoolAutoscaler.h>
 #include <wangle/concurrent/ThreadPoolExecutor.h>
+#include <wangle/concurrent/WorkStealingQueue.h>
+#include <folly/experimental/fibers/Baton.h>
+#include <folly/io/async/EventBase.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
+#include <numeric>
+#include <thread>
 
 using namespace folly;
 using namespace wangle;
@@ -203,6 +215,56 @@ TEST(ThreadPoolExecutorTest, IOTaskStats) {
   taskStats<IOThreadPoolExecutor>();
 }
 
+template <class TPE>
+static void sampledTaskStats() {
+  TPE tpe(1);
+  std::atomic<int> c(0);
+  auto s = tpe.subscribeToTaskStats(
+      Observer<ThreadPoolExecutor::TaskStats>::create(
+          [&](ThreadPoolExecutor::TaskStats stats) {
+        c++;
+      }));
+  tpe.setTaskStatsSampleRate(2);
+  for (int i = 0; i < 10; i++) {
+    tpe.add(burnMs(2));
+  }
+  tpe.join();
+  EXPECT_EQ(5, c);
+  // Every task is in the histograms, which outlive the threads
+  auto stats = tpe.getPoolStats();
+  EXPECT_EQ(10, stats.waitTime.count());
+  EXPECT_EQ(10, stats.runTime.count());
+  EXPECT_LE(milliseconds(1), stats.runTime.getPercentile(50));
+  EXPECT_LT(stats.waitTime.getPercentile(10), stats.waitTime.getPercentile(90));
+}
+
+TEST(ThreadPoolExecutorTest, CPUSampledTaskStats) {
+  sampledTaskStats<CPUThreadPoolExecutor>();
+}
+
+TEST(ThreadPoolExecutorTest, IOSampledTaskStats) {
+  sampledTaskStats<IOThreadPoolExecutor>();
+}
+
+TEST(LatencyHistogramTest, Buckets) {
+  LatencyHistogram h;
+  EXPECT_EQ(milliseconds(0), h.getPercentile(50));
+  for (int i = 1; i <= 100; i++) {
+    h.add(microseconds(i));
+  }
+  EXPECT_EQ(100, h.count());
+  // Within 12.5% below the exact percentile
+  for (int pct : {1, 50, 90, 100}) {
+    auto exact = microseconds(pct);
+    EXPECT_GE(exact, h.getPercentile(pct));
+    EXPECT_LT(exact * 7 / 8, h.getPercentile(pct));
+  }
+  for (size_t i = 0; i < LatencyHistogram::kNumBuckets; i++) {
+    auto lower = nanoseconds(LatencyHistogram::lowerBound(i));
+    EXPECT_EQ(i, LatencyHistogram::bucketOf(lower));
+  }
+}
+
 template <class TPE>
 static void expiration() {
   TPE tpe(1);
@@ -293,6 +355,63 @@ TEST(ThreadPoolExecutorTest, IOFuturePool) {
   futureExecutor<IOThreadPoolExecutor>();
 }
 
+TEST(ThreadPoolExecutorTest, CPUShedOnOverload) {
+  std::atomic_int ran{0};
+  std::atomic_int expired{0};
+  CPUThreadPoolExecutor pool(1);
+  pool.setShedOnOverload(true);
+
+  // Every task queues for longer than the codel target, so once the first
+  // interval ends the rest get expired
+  pool.add(burnMs(150));
+  for (int i = 0; i < 20; i++) {
+    pool.add([&] { burnMs(20)(); ran++; },
+             milliseconds(0),
+             [&] { expired++; });
+  }
+  pool.join();
+
+  EXPECT_EQ(20, ran + expired);
+  EXPECT_LT(0, ran);
+  EXPECT_LT(0, expired);
+  EXPECT_EQ(100, pool.getCodel().getLoad());
+}
+
+template <class TPE>
+static void autoscale() {
+  TPE pool(1);
+  ThreadPoolAutoscaler::Options options;
+  options.maxThreads = 4;
+  options.targetWaitTime = milliseconds(1);
+  options.period = milliseconds(10);
+  options.shrinkAfter = 5;
+  {
+    ThreadPoolAutoscaler autoscaler(&pool, options);
+    auto waitFor = [&](size_t n) {
+      for (int i = 0; i < 500 && autoscaler.getNumThreads() != n; i++) {
+        std::this_thread::sleep_for(milliseconds(10));
+      }
+      return autoscaler.getNumThreads();
+    };
+    // A backlog of 500ms for a single thread
+    for (int i = 0; i < 100; i++) {
+      pool.add(burnMs(5));
+    }
+    EXPECT_EQ(4, waitFor(4));
+    // And back down once it has drained
+    EXPECT_EQ(1, waitFor(1));
+  }
+  pool.join();
+}
+
+TEST(ThreadPoolExecutorTest, CPUAutoscale) {
+  autoscale<CPUThreadPoolExecutor>();
+}
+
+TEST(ThreadPoolExecutorTest, IOAutoscale) {
+  autoscale<IOThreadPoolExecutor>();
+}
+
 TEST(ThreadPoolExecutorTest, PriorityPreemptionTest) {
   bool tookLopri = false;
   auto completed = 0;
@@ -316,6 +435,62 @@ TEST(ThreadPoolExecutorTest, PriorityPreemptionTest) {
   EXPECT_EQ(100, completed);
 }
 
+TEST(ThreadPoolExecutorTest, PriorityQueueManyPriorities) {
+  PriorityLifoSemMPMCQueue<int> q(200, 10);
+  for (int p = -100; p < 100; p += 7) {
+    q.addWithPriority(p, p);
+  }
+  EXPECT_EQ(29, q.size());
+  int last = 100;
+  for (int i = 0; i < 29; i++) {
+    int p = q.take();
+    EXPECT_LT(p, last);
+    last = p;
+  }
+  EXPECT_EQ(0, q.size());
+}
+
+TEST(ThreadPoolExecutorTest, PriorityQueueAging) {
+  PriorityLifoSemMPMCQueue<int> q(3, 100);
+  q.setAging(4);
+  for (int i = 0; i < 10; i++) {
+    q.addWithPriority(Executor::LO_PRI, Executor::LO_PRI);
+  }
+  for (int i = 0; i < 30; i++) {
+    q.addWithPriority(Executor::HI_PRI, Executor::HI_PRI);
+  }
+  // One take in four goes to the lowest priority
+  int lopri = 0;
+  for (int i = 0; i < 20; i++) {
+    if (q.take() == Executor::LO_PRI) {
+      lopri++;
+    }
+  }
+  EXPECT_EQ(5, lopri);
+}
+
+TEST(ThreadPoolExecutorTest, TryAdd) {
+  int completed = 0;
+  CPUThreadPoolExecutor pool(0, 2, 2);
+  Func f = [&] { completed++; };
+  EXPECT_TRUE(pool.tryAdd(Func(f), Executor::HI_PRI));
+  EXPECT_TRUE(pool.tryAdd(Func(f), Executor::HI_PRI));
+  EXPECT_FALSE(pool.tryAdd(std::move(f), Executor::HI_PRI));
+  // Not moved from, so it can be run some other way
+  EXPECT_TRUE(f != nullptr);
+  // The other priority has room of its own
+  EXPECT_TRUE(pool.tryAdd(Func(f), Executor::LO_PRI));
+
+  auto start = steady_clock::now();
+  EXPECT_FALSE(pool.addFor(std::move(f), milliseconds(20), Executor::HI_PRI));
+  EXPECT_GE(steady_clock::now() - start, milliseconds(20));
+  EXPECT_TRUE(f != nullptr);
+
+  pool.setNumThreads(1);
+  pool.join();
+  EXPECT_EQ(3, completed);
+}
+
 class TestObserver : public ThreadPoolExecutor::Observer {
  public:
   void threadStarted(ThreadPoolExecutor::ThreadHandle*) override { threads_++; }
@@ -369,9 +544,11 @@ TEST(ThreadPoolExecutorTest, AddWithPriority) {
   std::atomic_int c{0};
   auto f = [&]{ c++; };
 
-  // IO exe doesn't support priorities
   IOThreadPoolExecutor ioExe(10);
-  EXPECT_THROW(ioExe.addWithPriority(f, 0), std::runtime_error);
+  ioExe.addWithPriority(f, Executor::LO_PRI);
+  ioExe.addWithPriority(f, 0);
+  ioExe.addWithPriority(f, Executor::HI_PRI);
+  ioExe.join();
 
   CPUThreadPoolExecutor cpuExe(10, 3);
   cpuExe.addWithPriority(f, -1);
@@ -383,7 +560,333 @@ TEST(ThreadPoolExecutorTest, AddWithPriority) {
   cpuExe.addWithPriority(f, Executor::HI_PRI);
   cpuExe.join();
 
-  EXPECT_EQ(7, c);
+  EXPECT_EQ(10, c);
+}
+
+template <class TPE>
+static void addBatch() {
+  std::atomic_int c{0};
+  TPE tpe(10);
+  std::vector<Func> funcs;
+  for (int i = 0; i < 100; i++) {
+    funcs.push_back([&] { c++; });
+  }
+  tpe.addBatch(std::move(funcs));
+  tpe.join();
+  EXPECT_EQ(100, c);
+}
+
+TEST(ThreadPoolExecutorTest, CPUAddBatch) {
+  addBatch<CPUThreadPoolExecutor>();
+}
+
+TEST(ThreadPoolExecutorTest, IOAddBatch) {
+  addBatch<IOThreadPoolExecutor>();
+}
+
+TEST(ThreadPoolExecutorTest, IOTwoChoices) {
+  IOThreadPoolExecutor pool(2);
+  pool.setThreadSelection(IOThreadPoolExecutor::ThreadSelection::TWO_CHOICES);
+
+  // Tasks added from a pool thread stay on it, so this loads one thread with
+  // 11 pending tasks. With two threads both are always compared, so nothing
+  // more may be sent to it.
+  Baton<> started, block;
+  pool.add([&] {
+    for (int i = 0; i < 10; i++) {
+      pool.add([] {});
+    }
+    started.post();
+    block.wait();
+  });
+  started.wait();
+  for (int i = 0; i < 10; i++) {
+    Baton<> done;
+    pool.add([&] { done.post(); });
+    EXPECT_TRUE(done.timed_wait(steady_clock::now() + seconds(5)));
+  }
+  block.post();
+  pool.join();
+}
+
+TEST(ThreadPoolExecutorTest, IOMemoryIdlerOptions) {
+  IOThreadPoolExecutor::MemoryIdlerOptions disabled;
+  disabled.enabled = false;
+  IOThreadPoolExecutor::MemoryIdlerOptions eager;
+  eager.idleTimeout = milliseconds(1);
+  eager.purgeArena = true;
+
+  for (const auto& options : {disabled, eager}) {
+    std::atomic<int> completed(0);
+    IOThreadPoolExecutor pool(
+        2,
+        std::make_shared<NamedThreadFactory>("IOThreadPool"),
+        EventBaseManager::get(),
+        options);
+    pool.add([&] { completed++; });
+    // Long enough for the eager threads to idle
+    burnMs(20)();
+    pool.add([&] { completed++; });
+    pool.join();
+    EXPECT_EQ(2, completed);
+  }
+}
+
+TEST(ThreadPoolExecutorTest, IOPriority) {
+  IOThreadPoolExecutor pool(1);
+  EXPECT_EQ(3, pool.getNumPriorities());
+  folly::Baton<> started, release;
+  std::vector<int> order;
+  pool.add([&] {
+    started.post();
+    release.wait();
+  });
+  started.wait();
+  pool.addWithPriority([&] { order.push_back(0); }, Executor::LO_PRI);
+  pool.add([&] { order.push_back(1); });
+  pool.addWithPriority([&] { order.push_back(2); }, Executor::HI_PRI);
+  pool.addWithPriority([&] { order.push_back(3); }, 1);
+  pool.addWithPriority([&] { order.push_back(4); }, -1);
+  release.post();
+  pool.join();
+  EXPECT_EQ(std::vector<int>({2, 3, 1, 0, 4}), order);
+}
+
+TEST(ThreadPoolExecutorTest, KeyedSerialExecutor) {
+  const int kKeys = 8;
+  const int kFuncsPerKey = 1000;
+  auto pool = std::make_shared<CPUThreadPoolExecutor>(4);
+  std::vector<int> next(kKeys, 0);
+  std::vector<std::atomic<bool>> running(kKeys);
+  std::atomic<int> concurrent(0), maxConcurrent(0), outOfOrder(0), done(0);
+  folly::Baton<> allDone;
+  {
+    KeyedSerialExecutor<int> strands(pool, 16);
+    for (int i = 0; i < kFuncsPerKey; i++) {
+      for (int key = 0; key < kKeys; key++) {
+        strands.add(key, [&, key, i] {
+          EXPECT_FALSE(running[key].exchange(true));
+          int n = ++concurrent;
+          int max = maxConcurrent;
+          while (n > max && !maxConcurrent.compare_exchange_weak(max, n)) {}
+          if (next[key]++ != i) {
+            outOfOrder++;
+          }
+          if (i % 100 == 0) {
+            burnMs(1)();
+          }
+          concurrent--;
+          running[key] = false;
+          if (++done == kKeys * kFuncsPerKey) {
+            allDone.post();
+          }
+        });
+      }
+    }
+    // The strands outlive the executor
+  }
+  // Strands re-add themselves, so they might not all run once join() has
+  // queued its poison tasks
+  allDone.wait();
+  pool->join();
+  EXPECT_EQ(0, outOfOrder);
+  EXPECT_EQ(std::vector<int>(kKeys, kFuncsPerKey), next);
+  EXPECT_GT(maxConcurrent, 1);
+}
+
+TEST(ThreadPoolExecutorTest, IOLoopStats) {
+  IOThreadPoolExecutor pool(2);
+  pool.setStallThreshold(milliseconds(5));
+  for (int i = 0; i < 10; i++) {
+    pool.add([] {});
+  }
+  pool.add(burnMs(20));
+  // Until the slow task has run and its loop iteration completed
+  while (true) {
+    uint64_t stalls = 0;
+    for (const auto& stats : pool.getLoopStats()) {
+      stalls += stats.stalls;
+    }
+    if (stalls > 0) {
+      EXPECT_EQ(1, stalls);
+      break;
+    }
+    std::this_thread::yield();
+  }
+  auto stats = pool.getLoopStats();
+  ASSERT_EQ(2, stats.size());
+  EXPECT_LT(stats[0].threadId, stats[1].threadId);
+  EXPECT_EQ(11, stats[0].waitTime.count() + stats[1].waitTime.count());
+  EXPECT_GT(stats[0].loopTime.count() + stats[1].loopTime.count(), 0);
+  EXPECT_GE(
+      std::max(stats[0].loopTime.getPercentile(100),
+               stats[1].loopTime.getPercentile(100)),
+      milliseconds(15));
+  pool.join();
+}
+
+TEST(ThreadPoolExecutorTest, IOBusyPoll) {
+  IOThreadPoolExecutor::BusyPollOptions options;
+  options.spinTime = std::chrono::microseconds(500);
+  std::atomic<int> completed(0);
+  IOThreadPoolExecutor pool(
+      2,
+      std::make_shared<NamedThreadFactory>("IOThreadPool"),
+      EventBaseManager::get(),
+      IOThreadPoolExecutor::MemoryIdlerOptions(),
+      options);
+  for (int i = 0; i < 100; i++) {
+    pool.add([&] { completed++; });
+  }
+  // Long enough for the threads to stop spinning and block
+  burnMs(10)();
+  pool.add([&] { completed++; });
+  pool.setNumThreads(1);
+  pool.add([&] { completed++; });
+  pool.join();
+  EXPECT_EQ(102, completed);
+}
+
+TEST(ThreadPoolExecutorTest, IOBatchedTasks) {
+  IOThreadPoolExecutor pool(1);
+  pool.setMaxBatchedTasks(8);
+  folly::Baton<> started;
+  folly::Baton<> release;
+  pool.add([&] {
+    started.post();
+    release.wait();
+  });
+  started.wait();
+
+  std::vector<int> order;
+  folly::Baton<> done;
+  for (int i = 0; i < 20; i++) {
+    pool.add([&, i] {
+      order.push_back(i);
+      if (i == 19) {
+        done.post();
+      }
+    });
+  }
+  // All behind a single callback
+  EXPECT_EQ(1, pool.getEventBase()->getNotificationQueueSize());
+  release.post();
+  done.wait();
+  std::vector<int> expected(20);
+  std::iota(expected.begin(), expected.end(), 0);
+  EXPECT_EQ(expected, order);
+  pool.join();
+}
+
+// More tasks than a thread's queue holds, the rest queued on the EventBase
+TEST(ThreadPoolExecutorTest, IOQueueOverflow) {
+  IOThreadPoolExecutor pool(1);
+  folly::Baton<> started;
+  folly::Baton<> release;
+  pool.add([&] {
+    started.post();
+    release.wait();
+  });
+  started.wait();
+
+  const int n = 3000;
+  std::vector<int> order;
+  for (int i = 0; i < n; i++) {
+    pool.add([&, i] { order.push_back(i); });
+  }
+  EXPECT_EQ(n, pool.getEventBase()->getNotificationQueueSize());
+  release.post();
+  pool.join();
+  // In the order added, across the fallback
+  std::vector<int> expected(n);
+  std::iota(expected.begin(), expected.end(), 0);
+  EXPECT_EQ(expected, order);
+}
+
+TEST(ThreadPoolExecutorTest, IOQueuedTasksRunOnStop) {
+  IOThreadPoolExecutor pool(1);
+  folly::Baton<> started;
+  folly::Baton<> release;
+  pool.add([&] {
+    started.post();
+    release.wait();
+  });
+  started.wait();
+
+  // Queued, then some past the queue, when the thread is told to exit
+  const int n = 2000;
+  std::atomic<int> completed(0);
+  for (int i = 0; i < n; i++) {
+    pool.add([&] { completed++; });
+  }
+  std::thread stopper([&] { pool.stop(); });
+  std::this_thread::sleep_for(milliseconds(10));
+  EXPECT_EQ(0, completed);
+  release.post();
+  stopper.join();
+  EXPECT_EQ(n, completed);
+}
+
+TEST(ThreadPoolExecutorTest, IOQueuedExpiration) {
+  IOThreadPoolExecutor pool(1);
+  std::atomic<int> expired(0);
+  auto s = pool.subscribeToTaskStats(
+      Observer<ThreadPoolExecutor::TaskStats>::create(
+          [&](ThreadPoolExecutor::TaskStats stats) {
+        if (stats.expired) {
+          expired++;
+        }
+      }));
+  folly::Baton<> started;
+  folly::Baton<> release;
+  pool.add([&] {
+    started.post();
+    release.wait();
+  });
+  started.wait();
+
+  std::atomic<int> ran(0);
+  std::atomic<int> expireCbCount(0);
+  auto task = [&] { ran++; };
+  auto expireCb = [&] { expireCbCount++; };
+  // Expiring in the thread's queue, then on the EventBase once it's full
+  pool.add(task, milliseconds(10), expireCb);
+  for (int i = 0; i < 2000; i++) {
+    pool.add(task);
+  }
+  pool.add(task, milliseconds(10), expireCb);
+  pool.add(task, milliseconds(10));
+  // Neither of these expires
+  pool.add(task, seconds(60), expireCb);
+  pool.add(task, milliseconds(0), expireCb);
+  std::this_thread::sleep_for(milliseconds(20));
+  release.post();
+  pool.join();
+  EXPECT_EQ(2002, ran);
+  EXPECT_EQ(2, expireCbCount);
+  EXPECT_EQ(3, expired);
+}
+
+TEST(ThreadPoolExecutorTest, IOAddDuringResize) {
+  std::atomic_int c{0};
+  std::atomic<bool> done{false};
+  int added = 0;
+  IOThreadPoolExecutor pool(4);
+
+  std::thread producer([&] {
+    while (!done) {
+      pool.add([&] { c++; });
+      added++;
+    }
+  });
+  for (int i = 0; i < 20; i++) {
+    pool.setNumThreads(1 + i % 8);
+  }
+  done = true;
+  producer.join();
+  pool.join();
+
+  EXPECT_EQ(added, c);
 }
 
 TEST(ThreadPoolExecutorTest, BlockingQueue) {
@@ -413,6 +916,186 @@ TEST(ThreadPoolExecutorTest, BlockingQueue) {
   EXPECT_EQ(5, c);
 }
 
+TEST(ThreadPoolExecutorTest, WorkStealingQueue) {
+  std::atomic_int c{0};
+  const int kThreads = 4;
+  const int kTasks = 100;
+  const int kSubtasks = 10;
+
+  CPUThreadPoolExecutor cpuExe(
+      kThreads,
+      folly::make_unique<WorkStealingQueue<CPUThreadPoolExecutor::CPUTask>>(
+          kThreads, 3));
+
+  // Subtasks go to the submitting thread's deque and get stolen from there
+  for (int i = 0; i < kTasks; i++) {
+    cpuExe.addWithPriority([&] {
+      for (int j = 0; j < kSubtasks; j++) {
+        cpuExe.addWithPriority([&] { burnMs(0)(); c++; }, Executor::HI_PRI);
+      }
+      c++;
+    }, i % 3 - 1);
+  }
+  cpuExe.join();
+
+  EXPECT_EQ(kTasks * (kSubtasks + 1), c);
+}
+
+TEST(ThreadPoolExecutorTest, WorkStealingQueuePriority) {
+  bool tookLopri = false;
+  auto completed = 0;
+  auto hipri = [&] {
+    EXPECT_FALSE(tookLopri);
+    completed++;
+  };
+  auto lopri = [&] {
+    tookLopri = true;
+    completed++;
+  };
+  CPUThreadPoolExecutor pool(
+      0,
+      folly::make_unique<WorkStealingQueue<CPUThreadPoolExecutor::CPUTask>>(
+          1, 2));
+  for (int i = 0; i < 50; i++) {
+    pool.addWithPriority(lopri, Executor::LO_PRI);
+  }
+  for (int i = 0; i < 50; i++) {
+    pool.addWithPriority(hipri, Executor::HI_PRI);
+  }
+  pool.setNumThreads(1);
+  pool.join();
+  EXPECT_EQ(100, completed);
+}
+
+TEST(ThreadPoolExecutorTest, DeadlineQueueOrder) {
+  std::vector<int> order;
+  CPUThreadPoolExecutor pool(0, folly::make_unique<DeadlineQueue>());
+  pool.add([&] { order.push_back(3); }, seconds(30));
+  pool.add([&] { order.push_back(1); }, seconds(10));
+  // No expiration, so due after the default of one second
+  pool.add([&] { order.push_back(0); });
+  pool.add([&] { order.push_back(2); }, seconds(20));
+  EXPECT_EQ(4, pool.getPoolStats().pendingTaskCount);
+  pool.setNumThreads(1);
+  pool.join();
+  EXPECT_EQ(std::vector<int>({0, 1, 2, 3}), order);
+}
+
+TEST(ThreadPoolExecutorTest, DeadlineQueueExpire) {
+  std::atomic<int> ran{0};
+  std::atomic<int> expired{0};
+  CPUThreadPoolExecutor pool(0, folly::make_unique<DeadlineQueue>());
+  for (int i = 0; i < 10; i++) {
+    pool.add([&] { ran++; }, milliseconds(1), [&] { expired++; });
+    pool.add([&] { ran++; }, seconds(10), [&] { expired++; });
+  }
+  burnMs(10)();
+  pool.setNumThreads(2);
+  pool.join();
+  EXPECT_EQ(10, ran);
+  EXPECT_EQ(10, expired);
+}
+
+TEST(ThreadPoolExecutorTest, TenantFairQueueOrder) {
+  std::vector<std::string> order;
+  auto queue = folly::make_unique<TenantFairQueue>();
+  queue->setWeight(1, 2);
+  auto tenants = queue.get();
+  CPUThreadPoolExecutor pool(0, std::move(queue));
+  auto addTasks = [&](uint64_t tenant, const std::string& name, int n) {
+    TenantFairQueue::TenantScope scope(tenant);
+    for (int i = 1; i <= n; i++) {
+      auto task = name + std::to_string(i);
+      pool.add([&order, task] { order.push_back(task); });
+    }
+  };
+  addTasks(1, "a", 6);
+  addTasks(2, "b", 3);
+  addTasks(3, "c", 1);
+  EXPECT_EQ(3, tenants->getNumTenants());
+  EXPECT_EQ(10, pool.getPoolStats().pendingTaskCount);
+  pool.setNumThreads(1);
+  pool.join();
+  // Two of a's per turn, one of the others'
+  EXPECT_EQ(std::vector<std::string>(
+              {"a1", "a2", "b1", "c1", "a3", "a4", "b2", "a5", "a6", "b3"}),
+            order);
+}
+
+TEST(ThreadPoolExecutorTest, TenantFairQueueCapacity) {
+  TenantFairQueue queue(3, 2);
+  auto task = [] {
+    return CPUThreadPoolExecutor::CPUTask(
+      [] {}, std::chrono::milliseconds(0), nullptr);
+  };
+  {
+    TenantFairQueue::TenantScope scope(1);
+    EXPECT_TRUE(queue.tryAdd(task()));
+    EXPECT_TRUE(queue.tryAdd(task()));
+    // Only its own limit is reached
+    EXPECT_FALSE(queue.tryAdd(task()));
+    EXPECT_THROW(queue.add(task()), std::runtime_error);
+  }
+  EXPECT_TRUE(queue.tryAdd(task()));
+  EXPECT_FALSE(queue.tryAdd(task()));
+  EXPECT_EQ(3, queue.size());
+  queue.take();
+  EXPECT_EQ(2, queue.size());
+}
+
+namespace {
+
+// Driven by the test itself
+class LoopIOExecutor : public IOExecutor {
+ public:
+  void add(folly::Func f) override {
+    evb.runInEventBaseThread(std::move(f));
+  }
+
+  EventBase* getEventBase() override {
+    return &evb;
+  }
+
+  EventBase evb;
+};
+
+} // namespace
+
+TEST(ThreadPoolExecutorTest, FiberIOExecutorStats) {
+  auto io = std::make_shared<LoopIOExecutor>();
+  FiberIOExecutor::Options options;
+  options.stackSize = 64 * 1024;
+  options.recordStackEvery = 1;
+  FiberIOExecutor fiber(io, options);
+
+  folly::fibers::Baton batons[2];
+  for (auto& baton : batons) {
+    fiber.add([&] { baton.wait(); });
+  }
+  io->evb.loop();
+  auto stats = fiber.getFiberStats();
+  EXPECT_EQ(2, stats.activeFibers);
+  EXPECT_EQ(0, stats.poolHits);
+  EXPECT_EQ(2, stats.poolMisses);
+
+  for (auto& baton : batons) {
+    baton.post();
+  }
+  io->evb.loop();
+  EXPECT_EQ(0, fiber.getFiberStats().activeFibers);
+
+  // Back in the pool
+  bool ran = false;
+  fiber.add([&] { ran = true; });
+  io->evb.loop();
+  EXPECT_TRUE(ran);
+  stats = fiber.getFiberStats();
+  EXPECT_EQ(1, stats.poolHits);
+  EXPECT_EQ(2, stats.peakActiveFibers);
+  EXPECT_LT(0, stats.stackHighWatermark);
+  EXPECT_GT(options.stackSize, stats.stackHighWatermark);
+}
+
 TEST(PriorityThreadFactoryTest, ThreadPriority) {
   PriorityThreadFactory factory(
     std::make_shared<NamedThreadFactory>("stuff"), 1);
@@ -422,3 +1105,26 @@ TEST(PriorityThreadFactoryTest, ThreadPriority) {
     }).join();
   EXPECT_EQ(1, actualPriority);
 }
+
+TEST(AffinityThreadFactoryTest, ParseCpuList) {
+  EXPECT_EQ((std::vector<size_t>{0}), AffinityThreadFactory::parseCpuList("0"));
+  EXPECT_EQ((std::vector<size_t>{0, 1, 2, 5, 7, 8}),
+            AffinityThreadFactory::parseCpuList("0-2,5,7-8\n"));
+  EXPECT_FALSE(AffinityThreadFactory::getNumaNodes().empty());
+}
+
+TEST(AffinityThreadFactoryTest, ThreadAffinity) {
+  AffinityThreadFactory factory(
+    std::make_shared<NamedThreadFactory>("stuff"), {{0}});
+  int cpus = 0;
+  bool onCpu0 = false;
+  factory.newThread([&]() {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+      cpus = CPU_COUNT(&set);
+      onCpu0 = CPU_ISSET(0, &set);
+    }).join();
+  EXPECT_EQ(1, cpus);
+  EXPECT_TRUE(onCpu0);
+}
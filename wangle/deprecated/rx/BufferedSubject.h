@@ -0,0 +1,155 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/deprecated/rx/types.h> // must come first
+#include <wangle/deprecated/rx/Subject.h>
+#include <wangle/deprecated/rx/Subscription.h>
+
+#include <folly/Optional.h>
+#include <deque>
+#include <mutex>
+
+namespace wangle {
+
+/// A Subject which holds on to up to capacity values until every observer
+/// subscribed to it with demand asks for them, sending them on in order on
+/// the thread that gave it them or the one that asked. Completion and errors
+/// follow the values buffered before them.
+///
+/// Subscribed to an Observable with subscribeTo(), it asks that one for as
+/// many values as there's room for, so that a producer checking getDemand()
+/// slows down to the pace of the slowest observer instead of queueing
+/// without bound. Values sent to it while it's full are dropped.
+template <class T>
+class BufferedSubject : public Subject<T> {
+ public:
+  explicit BufferedSubject(size_t capacity) : capacity_(capacity) {}
+
+  /// Subscribes to upstream with demand for a buffer's worth of values,
+  /// asking for more as they're sent on. Call before any value is sent.
+  void subscribeTo(Observable<T>& upstream) {
+    upstream_ = upstream.subscribeWithDemand(
+      Observer<T>::create(
+        [this](const T& val) { onNext(val); },
+        [this](Error e) { onError(e); },
+        [this]() { onCompleted(); }),
+      capacity_);
+  }
+
+  void onNext(const T& val) override {
+    {
+      std::lock_guard<std::mutex> g(mutex_);
+      if (done_ || buffer_.size() >= capacity_) {
+        dropped_++;
+        return;
+      }
+      buffer_.push_back(val);
+    }
+    drain();
+  }
+
+  void onError(Error e) override {
+    {
+      std::lock_guard<std::mutex> g(mutex_);
+      if (done_) {
+        return;
+      }
+      done_ = true;
+      error_ = std::move(e);
+    }
+    drain();
+  }
+
+  void onCompleted() override {
+    {
+      std::lock_guard<std::mutex> g(mutex_);
+      if (done_) {
+        return;
+      }
+      done_ = true;
+    }
+    drain();
+  }
+
+  size_t size() {
+    std::lock_guard<std::mutex> g(mutex_);
+    return buffer_.size();
+  }
+
+  uint64_t getNumDropped() {
+    std::lock_guard<std::mutex> g(mutex_);
+    return dropped_;
+  }
+
+ protected:
+  void onRequest() override {
+    drain();
+  }
+
+ private:
+  // Sends on what the observers have demand for, on one thread at a time:
+  // the others, and the observers asking for more from within their
+  // callbacks, leave it to the thread draining already
+  void drain() {
+    {
+      std::lock_guard<std::mutex> g(mutex_);
+      if (draining_) {
+        missed_ = true;
+        return;
+      }
+      draining_ = true;
+    }
+    for (;;) {
+      std::unique_lock<std::mutex> g(mutex_);
+      if (!buffer_.empty() && this->getDemand() > 0) {
+        T val = std::move(buffer_.front());
+        buffer_.pop_front();
+        g.unlock();
+        Subject<T>::onNext(val);
+        upstream_.request(1);
+        continue;
+      }
+      if (buffer_.empty() && done_ && !terminated_) {
+        terminated_ = true;
+        auto error = std::move(error_);
+        g.unlock();
+        if (error) {
+          Subject<T>::onError(std::move(error.value()));
+        } else {
+          Subject<T>::onCompleted();
+        }
+        continue;
+      }
+      if (!missed_) {
+        draining_ = false;
+        return;
+      }
+      missed_ = false;
+    }
+  }
+
+  const size_t capacity_;
+  Subscription<T> upstream_;
+
+  std::mutex mutex_;
+  std::deque<T> buffer_;
+  uint64_t dropped_{0};
+  // Whether onError() or onCompleted() came, and was sent on
+  bool done_{false};
+  bool terminated_{false};
+  folly::Optional<Error> error_;
+  bool draining_{false};
+  // Whether drain() was called while running, so there may be more to do
+  bool missed_{false};
+};
+
+} // namespace wangle
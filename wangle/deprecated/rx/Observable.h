@@ -20,15 +20,26 @@
 #include <folly/small_vector.h>
 #include <folly/Executor.h>
 #include <folly/Memory.h>
-#include <map>
+#include <algorithm>
+#include <atomic>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace wangle {
 
 template <class T, size_t InlineObservers>
 class Observable {
  public:
-  Observable() : nextSubscriptionId_{1} {}
+  static constexpr uint64_t kUnboundedDemand =
+    std::numeric_limits<uint64_t>::max();
+
+  Observable()
+    : nextSubscriptionId_{1},
+      observers_(std::make_shared<Observers>()),
+      version_{0} {}
 
   // TODO perhaps we want to provide this #5283229
   Observable(Observable&& other) = delete;
@@ -55,6 +66,15 @@ class Observable {
   // allocations must be kept to a minimum. Template parameter InlineObservers
   // specifies how many observers can been subscribed inline without any
   // allocations (it's just the size of a folly::small_vector).
+  //
+  // Observers are kept in an immutable snapshot which these methods copy and
+  // replace, so that notifying takes no lock: a notification running on
+  // another thread at the same time may still use the previous snapshot.
+  // Destroying a Subscription still waits for the notifications calling
+  // its observer on other threads to return, after which the observer is
+  // no longer called and is released. Within a callback of this
+  // Observable, it doesn't wait, and the observer is released by the last
+  // notification using it.
   virtual Subscription<T> subscribe(ObserverPtr<T> observer) {
     return subscribeImpl(observer, false);
   }
@@ -63,16 +83,33 @@ class Observable {
     subscribeImpl(observer, true);
   }
 
-  virtual void observe(Observer<T>* observer) {
-    if (inCallback_ && *inCallback_) {
-      if (!newObservers_) {
-        newObservers_.reset(new ObserverList());
+  // Subscribes observer with backpressure: it's sent at most demand values,
+  // plus those it asks for with Subscription::request(), and the values it
+  // isn't asking for at the moment aren't sent to it at all. Producers
+  // which shouldn't lose values check getDemand() before each onNext(), and
+  // can override onRequest() to hear of more demand; a BufferedSubject in
+  // between smooths out the bursts of those which can't wait.
+  Subscription<T> subscribeWithDemand(ObserverPtr<T> observer,
+                                      uint64_t demand) {
+    return subscribeImpl(observer, false, std::make_shared<Demand>(demand));
+  }
+
+  // How many values can be sent to every observer subscribed with demand,
+  // or kUnboundedDemand without any
+  uint64_t getDemand() {
+    auto demand = kUnboundedDemand;
+    for (auto& subscriber : getSnapshot()->observers->subscribers) {
+      if (subscriber.state->demand) {
+        demand = std::min(demand, subscriber.state->demand->get());
       }
-      newObservers_->push_back(observer);
-    } else {
-      folly::RWSpinLock::WriteHolder{&observersLock_};
-      observers_.push_back(observer);
     }
+    return demand;
+  }
+
+  virtual void observe(Observer<T>* observer) {
+    updateObservers([&](Observers& observers) {
+      observers.observers.push_back(observer);
+    });
   }
 
   // TODO unobserve(ObserverPtr<T>), unobserve(Observer<T>*)
@@ -137,67 +174,188 @@ class Observable {
  protected:
   // Safely execute an operation on each observer. F must take a single
   // Observer<T>* as its argument.
+  // With consumeDemand, as for values, f is called only for the subscribers
+  // with demand left, which it takes one of.
+  //
+  // Observers subscribed or unsubscribed by f, or on other threads, while
+  // this runs don't change which observers it calls.
   template <class F>
-  void forEachObserver(F f) {
-    if (UNLIKELY(!inCallback_)) {
-      inCallback_.reset(new bool{false});
-    }
-    CHECK(!(*inCallback_));
-    *inCallback_ = true;
+  void forEachObserver(F f, bool consumeDemand = false) {
+    auto snapshot = getSnapshot();
+    CHECK(!snapshot->inCallback);
 
-    {
-      folly::RWSpinLock::ReadHolder rh(observersLock_);
-      for (auto o : observers_) {
-        f(o);
+    snapshot->inCallback = true;
+    for (auto o : snapshot->observers->observers) {
+      f(o);
+    }
+    for (auto& subscriber : snapshot->observers->subscribers) {
+      auto& state = *subscriber.state;
+      if (consumeDemand && state.demand && !state.demand->take()) {
+        continue;
       }
-
-      for (auto& kv : subscribers_) {
-        f(kv.second.get());
+      // Counted before checking, so that unsubscribe() either sees this
+      // notification or this sees it
+      state.users++;
+      if (state.subscribed) {
+        f(state.observer.get());
+      }
+      if (--state.users == 0 && !state.subscribed) {
+        state.release();
       }
     }
+    snapshot->inCallback = false;
+  }
 
-    if (UNLIKELY((newObservers_ && !newObservers_->empty()) ||
-                 (newSubscribers_ && !newSubscribers_->empty()) ||
-                 (oldSubscribers_ && !oldSubscribers_->empty()))) {
-      {
-        folly::RWSpinLock::WriteHolder wh(observersLock_);
-        if (newObservers_) {
-          for (auto observer : *(newObservers_)) {
-            observers_.push_back(observer);
-          }
-          newObservers_->clear();
-        }
-        if (newSubscribers_) {
-          for (auto& kv : *(newSubscribers_)) {
-            subscribers_.insert(std::move(kv));
-          }
-          newSubscribers_->clear();
+  // Called after an observer subscribed with demand asked for more, on the
+  // thread it did, which may be within a callback of this Observable
+  virtual void onRequest() {}
+
+ private:
+  // What an observer subscribed with demand may still be sent
+  class Demand {
+   public:
+    explicit Demand(uint64_t n) : n_(n) {}
+
+    uint64_t get() const {
+      return n_.load(std::memory_order_acquire);
+    }
+
+    void add(uint64_t n) {
+      auto current = n_.load(std::memory_order_relaxed);
+      uint64_t next;
+      do {
+        next = current > kUnboundedDemand - n ? kUnboundedDemand : current + n;
+      } while (!n_.compare_exchange_weak(current, next));
+    }
+
+    // Takes one value out of the demand, false if there's none left
+    bool take() {
+      auto current = n_.load(std::memory_order_relaxed);
+      do {
+        if (current == 0) {
+          return false;
         }
-        if (oldSubscribers_) {
-          for (auto id : *(oldSubscribers_)) {
-            subscribers_.erase(id);
-          }
-          oldSubscribers_->clear();
+        if (current == kUnboundedDemand) {
+          return true;
         }
+      } while (!n_.compare_exchange_weak(current, current - 1));
+      return true;
+    }
+
+   private:
+    std::atomic<uint64_t> n_;
+  };
+
+  // Shared by the snapshots, which only hold on to the observer until
+  // it's unsubscribed and no notification uses it any more
+  struct SubscriberState {
+    SubscriberState(ObserverPtr<T> o, std::shared_ptr<Demand> d)
+      : observer(std::move(o)), demand(std::move(d)) {}
+
+    void release() {
+      if (!released.exchange(true)) {
+        observer.reset();
       }
     }
-    *inCallback_ = false;
-  }
 
- private:
-  Subscription<T> subscribeImpl(ObserverPtr<T> observer, bool indefinite) {
+    ObserverPtr<T> observer;
+    // Null for unbounded demand
+    std::shared_ptr<Demand> demand;
+    std::atomic<bool> subscribed{true};
+    // Notifications calling the observer or about to
+    std::atomic<uint32_t> users{0};
+    std::atomic<bool> released{false};
+  };
+
+  struct Subscriber {
+    Subscriber(uint64_t i, ObserverPtr<T> o, std::shared_ptr<Demand> d)
+      : id(i),
+        state(std::make_shared<SubscriberState>(std::move(o),
+                                                std::move(d))) {}
+
+    uint64_t id;
+    std::shared_ptr<SubscriberState> state;
+  };
+
+  typedef folly::small_vector<Observer<T>*, InlineObservers> ObserverList;
+  // Sorted by subscription id, i.e. in the order they subscribed
+  typedef std::vector<Subscriber> SubscriberList;
+
+  struct Observers {
+    ObserverList observers;
+    SubscriberList subscribers;
+  };
+
+  // What forEachObserver() last used on a thread
+  struct Snapshot {
+    std::shared_ptr<const Observers> observers;
+    uint64_t version{~uint64_t(0)};
+    bool inCallback{false};
+  };
+
+  Subscription<T> subscribeImpl(ObserverPtr<T> observer,
+                                bool indefinite,
+                                std::shared_ptr<Demand> demand = nullptr) {
     auto subscription = makeSubscription(indefinite);
-    typename SubscriberMap::value_type kv{subscription.id_, std::move(observer)};
-    if (inCallback_ && *inCallback_) {
-      if (!newSubscribers_) {
-        newSubscribers_.reset(new SubscriberMap());
+    auto id = subscription.id_;
+    subscription.demand_ = demand;
+    updateObservers([&](Observers& observers) {
+      observers.subscribers.emplace(findSubscriber(observers.subscribers, id),
+                                    id,
+                                    std::move(observer),
+                                    std::move(demand));
+    });
+    return subscription;
+  }
+
+  // This thread's copy of observers_, which is still current unless
+  // version_ moved, as only subscribing or unsubscribing does. Not
+  // refreshed within a callback, as the copy is being iterated.
+  Snapshot* getSnapshot() {
+    auto snapshot = snapshot_.get();
+    if (UNLIKELY(!snapshot)) {
+      snapshot = new Snapshot();
+      snapshot_.reset(snapshot);
+    }
+    if (UNLIKELY(version_.load(std::memory_order_acquire) !=
+                 snapshot->version) && !snapshot->inCallback) {
+      std::shared_ptr<const Observers> observers;
+      {
+        std::lock_guard<std::mutex> g(observersLock_);
+        observers = observers_;
+        snapshot->version = version_.load(std::memory_order_relaxed);
       }
-      newSubscribers_->insert(std::move(kv));
-    } else {
-      folly::RWSpinLock::WriteHolder{&observersLock_};
-      subscribers_.insert(std::move(kv));
+      // The previous copy may hold the last reference to an observer
+      snapshot->observers.swap(observers);
     }
-    return subscription;
+    return snapshot;
+  }
+
+  // The subscriber with id, or where it would go
+  static typename SubscriberList::iterator findSubscriber(
+      SubscriberList& subscribers, uint64_t id) {
+    return std::lower_bound(
+      subscribers.begin(), subscribers.end(), id,
+      [](const Subscriber& subscriber, uint64_t i) {
+        return subscriber.id < i;
+      });
+  }
+
+  // Replaces observers_ with a copy f modified, for the threads notifying to
+  // pick up on their next notification
+  template <class F>
+  void updateObservers(F f) {
+    std::shared_ptr<const Observers> old;
+    {
+      std::lock_guard<std::mutex> g(observersLock_);
+      auto observers = std::make_shared<Observers>(*observers_);
+      f(*observers);
+      old = std::move(observers_);
+      observers_ = std::move(observers);
+      version_.fetch_add(1, std::memory_order_release);
+    }
+    // Destroyed unlocked, as observers being destroyed may unsubscribe
+    old.reset();
   }
 
   class Unsubscriber {
@@ -214,6 +372,13 @@ class Observable {
       }
     }
 
+    void requested() {
+      folly::RWSpinLock::ReadHolder guard(lock_);
+      if (observable_) {
+        observable_->onRequest();
+      }
+    }
+
     void disable() {
       folly::RWSpinLock::WriteHolder guard(lock_);
       observable_ = nullptr;
@@ -230,22 +395,30 @@ class Observable {
   friend class Subscription<T>;
 
   void unsubscribe(uint64_t id) {
-    if (inCallback_ && *inCallback_) {
-      if (!oldSubscribers_) {
-        oldSubscribers_.reset(new std::vector<uint64_t>());
+    std::shared_ptr<SubscriberState> state;
+    updateObservers([&](Observers& observers) {
+      auto it = findSubscriber(observers.subscribers, id);
+      if (it != observers.subscribers.end() && it->id == id) {
+        state = it->state;
+        observers.subscribers.erase(it);
       }
-      if (newSubscribers_) {
-        auto it = newSubscribers_->find(id);
-        if (it != newSubscribers_->end()) {
-          newSubscribers_->erase(it);
-          return;
-        }
+    });
+    if (!state) {
+      return;
+    }
+    state->subscribed = false;
+    auto snapshot = snapshot_.get();
+    if (snapshot && snapshot->inCallback) {
+      // Maybe from the observer's own callback, which can't be waited for
+      if (state->users == 0) {
+        state->release();
       }
-      oldSubscribers_->push_back(id);
-    } else {
-      folly::RWSpinLock::WriteHolder{&observersLock_};
-      subscribers_.erase(id);
+      return;
+    }
+    while (state->users > 0) {
+      std::this_thread::yield();
     }
+    state->release();
   }
 
   Subscription<T> makeSubscription(bool indefinite) {
@@ -263,17 +436,16 @@ class Observable {
   }
 
   std::atomic<uint64_t> nextSubscriptionId_;
-  folly::RWSpinLock observersLock_;
-  folly::ThreadLocalPtr<bool> inCallback_;
 
-  typedef folly::small_vector<Observer<T>*, InlineObservers> ObserverList;
-  ObserverList observers_;
-  folly::ThreadLocalPtr<ObserverList> newObservers_;
-
-  typedef std::map<uint64_t, ObserverPtr<T>> SubscriberMap;
-  SubscriberMap subscribers_;
-  folly::ThreadLocalPtr<SubscriberMap> newSubscribers_;
-  folly::ThreadLocalPtr<std::vector<uint64_t>> oldSubscribers_;
+  // Serializes the updates of observers_, never taken by notifications
+  // unless observers_ changed since their thread last notified
+  std::mutex observersLock_;
+  std::shared_ptr<const Observers> observers_;
+  std::atomic<uint64_t> version_;
+  folly::ThreadLocalPtr<Snapshot> snapshot_;
 };
 
+template <class T, size_t InlineObservers>
+constexpr uint64_t Observable<T, InlineObservers>::kUnboundedDemand;
+
 } // namespace wangle
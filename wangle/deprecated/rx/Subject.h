@@ -24,7 +24,7 @@ struct Subject : public Observable<T>, public Observer<T> {
   void onNext(const T& val) override {
     this->forEachObserver([&](Observer<T>* o){
       o->onNext(val);
-    });
+    }, true);
   }
   void onError(Error e) override {
     this->forEachObserver([&](Observer<T>* o){
@@ -29,8 +29,10 @@ class Subscription {
   Subscription& operator=(Subscription&& other) noexcept {
     unsubscribe();
     unsubscriber_ = std::move(other.unsubscriber_);
+    demand_ = std::move(other.demand_);
     id_ = other.id_;
     other.unsubscriber_ = nullptr;
+    other.demand_ = nullptr;
     other.id_ = 0;
     return *this;
   }
@@ -39,8 +41,22 @@ class Subscription {
     unsubscribe();
   }
 
+  /// For a subscription made by Observable::subscribeWithDemand(), lets n
+  /// more values be sent to its observer. Thread safe, and callable from
+  /// the observer's callbacks. A no-op for other subscriptions, which are
+  /// sent everything.
+  void request(uint64_t n) {
+    if (demand_ && n > 0) {
+      demand_->add(n);
+      if (unsubscriber_) {
+        unsubscriber_->requested();
+      }
+    }
+  }
+
  private:
   typedef typename Observable<T>::Unsubscriber Unsubscriber;
+  typedef typename Observable<T>::Demand Demand;
 
   Subscription(std::shared_ptr<Unsubscriber> unsubscriber, uint64_t id)
     : unsubscriber_(std::move(unsubscriber)), id_(id) {
@@ -52,10 +68,12 @@ class Subscription {
       unsubscriber_->unsubscribe(id_);
       id_ = 0;
       unsubscriber_ = nullptr;
+      demand_ = nullptr;
     }
   }
 
   std::shared_ptr<Unsubscriber> unsubscriber_;
+  std::shared_ptr<Demand> demand_;
   uint64_t id_{0};
 
   friend class Observable<T>;
@@ -13,6 +13,8 @@
 #include <wangle/deprecated/rx/Subject.h>
 #include <gflags/gflags.h>
 
+#include <thread>
+
 using namespace wangle;
 using folly::BenchmarkSuspender;
 
@@ -120,6 +122,56 @@ void notifyInlineObservers(uint iters, int N) {
   }
 }
 
+// Every thread notifies the same subject, as ThreadPoolExecutor threads do
+// with their task stats
+void notifyConcurrently(uint iters, int threads) {
+  BenchmarkSuspender bs;
+  Subject<int> subject;
+  std::vector<Subscription<int>> subscriptions;
+  for (int i = 0; i < 3; i++) {
+    subscriptions.push_back(subject.subscribe(makeObserver()));
+  }
+  std::vector<std::thread> workers;
+  bs.dismiss();
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&] {
+      for (uint iter = 0; iter < iters; iter++) {
+        subject.onNext(42);
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  bs.rehire();
+}
+
+// The same, with a subscription coming and going every 1000 notifications
+void notifyConcurrentlyWithChurn(uint iters, int threads) {
+  BenchmarkSuspender bs;
+  Subject<int> subject;
+  std::vector<Subscription<int>> subscriptions;
+  for (int i = 0; i < 3; i++) {
+    subscriptions.push_back(subject.subscribe(makeObserver()));
+  }
+  std::vector<std::thread> workers;
+  bs.dismiss();
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      for (uint iter = 0; iter < iters; iter++) {
+        if (t == 0 && iter % 1000 == 0) {
+          subject.subscribe(makeObserver());
+        }
+        subject.onNext(42);
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  bs.rehire();
+}
+
 BENCHMARK_PARAM(subscribeAndUnsubscribe, 1);
 BENCHMARK_RELATIVE_PARAM(subscribe, 1);
 BENCHMARK_RELATIVE_PARAM(observe, 1);
@@ -142,6 +194,13 @@ BENCHMARK_DRAW_LINE();
 BENCHMARK_PARAM(notifySubscribers, 1000);
 BENCHMARK_RELATIVE_PARAM(notifyInlineObservers, 1000);
 
+BENCHMARK_DRAW_LINE();
+
+BENCHMARK_PARAM(notifyConcurrently, 1);
+BENCHMARK_RELATIVE_PARAM(notifyConcurrently, 4);
+BENCHMARK_RELATIVE_PARAM(notifyConcurrently, 16);
+BENCHMARK_RELATIVE_PARAM(notifyConcurrentlyWithChurn, 16);
+
 int main(int argc, char** argv) {
   gflags::ParseCommandLineFlags(&argc, &argv, true);
   folly::runBenchmarks();
@@ -8,10 +8,15 @@
  *
  */
 
+#include <wangle/deprecated/rx/BufferedSubject.h>
 #include <wangle/deprecated/rx/Observer.h>
 #include <wangle/deprecated/rx/Subject.h>
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <chrono>
+#include <thread>
+
 using namespace wangle;
 
 static std::unique_ptr<Observer<int>> incrementer(int& counter) {
@@ -148,6 +153,156 @@ TEST(RxTest, SubscribeUnsubscribeDuringCallback) {
   EXPECT_EQ(0, innerCount);
 }
 
+TEST(RxTest, NotifyFromManyThreads) {
+  // Notifications racing with subscriptions reach the observers subscribed
+  // throughout, and only those once unsubscribed
+  Subject<int> subject;
+  std::atomic<int> count{0};
+  std::atomic<int> churnCount{0};
+  auto s = subject.subscribe(Observer<int>::create([&] (int x) {
+    count++;
+  }));
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&] {
+      for (int i = 0; i < 1000; i++) {
+        subject.onNext(i);
+      }
+    });
+  }
+  for (int i = 0; i < 100; i++) {
+    auto churn = subject.subscribe(Observer<int>::create([&] (int x) {
+      churnCount++;
+    }));
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(4000, count);
+  auto churned = churnCount.load();
+  subject.onNext(0);
+  EXPECT_EQ(4001, count);
+  EXPECT_EQ(churned, churnCount);
+}
+
+TEST(RxTest, UnsubscribeWaitsForNotifications) {
+  // Once its Subscription is gone, an observer is no longer being called on
+  // any thread, nor held on to by their snapshots
+  Subject<int> subject;
+  std::atomic<bool> inCallback{false};
+  std::atomic<bool> proceed{false};
+  std::atomic<bool> unsubscribed{false};
+  std::atomic<int> callsAfter{0};
+  auto token = std::make_shared<int>(0);
+  std::unique_ptr<Subscription<int>> s(new Subscription<int>(
+    subject.subscribe(Observer<int>::create([&, token] (int x) {
+      inCallback = true;
+      while (!proceed) {
+        std::this_thread::yield();
+      }
+      if (unsubscribed) {
+        callsAfter++;
+      }
+    }))));
+  std::thread notifier([&] { subject.onNext(1); });
+  while (!inCallback) {
+    std::this_thread::yield();
+  }
+  std::thread unsubscriber([&] {
+    s.reset();
+    unsubscribed = true;
+  });
+  // Still waiting on the callback
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_FALSE(unsubscribed);
+  proceed = true;
+  unsubscriber.join();
+  notifier.join();
+  EXPECT_TRUE(unsubscribed);
+  EXPECT_EQ(1, token.use_count());
+  subject.onNext(2);
+  EXPECT_EQ(0, callsAfter);
+}
+
+TEST(RxTest, SubscribeWithDemand) {
+  // Values are sent only as far as they were asked for
+  Subject<int> subject;
+  int count = 0, allCount = 0;
+  EXPECT_EQ(Subject<int>::kUnboundedDemand, subject.getDemand());
+  auto all = subject.subscribe(incrementer(allCount));
+  auto s = subject.subscribeWithDemand(incrementer(count), 2);
+  EXPECT_EQ(2, subject.getDemand());
+  for (int i = 0; i < 3; i++) {
+    subject.onNext(i);
+  }
+  EXPECT_EQ(2, count);
+  EXPECT_EQ(3, allCount);
+  EXPECT_EQ(0, subject.getDemand());
+  s.request(1);
+  EXPECT_EQ(1, subject.getDemand());
+  subject.onNext(3);
+  EXPECT_EQ(3, count);
+}
+
+TEST(RxTest, BufferedSubject) {
+  // The values sent while the observer isn't asking are held on to, up to
+  // the capacity, and the producer sees how many more it can send
+  Subject<int> producer;
+  BufferedSubject<int> buffer(2);
+  buffer.subscribeTo(producer);
+  std::vector<int> values;
+  bool completed = false;
+  auto s = buffer.subscribeWithDemand(Observer<int>::create(
+    [&] (int x) { values.push_back(x); },
+    [] (Error e) {},
+    [&] () { completed = true; }), 1);
+
+  producer.onNext(1);
+  producer.onNext(2);
+  producer.onNext(3);
+  EXPECT_EQ(std::vector<int>({1}), values);
+  EXPECT_EQ(2, buffer.size());
+  EXPECT_EQ(0, producer.getDemand());
+  // Not even sent on, as it wasn't asked for
+  producer.onNext(4);
+  EXPECT_EQ(2, buffer.size());
+  EXPECT_EQ(0, buffer.getNumDropped());
+  // Dropped by a full buffer
+  buffer.onNext(4);
+  EXPECT_EQ(1, buffer.getNumDropped());
+
+  producer.onCompleted();
+  EXPECT_FALSE(completed);
+  s.request(1);
+  EXPECT_EQ(std::vector<int>({1, 2}), values);
+  EXPECT_EQ(1, producer.getDemand());
+  s.request(1);
+  EXPECT_EQ(std::vector<int>({1, 2, 3}), values);
+  EXPECT_TRUE(completed);
+}
+
+TEST(RxTest, BufferedSubjectRequestDuringCallback) {
+  // An observer asking for the next value as it gets one is sent the whole
+  // buffer, without recursing
+  Subject<int> producer;
+  BufferedSubject<int> buffer(10);
+  buffer.subscribeTo(producer);
+  Subscription<int> s;
+  int count = 0;
+  s = buffer.subscribeWithDemand(Observer<int>::create([&] (int x) {
+    count++;
+    s.request(1);
+  }), 0);
+  for (int i = 0; i < 5; i++) {
+    producer.onNext(i);
+  }
+  EXPECT_EQ(0, count);
+  s.request(1);
+  EXPECT_EQ(5, count);
+  producer.onNext(5);
+  EXPECT_EQ(6, count);
+}
+
 // Move only type
 typedef std::unique_ptr<int> MO;
 static MO makeMO() { return folly::make_unique<int>(1); }
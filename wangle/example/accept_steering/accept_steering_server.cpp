@@ -11,36 +11,39 @@
 #include <gflags/gflags.h>
 
 #include <wangle/bootstrap/AcceptRoutingHandler.h>
+#include <wangle/bootstrap/AcceptSteeringHandler.h>
 #include <wangle/bootstrap/RoutingDataHandler.h>
 #include <wangle/bootstrap/ServerBootstrap.h>
 #include <wangle/channel/AsyncSocketHandler.h>
+#include <wangle/codec/BufferScanner.h>
 
 using namespace folly;
 using namespace wangle;
 
 DEFINE_int32(port, 23, "test server port");
+DEFINE_bool(peek, false, "Steer with AcceptSteeringHandler, peeking at the "
+            "first byte in the accepting thread, rather than a routing "
+            "pipeline per connection");
 
 /**
  * A simple server that hashes connections to worker threads
  * based on the first character typed in by the client.
  */
 
-class NaiveRoutingDataHandler : public RoutingDataHandler<char> {
+class NaiveRoutingDataHandler : public PeekingRoutingDataHandler<char> {
  public:
   NaiveRoutingDataHandler(uint64_t connId, Callback* cob)
-      : RoutingDataHandler<char>(connId, cob) {}
+      : PeekingRoutingDataHandler<char>(connId, cob) {}
 
-  bool parseRoutingData(folly::IOBufQueue& bufQueue,
-                        RoutingData& routingData) override {
-    if (bufQueue.chainLength() == 0) {
+  bool peekRoutingData(const folly::IOBufQueue& bufQueue,
+                       char& routingData) override {
+    BufferScanner scanner(bufQueue);
+    if (scanner.getLength() == 0) {
       return false;
     }
 
-    auto buf = bufQueue.move();
-    buf->coalesce();
     // Use the first byte for hashing to a worker
-    routingData.routingData = buf->data()[0];
-    routingData.bufQueue.append(std::move(buf));
+    routingData = scanner.byteAt(0);
     return true;
   }
 };
@@ -94,6 +97,32 @@ class ServerPipelineFactory
   }
 };
 
+// The same, for AcceptSteeringHandler, which passes on the peeked byte
+class PeekedThreadPrintingHandler : public BytesToBytesHandler {
+ public:
+  void read(Context* ctx, IOBufQueue& q) override {
+    auto buf = q.move();
+    buf->coalesce();
+    std::stringstream out;
+    out << "You were hashed to thread " << std::this_thread::get_id()
+        << " based on '" << char(buf->data()[0]) << "'" << std::endl;
+    write(ctx, IOBuf::copyBuffer(out.str()));
+    close(ctx);
+  }
+};
+
+class PeekedPipelineFactory : public PipelineFactory<DefaultPipeline> {
+ public:
+  DefaultPipeline::Ptr newPipeline(
+      std::shared_ptr<AsyncTransportWrapper> sock) override {
+    auto pipeline = DefaultPipeline::create();
+    pipeline->addBack(AsyncSocketHandler(sock));
+    pipeline->addBack(PeekedThreadPrintingHandler());
+    pipeline->finalize();
+    return pipeline;
+  }
+};
+
 int main(int argc, char** argv) {
   google::ParseCommandLineFlags(&argc, &argv, true);
 
@@ -102,9 +131,22 @@ int main(int argc, char** argv) {
   auto childPipelineFactory = std::make_shared<ServerPipelineFactory>();
 
   ServerBootstrap<DefaultPipeline> server;
-  server.pipeline(
-      std::make_shared<AcceptRoutingPipelineFactory<DefaultPipeline, char>>(
-          &server, routingHandlerFactory, childPipelineFactory));
+  if (FLAGS_peek) {
+    auto parser = [](const IOBufQueue& data, uint64_t& hash) {
+      if (data.chainLength() == 0) {
+        return false;
+      }
+      hash = std::hash<char>()(data.front()->data()[0]);
+      return true;
+    };
+    server.pipeline(
+        std::make_shared<AcceptSteeringPipelineFactory<DefaultPipeline>>(
+            &server, parser, std::make_shared<PeekedPipelineFactory>()));
+  } else {
+    server.pipeline(
+        std::make_shared<AcceptRoutingPipelineFactory<DefaultPipeline, char>>(
+            &server, routingHandlerFactory, childPipelineFactory));
+  }
   server.bind(FLAGS_port);
   server.waitForStop();
 
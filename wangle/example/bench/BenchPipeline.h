@@ -0,0 +1,66 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <wangle/channel/AsyncSocketHandler.h>
+#include <wangle/channel/Handler.h>
+#include <wangle/channel/TrafficCapture.h>
+#include <wangle/codec/LengthFieldBasedFrameDecoder.h>
+#include <wangle/codec/LengthFieldPrepender.h>
+
+namespace wangle {
+
+// Answers each request with response, or with the request if it's null
+class BenchHandler : public HandlerAdapter<std::unique_ptr<folly::IOBuf>> {
+ public:
+  explicit BenchHandler(std::shared_ptr<folly::IOBuf> response)
+    : response_(std::move(response)) {}
+
+  void read(Context* ctx, std::unique_ptr<folly::IOBuf> req) override {
+    writeNoFuture(ctx, response_ ? response_->clone() : std::move(req));
+  }
+
+ private:
+  std::shared_ptr<folly::IOBuf> response_;
+};
+
+// The pipeline of BenchServer, and of CaptureReplay, which gives it no
+// transport
+class BenchPipelineFactory : public PipelineFactory<DefaultPipeline> {
+ public:
+  explicit BenchPipelineFactory(
+      std::shared_ptr<folly::IOBuf> response,
+      std::shared_ptr<TrafficCapture> capture = nullptr)
+    : response_(std::move(response)),
+      capture_(std::move(capture)) {}
+
+  DefaultPipeline::Ptr newPipeline(
+      std::shared_ptr<folly::AsyncTransportWrapper> sock) override {
+    auto pipeline = DefaultPipeline::create();
+    if (sock) {
+      pipeline->addBack(AsyncSocketHandler(sock));
+    }
+    if (capture_) {
+      pipeline->addBack(TrafficCaptureHandler(capture_));
+    }
+    pipeline->addBack(LengthFieldBasedFrameDecoder());
+    pipeline->addBack(LengthFieldPrepender());
+    pipeline->addBack(BenchHandler(response_));
+    pipeline->finalize();
+    return pipeline;
+  }
+
+ private:
+  std::shared_ptr<folly::IOBuf> response_;
+  std::shared_ptr<TrafficCapture> capture_;
+};
+
+} // namespace wangle
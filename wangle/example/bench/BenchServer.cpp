@@ -0,0 +1,68 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// The server LoadGenerator runs against: answers each length-prefixed
+// frame with one, echoing it or of --response_size bytes, over plain TCP or
+// TLS with --cert_path and --key_path. With --capture_path, it captures a
+// sample of its connections for CaptureReplay.
+
+#include <gflags/gflags.h>
+
+#include <wangle/bootstrap/ServerBootstrap.h>
+#include <wangle/example/bench/BenchPipeline.h>
+
+DEFINE_int32(port, 8080, "Port to listen on");
+DEFINE_int32(threads, 0, "IO threads, 0 for one per core");
+DEFINE_int32(response_size, 0, "Bytes answered per request, 0 to echo it");
+DEFINE_string(cert_path, "", "Certificate to serve TLS with, PEM");
+DEFINE_string(key_path, "", "Private key of --cert_path, PEM");
+DEFINE_string(capture_path, "", "File to capture connections into, "
+              "for CaptureReplay");
+DEFINE_int32(capture_sample_rate, 100, "Capture one connection in this many");
+DEFINE_int64(capture_max_bytes, 1 << 30, "Stop capturing at this size");
+
+using namespace folly;
+using namespace wangle;
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  std::shared_ptr<IOBuf> response;
+  if (FLAGS_response_size > 0) {
+    response = IOBuf::copyBuffer(std::string(FLAGS_response_size, 'x'));
+  }
+
+  std::shared_ptr<TrafficCapture> capture;
+  if (!FLAGS_capture_path.empty()) {
+    capture = std::make_shared<TrafficCapture>(
+        FLAGS_capture_path,
+        FLAGS_capture_sample_rate,
+        FLAGS_capture_max_bytes);
+  }
+
+  ServerSocketConfig config;
+  if (!FLAGS_cert_path.empty()) {
+    SSLContextConfig sslConfig;
+    sslConfig.setCertificate(FLAGS_cert_path, FLAGS_key_path, "");
+    sslConfig.isDefault = true;
+    config.sslContextConfigs.push_back(sslConfig);
+  }
+
+  ServerBootstrap<DefaultPipeline> server;
+  server.acceptorConfig(config);
+  server.childPipeline(
+      std::make_shared<BenchPipelineFactory>(response, capture));
+  server.group(std::make_shared<IOThreadPoolExecutor>(
+      FLAGS_threads > 0 ? FLAGS_threads : sysconf(_SC_NPROCESSORS_ONLN)));
+  server.bind(FLAGS_port);
+  server.waitForStop();
+
+  return 0;
+}
@@ -0,0 +1,62 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Replays the connections BenchServer captured with --capture_path through
+// its pipeline, without sockets, and reports the time spent in each
+// handler. Other servers can do the same with their own PipelineFactory by
+// way of TrafficReplay.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <wangle/channel/TrafficReplay.h>
+#include <wangle/example/bench/BenchPipeline.h>
+
+#include <cstdio>
+
+DEFINE_string(capture_path, "", "Capture to replay");
+DEFINE_int32(iterations, 10, "Times to replay the capture");
+DEFINE_int32(response_size, 0, "As given to BenchServer");
+
+using namespace folly;
+using namespace wangle;
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  CHECK(!FLAGS_capture_path.empty()) << "--capture_path is required";
+
+  std::shared_ptr<IOBuf> response;
+  if (FLAGS_response_size > 0) {
+    response = IOBuf::copyBuffer(std::string(FLAGS_response_size, 'x'));
+  }
+  BenchPipelineFactory factory(response);
+  TrafficReplay replay(TrafficCapture::read(FLAGS_capture_path));
+
+  for (int i = 0; i < FLAGS_iterations; i++) {
+    const auto stats = replay.run(factory);
+    printf("run %d: %lu sessions, %lu chunks, %lu bytes in, %lu out, %.3f ms\n",
+           i,
+           stats.sessions,
+           stats.chunks,
+           stats.bytesRead,
+           stats.bytesWritten,
+           stats.elapsed.count() / 1e6);
+    for (const auto& handler : stats.handlers) {
+      printf("  %-40s %10lu in %10lu out %10.3f ms\n",
+             handler.handler.c_str(),
+             handler.inboundCalls,
+             handler.outboundCalls,
+             handler.sampledTime.count() / 1e6);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,250 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Loads BenchServer, or any server answering each length-prefixed frame
+// with one, over --connections, and reports the requests answered per
+// second and their latency percentiles.
+//
+// With --rate the load is open-loop: requests fall due on a fixed schedule
+// whether or not the earlier ones were answered, waiting for one of the
+// --depth slots of their connection if need be, and their latency counts
+// from when they fell due, so that a server stalling can't hide the wait it
+// imposed. Without, each connection keeps --depth requests in flight.
+
+#include <gflags/gflags.h>
+
+#include <wangle/bootstrap/ClientBootstrap.h>
+#include <wangle/channel/AsyncSocketHandler.h>
+#include <wangle/codec/LengthFieldBasedFrameDecoder.h>
+#include <wangle/codec/LengthFieldPrepender.h>
+#include <wangle/concurrent/IOThreadPoolExecutor.h>
+#include <wangle/concurrent/LatencyHistogram.h>
+
+#include <folly/io/async/AsyncTimeout.h>
+#include <folly/io/async/SSLContext.h>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <thread>
+#include <vector>
+
+DEFINE_string(host, "127.0.0.1", "Server host");
+DEFINE_int32(port, 8080, "Server port");
+DEFINE_int32(connections, 16, "Connections to open");
+DEFINE_int32(threads, 4, "IO threads the connections are spread over");
+DEFINE_int32(depth, 1, "Requests in flight per connection at most");
+DEFINE_int32(size, 64, "Request payload bytes");
+DEFINE_double(rate, 0,
+              "Requests per second, over all connections, on a fixed "
+              "schedule; 0 for as many as the server answers");
+DEFINE_int32(warmup, 2, "Seconds of load before measuring");
+DEFINE_int32(duration, 10, "Seconds of load measured");
+DEFINE_bool(tls, false, "Connect with TLS");
+
+using namespace folly;
+using namespace wangle;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Whether the answers arriving are counted
+std::atomic<bool> measuring{false};
+
+// Sends the requests of one connection, on its EventBase
+class LoadHandler : public HandlerAdapter<std::unique_ptr<IOBuf>>,
+                    private AsyncTimeout {
+ public:
+  explicit LoadHandler(EventBase* evb)
+    : AsyncTimeout(evb),
+      payload_(IOBuf::copyBuffer(std::string(FLAGS_size, 'x'))) {}
+
+  // rate is this connection's, 0 for closed-loop
+  void start(double rate) {
+    auto now = Clock::now();
+    if (rate > 0) {
+      interval_ = std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(1 / rate));
+      nextDue_ = now;
+      timeoutExpired();
+      return;
+    }
+    for (int i = 0; i < FLAGS_depth; i++) {
+      backlog_.push_back(now);
+    }
+    sendBacklog();
+  }
+
+  void stop() {
+    stopped_ = true;
+    cancelTimeout();
+  }
+
+  void read(Context* /* ctx */, std::unique_ptr<IOBuf> /* resp */) override {
+    auto now = Clock::now();
+    if (inFlight_.empty()) {
+      errors_++;
+      return;
+    }
+    if (measuring.load(std::memory_order_relaxed)) {
+      latency_.add(now - inFlight_.front());
+    }
+    inFlight_.pop_front();
+    if (stopped_) {
+      return;
+    }
+    if (interval_ == Clock::duration::zero()) {
+      backlog_.push_back(now);
+    }
+    sendBacklog();
+  }
+
+  void readEOF(Context* /* ctx */) override {
+    LOG(ERROR) << "Connection closed by the server";
+    errors_++;
+    stop();
+  }
+
+  void readException(Context* /* ctx */, exception_wrapper e) override {
+    LOG(ERROR) << "Connection error: " << exceptionStr(e);
+    errors_++;
+    stop();
+  }
+
+  const LatencyHistogram& getLatency() const {
+    return latency_;
+  }
+
+  uint64_t getErrors() const {
+    return errors_;
+  }
+
+  size_t getBacklog() const {
+    return backlog_.size();
+  }
+
+ private:
+  // Every millisecond, queues the requests which fell due since
+  void timeoutExpired() noexcept override {
+    auto now = Clock::now();
+    while (nextDue_ <= now) {
+      backlog_.push_back(nextDue_);
+      nextDue_ += interval_;
+    }
+    sendBacklog();
+    if (!stopped_) {
+      scheduleTimeout(1);
+    }
+  }
+
+  void sendBacklog() {
+    while (!backlog_.empty() && inFlight_.size() < size_t(FLAGS_depth)) {
+      inFlight_.push_back(backlog_.front());
+      backlog_.pop_front();
+      writeNoFuture(getContext(), payload_->clone());
+    }
+  }
+
+  std::unique_ptr<IOBuf> payload_;
+  Clock::duration interval_{Clock::duration::zero()};
+  Clock::time_point nextDue_;
+  // When the requests sent and those waiting to be fell due
+  std::deque<Clock::time_point> inFlight_;
+  std::deque<Clock::time_point> backlog_;
+  bool stopped_{false};
+  LatencyHistogram latency_;
+  uint64_t errors_{0};
+};
+
+class LoadPipelineFactory : public PipelineFactory<DefaultPipeline> {
+ public:
+  DefaultPipeline::Ptr newPipeline(
+      std::shared_ptr<AsyncTransportWrapper> sock) override {
+    auto evb = sock->getEventBase();
+    auto pipeline = DefaultPipeline::create();
+    pipeline->addBack(AsyncSocketHandler(sock));
+    pipeline->addBack(LengthFieldBasedFrameDecoder());
+    pipeline->addBack(LengthFieldPrepender());
+    pipeline->addBack(std::make_shared<LoadHandler>(evb));
+    pipeline->finalize();
+    return pipeline;
+  }
+};
+
+long us(const LatencyHistogram& latency, double pct) {
+  return long(std::chrono::duration_cast<std::chrono::microseconds>(
+      latency.getPercentile(pct)).count());
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  auto threads = std::make_shared<IOThreadPoolExecutor>(FLAGS_threads);
+  auto factory = std::make_shared<LoadPipelineFactory>();
+  SocketAddress address(FLAGS_host, FLAGS_port, true);
+  std::vector<std::unique_ptr<ClientBootstrap<DefaultPipeline>>> clients;
+  std::vector<DefaultPipeline*> pipelines;
+  for (int i = 0; i < FLAGS_connections; i++) {
+    clients.emplace_back(new ClientBootstrap<DefaultPipeline>());
+    auto& client = clients.back();
+    client->group(threads);
+    client->pipelineFactory(factory);
+    if (FLAGS_tls) {
+      client->sslContext(std::make_shared<SSLContext>());
+    }
+    pipelines.push_back(client->connect(address).get());
+  }
+
+  auto run = [&](std::function<void(DefaultPipeline*, LoadHandler*)> f) {
+    for (auto pipeline : pipelines) {
+      auto evb = pipeline->getTransport()->getEventBase();
+      evb->runInEventBaseThreadAndWait([&] {
+        f(pipeline, pipeline->getHandler<LoadHandler>());
+      });
+    }
+  };
+
+  run([](DefaultPipeline*, LoadHandler* load) {
+    load->start(FLAGS_rate / FLAGS_connections);
+  });
+  std::this_thread::sleep_for(std::chrono::seconds(FLAGS_warmup));
+  measuring = true;
+  auto start = Clock::now();
+  std::this_thread::sleep_for(std::chrono::seconds(FLAGS_duration));
+  measuring = false;
+  auto elapsed = std::chrono::duration<double>(Clock::now() - start);
+
+  LatencyHistogram latency;
+  uint64_t errors = 0;
+  size_t backlog = 0;
+  run([&](DefaultPipeline* pipeline, LoadHandler* load) {
+    load->stop();
+    latency.merge(load->getLatency());
+    errors += load->getErrors();
+    backlog += load->getBacklog();
+    pipeline->close();
+  });
+
+  printf("%d connections depth %d size %d%s: %.0f qps, "
+         "p50 %ldus p90 %ldus p99 %ldus p99.9 %ldus max %ldus\n",
+         FLAGS_connections, FLAGS_depth, FLAGS_size, FLAGS_tls ? " tls" : "",
+         latency.count() / elapsed.count(),
+         us(latency, 50), us(latency, 90), us(latency, 99),
+         us(latency, 99.9), us(latency, 100));
+  if (errors > 0 || backlog > 0) {
+    // A backlog left means the server couldn't keep up with --rate
+    printf("%lu errors, %zu requests never sent\n",
+           (unsigned long)errors, backlog);
+  }
+  return errors > 0 ? 1 : 0;
+}
@@ -90,20 +90,20 @@ class StringToByteEncoder : public MessageToByteEncoder<std::string> {
  * All requests from the same client IP will be hashed to the same worker
  * thread.
  */
-class ClientIPRoutingDataHandler : public RoutingDataHandler<std::string> {
+class ClientIPRoutingDataHandler
+    : public PeekingRoutingDataHandler<std::string> {
  public:
   ClientIPRoutingDataHandler(uint64_t connId, Callback* cob)
-      : RoutingDataHandler<std::string>(connId, cob) {}
+      : PeekingRoutingDataHandler<std::string>(connId, cob) {}
 
-  bool parseRoutingData(folly::IOBufQueue& bufQueue,
-                        RoutingData& routingData) override {
+  bool peekRoutingData(const folly::IOBufQueue& /*bufQueue*/,
+                       std::string& routingData) override {
     auto transportInfo = getContext()->getPipeline()->getTransportInfo();
     const auto& clientIP = transportInfo->remoteAddr->getAddressStr();
     LOG(INFO) << "Using client IP " << clientIP
               << " as routing data to hash to a worker thread";
 
-    routingData.routingData = clientIP;
-    routingData.bufQueue.append(bufQueue);
+    routingData = clientIP;
     return true;
   }
 };
@@ -13,6 +13,7 @@
 #include <wangle/bootstrap/ClientBootstrap.h>
 #include <wangle/bootstrap/ServerBootstrap.h>
 #include <wangle/channel/AsyncSocketHandler.h>
+#include <wangle/channel/ProxyRelay.h>
 
 using namespace folly;
 using namespace wangle;
@@ -21,90 +22,55 @@ DEFINE_int32(port, 1080, "proxy server port");
 DEFINE_string(remote_host, "127.0.0.1", "remote host");
 DEFINE_int32(remote_port, 23, "remote port");
 
-class ProxyBackendHandler : public InboundBytesToBytesHandler {
- public:
-  explicit ProxyBackendHandler(DefaultPipeline* frontendPipeline) :
-      frontendPipeline_(frontendPipeline) {}
-
-  void read(Context* ctx, IOBufQueue& q) override {
-    frontendPipeline_->write(q.move());
-  }
-
-  void readEOF(Context* ctx) override {
-    LOG(INFO) << "Connection closed by remote host";
-    frontendPipeline_->close();
-  }
-
-  void readException(Context* ctx, exception_wrapper e) override {
-    LOG(ERROR) << "Remote error: " << exceptionStr(e);
-    frontendPipeline_->close();
-  }
-
- private:
-  DefaultPipeline* frontendPipeline_;
-};
-
 class ProxyBackendPipelineFactory : public PipelineFactory<DefaultPipeline> {
  public:
-  explicit ProxyBackendPipelineFactory(DefaultPipeline* frontendPipeline) :
-      frontendPipeline_(frontendPipeline) {}
-
   DefaultPipeline::Ptr newPipeline(
       std::shared_ptr<AsyncTransportWrapper> sock) {
     auto pipeline = DefaultPipeline::create();
     pipeline->addBack(AsyncSocketHandler(sock));
-    pipeline->addBack(ProxyBackendHandler(frontendPipeline_));
     pipeline->finalize();
 
     return pipeline;
   }
- private:
-  DefaultPipeline* frontendPipeline_;
 };
 
+// Once connected to the remote host, hands both sockets to a ProxyRelay,
+// which splices the bytes between them
 class ProxyFrontendHandler : public BytesToBytesHandler {
  public:
   explicit ProxyFrontendHandler(SocketAddress remoteAddress) :
       remoteAddress_(remoteAddress) {}
 
-  void read(Context* ctx, IOBufQueue& q) override {
-    backendPipeline_->write(q.move());
-  }
-
-  void readEOF(Context* ctx) override {
-    LOG(INFO) << "Connection closed by local host";
-    backendPipeline_->close().then([this, ctx](){
-      this->close(ctx);
-    });
-  }
-
-  void readException(Context* ctx, exception_wrapper e) override {
-    LOG(ERROR) << "Local error: " << exceptionStr(e);
-    backendPipeline_->close().then([this, ctx](){
-      this->close(ctx);
-    });
-  }
-
   void transportActive(Context* ctx) override {
-    if (backendPipeline_) {
+    if (relay_) {
       // Already connected
       return;
     }
 
-    // Pause reading from the socket until remote connection succeeds
+    // The relay does the reading from the socket from now on
     auto frontendPipeline = dynamic_cast<DefaultPipeline*>(ctx->getPipeline());
+    auto frontend = std::dynamic_pointer_cast<AsyncTransportWrapper>(
+        frontendPipeline->getTransport());
     frontendPipeline->transportInactive();
 
-    client_.pipelineFactory(
-        std::make_shared<ProxyBackendPipelineFactory>(frontendPipeline));
+    client_.pipelineFactory(std::make_shared<ProxyBackendPipelineFactory>());
     client_.connect(remoteAddress_)
-      .then([this, frontendPipeline](DefaultPipeline* pipeline){
+      .then([this, frontend](DefaultPipeline* pipeline){
         backendPipeline_ = pipeline;
-        // Resume read
-        frontendPipeline->transportActive();
+        auto backend = std::dynamic_pointer_cast<AsyncTransportWrapper>(
+            pipeline->getTransport());
+        pipeline->transportInactive();
+        relay_ = std::make_shared<ProxyRelay>(frontend, backend);
+        return relay_->start();
+      })
+      .onError([](const std::exception& e){
+        LOG(ERROR) << "Proxy error: " << exceptionStr(e);
       })
-      .onError([this, ctx](const std::exception& e){
-        LOG(ERROR) << "Connect error: " << exceptionStr(e);
+      .ensure([this, ctx](){
+        LOG(INFO) << "Connection closed";
+        if (backendPipeline_) {
+          backendPipeline_->close();
+        }
         this->close(ctx);
       });
   }
@@ -112,7 +78,8 @@ class ProxyFrontendHandler : public BytesToBytesHandler {
  private:
   SocketAddress remoteAddress_;
   ClientBootstrap<DefaultPipeline> client_;
-  DefaultPipeline* backendPipeline_;
+  DefaultPipeline* backendPipeline_{nullptr};
+  std::shared_ptr<ProxyRelay> relay_;
 };
 
 class ProxyFrontendPipelineFactory : public PipelineFactory<DefaultPipeline> {
@@ -10,6 +10,7 @@
 #pragma once
 
 #include <wangle/channel/Handler.h>
+#include <wangle/codec/LengthFieldPrepender.h>
 
 #include <thrift/test/gen-cpp/ThriftTest.h>
 #include <thrift/lib/cpp/util/ThriftSerializer.h>
@@ -31,7 +32,8 @@ class ServerSerializeHandler : public wangle::Handler<
 
     std::string out;
     ser.serialize<thrift::test::Xtruct>(b, &out);
-    return ctx->fireWrite(folly::IOBuf::copyBuffer(out));
+    return ctx->fireWrite(folly::IOBuf::copyBuffer(
+        out, wangle::LengthFieldPrepender::kMaxLengthFieldLength));
   }
 
  private:
@@ -0,0 +1,139 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/Conv.h>
+#include <folly/MoveWrapper.h>
+#include <folly/ThreadLocal.h>
+#include <folly/io/async/EventBaseManager.h>
+#include <wangle/service/Service.h>
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <vector>
+
+namespace wangle {
+
+/**
+ * A service filter gathering requests into batches for a service taking
+ * them all at once, e.g. a multi-get, and handing each caller its own
+ * response: the batch service must return one response per request, in
+ * order.
+ *
+ * A batch is sent once it has maxBatchSize requests, or maxDelay after its
+ * first one; with no delay, at the end of the current loop iteration, so
+ * that the requests made by everything ready at once go together. Batches
+ * are kept per thread and flushed in the calling thread's EventBase, so no
+ * lock is taken; requests made outside an EventBase thread are sent right
+ * away, each a batch of its own.
+ */
+template <typename Req, typename Resp = Req>
+class BatchingFilter
+    : public ServiceFilter<Req, Resp, std::vector<Req>, std::vector<Resp>> {
+ public:
+  typedef Service<std::vector<Req>, std::vector<Resp>> BatchService;
+
+  explicit BatchingFilter(
+      std::shared_ptr<BatchService> service,
+      size_t maxBatchSize = 64,
+      std::chrono::microseconds maxDelay = std::chrono::microseconds(0))
+      : ServiceFilter<Req, Resp, std::vector<Req>, std::vector<Resp>>(
+            service),
+        maxBatchSize_(std::max<size_t>(1, maxBatchSize)),
+        maxDelay_(maxDelay) {}
+
+  folly::Future<Resp> operator()(Req req) override {
+    auto& batch = *batches_;
+    if (!batch) {
+      batch = std::make_shared<Batch>();
+    }
+    batch->promises.emplace_back();
+    auto future = batch->promises.back().getFuture();
+    batch->requests.push_back(std::move(req));
+
+    auto evb = folly::EventBaseManager::get()->getExistingEventBase();
+    if (!evb || batch->requests.size() >= maxBatchSize_) {
+      flush(this->service_, *batch);
+    } else if (batch->requests.size() == 1) {
+      schedule(evb, batch);
+    }
+    return future;
+  }
+
+ private:
+  struct Batch {
+    std::vector<Req> requests;
+    std::vector<folly::Promise<Resp>> promises;
+    // Bumped by every flush, so that the timer of a batch already sent
+    // leaves the next one alone
+    uint64_t generation{0};
+  };
+
+  // The timer holds on to the batch and the service, not to the filter
+  void schedule(folly::EventBase* evb, std::shared_ptr<Batch> batch) {
+    auto service = this->service_;
+    auto generation = batch->generation;
+    auto flushBatch = [service, batch, generation]() {
+      if (batch->generation == generation) {
+        flush(service, *batch);
+      }
+    };
+    if (maxDelay_.count() == 0) {
+      evb->runInLoop(std::move(flushBatch));
+      return;
+    }
+    // EventBase timers have millisecond resolution
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        maxDelay_ + std::chrono::microseconds(999));
+    evb->runAfterDelay(std::move(flushBatch), uint32_t(ms.count()));
+  }
+
+  static void flush(const std::shared_ptr<BatchService>& service,
+                    Batch& batch) {
+    batch.generation++;
+    std::vector<Req> requests;
+    requests.swap(batch.requests);
+    auto promises = folly::makeMoveWrapper(
+        std::vector<folly::Promise<Resp>>());
+    promises->swap(batch.promises);
+
+    (*service)(std::move(requests)).then(
+        [promises](folly::Try<std::vector<Resp>>&& t) mutable {
+          if (t.hasException()) {
+            for (auto& p : *promises) {
+              p.setException(t.exception());
+            }
+            return;
+          }
+          auto& responses = t.value();
+          if (responses.size() != promises->size()) {
+            auto ew = folly::make_exception_wrapper<std::runtime_error>(
+                "batch service returned " + folly::to<std::string>(
+                    responses.size()) + " responses for " +
+                folly::to<std::string>(promises->size()) + " requests");
+            for (auto& p : *promises) {
+              p.setException(ew);
+            }
+            return;
+          }
+          for (size_t i = 0; i < responses.size(); i++) {
+            (*promises)[i].setValue(std::move(responses[i]));
+          }
+        });
+  }
+
+  const size_t maxBatchSize_;
+  const std::chrono::microseconds maxDelay_;
+  folly::ThreadLocal<std::shared_ptr<Batch>> batches_;
+};
+
+} // namespace wangle
@@ -0,0 +1,160 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/futures/Future.h>
+#include <wangle/service/Service.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace wangle {
+
+struct CachingFilterOptions {
+  // How long a response is served from the cache
+  std::chrono::milliseconds ttl{1000};
+  // Responses kept, least recently used out first
+  size_t maxEntries{10000};
+  // Each with its own lock, so that callers from different threads rarely
+  // contend
+  size_t numShards{16};
+};
+
+/**
+ * A service filter caching responses by a key taken from each request, for
+ * ttl. Requests for a key already being fetched don't go to the service:
+ * they wait for the response of the first one, so that a burst of the
+ * same request, e.g. right after its response expired, costs one call.
+ * Failures are handed to the waiting requests but not cached.
+ *
+ * Resp must be copyable. Thread safe.
+ */
+template <typename Req, typename Resp = Req, typename Key = std::string>
+class CachingFilter : public ServiceFilter<Req, Resp> {
+ public:
+  typedef CachingFilterOptions Options;
+  typedef std::function<Key(const Req&)> KeyFn;
+
+  CachingFilter(std::shared_ptr<Service<Req, Resp>> service,
+                KeyFn keyFn,
+                Options options = Options())
+      : ServiceFilter<Req, Resp>(service),
+        keyFn_(std::move(keyFn)),
+        ttl_(options.ttl),
+        shards_(std::make_shared<std::vector<Shard>>(
+            std::max<size_t>(1, options.numShards))) {
+    auto perShard = (options.maxEntries + shards_->size() - 1) /
+      shards_->size();
+    for (auto& shard : *shards_) {
+      shard.capacity = std::max<size_t>(1, perShard);
+    }
+  }
+
+  virtual folly::Future<Resp> operator()(Req req) override {
+    auto key = keyFn_(req);
+    auto shards = shards_;
+    auto shard = &(*shards)[std::hash<Key>()(key) % shards->size()];
+    auto now = Clock::now();
+    {
+      std::lock_guard<std::mutex> g(shard->mutex);
+      auto it = shard->entries.find(key);
+      if (it != shard->entries.end()) {
+        if (it->second.expires > now) {
+          shard->lru.splice(shard->lru.begin(), shard->lru, it->second.lru);
+          return folly::makeFuture<Resp>(Resp(it->second.value));
+        }
+        shard->lru.erase(it->second.lru);
+        shard->entries.erase(it);
+      }
+      auto pending = shard->pending.find(key);
+      if (pending != shard->pending.end()) {
+        pending->second.emplace_back();
+        return pending->second.back().getFuture();
+      }
+      // The first one for this key, the one going to the service
+      shard->pending[key];
+    }
+
+    auto ttl = ttl_;
+    return (*this->service_)(std::move(req)).then(
+        [shards, shard, key, ttl](folly::Try<Resp>&& t) {
+          std::vector<folly::Promise<Resp>> waiters;
+          {
+            std::lock_guard<std::mutex> g(shard->mutex);
+            auto pending = shard->pending.find(key);
+            waiters.swap(pending->second);
+            shard->pending.erase(pending);
+            if (t.hasValue()) {
+              shard->insert(key, t.value(), Clock::now() + ttl);
+            }
+          }
+          for (auto& waiter : waiters) {
+            waiter.setTry(folly::Try<Resp>(t));
+          }
+          return std::move(t.value());
+        });
+  }
+
+  size_t getNumEntries() const {
+    size_t n = 0;
+    for (auto& shard : *shards_) {
+      std::lock_guard<std::mutex> g(shard.mutex);
+      n += shard.entries.size();
+    }
+    return n;
+  }
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Entry {
+    Resp value;
+    Clock::time_point expires;
+    typename std::list<Key>::iterator lru;
+  };
+
+  struct Shard {
+    void insert(const Key& key, const Resp& value, Clock::time_point expires) {
+      auto it = entries.find(key);
+      if (it != entries.end()) {
+        lru.erase(it->second.lru);
+        entries.erase(it);
+      }
+      while (entries.size() >= capacity) {
+        entries.erase(lru.back());
+        lru.pop_back();
+      }
+      lru.push_front(key);
+      entries.emplace(key, Entry{value, expires, lru.begin()});
+    }
+
+    mutable std::mutex mutex;
+    size_t capacity{1};
+    std::unordered_map<Key, Entry> entries;
+    // Most recently used first
+    std::list<Key> lru;
+    // The requests waiting on the one in flight for each key
+    std::unordered_map<Key, std::vector<folly::Promise<Resp>>> pending;
+  };
+
+  KeyFn keyFn_;
+  const std::chrono::milliseconds ttl_;
+  // Shared with the callbacks, which can outlive the filter
+  std::shared_ptr<std::vector<Shard>> shards_;
+};
+
+} // namespace wangle
@@ -10,16 +10,28 @@
 
 #pragma once
 
+#include <folly/io/async/HHWheelTimer.h>
 #include <wangle/channel/Handler.h>
+#include <wangle/service/Deadline.h>
 #include <wangle/service/Service.h>
+#include <wangle/service/StreamingService.h>
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
 
 namespace wangle {
 
-template <typename Pipeline, typename Req, typename Resp = Req>
-class ClientDispatcherBase : public HandlerAdapter<Resp, Req>
+// In is what the dispatcher reads off the pipeline, if not Resp itself
+template <typename Pipeline, typename Req, typename Resp = Req,
+          typename In = Resp>
+class ClientDispatcherBase : public HandlerAdapter<In, Req>
                              , public Service<Req, Resp> {
  public:
-  typedef typename HandlerAdapter<Resp, Req>::Context Context;
+  typedef typename HandlerAdapter<In, Req>::Context Context;
 
   ~ClientDispatcherBase() {
     if (pipeline_) {
@@ -31,23 +43,24 @@ class ClientDispatcherBase : public HandlerAdapter<Resp, Req>
     }
   }
 
+  // The pipeline must be finalized. Only the links next to the dispatcher
+  // are updated, so this is cheap enough to do per request.
   void setPipeline(Pipeline* pipeline) {
     try {
-      pipeline->template remove<ClientDispatcherBase>();
+      pipeline->template unlink<ClientDispatcherBase>();
     } catch (const std::invalid_argument& e) {
       // no existing dispatcher; this is fine
     }
     pipeline_ = pipeline;
-    pipeline_->addBack(this);
-    pipeline_->finalize();
+    pipeline_->insertBack(this);
   }
 
   virtual folly::Future<folly::Unit> close() override {
-    return HandlerAdapter<Resp, Req>::close(this->getContext());
+    return HandlerAdapter<In, Req>::close(this->getContext());
   }
 
   virtual folly::Future<folly::Unit> close(Context* ctx) override {
-    return HandlerAdapter<Resp, Req>::close(ctx);
+    return HandlerAdapter<In, Req>::close(ctx);
   }
 
  protected:
@@ -74,6 +87,10 @@ class SerialClientDispatcher
   virtual folly::Future<Resp> operator()(Req arg) override {
     CHECK(!p_);
     DCHECK(this->pipeline_);
+    if (RequestDeadline::expired()) {
+      return folly::makeFuture<Resp>(
+          folly::make_exception_wrapper<DeadlineExceeded>());
+    }
 
     p_ = folly::Promise<Resp>();
     auto f = p_->getFuture();
@@ -106,6 +123,10 @@ class PipelinedClientDispatcher
 
   virtual folly::Future<Resp> operator()(Req arg) override {
     DCHECK(this->pipeline_);
+    if (RequestDeadline::expired()) {
+      return folly::makeFuture<Resp>(
+          folly::make_exception_wrapper<DeadlineExceeded>());
+    }
 
     folly::Promise<Resp> p;
     auto f = p.getFuture();
@@ -118,10 +139,242 @@ class PipelinedClientDispatcher
   std::deque<folly::Promise<Resp>> p_;
 };
 
-/*
- * A full out-of-order request/response client would require some sort
- * of sequence id on the wire.  Currently this is left up to
- * individual protocol writers to implement.
+/**
+ * Dispatch requests out of order: each response is matched to its request
+ * by the id IdExtractor reads off both, so a slow response doesn't hold up
+ * the ones behind it. Ids, assigned by the protocol, must be unique among
+ * the requests in flight; a request reusing one fails at once.
+ *
+ * IdExtractor is default constructible, with uint64_t operator()(const
+ * Req&) and uint64_t operator()(const Resp&) (a single one if Req is
+ * Resp). A request not answered within timeout, if set, or by its
+ * RequestDeadline, fails with folly::TimedOut, and a late response to it
+ * is dropped. Pending requests fail as the connection closes.
+ */
+template <typename Pipeline, typename Req, typename Resp,
+          typename IdExtractor>
+class MultiplexClientDispatcher
+    : public ClientDispatcherBase<Pipeline, Req, Resp> {
+ public:
+  typedef typename HandlerAdapter<Resp, Req>::Context Context;
+
+  explicit MultiplexClientDispatcher(
+      std::chrono::milliseconds timeout = std::chrono::milliseconds(0),
+      IdExtractor extractor = IdExtractor())
+    : timeout_(timeout),
+      extractor_(std::move(extractor)) {}
+
+  void read(Context* ctx, Resp in) override {
+    auto it = pending_.find(extractor_(in));
+    if (it == pending_.end()) {
+      // Timed out already, or not ours
+      VLOG(4) << "dropping response to unknown request " << extractor_(in);
+      return;
+    }
+    auto p = std::move(it->second->promise);
+    pending_.erase(it);
+    p.setValue(std::move(in));
+  }
+
+  void readEOF(Context* ctx) override {
+    failAll(folly::make_exception_wrapper<std::runtime_error>(
+        "connection closed"));
+    ctx->fireReadEOF();
+  }
+
+  void readException(Context* ctx, folly::exception_wrapper e) override {
+    failAll(e);
+    ctx->fireReadException(std::move(e));
+  }
+
+  virtual folly::Future<Resp> operator()(Req arg) override {
+    DCHECK(this->pipeline_);
+    if (RequestDeadline::expired()) {
+      return folly::makeFuture<Resp>(
+          folly::make_exception_wrapper<DeadlineExceeded>());
+    }
+
+    const uint64_t id = extractor_(arg);
+    auto& entry = pending_[id];
+    if (entry) {
+      return folly::makeFuture<Resp>(std::invalid_argument(
+          "request id already in flight"));
+    }
+    entry.reset(new Pending(this, id));
+    auto f = entry->promise.getFuture();
+    // No longer than the request's deadline
+    auto timeout = timeout_;
+    if (RequestDeadline::isSet() &&
+        (timeout.count() == 0 || RequestDeadline::remaining() < timeout)) {
+      timeout = std::max(RequestDeadline::remaining(),
+                         std::chrono::milliseconds(1));
+    }
+    if (timeout.count() > 0) {
+      getTimer()->scheduleTimeout(entry.get(), timeout);
+    }
+    this->pipeline_->write(std::move(arg));
+    return f;
+  }
+
+  size_t getNumPending() const {
+    return pending_.size();
+  }
+
+ private:
+  struct Pending : public folly::HHWheelTimer::Callback {
+    Pending(MultiplexClientDispatcher* d, uint64_t i)
+      : dispatcher(d), id(i) {}
+
+    void timeoutExpired() noexcept override {
+      dispatcher->expire(id);
+    }
+
+    MultiplexClientDispatcher* dispatcher;
+    uint64_t id;
+    folly::Promise<Resp> promise;
+  };
+
+  // On the EventBase of the connection, created with the first timeout
+  folly::HHWheelTimer* getTimer() {
+    if (!timer_) {
+      auto transport = this->pipeline_->getTransport();
+      CHECK(transport) << "request timeouts need a transport";
+      timer_.reset(new folly::HHWheelTimer(transport->getEventBase()));
+    }
+    return timer_.get();
+  }
+
+  void expire(uint64_t id) {
+    auto it = pending_.find(id);
+    DCHECK(it != pending_.end());
+    auto p = std::move(it->second->promise);
+    // Deletes the timeout callback we are in, which is fine as its last act
+    pending_.erase(it);
+    p.setException(folly::TimedOut());
+  }
+
+  void failAll(const folly::exception_wrapper& e) {
+    auto pending = std::move(pending_);
+    pending_.clear();
+    for (auto& entry : pending) {
+      entry.second->promise.setException(e);
+    }
+  }
+
+  const std::chrono::milliseconds timeout_;
+  IdExtractor extractor_;
+  // Outlives the pending requests, whose timeouts it may hold
+  folly::HHWheelTimer::UniquePtr timer_;
+  std::unordered_map<uint64_t, std::unique_ptr<Pending>> pending_;
+};
+
+/**
+ * Dispatch requests to a streaming server (see StreamingServerDispatcher),
+ * pipelined: a request's response stream is returned at once, and gets the
+ * DATA frames read until the END or FAILED one, the frames after that going
+ * to the next request's stream. Reads are paused while the stream being
+ * read holds bufferChunks chunks its consumer hasn't taken, so a slow
+ * consumer holds back the server instead of the response piling up here.
+ * A consumer that stops reading must cancel() the stream; the rest of its
+ * frames are then dropped. Pending streams fail as the connection closes.
  */
+template <typename Pipeline, typename Req, typename Chunk>
+class StreamingClientDispatcher
+    : public ClientDispatcherBase<Pipeline, Req,
+                                  std::shared_ptr<ResponseStream<Chunk>>,
+                                  StreamFrame<Chunk>> {
+ public:
+  typedef typename HandlerAdapter<StreamFrame<Chunk>, Req>::Context Context;
+  typedef std::shared_ptr<ResponseStream<Chunk>> StreamPtr;
+
+  explicit StreamingClientDispatcher(size_t bufferChunks = 16)
+    : bufferChunks_(bufferChunks),
+      alive_(std::make_shared<bool>(true)) {}
+
+  void read(Context* ctx, StreamFrame<Chunk> frame) override {
+    if (streams_.empty()) {
+      VLOG(4) << "dropping stream frame with no request";
+      return;
+    }
+    auto stream = streams_.front();
+    switch (frame.type) {
+      case StreamFrame<Chunk>::Type::DATA: {
+        auto room = stream->push(std::move(frame.chunk));
+        if (!room.isReady() && !paused_) {
+          paused_ = true;
+          ctx->pauseRead();
+          std::weak_ptr<bool> alive = alive_;
+          // Also run if the stream goes away unread
+          room.then([this, alive](folly::Try<folly::Unit>&&) {
+            if (!alive.expired()) {
+              resume();
+            }
+          });
+        }
+        return;
+      }
+      case StreamFrame<Chunk>::Type::END:
+        streams_.pop_front();
+        stream->finish();
+        return;
+      case StreamFrame<Chunk>::Type::FAILED:
+        streams_.pop_front();
+        stream->fail(folly::make_exception_wrapper<std::runtime_error>(
+            frame.message));
+        return;
+    }
+  }
+
+  void readEOF(Context* ctx) override {
+    failAll(folly::make_exception_wrapper<std::runtime_error>(
+        "connection closed"));
+    ctx->fireReadEOF();
+  }
+
+  void readException(Context* ctx, folly::exception_wrapper e) override {
+    failAll(e);
+    ctx->fireReadException(std::move(e));
+  }
+
+  virtual folly::Future<StreamPtr> operator()(Req arg) override {
+    DCHECK(this->pipeline_);
+    if (RequestDeadline::expired()) {
+      return folly::makeFuture<StreamPtr>(
+          folly::make_exception_wrapper<DeadlineExceeded>());
+    }
+
+    auto stream = std::make_shared<QueueResponseStream<Chunk>>(bufferChunks_);
+    streams_.push_back(stream);
+    this->pipeline_->write(std::move(arg));
+    return folly::makeFuture<StreamPtr>(std::move(stream));
+  }
+
+  size_t getNumPending() const {
+    return streams_.size();
+  }
+
+ private:
+  void resume() {
+    if (paused_) {
+      paused_ = false;
+      this->getContext()->resumeRead();
+    }
+  }
+
+  void failAll(const folly::exception_wrapper& e) {
+    auto streams = std::move(streams_);
+    streams_.clear();
+    for (auto& stream : streams) {
+      stream->fail(e);
+    }
+    resume();
+  }
+
+  const size_t bufferChunks_;
+  // Outlived by continuations on the streams handed out
+  std::shared_ptr<bool> alive_;
+  std::deque<std::shared_ptr<QueueResponseStream<Chunk>>> streams_;
+  bool paused_{false};
+};
 
 } // namespace wangle
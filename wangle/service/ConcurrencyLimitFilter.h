@@ -0,0 +1,167 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/futures/Future.h>
+#include <wangle/service/Service.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+#include <stdexcept>
+
+namespace wangle {
+
+class ConcurrencyLimitExceeded : public std::runtime_error {
+ public:
+  ConcurrencyLimitExceeded()
+      : std::runtime_error("concurrency limit exceeded") {}
+};
+
+struct ConcurrencyLimitFilterOptions {
+  uint32_t initialLimit{20};
+  uint32_t minLimit{1};
+  uint32_t maxLimit{1000};
+  // How far above its long term average latency may go before the limit
+  // comes down
+  double tolerance{1.5};
+  // Weight of each new estimate in the limit
+  double smoothing{0.2};
+  // Latencies averaged into the long term one
+  uint32_t longWindow{600};
+};
+
+/**
+ * A service filter bounding the requests in flight on a service, with a
+ * limit following the latency the service shows, in the manner of the
+ * gradient limit of Netflix's concurrency-limits: as latency grows past
+ * its long term average, queueing is taken to have started and the limit
+ * comes down; while it stays close, the limit goes up by its square root.
+ *
+ * Requests beyond the limit fail right away with ConcurrencyLimitExceeded,
+ * without anything being thrown, rather than queueing until they time out.
+ * Thread safe.
+ */
+template <typename Req, typename Resp = Req>
+class ConcurrencyLimitFilter : public ServiceFilter<Req, Resp> {
+ public:
+  typedef ConcurrencyLimitFilterOptions Options;
+
+  explicit ConcurrencyLimitFilter(
+      std::shared_ptr<Service<Req, Resp>> service,
+      Options options = Options())
+      : ServiceFilter<Req, Resp>(service),
+        limiter_(std::make_shared<Limiter>(options)) {}
+
+  virtual folly::Future<Resp> operator()(Req req) override {
+    auto limiter = limiter_;
+    uint32_t inFlight;
+    if (!limiter->acquire(&inFlight)) {
+      return folly::makeFuture<Resp>(
+          folly::make_exception_wrapper<ConcurrencyLimitExceeded>());
+    }
+    auto start = std::chrono::steady_clock::now();
+    return (*this->service_)(std::move(req)).then(
+        [limiter, start, inFlight](folly::Try<Resp>&& t) {
+          limiter->release(t.hasValue(),
+                           std::chrono::steady_clock::now() - start,
+                           inFlight);
+          return std::move(t.value());
+        });
+  }
+
+  uint32_t getLimit() const {
+    return limiter_->limit.load(std::memory_order_relaxed);
+  }
+
+  uint32_t getInFlight() const {
+    return limiter_->inFlight.load(std::memory_order_relaxed);
+  }
+
+  uint64_t getNumRejected() const {
+    return limiter_->rejected.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // Shared with the callbacks, which can outlive the filter
+  class Limiter {
+   public:
+    explicit Limiter(const Options& options)
+        : limit(options.initialLimit),
+          options_(options),
+          estimate_(options.initialLimit) {}
+
+    bool acquire(uint32_t* current) {
+      *current = inFlight.fetch_add(1, std::memory_order_relaxed) + 1;
+      if (*current > limit.load(std::memory_order_relaxed)) {
+        inFlight.fetch_sub(1, std::memory_order_relaxed);
+        rejected.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      return true;
+    }
+
+    // With the requests in flight when the request was sent
+    void release(bool success,
+                 std::chrono::steady_clock::duration latency,
+                 uint32_t sentInFlight) {
+      inFlight.fetch_sub(1, std::memory_order_relaxed);
+      // Failures say nothing of the latency
+      if (!success) {
+        return;
+      }
+      double rtt = std::max<double>(
+          1, std::chrono::duration_cast<std::chrono::microseconds>(
+              latency).count());
+
+      std::lock_guard<std::mutex> g(mutex_);
+      // A plain mean until the window is full, then a moving one
+      samples_ = std::min(samples_ + 1, std::max(options_.longWindow, 1u));
+      longRtt_ += (rtt - longRtt_) / samples_;
+      // Lets the long term latency come down quickly after a spike
+      if (longRtt_ > 2 * rtt) {
+        longRtt_ *= 0.95;
+      }
+      // Too few requests in flight to tell whether more would do
+      if (sentInFlight < estimate_ / 2) {
+        return;
+      }
+
+      double gradient =
+        std::max(0.5, std::min(1.0, options_.tolerance * longRtt_ / rtt));
+      double next = estimate_ * gradient + std::sqrt(estimate_);
+      estimate_ = estimate_ * (1 - options_.smoothing) +
+        next * options_.smoothing;
+      estimate_ = std::max<double>(options_.minLimit,
+                                   std::min<double>(options_.maxLimit,
+                                                    estimate_));
+      limit.store(uint32_t(estimate_), std::memory_order_relaxed);
+    }
+
+    std::atomic<uint32_t> limit;
+    std::atomic<uint32_t> inFlight{0};
+    std::atomic<uint64_t> rejected{0};
+
+   private:
+    const Options options_;
+
+    std::mutex mutex_;
+    double estimate_;
+    double longRtt_{0};
+    uint32_t samples_{0};
+  };
+
+  std::shared_ptr<Limiter> limiter_;
+};
+
+} // namespace wangle
@@ -0,0 +1,107 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+namespace wangle {
+
+class DeadlineExceeded : public std::runtime_error {
+ public:
+  DeadlineExceeded() : std::runtime_error("deadline exceeded") {}
+};
+
+/**
+ * The deadline of the request a thread is working for: set it with a
+ * RequestDeadline::Scope around the calls made for a request, e.g. from
+ * the deadline a server found in the request, and the services and
+ * filters down the stack give up on the request once it is past, rather
+ * than doing work no one waits for anymore:
+ *
+ *   - ExecutorFilter fails requests whose deadline passed while they were
+ *     queued, and hands the time left to a ThreadPoolExecutor as the
+ *     task's expiration;
+ *   - the client dispatchers don't send expired requests, and
+ *     MultiplexClientDispatcher doesn't wait past the deadline;
+ *   - RetryFilter doesn't retry past it.
+ *
+ * They fail such requests with DeadlineExceeded. The deadline is carried
+ * across the executor and timer hops they make themselves; other code
+ * continuing a request in another thread or callback takes current() with
+ * it and opens a Scope there.
+ */
+class RequestDeadline {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  static Clock::time_point none() {
+    return Clock::time_point::max();
+  }
+
+  // The deadline of this thread's request, or none()
+  static Clock::time_point current() {
+    return slot();
+  }
+
+  static bool isSet() {
+    return current() != none();
+  }
+
+  static bool expired() {
+    return isSet() && Clock::now() >= current();
+  }
+
+  // Until the deadline, 0 once past; max() if none is set
+  static std::chrono::milliseconds remaining() {
+    if (!isSet()) {
+      return std::chrono::milliseconds::max();
+    }
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        current() - Clock::now());
+    return std::max(left, std::chrono::milliseconds(0));
+  }
+
+  /**
+   * Sets this thread's deadline until destroyed. A nested scope can only
+   * bring the deadline closer, not extend its caller's.
+   */
+  class Scope {
+   public:
+    explicit Scope(Clock::time_point deadline) : previous_(slot()) {
+      slot() = std::min(previous_, deadline);
+    }
+
+    // Without a deadline for std::chrono::milliseconds::max()
+    explicit Scope(std::chrono::milliseconds timeout)
+        : Scope(timeout == std::chrono::milliseconds::max()
+                ? none() : Clock::now() + timeout) {}
+
+    ~Scope() {
+      slot() = previous_;
+    }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+   private:
+    const Clock::time_point previous_;
+  };
+
+ private:
+  static Clock::time_point& slot() {
+    static thread_local Clock::time_point deadline = none();
+    return deadline;
+  }
+};
+
+} // namespace wangle
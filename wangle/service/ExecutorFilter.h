@@ -1,30 +1,111 @@
 #pragma once
 
+#include <wangle/concurrent/Codel.h>
+#include <wangle/concurrent/RequestTrace.h>
+#include <wangle/concurrent/ThreadPoolExecutor.h>
+#include <wangle/service/Deadline.h>
 #include <wangle/service/Service.h>
 
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
 namespace wangle {
 
+class ExecutorOverloaded : public std::runtime_error {
+ public:
+  ExecutorOverloaded()
+      : std::runtime_error("request sloughed, executor overloaded") {}
+};
+
 /**
  * A service that runs all requests through an executor.
+ *
+ * Given a Codel, the time each request waited in the executor's queue is
+ * fed to it, and requests it says to slough fail with ExecutorOverloaded
+ * instead of reaching the service, so that a backed up executor sheds
+ * load rather than serving requests whose callers have given up.
+ *
+ * Requests past their RequestDeadline fail with DeadlineExceeded, when
+ * made or when dequeued, and run with their deadline set. A
+ * ThreadPoolExecutor is given the time left as the task's expiration.
+ * Likewise, they run with the RequestTrace they were made with.
  */
 template <typename Req, typename Resp = Req>
 class ExecutorFilter : public ServiceFilter<Req, Resp> {
  public:
  explicit ExecutorFilter(
    std::shared_ptr<folly::Executor> exe,
-   std::shared_ptr<Service<Req, Resp>> service)
+   std::shared_ptr<Service<Req, Resp>> service,
+   std::shared_ptr<Codel> codel = nullptr)
       : ServiceFilter<Req, Resp>(service)
-      , exe_(exe) {}
+      , exe_(exe)
+      , pool_(dynamic_cast<ThreadPoolExecutor*>(exe_.get()))
+      , codel_(std::move(codel)) {}
 
  folly::Future<Resp> operator()(Req req) override {
-    folly::MoveWrapper<Req> wrapped(std::move(req));
-    return via(exe_.get()).then([wrapped,this]() mutable {
-      return (*this->service_)(wrapped.move());
-    });
+    if (RequestDeadline::expired()) {
+      return folly::makeFuture<Resp>(
+        folly::make_exception_wrapper<DeadlineExceeded>());
+    }
+    // Straight on the executor, without a Future in between
+    auto task = std::make_shared<Task>(std::move(req));
+    task->deadline = RequestDeadline::current();
+    task->traceId = RequestTrace::current();
+    auto future = task->promise.getFuture();
+    auto service = this->service_;
+    auto codel = codel_;
+    auto enqueued = std::chrono::steady_clock::now();
+    auto run = [task, service, codel, enqueued]() {
+      if (task->deadline <= std::chrono::steady_clock::now()) {
+        task->promise.setException(
+          folly::make_exception_wrapper<DeadlineExceeded>());
+        return;
+      }
+      if (codel && codel->overloaded(
+            std::chrono::steady_clock::now() - enqueued)) {
+        task->promise.setException(
+          folly::make_exception_wrapper<ExecutorOverloaded>());
+        return;
+      }
+      RequestDeadline::Scope scope(task->deadline);
+      RequestTrace::Scope traceScope(task->traceId);
+      RequestTrace::record("service");
+      (*service)(std::move(task->request)).then(
+        [task](folly::Try<Resp>&& t) {
+          task->promise.setTry(std::move(t));
+        });
+    };
+
+    if (pool_ && task->deadline != RequestDeadline::none()) {
+      // Expired by the pool as soon as it dequeues it too late
+      pool_->add(run,
+                 std::max(RequestDeadline::remaining(),
+                          std::chrono::milliseconds(1)),
+                 [task]() {
+                   task->promise.setException(
+                     folly::make_exception_wrapper<DeadlineExceeded>());
+                 });
+    } else {
+      exe_->add(run);
+    }
+    return future;
   }
 
  private:
+  struct Task {
+    explicit Task(Req req) : request(std::move(req)) {}
+
+    Req request;
+    folly::Promise<Resp> promise;
+    RequestDeadline::Clock::time_point deadline;
+    uint64_t traceId{0};
+  };
+
   std::shared_ptr<folly::Executor> exe_;
+  // Set if exe_ is one, to give it the deadlines as expirations
+  ThreadPoolExecutor* pool_;
+  std::shared_ptr<Codel> codel_;
 };
 
 } // namespace wangle
@@ -1,10 +1,21 @@
 #pragma once
 
+#include <folly/io/async/HHWheelTimer.h>
+
+#include <chrono>
+#include <functional>
+
 namespace wangle {
 /**
  * A service filter that expires the self service after a certain
  * amount of idle time, or after a maximum amount of time total.
  * Idle timeout is cancelled when any requests are outstanding.
+ *
+ * Given an EventBase, the timers go on a timer wheel of that EventBase
+ * instead of the Timekeeper, and a request only costs a timestamp: the
+ * idle timer checks when it fires whether there was activity meanwhile,
+ * and goes again for the rest of the idle time if so. The filter must then
+ * be used, and its requests complete, in the EventBase's thread.
  */
 
 template <typename Req, typename Resp = Req>
@@ -30,7 +41,29 @@ class ExpiringFilter : public ServiceFilter<Req, Resp> {
     startIdleTimer();
   }
 
+  ExpiringFilter(std::shared_ptr<Service<Req, Resp>> service,
+                 folly::EventBase* evb,
+                 std::chrono::milliseconds idleTimeoutTime,
+                 std::chrono::milliseconds maxTime
+                 = std::chrono::milliseconds(0))
+  : ServiceFilter<Req, Resp>(service)
+  , idleTimeoutTime_(idleTimeoutTime)
+  , maxTime_(maxTime)
+  , timekeeper_(nullptr)
+  , timer_(new folly::HHWheelTimer(evb))
+  , lastActivity_(std::chrono::steady_clock::now()) {
+    if (maxTime_ > std::chrono::milliseconds(0)) {
+      timer_->scheduleTimeout(&maxCallback_, maxTime_);
+    }
+    if (idleTimeoutTime_ > std::chrono::milliseconds(0)) {
+      timer_->scheduleTimeout(&idleCallback_, idleTimeoutTime_);
+    }
+  }
+
   ~ExpiringFilter() {
+    if (timer_) {
+      return;
+    }
     if (!idleTimeout_.isReady()) {
       idleTimeout_.cancel();
     }
@@ -52,6 +85,13 @@ class ExpiringFilter : public ServiceFilter<Req, Resp> {
   };
 
   virtual folly::Future<Resp> operator()(Req req) override {
+    if (timer_) {
+      requests_++;
+      return (*this->service_)(std::move(req)).ensure([this](){
+        requests_--;
+        lastActivity_ = std::chrono::steady_clock::now();
+      });
+    }
     if (!idleTimeout_.isReady()) {
       idleTimeout_.cancel();
     }
@@ -63,12 +103,44 @@ class ExpiringFilter : public ServiceFilter<Req, Resp> {
   }
 
  private:
+  class Timeout : public folly::HHWheelTimer::Callback {
+   public:
+    explicit Timeout(std::function<void()> expired)
+      : expired_(std::move(expired)) {}
+
+    void timeoutExpired() noexcept override {
+      expired_();
+    }
+
+   private:
+    std::function<void()> expired_;
+  };
+
+  void idleExpired() {
+    auto idle = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - lastActivity_);
+    if (requests_ != 0) {
+      timer_->scheduleTimeout(&idleCallback_, idleTimeoutTime_);
+    } else if (idle >= idleTimeoutTime_) {
+      this->close();
+    } else {
+      timer_->scheduleTimeout(&idleCallback_, idleTimeoutTime_ - idle);
+    }
+  }
+
   folly::Future<folly::Unit> idleTimeout_;
   folly::Future<folly::Unit> maxTimeout_;
   std::chrono::milliseconds idleTimeoutTime_{0};
   std::chrono::milliseconds maxTime_{0};
   folly::Timekeeper* timekeeper_;
   uint32_t requests_{0};
+
+  // With an EventBase. The timeouts come after the wheel, so that they are
+  // cancelled before it goes
+  folly::HHWheelTimer::UniquePtr timer_;
+  std::chrono::steady_clock::time_point lastActivity_;
+  Timeout idleCallback_{[this]() { idleExpired(); }};
+  Timeout maxCallback_{[this]() { this->close(); }};
 };
 
 } // namespace wangle
@@ -0,0 +1,99 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <functional>
+#include <memory>
+
+#include <folly/MoveWrapper.h>
+#include <folly/experimental/fibers/FiberManagerMap.h>
+#include <folly/experimental/fibers/Promise.h>
+#include <folly/futures/Future.h>
+#include <folly/io/async/EventBaseManager.h>
+#include <wangle/service/Service.h>
+
+namespace wangle {
+
+/**
+ * Waits for future. On a fiber, only the fiber waits, and the EventBase
+ * goes on with its other connections meanwhile; elsewhere it blocks, as
+ * future.get() does.
+ */
+template <typename T>
+T fiberAwait(folly::Future<T> future) {
+  if (!folly::fibers::onFiber()) {
+    return future.get();
+  }
+  return folly::fibers::await([&](folly::fibers::Promise<T> promise) {
+    auto p = folly::makeMoveWrapper(std::move(promise));
+    future.then([p](folly::Try<T>&& t) mutable {
+      p->setTry(std::move(t));
+    });
+  });
+}
+
+/**
+ * A service running blocking-style code, which waits on Futures with
+ * fiberAwait(), on fibers of the FiberManager of the EventBase it's called
+ * on: each request gets a fiber, from the manager's pool, and waiting
+ * suspends only that fiber. With a server dispatcher on an IO thread,
+ * requests then run on the connection's own thread, without a hop to a
+ * CPU pool, while the loop serves other connections, e.g.
+ *
+ *   FiberService<Req, Resp> service([](Req req) {
+ *     auto user = fiberAwait(userClient(req.userId));
+ *     return render(req, user);
+ *   });
+ *   PipelinedServerDispatcher<Req, Resp> dispatcher(&service);
+ *
+ * The options (stack size, fibers pooled) are those of the EventBase's
+ * FiberManager, and so only apply if this is the first to get it. Called
+ * off an EventBase thread, requests run inline.
+ */
+template <typename Req, typename Resp = Req>
+class FiberService : public Service<Req, Resp> {
+ public:
+  typedef std::function<Resp(Req)> Func;
+
+  explicit FiberService(
+      Func func,
+      folly::fibers::FiberManager::Options options =
+        folly::fibers::FiberManager::Options())
+      : func_(std::make_shared<Func>(std::move(func))),
+        options_(std::move(options)) {}
+
+  folly::Future<Resp> operator()(Req req) override {
+    auto evb = folly::EventBaseManager::get()->getExistingEventBase();
+    if (!evb) {
+      return folly::makeFutureWith([&] {
+        return (*func_)(std::move(req));
+      });
+    }
+    auto promise = std::make_shared<folly::Promise<Resp>>();
+    auto future = promise->getFuture();
+    auto func = func_;
+    auto r = folly::makeMoveWrapper(std::move(req));
+    folly::fibers::getFiberManager(*evb, options_).add(
+        [promise, func, r]() mutable {
+      promise->setWith([&] {
+        return (*func)(std::move(*r));
+      });
+    });
+    return future;
+  }
+
+ private:
+  // Shared with the fibers, which may outlive the service
+  std::shared_ptr<Func> func_;
+  folly::fibers::FiberManager::Options options_;
+};
+
+} // namespace wangle
@@ -0,0 +1,201 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/futures/Future.h>
+#include <folly/io/async/EventBaseManager.h>
+#include <wangle/service/Service.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+namespace wangle {
+
+struct HedgingFilterOptions {
+  // Latency percentile of the service past which a request is hedged
+  double percentile{0.95};
+  // Most requests hedged, as a fraction of all requests
+  double budget{0.05};
+  // Latencies the percentile is taken over, the most recent ones
+  size_t window{1000};
+  // Until the first window / 10 latencies are in
+  std::chrono::milliseconds initialDelay{10};
+};
+
+/**
+ * A service filter cutting the tail latency of a service: a request still
+ * unanswered after the service's recent percentile latency is sent again
+ * to an alternate service, e.g. another replica, and whichever response
+ * comes first is returned. The other one is ignored. A failure is only
+ * returned if the other request fails too, or was never sent.
+ *
+ * At most a budget fraction of the requests is hedged, so that a slow
+ * backend doesn't double the load. Requests are only hedged when made in
+ * an EventBase thread, whose timers send the hedges; Req must be copyable.
+ */
+template <typename Req, typename Resp = Req>
+class HedgingFilter : public ServiceFilter<Req, Resp> {
+ public:
+  typedef HedgingFilterOptions Options;
+
+  HedgingFilter(std::shared_ptr<Service<Req, Resp>> service,
+                std::shared_ptr<Service<Req, Resp>> alternate,
+                Options options = Options())
+      : ServiceFilter<Req, Resp>(service),
+        alternate_(std::move(alternate)),
+        stats_(std::make_shared<Stats>(options)) {}
+
+  virtual folly::Future<Resp> operator()(Req req) override {
+    stats_->requests.fetch_add(1, std::memory_order_relaxed);
+    auto evb = folly::EventBaseManager::get()->getExistingEventBase();
+    if (!evb) {
+      return (*this->service_)(std::move(req));
+    }
+
+    auto call = std::make_shared<Call>(req);
+    auto future = call->promise.getFuture();
+    auto stats = stats_;
+    auto start = std::chrono::steady_clock::now();
+    (*this->service_)(std::move(req)).then(
+        [call, stats, start](folly::Try<Resp>&& t) {
+          if (t.hasValue()) {
+            stats->addLatency(std::chrono::steady_clock::now() - start);
+          }
+          call->complete(std::move(t));
+        });
+
+    auto alternate = alternate_;
+    auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(
+        stats->getDelay() + std::chrono::microseconds(999));
+    evb->runAfterDelay([call, stats, alternate]() {
+      if (call->done || !stats->takeHedge()) {
+        return;
+      }
+      call->pending++;
+      if (call->done) {
+        return;
+      }
+      (*alternate)(std::move(call->request)).then(
+          [call](folly::Try<Resp>&& t) {
+            call->complete(std::move(t));
+          });
+    }, uint32_t(delay.count()));
+    return future;
+  }
+
+  virtual folly::Future<folly::Unit> close() override {
+    auto alternate = alternate_;
+    return this->service_->close().then(
+        [alternate](folly::Try<folly::Unit>&&) {
+          return alternate->close();
+        });
+  }
+
+  uint64_t getNumHedged() const {
+    return stats_->hedges.load(std::memory_order_relaxed);
+  }
+
+  // Currently waited for before hedging
+  std::chrono::microseconds getHedgeDelay() const {
+    return stats_->getDelay();
+  }
+
+ private:
+  struct Call {
+    explicit Call(const Req& req) : request(req) {}
+
+    // The first success wins, or the last failure
+    void complete(folly::Try<Resp>&& t) {
+      auto remaining = --pending;
+      if ((t.hasValue() || remaining == 0) && !done.exchange(true)) {
+        promise.setTry(std::move(t));
+      }
+    }
+
+    Req request;
+    folly::Promise<Resp> promise;
+    std::atomic<int> pending{1};
+    std::atomic<bool> done{false};
+  };
+
+  // Shared with the timers and callbacks, which can outlive the filter
+  class Stats {
+   public:
+    explicit Stats(const Options& options)
+        : options_(options),
+          delayUs_(std::chrono::duration_cast<std::chrono::microseconds>(
+                       options.initialDelay).count()) {
+      options_.window = std::max<size_t>(1, options_.window);
+    }
+
+    template <typename Duration>
+    void addLatency(Duration latency) {
+      auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+          latency).count();
+      std::lock_guard<std::mutex> g(mutex_);
+      if (samples_.size() < options_.window) {
+        samples_.push_back(us);
+      } else {
+        samples_[next_] = us;
+      }
+      next_ = (next_ + 1) % options_.window;
+      // Refreshed every tenth of a window
+      if (++sinceUpdate_ < std::max<size_t>(1, options_.window / 10)) {
+        return;
+      }
+      sinceUpdate_ = 0;
+      sorted_ = samples_;
+      auto nth = sorted_.begin() + std::min(
+          sorted_.size() - 1, size_t(sorted_.size() * options_.percentile));
+      std::nth_element(sorted_.begin(), nth, sorted_.end());
+      delayUs_.store(*nth, std::memory_order_relaxed);
+    }
+
+    std::chrono::microseconds getDelay() const {
+      return std::chrono::microseconds(
+          delayUs_.load(std::memory_order_relaxed));
+    }
+
+    // Whether the budget allows one more hedge, counting it if so
+    bool takeHedge() {
+      auto allowed = uint64_t(
+          requests.load(std::memory_order_relaxed) * options_.budget);
+      auto hedged = hedges.load(std::memory_order_relaxed);
+      while (hedged < allowed) {
+        if (hedges.compare_exchange_weak(hedged, hedged + 1)) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> hedges{0};
+
+   private:
+    Options options_;
+    std::atomic<int64_t> delayUs_;
+
+    std::mutex mutex_;
+    std::vector<int64_t> samples_;
+    size_t next_{0};
+    size_t sinceUpdate_{0};
+    std::vector<int64_t> sorted_;
+  };
+
+  std::shared_ptr<Service<Req, Resp>> alternate_;
+  std::shared_ptr<Stats> stats_;
+};
+
+} // namespace wangle
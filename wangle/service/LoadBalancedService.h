@@ -0,0 +1,199 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/Random.h>
+#include <folly/futures/Future.h>
+#include <wangle/service/Service.h>
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <vector>
+
+namespace wangle {
+
+struct LoadBalancedServiceOptions {
+  // Weight of each new sample in an endpoint's moving average latency
+  double ewmaWeight{0.3};
+  // Consecutive failures taking an endpoint out
+  uint32_t maxFailures{3};
+  // How long an endpoint taken out gets no requests. Its next failure
+  // takes it out again, its next success puts it back for good.
+  std::chrono::milliseconds ejectionTime{10000};
+};
+
+/**
+ * A service spreading requests over several endpoints serving the same
+ * thing, e.g. a PooledClientService or a dispatcher per backend.
+ *
+ * Each request goes to the better of two endpoints drawn at random, by
+ * outstanding requests times moving average latency, so that slow or busy
+ * endpoints get less. An endpoint failing maxFailures requests in a row is
+ * taken out for ejectionTime; if every endpoint is out, all of them are
+ * tried anyway.
+ *
+ * Not thread safe: call it, update its endpoints and complete the
+ * endpoints' futures in the same thread, e.g. an IO thread.
+ */
+template <typename Req, typename Resp = Req>
+class LoadBalancedService : public Service<Req, Resp> {
+ public:
+  typedef LoadBalancedServiceOptions Options;
+
+  explicit LoadBalancedService(
+      const std::vector<std::shared_ptr<Service<Req, Resp>>>& endpoints = {},
+      Options options = Options())
+      : options_(std::move(options)) {
+    for (auto& endpoint : endpoints) {
+      addEndpoint(endpoint);
+    }
+  }
+
+  void addEndpoint(std::shared_ptr<Service<Req, Resp>> service) {
+    auto endpoint = std::make_shared<Endpoint>();
+    endpoint->service = std::move(service);
+    endpoints_.push_back(std::move(endpoint));
+  }
+
+  // Requests in flight on it still complete
+  void removeEndpoint(const std::shared_ptr<Service<Req, Resp>>& service) {
+    endpoints_.erase(
+        std::remove_if(endpoints_.begin(), endpoints_.end(),
+                       [&](const std::shared_ptr<Endpoint>& e) {
+                         return e->service == service;
+                       }),
+        endpoints_.end());
+  }
+
+  size_t getNumEndpoints() const {
+    return endpoints_.size();
+  }
+
+  virtual folly::Future<Resp> operator()(Req request) override {
+    auto endpoint = pick();
+    if (!endpoint) {
+      return folly::makeFuture<Resp>(
+          std::runtime_error("no endpoint available"));
+    }
+    endpoint->outstanding++;
+    auto start = Clock::now();
+    auto options = options_;
+    return (*endpoint->service)(std::move(request)).then(
+        [endpoint, start, options](folly::Try<Resp>&& t) {
+          endpoint->outstanding--;
+          if (t.hasException()) {
+            if (++endpoint->failures >= options.maxFailures) {
+              endpoint->ejectedUntil = Clock::now() + options.ejectionTime;
+            }
+          } else {
+            endpoint->failures = 0;
+            double us = std::chrono::duration_cast<std::chrono::microseconds>(
+                Clock::now() - start).count();
+            if (endpoint->measured) {
+              endpoint->latencyUs += options.ewmaWeight *
+                (us - endpoint->latencyUs);
+            } else {
+              endpoint->latencyUs = us;
+              endpoint->measured = true;
+            }
+          }
+          return std::move(t.value());
+        });
+  }
+
+  virtual folly::Future<folly::Unit> close() override {
+    std::vector<folly::Future<folly::Unit>> closes;
+    for (auto& endpoint : endpoints_) {
+      closes.push_back(endpoint->service->close());
+    }
+    return folly::collectAll(closes).then(
+        [](const std::vector<folly::Try<folly::Unit>>&) {});
+  }
+
+  virtual bool isAvailable() override {
+    for (auto& endpoint : endpoints_) {
+      if (endpoint->service->isAvailable()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Endpoint {
+    std::shared_ptr<Service<Req, Resp>> service;
+    size_t outstanding{0};
+    double latencyUs{0};
+    bool measured{false};
+    uint32_t failures{0};
+    Clock::time_point ejectedUntil;
+  };
+
+  std::shared_ptr<Endpoint> pick() {
+    auto now = Clock::now();
+    candidates_.clear();
+    double latencySum = 0;
+    size_t measured = 0;
+    for (size_t i = 0; i < endpoints_.size(); i++) {
+      auto& endpoint = *endpoints_[i];
+      if (!endpoint.service->isAvailable()) {
+        continue;
+      }
+      if (endpoint.measured) {
+        latencySum += endpoint.latencyUs;
+        measured++;
+      }
+      if (endpoint.ejectedUntil <= now) {
+        candidates_.push_back(i);
+      }
+    }
+    if (candidates_.empty()) {
+      for (size_t i = 0; i < endpoints_.size(); i++) {
+        if (endpoints_[i]->service->isAvailable()) {
+          candidates_.push_back(i);
+        }
+      }
+    }
+    if (candidates_.empty()) {
+      return nullptr;
+    }
+
+    // Endpoints not heard from yet are taken to be as fast as the others
+    const double defaultLatency = measured ? latencySum / measured : 1;
+    auto cost = [defaultLatency](const Endpoint& e) {
+      return (e.outstanding + 1) *
+        std::max(e.measured ? e.latencyUs : defaultLatency, 1.0);
+    };
+    const auto n = uint32_t(candidates_.size());
+    auto a = folly::Random::rand32(n);
+    if (n == 1) {
+      return endpoints_[candidates_[a]];
+    }
+    // Any other one
+    auto b = folly::Random::rand32(n - 1);
+    if (b >= a) {
+      b++;
+    }
+    auto& first = endpoints_[candidates_[a]];
+    auto& second = endpoints_[candidates_[b]];
+    return cost(*first) <= cost(*second) ? first : second;
+  }
+
+  Options options_;
+  std::vector<std::shared_ptr<Endpoint>> endpoints_;
+  // Indices in endpoints_, kept around so that picking doesn't allocate
+  std::vector<size_t> candidates_;
+};
+
+} // namespace wangle
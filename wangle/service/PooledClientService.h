@@ -0,0 +1,78 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/MoveWrapper.h>
+#include <wangle/bootstrap/ClientConnectionPool.h>
+#include <wangle/service/ClientDispatcher.h>
+#include <wangle/service/Service.h>
+
+namespace wangle {
+
+/**
+ * A client Service sending each request on a connection leased from a
+ * ClientConnectionPool, until its response arrives. A leased connection
+ * carries one request at a time, so SerialClientDispatcher is enough; pass
+ * PipelinedClientDispatcher if the pipeline expects it. A connection whose
+ * request failed is closed rather than reused.
+ *
+ * Must be called in the thread of the pool's EventBase.
+ */
+template <typename Pipeline, typename Req, typename Resp = Req,
+          typename Dispatcher = SerialClientDispatcher<Pipeline, Req, Resp>>
+class PooledClientService : public Service<Req, Resp> {
+  typedef typename ClientConnectionPool<Pipeline>::Lease Lease;
+
+ public:
+  PooledClientService(
+      std::shared_ptr<ClientConnectionPool<Pipeline>> pool,
+      const folly::SocketAddress& address,
+      const std::string& serverName = "")
+    : pool_(pool),
+      address_(address),
+      serverName_(serverName) {}
+
+  virtual folly::Future<Resp> operator()(Req request) override {
+    auto req = folly::makeMoveWrapper(std::move(request));
+    return pool_->get(address_, serverName_).then(
+      [req](Lease lease) mutable {
+        auto call = std::make_shared<Call>();
+        call->lease = std::move(lease);
+        call->dispatcher.reset(new Dispatcher());
+        call->dispatcher->setPipeline(call->lease.get());
+        return (*call->dispatcher)(std::move(*req)).then(
+          [call](folly::Try<Resp>&& t) {
+            call->reuse = t.hasValue();
+            return std::move(t.value());
+          });
+      });
+  }
+
+ private:
+  struct Call {
+    Lease lease;
+    std::unique_ptr<Dispatcher> dispatcher;
+    bool reuse{true};
+
+    ~Call() {
+      // Out of the pipeline before it goes back to the pool
+      dispatcher.reset();
+      if (!reuse) {
+        lease.discard();
+      }
+    }
+  };
+
+  std::shared_ptr<ClientConnectionPool<Pipeline>> pool_;
+  folly::SocketAddress address_;
+  std::string serverName_;
+};
+
+} // namespace wangle
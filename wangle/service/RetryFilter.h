@@ -0,0 +1,183 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/Random.h>
+#include <folly/futures/Future.h>
+#include <folly/io/async/EventBaseManager.h>
+#include <wangle/service/Deadline.h>
+#include <wangle/service/Service.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+namespace wangle {
+
+struct RetryFilterOptions {
+  // Retries of a request at most, on top of the first attempt
+  uint32_t maxRetries{2};
+  // Retries earned by each successful request
+  double budgetRatio{0.1};
+  // Retries saved up at most, which the budget also starts with, so that a
+  // client that just started can retry a little
+  uint32_t maxBudget{10};
+  // Retry n waits a random time up to min(maxBackoff, baseBackoff * 2^n)
+  std::chrono::milliseconds baseBackoff{10};
+  std::chrono::milliseconds maxBackoff{1000};
+  // Which failures are worth retrying; all of them if not set
+  std::function<bool(const folly::exception_wrapper&)> retryable;
+};
+
+/**
+ * A service filter retrying failed requests, within a budget: retries are
+ * paid for by successful requests, budgetRatio of a retry each, so that
+ * when a backend is failing, retries stay a small fraction of the traffic
+ * instead of multiplying it. A failure the budget can't pay for is
+ * returned as is.
+ *
+ * Retries wait a jittered exponential backoff on the timers of the
+ * caller's EventBase; outside an EventBase thread they go right away.
+ * Requests are not retried past their RequestDeadline, which is set again
+ * for each attempt.
+ * Req must be copyable. Thread safe.
+ */
+template <typename Req, typename Resp = Req>
+class RetryFilter : public ServiceFilter<Req, Resp> {
+ public:
+  typedef RetryFilterOptions Options;
+
+  explicit RetryFilter(std::shared_ptr<Service<Req, Resp>> service,
+                       Options options = Options())
+      : ServiceFilter<Req, Resp>(service),
+        shared_(std::make_shared<Shared>(service, std::move(options))) {}
+
+  virtual folly::Future<Resp> operator()(Req req) override {
+    auto call = std::make_shared<Call>(std::move(req));
+    call->shared = shared_;
+    call->evb = folly::EventBaseManager::get()->getExistingEventBase();
+    call->deadline = RequestDeadline::current();
+    auto future = call->promise.getFuture();
+    attempt(call);
+    return future;
+  }
+
+  uint64_t getNumRetries() const {
+    return shared_->retries.load(std::memory_order_relaxed);
+  }
+
+  // Retries not made for lack of budget
+  uint64_t getNumSuppressed() const {
+    return shared_->suppressed.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // Budgets are counted in thousandths of a retry
+  static constexpr int64_t kRetryCost = 1000;
+
+  // Shared with the calls, which can outlive the filter
+  struct Shared {
+    Shared(std::shared_ptr<Service<Req, Resp>> s, Options o)
+        : service(std::move(s)),
+          options(std::move(o)),
+          budget(int64_t(options.maxBudget) * kRetryCost) {}
+
+    void deposit() {
+      const int64_t max = int64_t(options.maxBudget) * kRetryCost;
+      const auto amount = int64_t(options.budgetRatio * kRetryCost);
+      auto current = budget.load(std::memory_order_relaxed);
+      while (current < max &&
+             !budget.compare_exchange_weak(
+               current, std::min(max, current + amount))) {
+      }
+    }
+
+    bool withdraw() {
+      auto current = budget.load(std::memory_order_relaxed);
+      while (current >= kRetryCost) {
+        if (budget.compare_exchange_weak(current, current - kRetryCost)) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    const std::shared_ptr<Service<Req, Resp>> service;
+    const Options options;
+    std::atomic<int64_t> budget;
+    std::atomic<uint64_t> retries{0};
+    std::atomic<uint64_t> suppressed{0};
+  };
+
+  struct Call {
+    explicit Call(Req req) : request(std::move(req)) {}
+
+    Req request;
+    folly::Promise<Resp> promise;
+    std::shared_ptr<Shared> shared;
+    folly::EventBase* evb{nullptr};
+    RequestDeadline::Clock::time_point deadline;
+    uint32_t retries{0};
+  };
+
+  static void attempt(std::shared_ptr<Call> call) {
+    RequestDeadline::Scope scope(call->deadline);
+    (*call->shared->service)(Req(call->request)).then(
+      [call](folly::Try<Resp>&& t) {
+        auto& shared = *call->shared;
+        if (t.hasValue()) {
+          shared.deposit();
+          call->promise.setTry(std::move(t));
+          return;
+        }
+        const auto& options = shared.options;
+        if (call->retries >= options.maxRetries ||
+            (options.retryable && !options.retryable(t.exception()))) {
+          call->promise.setTry(std::move(t));
+          return;
+        }
+        uint32_t delay = 0;
+        if (call->evb) {
+          auto cap = std::min<int64_t>(
+            options.maxBackoff.count(),
+            options.baseBackoff.count() << std::min(call->retries, 30u));
+          delay = folly::Random::rand32(
+            uint32_t(std::max<int64_t>(0, cap)) + 1);
+        }
+        // A retry that would start past the deadline isn't worth it
+        if (RequestDeadline::Clock::now() + std::chrono::milliseconds(delay) >=
+            call->deadline) {
+          call->promise.setTry(std::move(t));
+          return;
+        }
+        if (!shared.withdraw()) {
+          shared.suppressed.fetch_add(1, std::memory_order_relaxed);
+          call->promise.setTry(std::move(t));
+          return;
+        }
+        shared.retries.fetch_add(1, std::memory_order_relaxed);
+        call->retries++;
+        if (delay == 0) {
+          attempt(call);
+          return;
+        }
+        call->evb->runAfterDelay([call]() { attempt(call); }, delay);
+      });
+  }
+
+  std::shared_ptr<Shared> shared_;
+};
+
+template <typename Req, typename Resp>
+constexpr int64_t RetryFilter<Req, Resp>::kRetryCost;
+
+} // namespace wangle
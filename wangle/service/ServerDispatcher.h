@@ -10,14 +10,50 @@
 
 #pragma once
 
+#include <folly/Executor.h>
+#include <folly/MoveWrapper.h>
+#include <folly/Optional.h>
 #include <wangle/channel/Handler.h>
+#include <wangle/concurrent/RequestTrace.h>
 #include <wangle/service/Service.h>
+#include <wangle/service/StreamingService.h>
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
 namespace wangle {
 
+namespace detail {
+
+// Removes and returns the RequestTrace of the request, or 0 if untraced;
+// a lookup only while some request is traced
+inline uint64_t takeTrace(
+    std::unordered_map<uint32_t, uint64_t>& traces,
+    uint32_t requestId) {
+  if (LIKELY(traces.empty())) {
+    return 0;
+  }
+  auto it = traces.find(requestId);
+  if (it == traces.end()) {
+    return 0;
+  }
+  const auto traceId = it->second;
+  traces.erase(it);
+  return traceId;
+}
+
+} // namespace detail
+
 /**
- * Dispatch requests from pipeline one at a time synchronously.
- * Concurrent requests are queued in the pipeline.
+ * Dispatch requests from pipeline one at a time.
+ * Reads are paused while a request is in flight and resumed once its
+ * response is written, so the IO thread never waits on the service.
+ * Requests decoded before the pause took effect are queued here.
+ * The connection is closed if the service fails: the responses after the
+ * missing one would be taken for it.
  */
 template <typename Req, typename Resp = Req>
 class SerialServerDispatcher : public HandlerAdapter<Req, Resp> {
@@ -26,21 +62,100 @@ class SerialServerDispatcher : public HandlerAdapter<Req, Resp> {
   typedef typename HandlerAdapter<Req, Resp>::Context Context;
 
   explicit SerialServerDispatcher(Service<Req, Resp>* service)
-      : service_(service) {}
+      : service_(service), alive_(std::make_shared<bool>(true)) {}
 
   void read(Context* ctx, Req in) override {
-    auto resp = (*service_)(std::move(in)).get();
-    ctx->fireWrite(std::move(resp));
+    if (inFlight_) {
+      queue_.push_back(std::move(in));
+      return;
+    }
+    inFlight_ = true;
+    ctx->getPipeline()->requestStarted();
+    ctx->pauseRead();
+    dispatch(ctx, std::move(in));
+  }
+
+  folly::Future<folly::Unit> close(Context* ctx) override {
+    reset();
+    return ctx->fireClose();
+  }
+
+  void detachPipeline(Context* /*ctx*/) override {
+    // Reads needn't be resumed on a pipeline going away
+    inFlight_ = false;
+    reset();
   }
 
  private:
+  void dispatch(Context* ctx, Req in) {
+    const auto traceId = RequestTrace::current();
+    RequestTrace::record("dispatched");
+    auto transport = ctx->getTransport();
+    auto evb = transport ? transport->getEventBase() : nullptr;
+    auto future = (*service_)(std::move(in));
+    if (evb) {
+      // The service may complete in another thread
+      future = std::move(future).via(evb);
+    }
+    std::weak_ptr<bool> alive = alive_;
+    const auto epoch = epoch_;
+    future.then([this, alive, epoch, traceId](folly::Try<Resp>&& resp) {
+      if (alive.expired() || epoch != epoch_) {
+        return;
+      }
+      auto ctx = this->getContext();
+      if (resp.hasException()) {
+        reset();
+        ctx->fireClose();
+        return;
+      }
+      {
+        RequestTrace::Scope scope(traceId);
+        RequestTrace::record("responded");
+        ctx->fireWrite(std::move(resp.value()));
+      }
+      if (!queue_.empty()) {
+        Req next = std::move(queue_.front());
+        queue_.pop_front();
+        dispatch(ctx, std::move(next));
+        return;
+      }
+      inFlight_ = false;
+      ctx->getPipeline()->requestFinished();
+      ctx->resumeRead();
+    });
+  }
+
+  // Drops what's in flight and queued; a late response is ignored
+  void reset() {
+    epoch_++;
+    queue_.clear();
+    if (inFlight_) {
+      inFlight_ = false;
+      if (auto ctx = this->getContext()) {
+        ctx->getPipeline()->requestFinished();
+        ctx->resumeRead();
+      }
+    }
+  }
 
   Service<Req, Resp>* service_;
+  bool inFlight_{false};
+  std::deque<Req> queue_;
+  // Outlived by continuations on the service
+  std::shared_ptr<bool> alive_;
+  // Bumped by reset(), for continuations to tell they're still current
+  uint64_t epoch_{0};
 };
 
 /**
  * Dispatch requests from pipeline as they come in.
- * Responses are queued until they can be sent in order.
+ * Responses are queued until they can be sent in order, in a ring indexed
+ * by request id. Reads are paused while maxInFlight requests await their
+ * response, so a slow one can't make the queue grow without bound; if
+ * requests already read still come through, the ring grows to fit them.
+ * The connection is closed if the service fails, as in
+ * SerialServerDispatcher.
  */
 template <typename Req, typename Resp = Req>
 class PipelinedServerDispatcher : public HandlerAdapter<Req, Resp> {
@@ -48,33 +163,309 @@ class PipelinedServerDispatcher : public HandlerAdapter<Req, Resp> {
 
   typedef typename HandlerAdapter<Req, Resp>::Context Context;
 
-  explicit PipelinedServerDispatcher(Service<Req, Resp>* service)
-      : service_(service) {}
+  explicit PipelinedServerDispatcher(
+      Service<Req, Resp>* service,
+      size_t maxInFlight = 1024)
+      : service_(service),
+        maxInFlight_(std::max<size_t>(1, maxInFlight)),
+        responses_(ringSize(maxInFlight_)),
+        alive_(std::make_shared<bool>(true)) {}
 
   void read(Context* ctx, Req in) override {
     auto requestId = requestId_++;
-    (*service_)(std::move(in)).then([requestId,this](Resp& resp){
-      responses_[requestId] = resp;
+    if (inFlight() > responses_.size()) {
+      grow();
+    }
+    if (!paused_ && inFlight() >= maxInFlight_) {
+      paused_ = true;
+      ctx->pauseRead();
+    }
+    if (RequestTrace::isSet()) {
+      RequestTrace::record("dispatched");
+      traces_[requestId] = RequestTrace::current();
+    }
+    ctx->getPipeline()->requestStarted();
+    std::weak_ptr<bool> alive = alive_;
+    const auto epoch = epoch_;
+    (*service_)(std::move(in)).then(
+        [requestId, this, alive, epoch](folly::Try<Resp>&& resp) {
+      if (alive.expired() || epoch != epoch_) {
+        return;
+      }
+      slot(requestId) = std::move(resp);
       sendResponses();
     });
   }
 
+  folly::Future<folly::Unit> close(Context* ctx) override {
+    reset();
+    return ctx->fireClose();
+  }
+
+  void detachPipeline(Context* /*ctx*/) override {
+    // Reads needn't be resumed on a pipeline going away
+    paused_ = false;
+    reset();
+  }
+
   void sendResponses() {
-    auto search = responses_.find(lastWrittenId_+1);
-    while (search != responses_.end()) {
-      Resp resp = std::move(search->second);
-      responses_.erase(search->first);
-      this->getContext()->fireWrite(std::move(resp));
+    auto ctx = this->getContext();
+    auto* next = &slot(lastWrittenId_ + 1);
+    while (lastWrittenId_ + 1 != requestId_ && next->hasValue()) {
+      auto resp = std::move(next->value());
+      *next = folly::none;
+      if (resp.hasException()) {
+        // The responses after it can't be told apart from its own
+        reset();
+        ctx->fireClose();
+        return;
+      }
       lastWrittenId_++;
-      search = responses_.find(lastWrittenId_+1);
+      RequestTrace::Scope scope(detail::takeTrace(traces_, lastWrittenId_));
+      RequestTrace::record("responded");
+      ctx->getPipeline()->requestFinished();
+      ctx->fireWrite(std::move(resp.value()));
+      next = &slot(lastWrittenId_ + 1);
+    }
+    if (paused_ && inFlight() < maxInFlight_) {
+      paused_ = false;
+      ctx->resumeRead();
     }
   }
 
  private:
+  // A power of two, so that the slots stay in order as ids wrap around
+  static size_t ringSize(size_t n) {
+    size_t size = 1;
+    while (size < n) {
+      size <<= 1;
+    }
+    return size;
+  }
+
+  // Requests read whose response isn't written yet
+  uint32_t inFlight() const {
+    return requestId_ - 1 - lastWrittenId_;
+  }
+
+  folly::Optional<folly::Try<Resp>>& slot(uint32_t requestId) {
+    return responses_[requestId & (responses_.size() - 1)];
+  }
+
+  void grow() {
+    std::vector<folly::Optional<folly::Try<Resp>>> ring(
+      responses_.size() * 2);
+    for (uint32_t id = lastWrittenId_ + 1; id != requestId_; id++) {
+      ring[id & (ring.size() - 1)] = std::move(slot(id));
+    }
+    responses_ = std::move(ring);
+  }
+
+  // Drops what's in flight; late responses are ignored
+  void reset() {
+    epoch_++;
+    traces_.clear();
+    for (auto& r : responses_) {
+      r = folly::none;
+    }
+    auto ctx = this->getContext();
+    if (ctx && inFlight() > 0) {
+      ctx->getPipeline()->requestFinished(inFlight());
+    }
+    lastWrittenId_ = requestId_ - 1;
+    if (paused_) {
+      paused_ = false;
+      if (ctx) {
+        ctx->resumeRead();
+      }
+    }
+  }
+
   Service<Req, Resp>* service_;
+  const size_t maxInFlight_;
   uint32_t requestId_{1};
-  std::unordered_map<uint32_t, Resp> responses_;
+  std::vector<folly::Optional<folly::Try<Resp>>> responses_;
   uint32_t lastWrittenId_{0};
+  bool paused_{false};
+  // The RequestTrace of the traced requests in flight, by request id
+  std::unordered_map<uint32_t, uint64_t> traces_;
+  // Outlived by continuations on the service
+  std::shared_ptr<bool> alive_;
+  // Bumped by reset(), for continuations to tell they're still current
+  uint64_t epoch_{0};
+};
+
+/**
+ * Dispatch up to window requests of the pipeline at once on executor, a
+ * CPU pool, and write their responses in order, for protocols without
+ * sequence ids that still want a connection's requests to run in
+ * parallel. Responses wait for those before them in a ring of window
+ * slots, which never grows: reads are paused while window requests are
+ * in flight, and requests decoded before the pause took effect wait for a
+ * slot here, undispatched. Their continuations run on the transport's
+ * EventBase. The connection is closed if the service fails, as in
+ * SerialServerDispatcher.
+ */
+template <typename Req, typename Resp = Req>
+class ParallelServerDispatcher : public HandlerAdapter<Req, Resp> {
+ public:
+  typedef typename HandlerAdapter<Req, Resp>::Context Context;
+
+  ParallelServerDispatcher(
+      Service<Req, Resp>* service,
+      std::shared_ptr<folly::Executor> executor,
+      size_t window = 16)
+      : service_(service),
+        executor_(std::move(executor)),
+        window_(std::max<size_t>(1, window)),
+        responses_(ringSize(window_)),
+        alive_(std::make_shared<bool>(true)) {}
+
+  // Requests dispatched whose response isn't written yet
+  size_t getNumInFlight() const {
+    return inFlight();
+  }
+
+  // Requests read waiting for a slot in the window
+  size_t getNumQueued() const {
+    return queue_.size();
+  }
+
+  void read(Context* ctx, Req in) override {
+    if (inFlight() >= window_) {
+      queue_.push_back(std::move(in));
+      return;
+    }
+    dispatch(ctx, std::move(in));
+  }
+
+  folly::Future<folly::Unit> close(Context* ctx) override {
+    reset();
+    return ctx->fireClose();
+  }
+
+  void detachPipeline(Context* /*ctx*/) override {
+    // Reads needn't be resumed on a pipeline going away
+    paused_ = false;
+    reset();
+  }
+
+ private:
+  static size_t ringSize(size_t n) {
+    size_t size = 1;
+    while (size < n) {
+      size <<= 1;
+    }
+    return size;
+  }
+
+  uint32_t inFlight() const {
+    return requestId_ - 1 - lastWrittenId_;
+  }
+
+  folly::Optional<folly::Try<Resp>>& slot(uint32_t requestId) {
+    return responses_[requestId & (responses_.size() - 1)];
+  }
+
+  void dispatch(Context* ctx, Req in) {
+    const auto requestId = requestId_++;
+    ctx->getPipeline()->requestStarted();
+    if (!paused_ && inFlight() >= window_) {
+      paused_ = true;
+      ctx->pauseRead();
+    }
+    auto transport = ctx->getTransport();
+    auto evb = transport ? transport->getEventBase() : nullptr;
+    auto service = service_;
+    auto req = folly::makeMoveWrapper(std::move(in));
+    const auto traceId = RequestTrace::current();
+    if (traceId != 0) {
+      RequestTrace::record("dispatched");
+      traces_[requestId] = traceId;
+    }
+    auto future = folly::via(executor_.get()).then(
+        [service, req, traceId]() mutable {
+      RequestTrace::Scope scope(traceId);
+      return (*service)(std::move(*req));
+    });
+    if (evb) {
+      future = std::move(future).via(evb);
+    }
+    std::weak_ptr<bool> alive = alive_;
+    const auto epoch = epoch_;
+    future.then([this, alive, epoch, requestId](folly::Try<Resp>&& resp) {
+      if (alive.expired() || epoch != epoch_) {
+        return;
+      }
+      slot(requestId) = std::move(resp);
+      sendResponses();
+    });
+  }
+
+  void sendResponses() {
+    auto ctx = this->getContext();
+    auto* next = &slot(lastWrittenId_ + 1);
+    while (inFlight() > 0 && next->hasValue()) {
+      auto resp = std::move(next->value());
+      *next = folly::none;
+      if (resp.hasException()) {
+        reset();
+        ctx->fireClose();
+        return;
+      }
+      lastWrittenId_++;
+      RequestTrace::Scope scope(detail::takeTrace(traces_, lastWrittenId_));
+      RequestTrace::record("responded");
+      ctx->getPipeline()->requestFinished();
+      ctx->fireWrite(std::move(resp.value()));
+      next = &slot(lastWrittenId_ + 1);
+    }
+    while (!queue_.empty() && inFlight() < window_) {
+      Req in = std::move(queue_.front());
+      queue_.pop_front();
+      dispatch(ctx, std::move(in));
+    }
+    if (paused_ && inFlight() < window_) {
+      paused_ = false;
+      ctx->resumeRead();
+    }
+  }
+
+  // Drops what's in flight and queued; late responses are ignored
+  void reset() {
+    epoch_++;
+    queue_.clear();
+    traces_.clear();
+    for (auto& r : responses_) {
+      r = folly::none;
+    }
+    auto ctx = this->getContext();
+    if (ctx && inFlight() > 0) {
+      ctx->getPipeline()->requestFinished(inFlight());
+    }
+    lastWrittenId_ = requestId_ - 1;
+    if (paused_) {
+      paused_ = false;
+      if (ctx) {
+        ctx->resumeRead();
+      }
+    }
+  }
+
+  Service<Req, Resp>* service_;
+  std::shared_ptr<folly::Executor> executor_;
+  const size_t window_;
+  uint32_t requestId_{1};
+  uint32_t lastWrittenId_{0};
+  std::vector<folly::Optional<folly::Try<Resp>>> responses_;
+  std::deque<Req> queue_;
+  bool paused_{false};
+  // The RequestTrace of the traced requests in flight, by request id
+  std::unordered_map<uint32_t, uint64_t> traces_;
+  // Outlived by continuations on the service
+  std::shared_ptr<bool> alive_;
+  // Bumped by reset(), for continuations to tell they're still current
+  uint64_t epoch_{0};
 };
 
 /**
@@ -94,8 +485,17 @@ class MultiplexServerDispatcher : public HandlerAdapter<Req, Resp> {
       : service_(service) {}
 
   void read(Context* ctx, Req in) override {
-    (*service_)(std::move(in)).then([ctx](Resp resp) {
-      ctx->fireWrite(std::move(resp));
+    const auto traceId = RequestTrace::current();
+    RequestTrace::record("dispatched");
+    ctx->getPipeline()->requestStarted();
+    (*service_)(std::move(in)).then([ctx, traceId](folly::Try<Resp>&& resp) {
+      ctx->getPipeline()->requestFinished();
+      if (resp.hasException()) {
+        return;
+      }
+      RequestTrace::Scope scope(traceId);
+      RequestTrace::record("responded");
+      ctx->fireWrite(std::move(resp.value()));
     });
   }
 
@@ -103,4 +503,207 @@ class MultiplexServerDispatcher : public HandlerAdapter<Req, Resp> {
   Service<Req, Resp>* service_;
 };
 
+/**
+ * Dispatch requests to a streaming service one at a time, writing each
+ * response as DATA frames followed by an END frame, or a FAILED one if the
+ * service or its stream fails. Chunks are pulled from the stream only
+ * while the pipeline is writable (see
+ * PipelineBase::setWriteBufferWatermarks()), or, without watermarks, once
+ * the previous chunk is written, so a response of any size is sent in
+ * constant memory and its first bytes go out as soon as they are
+ * produced. Reads are paused while a response is being sent, as in
+ * SerialServerDispatcher. The stream is cancelled if the connection goes
+ * away first.
+ */
+template <typename Req, typename Chunk>
+class StreamingServerDispatcher
+    : public HandlerAdapter<Req, StreamFrame<Chunk>> {
+ public:
+  typedef typename HandlerAdapter<Req, StreamFrame<Chunk>>::Context Context;
+  typedef std::shared_ptr<ResponseStream<Chunk>> StreamPtr;
+
+  explicit StreamingServerDispatcher(StreamingService<Req, Chunk>* service)
+      : service_(service),
+        alive_(std::make_shared<bool>(true)) {}
+
+  ~StreamingServerDispatcher() {
+    if (stream_) {
+      stream_->cancel();
+    }
+  }
+
+  void read(Context* ctx, Req in) override {
+    if (inFlight_) {
+      queue_.push_back(std::move(in));
+      return;
+    }
+    inFlight_ = true;
+    ctx->getPipeline()->requestStarted();
+    ctx->pauseRead();
+    dispatch(std::move(in));
+  }
+
+  void readException(Context* ctx, folly::exception_wrapper e) override {
+    stop();
+    ctx->fireReadException(std::move(e));
+  }
+
+  void transportInactive(Context* ctx) override {
+    stop();
+    ctx->fireTransportInactive();
+  }
+
+  void writabilityChanged(Context* ctx, bool writable) override {
+    ctx->fireWritabilityChanged(writable);
+    if (writable) {
+      pump();
+    }
+  }
+
+  folly::Future<folly::Unit> close(Context* ctx) override {
+    stop();
+    return ctx->fireClose();
+  }
+
+  void detachPipeline(Context* /*ctx*/) override {
+    // Reads needn't be resumed on a pipeline going away
+    inFlight_ = false;
+    stop();
+  }
+
+ private:
+  void dispatch(Req in) {
+    waiting_ = true;
+    std::weak_ptr<bool> alive = alive_;
+    const auto epoch = epoch_;
+    (*service_)(std::move(in)).then(
+        [this, alive, epoch](folly::Try<StreamPtr>&& stream) {
+      if (alive.expired() || epoch != epoch_) {
+        if (stream.hasValue() && stream.value()) {
+          stream.value()->cancel();
+        }
+        return;
+      }
+      waiting_ = false;
+      if (stream.hasException()) {
+        finish(StreamFrame<Chunk>::failed(
+            stream.exception().what().c_str()));
+        return;
+      }
+      stream_ = std::move(stream.value());
+      if (!stream_) {
+        finish(StreamFrame<Chunk>::end());
+        return;
+      }
+      pump();
+    });
+  }
+
+  // Pulls and writes chunks until the stream, the pipeline or the write of
+  // the last chunk has to be waited for
+  void pump() {
+    while (stream_ && !waiting_) {
+      if (!this->getContext()->getPipeline()->isWritable()) {
+        // Until writabilityChanged()
+        return;
+      }
+      auto next = stream_->next();
+      if (!next.isReady()) {
+        waiting_ = true;
+        std::weak_ptr<bool> alive = alive_;
+        const auto epoch = epoch_;
+        next.then([this, alive, epoch](
+            folly::Try<folly::Optional<Chunk>>&& chunk) {
+          if (alive.expired() || epoch != epoch_) {
+            return;
+          }
+          waiting_ = false;
+          onChunk(std::move(chunk));
+          pump();
+        });
+        return;
+      }
+      onChunk(std::move(next.getTry()));
+    }
+  }
+
+  void onChunk(folly::Try<folly::Optional<Chunk>>&& chunk) {
+    if (chunk.hasException()) {
+      finish(StreamFrame<Chunk>::failed(chunk.exception().what().c_str()));
+      return;
+    }
+    if (!chunk.value()) {
+      finish(StreamFrame<Chunk>::end());
+      return;
+    }
+    auto ctx = this->getContext();
+    auto written = ctx->fireWrite(
+        StreamFrame<Chunk>::data(std::move(*chunk.value())));
+    if (ctx->getPipeline()->getWriteBufferWatermarks().second != 0 ||
+        written.isReady()) {
+      if (written.hasException()) {
+        stop();
+      }
+      return;
+    }
+    waiting_ = true;
+    std::weak_ptr<bool> alive = alive_;
+    const auto epoch = epoch_;
+    written.then([this, alive, epoch](folly::Try<folly::Unit>&& t) {
+      if (alive.expired() || epoch != epoch_) {
+        return;
+      }
+      waiting_ = false;
+      if (t.hasException()) {
+        stop();
+        return;
+      }
+      pump();
+    });
+  }
+
+  void finish(StreamFrame<Chunk> frame) {
+    stream_.reset();
+    auto ctx = this->getContext();
+    ctx->fireWriteNoFuture(std::move(frame));
+    if (!queue_.empty()) {
+      Req next = std::move(queue_.front());
+      queue_.pop_front();
+      dispatch(std::move(next));
+      return;
+    }
+    inFlight_ = false;
+    ctx->getPipeline()->requestFinished();
+    ctx->resumeRead();
+  }
+
+  // Drops the response being sent and the requests behind it
+  void stop() {
+    epoch_++;
+    waiting_ = false;
+    queue_.clear();
+    if (stream_) {
+      auto stream = std::move(stream_);
+      stream->cancel();
+    }
+    if (inFlight_) {
+      inFlight_ = false;
+      if (auto ctx = this->getContext()) {
+        ctx->getPipeline()->requestFinished();
+        ctx->resumeRead();
+      }
+    }
+  }
+
+  StreamingService<Req, Chunk>* service_;
+  // Outlived by continuations on the service and its streams
+  std::shared_ptr<bool> alive_;
+  // Of the response being sent, for continuations to tell it's still theirs
+  uint64_t epoch_{0};
+  bool inFlight_{false};
+  bool waiting_{false};
+  StreamPtr stream_;
+  std::deque<Req> queue_;
+};
+
 } // namespace wangle
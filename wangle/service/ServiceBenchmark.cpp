@@ -0,0 +1,212 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// Runs an echo client and server over loopback TCP, through the client and
+// server dispatchers, keeping --depth requests in flight, and reports the
+// requests per second and latency percentiles for each dispatcher pair,
+// depth and payload size.
+
+#include <folly/Baton.h>
+#include <folly/Conv.h>
+#include <folly/String.h>
+#include <gflags/gflags.h>
+#include <wangle/bootstrap/ClientBootstrap.h>
+#include <wangle/bootstrap/ServerBootstrap.h>
+#include <wangle/channel/AsyncSocketHandler.h>
+#include <wangle/channel/EventBaseHandler.h>
+#include <wangle/codec/LengthFieldBasedFrameDecoder.h>
+#include <wangle/codec/LengthFieldPrepender.h>
+#include <wangle/codec/StringCodec.h>
+#include <wangle/concurrent/LatencyHistogram.h>
+#include <wangle/service/ClientDispatcher.h>
+#include <wangle/service/ServerDispatcher.h>
+
+#include <chrono>
+#include <vector>
+
+DEFINE_int32(requests, 100000, "Requests per run");
+DEFINE_string(depths, "1,8,64", "Requests kept in flight, comma separated");
+DEFINE_string(payloads, "16,1024,16384", "Payload sizes, comma separated");
+
+using namespace wangle;
+using folly::AsyncTransportWrapper;
+using folly::Future;
+using folly::IOBufQueue;
+using folly::SocketAddress;
+
+namespace {
+
+typedef Pipeline<IOBufQueue&, std::string> StringPipeline;
+
+class EchoService : public Service<std::string, std::string> {
+ public:
+  Future<std::string> operator()(std::string req) override {
+    return req;
+  }
+};
+
+void addCodec(StringPipeline* pipeline) {
+  pipeline->addBack(EventBaseHandler());
+  pipeline->addBack(LengthFieldBasedFrameDecoder());
+  pipeline->addBack(LengthFieldPrepender());
+  pipeline->addBack(StringCodec());
+}
+
+template <typename Dispatcher>
+class ServerPipelineFactory : public PipelineFactory<StringPipeline> {
+ public:
+  StringPipeline::Ptr newPipeline(
+      std::shared_ptr<AsyncTransportWrapper> sock) override {
+    auto pipeline = StringPipeline::create();
+    pipeline->addBack(AsyncSocketHandler(sock));
+    addCodec(pipeline.get());
+    pipeline->addBack(Dispatcher(&service_));
+    pipeline->finalize();
+    return pipeline;
+  }
+
+ private:
+  EchoService service_;
+};
+
+class ClientPipelineFactory : public PipelineFactory<StringPipeline> {
+ public:
+  StringPipeline::Ptr newPipeline(
+      std::shared_ptr<AsyncTransportWrapper> sock) override {
+    auto pipeline = StringPipeline::create();
+    pipeline->addBack(AsyncSocketHandler(sock));
+    addCodec(pipeline.get());
+    pipeline->finalize();
+    return pipeline;
+  }
+};
+
+// Keeps depth requests in flight until total have been answered, in the
+// client's IO thread
+template <typename Dispatcher>
+class Load {
+ public:
+  Load(Dispatcher* dispatcher, size_t depth, size_t payload, size_t total)
+      : dispatcher_(dispatcher),
+        depth_(depth),
+        payload_(payload, 'x'),
+        total_(total) {}
+
+  void start() {
+    for (size_t i = 0; i < depth_ && sent_ < total_; i++) {
+      send();
+    }
+  }
+
+  void wait() {
+    done_.wait();
+  }
+
+  const LatencyHistogram& getLatency() const {
+    return latency_;
+  }
+
+ private:
+  void send() {
+    sent_++;
+    auto start = std::chrono::steady_clock::now();
+    (*dispatcher_)(payload_).then([this, start](std::string) {
+      latency_.add(std::chrono::steady_clock::now() - start);
+      if (++received_ == total_) {
+        done_.post();
+      } else if (sent_ < total_) {
+        send();
+      }
+    });
+  }
+
+  Dispatcher* dispatcher_;
+  const size_t depth_;
+  const std::string payload_;
+  const size_t total_;
+  size_t sent_{0};
+  size_t received_{0};
+  LatencyHistogram latency_;
+  folly::Baton<> done_;
+};
+
+template <typename ClientDispatcher, typename ServerDispatcher>
+void run(const char* name, size_t depth, size_t payload) {
+  ServerBootstrap<StringPipeline> server;
+  server.childPipeline(
+      std::make_shared<ServerPipelineFactory<ServerDispatcher>>());
+  server.group(std::make_shared<IOThreadPoolExecutor>(1));
+  server.bind(0);
+  SocketAddress address;
+  server.getSockets()[0]->getAddress(&address);
+
+  ClientBootstrap<StringPipeline> client;
+  auto clientThread = std::make_shared<IOThreadPoolExecutor>(1);
+  client.group(clientThread);
+  client.pipelineFactory(std::make_shared<ClientPipelineFactory>());
+  auto pipeline = client.connect(address).get();
+
+  ClientDispatcher dispatcher;
+  Load<ClientDispatcher> load(
+      &dispatcher, depth, payload, size_t(FLAGS_requests));
+  auto evb = clientThread->getEventBase();
+  auto start = std::chrono::steady_clock::now();
+  evb->runInEventBaseThread([&] {
+    dispatcher.setPipeline(pipeline);
+    load.start();
+  });
+  load.wait();
+  auto elapsed = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start);
+
+  auto& latency = load.getLatency();
+  auto us = [&](double pct) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        latency.getPercentile(pct)).count();
+  };
+  printf("%-10s depth %4zu payload %6zu: %9.0f qps, "
+         "p50 %6ldus p99 %6ldus p99.9 %6ldus\n",
+         name, depth, payload, FLAGS_requests / elapsed.count(),
+         long(us(50)), long(us(99)), long(us(99.9)));
+
+  evb->runInEventBaseThreadAndWait([&] {
+    pipeline->close();
+  });
+  server.stop();
+  server.join();
+}
+
+std::vector<size_t> parseSizes(const std::string& list) {
+  std::vector<folly::StringPiece> pieces;
+  folly::split(',', list, pieces);
+  std::vector<size_t> sizes;
+  for (auto& piece : pieces) {
+    sizes.push_back(folly::to<size_t>(piece));
+  }
+  return sizes;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  for (auto payload : parseSizes(FLAGS_payloads)) {
+    // One request at a time is all a serial dispatcher takes
+    run<SerialClientDispatcher<StringPipeline, std::string>,
+        SerialServerDispatcher<std::string>>("serial", 1, payload);
+    for (auto depth : parseSizes(FLAGS_depths)) {
+      run<PipelinedClientDispatcher<StringPipeline, std::string>,
+          PipelinedServerDispatcher<std::string>>(
+          "pipelined", depth, payload);
+    }
+  }
+  return 0;
+}
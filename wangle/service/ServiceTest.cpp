@@ -10,13 +10,34 @@
 
 #include <gtest/gtest.h>
 
+#include <folly/futures/ManualExecutor.h>
+#include <wangle/channel/OutputBufferingHandler.h>
+#include <wangle/channel/RequestTraceHandler.h>
+#include <wangle/codec/LineBasedFrameDecoder.h>
 #include <wangle/codec/StringCodec.h>
 #include <wangle/codec/ByteToMessageDecoder.h>
+#include <wangle/service/BatchingFilter.h>
+#include <wangle/service/CachingFilter.h>
 #include <wangle/service/ClientDispatcher.h>
 #include <wangle/service/ServerDispatcher.h>
 #include <wangle/service/Service.h>
 #include <wangle/service/CloseOnReleaseFilter.h>
+#include <wangle/service/ConcurrencyLimitFilter.h>
+#include <wangle/service/Deadline.h>
+#include <wangle/service/ExecutorFilter.h>
 #include <wangle/service/ExpiringFilter.h>
+#include <wangle/service/FiberService.h>
+#include <wangle/service/HedgingFilter.h>
+#include <wangle/service/LoadBalancedService.h>
+#include <wangle/service/RetryFilter.h>
+#include <wangle/service/StatsFilter.h>
+#include <wangle/service/StreamingService.h>
+
+#include <deque>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
 
 namespace wangle {
 
@@ -106,20 +127,20 @@ class ClientServiceFactory : public ServiceFactory<Pipeline, Req, Resp> {
 };
 
 TEST(Wangle, ClientServerTest) {
-  int port = 1234;
   // server
 
   ServerBootstrap<ServicePipeline> server;
   server.childPipeline(
     std::make_shared<ServerPipelineFactory<std::string, std::string>>());
-  server.bind(port);
+  server.bind(0);
+  SocketAddress addr;
+  server.getSockets()[0]->getAddress(&addr);
 
   // client
   auto client = std::make_shared<ClientBootstrap<ServicePipeline>>();
   ClientServiceFactory<ServicePipeline, std::string, std::string> serviceFactory;
   client->pipelineFactory(
     std::make_shared<ClientPipelineFactory<std::string, std::string>>());
-  SocketAddress addr("127.0.0.1", port);
   client->connect(addr);
   auto service = serviceFactory(client).value();
   auto rep = (*service)("test");
@@ -225,7 +246,7 @@ TEST(Wangle, ServiceFactoryFilter) {
     std::make_shared<ClientPipelineFactory<std::string, std::string>>());
   // It doesn't matter if connect succeds or not, but it needs to be called
   // to create a pipeline
-  client->connect(folly::SocketAddress("::1", 8090));
+  client->connect(folly::SocketAddress("127.0.0.1", 8090));
 
   auto service = (*countingFactory)(client).value();
 
@@ -319,6 +340,908 @@ TEST(ServiceFilter, NoIdleDuringRequests) {
   EXPECT_EQ(3, timekeeper.promises_.size());
 }
 
+TEST(ServiceFilter, ExpiringIdleOnEventBase) {
+  EventBase evb;
+  std::shared_ptr<Service<std::string, std::string>> service =
+    std::make_shared<EchoService>();
+  std::shared_ptr<Service<std::string, std::string>> closeOnReleaseService =
+    std::make_shared<CloseOnReleaseFilter<std::string, std::string>>(service);
+  ExpiringFilter<std::string, std::string> expiringService(
+    closeOnReleaseService, &evb, std::chrono::milliseconds(20));
+
+  EXPECT_EQ("test", expiringService("test").get());
+  // Runs until the idle timer closes the service
+  evb.loop();
+  EXPECT_TRUE(expiringService("test").getTry().hasException());
+}
+
+typedef Pipeline<std::string, std::string> StringPipeline;
+
+// "<id>:<payload>"
+struct PrefixIdExtractor {
+  uint64_t operator()(const std::string& msg) const {
+    return folly::to<uint64_t>(msg.substr(0, msg.find(':')));
+  }
+};
+
+class WriteCapture : public OutboundHandler<std::string> {
+ public:
+  Future<Unit> write(Context* ctx, std::string msg) override {
+    writes.push_back(std::move(msg));
+    return makeFuture();
+  }
+  std::vector<std::string> writes;
+};
+
+TEST(Wangle, MultiplexClientDispatcher) {
+  WriteCapture capture;
+  auto pipeline = StringPipeline::create();
+  pipeline->addBack(&capture);
+  pipeline->finalize();
+  MultiplexClientDispatcher<StringPipeline, std::string, std::string,
+                            PrefixIdExtractor> dispatcher;
+  dispatcher.setPipeline(pipeline.get());
+
+  auto first = dispatcher("1:slow");
+  auto second = dispatcher("2:fast");
+  EXPECT_EQ(2, capture.writes.size());
+  EXPECT_EQ(2, dispatcher.getNumPending());
+  EXPECT_TRUE(dispatcher("1:again").getTry().hasException());
+
+  // Answered out of order
+  pipeline->read(std::string("2:done"));
+  EXPECT_FALSE(first.isReady());
+  EXPECT_EQ("2:done", second.value());
+  pipeline->read(std::string("1:done"));
+  EXPECT_EQ("1:done", first.value());
+
+  // Unknown ids are dropped
+  pipeline->read(std::string("7:late"));
+  EXPECT_EQ(0, dispatcher.getNumPending());
+
+  auto third = dispatcher("3:lost");
+  pipeline->readEOF();
+  EXPECT_TRUE(third.getTry().hasException());
+  EXPECT_EQ(0, dispatcher.getNumPending());
+}
+
+class PromiseService : public Service<std::string, std::string> {
+ public:
+  Future<std::string> operator()(std::string req) override {
+    promises.emplace_back();
+    return promises.back().getFuture();
+  }
+  std::deque<Promise<std::string>> promises;
+};
+
+TEST(Wangle, PipelinedServerDispatcher) {
+  WriteCapture capture;
+  PromiseService service;
+  PipelinedServerDispatcher<std::string> dispatcher(&service, 2);
+  auto pipeline = StringPipeline::create();
+  pipeline->addBack(&capture);
+  pipeline->addBack(&dispatcher);
+  pipeline->finalize();
+
+  pipeline->read(std::string("a"));
+  EXPECT_FALSE(pipeline->isReadPaused());
+  pipeline->read(std::string("b"));
+  EXPECT_TRUE(pipeline->isReadPaused());
+  // Already decoded, past the window
+  pipeline->read(std::string("c"));
+
+  service.promises[2].setValue("C");
+  service.promises[1].setValue("B");
+  EXPECT_TRUE(capture.writes.empty());
+  service.promises[0].setValue("A");
+  EXPECT_EQ((std::vector<std::string>{"A", "B", "C"}), capture.writes);
+  EXPECT_FALSE(pipeline->isReadPaused());
+}
+
+TEST(Wangle, ParallelServerDispatcher) {
+  WriteCapture capture;
+  PromiseService service;
+  auto executor = std::make_shared<ManualExecutor>();
+  ParallelServerDispatcher<std::string> dispatcher(&service, executor, 2);
+  auto pipeline = StringPipeline::create();
+  pipeline->addBack(&capture);
+  pipeline->addBack(&dispatcher);
+  pipeline->finalize();
+
+  pipeline->read(std::string("a"));
+  EXPECT_FALSE(pipeline->isReadPaused());
+  pipeline->read(std::string("b"));
+  EXPECT_TRUE(pipeline->isReadPaused());
+  // Already decoded, waits for a slot
+  pipeline->read(std::string("c"));
+  EXPECT_EQ(2, dispatcher.getNumInFlight());
+  EXPECT_EQ(1, dispatcher.getNumQueued());
+
+  // Both run on the executor at once
+  executor->run();
+  ASSERT_EQ(2, service.promises.size());
+  service.promises[1].setValue("B");
+  EXPECT_TRUE(capture.writes.empty());
+  service.promises[0].setValue("A");
+  EXPECT_EQ((std::vector<std::string>{"A", "B"}), capture.writes);
+  EXPECT_EQ(1, dispatcher.getNumInFlight());
+  EXPECT_EQ(0, dispatcher.getNumQueued());
+  EXPECT_FALSE(pipeline->isReadPaused());
+
+  executor->run();
+  ASSERT_EQ(3, service.promises.size());
+  service.promises[2].setValue("C");
+  EXPECT_EQ((std::vector<std::string>{"A", "B", "C"}), capture.writes);
+  EXPECT_EQ(0, dispatcher.getNumInFlight());
+}
+
+TEST(Wangle, FiberService) {
+  auto evb = EventBaseManager::get()->getEventBase();
+  std::deque<Promise<std::string>> backends;
+  FiberService<std::string> service([&](std::string req) {
+    backends.emplace_back();
+    return req + fiberAwait(backends.back().getFuture());
+  });
+
+  WriteCapture capture;
+  PipelinedServerDispatcher<std::string> dispatcher(&service);
+  auto pipeline = StringPipeline::create();
+  pipeline->addBack(&capture);
+  pipeline->addBack(&dispatcher);
+  pipeline->finalize();
+
+  // Both wait at once, without blocking the loop
+  pipeline->read(std::string("a"));
+  pipeline->read(std::string("b"));
+  evb->loop();
+  ASSERT_EQ(2, backends.size());
+
+  backends[1].setValue("B");
+  evb->loop();
+  EXPECT_TRUE(capture.writes.empty());
+  backends[0].setValue("A");
+  evb->loop();
+  EXPECT_EQ((std::vector<std::string>{"aA", "bB"}), capture.writes);
+}
+
+TEST(Wangle, SerialServerDispatcher) {
+  WriteCapture capture;
+  PromiseService service;
+  SerialServerDispatcher<std::string> dispatcher(&service);
+  auto pipeline = StringPipeline::create();
+  pipeline->addBack(&capture);
+  pipeline->addBack(&dispatcher);
+  pipeline->finalize();
+
+  pipeline->read(std::string("a"));
+  EXPECT_TRUE(pipeline->isReadPaused());
+  // Already decoded, dispatched after the first one
+  pipeline->read(std::string("b"));
+  EXPECT_EQ(1, service.promises.size());
+
+  service.promises[0].setValue("A");
+  EXPECT_EQ(2, service.promises.size());
+  EXPECT_TRUE(pipeline->isReadPaused());
+  service.promises[1].setValue("B");
+  EXPECT_EQ((std::vector<std::string>{"A", "B"}), capture.writes);
+  EXPECT_FALSE(pipeline->isReadPaused());
+}
+
+TEST(Wangle, SerialServerDispatcherRespondsOnEventBase) {
+  auto evb = EventBaseManager::get()->getEventBase();
+  WriteCapture capture;
+  PromiseService service;
+  auto dispatcher =
+    folly::make_unique<SerialServerDispatcher<std::string>>(&service);
+  auto pipeline = StringPipeline::create();
+  pipeline->setTransport(AsyncSocket::newSocket(evb));
+  pipeline->addBack(&capture);
+  pipeline->addBack(dispatcher.get());
+  pipeline->finalize();
+
+  // Completed on another thread, written on the connection's
+  pipeline->read(std::string("a"));
+  std::thread([&] { service.promises[0].setValue("A"); }).join();
+  EXPECT_TRUE(capture.writes.empty());
+  evb->loopOnce();
+  EXPECT_EQ((std::vector<std::string>{"A"}), capture.writes);
+  EXPECT_FALSE(pipeline->isReadPaused());
+
+  // A response after the dispatcher is gone is dropped
+  pipeline->read(std::string("b"));
+  pipeline.reset();
+  dispatcher.reset();
+  service.promises[1].setValue("B");
+  evb->loopOnce(EVLOOP_NONBLOCK);
+  EXPECT_EQ(1, capture.writes.size());
+}
+
+typedef StreamFrame<std::string> StringFrame;
+
+class FrameCapture : public OutboundHandler<StringFrame> {
+ public:
+  Future<Unit> write(Context* ctx, StringFrame frame) override {
+    frames.push_back(std::move(frame));
+    return makeFuture();
+  }
+  std::vector<StringFrame> frames;
+};
+
+class QueueStreamingService
+    : public StreamingService<std::string, std::string> {
+ public:
+  Future<std::shared_ptr<ResponseStream<std::string>>> operator()(
+      std::string req) override {
+    if (req == "fail") {
+      return makeFuture<std::shared_ptr<ResponseStream<std::string>>>(
+          std::runtime_error("no such stream"));
+    }
+    streams.push_back(std::make_shared<QueueResponseStream<std::string>>());
+    return std::shared_ptr<ResponseStream<std::string>>(streams.back());
+  }
+  std::vector<std::shared_ptr<QueueResponseStream<std::string>>> streams;
+};
+
+TEST(Wangle, StreamingServerDispatcher) {
+  FrameCapture capture;
+  QueueStreamingService service;
+  StreamingServerDispatcher<std::string, std::string> dispatcher(&service);
+  auto pipeline = Pipeline<std::string, StringFrame>::create();
+  pipeline->addBack(&capture);
+  pipeline->addBack(&dispatcher);
+  pipeline->finalize();
+  pipeline->setWriteBufferWatermarks(1, 2);
+
+  // Nothing is pulled while the pipeline is unwritable
+  pipeline->setWritable(false);
+  pipeline->read(std::string("a"));
+  pipeline->read(std::string("fail"));
+  EXPECT_TRUE(pipeline->isReadPaused());
+  ASSERT_EQ(1, service.streams.size());
+  auto stream = service.streams[0];
+  stream->push("1");
+  stream->push("2");
+  EXPECT_TRUE(capture.frames.empty());
+
+  pipeline->setWritable(true);
+  pipeline->writabilityChanged(true);
+  ASSERT_EQ(2, capture.frames.size());
+  EXPECT_EQ("1", capture.frames[0].chunk);
+  EXPECT_EQ("2", capture.frames[1].chunk);
+  EXPECT_EQ(0, stream->size());
+
+  // Sent as soon as produced
+  stream->push("3");
+  EXPECT_EQ(3, capture.frames.size());
+  stream->finish();
+  ASSERT_EQ(5, capture.frames.size());
+  EXPECT_EQ(StringFrame::Type::END, capture.frames[3].type);
+  EXPECT_EQ(StringFrame::Type::FAILED, capture.frames[4].type);
+  EXPECT_EQ("no such stream", capture.frames[4].message);
+  EXPECT_FALSE(pipeline->isReadPaused());
+
+  // The stream is cancelled with the connection
+  pipeline->read(std::string("b"));
+  pipeline->transportInactive();
+  EXPECT_TRUE(service.streams[1]->isCancelled());
+  EXPECT_FALSE(pipeline->isReadPaused());
+}
+
+TEST(Wangle, StreamingClientDispatcher) {
+  typedef Pipeline<StringFrame, std::string> ClientPipeline;
+  WriteCapture capture;
+  auto pipeline = ClientPipeline::create();
+  pipeline->addBack(&capture);
+  pipeline->finalize();
+  StreamingClientDispatcher<ClientPipeline, std::string, std::string>
+    dispatcher(2);
+  dispatcher.setPipeline(pipeline.get());
+
+  auto first = dispatcher("a").value();
+  auto second = dispatcher("b").value();
+  EXPECT_EQ(2, capture.writes.size());
+
+  // Reads pause while the consumer is behind
+  pipeline->read(StringFrame::data("1"));
+  EXPECT_FALSE(pipeline->isReadPaused());
+  pipeline->read(StringFrame::data("2"));
+  EXPECT_TRUE(pipeline->isReadPaused());
+  EXPECT_EQ("1", first->next().value().value());
+  EXPECT_FALSE(pipeline->isReadPaused());
+
+  auto pending = second->next();
+  EXPECT_FALSE(pending.isReady());
+  pipeline->read(StringFrame::end());
+  EXPECT_EQ("2", first->next().value().value());
+  EXPECT_FALSE(first->next().value().hasValue());
+
+  pipeline->read(StringFrame::data("3"));
+  EXPECT_EQ("3", pending.value().value());
+  pipeline->read(StringFrame::failed("boom"));
+  EXPECT_TRUE(second->next().getTry().hasException());
+  EXPECT_EQ(0, dispatcher.getNumPending());
+
+  auto third = dispatcher("c").value();
+  pipeline->readEOF();
+  EXPECT_TRUE(third->next().getTry().hasException());
+}
+
+class DoublingBatchService
+    : public Service<std::vector<int>, std::vector<int>> {
+ public:
+  Future<std::vector<int>> operator()(std::vector<int> req) override {
+    batchSizes.push_back(req.size());
+    for (auto& i : req) {
+      i *= 2;
+    }
+    return req;
+  }
+  std::vector<size_t> batchSizes;
+};
+
+TEST(ServiceFilter, Batching) {
+  auto evb = EventBaseManager::get()->getEventBase();
+  auto service = std::make_shared<DoublingBatchService>();
+  BatchingFilter<int> filter(service, 3);
+
+  auto one = filter(1);
+  auto two = filter(2);
+  EXPECT_FALSE(one.isReady());
+  evb->loopOnce();
+  EXPECT_EQ(2, one.value());
+  EXPECT_EQ(4, two.value());
+
+  // A full batch goes right away
+  std::vector<Future<int>> futures;
+  for (int i = 0; i < 3; i++) {
+    futures.push_back(filter(i));
+  }
+  EXPECT_EQ(4, futures[2].value());
+  EXPECT_EQ((std::vector<size_t>{2, 3}), service->batchSizes);
+  evb->loopOnce(EVLOOP_NONBLOCK);
+  EXPECT_EQ(2, service->batchSizes.size());
+}
+
+class CountingService : public Service<int, int> {
+ public:
+  explicit CountingService(bool fail) : fail_(fail) {}
+  Future<int> operator()(int req) override {
+    calls++;
+    if (fail_) {
+      return makeFuture<int>(std::runtime_error("down"));
+    }
+    return req;
+  }
+  int calls{0};
+ private:
+  bool fail_;
+};
+
+TEST(Wangle, LoadBalancedService) {
+  auto good = std::make_shared<CountingService>(false);
+  auto bad = std::make_shared<CountingService>(true);
+  LoadBalancedServiceOptions options;
+  options.maxFailures = 2;
+  LoadBalancedService<int> service({good, bad}, options);
+
+  for (int i = 0; i < 50; i++) {
+    service(i);
+  }
+  // Taken out once it failed twice in a row
+  EXPECT_EQ(2, bad->calls);
+  EXPECT_EQ(48, good->calls);
+
+  service.removeEndpoint(good);
+  EXPECT_EQ(1, service.getNumEndpoints());
+  // Out, but tried anyway as the only one left
+  EXPECT_TRUE(service(1).getTry().hasException());
+  EXPECT_EQ(3, bad->calls);
+
+  service.removeEndpoint(bad);
+  EXPECT_TRUE(service(1).getTry().hasException());
+}
+
+class HangingService : public Service<int, int> {
+ public:
+  Future<int> operator()(int req) override {
+    promises.emplace_back();
+    return promises.back().getFuture();
+  }
+  std::deque<Promise<int>> promises;
+};
+
+TEST(ServiceFilter, Hedging) {
+  auto evb = EventBaseManager::get()->getEventBase();
+  auto slow = std::make_shared<HangingService>();
+  auto fast = std::make_shared<CountingService>(false);
+  HedgingFilterOptions options;
+  options.initialDelay = std::chrono::milliseconds(0);
+  options.budget = 0.5;
+  HedgingFilter<int> filter(slow, fast, options);
+
+  auto hedged = filter(1);
+  auto notHedged = filter(2);
+  EXPECT_FALSE(hedged.isReady());
+  evb->loop();
+  // Over budget for the second one
+  EXPECT_EQ(1, hedged.value());
+  EXPECT_FALSE(notHedged.isReady());
+  EXPECT_EQ(1, filter.getNumHedged());
+  EXPECT_EQ(1, fast->calls);
+
+  // The loser is ignored
+  slow->promises[0].setValue(10);
+  EXPECT_EQ(1, hedged.value());
+  slow->promises[1].setValue(20);
+  EXPECT_EQ(20, notHedged.value());
+}
+
+TEST(ServiceFilter, ConcurrencyLimit) {
+  auto service = std::make_shared<HangingService>();
+  ConcurrencyLimitFilterOptions options;
+  options.initialLimit = 2;
+  ConcurrencyLimitFilter<int> filter(service, options);
+
+  auto one = filter(1);
+  auto two = filter(2);
+  auto rejected = filter(3);
+  EXPECT_TRUE(
+      rejected.getTry().hasException<ConcurrencyLimitExceeded>());
+  EXPECT_EQ(2, service->promises.size());
+  EXPECT_EQ(2, filter.getInFlight());
+  EXPECT_EQ(1, filter.getNumRejected());
+
+  service->promises[0].setValue(1);
+  service->promises[1].setException(std::runtime_error("failed"));
+  EXPECT_EQ(0, filter.getInFlight());
+  EXPECT_TRUE(two.getTry().hasException());
+  EXPECT_LE(1, filter.getLimit());
+  filter(4);
+  EXPECT_EQ(3, service->promises.size());
+}
+
+TEST(ServiceFilter, Caching) {
+  auto service = std::make_shared<HangingService>();
+  CachingFilter<int, int, int> filter(service, [](const int& i) {
+    return i;
+  });
+
+  // Coalesced into one call
+  auto first = filter(1);
+  auto second = filter(1);
+  EXPECT_EQ(1, service->promises.size());
+  service->promises[0].setValue(10);
+  EXPECT_EQ(10, first.value());
+  EXPECT_EQ(10, second.value());
+
+  EXPECT_EQ(10, filter(1).value());
+  EXPECT_EQ(1, service->promises.size());
+  EXPECT_EQ(1, filter.getNumEntries());
+
+  // Failures aren't cached
+  auto failed = filter(2);
+  service->promises[1].setException(std::runtime_error("failed"));
+  EXPECT_TRUE(failed.getTry().hasException());
+  filter(2);
+  EXPECT_EQ(3, service->promises.size());
+}
+
+TEST(ServiceFilter, ExecutorSloughsWhenOverloaded) {
+  auto exe = std::make_shared<ManualExecutor>();
+  auto codel = std::make_shared<Codel>();
+  std::shared_ptr<Service<std::string, std::string>> service =
+    std::make_shared<EchoService>();
+  ExecutorFilter<std::string, std::string> filter(exe, service, codel);
+
+  auto served = filter("test");
+  EXPECT_FALSE(served.isReady());
+  exe->run();
+  EXPECT_EQ("test", served.value());
+
+  // Overloaded, as in CodelTest.Basic
+  std::this_thread::sleep_for(std::chrono::milliseconds(110));
+  codel->overloaded(std::chrono::milliseconds(100));
+  std::this_thread::sleep_for(std::chrono::milliseconds(90));
+  codel->overloaded(std::chrono::milliseconds(50));
+
+  auto sloughed = filter("test");
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  exe->run();
+  EXPECT_TRUE(sloughed.getTry().hasException<ExecutorOverloaded>());
+}
+
+class FlakyService : public Service<int, int> {
+ public:
+  Future<int> operator()(int req) override {
+    calls++;
+    if (failures > 0) {
+      failures--;
+      return makeFuture<int>(std::runtime_error("flaked"));
+    }
+    return req;
+  }
+  int failures{0};
+  int calls{0};
+};
+
+TEST(ServiceFilter, RetryBudget) {
+  auto evb = EventBaseManager::get()->getEventBase();
+  auto service = std::make_shared<FlakyService>();
+  RetryFilterOptions options;
+  options.maxBudget = 1;
+  options.budgetRatio = 0.5;
+  options.baseBackoff = std::chrono::milliseconds(1);
+  RetryFilter<int> filter(service, options);
+
+  service->failures = 1;
+  auto retried = filter(1);
+  evb->loop();
+  EXPECT_EQ(1, retried.value());
+  EXPECT_EQ(2, service->calls);
+  EXPECT_EQ(1, filter.getNumRetries());
+
+  // Half a retry earned back isn't enough
+  service->failures = 1;
+  EXPECT_TRUE(filter(2).getTry().hasException());
+  EXPECT_EQ(3, service->calls);
+  EXPECT_EQ(1, filter.getNumSuppressed());
+
+  // Until another success
+  EXPECT_EQ(3, filter(3).value());
+  service->failures = 1;
+  auto again = filter(4);
+  evb->loop();
+  EXPECT_EQ(4, again.value());
+  EXPECT_EQ(2, filter.getNumRetries());
+}
+
+class CapturingExporter : public ServiceStatsExporter {
+ public:
+  void exportStats(const std::string& name,
+                   const ServiceStats& stats) override {
+    names.push_back(name);
+    requests = stats.requests;
+  }
+  std::vector<std::string> names;
+  uint64_t requests{0};
+};
+
+TEST(ServiceFilter, Stats) {
+  auto service = std::make_shared<FlakyService>();
+  StatsFilter<int> filter(service, "flaky");
+
+  service->failures = 1;
+  EXPECT_TRUE(filter(1).getTry().hasException());
+  EXPECT_EQ(2, filter(2).value());
+  std::thread([&] {
+    filter(3);
+  }).join();
+
+  auto stats = filter.getStats();
+  EXPECT_EQ(3, stats.requests);
+  EXPECT_EQ(1, stats.errors);
+  EXPECT_EQ(3, stats.latency.count());
+
+  CapturingExporter exporter;
+  filter.exportStats(exporter);
+  EXPECT_EQ(std::vector<std::string>{"flaky"}, exporter.names);
+  EXPECT_EQ(3, exporter.requests);
+}
+
+TEST(Wangle, RequestDeadline) {
+  EXPECT_FALSE(RequestDeadline::isSet());
+  {
+    RequestDeadline::Scope scope(std::chrono::milliseconds(1000));
+    auto deadline = RequestDeadline::current();
+    {
+      // Can't be extended
+      RequestDeadline::Scope longer(std::chrono::milliseconds(5000));
+      EXPECT_EQ(deadline, RequestDeadline::current());
+    }
+    EXPECT_FALSE(RequestDeadline::expired());
+    EXPECT_LT(0, RequestDeadline::remaining().count());
+  }
+  EXPECT_FALSE(RequestDeadline::isSet());
+
+  WriteCapture capture;
+  auto pipeline = StringPipeline::create();
+  pipeline->addBack(&capture);
+  pipeline->finalize();
+  PipelinedClientDispatcher<StringPipeline, std::string> dispatcher;
+  dispatcher.setPipeline(pipeline.get());
+
+  auto exe = std::make_shared<ManualExecutor>();
+  std::shared_ptr<Service<std::string, std::string>> service =
+    std::make_shared<EchoService>();
+  ExecutorFilter<std::string, std::string> filter(exe, service);
+
+  Future<std::string> queued = makeFuture<std::string>("");
+  {
+    RequestDeadline::Scope scope(std::chrono::milliseconds(0));
+    // Not sent
+    EXPECT_TRUE(dispatcher("late").getTry().hasException<DeadlineExceeded>());
+    EXPECT_TRUE(filter("late").getTry().hasException<DeadlineExceeded>());
+  }
+  EXPECT_TRUE(capture.writes.empty());
+  {
+    RequestDeadline::Scope scope(std::chrono::milliseconds(10));
+    queued = filter("queued");
+  }
+  // Expired while queued
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  exe->run();
+  EXPECT_TRUE(queued.getTry().hasException<DeadlineExceeded>());
+}
+
+// Each write with the RequestTrace it's made in
+class TraceCapture : public OutboundHandler<std::string> {
+ public:
+  Future<Unit> write(Context* ctx, std::string msg) override {
+    writes.push_back(std::move(msg));
+    traces.push_back(RequestTrace::current());
+    return makeFuture();
+  }
+
+  Future<Unit> close(Context* ctx) override {
+    closed = true;
+    return makeFuture();
+  }
+
+  std::vector<std::string> writes;
+  std::vector<uint64_t> traces;
+  bool closed{false};
+};
+
+// Each read with the RequestTrace it's passed in
+class TraceReadCapture : public InboundHandler<std::string> {
+ public:
+  void read(Context* ctx, std::string msg) override {
+    traces.push_back(RequestTrace::current());
+  }
+
+  std::vector<uint64_t> traces;
+};
+
+// A PromiseService noting the RequestTrace of each call
+class TracedPromiseService : public PromiseService {
+ public:
+  Future<std::string> operator()(std::string req) override {
+    traces.push_back(RequestTrace::current());
+    return PromiseService::operator()(std::move(req));
+  }
+  std::vector<uint64_t> traces;
+};
+
+std::vector<std::string> traceStages(uint64_t traceId) {
+  std::vector<std::string> stages;
+  for (const auto& event : RequestTrace::getEvents(traceId)) {
+    stages.push_back(event.stage);
+  }
+  return stages;
+}
+
+TEST(RequestTrace, Sampler) {
+  TraceReadCapture capture;
+  RequestTraceSampler<std::string> sampler(1);
+  auto pipeline = StringPipeline::create();
+  pipeline->addBack(&sampler);
+  pipeline->addBack(&capture);
+  pipeline->finalize();
+
+  pipeline->read(std::string("a"));
+  pipeline->read(std::string("b"));
+  ASSERT_EQ(2, capture.traces.size());
+  EXPECT_NE(0, capture.traces[0]);
+  EXPECT_NE(0, capture.traces[1]);
+  EXPECT_NE(capture.traces[0], capture.traces[1]);
+  EXPECT_EQ(std::vector<std::string>{"decoded"},
+            traceStages(capture.traces[0]));
+  EXPECT_FALSE(RequestTrace::isSet());
+
+  // A message in a trace keeps it
+  const auto id = RequestTrace::sample(1);
+  {
+    RequestTrace::Scope scope(id);
+    pipeline->read(std::string("c"));
+  }
+  EXPECT_EQ(id, capture.traces[2]);
+
+  sampler.setOneIn(0);
+  pipeline->read(std::string("d"));
+  EXPECT_EQ(0, capture.traces[3]);
+}
+
+TEST(RequestTrace, SerialServerDispatcher) {
+  TraceCapture capture;
+  PromiseService service;
+  SerialServerDispatcher<std::string> dispatcher(&service);
+  auto pipeline = StringPipeline::create();
+  pipeline->addBack(&capture);
+  pipeline->addBack(&dispatcher);
+  pipeline->finalize();
+
+  const auto id = RequestTrace::sample(1);
+  {
+    RequestTrace::Scope scope(id);
+    pipeline->read(std::string("a"));
+  }
+  pipeline->read(std::string("b"));
+  // Completed outside of the trace, written in it
+  service.promises[0].setValue("A");
+  service.promises[1].setValue("B");
+  EXPECT_EQ((std::vector<uint64_t>{id, 0}), capture.traces);
+  EXPECT_EQ((std::vector<std::string>{"dispatched", "responded"}),
+            traceStages(id));
+}
+
+TEST(RequestTrace, PipelinedServerDispatcher) {
+  TraceCapture capture;
+  PromiseService service;
+  PipelinedServerDispatcher<std::string> dispatcher(&service);
+  auto pipeline = StringPipeline::create();
+  pipeline->addBack(&capture);
+  pipeline->addBack(&dispatcher);
+  pipeline->finalize();
+
+  const auto first = RequestTrace::sample(1);
+  const auto third = RequestTrace::sample(1);
+  {
+    RequestTrace::Scope scope(first);
+    pipeline->read(std::string("a"));
+  }
+  pipeline->read(std::string("b"));
+  {
+    RequestTrace::Scope scope(third);
+    pipeline->read(std::string("c"));
+  }
+  service.promises[2].setValue("C");
+  service.promises[1].setValue("B");
+  service.promises[0].setValue("A");
+  EXPECT_EQ((std::vector<std::string>{"A", "B", "C"}), capture.writes);
+  EXPECT_EQ((std::vector<uint64_t>{first, 0, third}), capture.traces);
+  EXPECT_EQ((std::vector<std::string>{"dispatched", "responded"}),
+            traceStages(first));
+  EXPECT_EQ((std::vector<std::string>{"dispatched", "responded"}),
+            traceStages(third));
+}
+
+TEST(RequestTrace, PipelinedServerDispatcherFailure) {
+  TraceCapture capture;
+  PromiseService service;
+  PipelinedServerDispatcher<std::string> dispatcher(&service, 2);
+  auto pipeline = StringPipeline::create();
+  pipeline->addBack(&capture);
+  pipeline->addBack(&dispatcher);
+  pipeline->finalize();
+
+  const auto failed = RequestTrace::sample(1);
+  const auto dropped = RequestTrace::sample(1);
+  {
+    RequestTrace::Scope scope(failed);
+    pipeline->read(std::string("a"));
+  }
+  {
+    RequestTrace::Scope scope(dropped);
+    pipeline->read(std::string("b"));
+  }
+  EXPECT_TRUE(pipeline->isReadPaused());
+  EXPECT_EQ(2, pipeline->getNumRequests());
+
+  // Closes the connection, dropping the requests after it
+  service.promises[0].setException(std::runtime_error("failed"));
+  EXPECT_TRUE(capture.closed);
+  EXPECT_TRUE(capture.writes.empty());
+  EXPECT_EQ(0, pipeline->getNumRequests());
+  EXPECT_FALSE(pipeline->isReadPaused());
+  service.promises[1].setValue("B");
+  EXPECT_TRUE(capture.writes.empty());
+  EXPECT_EQ(std::vector<std::string>{"dispatched"}, traceStages(failed));
+  EXPECT_EQ(std::vector<std::string>{"dispatched"}, traceStages(dropped));
+
+  // Nothing left of them for the requests after
+  pipeline->read(std::string("c"));
+  service.promises[2].setValue("C");
+  EXPECT_EQ(std::vector<std::string>{"C"}, capture.writes);
+  EXPECT_EQ(std::vector<uint64_t>{0}, capture.traces);
+  EXPECT_EQ(0, pipeline->getNumRequests());
+}
+
+TEST(RequestTrace, ParallelServerDispatcher) {
+  TraceCapture capture;
+  TracedPromiseService service;
+  auto executor = std::make_shared<ManualExecutor>();
+  ParallelServerDispatcher<std::string> dispatcher(&service, executor);
+  auto pipeline = StringPipeline::create();
+  pipeline->addBack(&capture);
+  pipeline->addBack(&dispatcher);
+  pipeline->finalize();
+
+  const auto id = RequestTrace::sample(1);
+  pipeline->read(std::string("a"));
+  {
+    RequestTrace::Scope scope(id);
+    pipeline->read(std::string("b"));
+  }
+  // Into the service on the executor and back
+  executor->run();
+  EXPECT_EQ((std::vector<uint64_t>{0, id}), service.traces);
+  service.promises[1].setValue("B");
+  service.promises[0].setValue("A");
+  EXPECT_EQ((std::vector<std::string>{"A", "B"}), capture.writes);
+  EXPECT_EQ((std::vector<uint64_t>{0, id}), capture.traces);
+  EXPECT_EQ((std::vector<std::string>{"dispatched", "responded"}),
+            traceStages(id));
+}
+
+TEST(RequestTrace, ExecutorFilter) {
+  auto exe = std::make_shared<ManualExecutor>();
+  auto service = std::make_shared<TracedPromiseService>();
+  ExecutorFilter<std::string, std::string> filter(exe, service);
+
+  const auto id = RequestTrace::sample(1);
+  Future<std::string> traced = makeFuture<std::string>("");
+  {
+    RequestTrace::Scope scope(id);
+    traced = filter("traced");
+  }
+  auto untraced = filter("untraced");
+  exe->run();
+  EXPECT_EQ((std::vector<uint64_t>{id, 0}), service->traces);
+  EXPECT_EQ(std::vector<std::string>{"service"}, traceStages(id));
+  service->promises[0].setValue("done");
+  service->promises[1].setValue("done");
+  EXPECT_EQ("done", traced.value());
+  EXPECT_EQ("done", untraced.value());
+}
+
+// The stages of a request through a whole server pipeline
+TEST(RequestTrace, ServerPipeline) {
+  class TracedEchoService : public Service<std::string, std::string> {
+   public:
+    Future<std::string> operator()(std::string req) override {
+      traceId = RequestTrace::current();
+      return req;
+    }
+    uint64_t traceId{0};
+  };
+
+  EventBase evb;
+  int fds[2];
+  ASSERT_EQ(0, ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  ASSERT_EQ(0, ::fcntl(fds[1], F_SETFL, O_NONBLOCK));
+  TracedEchoService service;
+  auto pipeline = ServicePipeline::create();
+  pipeline->addBack(AsyncSocketHandler(AsyncSocket::newSocket(&evb, fds[0])));
+  pipeline->addBack(OutputBufferingHandler());
+  pipeline->addBack(LineBasedFrameDecoder());
+  pipeline->addBack(StringCodec());
+  pipeline->addBack(RequestTraceSampler<std::string>(1));
+  pipeline->addBack(PipelinedServerDispatcher<std::string>(&service));
+  pipeline->finalize();
+  pipeline->transportActive();
+
+  ASSERT_EQ(5, ::write(fds[1], "ping\n", 5));
+  std::string received;
+  char buf[64];
+  for (int i = 0; i < 1000 && received.size() < 4; i++) {
+    evb.loopOnce(EVLOOP_NONBLOCK);
+    auto n = ::read(fds[1], buf, sizeof(buf));
+    if (n > 0) {
+      received.append(buf, n);
+    }
+  }
+  EXPECT_EQ("ping", received);
+  ASSERT_NE(0, service.traceId);
+  EXPECT_EQ((std::vector<std::string>{"decoded", "dispatched", "responded",
+                                      "buffered", "flushed",
+                                      "socket write"}),
+            traceStages(service.traceId));
+  EXPECT_FALSE(RequestTrace::isSet());
+
+  pipeline->close();
+  ::close(fds[1]);
+}
+
 int main(int argc, char** argv) {
   testing::InitGoogleTest(&argc, argv);
   google::InitGoogleLogging(argv[0]);
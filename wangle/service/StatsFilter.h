@@ -0,0 +1,137 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/ThreadLocal.h>
+#include <folly/futures/Future.h>
+#include <wangle/concurrent/LatencyHistogram.h>
+#include <wangle/service/Service.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace wangle {
+
+// Totals since the filter was created; rates are for the exporter to take
+// from the difference between two snapshots
+struct ServiceStats {
+  uint64_t requests{0};
+  uint64_t errors{0};
+  // Of every request completed, failed ones included
+  LatencyHistogram latency;
+};
+
+class ServiceStatsExporter {
+ public:
+  virtual ~ServiceStatsExporter() = default;
+
+  virtual void exportStats(const std::string& name,
+                           const ServiceStats& stats) = 0;
+};
+
+/**
+ * A service filter counting requests and failures, and recording request
+ * latencies in a histogram.
+ *
+ * Each thread completing requests writes its own counters with relaxed
+ * stores, no locked instruction nor shared cache line, so the filter can
+ * stay on at high request rates; getStats() adds them all up. Counters
+ * are kept after their thread exits.
+ */
+template <typename Req, typename Resp = Req>
+class StatsFilter : public ServiceFilter<Req, Resp> {
+ public:
+  StatsFilter(std::shared_ptr<Service<Req, Resp>> service,
+              std::string name)
+      : ServiceFilter<Req, Resp>(service),
+        name_(std::move(name)),
+        shards_(std::make_shared<Shards>()) {}
+
+  virtual folly::Future<Resp> operator()(Req req) override {
+    auto shards = shards_;
+    auto start = std::chrono::steady_clock::now();
+    return (*this->service_)(std::move(req)).then(
+      [shards, start](folly::Try<Resp>&& t) {
+        auto& shard = shards->local();
+        Shard::bump(shard.requests);
+        if (t.hasException()) {
+          Shard::bump(shard.errors);
+        }
+        shard.latency.add(std::chrono::steady_clock::now() - start);
+        // Without rethrowing failures
+        return folly::makeFuture<Resp>(std::move(t));
+      });
+  }
+
+  ServiceStats getStats() const {
+    return shards_->snapshot();
+  }
+
+  const std::string& getName() const {
+    return name_;
+  }
+
+  void exportStats(ServiceStatsExporter& exporter) const {
+    exporter.exportStats(name_, getStats());
+  }
+
+ private:
+  // Written by a single thread, read from any
+  struct Shard {
+    static void bump(std::atomic<uint64_t>& counter) {
+      counter.store(counter.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> errors{0};
+    LatencyHistogram::Writer latency;
+  };
+
+  // Shared with the callbacks, which can outlive the filter
+  class Shards {
+   public:
+    Shard& local() {
+      auto shard = *local_;
+      if (!shard) {
+        // Once per thread; kept here after the thread exits
+        std::lock_guard<std::mutex> g(mutex_);
+        all_.emplace_back(new Shard());
+        shard = *local_ = all_.back().get();
+      }
+      return *shard;
+    }
+
+    ServiceStats snapshot() {
+      ServiceStats stats;
+      std::lock_guard<std::mutex> g(mutex_);
+      for (auto& shard : all_) {
+        stats.requests += shard->requests.load(std::memory_order_relaxed);
+        stats.errors += shard->errors.load(std::memory_order_relaxed);
+        shard->latency.snapshot(stats.latency);
+      }
+      return stats;
+    }
+
+   private:
+    folly::ThreadLocal<Shard*> local_;
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<Shard>> all_;
+  };
+
+  const std::string name_;
+  std::shared_ptr<Shards> shards_;
+};
+
+} // namespace wangle
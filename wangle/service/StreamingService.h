@@ -0,0 +1,204 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <folly/Optional.h>
+#include <folly/futures/Future.h>
+#include <wangle/service/Service.h>
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace wangle {
+
+/**
+ * An asynchronous stream of response chunks, pulled by its consumer: the
+ * producer is asked for a chunk only when the consumer can take one, so a
+ * large response is never held in memory as a whole. next() returns the
+ * next chunk, or none once the stream ends, and isn't called again before
+ * the Future it returned completes. A consumer that stops before the end
+ * calls cancel().
+ */
+template <typename T>
+class ResponseStream {
+ public:
+  virtual ~ResponseStream() = default;
+  virtual folly::Future<folly::Optional<T>> next() = 0;
+  virtual void cancel() {}
+};
+
+/**
+ * A Service whose response is a stream of chunks: the Future completes
+ * once the response starts, and the chunks follow through the stream.
+ * Being a Service, it composes with the usual filters.
+ */
+template <typename Req, typename Chunk>
+using StreamingService =
+  Service<Req, std::shared_ptr<ResponseStream<Chunk>>>;
+
+/**
+ * A ResponseStream the producer pushes chunks into. push() returns a Future
+ * that completes once the stream has room for another chunk, that is while
+ * fewer than capacity chunks are waiting for the consumer; a producer that
+ * waits for it runs in constant memory. Chunks pushed after cancel() are
+ * dropped. Not thread safe: producer and consumer are on one thread, the
+ * pipeline's.
+ */
+template <typename T>
+class QueueResponseStream : public ResponseStream<T> {
+ public:
+  explicit QueueResponseStream(size_t capacity = 16)
+      : capacity_(std::max<size_t>(capacity, 1)) {}
+
+  folly::Future<folly::Unit> push(T chunk) {
+    if (cancelled_ || done_) {
+      return folly::makeFuture();
+    }
+    if (waiter_) {
+      auto p = std::move(*waiter_);
+      waiter_ = folly::none;
+      p.setValue(folly::Optional<T>(std::move(chunk)));
+      return folly::makeFuture();
+    }
+    chunks_.push_back(std::move(chunk));
+    if (chunks_.size() < capacity_) {
+      return folly::makeFuture();
+    }
+    roomWaiters_.emplace_back();
+    return roomWaiters_.back().getFuture();
+  }
+
+  void finish() {
+    if (done_) {
+      return;
+    }
+    done_ = true;
+    if (waiter_) {
+      auto p = std::move(*waiter_);
+      waiter_ = folly::none;
+      p.setValue(folly::none);
+    }
+  }
+
+  void fail(folly::exception_wrapper ex) {
+    if (done_) {
+      return;
+    }
+    done_ = true;
+    error_ = std::move(ex);
+    if (waiter_) {
+      auto p = std::move(*waiter_);
+      waiter_ = folly::none;
+      p.setException(error_);
+    }
+  }
+
+  bool isCancelled() const {
+    return cancelled_;
+  }
+
+  // Chunks pushed but not yet taken by the consumer
+  size_t size() const {
+    return chunks_.size();
+  }
+
+  folly::Future<folly::Optional<T>> next() override {
+    DCHECK(!waiter_);
+    if (!chunks_.empty()) {
+      folly::Optional<T> chunk(std::move(chunks_.front()));
+      chunks_.pop_front();
+      auto f = folly::makeFuture(std::move(chunk));
+      // Last, as the producer may push again from here
+      notifyRoom();
+      return f;
+    }
+    if (error_) {
+      return folly::makeFuture<folly::Optional<T>>(error_);
+    }
+    if (done_ || cancelled_) {
+      return folly::makeFuture(folly::Optional<T>());
+    }
+    waiter_ = folly::Promise<folly::Optional<T>>();
+    return waiter_->getFuture();
+  }
+
+  void cancel() override {
+    cancelled_ = true;
+    chunks_.clear();
+    if (waiter_) {
+      auto p = std::move(*waiter_);
+      waiter_ = folly::none;
+      p.setValue(folly::none);
+    }
+    notifyRoom();
+  }
+
+ private:
+  void notifyRoom() {
+    if (chunks_.size() >= capacity_ || roomWaiters_.empty()) {
+      return;
+    }
+    auto waiters = std::move(roomWaiters_);
+    roomWaiters_.clear();
+    for (auto& p : waiters) {
+      p.setValue();
+    }
+  }
+
+  const size_t capacity_;
+  std::deque<T> chunks_;
+  folly::Optional<folly::Promise<folly::Optional<T>>> waiter_;
+  std::vector<folly::Promise<folly::Unit>> roomWaiters_;
+  folly::exception_wrapper error_;
+  bool done_{false};
+  bool cancelled_{false};
+};
+
+/**
+ * What StreamingServerDispatcher writes, and StreamingClientDispatcher
+ * reads: a response is DATA frames followed by an END frame, or a FAILED
+ * one carrying the error. The protocol's codec below the dispatcher
+ * encodes them.
+ */
+template <typename T>
+struct StreamFrame {
+  enum class Type {
+    DATA,
+    END,
+    FAILED,
+  };
+
+  static StreamFrame data(T chunk) {
+    StreamFrame frame;
+    frame.type = Type::DATA;
+    frame.chunk = std::move(chunk);
+    return frame;
+  }
+
+  static StreamFrame end() {
+    return StreamFrame();
+  }
+
+  static StreamFrame failed(std::string message) {
+    StreamFrame frame;
+    frame.type = Type::FAILED;
+    frame.message = std::move(message);
+    return frame;
+  }
+
+  Type type{Type::END};
+  T chunk;
+  std::string message;
+};
+
+} // namespace wangle
@@ -0,0 +1,102 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/ssl/EarlyDataReplayCache.h>
+
+#include <folly/Hash.h>
+#include <folly/Singleton.h>
+
+#include <algorithm>
+
+namespace {
+
+folly::Singleton<wangle::EarlyDataReplayCache> defaultCache;
+
+}
+
+namespace wangle {
+
+EarlyDataReplayCache::EarlyDataReplayCache(Options options)
+    : options_(options),
+      windowSeconds_(options.window.count()),
+      shardCapacity_(std::max<size_t>(
+        1, options.capacity / std::max<size_t>(1, options.shards))) {
+  for (size_t i = 0; i < std::max<size_t>(1, options_.shards); i++) {
+    shards_.emplace_back(new Shard());
+  }
+}
+
+std::shared_ptr<EarlyDataReplayCache> EarlyDataReplayCache::getDefault() {
+  return defaultCache.try_get();
+}
+
+bool EarlyDataReplayCache::checkAndInsert(folly::ByteRange key,
+                                          Clock::time_point now) {
+  const auto window = getWindow();
+  if (window.count() <= 0) {
+    // A replay could come at any time
+    return false;
+  }
+  std::string k(reinterpret_cast<const char*>(key.data()), key.size());
+  auto& shard = *shards_[folly::hash::fnv64(k) % shards_.size()];
+  std::lock_guard<std::mutex> g(shard.mutex);
+  while (!shard.byAge.empty() &&
+         now - shard.byAge.front().first >= window) {
+    shard.keys.erase(shard.byAge.front().second);
+    shard.byAge.pop_front();
+  }
+  if (shard.keys.count(k)) {
+    shard.replays++;
+    return false;
+  }
+  if (shard.keys.size() >= shardCapacity_) {
+    shard.rejectedFull++;
+    return false;
+  }
+  shard.keys.insert(k);
+  shard.byAge.emplace_back(now, std::move(k));
+  return true;
+}
+
+void EarlyDataReplayCache::coverTicketLifetime(
+    std::chrono::seconds lifetime) {
+  auto window = windowSeconds_.load();
+  while (window < lifetime.count() &&
+         !windowSeconds_.compare_exchange_weak(window, lifetime.count())) {
+  }
+}
+
+size_t EarlyDataReplayCache::size() const {
+  size_t total = 0;
+  for (auto& shard : shards_) {
+    std::lock_guard<std::mutex> g(shard->mutex);
+    total += shard->keys.size();
+  }
+  return total;
+}
+
+uint64_t EarlyDataReplayCache::getNumReplays() const {
+  uint64_t total = 0;
+  for (auto& shard : shards_) {
+    std::lock_guard<std::mutex> g(shard->mutex);
+    total += shard->replays;
+  }
+  return total;
+}
+
+uint64_t EarlyDataReplayCache::getNumRejectedFull() const {
+  uint64_t total = 0;
+  for (auto& shard : shards_) {
+    std::lock_guard<std::mutex> g(shard->mutex);
+    total += shard->rejectedFull;
+  }
+  return total;
+}
+
+}
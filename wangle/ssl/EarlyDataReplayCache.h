@@ -0,0 +1,103 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <folly/Range.h>
+
+namespace wangle {
+
+/**
+ * Remembers the resumption secrets early (0-RTT) data was accepted with,
+ * so that early data replayed with the same session ticket, to this
+ * process from any of its threads, is rejected: a client sends early data
+ * before the handshake proves it's live, so a recording of it can be
+ * played again verbatim.
+ *
+ * Keys are remembered for the window, which must cover the lifetime of
+ * the tickets early data is accepted with: it's the longest lifetime given
+ * to coverTicketLifetime(), as the SSLContextManagers do for each SSL_CTX
+ * accepting early data, or Options::window if longer. Until there is one,
+ * all early data is rejected. At most capacity keys are kept, split
+ * across shards with a lock each. A full shard rejects early data, rather
+ * than forgetting keys that could still be replayed, until its oldest key
+ * is older than the window; the handshake then goes on without early
+ * data. Thread safe.
+ */
+class EarlyDataReplayCache : private boost::noncopyable {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Options {
+    // The shortest window, 0 for only the ticket lifetimes covered
+    std::chrono::seconds window{0};
+    size_t capacity{1 << 20};
+    size_t shards{16};
+  };
+
+  EarlyDataReplayCache() : EarlyDataReplayCache(Options()) {}
+  explicit EarlyDataReplayCache(Options options);
+
+  /**
+   * A cache shared by the whole process, created on first use, which the
+   * SSLContextManagers accepting early data use. Null during shutdown.
+   */
+  static std::shared_ptr<EarlyDataReplayCache> getDefault();
+
+  /**
+   * Records key and returns true the first time it's seen within window,
+   * for early data to be accepted; false for a replay, or when key's
+   * shard is full.
+   */
+  bool checkAndInsert(folly::ByteRange key,
+                      Clock::time_point now = Clock::now());
+
+  /**
+   * Makes the window at least lifetime, that of the tickets of an SSL_CTX
+   * accepting early data (SSL_CTX_get_timeout()). Never shortens it, as
+   * tickets already issued keep their lifetime.
+   */
+  void coverTicketLifetime(std::chrono::seconds lifetime);
+
+  std::chrono::seconds getWindow() const {
+    return std::chrono::seconds(windowSeconds_.load());
+  }
+
+  size_t size() const;
+
+  uint64_t getNumReplays() const;
+  uint64_t getNumRejectedFull() const;
+
+ private:
+  struct Shard {
+    mutable std::mutex mutex;
+    std::unordered_set<std::string> keys;
+    // Keys in the order they were inserted, oldest first
+    std::deque<std::pair<Clock::time_point, std::string>> byAge;
+    uint64_t replays{0};
+    uint64_t rejectedFull{0};
+  };
+
+  const Options options_;
+  std::atomic<int64_t> windowSeconds_;
+  const size_t shardCapacity_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+}
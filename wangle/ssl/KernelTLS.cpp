@@ -0,0 +1,204 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/ssl/KernelTLS.h>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+#include <glog/logging.h>
+#include <openssl/hmac.h>
+#include <openssl/sha.h>
+#include <openssl/ssl.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/tls.h>)
+#include <linux/tls.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+#endif
+
+// kTLS of both directions, and the OpenSSL 1.0 structs the keys are
+// taken from
+#if defined(TLS_RX) && OPENSSL_VERSION_NUMBER < 0x10100000L
+#define WANGLE_HAVE_KTLS 1
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#else
+#define WANGLE_HAVE_KTLS 0
+#endif
+
+using folly::AsyncSocket;
+using folly::AsyncSSLSocket;
+
+namespace wangle {
+
+namespace detail {
+
+constexpr size_t TLS12GCMKeys::kKeySize;
+constexpr size_t TLS12GCMKeys::kSaltSize;
+
+void tls12PRF(const unsigned char* secret, size_t secretLen,
+              const std::string& seed,
+              unsigned char* out, size_t outLen) {
+  unsigned char a[SHA256_DIGEST_LENGTH];
+  unsigned char block[SHA256_DIGEST_LENGTH];
+  unsigned int len = 0;
+  // A(1)
+  HMAC(EVP_sha256(), secret, secretLen,
+       reinterpret_cast<const unsigned char*>(seed.data()), seed.size(),
+       a, &len);
+  while (outLen > 0) {
+    std::string input(reinterpret_cast<const char*>(a), sizeof(a));
+    input.append(seed);
+    HMAC(EVP_sha256(), secret, secretLen,
+         reinterpret_cast<const unsigned char*>(input.data()), input.size(),
+         block, &len);
+    auto n = std::min(outLen, sizeof(block));
+    memcpy(out, block, n);
+    out += n;
+    outLen -= n;
+    // A(i + 1)
+    HMAC(EVP_sha256(), secret, secretLen, a, sizeof(a), a, &len);
+  }
+}
+
+void deriveTLS12GCMKeys(const unsigned char* masterKey, size_t masterKeyLen,
+                        const unsigned char* clientRandom,
+                        const unsigned char* serverRandom,
+                        size_t randomLen,
+                        TLS12GCMKeys& keys) {
+  // client_write_key, server_write_key, client_write_IV, server_write_IV
+  static_assert(sizeof(TLS12GCMKeys) ==
+                2 * TLS12GCMKeys::kKeySize + 2 * TLS12GCMKeys::kSaltSize,
+                "the keys must be laid out as the key block");
+  std::string seed("key expansion");
+  seed.append(reinterpret_cast<const char*>(serverRandom), randomLen);
+  seed.append(reinterpret_cast<const char*>(clientRandom), randomLen);
+  tls12PRF(masterKey, masterKeyLen, seed,
+           reinterpret_cast<unsigned char*>(&keys), sizeof(keys));
+}
+
+} // namespace detail
+
+#if WANGLE_HAVE_KTLS
+
+namespace {
+
+const size_t kKeySize = TLS_CIPHER_AES_GCM_128_KEY_SIZE;
+const size_t kSaltSize = TLS_CIPHER_AES_GCM_128_SALT_SIZE;
+static_assert(kKeySize == detail::TLS12GCMKeys::kKeySize &&
+              kSaltSize == detail::TLS12GCMKeys::kSaltSize,
+              "kTLS takes AES-128-GCM keys");
+
+bool isOffloadable(SSL* ssl) {
+  if (SSL_version(ssl) != TLS1_2_VERSION || !ssl->session || !ssl->s3) {
+    return false;
+  }
+  switch (SSL_CIPHER_get_id(SSL_get_current_cipher(ssl))) {
+    case TLS1_CK_RSA_WITH_AES_128_GCM_SHA256:
+    case TLS1_CK_ECDHE_RSA_WITH_AES_128_GCM_SHA256:
+    case TLS1_CK_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256:
+      break;
+    default:
+      return false;
+  }
+  // Records OpenSSL already read would be lost to the kernel
+  return SSL_pending(ssl) == 0 && ssl->s3->rbuf.left == 0 &&
+    ssl->s3->wbuf.left == 0;
+}
+
+void fillCryptoInfo(tls12_crypto_info_aes_gcm_128& info,
+                    const unsigned char* key,
+                    const unsigned char* salt,
+                    const unsigned char* sequence) {
+  memset(&info, 0, sizeof(info));
+  info.info.version = TLS_1_2_VERSION;
+  info.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+  memcpy(info.key, key, kKeySize);
+  memcpy(info.salt, salt, kSaltSize);
+  // The explicit nonces only have to be unique, the sequence numbers are
+  memcpy(info.iv, sequence, TLS_CIPHER_AES_GCM_128_IV_SIZE);
+  memcpy(info.rec_seq, sequence, TLS_CIPHER_AES_GCM_128_REC_SEQ_SIZE);
+}
+
+}
+
+bool KernelTLS::isSupported() {
+  return true;
+}
+
+AsyncSocket::UniquePtr KernelTLS::offload(AsyncSSLSocket::UniquePtr& sock) {
+  auto ssl = const_cast<SSL*>(sock->getSSL());
+  if (!ssl || !isOffloadable(ssl)) {
+    return nullptr;
+  }
+
+  detail::TLS12GCMKeys keys;
+  detail::deriveTLS12GCMKeys(
+    ssl->session->master_key, ssl->session->master_key_length,
+    ssl->s3->client_random, ssl->s3->server_random, SSL3_RANDOM_SIZE, keys);
+
+  tls12_crypto_info_aes_gcm_128 tx;
+  tls12_crypto_info_aes_gcm_128 rx;
+  fillCryptoInfo(tx, keys.serverKey, keys.serverSalt,
+                 ssl->s3->write_sequence);
+  fillCryptoInfo(rx, keys.clientKey, keys.clientSalt,
+                 ssl->s3->read_sequence);
+  OPENSSL_cleanse(&keys, sizeof(keys));
+
+  auto fd = sock->getFd();
+  if (setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) != 0) {
+    // e.g. without the tls module; nothing changed yet
+    VLOG(4) << "Kernel TLS not available: errno " << errno;
+    OPENSSL_cleanse(&tx, sizeof(tx));
+    OPENSSL_cleanse(&rx, sizeof(rx));
+    return nullptr;
+  }
+  bool installed =
+    setsockopt(fd, SOL_TLS, TLS_TX, &tx, sizeof(tx)) == 0 &&
+    setsockopt(fd, SOL_TLS, TLS_RX, &rx, sizeof(rx)) == 0;
+  OPENSSL_cleanse(&tx, sizeof(tx));
+  OPENSSL_cleanse(&rx, sizeof(rx));
+
+  // OpenSSL must not write anything more, not even a close_notify, now
+  // that the kernel owns the record sequence
+  SSL_set_quiet_shutdown(ssl, 1);
+  if (!installed) {
+    LOG(ERROR) << "Failed to install the TLS keys in the kernel: errno "
+               << errno;
+    sock->closeNow();
+    return nullptr;
+  }
+
+  auto evb = sock->getEventBase();
+  fd = sock->detachFd();
+  sock.reset();
+  return AsyncSocket::UniquePtr(new AsyncSocket(evb, fd));
+}
+
+#else
+
+bool KernelTLS::isSupported() {
+  return false;
+}
+
+AsyncSocket::UniquePtr KernelTLS::offload(AsyncSSLSocket::UniquePtr&) {
+  return nullptr;
+}
+
+#endif
+
+}
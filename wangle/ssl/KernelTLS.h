@@ -0,0 +1,78 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <folly/io/async/AsyncSSLSocket.h>
+#include <folly/io/async/AsyncSocket.h>
+
+#include <string>
+
+namespace wangle {
+
+/**
+ * Hands the record layer of an established TLS connection over to the
+ * kernel (Linux kTLS, TCP_ULP "tls"), which then encrypts what is written
+ * to the socket and decrypts what is read from it, so the connection can
+ * go on as a plain AsyncSocket: no userspace copies for encryption, and
+ * FileRegion can sendfile() over it.
+ *
+ * Only TLS 1.2 AES-128-GCM connections of a server are offloaded, and
+ * only on kernels with kTLS for both directions (4.17 on). The kernel
+ * doesn't renegotiate, nor deliver alerts to read(): a close_notify from
+ * the peer is read as an error.
+ */
+class KernelTLS {
+ public:
+  // Whether this build can offload at all; the kernel may still refuse
+  static bool isSupported();
+
+  /**
+   * Installs the keys and record sequence numbers of sock's connection in
+   * the kernel, and returns a plain AsyncSocket on its file descriptor,
+   * sock being reset then. Returns nullptr and leaves sock as it was if
+   * the connection can't be offloaded, e.g. for its cipher or because
+   * records were already read ahead; but closes sock if the kernel took
+   * only part of the keys, as the connection is unusable then.
+   *
+   * The connection must have no read callback nor writes pending.
+   */
+  static folly::AsyncSocket::UniquePtr offload(
+    folly::AsyncSSLSocket::UniquePtr& sock);
+};
+
+namespace detail {
+
+// P_SHA256 of RFC 5246 section 5, the PRF of the AES-GCM-SHA256 suites:
+// outLen bytes of PRF(secret, label, seed), given label + seed
+void tls12PRF(const unsigned char* secret, size_t secretLen,
+              const std::string& labelAndSeed,
+              unsigned char* out, size_t outLen);
+
+// The AES-128-GCM write keys and implicit IVs of a TLS 1.2 connection,
+// from its key block (RFC 5246 section 6.3)
+struct TLS12GCMKeys {
+  static constexpr size_t kKeySize = 16;
+  static constexpr size_t kSaltSize = 4;
+
+  unsigned char clientKey[kKeySize];
+  unsigned char serverKey[kKeySize];
+  unsigned char clientSalt[kSaltSize];
+  unsigned char serverSalt[kSaltSize];
+};
+
+void deriveTLS12GCMKeys(const unsigned char* masterKey, size_t masterKeyLen,
+                        const unsigned char* clientRandom,
+                        const unsigned char* serverRandom,
+                        size_t randomLen,
+                        TLS12GCMKeys& keys);
+
+} // namespace detail
+
+}
@@ -0,0 +1,175 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/ssl/OCSPStapler.h>
+
+#include <folly/Conv.h>
+#include <folly/FileUtil.h>
+#include <folly/ScopeGuard.h>
+#include <glog/logging.h>
+#include <openssl/ocsp.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace wangle {
+
+namespace {
+
+// Frees the reference a SSL_CTX holds to its stapler
+void freeStapler(void* /* parent */, void* ptr, CRYPTO_EX_DATA* /* ad */,
+                 int /* idx */, long /* argl */, void* /* argp */) {
+  delete static_cast<std::shared_ptr<OCSPStapler>*>(ptr);
+}
+
+int getStaplerIndex() {
+  static int index = SSL_CTX_get_ex_new_index(
+    0, nullptr, nullptr, nullptr, freeStapler);
+  return index;
+}
+
+}
+
+constexpr std::chrono::seconds OCSPStapler::kMinRefreshInterval;
+
+std::shared_ptr<OCSPStapler> OCSPStapler::install(
+    SSL_CTX* ctx,
+    std::chrono::seconds refreshInterval) {
+  std::shared_ptr<OCSPStapler> stapler(new OCSPStapler(refreshInterval));
+  SSL_CTX_set_ex_data(ctx, getStaplerIndex(),
+                      new std::shared_ptr<OCSPStapler>(stapler));
+  SSL_CTX_set_tlsext_status_cb(ctx, statusCallback);
+  SSL_CTX_set_tlsext_status_arg(ctx, stapler.get());
+  return stapler;
+}
+
+void OCSPStapler::addCertificate(X509* cert, const std::string& path) {
+  auto response = load(path);
+  std::lock_guard<std::mutex> g(mutex_);
+  entries_.push_back(Entry{cert, path, std::move(response)});
+}
+
+void OCSPStapler::refresh() {
+  std::vector<std::pair<size_t, std::string>> paths;
+  {
+    std::lock_guard<std::mutex> g(mutex_);
+    for (size_t i = 0; i < entries_.size(); i++) {
+      paths.emplace_back(i, entries_[i].path);
+    }
+  }
+  // Without the lock held, the handshakes keep stapling meanwhile
+  for (auto& path : paths) {
+    std::shared_ptr<const Response> response;
+    try {
+      response = load(path.second);
+    } catch (const std::exception& ex) {
+      LOG(ERROR) << "Keeping the current OCSP response: " << ex.what();
+      continue;
+    }
+    std::lock_guard<std::mutex> g(mutex_);
+    entries_[path.first].response = std::move(response);
+  }
+}
+
+OCSPStapler::Clock::time_point OCSPStapler::nextRefresh() const {
+  auto now = Clock::now();
+  auto next = now + refreshInterval_;
+  {
+    std::lock_guard<std::mutex> g(mutex_);
+    for (auto& entry : entries_) {
+      auto nextUpdate = entry.response->nextUpdate;
+      if (nextUpdate != Clock::time_point::max() && nextUpdate > now) {
+        next = std::min(next, now + (nextUpdate - now) / 2);
+      }
+    }
+  }
+  return std::max(next, now + kMinRefreshInterval);
+}
+
+std::string OCSPStapler::getResponse(X509* cert) const {
+  auto response = find(cert);
+  return response ? response->der : std::string();
+}
+
+std::shared_ptr<const OCSPStapler::Response> OCSPStapler::load(
+    const std::string& path) {
+  auto response = std::make_shared<Response>();
+  if (!folly::readFile(path.c_str(), response->der)) {
+    throw std::runtime_error(
+      folly::to<std::string>("error reading OCSP response ", path));
+  }
+
+  auto p = reinterpret_cast<const unsigned char*>(response->der.data());
+  OCSP_RESPONSE* resp = d2i_OCSP_RESPONSE(
+    nullptr, &p, long(response->der.size()));
+  if (!resp) {
+    throw std::runtime_error(
+      folly::to<std::string>("error parsing OCSP response ", path));
+  }
+  SCOPE_EXIT { OCSP_RESPONSE_free(resp); };
+  if (OCSP_response_status(resp) != OCSP_RESPONSE_STATUS_SUCCESSFUL) {
+    throw std::runtime_error(
+      folly::to<std::string>("unsuccessful OCSP response ", path));
+  }
+
+  response->nextUpdate = Clock::time_point::max();
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+  OCSP_BASICRESP* basic = OCSP_response_get1_basic(resp);
+  if (basic) {
+    SCOPE_EXIT { OCSP_BASICRESP_free(basic); };
+    int reason;
+    ASN1_GENERALIZEDTIME* revoked;
+    ASN1_GENERALIZEDTIME* thisUpdate;
+    ASN1_GENERALIZEDTIME* nextUpdate = nullptr;
+    OCSP_SINGLERESP* single = OCSP_resp_get0(basic, 0);
+    int days;
+    int seconds;
+    if (single &&
+        OCSP_single_get0_status(
+          single, &reason, &revoked, &thisUpdate, &nextUpdate) >= 0 &&
+        nextUpdate &&
+        ASN1_TIME_diff(&days, &seconds, nullptr, nextUpdate)) {
+      response->nextUpdate = Clock::now() +
+        std::chrono::seconds(int64_t(days) * 86400 + seconds);
+    }
+  }
+#endif
+  return response;
+}
+
+std::shared_ptr<const OCSPStapler::Response> OCSPStapler::find(
+    X509* cert) const {
+  std::lock_guard<std::mutex> g(mutex_);
+  for (auto& entry : entries_) {
+    if (entry.cert == cert) {
+      return entry.response;
+    }
+  }
+  return nullptr;
+}
+
+int OCSPStapler::statusCallback(SSL* ssl, void* arg) {
+  auto stapler = static_cast<OCSPStapler*>(arg);
+  auto response = stapler->find(SSL_get_certificate(ssl));
+  if (!response || response->nextUpdate <= Clock::now()) {
+    return SSL_TLSEXT_ERR_NOACK;
+  }
+  // OpenSSL frees it with the SSL
+  auto der = static_cast<unsigned char*>(
+    OPENSSL_malloc(response->der.size()));
+  if (!der) {
+    return SSL_TLSEXT_ERR_NOACK;
+  }
+  memcpy(der, response->der.data(), response->der.size());
+  SSL_set_tlsext_status_ocsp_resp(ssl, der, long(response->der.size()));
+  return SSL_TLSEXT_ERR_OK;
+}
+
+}
@@ -0,0 +1,96 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <openssl/ssl.h>
+
+namespace wangle {
+
+/**
+ * Staples the OCSP responses of the certificates of a SSL_CTX to the
+ * handshakes asking for one. The responses, in DER form, are read from
+ * files kept up to date by whatever fetches them from the CA, and served
+ * from memory: a handshake only copies the response of its certificate
+ * into the SSL, no I/O.
+ *
+ * refresh() rereads the files; nextRefresh() tells when it should run
+ * next, half way to the soonest nextUpdate of the responses if that is
+ * closer than the refresh interval. A response past its nextUpdate is not
+ * stapled anymore, as clients would reject it. Thread safe.
+ */
+class OCSPStapler {
+ public:
+  typedef std::chrono::system_clock Clock;
+
+  /**
+   * Creates the stapler of ctx and sets it as its status callback. ctx
+   * keeps a reference to it, so that handshakes in progress can still
+   * use it after the caller drops its own.
+   */
+  static std::shared_ptr<OCSPStapler> install(
+    SSL_CTX* ctx,
+    std::chrono::seconds refreshInterval);
+
+  /**
+   * Staples the response in responsePath, for handshakes using cert.
+   * Throws if the file can't be read or doesn't hold a successful OCSP
+   * response.
+   */
+  void addCertificate(X509* cert, const std::string& responsePath);
+
+  /**
+   * Rereads the response files, keeping the current response of those
+   * that can't be read or parsed.
+   */
+  void refresh();
+
+  Clock::time_point nextRefresh() const;
+
+  // The response stapled for cert at the moment, empty if none
+  std::string getResponse(X509* cert) const;
+
+  // Don't refresh more often than this, whatever the responses say
+  static constexpr std::chrono::seconds kMinRefreshInterval{60};
+
+ private:
+  struct Response {
+    std::string der;
+    // max() if the response doesn't say
+    Clock::time_point nextUpdate;
+  };
+
+  struct Entry {
+    X509* cert;
+    std::string path;
+    std::shared_ptr<const Response> response;
+  };
+
+  explicit OCSPStapler(std::chrono::seconds refreshInterval)
+      : refreshInterval_(refreshInterval) {}
+
+  // Throws on failure
+  static std::shared_ptr<const Response> load(const std::string& path);
+
+  std::shared_ptr<const Response> find(X509* cert) const;
+
+  static int statusCallback(SSL* ssl, void* arg);
+
+  const std::chrono::seconds refreshInterval_;
+  mutable std::mutex mutex_;
+  std::vector<Entry> entries_;
+};
+
+}
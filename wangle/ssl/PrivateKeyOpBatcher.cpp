@@ -0,0 +1,109 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/ssl/PrivateKeyOpBatcher.h>
+
+#include <glog/logging.h>
+
+namespace wangle {
+
+PrivateKeyOpBatcher::PrivateKeyOpBatcher(folly::EventBase* evb,
+                                         BatchFn batchFn,
+                                         Options options)
+    : folly::AsyncTimeout(evb),
+      evb_(evb),
+      batchFn_(std::move(batchFn)),
+      options_(options),
+      counters_(std::make_shared<Counters>()) {}
+
+PrivateKeyOpBatcher::~PrivateKeyOpBatcher() {
+  // Rather than leaving the handshakes waiting
+  flush();
+}
+
+folly::Future<std::string> PrivateKeyOpBatcher::add(PrivateKeyOp op) {
+  DCHECK(evb_->isInEventBaseThread());
+  if (!batch_) {
+    batch_ = std::make_shared<Batch>();
+    batch_->counters = counters_;
+    scheduleTimeout(uint32_t(options_.window.count()));
+  }
+  ops_.push_back(std::move(op));
+  batch_->promises.emplace_back();
+  auto future = batch_->promises.back().getFuture();
+  if (ops_.size() >= options_.maxBatchSize) {
+    flush();
+  }
+  return future;
+}
+
+void PrivateKeyOpBatcher::timeoutExpired() noexcept {
+  flush();
+}
+
+void PrivateKeyOpBatcher::flush() {
+  cancelTimeout();
+  if (!batch_) {
+    return;
+  }
+  auto batch = std::move(batch_);
+  batch_.reset();
+  std::vector<PrivateKeyOp> ops;
+  ops.swap(ops_);
+  counters_->batches++;
+  counters_->ops += ops.size();
+
+  evb_->runAfterDelay([batch] {
+    if (!batch->done) {
+      batch->counters->timeouts++;
+      complete(batch, folly::Try<std::vector<std::string>>(
+        folly::make_exception_wrapper<PrivateKeyOpTimeout>()));
+    }
+  }, uint32_t(options_.timeout.count()));
+
+  folly::Future<std::vector<std::string>> results =
+    folly::makeFuture<std::vector<std::string>>(std::runtime_error(
+      "no private key batch function"));
+  if (batchFn_) {
+    try {
+      results = batchFn_(std::move(ops));
+    } catch (const std::exception& ex) {
+      results = folly::makeFuture<std::vector<std::string>>(
+        folly::exception_wrapper(std::current_exception(), ex));
+    }
+  }
+  std::move(results).via(evb_).then(
+    [batch](folly::Try<std::vector<std::string>>&& t) {
+      complete(batch, std::move(t));
+    });
+}
+
+void PrivateKeyOpBatcher::complete(
+    const std::shared_ptr<Batch>& batch,
+    folly::Try<std::vector<std::string>>&& results) {
+  if (batch->done) {
+    return;
+  }
+  batch->done = true;
+  auto& promises = batch->promises;
+  if (results.hasValue() && results.value().size() != promises.size()) {
+    results = folly::Try<std::vector<std::string>>(
+      folly::make_exception_wrapper<std::runtime_error>(
+        "wrong number of private key operation results"));
+  }
+  for (size_t i = 0; i < promises.size(); i++) {
+    if (results.hasException()) {
+      promises[i].setException(results.exception());
+    } else {
+      promises[i].setValue(std::move(results.value()[i]));
+    }
+  }
+}
+
+}
@@ -0,0 +1,127 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <folly/futures/Future.h>
+#include <folly/io/async/AsyncTimeout.h>
+#include <folly/io/async/EventBase.h>
+
+namespace wangle {
+
+/**
+ * A private key operation for a key that lives outside the process, see
+ * SSLContextConfig::isLocalPrivateKey.
+ */
+struct PrivateKeyOp {
+  enum class Type : uint8_t {
+    SIGN,
+    DECRYPT,
+  };
+
+  // Which key, e.g. the certificate's path or a hash of its public key
+  std::string keyId;
+  Type type{Type::SIGN};
+  // The digest to sign, or the data to decrypt
+  std::string input;
+};
+
+class PrivateKeyOpTimeout : public std::runtime_error {
+ public:
+  PrivateKeyOpTimeout()
+      : std::runtime_error("private key operation timed out") {}
+};
+
+/**
+ * Gathers the private key operations of the handshakes of an EventBase
+ * into batches, each sent to the key servers in one call: under a
+ * reconnect storm, that is one call per window instead of one per
+ * handshake. For the enableAsyncCrypto() of SSLContextManager subclasses,
+ * to resume the handshakes from once their operation is done.
+ *
+ * A batch is sent when window has passed since its first operation, or
+ * once it has maxBatchSize of them. If the call doesn't complete within
+ * timeout, the operations fail with PrivateKeyOpTimeout, for the caller
+ * to fall back on a local key or fail the handshake, and its result is
+ * dropped. The results are delivered on the EventBase thread, from which
+ * add() must be called too.
+ */
+class PrivateKeyOpBatcher : private folly::AsyncTimeout {
+ public:
+  // Returns a result for each operation, in the same order
+  typedef std::function<folly::Future<std::vector<std::string>>(
+    std::vector<PrivateKeyOp>)> BatchFn;
+
+  struct Options {
+    std::chrono::milliseconds window{1};
+    size_t maxBatchSize{64};
+    std::chrono::milliseconds timeout{500};
+  };
+
+  PrivateKeyOpBatcher(folly::EventBase* evb,
+                      BatchFn batchFn,
+                      Options options = Options());
+
+  ~PrivateKeyOpBatcher() override;
+
+  folly::Future<std::string> add(PrivateKeyOp op);
+
+  // Sends the operations waiting now, without waiting for the window
+  void flush();
+
+  uint64_t getNumBatches() const {
+    return counters_->batches;
+  }
+
+  uint64_t getNumOps() const {
+    return counters_->ops;
+  }
+
+  // Batches which timed out
+  uint64_t getNumTimeouts() const {
+    return counters_->timeouts;
+  }
+
+ private:
+  // Only touched from the EventBase thread, by batches which can outlive
+  // the batcher too
+  struct Counters {
+    uint64_t batches{0};
+    uint64_t ops{0};
+    uint64_t timeouts{0};
+  };
+
+  // Shared between the call's callback and its timeout
+  struct Batch {
+    std::vector<folly::Promise<std::string>> promises;
+    std::shared_ptr<Counters> counters;
+    bool done{false};
+  };
+
+  void timeoutExpired() noexcept override;
+
+  static void complete(
+    const std::shared_ptr<Batch>& batch,
+    folly::Try<std::vector<std::string>>&& results);
+
+  folly::EventBase* evb_;
+  BatchFn batchFn_;
+  const Options options_;
+  std::vector<PrivateKeyOp> ops_;
+  std::shared_ptr<Batch> batch_;
+  std::shared_ptr<Counters> counters_;
+};
+
+}
@@ -11,6 +11,7 @@
 
 #include <chrono>
 #include <cstdint>
+#include <string>
 
 namespace wangle {
 
@@ -18,6 +19,21 @@ struct SSLCacheOptions {
   std::chrono::seconds sslCacheTimeout;
   uint64_t maxSSLCacheSize;
   uint64_t sslCacheFlushSize;
+  // Locks the process wide session cache is split across; 0 for the default
+  uint32_t sslCacheShards;
+  // Sessions each IO thread keeps to itself in front of the process wide
+  // cache, without locking; 0 for none
+  uint32_t sslThreadCacheSize;
+  // Sessions looked up in the external cache per getAsyncBatch() call, from
+  // the misses of one event loop iteration; 0 or 1 for one getAsync() each
+  uint32_t sslExternalBatchSize;
+  // How long a session the external cache didn't have isn't asked for
+  // again; 0 for always asking
+  std::chrono::milliseconds sslExternalMissTTL;
+  // Where the process wide cache's sessions are saved on shutdown() and
+  // loaded from when it's created, to resume sessions from the start after
+  // a restart; empty for none. See SSLSessionCacheManager::saveSessions().
+  std::string sslCacheSnapshotFile;
 };
 
 } // namespace wangle
@@ -11,6 +11,8 @@
 
 #include <folly/io/async/AsyncSSLSocket.h>
 
+#include <vector>
+
 namespace wangle {
 
 class SSLSessionCacheManager;
@@ -64,6 +66,26 @@ public:
   virtual bool getAsync(const std::string& sessionId,
                         CacheContext* context) = 0;
 
+  /**
+   * Retrieve several sessions from the external cache, e.g. with one multi
+   * get, calling the cache manager's onGetSuccess() or onGetFailure()
+   * callback for each of them when done.  Defaults to a getAsync() each.
+   * @param contexts    Data for each session to fetch; the session ID to
+   *                      fetch is in its sessionId
+   * @return the contexts whose lookup couldn't be initiated, which are
+   *         left to the caller
+   */
+  virtual std::vector<CacheContext*> getAsyncBatch(
+      const std::vector<CacheContext*>& contexts) {
+    std::vector<CacheContext*> failed;
+    for (auto context : contexts) {
+      if (!getAsync(context->sessionId, context)) {
+        failed.push_back(context);
+      }
+    }
+    return failed;
+  }
+
 };
 
 } // namespace wangle
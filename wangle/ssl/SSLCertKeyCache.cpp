@@ -0,0 +1,236 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/ssl/SSLCertKeyCache.h>
+
+#include <folly/Conv.h>
+#include <folly/ScopeGuard.h>
+#include <folly/Singleton.h>
+#include <glog/logging.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <wangle/concurrent/GlobalExecutor.h>
+#include <wangle/ssl/PasswordInFile.h>
+#include <wangle/ssl/SSLUtil.h>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+folly::Singleton<wangle::SSLCertKeyCache> defaultCache;
+
+std::string lastError() {
+  char buf[256];
+  ERR_error_string_n(ERR_get_error(), buf, sizeof(buf));
+  ERR_clear_error();
+  return buf;
+}
+
+int passwordCallback(char* buf, int size, int /* rwflag */, void* data) {
+  auto password = static_cast<const std::string*>(data);
+  int length = std::min(int(password->size()), size);
+  memcpy(buf, password->data(), length);
+  return length;
+}
+
+}
+
+namespace wangle {
+
+SSLCertKeyCache::Certificate::~Certificate() {
+  if (cert) {
+    X509_free(cert);
+  }
+  for (auto x509 : chain) {
+    X509_free(x509);
+  }
+}
+
+SSLCertKeyCache::PrivateKey::~PrivateKey() {
+  if (key) {
+    EVP_PKEY_free(key);
+  }
+}
+
+std::shared_ptr<SSLCertKeyCache> SSLCertKeyCache::getDefault() {
+  return defaultCache.try_get();
+}
+
+template <typename T, typename LoadFn>
+std::shared_ptr<const T> SSLCertKeyCache::getOrLoad(
+    SlotMap<T>& slots,
+    const std::string& key,
+    std::string version,
+    LoadFn&& load) {
+  std::promise<std::shared_ptr<const T>> promise;
+  std::shared_future<std::shared_ptr<const T>> parsed;
+  {
+    std::lock_guard<std::mutex> g(mutex_);
+    auto it = slots.find(key);
+    if (it != slots.end() && it->second.version == version) {
+      parsed = it->second.value;
+    } else {
+      slots[key] = Slot<T>{version, promise.get_future().share()};
+    }
+  }
+  if (parsed.valid()) {
+    // Rethrows the failure of the parse waited for
+    return parsed.get();
+  }
+
+  try {
+    auto value = load();
+    promise.set_value(value);
+    return value;
+  } catch (...) {
+    promise.set_exception(std::current_exception());
+    // Parsed again on the next call, in case the error was passing
+    std::lock_guard<std::mutex> g(mutex_);
+    auto it = slots.find(key);
+    if (it != slots.end() && it->second.version == version) {
+      slots.erase(it);
+    }
+    throw;
+  }
+}
+
+std::shared_ptr<const SSLCertKeyCache::Certificate>
+SSLCertKeyCache::getCertificate(const std::string& path) {
+  return getOrLoad(certificates_, path, SSLUtil::getFileVersion(path),
+                   [&] { return loadCertificate(path); });
+}
+
+std::shared_ptr<const SSLCertKeyCache::PrivateKey>
+SSLCertKeyCache::getPrivateKey(const std::string& path,
+                               const std::string& passwordPath) {
+  auto key = folly::to<std::string>(path, '\0', passwordPath);
+  auto version = folly::to<std::string>(
+    SSLUtil::getFileVersion(path), '\0',
+    SSLUtil::getFileVersion(passwordPath));
+  return getOrLoad(keys_, key, std::move(version),
+                   [&] { return loadPrivateKey(path, passwordPath); });
+}
+
+folly::Future<folly::Unit> SSLCertKeyCache::preload(
+    const std::vector<SSLContextConfig>& ctxConfigs,
+    folly::Executor* executor) {
+  auto cpuExecutor = getCPUExecutor();
+  if (!executor) {
+    executor = cpuExecutor.get();
+  }
+  std::vector<folly::Future<folly::Unit>> loads;
+  for (const auto& ctxConfig : ctxConfigs) {
+    const bool loadKeys = ctxConfig.isLocalPrivateKey;
+    for (const auto& cert : ctxConfig.certificates) {
+      loads.push_back(folly::via(executor, [this, cert, loadKeys,
+                                            cpuExecutor] {
+        try {
+          getCertificate(cert.certPath);
+          if (loadKeys) {
+            getPrivateKey(cert.keyPath, cert.passwordPath);
+          }
+        } catch (const std::exception& ex) {
+          LOG(ERROR) << "Failed to preload " << cert.certPath << ": "
+                     << ex.what();
+        }
+      }));
+    }
+  }
+  return folly::collectAll(loads).then(
+    [](const std::vector<folly::Try<folly::Unit>>&) {});
+}
+
+void SSLCertKeyCache::useCertificate(SSL_CTX* ctx, const Certificate& cert) {
+  if (SSL_CTX_use_certificate(ctx, cert.cert) != 1) {
+    throw std::runtime_error(lastError());
+  }
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+  // The chain of the current certificate, leaving those of the others
+  SSL_CTX_clear_chain_certs(ctx);
+  for (auto x509 : cert.chain) {
+    if (SSL_CTX_add1_chain_cert(ctx, x509) != 1) {
+      throw std::runtime_error(lastError());
+    }
+  }
+#else
+  for (auto x509 : cert.chain) {
+    CRYPTO_add(&x509->references, 1, CRYPTO_LOCK_X509);
+    if (SSL_CTX_add_extra_chain_cert(ctx, x509) != 1) {
+      X509_free(x509);
+      throw std::runtime_error(lastError());
+    }
+  }
+#endif
+}
+
+void SSLCertKeyCache::usePrivateKey(SSL_CTX* ctx, const PrivateKey& key) {
+  if (SSL_CTX_use_PrivateKey(ctx, key.key) != 1) {
+    throw std::runtime_error(lastError());
+  }
+}
+
+size_t SSLCertKeyCache::size() const {
+  std::lock_guard<std::mutex> g(mutex_);
+  return certificates_.size() + keys_.size();
+}
+
+void SSLCertKeyCache::clear() {
+  std::lock_guard<std::mutex> g(mutex_);
+  certificates_.clear();
+  keys_.clear();
+}
+
+std::shared_ptr<const SSLCertKeyCache::Certificate>
+SSLCertKeyCache::loadCertificate(const std::string& path) {
+  BIO* bio = BIO_new_file(path.c_str(), "r");
+  if (!bio) {
+    throw std::runtime_error(folly::to<std::string>(
+      "cannot open ", path, ": ", lastError()));
+  }
+  SCOPE_EXIT { BIO_free(bio); };
+  auto cert = std::make_shared<Certificate>();
+  cert->cert = PEM_read_bio_X509_AUX(bio, nullptr, nullptr, nullptr);
+  if (!cert->cert) {
+    throw std::runtime_error(folly::to<std::string>(
+      "cannot parse ", path, ": ", lastError()));
+  }
+  while (X509* x509 = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr)) {
+    cert->chain.push_back(x509);
+  }
+  // The end of the file
+  ERR_clear_error();
+  return cert;
+}
+
+std::shared_ptr<const SSLCertKeyCache::PrivateKey>
+SSLCertKeyCache::loadPrivateKey(const std::string& path,
+                                const std::string& passwordPath) {
+  std::string password;
+  if (!passwordPath.empty()) {
+    PasswordInFile(passwordPath).getPassword(password, 0);
+  }
+  BIO* bio = BIO_new_file(path.c_str(), "r");
+  if (!bio) {
+    throw std::runtime_error(folly::to<std::string>(
+      "cannot open ", path, ": ", lastError()));
+  }
+  SCOPE_EXIT { BIO_free(bio); };
+  auto key = std::make_shared<PrivateKey>();
+  key->key = PEM_read_bio_PrivateKey(
+    bio, nullptr, passwordCallback, &password);
+  if (!key->key) {
+    throw std::runtime_error(folly::to<std::string>(
+      "cannot parse ", path, ": ", lastError()));
+  }
+  return key;
+}
+
+}
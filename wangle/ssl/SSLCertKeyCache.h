@@ -0,0 +1,112 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <folly/Executor.h>
+#include <folly/futures/Future.h>
+#include <openssl/ssl.h>
+#include <wangle/ssl/SSLContextConfig.h>
+
+namespace wangle {
+
+/**
+ * The certificates and private keys parsed from their files, shared by
+ * every SSLContextManager of the process: with an Acceptor, and so a
+ * manager, for each IO thread, each file is parsed once rather than once
+ * per thread, and the SSL_CTXs of all the threads reference the same
+ * X509s and EVP_PKEYs, which OpenSSL only reads once loaded.
+ *
+ * A file is parsed again once its mtime or size changes. Thread safe;
+ * callers wanting the same file at once wait for a single parse.
+ */
+class SSLCertKeyCache : private boost::noncopyable {
+ public:
+  // A certificate and the chain following it in its file
+  struct Certificate : private boost::noncopyable {
+    ~Certificate();
+
+    X509* cert{nullptr};
+    std::vector<X509*> chain;
+  };
+
+  struct PrivateKey : private boost::noncopyable {
+    ~PrivateKey();
+
+    EVP_PKEY* key{nullptr};
+  };
+
+  /**
+   * A cache shared by the whole process, created on first use.
+   * Null during shutdown.
+   */
+  static std::shared_ptr<SSLCertKeyCache> getDefault();
+
+  // Both throw std::runtime_error if the file can't be read or parsed
+  std::shared_ptr<const Certificate> getCertificate(const std::string& path);
+  std::shared_ptr<const PrivateKey> getPrivateKey(
+    const std::string& path,
+    const std::string& passwordPath);
+
+  /**
+   * Parses the certificates and local private keys of ctxConfigs in
+   * parallel, on executor, the global CPU executor if null, for the
+   * SSLContextManagers to find them parsed. Failures are only logged, for
+   * the managers to report as usual. The cache must outlive the returned
+   * future.
+   */
+  folly::Future<folly::Unit> preload(
+    const std::vector<SSLContextConfig>& ctxConfigs,
+    folly::Executor* executor = nullptr);
+
+  // Uses what is cached in ctx, as its current certificate and key
+  static void useCertificate(SSL_CTX* ctx, const Certificate& cert);
+  static void usePrivateKey(SSL_CTX* ctx, const PrivateKey& key);
+
+  size_t size() const;
+
+  void clear();
+
+ private:
+  template <typename T>
+  struct Slot {
+    // See SSLUtil::getFileVersion()
+    std::string version;
+    std::shared_future<std::shared_ptr<const T>> value;
+  };
+
+  template <typename T>
+  using SlotMap = std::unordered_map<std::string, Slot<T>>;
+
+  template <typename T, typename LoadFn>
+  std::shared_ptr<const T> getOrLoad(SlotMap<T>& slots,
+                                     const std::string& key,
+                                     std::string version,
+                                     LoadFn&& load);
+
+  static std::shared_ptr<const Certificate> loadCertificate(
+    const std::string& path);
+  static std::shared_ptr<const PrivateKey> loadPrivateKey(
+    const std::string& path,
+    const std::string& passwordPath);
+
+  mutable std::mutex mutex_;
+  SlotMap<Certificate> certificates_;
+  SlotMap<PrivateKey> keys_;
+};
+
+}
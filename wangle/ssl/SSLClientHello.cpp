@@ -0,0 +1,249 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/ssl/SSLClientHello.h>
+
+#include <folly/Conv.h>
+#include <folly/String.h>
+
+#include <algorithm>
+#include <array>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using folly::AsyncSSLSocket;
+using folly::ByteRange;
+
+namespace wangle {
+
+namespace {
+
+typedef std::vector<std::pair<const AsyncSSLSocket*,
+                              std::shared_ptr<SSLClientHello>>> Kept;
+
+// The handshakes this thread keeps the ClientHello of
+Kept& keptHandshakes() {
+  static thread_local Kept kept;
+  return kept;
+}
+
+// The TLS names OpenSSL knows of the ciphers it implements
+const std::unordered_map<uint16_t, std::string>& cipherNames() {
+  static const std::unordered_map<uint16_t, std::string> names = [] {
+    std::unordered_map<uint16_t, std::string> m;
+    auto ctx = SSL_CTX_new(SSLv23_method());
+    if (!ctx) {
+      return m;
+    }
+    SSL_CTX_set_cipher_list(ctx, "ALL:COMPLEMENTOFALL");
+    auto ciphers = SSL_CTX_get_ciphers(ctx);
+    for (int i = 0; ciphers && i < sk_SSL_CIPHER_num(ciphers); i++) {
+      auto cipher = sk_SSL_CIPHER_value(ciphers, i);
+      m.emplace(uint16_t(SSL_CIPHER_get_id(cipher) & 0xffff),
+                SSL_CIPHER_get_name(cipher));
+    }
+    SSL_CTX_free(ctx);
+    return m;
+  }();
+  return names;
+}
+
+// Reads the fields of a handshake message, failing for good on the first
+// one truncated
+class Reader {
+ public:
+  explicit Reader(ByteRange data) : data_(data) {}
+
+  uint16_t readU16() {
+    auto bytes = take(2);
+    return bytes.empty() ? 0 : uint16_t((bytes[0] << 8) | bytes[1]);
+  }
+
+  ByteRange take(size_t n) {
+    if (!ok_ || data_.size() < n) {
+      ok_ = false;
+      return ByteRange();
+    }
+    auto bytes = data_.subpiece(0, n);
+    data_.advance(n);
+    return bytes;
+  }
+
+  // A field preceded by its length, in lengthSize bytes
+  ByteRange takeVector(size_t lengthSize) {
+    auto length = take(lengthSize);
+    if (length.empty()) {
+      return ByteRange();
+    }
+    size_t n = 0;
+    for (auto byte : length) {
+      n = (n << 8) | byte;
+    }
+    return take(n);
+  }
+
+  bool ok() const {
+    return ok_;
+  }
+
+  bool done() const {
+    return data_.empty();
+  }
+
+ private:
+  ByteRange data_;
+  bool ok_{true};
+};
+
+constexpr uint8_t kClientHello = 1;
+constexpr uint16_t kSignatureAlgorithms = 13;
+
+void appendHex(uint16_t value, std::string& out) {
+  std::array<uint8_t, 2> bytes{{uint8_t(value >> 8), uint8_t(value)}};
+  folly::hexlify(bytes, out, /* append_output = */ true);
+}
+
+}
+
+void SSLClientHello::messageCallback(int writeP,
+                                     int /* version */,
+                                     int contentType,
+                                     const void* buf,
+                                     size_t len,
+                                     SSL* ssl,
+                                     void* /* arg */) {
+  auto& kept = keptHandshakes();
+  if (kept.empty() || writeP || contentType != SSL3_RT_HANDSHAKE ||
+      len == 0 || static_cast<const uint8_t*>(buf)[0] != kClientHello) {
+    return;
+  }
+  auto sock = AsyncSSLSocket::getFromSSL(ssl);
+  for (auto& entry : kept) {
+    // The first one only, not that of a renegotiation
+    if (entry.first == sock && entry.second->empty()) {
+      entry.second->message_.assign(static_cast<const char*>(buf), len);
+      return;
+    }
+  }
+}
+
+void SSLClientHello::attach(const AsyncSSLSocket* sock,
+                            std::shared_ptr<SSLClientHello> hello) {
+  keptHandshakes().emplace_back(sock, std::move(hello));
+}
+
+void SSLClientHello::detach(const AsyncSSLSocket* sock) {
+  auto& kept = keptHandshakes();
+  kept.erase(
+    std::remove_if(kept.begin(), kept.end(),
+                   [sock](const Kept::value_type& entry) {
+                     return entry.first == sock;
+                   }),
+    kept.end());
+}
+
+SSLClientHello::Fields SSLClientHello::parse() const {
+  Fields fields;
+  Reader message(getMessage());
+  // type and length, client_version, random, session_id
+  message.take(4);
+  message.take(2);
+  message.take(32);
+  message.takeVector(1);
+  fields.ciphers = message.takeVector(2);
+  fields.comprMethods = message.takeVector(1);
+  if (!message.ok() || message.done()) {
+    return fields;
+  }
+  fields.exts = message.takeVector(2);
+  Reader exts(fields.exts);
+  while (exts.ok() && !exts.done()) {
+    auto type = exts.readU16();
+    auto data = exts.takeVector(2);
+    if (exts.ok() && type == kSignatureAlgorithms) {
+      fields.sigAlgs = Reader(data).takeVector(2);
+    }
+  }
+  return fields;
+}
+
+std::string SSLClientHello::getCiphers(bool names) const {
+  std::string out;
+  Reader ciphers(parse().ciphers);
+  while (!ciphers.done()) {
+    auto code = ciphers.readU16();
+    if (!ciphers.ok()) {
+      break;
+    }
+    if (!out.empty()) {
+      out.push_back(':');
+    }
+    if (names) {
+      auto it = cipherNames().find(code);
+      if (it != cipherNames().end()) {
+        out.append(it->second);
+        continue;
+      }
+    }
+    appendHex(code, out);
+  }
+  return out;
+}
+
+std::string SSLClientHello::getCiphers() const {
+  return getCiphers(true);
+}
+
+std::string SSLClientHello::getCiphersHex() const {
+  return getCiphers(false);
+}
+
+std::string SSLClientHello::getComprMethods() const {
+  std::string out;
+  for (auto method : parse().comprMethods) {
+    if (!out.empty()) {
+      out.push_back(':');
+    }
+    folly::toAppend(unsigned(method), &out);
+  }
+  return out;
+}
+
+std::string SSLClientHello::getExts() const {
+  std::string out;
+  Reader exts(parse().exts);
+  while (!exts.done()) {
+    auto type = exts.readU16();
+    exts.takeVector(2);
+    if (!exts.ok()) {
+      break;
+    }
+    if (!out.empty()) {
+      out.push_back(':');
+    }
+    folly::toAppend(type, &out);
+  }
+  return out;
+}
+
+std::string SSLClientHello::getSigAlgs() const {
+  std::string out;
+  auto sigAlgs = parse().sigAlgs;
+  for (size_t i = 0; i + 1 < sigAlgs.size(); i += 2) {
+    if (!out.empty()) {
+      out.push_back(':');
+    }
+    folly::toAppend(unsigned(sigAlgs[i]), ',', unsigned(sigAlgs[i + 1]),
+                    &out);
+  }
+  return out;
+}
+
+}
@@ -0,0 +1,93 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <folly/Range.h>
+#include <folly/io/async/AsyncSSLSocket.h>
+#include <openssl/ssl.h>
+
+namespace wangle {
+
+/**
+ * The ClientHello of a TLS handshake as it was received, for the
+ * handshakes ServerSocketConfig::sslClientHelloLazy keeps them for. It's
+ * a single copy of the message, decoded only by the getters, which return
+ * what the AsyncSSLSocket ClientHello getters return for the fields of
+ * TransportInfo, so that a handshake nobody looks at costs no parsing
+ * and no string per field.
+ *
+ * The message is captured by messageCallback(), which the SSL_CTXs
+ * parsing ClientHellos install, on the thread running the handshake, for
+ * the sockets attached there; like SSLHandshakeTimings, other handshakes
+ * cost a check of that thread's list for being empty.
+ */
+class SSLClientHello {
+ public:
+  SSLClientHello() = default;
+  explicit SSLClientHello(std::string message)
+      : message_(std::move(message)) {}
+
+  // For SSL_CTX_set_msg_callback()
+  static void messageCallback(int writeP,
+                              int version,
+                              int contentType,
+                              const void* buf,
+                              size_t len,
+                              SSL* ssl,
+                              void* arg);
+
+  /**
+   * Keeps the ClientHello of sock into hello, until detached. Both must be
+   * called on the thread running the handshake.
+   */
+  static void attach(const folly::AsyncSSLSocket* sock,
+                     std::shared_ptr<SSLClientHello> hello);
+  static void detach(const folly::AsyncSSLSocket* sock);
+
+  bool empty() const {
+    return message_.empty();
+  }
+
+  // The handshake message, its header included
+  folly::ByteRange getMessage() const {
+    return folly::StringPiece(message_);
+  }
+
+  // Cipher names, or 4 hex digits for those OpenSSL doesn't know, each
+  // followed by ':' but the last
+  std::string getCiphers() const;
+  // 4 hex digits per cipher
+  std::string getCiphersHex() const;
+  // In decimal, separated as above
+  std::string getComprMethods() const;
+  std::string getExts() const;
+  // "hash,signature" pairs of the signature_algorithms extension
+  std::string getSigAlgs() const;
+
+ private:
+  struct Fields {
+    folly::ByteRange ciphers;
+    folly::ByteRange comprMethods;
+    folly::ByteRange exts;
+    folly::ByteRange sigAlgs;
+  };
+
+  // Stops at the first field truncated, leaving it and those after empty
+  Fields parse() const;
+
+  std::string getCiphers(bool names) const;
+
+  std::string message_;
+};
+
+}
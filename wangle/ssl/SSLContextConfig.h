@@ -9,6 +9,7 @@
  */
 #pragma once
 
+#include <chrono>
 #include <string>
 #include <folly/Optional.h>
 #include <folly/io/async/SSLContext.h>
@@ -35,11 +36,17 @@ struct SSLContextConfig {
   struct CertificateInfo {
     CertificateInfo(const std::string& crtPath,
                     const std::string& kyPath,
-                    const std::string& passwdPath)
-        : certPath(crtPath), keyPath(kyPath), passwordPath(passwdPath) {}
+                    const std::string& passwdPath,
+                    const std::string& ocspPath = "")
+        : certPath(crtPath),
+          keyPath(kyPath),
+          passwordPath(passwdPath),
+          ocspResponsePath(ocspPath) {}
     std::string certPath;
     std::string keyPath;
     std::string passwordPath;
+    // DER OCSP response to staple for the certificate, if not empty
+    std::string ocspResponsePath;
   };
 
   struct KeyOffloadParams {
@@ -63,8 +70,10 @@ struct SSLContextConfig {
 
   void addCertificate(const std::string& certPath,
                       const std::string& keyPath,
-                      const std::string& passwordPath) {
-    certificates.emplace_back(certPath, keyPath, passwordPath);
+                      const std::string& passwordPath,
+                      const std::string& ocspResponsePath = "") {
+    certificates.emplace_back(
+      certPath, keyPath, passwordPath, ocspResponsePath);
   }
 
   /**
@@ -83,6 +92,10 @@ struct SSLContextConfig {
     folly::SSLContext::TLSv1};
   bool sessionCacheEnabled{true};
   bool sessionTicketEnabled{true};
+  // How long new session tickets share a salt, zero for a salt per ticket.
+  // A shared salt lets the keys derived for tickets be cached, see
+  // TLSTicketKeyManager::setSaltRotationInterval().
+  std::chrono::seconds ticketSaltRotationInterval{0};
   bool clientHelloParsingEnabled{true};
   std::string sslCiphers{
     "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-ECDSA-AES256-GCM-SHA384:"
@@ -115,6 +128,20 @@ struct SSLContextConfig {
   // same context. If not specified the common name for the certificates set
   // in the context will be used by default.
   folly::Optional<std::string> sessionContext;
+  // How often the OCSP response files of the certificates are reread, at
+  // most; sooner if a response expires before then. See OCSPStapler.
+  std::chrono::seconds ocspRefreshInterval{3600};
+  // Bytes of TLS 1.3 early (0-RTT) data accepted on resumption, 0 for
+  // none. Early data is accepted once per ticket, see EarlyDataReplayCache,
+  // and can still be a replay: TransportInfo::sslEarlyData tells which
+  // connections had it, for only idempotent requests to be served from it.
+  // Needs OpenSSL 1.1.1, and an AsyncSSLSocket reading early data.
+  uint32_t maxEarlyData{0};
+  // Build the SSL_CTX on the first handshake asking for one of the names
+  // of the certificate, rather than when the config is added, and drop it
+  // again once it's one of the least recently used; see
+  // SSLContextManager::setMaxLazySSLContexts(). Ignored for the default.
+  bool lazy{false};
 };
 
 } // namespace wangle
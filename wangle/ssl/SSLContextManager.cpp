@@ -11,8 +11,12 @@
 
 #include <wangle/ssl/ClientHelloExtStats.h>
 #include <wangle/ssl/DHParam.h>
-#include <wangle/ssl/PasswordInFile.h>
+#include <wangle/ssl/EarlyDataReplayCache.h>
+#include <wangle/ssl/OCSPStapler.h>
 #include <wangle/ssl/SSLCacheOptions.h>
+#include <wangle/ssl/SSLCertKeyCache.h>
+#include <wangle/ssl/SSLClientHello.h>
+#include <wangle/ssl/SSLHandshakeTimings.h>
 #include <wangle/ssl/SSLSessionCacheManager.h>
 #include <wangle/ssl/SSLUtil.h>
 #include <wangle/ssl/TLSTicketKeyManager.h>
@@ -20,12 +24,18 @@
 
 #include <folly/Conv.h>
 #include <folly/ScopeGuard.h>
+#include <folly/SocketAddress.h>
 #include <folly/String.h>
+#include <algorithm>
 #include <functional>
 #include <openssl/asn1.h>
+#include <openssl/sha.h>
 #include <openssl/ssl.h>
+#include <set>
 #include <string>
+#include <folly/io/async/AsyncTimeout.h>
 #include <folly/io/async/EventBase.h>
+#include <wangle/concurrent/GlobalExecutor.h>
 
 #define OPENSSL_MISSING_FEATURE(name) \
 do { \
@@ -63,6 +73,36 @@ namespace wangle {
 
 namespace {
 
+/**
+ * The managers a SSL_CTX's callbacks find in its ex data. Held by the
+ * SSL_CTX until it's freed, after its last connection, rather than only
+ * by the manager's ContextEntry, which a reload drops while handshakes
+ * on the old SSL_CTX may still be going on.
+ */
+struct CtxManagers {
+  std::shared_ptr<SSLSessionCacheManager> sessionCacheManager;
+  std::shared_ptr<TLSTicketKeyManager> ticketManager;
+};
+
+// Called after the SSL_CTX's internal session cache is flushed, so the
+// session callbacks still find their manager until then
+void freeCtxManagers(void* /* parent */, void* ptr, CRYPTO_EX_DATA* /* ad */,
+                     int /* idx */, long /* argl */, void* /* argp */) {
+  delete static_cast<CtxManagers*>(ptr);
+}
+
+int getCtxManagersIndex() {
+  static int index = SSL_CTX_get_ex_new_index(
+    0, nullptr, nullptr, nullptr, freeCtxManagers);
+  return index;
+}
+
+void holdCtxManagers(SSL_CTX* ctx, CtxManagers managers) {
+  const auto index = getCtxManagersIndex();
+  delete static_cast<CtxManagers*>(SSL_CTX_get_ex_data(ctx, index));
+  SSL_CTX_set_ex_data(ctx, index, new CtxManagers(std::move(managers)));
+}
+
 X509* getX509(SSL_CTX* ctx) {
   SSL* ssl = SSL_new(ctx);
   SSL_set_connect_state(ssl);
@@ -124,6 +164,8 @@ std::unique_ptr<TLSTicketKeyManager> createTicketManagerHelper(
 #ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
   if (ticketSeeds && ctxConfig.sessionTicketEnabled) {
     ticketManager = folly::make_unique<TLSTicketKeyManager>(ctx.get(), stats);
+    ticketManager->setSaltRotationInterval(
+      ctxConfig.ticketSaltRotationInterval);
     ticketManager->setTLSTicketKeySeeds(
       ticketSeeds->oldSeeds,
       ticketSeeds->currentSeeds,
@@ -139,6 +181,9 @@ std::unique_ptr<TLSTicketKeyManager> createTicketManagerHelper(
   return ticketManager;
 }
 
+// Server names whose SSL_CTX is remembered by serverNameCallback
+const size_t kSNICacheSize = 256;
+
 std::string flattenList(const std::list<std::string>& list) {
   std::string s;
   bool first = true;
@@ -153,8 +198,150 @@ std::string flattenList(const std::list<std::string>& list) {
   return s;
 }
 
+CertCrypto getCertCrypto(X509* x509) {
+  int sigAlg = OBJ_obj2nid(x509->sig_alg->algorithm);
+  if (sigAlg == NID_sha1WithRSAEncryption ||
+      sigAlg == NID_ecdsa_with_SHA1) {
+    return CertCrypto::SHA1_SIGNATURE;
+  }
+  return CertCrypto::BEST_AVAILABLE;
+}
+
+// A CN or subject alternative name as the lazy index keeps it: lowercase,
+// and "*.example.com" as ".example.com", like in the trie. Throws for the
+// names the trie doesn't take either.
+std::string getLazyIndexName(const std::string& name) {
+  folly::StringPiece dn(name);
+  if (dn.size() > 2 && dn.startsWith("*.")) {
+    dn.advance(1);
+  }
+  if (dn.empty() || dn == "." || dn.find('*') != folly::StringPiece::npos) {
+    throw std::runtime_error(folly::to<string>(
+      "Invalid CN/subject-alternative-name \"", name, "\""));
+  }
+  auto indexName = dn.str();
+  folly::toLowerAscii(&indexName[0], indexName.size());
+  return indexName;
+}
+
+void appendFileVersion(const std::string& path, std::string& out) {
+  folly::toAppend(SSLUtil::getFileVersion(path), ';', &out);
+}
+
+/**
+ * What a context is built from: the fields of its config but the SNI no
+ * match callback, and the versions of the files it loads, but the OCSP
+ * responses its stapler rereads by itself. Contexts with the same
+ * fingerprint are interchangeable.
+ */
+std::string getFingerprint(const SSLContextConfig& ctxConfig) {
+  std::string fp;
+  for (const auto& cert : ctxConfig.certificates) {
+    appendFileVersion(cert.certPath, fp);
+    appendFileVersion(cert.keyPath, fp);
+    appendFileVersion(cert.passwordPath, fp);
+    folly::toAppend(cert.ocspResponsePath, ';', &fp);
+  }
+  folly::toAppend(int(ctxConfig.sslVersion), ';',
+                  ctxConfig.sessionCacheEnabled, ';',
+                  ctxConfig.sessionTicketEnabled, ';',
+                  ctxConfig.clientHelloParsingEnabled, ';',
+                  ctxConfig.sslCiphers, ';',
+                  ctxConfig.eccCurveName, ';',
+                  ctxConfig.tls11Ciphers, ';', &fp);
+  for (const auto& cipher : ctxConfig.tls11AltCipherlist) {
+    folly::toAppend(cipher.first, '=', cipher.second, ',', &fp);
+  }
+  fp.push_back(';');
+  for (const auto& item : ctxConfig.nextProtocols) {
+    folly::toAppend(item.weight, '=', flattenList(item.protocols), ',', &fp);
+  }
+  fp.push_back(';');
+  folly::toAppend(ctxConfig.isLocalPrivateKey, ';',
+                  ctxConfig.isDefault, ';', &fp);
+  appendFileVersion(ctxConfig.clientCAFile, fp);
+  folly::toAppend(int(ctxConfig.clientVerification), ';',
+                  ctxConfig.keyOffloadParams.localFallback, ';', &fp);
+  for (const auto& type : ctxConfig.keyOffloadParams.offloadType) {
+    folly::toAppend(type, ',', &fp);
+  }
+  fp.push_back(';');
+  if (ctxConfig.sessionContext) {
+    folly::toAppend('=', *ctxConfig.sessionContext, &fp);
+  }
+  folly::toAppend(';', ctxConfig.ocspRefreshInterval.count(), &fp);
+  folly::toAppend(';', ctxConfig.maxEarlyData, ';', ctxConfig.lazy, &fp);
+  return fp;
+}
+
+#ifdef SSL_EARLY_DATA_ACCEPTED
+// Accepts the early data of a resumption once per ticket: the resumption
+// secret is that of the ticket, whichever connection presents it. Only its
+// digest is remembered.
+int allowEarlyData(SSL* ssl, void* /* arg */) {
+  auto cache = EarlyDataReplayCache::getDefault();
+  auto session = SSL_get_session(ssl);
+  if (!cache || !session) {
+    return 0;
+  }
+  // Replays of a ticket outliving the window wouldn't all be caught, e.g.
+  // one issued by another server sharing the ticket keys
+  if (SSL_SESSION_get_timeout(session) > cache->getWindow().count()) {
+    return 0;
+  }
+  unsigned char secret[SSL_MAX_MASTER_KEY_LENGTH];
+  auto length = SSL_SESSION_get_master_key(session, secret, sizeof(secret));
+  unsigned char digest[SHA256_DIGEST_LENGTH];
+  SHA256(secret, length, digest);
+  OPENSSL_cleanse(secret, sizeof(secret));
+  return cache->checkAndInsert(folly::ByteRange(digest, sizeof(digest)));
+}
+#endif
+
 }
 
+class SSLContextManager::OCSPRefreshTimeout : public folly::AsyncTimeout {
+ public:
+  explicit OCSPRefreshTimeout(SSLContextManager* manager)
+      : folly::AsyncTimeout(manager->eventBase_), manager_(manager) {}
+
+  void timeoutExpired() noexcept override {
+    // The files are read in the background, the next refresh is at least
+    // OCSPStapler::kMinRefreshInterval away
+    auto executor = getCPUExecutor();
+    for (const auto& stapler : manager_->getOCSPStaplers()) {
+      executor->add([stapler] { stapler->refresh(); });
+    }
+    manager_->scheduleOCSPRefresh();
+  }
+
+ private:
+  SSLContextManager* manager_;
+};
+
+struct SSLContextManager::LazyContext {
+  std::string fingerprint;
+  SSLContextConfig config;
+  SSLCacheOptions cacheOptions;
+  folly::Optional<TLSTicketKeySeeds> ticketSeeds;
+  folly::SocketAddress vipAddress;
+  std::shared_ptr<SSLCacheProvider> externalCache;
+  // Held while building, for the handshakes wanting it meanwhile to wait
+  // for that build
+  std::mutex buildMutex;
+
+  // The rest is under the manager's lazyMutex_. The entry is owned by the
+  // SSL_CTX handed out, for its session cache and ticket managers to stay
+  // until the last handshake using it is done, though dropped here.
+  std::shared_ptr<folly::SSLContext> ctx;
+  std::shared_ptr<ContextEntry> entry;
+  std::list<std::shared_ptr<LazyContext>>::iterator lruPos;
+  // Counts the changes of ticketSeeds, which builds may race with
+  uint64_t ticketSeedsVersion{0};
+  // Once a reload replaced it, not to be kept built anymore
+  bool removed{false};
+};
+
 SSLContextManager::~SSLContextManager() = default;
 
 SSLContextManager::SSLContextManager(
@@ -163,6 +350,7 @@ SSLContextManager::SSLContextManager(
   bool strict,
   SSLStats* stats) :
     stats_(stats),
+    sniCache_(kSNICacheSize),
     eventBase_(eventBase),
     strict_(strict) {
 }
@@ -173,15 +361,39 @@ void SSLContextManager::addSSLContextConfig(
   const TLSTicketKeySeeds* ticketSeeds,
   const folly::SocketAddress& vipAddress,
   const std::shared_ptr<SSLCacheProvider>& externalCache) {
+  if (isLazy(ctxConfig)) {
+    addLazySSLContextConfig(ctxConfig, cacheOptions, ticketSeeds, vipAddress,
+                            externalCache, getFingerprint(ctxConfig));
+    return;
+  }
+  installSSLContext(
+    buildSSLContext(ctxConfig, cacheOptions, getFingerprint(ctxConfig)),
+    ctxConfig,
+    cacheOptions,
+    ticketSeeds,
+    vipAddress,
+    externalCache);
+}
 
+SSLContextManager::BuiltContext SSLContextManager::buildSSLContext(
+  const SSLContextConfig& ctxConfig,
+  const SSLCacheOptions& cacheOptions,
+  std::string fingerprint) {
   unsigned numCerts = 0;
   std::string commonName;
   std::string lastCertPath;
   std::unique_ptr<std::list<std::string>> subjectAltName;
   auto sslCtx = std::make_shared<SSLContext>(ctxConfig.sslVersion);
+  std::shared_ptr<OCSPStapler> ocspStapler;
+  // Parsed once for all the managers of the process
+  auto certKeyCache = SSLCertKeyCache::getDefault();
+  if (!certKeyCache) {
+    certKeyCache = std::make_shared<SSLCertKeyCache>();
+  }
   for (const auto& cert : ctxConfig.certificates) {
     try {
-      sslCtx->loadCertificate(cert.certPath.c_str());
+      SSLCertKeyCache::useCertificate(
+        sslCtx->getSSLCtx(), *certKeyCache->getCertificate(cert.certPath));
     } catch (const std::exception& ex) {
       // The exception isn't very useful without the certificate path name,
       // so throw a new exception that includes the path to the certificate.
@@ -235,6 +447,22 @@ void SSLContextManager::addSSLContextConfig(
     }
     lastCertPath = cert.certPath;
 
+    if (!cert.ocspResponsePath.empty()) {
+      if (!ocspStapler) {
+        ocspStapler = OCSPStapler::install(sslCtx->getSSLCtx(),
+                                           ctxConfig.ocspRefreshInterval);
+      }
+      try {
+        ocspStapler->addCertificate(x509, cert.ocspResponsePath);
+      } catch (const std::exception& ex) {
+        string msg = folly::to<string>("error loading OCSP response for ",
+                                       cert.certPath, ": ",
+                                       folly::exceptionStr(ex));
+        LOG(ERROR) << msg;
+        throw std::runtime_error(msg);
+      }
+    }
+
     int pkeyType = getPkeyType(x509);
     if (ctxConfig.isLocalPrivateKey
 #ifdef SSL_ERROR_WANT_ECDSA_ASYNC_PENDING
@@ -248,15 +476,10 @@ void SSLContextManager::addSSLContextConfig(
 #endif
         ) {
       // The private key lives in the same process
-
-      // This needs to be called before loadPrivateKey().
-      if (!cert.passwordPath.empty()) {
-        auto sslPassword = std::make_shared<PasswordInFile>(cert.passwordPath);
-        sslCtx->passwordCollector(sslPassword);
-      }
-
       try {
-        sslCtx->loadPrivateKey(cert.keyPath.c_str());
+        SSLCertKeyCache::usePrivateKey(
+          sslCtx->getSSLCtx(),
+          *certKeyCache->getPrivateKey(cert.keyPath, cert.passwordPath));
       } catch (const std::exception& ex) {
         // Throw an error that includes the key path, so the user can tell
         // which key had a problem.
@@ -330,43 +553,75 @@ void SSLContextManager::addSSLContextConfig(
   SSL_CTX_set_session_cache_mode(sslCtx->getSSLCtx(), SSL_SESS_CACHE_OFF);
   SSL_CTX_set_timeout(sslCtx->getSSLCtx(),
                       cacheOptions.sslCacheTimeout.count());
-  std::string sessionContext;
+  BuiltContext built;
   if (ctxConfig.sessionContext) {
-    sessionContext = *ctxConfig.sessionContext;
+    built.sessionContext = *ctxConfig.sessionContext;
   } else {
-    sessionContext = commonName;
+    built.sessionContext = commonName;
   }
-  std::unique_ptr<SSLSessionCacheManager> sessionCacheManager;
+  // even though SSLSessionCacheManager might set the context if enabled,
+  // we also want to setup the context in case a cache is not enabled.
+  sslCtx->setSessionCacheContext(built.sessionContext);
+
+  built.fingerprint = std::move(fingerprint);
+  built.ctx = std::move(sslCtx);
+  built.ocspStapler = std::move(ocspStapler);
+  return built;
+}
+
+SSLContextManager::ContextEntry SSLContextManager::makeContextEntry(
+  BuiltContext built,
+  const SSLContextConfig& ctxConfig,
+  const SSLCacheOptions& cacheOptions,
+  const TLSTicketKeySeeds* ticketSeeds,
+  const folly::SocketAddress& vipAddress,
+  const std::shared_ptr<SSLCacheProvider>& externalCache) {
+  auto& sslCtx = built.ctx;
+  ContextEntry entry;
   if (ctxConfig.sessionCacheEnabled &&
       cacheOptions.maxSSLCacheSize > 0 &&
       cacheOptions.sslCacheFlushSize > 0) {
-    sessionCacheManager =
-      folly::make_unique<SSLSessionCacheManager>(
-        cacheOptions.maxSSLCacheSize,
-        cacheOptions.sslCacheFlushSize,
+    entry.sessionCacheManager =
+      std::make_shared<SSLSessionCacheManager>(
+        cacheOptions,
         sslCtx.get(),
         vipAddress,
-        sessionContext,
+        built.sessionContext,
         eventBase_,
         stats_,
         externalCache);
   }
-  // even though SSLSessionCacheManager might set the context if enabled,
-  // we also want to setup the context in case a cache is not enabled.
-  sslCtx->setSessionCacheContext(sessionContext);
   // - end - SSL session cache config
 
-  std::unique_ptr<TLSTicketKeyManager> ticketManager =
+  entry.ticketManager =
     createTicketManagerHelper(sslCtx, ticketSeeds, ctxConfig, stats_);
 
   // finalize sslCtx setup by the individual features supported by openssl
   ctxSetupByOpensslFeature(sslCtx, ctxConfig);
 
+  holdCtxManagers(sslCtx->getSSLCtx(),
+                  CtxManagers{entry.sessionCacheManager, entry.ticketManager});
+
+  entry.fingerprint = std::move(built.fingerprint);
+  entry.ctx = std::move(sslCtx);
+  entry.ocspStapler = std::move(built.ocspStapler);
+  entry.isDefault = ctxConfig.isDefault;
+  return entry;
+}
+
+void SSLContextManager::installSSLContext(
+  BuiltContext built,
+  const SSLContextConfig& ctxConfig,
+  const SSLCacheOptions& cacheOptions,
+  const TLSTicketKeySeeds* ticketSeeds,
+  const folly::SocketAddress& vipAddress,
+  const std::shared_ptr<SSLCacheProvider>& externalCache) {
+  auto entry = makeContextEntry(std::move(built), ctxConfig, cacheOptions,
+                                ticketSeeds, vipAddress, externalCache);
+  setupSNI(entry.ctx, ctxConfig);
+  auto hasStapler = bool(entry.ocspStapler);
   try {
-    insert(sslCtx,
-           std::move(sessionCacheManager),
-           std::move(ticketManager),
-           ctxConfig.isDefault);
+    insert(std::move(entry));
   } catch (const std::exception& ex) {
     string msg = folly::to<string>("Error adding certificate : ",
                                    folly::exceptionStr(ex));
@@ -374,11 +629,225 @@ void SSLContextManager::addSSLContextConfig(
     throw std::runtime_error(msg);
   }
 
+  if (hasStapler) {
+    scheduleOCSPRefresh();
+  }
+}
+
+folly::Future<folly::Unit> SSLContextManager::reloadSSLContextConfigs(
+  std::vector<SSLContextConfig> ctxConfigs,
+  const SSLCacheOptions& cacheOptions,
+  const TLSTicketKeySeeds* ticketSeeds,
+  const folly::SocketAddress& vipAddress,
+  const std::shared_ptr<SSLCacheProvider>& externalCache,
+  folly::Executor* executor) {
+  auto configs = std::make_shared<std::vector<SSLContextConfig>>(
+    std::move(ctxConfigs));
+  auto current = std::make_shared<std::set<std::string>>();
+  for (const auto& entry : contexts_) {
+    current->insert(entry.fingerprint);
+  }
+  auto cpuExecutor = getCPUExecutor();
+  if (!executor) {
+    executor = cpuExecutor.get();
+  }
+  folly::Optional<TLSTicketKeySeeds> seeds;
+  if (ticketSeeds) {
+    seeds = *ticketSeeds;
+  }
+
+  // Checking the files and loading the keys is what takes time
+  return folly::via(executor, [this, configs, current, cacheOptions,
+                               cpuExecutor] {
+    std::vector<BuiltContext> built;
+    for (const auto& ctxConfig : *configs) {
+      auto fingerprint = getFingerprint(ctxConfig);
+      // Lazy ones are built on first use, as when added
+      if (current->count(fingerprint) || isLazy(ctxConfig)) {
+        BuiltContext unchanged;
+        unchanged.fingerprint = std::move(fingerprint);
+        built.push_back(std::move(unchanged));
+      } else {
+        built.push_back(
+          buildSSLContext(ctxConfig, cacheOptions, std::move(fingerprint)));
+      }
+    }
+    return built;
+  }).via(eventBase_).then([this, configs, cacheOptions, seeds, vipAddress,
+                           externalCache] (std::vector<BuiltContext>&& built) {
+    swapContexts(std::move(built), *configs, cacheOptions,
+                 seeds.get_pointer(), vipAddress, externalCache);
+  });
+}
+
+void SSLContextManager::swapContexts(
+  std::vector<BuiltContext> built,
+  const std::vector<SSLContextConfig>& ctxConfigs,
+  const SSLCacheOptions& cacheOptions,
+  const TLSTicketKeySeeds* ticketSeeds,
+  const folly::SocketAddress& vipAddress,
+  const std::shared_ptr<SSLCacheProvider>& externalCache) {
+  // Put back if the new contexts can't all be installed
+  auto oldContexts = std::move(contexts_);
+  auto oldRoot = std::move(dnRoot_);
+  auto oldDefaultCtx = std::move(defaultCtx_);
+  auto oldDefaultCtxDomainName = std::move(defaultCtxDomainName_);
+  auto oldNoMatchFn = std::move(noMatchFn_);
+  std::vector<std::shared_ptr<LazyContext>> oldLazy;
+  std::unordered_map<std::string, std::shared_ptr<LazyContext>> oldLazyIndex;
+  {
+    std::lock_guard<std::mutex> g(lazyMutex_);
+    oldLazy = std::move(lazyContexts_);
+    oldLazyIndex = std::move(lazyIndex_);
+    lazyContexts_.clear();
+    lazyIndex_.clear();
+  }
+  contexts_.clear();
+  dnRoot_ = DnNode();
+  defaultCtx_.reset();
+  defaultCtxDomainName_.clear();
+  noMatchFn_ = nullptr;
+  clearSNICache();
+
+  std::vector<bool> reused(oldContexts.size(), false);
+  std::vector<bool> lazyReused(oldLazy.size(), false);
+  try {
+    for (size_t i = 0; i < built.size(); i++) {
+      const auto& ctxConfig = ctxConfigs[i];
+      if (isLazy(ctxConfig)) {
+        // Kept built if unchanged
+        size_t j = 0;
+        while (j < oldLazy.size() &&
+               (lazyReused[j] ||
+                oldLazy[j]->fingerprint != built[i].fingerprint)) {
+          j++;
+        }
+        if (j < oldLazy.size()) {
+          lazyReused[j] = true;
+          noMatchFn_ = ctxConfig.sniNoMatchFn;
+          indexLazyContext(oldLazy[j]);
+          std::lock_guard<std::mutex> g(lazyMutex_);
+          lazyContexts_.push_back(oldLazy[j]);
+        } else {
+          addLazySSLContextConfig(ctxConfig, cacheOptions, ticketSeeds,
+                                  vipAddress, externalCache,
+                                  std::move(built[i].fingerprint));
+        }
+        continue;
+      }
+      if (!built[i].ctx) {
+        // Unchanged, unless replaced since the reload started
+        size_t j = 0;
+        while (j < oldContexts.size() &&
+               (reused[j] ||
+                oldContexts[j].fingerprint != built[i].fingerprint)) {
+          j++;
+        }
+        if (j < oldContexts.size()) {
+          reused[j] = true;
+          setupSNI(oldContexts[j].ctx, ctxConfig);
+          insert(oldContexts[j]);
+          continue;
+        }
+        built[i] = buildSSLContext(
+          ctxConfig, cacheOptions, std::move(built[i].fingerprint));
+      }
+      installSSLContext(std::move(built[i]), ctxConfig, cacheOptions,
+                        ticketSeeds, vipAddress, externalCache);
+    }
+  } catch (const std::exception& ex) {
+    LOG(ERROR) << "Keeping the current SSL contexts: "
+               << folly::exceptionStr(ex);
+    contexts_ = std::move(oldContexts);
+    dnRoot_ = std::move(oldRoot);
+    defaultCtx_ = std::move(oldDefaultCtx);
+    defaultCtxDomainName_ = std::move(oldDefaultCtxDomainName);
+    noMatchFn_ = std::move(oldNoMatchFn);
+    clearSNICache();
+    {
+      std::lock_guard<std::mutex> g(lazyMutex_);
+      lazyContexts_ = std::move(oldLazy);
+      lazyIndex_ = std::move(oldLazyIndex);
+    }
+    scheduleOCSPRefresh();
+    throw;
+  }
+  {
+    std::lock_guard<std::mutex> g(lazyMutex_);
+    for (size_t j = 0; j < oldLazy.size(); j++) {
+      if (!lazyReused[j]) {
+        oldLazy[j]->removed = true;
+        dropLazyContext(*oldLazy[j]);
+      }
+    }
+  }
+  scheduleOCSPRefresh();
+
+  size_t nReused = 0;
+  for (bool r : reused) {
+    nReused += r;
+  }
+  VLOG(2) << "Reloaded " << contexts_.size() << " SSL contexts, "
+          << contexts_.size() - nReused << " of them rebuilt";
+}
+
+void SSLContextManager::scheduleOCSPRefresh() {
+  auto next = OCSPStapler::Clock::time_point::max();
+  for (const auto& stapler : getOCSPStaplers()) {
+    next = std::min(next, stapler->nextRefresh());
+  }
+  if (next == OCSPStapler::Clock::time_point::max()) {
+    if (ocspRefreshTimeout_) {
+      ocspRefreshTimeout_->cancelTimeout();
+    }
+    return;
+  }
+  if (!eventBase_) {
+    LOG(WARNING) << "No EventBase to refresh the OCSP responses from";
+    return;
+  }
+  if (!ocspRefreshTimeout_) {
+    ocspRefreshTimeout_ = folly::make_unique<OCSPRefreshTimeout>(this);
+  }
+  auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(
+    next - OCSPStapler::Clock::now());
+  ocspRefreshTimeout_->scheduleTimeout(
+    std::max(delay, std::chrono::milliseconds(0)));
+}
+
+bool SSLContextManager::findCachedSNIMatch(
+  const std::string& key,
+  SNIMatch& match) {
+  std::lock_guard<std::mutex> g(sniCacheMutex_);
+  // Moves it to the front, so it's a write too
+  auto it = sniCache_.find(key);
+  if (it == sniCache_.end()) {
+    return false;
+  }
+  match = it->second;
+  return true;
+}
+
+void SSLContextManager::cacheSNIMatch(
+  const std::string& key,
+  const SNIMatch& match) {
+  std::lock_guard<std::mutex> g(sniCacheMutex_);
+  sniCache_.set(key, match);
+}
+
+void SSLContextManager::clearSNICache() {
+  std::lock_guard<std::mutex> g(sniCacheMutex_);
+  sniCache_.clear();
 }
 
 #ifdef PROXYGEN_HAVE_SERVERNAMECALLBACK
 SSLContext::ServerNameCallbackResult
 SSLContextManager::serverNameCallback(SSL* ssl) {
+  SSLHandshakeTimings::mark(ssl, SSLHandshakeTimings::Stage::CLIENT_HELLO);
+  SCOPE_EXIT {
+    SSLHandshakeTimings::mark(
+      ssl, SSLHandshakeTimings::Stage::CONTEXT_SELECTED);
+  };
   shared_ptr<SSLContext> ctx;
 
   const char* sn = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
@@ -414,6 +883,27 @@ SSLContextManager::serverNameCallback(SSL* ssl) {
     }
   }
 
+  auto matched = [&](const SNIMatch& match) {
+    sslSocket->switchServerSSLContext(match.ctx);
+    if (clientHelloTLSExtStats_) {
+      if (reqHasServerName) {
+        clientHelloTLSExtStats_->recordMatch();
+      }
+      clientHelloTLSExtStats_->recordCertCrypto(certCryptoReq,
+                                                match.certCrypto);
+    }
+    return SSLContext::SERVER_NAME_FOUND;
+  };
+
+  std::string cacheKey(sn, snLen);
+  folly::toLowerAscii(&cacheKey[0], cacheKey.size());
+  cacheKey.push_back(static_cast<char>(certCryptoReq));
+  SNIMatch cached;
+  if (findCachedSNIMatch(cacheKey, cached)) {
+    VLOG(6) << "Found a cached SSL_CTX for \"" << sn << "\"";
+    return matched(cached);
+  }
+
   DNString dnstr(sn, snLen);
   uint32_t count = 0;
   do {
@@ -423,30 +913,32 @@ SSLContextManager::serverNameCallback(SSL* ssl) {
     SSLContextKey key(dnstr, certCryptoReq);
     ctx = getSSLCtx(key);
     if (ctx) {
-      sslSocket->switchServerSSLContext(ctx);
-      if (clientHelloTLSExtStats_) {
-        if (reqHasServerName) {
-          clientHelloTLSExtStats_->recordMatch();
-        }
-        clientHelloTLSExtStats_->recordCertCrypto(certCryptoReq, certCryptoReq);
-      }
-      return SSLContext::SERVER_NAME_FOUND;
+      SNIMatch match{ctx, certCryptoReq};
+      cacheSNIMatch(cacheKey, match);
+      return matched(match);
     }
 
     // If we didn't find an exact match, look for a cert with upgraded crypto.
+    SSLContextKey fallbackKey(dnstr, CertCrypto::BEST_AVAILABLE);
     if (certCryptoReq != CertCrypto::BEST_AVAILABLE) {
-      SSLContextKey fallbackKey(dnstr, CertCrypto::BEST_AVAILABLE);
       ctx = getSSLCtx(fallbackKey);
       if (ctx) {
-        sslSocket->switchServerSSLContext(ctx);
-        if (clientHelloTLSExtStats_) {
-          if (reqHasServerName) {
-            clientHelloTLSExtStats_->recordMatch();
-          }
-          clientHelloTLSExtStats_->recordCertCrypto(
-              certCryptoReq, CertCrypto::BEST_AVAILABLE);
-        }
-        return SSLContext::SERVER_NAME_FOUND;
+        SNIMatch match{ctx, CertCrypto::BEST_AVAILABLE};
+        cacheSNIMatch(cacheKey, match);
+        return matched(match);
+      }
+    }
+
+    // Then among the lazy ones, which aren't cached here: their lookups
+    // are what tells the hot from the cold
+    ctx = getLazySSLCtx(key);
+    if (ctx) {
+      return matched(SNIMatch{ctx, certCryptoReq});
+    }
+    if (certCryptoReq != CertCrypto::BEST_AVAILABLE) {
+      ctx = getLazySSLCtx(fallbackKey);
+      if (ctx) {
+        return matched(SNIMatch{ctx, CertCrypto::BEST_AVAILABLE});
       }
     }
 
@@ -491,6 +983,21 @@ SSLContextManager::ctxSetupByOpensslFeature(
   SSL_CTX_set_max_send_fragment(sslCtx->getSSLCtx(), 8000);
 #endif
 
+  if (ctxConfig.maxEarlyData > 0) {
+#ifdef SSL_EARLY_DATA_ACCEPTED
+    SSL_CTX_set_max_early_data(sslCtx->getSSLCtx(), ctxConfig.maxEarlyData);
+    SSL_CTX_set_allow_early_data_cb(
+      sslCtx->getSSLCtx(), allowEarlyData, nullptr);
+    // Replays are caught for as long as the tickets of the SSL_CTX last
+    if (auto cache = EarlyDataReplayCache::getDefault()) {
+      cache->coverTicketLifetime(
+        std::chrono::seconds(SSL_CTX_get_timeout(sslCtx->getSSLCtx())));
+    }
+#else
+    OPENSSL_MISSING_FEATURE(EarlyData);
+#endif
+  }
+
   // Specify cipher(s) to be used for TLS1.1 client
   if (!ctxConfig.tls11Ciphers.empty() ||
       !ctxConfig.tls11AltCipherlist.empty()) {
@@ -513,6 +1020,13 @@ SSLContextManager::ctxSetupByOpensslFeature(
 #endif
   }
 
+  // Where the acceptor keeps ClientHellos as received, rather than have
+  // the socket parse them; a socket parsing them sets its own callback
+  if (ctxConfig.clientHelloParsingEnabled) {
+    SSL_CTX_set_msg_callback(
+      sslCtx->getSSLCtx(), &SSLClientHello::messageCallback);
+  }
+
   // NPN (Next Protocol Negotiation)
   if (!ctxConfig.nextProtocols.empty()) {
 #ifdef OPENSSL_NPN_NEGOTIATED
@@ -521,8 +1035,12 @@ SSLContextManager::ctxSetupByOpensslFeature(
     OPENSSL_MISSING_FEATURE(NPN);
 #endif
   }
+}
 
-  // SNI
+void
+SSLContextManager::setupSNI(
+  const shared_ptr<folly::SSLContext>& sslCtx,
+  const SSLContextConfig& ctxConfig) {
 #ifdef PROXYGEN_HAVE_SERVERNAMECALLBACK
   noMatchFn_ = ctxConfig.sniNoMatchFn;
   if (ctxConfig.isDefault) {
@@ -536,17 +1054,16 @@ SSLContextManager::ctxSetupByOpensslFeature(
                 std::placeholders::_1));
   }
 #else
-  if (ctxs_.size() > 1) {
+  if (contexts_.size() > 1) {
     OPENSSL_MISSING_FEATURE(SNI);
   }
 #endif
 }
 
 void
-SSLContextManager::insert(shared_ptr<SSLContext> sslCtx,
-                          std::unique_ptr<SSLSessionCacheManager> smanager,
-                          std::unique_ptr<TLSTicketKeyManager> tmanager,
-                          bool defaultFallback) {
+SSLContextManager::insert(ContextEntry entry) {
+  const auto& sslCtx = entry.ctx;
+  bool defaultFallback = entry.isDefault;
   X509* x509 = getX509(sslCtx->getSSLCtx());
   auto guard = folly::makeGuard([x509] { X509_free(x509); });
   auto cn = SSLUtil::getCommonName(x509);
@@ -578,20 +1095,14 @@ SSLContextManager::insert(shared_ptr<SSLContext> sslCtx,
     if (!defaultFallback) {
       throw std::runtime_error("STAR X509 is not the default");
     }
-    ctxs_.emplace_back(sslCtx);
-    sessionCacheManagers_.emplace_back(std::move(smanager));
-    ticketManagers_.emplace_back(std::move(tmanager));
+    contexts_.push_back(std::move(entry));
     return;
   }
 
-  CertCrypto certCrypto;
-  int sigAlg = OBJ_obj2nid(x509->sig_alg->algorithm);
-  if (sigAlg == NID_sha1WithRSAEncryption ||
-      sigAlg == NID_ecdsa_with_SHA1) {
-    certCrypto = CertCrypto::SHA1_SIGNATURE;
+  auto certCrypto = getCertCrypto(x509);
+  if (certCrypto == CertCrypto::SHA1_SIGNATURE) {
     VLOG(4) << "Adding SSLContext with SHA1 Signature";
   } else {
-    certCrypto = CertCrypto::BEST_AVAILABLE;
     VLOG(4) << "Adding SSLContext with best available crypto";
   }
 
@@ -610,9 +1121,7 @@ SSLContextManager::insert(shared_ptr<SSLContext> sslCtx,
     defaultCtxDomainName_ = *cn;
   }
 
-  ctxs_.emplace_back(sslCtx);
-  sessionCacheManagers_.emplace_back(std::move(smanager));
-  ticketManagers_.emplace_back(std::move(tmanager));
+  contexts_.push_back(std::move(entry));
 }
 
 void
@@ -664,59 +1173,148 @@ SSLContextManager::insertSSLCtxByDomainNameImpl(const char* dn, size_t len,
   }
 
   DNString dnstr(dn, len);
-  insertIntoDnMap(SSLContextKey(dnstr, certCrypto), sslCtx, true);
+  insertIntoDnTrie(SSLContextKey(dnstr, certCrypto), sslCtx, true);
   if (certCrypto != CertCrypto::BEST_AVAILABLE) {
     // Note: there's no partial ordering here (you either get what you request,
     // or you get best available).
     VLOG(6) << "Attempting insert of weak crypto SSLContext as best available.";
-    insertIntoDnMap(
+    insertIntoDnTrie(
         SSLContextKey(dnstr, CertCrypto::BEST_AVAILABLE), sslCtx, false);
   }
 }
 
-void SSLContextManager::insertIntoDnMap(SSLContextKey key,
-                                        shared_ptr<SSLContext> sslCtx,
-                                        bool overwrite)
+size_t SSLContextManager::DnLabelHash::operator()(
+    folly::StringPiece label) const {
+  // FNV-1a of the lowercase label
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (char c : label) {
+    hash = (hash ^ static_cast<unsigned char>(::tolower(c))) *
+      0x100000001b3ULL;
+  }
+  return static_cast<size_t>(hash);
+}
+
+bool SSLContextManager::DnLabelEqual::operator()(
+    folly::StringPiece lhs, folly::StringPiece rhs) const {
+  return lhs.size() == rhs.size() &&
+    dn_char_traits::compare(lhs.data(), rhs.data(), lhs.size()) == 0;
+}
+
+const SSLContextManager::DnNode*
+SSLContextManager::findDnNode(folly::StringPiece name) const {
+  const DnNode* node = &dnRoot_;
+  while (true) {
+    auto dot = name.rfind('.');
+    auto label = dot == folly::StringPiece::npos ?
+      name : name.subpiece(dot + 1);
+    const auto v = node->children.find(label);
+    if (v == node->children.end()) {
+      return nullptr;
+    }
+    node = v->second.get();
+    if (dot == folly::StringPiece::npos) {
+      return node;
+    }
+    name = name.subpiece(0, dot);
+  }
+}
+
+SSLContextManager::DnNode*
+SSLContextManager::findOrCreateDnNode(folly::StringPiece name) {
+  DnNode* node = &dnRoot_;
+  while (true) {
+    auto dot = name.rfind('.');
+    auto label = dot == folly::StringPiece::npos ?
+      name : name.subpiece(dot + 1);
+    auto v = node->children.find(label);
+    if (v == node->children.end()) {
+      // Keyed by its own copy of the label, not by the name's
+      std::unique_ptr<DnNode> child(new DnNode());
+      child->label = label.str();
+      folly::StringPiece childLabel(child->label);
+      v = node->children.emplace(childLabel, std::move(child)).first;
+    }
+    node = v->second.get();
+    if (dot == folly::StringPiece::npos) {
+      return node;
+    }
+    name = name.subpiece(0, dot);
+  }
+}
+
+void SSLContextManager::insertIntoDnTrie(SSLContextKey key,
+                                         shared_ptr<SSLContext> sslCtx,
+                                         bool overwrite)
 {
-  const auto v = dnMap_.find(key);
-  if (v == dnMap_.end()) {
-    VLOG(6) << "Inserting SSLContext into map.";
-    dnMap_.emplace(key, sslCtx);
-  } else if (v->second == sslCtx) {
+  folly::StringPiece name(key.dnString.data(), key.dnString.size());
+  const auto crypto = static_cast<size_t>(key.certCrypto);
+  shared_ptr<SSLContext>* v;
+  if (name.startsWith('.')) {
+    v = &findOrCreateDnNode(name.subpiece(1))->wildcard[crypto];
+  } else {
+    v = &findOrCreateDnNode(name)->exact[crypto];
+  }
+  // Cached matches may no longer be the best ones
+  clearSNICache();
+  if (!*v) {
+    VLOG(6) << "Inserting SSLContext into trie.";
+    *v = sslCtx;
+  } else if (*v == sslCtx) {
     VLOG(6)<< "Duplicate CN or subject alternative name found in the same X509."
       "  Ignore the later name.";
   } else if (overwrite) {
     VLOG(6) << "Overwriting SSLContext.";
-    v->second = sslCtx;
+    *v = sslCtx;
   } else {
-    VLOG(6) << "Leaving existing SSLContext in map.";
+    VLOG(6) << "Leaving existing SSLContext in trie.";
   }
 }
 
 shared_ptr<SSLContext>
 SSLContextManager::getSSLCtx(const SSLContextKey& key) const
 {
-  auto ctx = getSSLCtxByExactDomain(key);
-  if (ctx) {
-    return ctx;
+  folly::StringPiece name(key.dnString.data(), key.dnString.size());
+  auto dot = name.find('.');
+  if (dot == 0 || dot == folly::StringPiece::npos) {
+    return getSSLCtxByExactDomain(key);
+  }
+  // The exact match is a child of the node the wildcard match is on
+  const auto crypto = static_cast<size_t>(key.certCrypto);
+  auto parent = findDnNode(name.subpiece(dot + 1));
+  if (!parent) {
+    VLOG(6) << folly::stringPrintf("\"%s\" is not a match",
+                                   key.dnString.c_str());
+    return shared_ptr<SSLContext>();
   }
-  return getSSLCtxBySuffix(key);
+  const auto v = parent->children.find(name.subpiece(0, dot));
+  if (v != parent->children.end() && v->second->exact[crypto]) {
+    VLOG(6) << folly::stringPrintf("\"%s\" is an exact match",
+                                   key.dnString.c_str());
+    return v->second->exact[crypto];
+  }
+  if (parent->wildcard[crypto]) {
+    VLOG(6) << folly::stringPrintf("\"%s\" is a wildcard match",
+                                   key.dnString.c_str());
+  } else {
+    VLOG(6) << folly::stringPrintf("\"%s\" is not a match",
+                                   key.dnString.c_str());
+  }
+  return parent->wildcard[crypto];
 }
 
 shared_ptr<SSLContext>
 SSLContextManager::getSSLCtxBySuffix(const SSLContextKey& key) const
 {
-  size_t dot;
-
-  if ((dot = key.dnString.find_first_of(".")) != DNString::npos) {
-    SSLContextKey suffixKey(DNString(key.dnString, dot),
-        key.certCrypto);
-    const auto v = dnMap_.find(suffixKey);
-    if (v != dnMap_.end()) {
+  folly::StringPiece name(key.dnString.data(), key.dnString.size());
+  auto dot = name.find('.');
+  if (dot != folly::StringPiece::npos) {
+    auto node = findDnNode(name.subpiece(dot + 1));
+    const auto crypto = static_cast<size_t>(key.certCrypto);
+    if (node && node->wildcard[crypto]) {
       VLOG(6) << folly::stringPrintf("\"%s\" is a willcard match to \"%s\"",
                                      key.dnString.c_str(),
-                                     suffixKey.dnString.c_str());
-      return v->second;
+                                     key.dnString.c_str() + dot);
+      return node->wildcard[crypto];
     }
   }
 
@@ -728,16 +1326,29 @@ SSLContextManager::getSSLCtxBySuffix(const SSLContextKey& key) const
 shared_ptr<SSLContext>
 SSLContextManager::getSSLCtxByExactDomain(const SSLContextKey& key) const
 {
-  const auto v = dnMap_.find(key);
-  if (v == dnMap_.end()) {
+  folly::StringPiece name(key.dnString.data(), key.dnString.size());
+  const auto crypto = static_cast<size_t>(key.certCrypto);
+  shared_ptr<SSLContext> ctx;
+  // ".facebook.com" names the wildcard "*.facebook.com"
+  if (name.startsWith('.')) {
+    auto node = findDnNode(name.subpiece(1));
+    if (node) {
+      ctx = node->wildcard[crypto];
+    }
+  } else {
+    auto node = findDnNode(name);
+    if (node) {
+      ctx = node->exact[crypto];
+    }
+  }
+  if (!ctx) {
     VLOG(6) << folly::stringPrintf("\"%s\" is not an exact match",
                                    key.dnString.c_str());
-    return shared_ptr<SSLContext>();
   } else {
     VLOG(6) << folly::stringPrintf("\"%s\" is an exact match",
                                    key.dnString.c_str());
-    return v->second;
   }
+  return ctx;
 }
 
 shared_ptr<SSLContext>
@@ -751,10 +1362,260 @@ SSLContextManager::reloadTLSTicketKeys(
   const std::vector<std::string>& currentSeeds,
   const std::vector<std::string>& newSeeds) {
 #ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
-  for (auto& tmgr: ticketManagers_) {
-    tmgr->setTLSTicketKeySeeds(oldSeeds, currentSeeds, newSeeds);
+  for (auto& entry : contexts_) {
+    if (entry.ticketManager) {
+      entry.ticketManager->setTLSTicketKeySeeds(
+        oldSeeds, currentSeeds, newSeeds);
+    }
   }
+  std::lock_guard<std::mutex> g(lazyMutex_);
+  for (auto& lazy : lazyContexts_) {
+    if (!lazy->ticketSeeds) {
+      continue;
+    }
+    lazy->ticketSeeds->oldSeeds = oldSeeds;
+    lazy->ticketSeeds->currentSeeds = currentSeeds;
+    lazy->ticketSeeds->newSeeds = newSeeds;
+    lazy->ticketSeedsVersion++;
+    if (lazy->entry && lazy->entry->ticketManager) {
+      lazy->entry->ticketManager->setTLSTicketKeySeeds(
+        oldSeeds, currentSeeds, newSeeds);
+    }
+  }
+#endif
+}
+
+bool SSLContextManager::isLazy(const SSLContextConfig& ctxConfig) {
+#ifdef PROXYGEN_HAVE_SERVERNAMECALLBACK
+  // The default is wanted by every handshake, and found by no name
+  return ctxConfig.lazy && !ctxConfig.isDefault;
+#else
+  return false;
 #endif
 }
 
+void SSLContextManager::addLazySSLContextConfig(
+  const SSLContextConfig& ctxConfig,
+  const SSLCacheOptions& cacheOptions,
+  const TLSTicketKeySeeds* ticketSeeds,
+  const folly::SocketAddress& vipAddress,
+  const std::shared_ptr<SSLCacheProvider>& externalCache,
+  std::string fingerprint) {
+  auto lazy = std::make_shared<LazyContext>();
+  lazy->fingerprint = std::move(fingerprint);
+  lazy->config = ctxConfig;
+  lazy->cacheOptions = cacheOptions;
+  if (ticketSeeds) {
+    lazy->ticketSeeds = *ticketSeeds;
+  }
+  lazy->vipAddress = vipAddress;
+  lazy->externalCache = externalCache;
+  indexLazyContext(lazy);
+  noMatchFn_ = ctxConfig.sniNoMatchFn;
+  std::lock_guard<std::mutex> g(lazyMutex_);
+  lazyContexts_.push_back(std::move(lazy));
+}
+
+void SSLContextManager::indexLazyContext(
+  const std::shared_ptr<LazyContext>& lazy) {
+  const auto& certs = lazy->config.certificates;
+  if (certs.empty()) {
+    throw std::runtime_error("No certificate for a lazy SSL context");
+  }
+  // Only the certificate, which is all the names are taken from
+  auto certKeyCache = SSLCertKeyCache::getDefault();
+  if (!certKeyCache) {
+    certKeyCache = std::make_shared<SSLCertKeyCache>();
+  }
+  std::shared_ptr<const SSLCertKeyCache::Certificate> cert;
+  try {
+    cert = certKeyCache->getCertificate(certs[0].certPath);
+  } catch (const std::exception& ex) {
+    string msg = folly::to<string>("error loading SSL certificate ",
+                                   certs[0].certPath, ": ",
+                                   folly::exceptionStr(ex));
+    LOG(ERROR) << msg;
+    throw std::runtime_error(msg);
+  }
+  auto cn = SSLUtil::getCommonName(cert->cert);
+  if (!cn) {
+    throw std::runtime_error(folly::to<string>("Cannot get CN for X509 ",
+                                               certs[0].certPath));
+  }
+  std::list<std::string> names{*cn};
+  auto altNames = SSLUtil::getSubjectAltName(cert->cert);
+  if (altNames) {
+    names.splice(names.end(), *altNames);
+  }
+  auto certCrypto = getCertCrypto(cert->cert);
+
+  std::lock_guard<std::mutex> g(lazyMutex_);
+  for (const auto& name : names) {
+    std::string indexName;
+    try {
+      indexName = getLazyIndexName(name);
+    } catch (const std::runtime_error& ex) {
+      if (strict_) {
+        throw;
+      }
+      LOG(ERROR) << ex.what();
+      continue;
+    }
+    // Like in the trie, a weak crypto context is the best available one
+    // unless there is another
+    lazyIndex_[indexName + static_cast<char>(certCrypto)] = lazy;
+    if (certCrypto != CertCrypto::BEST_AVAILABLE) {
+      lazyIndex_.emplace(
+        indexName + static_cast<char>(CertCrypto::BEST_AVAILABLE), lazy);
+    }
+  }
+}
+
+shared_ptr<SSLContext>
+SSLContextManager::getLazySSLCtx(const SSLContextKey& key) {
+  std::string name(key.dnString.data(), key.dnString.size());
+  folly::toLowerAscii(&name[0], name.size());
+  const auto crypto = static_cast<char>(key.certCrypto);
+  std::shared_ptr<LazyContext> lazy;
+  {
+    std::lock_guard<std::mutex> g(lazyMutex_);
+    if (lazyIndex_.empty()) {
+      return nullptr;
+    }
+    auto v = lazyIndex_.find(name + crypto);
+    auto dot = name.find('.');
+    if (v == lazyIndex_.end() && dot != 0 && dot != std::string::npos) {
+      v = lazyIndex_.find(name.substr(dot) + crypto);
+    }
+    if (v == lazyIndex_.end()) {
+      return nullptr;
+    }
+    lazy = v->second;
+    if (lazy->ctx) {
+      touchLazyContext(*lazy);
+      return lazy->ctx;
+    }
+  }
+  return buildLazyContext(lazy);
+}
+
+shared_ptr<SSLContext> SSLContextManager::buildLazyContext(
+  const std::shared_ptr<LazyContext>& lazy) {
+  std::lock_guard<std::mutex> building(lazy->buildMutex);
+  folly::Optional<TLSTicketKeySeeds> ticketSeeds;
+  uint64_t ticketSeedsVersion;
+  {
+    std::lock_guard<std::mutex> g(lazyMutex_);
+    if (lazy->ctx) {
+      touchLazyContext(*lazy);
+      return lazy->ctx;
+    }
+    ticketSeeds = lazy->ticketSeeds;
+    ticketSeedsVersion = lazy->ticketSeedsVersion;
+  }
+
+  const auto& ctxConfig = lazy->config;
+  std::shared_ptr<ContextEntry> entry;
+  try {
+    entry = std::make_shared<ContextEntry>(makeContextEntry(
+      buildSSLContext(ctxConfig, lazy->cacheOptions, lazy->fingerprint),
+      ctxConfig,
+      lazy->cacheOptions,
+      ticketSeeds.get_pointer(),
+      lazy->vipAddress,
+      lazy->externalCache));
+  } catch (const std::exception& ex) {
+    LOG(ERROR) << "Error building the SSL context of "
+               << ctxConfig.certificates[0].certPath << ": "
+               << folly::exceptionStr(ex);
+    return nullptr;
+  }
+  VLOG(2) << "Built the SSL context of "
+          << ctxConfig.certificates[0].certPath << " on first use";
+  shared_ptr<SSLContext> ctx(entry, entry->ctx.get());
+  auto hasStapler = bool(entry->ocspStapler);
+
+  {
+    std::lock_guard<std::mutex> g(lazyMutex_);
+    if (lazy->removed) {
+      return ctx;
+    }
+    if (lazy->ticketSeedsVersion != ticketSeedsVersion &&
+        entry->ticketManager) {
+      entry->ticketManager->setTLSTicketKeySeeds(
+        lazy->ticketSeeds->oldSeeds,
+        lazy->ticketSeeds->currentSeeds,
+        lazy->ticketSeeds->newSeeds);
+    }
+    lazy->entry = std::move(entry);
+    lazy->ctx = ctx;
+    lazyBuilt_.push_front(lazy);
+    lazy->lruPos = lazyBuilt_.begin();
+    while (maxLazyContexts_ > 0 && lazyBuilt_.size() > maxLazyContexts_) {
+      auto coldest = lazyBuilt_.back();
+      dropLazyContext(*coldest);
+    }
+  }
+  // The refresh timeout belongs to the manager's thread: built on a
+  // handshake executor's, schedule it from there
+  if (hasStapler && eventBase_) {
+    if (eventBase_->isInEventBaseThread()) {
+      scheduleOCSPRefresh();
+    } else {
+      std::weak_ptr<bool> alive = alive_;
+      eventBase_->runInEventBaseThread([this, alive] {
+        if (alive.lock()) {
+          scheduleOCSPRefresh();
+        }
+      });
+    }
+  }
+  return ctx;
+}
+
+void SSLContextManager::touchLazyContext(LazyContext& lazy) {
+  lazyBuilt_.splice(lazyBuilt_.begin(), lazyBuilt_, lazy.lruPos);
+}
+
+void SSLContextManager::dropLazyContext(LazyContext& lazy) {
+  if (!lazy.ctx) {
+    return;
+  }
+  // The handshakes using it keep it until they are done
+  lazyBuilt_.erase(lazy.lruPos);
+  lazy.ctx.reset();
+  lazy.entry.reset();
+}
+
+void SSLContextManager::setMaxLazySSLContexts(size_t max) {
+  std::lock_guard<std::mutex> g(lazyMutex_);
+  maxLazyContexts_ = max;
+  while (maxLazyContexts_ > 0 && lazyBuilt_.size() > maxLazyContexts_) {
+    auto coldest = lazyBuilt_.back();
+    dropLazyContext(*coldest);
+  }
+}
+
+size_t SSLContextManager::getNumBuiltLazySSLContexts() const {
+  std::lock_guard<std::mutex> g(lazyMutex_);
+  return lazyBuilt_.size();
+}
+
+std::vector<std::shared_ptr<OCSPStapler>>
+SSLContextManager::getOCSPStaplers() const {
+  std::vector<std::shared_ptr<OCSPStapler>> staplers;
+  for (const auto& entry : contexts_) {
+    if (entry.ocspStapler) {
+      staplers.push_back(entry.ocspStapler);
+    }
+  }
+  std::lock_guard<std::mutex> g(lazyMutex_);
+  for (const auto& lazy : lazyBuilt_) {
+    if (lazy->entry->ocspStapler) {
+      staplers.push_back(lazy->entry->ocspStapler);
+    }
+  }
+  return staplers;
+}
+
 } // namespace wangle
@@ -9,16 +9,22 @@
  */
 #pragma once
 
+#include <folly/EvictingCacheMap.h>
+#include <folly/Executor.h>
+#include <folly/Range.h>
+#include <folly/futures/Future.h>
 #include <folly/io/async/EventBase.h>
 #include <folly/io/async/SSLContext.h>
 
 #include <glog/logging.h>
 #include <list>
 #include <memory>
+#include <mutex>
 #include <wangle/ssl/SSLContextConfig.h>
 #include <wangle/ssl/SSLSessionCacheManager.h>
 #include <wangle/ssl/TLSTicketKeySeeds.h>
 #include <wangle/acceptor/SSLContextSelectionMisc.h>
+#include <unordered_map>
 #include <vector>
 
 namespace folly {
@@ -31,6 +37,7 @@ class SSLContext;
 namespace wangle {
 
 class ClientHelloExtStats;
+class OCSPStapler;
 struct SSLCacheOptions;
 class SSLStats;
 class TLSTicketKeyManager;
@@ -63,6 +70,30 @@ class SSLContextManager {
     const folly::SocketAddress& vipAddress,
     const std::shared_ptr<SSLCacheProvider> &externalCache);
 
+  /**
+   * Replace the X509s by those of ctxConfigs, only building again the
+   * SSL_CTXs whose config, or certificate, key or CA files, changed since
+   * they were added; the others are kept, with their session caches.
+   *
+   * The files are checked and the new SSL_CTXs built on executor, the
+   * global CPU executor if null, so enableAsyncCrypto() must be safe to
+   * call from there. All the SSL_CTXs are then swapped in at once, from
+   * the manager's EventBase thread, so that a handshake sees either the
+   * old or the new set. If any fails to build or insert, the current set
+   * stays, and the future fails with the error.
+   *
+   * Must be called from the EventBase thread, and the manager outlive the
+   * returned future. cacheOptions and ticketSeeds are only used for the
+   * new SSL_CTXs: use reloadTLSTicketKeys() to change the seeds of all.
+   */
+  folly::Future<folly::Unit> reloadSSLContextConfigs(
+    std::vector<SSLContextConfig> ctxConfigs,
+    const SSLCacheOptions& cacheOptions,
+    const TLSTicketKeySeeds* ticketSeeds,
+    const folly::SocketAddress& vipAddress,
+    const std::shared_ptr<SSLCacheProvider>& externalCache,
+    folly::Executor* executor = nullptr);
+
   /**
    * Get the default SSL_CTX for a VIP
    */
@@ -75,6 +106,24 @@ class SSLContextManager {
   std::shared_ptr<folly::SSLContext>
     getSSLCtx(const SSLContextKey& key) const;
 
+  /**
+   * Search the lazy SSL_CTXs (see SSLContextConfig::lazy) like getSSLCtx(),
+   * building the one found if it isn't. Names the other SSL_CTXs have are
+   * matched by those first. Null if none matches, or it fails to build.
+   * Thread safe, unlike the rest of the manager: handshakes build their
+   * SSL_CTX on the thread running them.
+   */
+  std::shared_ptr<folly::SSLContext>
+    getLazySSLCtx(const SSLContextKey& key);
+
+  /**
+   * Lazy SSL_CTXs kept built at most; building one more drops the least
+   * recently used. 0, the default, keeps them all.
+   */
+  void setMaxLazySSLContexts(size_t max);
+
+  size_t getNumBuiltLazySSLContexts() const;
+
   /**
    * Search by the _one_ level up subdomain
    */
@@ -104,6 +153,10 @@ class SSLContextManager {
     stats_ = stats;
   }
 
+  SSLStats* getSSLStats() const {
+    return stats_;
+  }
+
   /**
    * SSLContextManager only collects SNI stats now
    */
@@ -112,6 +165,8 @@ class SSLContextManager {
   }
 
  protected:
+  // For keys living outside the process; PrivateKeyOpBatcher batches the
+  // operations of the handshakes into fewer calls to the key servers
   virtual void enableAsyncCrypto(
     const std::shared_ptr<folly::SSLContext>& sslCtx,
     const SSLContextConfig& ctxConfig) {
@@ -122,10 +177,100 @@ class SSLContextManager {
  private:
   SSLContextManager(const SSLContextManager&) = delete;
 
+  /**
+   * A SSL_CTX and what the manager keeps along with it
+   */
+  struct ContextEntry {
+    // See getFingerprint()
+    std::string fingerprint;
+    std::shared_ptr<folly::SSLContext> ctx;
+    std::shared_ptr<SSLSessionCacheManager> sessionCacheManager;
+    std::shared_ptr<TLSTicketKeyManager> ticketManager;
+    std::shared_ptr<OCSPStapler> ocspStapler;
+    bool isDefault{false};
+  };
+
+  /**
+   * A SSL_CTX loaded from its config, not yet added to the manager; a
+   * null ctx stands for one the manager already has.
+   */
+  struct BuiltContext {
+    std::string fingerprint;
+    std::shared_ptr<folly::SSLContext> ctx;
+    std::string sessionContext;
+    std::shared_ptr<OCSPStapler> ocspStapler;
+  };
+
+  // Doesn't touch the manager's state, so runs from any thread
+  BuiltContext buildSSLContext(
+    const SSLContextConfig& ctxConfig,
+    const SSLCacheOptions& cacheOptions,
+    std::string fingerprint);
+
+  // Sets built up with the session cache and ticket managers, from any
+  // thread too
+  ContextEntry makeContextEntry(
+    BuiltContext built,
+    const SSLContextConfig& ctxConfig,
+    const SSLCacheOptions& cacheOptions,
+    const TLSTicketKeySeeds* ticketSeeds,
+    const folly::SocketAddress& vipAddress,
+    const std::shared_ptr<SSLCacheProvider>& externalCache);
+
+  void installSSLContext(
+    BuiltContext built,
+    const SSLContextConfig& ctxConfig,
+    const SSLCacheOptions& cacheOptions,
+    const TLSTicketKeySeeds* ticketSeeds,
+    const folly::SocketAddress& vipAddress,
+    const std::shared_ptr<SSLCacheProvider>& externalCache);
+
+  // Replaces the contexts by built, the SSL_CTXs of ctxConfigs
+  void swapContexts(
+    std::vector<BuiltContext> built,
+    const std::vector<SSLContextConfig>& ctxConfigs,
+    const SSLCacheOptions& cacheOptions,
+    const TLSTicketKeySeeds* ticketSeeds,
+    const folly::SocketAddress& vipAddress,
+    const std::shared_ptr<SSLCacheProvider>& externalCache);
+
   void ctxSetupByOpensslFeature(
     std::shared_ptr<folly::SSLContext> sslCtx,
     const SSLContextConfig& ctxConfig);
 
+  /**
+   * An SSL_CTX built on first use, see SSLContextConfig::lazy, and what it
+   * takes to build it
+   */
+  struct LazyContext;
+
+  static bool isLazy(const SSLContextConfig& ctxConfig);
+
+  void addLazySSLContextConfig(
+    const SSLContextConfig& ctxConfig,
+    const SSLCacheOptions& cacheOptions,
+    const TLSTicketKeySeeds* ticketSeeds,
+    const folly::SocketAddress& vipAddress,
+    const std::shared_ptr<SSLCacheProvider>& externalCache,
+    std::string fingerprint);
+
+  // Adds the names of lazy's certificate to lazyIndex_
+  void indexLazyContext(const std::shared_ptr<LazyContext>& lazy);
+
+  std::shared_ptr<folly::SSLContext> buildLazyContext(
+    const std::shared_ptr<LazyContext>& lazy);
+
+  // Under lazyMutex_
+  void touchLazyContext(LazyContext& lazy);
+  void dropLazyContext(LazyContext& lazy);
+
+  // Of the SSL_CTXs built, lazy ones included
+  std::vector<std::shared_ptr<OCSPStapler>> getOCSPStaplers() const;
+
+  void setupSNI(
+    const std::shared_ptr<folly::SSLContext>& sslCtx,
+    const SSLContextConfig& ctxConfig);
+
   /**
    * Callback function from openssl to find the right X509 to
    * use during SSL handshake
@@ -148,22 +293,29 @@ class SSLContextManager {
    *    The wildcard name must be _prefixed_ by '*.'.  It errors out whenever
    *    it sees '*' in any other locations.
    *
-   * 3. It uses one std::unordered_map<DomainName, SSL_CTX> object to
-   *    do this.  For wildcard name like "*.facebook.com", ".facebook.com"
-   *    is used as the key.
+   * 3. It uses a trie of domain name labels, walked from the last label,
+   *    to do this: "www.facebook.com" is found at com -> facebook -> www.
+   *    A wildcard name like "*.facebook.com" is kept on the node of
+   *    "facebook.com", and a name given as ".facebook.com" stands for it.
    *
    * 4. After getting tlsext_hostname from the client hello message, it
    *    will do a full string search first and then try one level up to
-   *    match any wildcard name (if any) in the X509.
+   *    match any wildcard name (if any) in the X509.  Both are done in one
+   *    walk down the trie, without copying the name.
    *    [Note, browser also only looks one level up when matching the requesting
    *     domain name with the wildcard name in the server X509].
+   *
+   * 5. The contexts matched for the most recent server names are kept in
+   *    a small LRU cache, emptied whenever a name is inserted.  It needs no
+   *    lock: like the rest of SSLContextManager, it belongs to a single
+   *    Acceptor, whose handshakes all run in the same EventBase thread.
    */
 
-  void insert(
-    std::shared_ptr<folly::SSLContext> sslCtx,
-    std::unique_ptr<SSLSessionCacheManager> cmanager,
-    std::unique_ptr<TLSTicketKeyManager> tManager,
-    bool defaultFallback);
+  void insert(ContextEntry entry);
+
+  // Rereads the OCSP responses when the soonest stapler wants it
+  void scheduleOCSPRefresh();
+  class OCSPRefreshTimeout;
 
   void insertSSLCtxByDomainNameImpl(
     const char* dn,
@@ -171,35 +323,89 @@ class SSLContextManager {
     std::shared_ptr<folly::SSLContext> sslCtx,
     CertCrypto certCrypto);
 
-  void insertIntoDnMap(SSLContextKey key,
+  void insertIntoDnTrie(SSLContextKey key,
     std::shared_ptr<folly::SSLContext> sslCtx,
     bool overwrite);
 
+  // Case insensitive, like DNString
+  struct DnLabelHash {
+    size_t operator()(folly::StringPiece label) const;
+  };
+
+  struct DnLabelEqual {
+    bool operator()(folly::StringPiece lhs, folly::StringPiece rhs) const;
+  };
+
+  struct DnNode {
+    // Owns the label the node is keyed by in its parent's children
+    std::string label;
+    std::unordered_map<
+      folly::StringPiece,
+      std::unique_ptr<DnNode>,
+      DnLabelHash,
+      DnLabelEqual> children;
+    // Indexed by CertCrypto
+    std::shared_ptr<folly::SSLContext> exact[2];
+    // For "*." followed by the name of this node
+    std::shared_ptr<folly::SSLContext> wildcard[2];
+  };
+
+  // The node of a name, or null
+  const DnNode* findDnNode(folly::StringPiece name) const;
+
+  DnNode* findOrCreateDnNode(folly::StringPiece name);
+
+  struct SNIMatch {
+    std::shared_ptr<folly::SSLContext> ctx;
+    CertCrypto certCrypto;
+  };
+
+  bool findCachedSNIMatch(const std::string& key, SNIMatch& match);
+  void cacheSNIMatch(const std::string& key, const SNIMatch& match);
+  void clearSNICache();
+
 
   /**
-   * Container to own the SSLContext, SSLSessionCacheManager and
-   * TLSTicketKeyManager.
+   * Container to own the SSLContext, SSLSessionCacheManager,
+   * TLSTicketKeyManager and OCSPStapler.
    */
-  std::vector<std::shared_ptr<folly::SSLContext>> ctxs_;
-  std::vector<std::unique_ptr<SSLSessionCacheManager>>
-    sessionCacheManagers_;
-  std::vector<std::unique_ptr<TLSTicketKeyManager>> ticketManagers_;
+  std::vector<ContextEntry> contexts_;
+  std::unique_ptr<OCSPRefreshTimeout> ocspRefreshTimeout_;
 
   std::shared_ptr<folly::SSLContext> defaultCtx_;
   std::string defaultCtxDomainName_;
 
   /**
-   * Container to store the (DomainName -> SSL_CTX) mapping
+   * Trie to store the (DomainName -> SSL_CTX) mapping
+   */
+  DnNode dnRoot_;
+
+  /**
+   * Recent (lowercase server name and requested CertCrypto -> SSL_CTX)
+   * matches made by serverNameCallback, under sniCacheMutex_ as the
+   * callback may run on handshake executor threads
    */
-  std::unordered_map<
-    SSLContextKey,
-    std::shared_ptr<folly::SSLContext>,
-    SSLContextKeyHash> dnMap_;
+  folly::EvictingCacheMap<std::string, SNIMatch> sniCache_;
+  std::mutex sniCacheMutex_;
+
+  /**
+   * The lazy SSL_CTXs, by lowercase name, as in the trie, followed by the
+   * CertCrypto char; and those built, most recently used first. Shared
+   * with the threads running handshakes, under lazyMutex_.
+   */
+  std::vector<std::shared_ptr<LazyContext>> lazyContexts_;
+  std::unordered_map<std::string, std::shared_ptr<LazyContext>> lazyIndex_;
+  std::list<std::shared_ptr<LazyContext>> lazyBuilt_;
+  size_t maxLazyContexts_{0};
+  mutable std::mutex lazyMutex_;
 
   folly::EventBase* eventBase_;
   ClientHelloExtStats* clientHelloTLSExtStats_{nullptr};
   SSLContextConfig::SNINoMatchFn noMatchFn_;
   bool strict_{true};
+
+  // Checked by what is queued on eventBase_ from other threads
+  std::shared_ptr<bool> alive_{std::make_shared<bool>(true)};
 };
 
 } // namespace wangle
@@ -0,0 +1,80 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/ssl/SSLHandshakeTimings.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+using folly::AsyncSSLSocket;
+
+namespace wangle {
+
+namespace {
+
+typedef std::vector<std::pair<const AsyncSSLSocket*,
+                              std::shared_ptr<SSLHandshakeTimings>>> Timed;
+
+// The handshakes this thread is timing
+Timed& timedHandshakes() {
+  static thread_local Timed timed;
+  return timed;
+}
+
+}
+
+constexpr size_t SSLHandshakeTimings::kNumStages;
+
+SSLHandshakeTimings::SSLHandshakeTimings(Clock::time_point acceptTime)
+    : acceptTime_(acceptTime) {
+  stages_.fill(std::chrono::microseconds(-1));
+}
+
+void SSLHandshakeTimings::mark(SSL* ssl, Stage stage) {
+  auto& timed = timedHandshakes();
+  if (timed.empty()) {
+    return;
+  }
+  auto sock = AsyncSSLSocket::getFromSSL(ssl);
+  for (auto& entry : timed) {
+    if (entry.first == sock) {
+      entry.second->mark(stage);
+      return;
+    }
+  }
+}
+
+void SSLHandshakeTimings::attach(
+    const AsyncSSLSocket* sock,
+    std::shared_ptr<SSLHandshakeTimings> timings) {
+  timedHandshakes().emplace_back(sock, std::move(timings));
+}
+
+void SSLHandshakeTimings::detach(const AsyncSSLSocket* sock) {
+  auto& timed = timedHandshakes();
+  timed.erase(
+    std::remove_if(timed.begin(), timed.end(),
+                   [sock](const Timed::value_type& entry) {
+                     return entry.first == sock;
+                   }),
+    timed.end());
+}
+
+void SSLHandshakeTimings::mark(Stage stage) {
+  auto& at = stages_[size_t(stage)];
+  if ((stage == Stage::SESSION_LOOKUP_STARTED ||
+       stage == Stage::KEY_OP_STARTED) && at.count() >= 0) {
+    return;
+  }
+  at = std::chrono::duration_cast<std::chrono::microseconds>(
+    Clock::now() - acceptTime_);
+}
+
+}
@@ -0,0 +1,88 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <memory>
+
+#include <folly/io/async/AsyncSSLSocket.h>
+
+namespace wangle {
+
+/**
+ * When a TLS handshake reached each of its stages, since the connection
+ * was accepted, for the handshakes picked by
+ * ServerSocketConfig::sslHandshakeTimingSampleRate. They are reported
+ * through SSLStats::recordSSLHandshakeTimings() and kept in the
+ * connection's TransportInfo.
+ *
+ * The stages are marked from the OpenSSL callbacks they happen in, on the
+ * thread running the handshake, which finds the timings of its socket
+ * through a list of the handshakes it is timing; a handshake not timed
+ * costs a check of that list for being empty.
+ */
+class SSLHandshakeTimings {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  enum class Stage : uint8_t {
+    // sslAccept() was called, after any wait for a handshake thread
+    STARTED,
+    // the ClientHello was read, and the server name callback ran
+    CLIENT_HELLO,
+    // the SSL_CTX for the server name was chosen
+    CONTEXT_SELECTED,
+    // the first session cache lookup started, and the last one finished:
+    // an asynchronous lookup calls back again once it is done
+    SESSION_LOOKUP_STARTED,
+    SESSION_LOOKUP_FINISHED,
+    // the private key operation, for asynchronous crypto implementations
+    // to mark; local keys are used between CONTEXT_SELECTED and FINISHED
+    KEY_OP_STARTED,
+    KEY_OP_FINISHED,
+    // the handshake succeeded
+    FINISHED,
+  };
+  static constexpr size_t kNumStages = 8;
+
+  explicit SSLHandshakeTimings(Clock::time_point acceptTime);
+
+  /**
+   * Marks stage as reached now, in the timings of ssl's handshake if it is
+   * timed. A started stage keeps its first mark, others their last.
+   */
+  static void mark(SSL* ssl, Stage stage);
+
+  /**
+   * Times the handshake of sock into timings, until detached. Both must be
+   * called on the thread running the handshake.
+   */
+  static void attach(const folly::AsyncSSLSocket* sock,
+                     std::shared_ptr<SSLHandshakeTimings> timings);
+  static void detach(const folly::AsyncSSLSocket* sock);
+
+  void mark(Stage stage);
+
+  bool reached(Stage stage) const {
+    return stages_[size_t(stage)].count() >= 0;
+  }
+
+  // Since the connection was accepted, or -1us if not reached
+  std::chrono::microseconds get(Stage stage) const {
+    return stages_[size_t(stage)];
+  }
+
+ private:
+  const Clock::time_point acceptTime_;
+  std::array<std::chrono::microseconds, kNumStages> stages_;
+};
+
+}
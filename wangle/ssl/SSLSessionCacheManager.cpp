@@ -9,11 +9,21 @@
  */
 #include <wangle/ssl/SSLSessionCacheManager.h>
 
+#include <wangle/client/persistence/BinaryCacheLog.h>
 #include <wangle/ssl/SSLCacheProvider.h>
+#include <wangle/ssl/SSLHandshakeTimings.h>
 #include <wangle/ssl/SSLStats.h>
 #include <wangle/ssl/SSLUtil.h>
 
+#include <folly/FileUtil.h>
+#include <folly/ScopeGuard.h>
 #include <folly/io/async/EventBase.h>
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #ifndef NO_LIB_GFLAGS
 #include <gflags/gflags.h>
@@ -34,6 +44,11 @@ const uint32_t NUM_CACHE_BUCKETS = 16;
 // for the protocol.  16 bytes for SSLv2 or 32 for SSLv3+
 const int MIN_SESSION_ID_LENGTH = 16;
 
+bool isExpired(SSL_SESSION* session, time_t now) {
+  return SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session) <=
+    now;
+}
+
 }
 
 #ifndef NO_LIB_GFLAGS
@@ -47,6 +62,9 @@ namespace wangle {
 
 int SSLSessionCacheManager::sExDataIndex_ = -1;
 shared_ptr<ShardedLocalSSLSessionCache> SSLSessionCacheManager::sCache_;
+string SSLSessionCacheManager::sSnapshotFile_;
+shared_ptr<SSLSessionCacheManager::ExternalLookups>
+  SSLSessionCacheManager::sExternalLookups_;
 std::mutex SSLSessionCacheManager::sCacheLock_;
 
 LocalSSLSessionCache::LocalSSLSessionCache(uint32_t maxCacheSize,
@@ -77,8 +95,25 @@ SSLSessionCacheManager::SSLSessionCacheManager(
   const string& context,
   EventBase* eventBase,
   SSLStats* stats,
+  const std::shared_ptr<SSLCacheProvider>& externalCache):
+    SSLSessionCacheManager(
+      SSLCacheOptions{std::chrono::seconds(0), maxCacheSize, cacheCullSize},
+      ctx, sockaddr, context, eventBase, stats, externalCache) {
+}
+
+SSLSessionCacheManager::SSLSessionCacheManager(
+  const SSLCacheOptions& options,
+  SSLContext* ctx,
+  const folly::SocketAddress& sockaddr,
+  const string& context,
+  EventBase* eventBase,
+  SSLStats* stats,
   const std::shared_ptr<SSLCacheProvider>& externalCache):
     ctx_(ctx),
+    sslCtx_(ctx->getSSLCtx()),
+    eventBase_(eventBase),
+    batchSize_(std::max<uint32_t>(1, options.sslExternalBatchSize)),
+    self_(this, [](SSLSessionCacheManager*) {}),
     stats_(stats),
     externalCache_(externalCache) {
 
@@ -99,33 +134,202 @@ SSLSessionCacheManager::SSLSessionCacheManager(
   SSL_CTX_set_session_cache_mode(sslCtx, SSL_SESS_CACHE_NO_INTERNAL
                                  | SSL_SESS_CACHE_SERVER);
 
-  localCache_ = SSLSessionCacheManager::getLocalCache(maxCacheSize,
-                                                      cacheCullSize);
+  localCache_ = SSLSessionCacheManager::getLocalCache(
+    options.maxSSLCacheSize, options.sslCacheFlushSize, options.sslCacheShards,
+    options.sslCacheSnapshotFile);
+  externalLookups_ = SSLSessionCacheManager::getExternalLookups(
+    options.sslExternalMissTTL);
+  auto threadCacheSize = options.sslThreadCacheSize;
+  if (threadCacheSize > 0) {
+    threadCache_.reset(new LocalSSLSessionCache(
+      threadCacheSize, std::max<uint32_t>(1, threadCacheSize / 8)));
+  }
 
   VLOG(2) << "On VipID=" << sockaddr.describe() << " context=" << context;
 }
 
 SSLSessionCacheManager::~SSLSessionCacheManager() {
+  for (auto cacheCtx : batch_) {
+    delete cacheCtx;
+  }
+  // Don't leave the other instances waiting on lookups made here
+  for (const auto& pending : pendingLookups_) {
+    if (!pending.second.coalesced) {
+      finishExternalLookup(pending.first, nullptr, false);
+    }
+  }
 }
 
 void SSLSessionCacheManager::shutdown() {
   std::lock_guard<std::mutex> g(sCacheLock_);
+  if (sCache_ && !sSnapshotFile_.empty()) {
+    saveSessions(*sCache_, sSnapshotFile_);
+  }
   sCache_.reset();
+  sExternalLookups_.reset();
+}
+
+size_t SSLSessionCacheManager::saveSessions(const string& file) {
+  std::lock_guard<std::mutex> g(sCacheLock_);
+  return sCache_ ? saveSessions(*sCache_, file) : 0;
+}
+
+size_t SSLSessionCacheManager::loadSessions(const string& file) {
+  std::lock_guard<std::mutex> g(sCacheLock_);
+  return sCache_ ? loadSessions(*sCache_, file) : 0;
+}
+
+size_t SSLSessionCacheManager::saveSessions(
+    ShardedLocalSSLSessionCache& cache,
+    const string& file) {
+  string snapshot = BinaryCacheLog::header().str();
+  string sessionString;
+  size_t nSessions = 0;
+  const auto now = time(nullptr);
+  cache.forEachSession([&](const string& sessionId, SSL_SESSION* session) {
+    if (isExpired(session, now)) {
+      return;
+    }
+    sessionString.resize(i2d_SSL_SESSION(session, nullptr));
+    uint8_t* cp = (uint8_t *)sessionString.data();
+    i2d_SSL_SESSION(session, &cp);
+    BinaryCacheLog::appendPut(sessionId, sessionString, snapshot);
+    ++nSessions;
+  });
+
+  // Not to leave a torn file behind for the next process. The temporary
+  // file is a new one of the owner's, rather than whatever may be at a
+  // predictable path, as it holds the master keys.
+  auto tmpFile = file + ".XXXXXX";
+  const auto fd = mkstemp(&tmpFile[0]);
+  if (fd == -1) {
+    LOG(ERROR) << "Failed to create a temporary file for " << file
+               << ": errno " << errno;
+    return 0;
+  }
+  bool saved = fchmod(fd, S_IRUSR | S_IWUSR) == 0;
+  const auto nWritten = folly::writeFull(fd, snapshot.data(), snapshot.size());
+  saved = saved && nWritten >= 0 &&
+    static_cast<size_t>(nWritten) == snapshot.size() && fsync(fd) == 0;
+  if (folly::closeNoInt(fd) != 0) {
+    saved = false;
+  }
+  if (!saved || rename(tmpFile.c_str(), file.c_str()) != 0) {
+    LOG(ERROR) << "Failed to write SSL sessions to " << file << ": errno "
+               << errno;
+    unlink(tmpFile.c_str());
+    return 0;
+  }
+  VLOG(2) << "Saved " << nSessions << " SSL sessions to " << file;
+  return nSessions;
+}
+
+size_t SSLSessionCacheManager::loadSessions(
+    ShardedLocalSSLSessionCache& cache,
+    const string& file) {
+  string snapshot;
+  if (!folly::readFile(file.c_str(), snapshot)) {
+    VLOG(2) << "No SSL sessions to load from " << file;
+    return 0;
+  }
+  size_t nSessions = 0;
+  size_t nRecords = 0;
+  const auto now = time(nullptr);
+  auto onPut = [&](string&& sessionId, string&& sessionString) {
+    auto data = (const uint8_t *)sessionString.data();
+    SSL_SESSION* session =
+      d2i_SSL_SESSION(nullptr, &data, sessionString.length());
+    if (!session) {
+      return;
+    }
+    if (isExpired(session, now)) {
+      SSL_SESSION_free(session);
+      return;
+    }
+    cache.storeSession(sessionId, session, nullptr);
+    ++nSessions;
+  };
+  try {
+    if (!BinaryCacheLog::replay<string, string>(
+          folly::StringPiece(snapshot), onPut, [](string&&) {}, [] {},
+          &nRecords)) {
+      LOG(WARNING) << "SSL session snapshot " << file << " is truncated after "
+                   << nRecords << " sessions";
+    }
+  } catch (const std::exception& ex) {
+    LOG(ERROR) << "Failed to load SSL sessions from " << file << ": "
+               << ex.what();
+  }
+  VLOG(2) << "Loaded " << nSessions << " SSL sessions from " << file;
+  return nSessions;
 }
 
 shared_ptr<ShardedLocalSSLSessionCache> SSLSessionCacheManager::getLocalCache(
   uint32_t maxCacheSize,
-  uint32_t cacheCullSize) {
+  uint32_t cacheCullSize,
+  uint32_t numCacheShards,
+  const string& snapshotFile) {
 
   std::lock_guard<std::mutex> g(sCacheLock_);
   if (!sCache_) {
-    sCache_.reset(new ShardedLocalSSLSessionCache(NUM_CACHE_BUCKETS,
-                                                  maxCacheSize,
-                                                  cacheCullSize));
+    sCache_.reset(new ShardedLocalSSLSessionCache(
+                    numCacheShards > 0 ? numCacheShards : NUM_CACHE_BUCKETS,
+                    maxCacheSize,
+                    cacheCullSize));
+    sSnapshotFile_ = snapshotFile;
+    if (!sSnapshotFile_.empty()) {
+      loadSessions(*sCache_, sSnapshotFile_);
+    }
   }
   return sCache_;
 }
 
+shared_ptr<SSLSessionCacheManager::ExternalLookups>
+SSLSessionCacheManager::getExternalLookups(std::chrono::milliseconds missTTL) {
+  std::lock_guard<std::mutex> g(sCacheLock_);
+  if (!sExternalLookups_) {
+    sExternalLookups_ = std::make_shared<ExternalLookups>(missTTL);
+  }
+  return sExternalLookups_;
+}
+
+SSL_SESSION* SSLSessionCacheManager::lookupLocalSession(
+    const string& sessionId) {
+  if (threadCache_) {
+    auto itr = threadCache_->sessionCache.find(sessionId);
+    if (itr != threadCache_->sessionCache.end()) {
+      CRYPTO_add(&itr->second->references, 1, CRYPTO_LOCK_SSL_SESSION);
+      return itr->second;
+    }
+  }
+  SSL_SESSION* session = localCache_->lookupSession(sessionId);
+  if (session && threadCache_) {
+    // The client is likely to come back to this thread
+    CRYPTO_add(&session->references, 1, CRYPTO_LOCK_SSL_SESSION);
+    storeThreadSession(sessionId, session);
+  }
+  return session;
+}
+
+void SSLSessionCacheManager::storeLocalSession(const string& sessionId,
+                                               SSL_SESSION* session) {
+  if (session && threadCache_) {
+    CRYPTO_add(&session->references, 1, CRYPTO_LOCK_SSL_SESSION);
+    storeThreadSession(sessionId, session);
+  }
+  localCache_->storeSession(sessionId, session, stats_);
+}
+
+void SSLSessionCacheManager::storeThreadSession(const string& sessionId,
+                                                SSL_SESSION* session) {
+  auto itr = threadCache_->sessionCache.find(sessionId);
+  if (itr != threadCache_->sessionCache.end()) {
+    // EvictingCacheMap doesn't free on overwrite
+    SSL_SESSION_free(itr->second);
+  }
+  threadCache_->sessionCache.set(sessionId, session, true);
+}
+
 int SSLSessionCacheManager::newSessionCallback(SSL* ssl, SSL_SESSION* session) {
   SSLSessionCacheManager* manager = nullptr;
   SSL_CTX* ctx = SSL_get_SSL_CTX(ssl);
@@ -147,7 +351,7 @@ int SSLSessionCacheManager::newSession(SSL* ssl, SSL_SESSION* session) {
     stats_->recordSSLSession(true /* new session */, false, false);
   }
 
-  localCache_->storeSession(sessionId, session, stats_);
+  storeLocalSession(sessionId, session);
 
   if (externalCache_) {
     VLOG(4) << "New SSL session: send session to external cache; id=" <<
@@ -179,6 +383,13 @@ void SSLSessionCacheManager::removeSession(SSL_CTX* ctx,
   // never be called
   VLOG(3) << "Remove SSL session; id=" << SSLUtil::hexlify(sessionId);
 
+  if (threadCache_) {
+    auto itr = threadCache_->sessionCache.find(sessionId);
+    if (itr != threadCache_->sessionCache.end()) {
+      SSL_SESSION_free(itr->second);
+      threadCache_->sessionCache.erase(sessionId);
+    }
+  }
   localCache_->removeSession(sessionId);
 
   if (stats_) {
@@ -206,6 +417,12 @@ SSL_SESSION* SSLSessionCacheManager::getSession(SSL* ssl,
                                                 int id_len,
                                                 int* copyflag) {
   VLOG(7) << "SSL get session callback";
+  SSLHandshakeTimings::mark(
+    ssl, SSLHandshakeTimings::Stage::SESSION_LOOKUP_STARTED);
+  SCOPE_EXIT {
+    SSLHandshakeTimings::mark(
+      ssl, SSLHandshakeTimings::Stage::SESSION_LOOKUP_FINISHED);
+  };
   SSL_SESSION* session = nullptr;
   bool foreign = false;
   char const* missReason = nullptr;
@@ -222,7 +439,7 @@ SSL_SESSION* SSLSessionCacheManager::getSession(SSL* ssl,
   assert(sslSocket != nullptr);
 
   // look it up in the local cache first
-  session = localCache_->lookupSession(sessionId);
+  session = lookupLocalSession(sessionId);
 #ifdef SSL_SESSION_CB_WOULD_BLOCK
   if (session == nullptr && externalCache_) {
     // external cache might have the session
@@ -232,17 +449,35 @@ SSL_SESSION* SSLSessionCacheManager::getSession(SSL* ssl,
     } else {
       PendingLookupMap::iterator pit = pendingLookups_.find(sessionId);
       if (pit == pendingLookups_.end()) {
-        auto result = pendingLookups_.emplace(sessionId, PendingLookup());
-        // initiate fetch
-        VLOG(4) << "Get SSL session [Pending]: Initiate Fetch; fd=" <<
-          sslSocket->getFd() << " id=" << SSLUtil::hexlify(sessionId);
-        if (lookupCacheRecord(sessionId, sslSocket)) {
-          // response is pending
+        auto lookup = startExternalLookup(sessionId);
+        if (lookup == ExternalLookup::KNOWN_MISS) {
+          missReason = "reason: recent external cache miss;";
+        } else if (lookup == ExternalLookup::COALESCED) {
+          // Another thread initiated the request, attach
+          VLOG(4) << "Get SSL session [Pending]: Request in progess "
+            "elsewhere: attach; fd=" << sslSocket->getFd() << " id=" <<
+            SSLUtil::hexlify(sessionId);
+          auto result = pendingLookups_.emplace(sessionId, PendingLookup());
+          result.first->second.coalesced = true;
+          std::unique_ptr<DelayedDestruction::DestructorGuard> dg(
+            new DelayedDestruction::DestructorGuard(sslSocket));
+          result.first->second.waiters.emplace_back(sslSocket, std::move(dg));
           *copyflag = SSL_SESSION_CB_WOULD_BLOCK;
           return nullptr;
         } else {
-          missReason = "reason: failed to send lookup request;";
-          pendingLookups_.erase(result.first);
+          auto result = pendingLookups_.emplace(sessionId, PendingLookup());
+          // initiate fetch
+          VLOG(4) << "Get SSL session [Pending]: Initiate Fetch; fd=" <<
+            sslSocket->getFd() << " id=" << SSLUtil::hexlify(sessionId);
+          if (lookupCacheRecord(sessionId, sslSocket)) {
+            // response is pending
+            *copyflag = SSL_SESSION_CB_WOULD_BLOCK;
+            return nullptr;
+          } else {
+            missReason = "reason: failed to send lookup request;";
+            pendingLookups_.erase(result.first);
+            finishExternalLookup(sessionId, nullptr, false);
+          }
         }
       } else {
         // A lookup was already initiated from this thread
@@ -294,7 +529,7 @@ bool SSLSessionCacheManager::storeCacheRecord(const string& sessionId,
   sessionString.resize(sessionLen);
   uint8_t* cp = (uint8_t *)sessionString.data();
   i2d_SSL_SESSION(session, &cp);
-  size_t expiration = SSL_CTX_get_timeout(ctx_->getSSLCtx());
+  size_t expiration = SSL_CTX_get_timeout(sslCtx_);
   return externalCache_->setAsync(sessionId, sessionString,
                                   std::chrono::seconds(expiration));
 }
@@ -308,6 +543,14 @@ bool SSLSessionCacheManager::lookupCacheRecord(const string& sessionId,
   cacheCtx->guard.reset(
       new DelayedDestruction::DestructorGuard(cacheCtx->sslSocket));
   cacheCtx->manager = this;
+  if (batchSize_ > 1 && eventBase_) {
+    // Sent at the end of this loop iteration, with the other misses
+    batch_.push_back(cacheCtx);
+    if (!flusher_.isLoopCallbackScheduled()) {
+      eventBase_->runInLoop(&flusher_);
+    }
+    return true;
+  }
   bool res = externalCache_->getAsync(sessionId, cacheCtx);
   if (!res) {
     delete cacheCtx;
@@ -315,6 +558,105 @@ bool SSLSessionCacheManager::lookupCacheRecord(const string& sessionId,
   return res;
 }
 
+void SSLSessionCacheManager::flushLookups() {
+  std::vector<SSLCacheProvider::CacheContext*> pending;
+  pending.swap(batch_);
+  for (size_t i = 0; i < pending.size(); i += batchSize_) {
+    std::vector<SSLCacheProvider::CacheContext*> batch(
+      pending.begin() + i,
+      pending.begin() + std::min(pending.size(), i + batchSize_));
+    VLOG(4) << "Get SSL sessions: send batch of " << batch.size();
+    for (auto cacheCtx : externalCache_->getAsyncBatch(batch)) {
+      failLookup(cacheCtx);
+    }
+  }
+}
+
+void SSLSessionCacheManager::failLookup(
+    SSLCacheProvider::CacheContext* cacheCtx) {
+  VLOG(4) << "Get SSL session: failed to send lookup request; id=" <<
+    SSLUtil::hexlify(cacheCtx->sessionId);
+  restartSSLAccept(cacheCtx);
+  finishExternalLookup(cacheCtx->sessionId, nullptr, false);
+  delete cacheCtx;
+}
+
+SSLSessionCacheManager::ExternalLookup
+SSLSessionCacheManager::startExternalLookup(const string& sessionId) {
+  auto& lookups = *externalLookups_;
+  std::lock_guard<std::mutex> g(lookups.lock);
+  auto miss = lookups.misses.find(sessionId);
+  if (miss != lookups.misses.end()) {
+    if (std::chrono::steady_clock::now() < miss->second) {
+      return ExternalLookup::KNOWN_MISS;
+    }
+    lookups.misses.erase(sessionId);
+  }
+  auto it = lookups.inFlight.find(sessionId);
+  if (it == lookups.inFlight.end()) {
+    lookups.inFlight.emplace(sessionId, ExternalLookups::Lookup{this, {}});
+  } else if (eventBase_) {
+    it->second.waiters.push_back(
+      ExternalLookups::Waiter{std::weak_ptr<SSLSessionCacheManager>(self_),
+                              eventBase_});
+    return ExternalLookup::COALESCED;
+  }
+  // Without an EventBase to be told the result in, look it up separately
+  return ExternalLookup::STARTED;
+}
+
+void SSLSessionCacheManager::finishExternalLookup(const string& sessionId,
+                                                  SSL_SESSION* session,
+                                                  bool recordMiss) {
+  std::vector<ExternalLookups::Waiter> waiters;
+  {
+    auto& lookups = *externalLookups_;
+    std::lock_guard<std::mutex> g(lookups.lock);
+    auto it = lookups.inFlight.find(sessionId);
+    if (it != lookups.inFlight.end() && it->second.owner == this) {
+      waiters.swap(it->second.waiters);
+      lookups.inFlight.erase(it);
+    }
+    if (!session && recordMiss && lookups.missTTL.count() > 0) {
+      lookups.misses.set(sessionId,
+                         std::chrono::steady_clock::now() + lookups.missTTL);
+    }
+  }
+  for (auto& waiter : waiters) {
+    if (session) {
+      // Handed over to the waiting instance
+      CRYPTO_add(&session->references, 1, CRYPTO_LOCK_SSL_SESSION);
+    }
+    auto manager = waiter.manager;
+    waiter.eventBase->runInEventBaseThread([manager, sessionId, session] {
+      auto waiting = manager.lock();
+      if (waiting) {
+        waiting->onCoalescedLookup(sessionId, session);
+      } else if (session) {
+        SSL_SESSION_free(session);
+      }
+    });
+  }
+}
+
+void SSLSessionCacheManager::onCoalescedLookup(const string& sessionId,
+                                               SSL_SESSION* session) {
+  PendingLookupMap::iterator pit = pendingLookups_.find(sessionId);
+  if (pit != pendingLookups_.end() && pit->second.coalesced) {
+    pit->second.request_in_progress = false;
+    pit->second.session = session;
+    VLOG(7) << "Restart SSL accept (coalesced)";
+    for (const auto& attachedLookup: pit->second.waiters) {
+      attachedLookup.first->restartSSLAccept();
+    }
+    pendingLookups_.erase(pit);
+  }
+  if (session) {
+    // The resumed clients took references of their own
+    SSL_SESSION_free(session);
+  }
+}
+
 void SSLSessionCacheManager::restartSSLAccept(
     const SSLCacheProvider::CacheContext* cacheCtx) {
   PendingLookupMap::iterator pit = pendingLookups_.find(cacheCtx->sessionId);
@@ -342,7 +684,8 @@ void SSLSessionCacheManager::restoreSession(
   /* Insert in the LRU after restarting all clients.  The stats logic
    * in getSession would treat this as a local hit otherwise.
    */
-  localCache_->storeSession(cacheCtx->sessionId, cacheCtx->session, stats_);
+  finishExternalLookup(cacheCtx->sessionId, cacheCtx->session, true);
+  storeLocalSession(cacheCtx->sessionId, cacheCtx->session);
   delete cacheCtx;
 }
 
@@ -365,6 +708,7 @@ void SSLSessionCacheManager::onGetSuccess(
 void SSLSessionCacheManager::onGetFailure(
     SSLCacheProvider::CacheContext* cacheCtx) {
   restartSSLAccept(cacheCtx);
+  finishExternalLookup(cacheCtx->sessionId, nullptr, true);
   delete cacheCtx;
 }
 
@@ -9,12 +9,17 @@
  */
 #pragma once
 
+#include <wangle/ssl/SSLCacheOptions.h>
 #include <wangle/ssl/SSLCacheProvider.h>
 #include <wangle/ssl/SSLStats.h>
 
 #include <folly/EvictingCacheMap.h>
+#include <folly/SpookyHashV2.h>
+#include <chrono>
 #include <mutex>
+#include <unordered_map>
 #include <folly/io/async/AsyncSSLSocket.h>
+#include <folly/io/async/EventBase.h>
 
 namespace wangle {
 
@@ -51,7 +56,7 @@ class LocalSSLSessionCache: private boost::noncopyable {
 /**
  * A sharded LRU for SSL sessions.  The sharding is inteneded to reduce
  * contention for the LRU locks.  Assuming uniform distribution, two workers
- * will contend for the same lock with probability 1 / n_buckets^2.
+ * will contend for the same lock with probability 1 / n_buckets.
  */
 class ShardedLocalSSLSessionCache : private boost::noncopyable {
  public:
@@ -118,12 +123,27 @@ class ShardedLocalSSLSessionCache : private boost::noncopyable {
     caches_[bucket]->sessionCache.erase(sessionId);
   }
 
+  /**
+   * Calls fn(sessionId, session) for every session, bucket by bucket with
+   * the bucket's lock held, from the least recently used on
+   */
+  template <typename Fn>
+  void forEachSession(Fn&& fn) {
+    for (auto& cache : caches_) {
+      std::lock_guard<std::mutex> g(cache->lock);
+      for (auto it = cache->sessionCache.rbegin();
+           it != cache->sessionCache.rend(); ++it) {
+        fn(it->first, it->second);
+      }
+    }
+  }
+
  private:
 
-  /* SSL session IDs are 32 bytes of random data, hash based on first 16 bits */
+  /* Hash the whole ID: not every session ID generator is random */
   size_t hash(const std::string& key) {
-    CHECK(key.length() >= 2);
-    return (key[0] << 8 | key[1]) % caches_.size();
+    return folly::hash::SpookyHashV2::Hash64(key.data(), key.length(), 0) %
+      caches_.size();
   }
 
   std::vector< std::unique_ptr<LocalSSLSessionCache> > caches_;
@@ -142,11 +162,14 @@ typedef std::pair<folly::AsyncSSLSocket *,
  */
 struct PendingLookup {
   bool request_in_progress;
+  // Made by another SSLSessionCacheManager, which tells this one the result
+  bool coalesced;
   SSL_SESSION* session;
   std::list<AttachedLookup> waiters;
 
   PendingLookup() {
     request_in_progress = true;
+    coalesced = false;
     session = nullptr;
   }
 };
@@ -161,9 +184,14 @@ typedef std::map<std::string, PendingLookup> PendingLookupMap;
  * to share sessions across instances.
  *
  * There is a single in memory session cache shared by all VIPs.  The cache is
- * split into N buckets (currently 16) with a separate lock per bucket.  The
- * VIP ID is hashed and stored as part of the session to handle the
- * (very unlikely) case of session ID collision.
+ * split into N buckets (16 unless configured) with a separate lock per
+ * bucket.  The VIP ID is hashed and stored as part of the session to handle
+ * the (very unlikely) case of session ID collision.
+ *
+ * Optionally, each instance also keeps the sessions it last created or
+ * resumed in a small cache of its own, looked up first and without a lock:
+ * with SO_REUSEPORT, a client reconnecting from the same address lands on
+ * the same thread, so most resumptions never touch the shared buckets.
  *
  * When a new SSL session is created, it is added to the LRU cache and
  * sent to the external cache to be stored.  The external cache
@@ -175,12 +203,21 @@ typedef std::map<std::string, PendingLookup> PendingLookupMap;
  * external cache query returns, the LRU cache is updated if the session was
  * found, and the SSL_accept call is resumed.
  *
- * If additional resume requests for the same session ID arrive in the same
- * thread while the request is pending, the 2nd - Nth callers attach to the
- * original external cache requests and are resumed when it comes back.  No
- * attempt is made to coalesce external cache requests for the same session
- * ID in different worker threads.  Previous work did this, but the
- * complexity was deemed to outweigh the potential savings.
+ * If additional resume requests for the same session ID arrive while the
+ * request is pending, in this thread or any other, the 2nd - Nth callers
+ * attach to the original external cache request and are resumed when it
+ * comes back; the instance that made it hands the result over to the others
+ * in their own EventBase threads.  After a load balancer shift, many
+ * threads see the same sessions at once, and each is fetched only once.
+ *
+ * Optionally, the requests of one event loop iteration are sent together
+ * with SSLCacheProvider::getAsyncBatch(), and sessions the external cache
+ * didn't have are not asked for again for a short while.
+ *
+ * Optionally too, the in memory cache is saved to a file on shutdown and
+ * loaded back when the next process creates it, so that it doesn't start
+ * out empty and send every resumption to the external cache or a full
+ * handshake.
  *
  */
 class SSLSessionCacheManager : private boost::noncopyable {
@@ -189,8 +226,18 @@ class SSLSessionCacheManager : private boost::noncopyable {
    * Constructor.  SSL session related callbacks will be set on the underlying
    * SSL_CTX.  vipId is assumed to a unique string identifying the VIP and must
    * be the same on all servers that wish to share sessions via the same
-   * external cache.
+   * external cache.  The options of the shared cache, the cache size, shards
+   * and external miss TTL, are taken from the first instance only.
    */
+  SSLSessionCacheManager(
+    const SSLCacheOptions& options,
+    folly::SSLContext* ctx,
+    const folly::SocketAddress& sockaddr,
+    const std::string& context,
+    folly::EventBase* eventBase,
+    SSLStats* stats,
+    const std::shared_ptr<SSLCacheProvider>& externalCache);
+
   SSLSessionCacheManager(
     uint32_t maxCacheSize,
     uint32_t cacheCullSize,
@@ -209,6 +256,32 @@ class SSLSessionCacheManager : private boost::noncopyable {
    */
   static void shutdown();
 
+  /**
+   * Write the sessions of the in memory cache that haven't expired to file,
+   * from the least recently used on, for loadSessions() to read. The file
+   * holds the sessions' master keys, and is only readable by its owner.
+   * Done by shutdown() with the snapshot file of the cache options.
+   * @return the number of sessions written, 0 if the file couldn't be
+   */
+  static size_t saveSessions(const std::string& file);
+
+  /**
+   * Add the sessions in file that haven't expired since to the in memory
+   * cache, once it's been created. Done when it's created with the
+   * snapshot file of the cache options.
+   * @return the number of sessions added
+   */
+  static size_t loadSessions(const std::string& file);
+
+  /**
+   * saveSessions() and loadSessions() of the given cache rather than the
+   * global one
+   */
+  static size_t saveSessions(ShardedLocalSSLSessionCache& cache,
+                             const std::string& file);
+  static size_t loadSessions(ShardedLocalSSLSessionCache& cache,
+                             const std::string& file);
+
   /**
    * Callback for ExternalCache to call when an async get succeeds
    * @param context  The context that was passed to the async get request
@@ -234,11 +307,106 @@ class SSLSessionCacheManager : private boost::noncopyable {
    */
   void onGetFailure(SSLCacheProvider::CacheContext* cacheCtx);
 
+ protected:
+
+  enum class ExternalLookup {
+    // This instance is to look the session up
+    STARTED,
+    // Another instance is looking it up already
+    COALESCED,
+    // The external cache didn't have it a moment ago
+    KNOWN_MISS
+  };
+
+  PendingLookupMap pendingLookups_;
+
+  /**
+   * Lookup a session in the external cache for the specified SSL socket.
+   */
+  bool lookupCacheRecord(const std::string& sessionId,
+                         folly::AsyncSSLSocket* sslSock);
+
+  /**
+   * Register a lookup of the session with the other instances
+   */
+  ExternalLookup startExternalLookup(const std::string& sessionId);
+
+  /**
+   * Hand the result of a lookup over to the other instances waiting for it,
+   * remembering a miss if recordMiss
+   */
+  void finishExternalLookup(const std::string& sessionId,
+                            SSL_SESSION* session,
+                            bool recordMiss);
+
+  /**
+   * Look a session up in the thread cache, then in the shared cache.
+   * The session returned has had its reference count bumped.
+   */
+  SSL_SESSION* lookupLocalSession(const std::string& sessionId);
+
+  /**
+   * Store a session, whose reference is handed over, in the shared cache,
+   * and in the thread cache with a reference of its own
+   */
+  void storeLocalSession(const std::string& sessionId, SSL_SESSION* session);
+
  private:
 
+  /**
+   * External cache lookups in flight, and recent misses, of all instances
+   */
+  struct ExternalLookups {
+    explicit ExternalLookups(std::chrono::milliseconds ttl)
+        : missTTL(ttl), misses(10000) {}
+
+    struct Waiter {
+      std::weak_ptr<SSLSessionCacheManager> manager;
+      folly::EventBase* eventBase;
+    };
+
+    struct Lookup {
+      const SSLSessionCacheManager* owner;
+      // The other instances waiting on it
+      std::vector<Waiter> waiters;
+    };
+
+    std::mutex lock;
+    const std::chrono::milliseconds missTTL;
+    std::unordered_map<std::string, Lookup> inFlight;
+    // When each recent miss can be looked up again
+    folly::EvictingCacheMap<std::string, std::chrono::steady_clock::time_point>
+      misses;
+  };
+
+  class LookupFlusher : public folly::EventBase::LoopCallback {
+   public:
+    explicit LookupFlusher(SSLSessionCacheManager* manager)
+        : manager_(manager) {}
+
+    void runLoopCallback() noexcept override {
+      manager_->flushLookups();
+    }
+
+   private:
+    SSLSessionCacheManager* manager_;
+  };
+
   folly::SSLContext* ctx_;
+  // Outlives the manager, unlike ctx_, which a reload may free while
+  // connections still use its SSL_CTX
+  SSL_CTX* sslCtx_;
+  folly::EventBase* eventBase_;
   std::shared_ptr<ShardedLocalSSLSessionCache> localCache_;
-  PendingLookupMap pendingLookups_;
+  std::shared_ptr<ExternalLookups> externalLookups_;
+  // Lookups waiting for the end of the loop iteration, to go in one batch
+  std::vector<SSLCacheProvider::CacheContext*> batch_;
+  uint32_t batchSize_{1};
+  LookupFlusher flusher_{this};
+  // For the other instances to tell if this one is still around
+  std::shared_ptr<SSLSessionCacheManager> self_;
+  // Only used from this instance's thread, so its lock is never taken
+  std::unique_ptr<LocalSSLSessionCache> threadCache_;
   SSLStats* stats_{nullptr};
   std::shared_ptr<SSLCacheProvider> externalCache_;
 
@@ -273,26 +441,48 @@ class SSLSessionCacheManager : private boost::noncopyable {
                       size_t length);
 
   /**
-   * Store a new session record in the external cache
+   * Store a session in the thread cache, handing over a reference
    */
-  bool storeCacheRecord(const std::string& sessionId, SSL_SESSION* session);
+  void storeThreadSession(const std::string& sessionId, SSL_SESSION* session);
 
   /**
-   * Lookup a session in the external cache for the specified SSL socket.
+   * Store a new session record in the external cache
    */
-  bool lookupCacheRecord(const std::string& sessionId,
-                         folly::AsyncSSLSocket* sslSock);
+  bool storeCacheRecord(const std::string& sessionId, SSL_SESSION* session);
 
   /**
    * Restart all clients waiting for the answer to an external cache query
    */
   void restartSSLAccept(const SSLCacheProvider::CacheContext* cacheCtx);
 
+  /**
+   * The result of a lookup made by another instance, whose reference to the
+   * session, if any, is handed over
+   */
+  void onCoalescedLookup(const std::string& sessionId, SSL_SESSION* session);
+
+  /**
+   * Send the lookups batched in this loop iteration
+   */
+  void flushLookups();
+
+  /**
+   * Resume the clients waiting on a lookup that couldn't be sent
+   */
+  void failLookup(SSLCacheProvider::CacheContext* cacheCtx);
+
   /**
    * Get or create the LRU cache for the given VIP ID
    */
   static std::shared_ptr<ShardedLocalSSLSessionCache> getLocalCache(
-    uint32_t maxCacheSize, uint32_t cacheCullSize);
+    uint32_t maxCacheSize, uint32_t cacheCullSize, uint32_t numCacheShards,
+    const std::string& snapshotFile);
+
+  /**
+   * Get or create the registry of external lookups
+   */
+  static std::shared_ptr<ExternalLookups> getExternalLookups(
+    std::chrono::milliseconds missTTL);
 
   /**
    * static functions registered as callbacks to openssl via
@@ -305,6 +495,8 @@ class SSLSessionCacheManager : private boost::noncopyable {
 
   static int32_t sExDataIndex_;
   static std::shared_ptr<ShardedLocalSSLSessionCache> sCache_;
+  static std::string sSnapshotFile_;
+  static std::shared_ptr<ExternalLookups> sExternalLookups_;
   static std::mutex sCacheLock_;
 };
 
@@ -11,6 +11,8 @@
 
 namespace wangle {
 
+class SSLHandshakeTimings;
+
 class SSLStats {
  public:
   virtual ~SSLStats() noexcept {}
@@ -25,6 +27,9 @@ class SSLStats {
   virtual void recordSSLSessionSetError(uint32_t err) noexcept = 0;
   virtual void recordSSLSessionGetError(uint32_t err) noexcept = 0;
   virtual void recordClientRenegotiation() noexcept = 0;
+  // For the sampled handshakes, failed ones too (FINISHED not reached)
+  virtual void recordSSLHandshakeTimings(
+    const SSLHandshakeTimings& /* timings */) noexcept {}
 
   // upstream
   virtual void recordSSLUpstreamConnection(bool handshake) noexcept = 0;
@@ -9,7 +9,9 @@
  */
 #include <wangle/ssl/SSLUtil.h>
 
+#include <folly/Conv.h>
 #include <folly/Memory.h>
+#include <sys/stat.h>
 
 #if OPENSSL_VERSION_NUMBER >= 0x1000105fL
 #define OPENSSL_GE_101 1
@@ -73,4 +75,31 @@ std::unique_ptr<std::list<std::string>> SSLUtil::getSubjectAltName(
 #endif
 }
 
+std::string SSLUtil::getFileVersion(const std::string& path) {
+  struct stat st;
+  if (path.empty() || stat(path.c_str(), &st) != 0) {
+    return path;
+  }
+  return folly::to<std::string>(path, '@', st.st_mtime, '.',
+                                st.st_mtim.tv_nsec, '/', st.st_size);
+}
+
+size_t SSLUtil::getRecordBufferSize(const SSL* ssl) {
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+  if (!ssl || !ssl->s3) {
+    return 0;
+  }
+  size_t bytes = 0;
+  if (ssl->s3->rbuf.buf) {
+    bytes += ssl->s3->rbuf.len;
+  }
+  if (ssl->s3->wbuf.buf) {
+    bytes += ssl->s3->wbuf.len;
+  }
+  return bytes;
+#else
+  return 0;
+#endif
+}
+
 } // namespace wangle
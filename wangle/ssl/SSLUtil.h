@@ -164,6 +164,19 @@ class SSLUtil {
    */
   static std::unique_ptr<std::list<std::string>> getSubjectAltName(
       const X509* cert);
+
+  /**
+   * Identifies the contents of a file without reading it, from its path,
+   * mtime and size: tells whether the file changed since it was read.
+   */
+  static std::string getFileVersion(const std::string& path);
+
+  /**
+   * Bytes of the record buffers OpenSSL holds for ssl. With
+   * SSL_MODE_RELEASE_BUFFERS, which SSLContextManager sets, an idle
+   * connection holds none. 0 where OpenSSL doesn't tell.
+   */
+  static size_t getRecordBufferSize(const SSL* ssl);
 };
 
 } // namespace wangle
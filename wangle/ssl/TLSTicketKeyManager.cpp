@@ -12,7 +12,9 @@
 #include <folly/Random.h>
 #include <folly/String.h>
 #include <folly/io/async/AsyncTimeout.h>
+#include <algorithm>
 #include <openssl/aes.h>
+#include <openssl/hmac.h>
 #include <openssl/rand.h>
 #include <openssl/ssl.h>
 #include <wangle/ssl/SSLStats.h>
@@ -26,10 +28,69 @@ namespace {
 const int kTLSTicketKeyNameLen = 4;
 const int kTLSTicketKeySaltLen = 12;
 
+// Key names are compared as uint32_t
+static_assert(kTLSTicketKeyNameLen == sizeof(uint32_t), "key name length");
+
+// Derived keys cached per thread, for the few encryption keys and for the
+// salts of the threads and servers whose tickets come back
+const size_t kKeyCacheSize = 16;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+HMAC_CTX* newHmacCtx() {
+  return HMAC_CTX_new();
+}
+
+void freeHmacCtx(HMAC_CTX* ctx) {
+  HMAC_CTX_free(ctx);
+}
+#else
+HMAC_CTX* newHmacCtx() {
+  auto ctx = new HMAC_CTX;
+  HMAC_CTX_init(ctx);
+  return ctx;
+}
+
+void freeHmacCtx(HMAC_CTX* ctx) {
+  HMAC_CTX_cleanup(ctx);
+  delete ctx;
+}
+#endif
+
 }
 
 namespace wangle {
 
+struct TLSTicketKeyManager::KeyCache {
+  struct Entry {
+    Entry() : hmacCtx(newHmacCtx()), cipherCtx(EVP_CIPHER_CTX_new()) {}
+
+    ~Entry() {
+      freeHmacCtx(hmacCtx);
+      EVP_CIPHER_CTX_free(cipherCtx);
+    }
+
+    Entry(const Entry&) = delete;
+    Entry& operator=(const Entry&) = delete;
+
+    // Null while unused
+    const TLSTicketKeySource* key{nullptr};
+    int encrypt{0};
+    unsigned char salt[kTLSTicketKeySaltLen];
+    // Set up with the derived keys, and no iv
+    HMAC_CTX* hmacCtx;
+    EVP_CIPHER_CTX* cipherCtx;
+  };
+
+  // Holds the keys the entries point to, so that a new set can't take
+  // their addresses
+  std::shared_ptr<const TLSTicketKeySet> keySet;
+  Entry entries[kKeyCacheSize];
+  // The entry to replace next
+  size_t next{0};
+  int64_t epoch{-1};
+  unsigned char epochSalt[kTLSTicketKeySaltLen];
+};
+
 
 // TLSTicketKeyManager Implementation
 int32_t TLSTicketKeyManager::sExDataIndex_ = -1;
@@ -70,11 +131,18 @@ TLSTicketKeyManager::processTicket(SSL* ssl, unsigned char* keyName,
   uint8_t output[SHA256_DIGEST_LENGTH];
   uint8_t* hmacKey = nullptr;
   uint8_t* aesKey = nullptr;
-  TLSTicketKeySource* key = nullptr;
+  const TLSTicketKeySource* key = nullptr;
   int result = 0;
 
+  // Held until the keys are derived, even if the seeds are reset meanwhile
+  auto keySet = std::atomic_load(&keySet_);
+  if (!keySet) {
+    VLOG(2) << "No TLS ticket keys set";
+    return encrypt ? -1 : 0;
+  }
+
   if (encrypt) {
-    key = findEncryptionKey();
+    key = findEncryptionKey(*keySet);
     if (key == nullptr) {
       // no keys available to encrypt
       VLOG(2) << "No TLS ticket key found";
@@ -84,26 +152,34 @@ TLSTicketKeyManager::processTicket(SSL* ssl, unsigned char* keyName,
       SSLUtil::hexlify(key->keyName_);
 
     // Get a random salt and write out key name
-    RAND_pseudo_bytes(salt, (int)sizeof(salt));
+    if (saltRotationInterval_.count() > 0) {
+      memcpy(salt, getEpochSalt(), sizeof(salt));
+    } else {
+      RAND_pseudo_bytes(salt, (int)sizeof(salt));
+    }
     memcpy(keyName, key->keyName_.data(), kTLSTicketKeyNameLen);
     memcpy(keyName + kTLSTicketKeyNameLen, salt, kTLSTicketKeySaltLen);
+    RAND_pseudo_bytes(iv, AES_BLOCK_SIZE);
 
-    // Create the unique keys by hashing with the salt
-    makeUniqueKeys(key->keySource_, sizeof(key->keySource_), salt, output);
-    // This relies on the fact that SHA256 has 32 bytes of output
-    // and that AES-128 keys are 16 bytes
-    hmacKey = output;
-    aesKey = output + SHA256_DIGEST_LENGTH / 2;
+    if (saltRotationInterval_.count() > 0) {
+      initCachedContexts(keySet, key, salt, iv, cipherCtx, hmacCtx, encrypt);
+    } else {
+      // Create the unique keys by hashing with the salt
+      makeUniqueKeys(key->keySource_, sizeof(key->keySource_), salt, output);
+      // This relies on the fact that SHA256 has 32 bytes of output
+      // and that AES-128 keys are 16 bytes
+      hmacKey = output;
+      aesKey = output + SHA256_DIGEST_LENGTH / 2;
 
-    // Initialize iv and cipher/mac CTX
-    RAND_pseudo_bytes(iv, AES_BLOCK_SIZE);
-    HMAC_Init_ex(hmacCtx, hmacKey, SHA256_DIGEST_LENGTH / 2,
-                 EVP_sha256(), nullptr);
-    EVP_EncryptInit_ex(cipherCtx, EVP_aes_128_cbc(), nullptr, aesKey, iv);
+      // Initialize cipher/mac CTX
+      HMAC_Init_ex(hmacCtx, hmacKey, SHA256_DIGEST_LENGTH / 2,
+                   EVP_sha256(), nullptr);
+      EVP_EncryptInit_ex(cipherCtx, EVP_aes_128_cbc(), nullptr, aesKey, iv);
+    }
 
     result = 1;
   } else {
-    key = findDecryptionKey(keyName);
+    key = findDecryptionKey(*keySet, keyName);
     if (key == nullptr) {
       // no ticket found for decryption - will issue a new ticket
       if (VLOG_IS_ON(4)) {
@@ -119,14 +195,21 @@ TLSTicketKeyManager::processTicket(SSL* ssl, unsigned char* keyName,
 
       // Reconstruct the unique key via the salt
       saltptr = keyName + kTLSTicketKeyNameLen;
-      makeUniqueKeys(key->keySource_, sizeof(key->keySource_), saltptr, output);
-      hmacKey = output;
-      aesKey = output + SHA256_DIGEST_LENGTH / 2;
-
-      // Initialize cipher/mac CTX
-      HMAC_Init_ex(hmacCtx, hmacKey, SHA256_DIGEST_LENGTH / 2,
-                   EVP_sha256(), nullptr);
-      EVP_DecryptInit_ex(cipherCtx, EVP_aes_128_cbc(), nullptr, aesKey, iv);
+      if (saltRotationInterval_.count() > 0) {
+        initCachedContexts(keySet, key, saltptr, iv, cipherCtx, hmacCtx,
+                           encrypt);
+      } else {
+        makeUniqueKeys(key->keySource_, sizeof(key->keySource_), saltptr,
+                       output);
+        hmacKey = output;
+        aesKey = output + SHA256_DIGEST_LENGTH / 2;
+
+        // Initialize cipher/mac CTX
+        HMAC_Init_ex(hmacCtx, hmacKey, SHA256_DIGEST_LENGTH / 2,
+                     EVP_sha256(), nullptr);
+        EVP_DecryptInit_ex(cipherCtx, EVP_aes_128_cbc(), nullptr, aesKey,
+                           iv);
+      }
 
       result = 1;
     }
@@ -148,9 +231,8 @@ TLSTicketKeyManager::setTLSTicketKeySeeds(
 
   bool result = true;
 
-  activeKeys_.clear();
-  ticketKeys_.clear();
-  ticketSeeds_.clear();
+  // Built aside, handshakes keep using the current keys meanwhile
+  auto keySet = std::make_shared<TLSTicketKeySet>();
   const std::vector<string> *seedList = &oldSeeds;
   for (uint32_t i = 0; i < 3; i++) {
     TLSTicketSeedType type = (TLSTicketSeedType)i;
@@ -161,23 +243,45 @@ TLSTicketKeyManager::setTLSTicketKeySeeds(
     }
 
     for (const auto& seedInput: *seedList) {
-      TLSTicketSeed* seed = insertSeed(seedInput, type);
-      if (seed == nullptr) {
+      auto seed = makeSeed(seedInput, type);
+      if (!seed) {
         result = false;
         continue;
       }
-      insertNewKey(seed, 1, nullptr);
+      insertNewKey(keySet.get(), seed.get(), 1, nullptr);
     }
   }
   if (!result) {
     VLOG(2) << "One or more seeds failed to decode";
   }
 
-  if (ticketKeys_.size() == 0 || activeKeys_.size() == 0) {
+  // The first key of each name is kept, should seeds be repeated
+  auto& keys = keySet->keys_;
+  std::stable_sort(keys.begin(), keys.end(),
+                   [](const TLSTicketKeySource& a,
+                      const TLSTicketKeySource& b) {
+                     return a.name_ < b.name_;
+                   });
+  keys.erase(std::unique(keys.begin(), keys.end(),
+                         [](const TLSTicketKeySource& a,
+                            const TLSTicketKeySource& b) {
+                           return a.name_ == b.name_;
+                         }),
+             keys.end());
+  for (const auto& key : keys) {
+    if (key.type_ == SEED_CURRENT) {
+      keySet->activeKeys_.push_back(&key);
+    }
+  }
+
+  if (keys.size() == 0 || keySet->activeKeys_.size() == 0) {
     LOG(WARNING) << "No keys configured, falling back to default";
     SSL_CTX_set_tlsext_ticket_key_cb(ctx_->getSSLCtx(), nullptr);
+    std::atomic_store(&keySet_, std::shared_ptr<const TLSTicketKeySet>());
     return false;
   }
+  std::atomic_store(&keySet_,
+                    std::shared_ptr<const TLSTicketKeySet>(keySet));
   SSL_CTX_set_tlsext_ticket_key_cb(ctx_->getSSLCtx(),
                                    TLSTicketKeyManager::callback);
 
@@ -196,37 +300,32 @@ TLSTicketKeyManager::makeKeyName(TLSTicketSeed* seed, uint32_t n,
   return string((char *)nameBuf, kTLSTicketKeyNameLen);
 }
 
-TLSTicketKeyManager::TLSTicketKeySource*
-TLSTicketKeyManager::insertNewKey(TLSTicketSeed* seed, uint32_t hashCount,
-                                  TLSTicketKeySource* prevKey) {
+void
+TLSTicketKeyManager::insertNewKey(TLSTicketKeySet* keySet,
+                                  TLSTicketSeed* seed, uint32_t hashCount,
+                                  const TLSTicketKeySource* prevKey) {
   unsigned char nameBuf[SHA256_DIGEST_LENGTH];
-  std::unique_ptr<TLSTicketKeySource> newKey(new TLSTicketKeySource);
+  TLSTicketKeySource newKey;
 
   // This function supports hash chaining but it is not currently used.
 
   if (prevKey != nullptr) {
     hashNth(prevKey->keySource_, sizeof(prevKey->keySource_),
-            newKey->keySource_, 1);
+            newKey.keySource_, 1);
   } else {
     // can't go backwards or the current is missing, start from the beginning
     hashNth((unsigned char *)seed->seed_.data(), seed->seed_.length(),
-            newKey->keySource_, hashCount);
+            newKey.keySource_, hashCount);
   }
 
-  newKey->hashCount_ = hashCount;
-  newKey->keyName_ = makeKeyName(seed, hashCount, nameBuf);
-  newKey->type_ = seed->type_;
-  auto it = ticketKeys_.insert(std::make_pair(newKey->keyName_,
-        std::move(newKey)));
-
-  auto key = it.first->second.get();
-  if (key->type_ == SEED_CURRENT) {
-    activeKeys_.push_back(key);
-  }
+  newKey.hashCount_ = hashCount;
+  newKey.keyName_ = makeKeyName(seed, hashCount, nameBuf);
+  memcpy(&newKey.name_, newKey.keyName_.data(), kTLSTicketKeyNameLen);
+  newKey.type_ = seed->type_;
   VLOG(4) << "Adding key for " << hashCount << " type=" <<
-    (uint32_t)key->type_ << " Name=" << SSLUtil::hexlify(key->keyName_);
+    (uint32_t)newKey.type_ << " Name=" << SSLUtil::hexlify(newKey.keyName_);
 
-  return key;
+  keySet->keys_.push_back(std::move(newKey));
 }
 
 void
@@ -240,57 +339,60 @@ TLSTicketKeyManager::hashNth(const unsigned char* input, size_t input_len,
   }
 }
 
-TLSTicketKeyManager::TLSTicketSeed *
-TLSTicketKeyManager::insertSeed(const string& seedInput,
-                                TLSTicketSeedType type) {
-  TLSTicketSeed* seed = nullptr;
+std::unique_ptr<TLSTicketKeyManager::TLSTicketSeed>
+TLSTicketKeyManager::makeSeed(const string& seedInput,
+                              TLSTicketSeedType type) {
   string seedOutput;
 
   if (!folly::unhexlify<string, string>(seedInput, seedOutput)) {
     LOG(WARNING) << "Failed to decode seed type=" << (uint32_t)type <<
       " seed=" << seedInput;
-    return seed;
+    return nullptr;
   }
 
-  seed = new TLSTicketSeed();
+  std::unique_ptr<TLSTicketSeed> seed(new TLSTicketSeed());
   seed->seed_ = seedOutput;
   seed->type_ = type;
   SHA256((unsigned char *)seedOutput.data(), seedOutput.length(),
          seed->seedName_);
-  ticketSeeds_.push_back(std::unique_ptr<TLSTicketSeed>(seed));
 
   return seed;
 }
 
-TLSTicketKeyManager::TLSTicketKeySource *
-TLSTicketKeyManager::findEncryptionKey() {
-  TLSTicketKeySource* result = nullptr;
+const TLSTicketKeyManager::TLSTicketKeySource *
+TLSTicketKeyManager::findEncryptionKey(const TLSTicketKeySet& keySet) {
+  const TLSTicketKeySource* result = nullptr;
   // call to rand here is a bit hokey since it's not cryptographically
   // random, and is predictably seeded with 0.  However, activeKeys_
   // is probably not going to have very many keys in it, and most
   // likely only 1.
-  size_t numKeys = activeKeys_.size();
+  size_t numKeys = keySet.activeKeys_.size();
   if (numKeys > 0) {
-    result = activeKeys_[folly::Random::rand32() % numKeys];
+    result = keySet.activeKeys_[folly::Random::rand32() % numKeys];
   }
   return result;
 }
 
-TLSTicketKeyManager::TLSTicketKeySource *
-TLSTicketKeyManager::findDecryptionKey(unsigned char* keyName) {
-  string name((char *)keyName, kTLSTicketKeyNameLen);
-  TLSTicketKeySource* key = nullptr;
-  TLSTicketKeyMap::iterator mapit = ticketKeys_.find(name);
-  if (mapit != ticketKeys_.end()) {
-    key = mapit->second.get();
+const TLSTicketKeyManager::TLSTicketKeySource *
+TLSTicketKeyManager::findDecryptionKey(const TLSTicketKeySet& keySet,
+                                       const unsigned char* keyName) {
+  uint32_t name;
+  memcpy(&name, keyName, kTLSTicketKeyNameLen);
+  const auto& keys = keySet.keys_;
+  auto it = std::lower_bound(keys.begin(), keys.end(), name,
+                             [](const TLSTicketKeySource& key, uint32_t n) {
+                               return key.name_ < n;
+                             });
+  if (it != keys.end() && it->name_ == name) {
+    return &*it;
   }
-  return key;
+  return nullptr;
 }
 
 void
-TLSTicketKeyManager::makeUniqueKeys(unsigned char* parentKey,
+TLSTicketKeyManager::makeUniqueKeys(const unsigned char* parentKey,
                                     size_t keyLen,
-                                    unsigned char* salt,
+                                    const unsigned char* salt,
                                     unsigned char* output) {
   SHA256_CTX hash_ctx;
 
@@ -300,5 +402,72 @@ TLSTicketKeyManager::makeUniqueKeys(unsigned char* parentKey,
   SHA256_Final(output, &hash_ctx);
 }
 
+void
+TLSTicketKeyManager::initCachedContexts(
+    const std::shared_ptr<const TLSTicketKeySet>& keySet,
+    const TLSTicketKeySource* key, const unsigned char* salt,
+    unsigned char* iv, EVP_CIPHER_CTX* cipherCtx, HMAC_CTX* hmacCtx,
+    int encrypt) {
+  auto& cache = getKeyCache();
+  if (cache.keySet != keySet) {
+    // The seeds were set again
+    for (auto& entry : cache.entries) {
+      entry.key = nullptr;
+    }
+    cache.keySet = keySet;
+  }
+
+  KeyCache::Entry* found = nullptr;
+  for (auto& entry : cache.entries) {
+    if (entry.key == key && entry.encrypt == encrypt &&
+        memcmp(entry.salt, salt, kTLSTicketKeySaltLen) == 0) {
+      found = &entry;
+      break;
+    }
+  }
+  if (!found) {
+    found = &cache.entries[cache.next];
+    cache.next = (cache.next + 1) % kKeyCacheSize;
+
+    uint8_t output[SHA256_DIGEST_LENGTH];
+    makeUniqueKeys(key->keySource_, sizeof(key->keySource_), salt, output);
+    HMAC_Init_ex(found->hmacCtx, output, SHA256_DIGEST_LENGTH / 2,
+                 EVP_sha256(), nullptr);
+    EVP_CipherInit_ex(found->cipherCtx, EVP_aes_128_cbc(), nullptr,
+                      output + SHA256_DIGEST_LENGTH / 2, nullptr, encrypt);
+    OPENSSL_cleanse(output, sizeof(output));
+    found->key = key;
+    found->encrypt = encrypt;
+    memcpy(found->salt, salt, kTLSTicketKeySaltLen);
+  }
+
+  // Copies keep the key schedules, only the iv is new
+  HMAC_CTX_copy(hmacCtx, found->hmacCtx);
+  EVP_CIPHER_CTX_copy(cipherCtx, found->cipherCtx);
+  EVP_CipherInit_ex(cipherCtx, nullptr, nullptr, nullptr, iv, encrypt);
+}
+
+const unsigned char*
+TLSTicketKeyManager::getEpochSalt() {
+  auto& cache = getKeyCache();
+  const int64_t epoch = std::chrono::steady_clock::now().time_since_epoch() /
+    saltRotationInterval_;
+  if (epoch != cache.epoch) {
+    cache.epoch = epoch;
+    RAND_pseudo_bytes(cache.epochSalt, (int)sizeof(cache.epochSalt));
+  }
+  return cache.epochSalt;
+}
+
+TLSTicketKeyManager::KeyCache&
+TLSTicketKeyManager::getKeyCache() {
+  auto cache = keyCache_.get();
+  if (!cache) {
+    cache = new KeyCache();
+    keyCache_.reset(cache);
+  }
+  return *cache;
+}
+
 } // namespace wangle
 #endif
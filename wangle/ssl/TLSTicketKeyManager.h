@@ -9,9 +9,14 @@
  */
 #pragma once
 
+#include <folly/ThreadLocal.h>
 #include <folly/io/async/SSLContext.h>
 #include <folly/io/async/EventBase.h>
 
+#include <chrono>
+#include <memory>
+#include <vector>
+
 namespace wangle {
 
 #ifndef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
@@ -46,12 +51,21 @@ class SSLStats;
  * can be used to derive the decryption key.  The salt is copied into the second
  * 8 bytes of the TLS ticket key name field.
  *
+ * With a salt rotation interval set, the salt is instead drawn by each thread
+ * once per interval, and the keys derived from it are cached with HMAC and
+ * AES contexts set up for them, as are those of the tickets decrypted, so
+ * that most handshakes copy contexts rather than derive keys.
+ *
  * A key is valid for decryption for the lifetime of the instance.
  * Sessions will be valid for less time than that, which results in an extra
  * symmetric decryption to discover the session is expired.
  *
- * A TLSTicketKeyManager should be used in only one thread, and should have
- * a 1:1 relationship with the SSLContext provided.
+ * The keys are kept in an immutable set, which setTLSTicketKeySeeds builds
+ * aside and then swaps in, so tickets are encrypted and decrypted without
+ * ever waiting on a rotation.  The seeds can be set from any thread.
+ *
+ * A TLSTicketKeyManager should have a 1:1 relationship with the SSLContext
+ * provided.
  *
  */
 class TLSTicketKeyManager : private boost::noncopyable {
@@ -86,6 +100,14 @@ class TLSTicketKeyManager : private boost::noncopyable {
                             const std::vector<std::string>& currentSeeds,
                             const std::vector<std::string>& newSeeds);
 
+  /**
+   * How long new tickets share a salt, see above; zero, the default, for a
+   * new salt per ticket. Set before handshakes start.
+   */
+  void setSaltRotationInterval(std::chrono::seconds interval) {
+    saltRotationInterval_ = interval;
+  }
+
   struct Unsafe {
     TLSTicketKeyManager* obj;
     int processTicket(SSL* ssl,
@@ -118,10 +140,26 @@ class TLSTicketKeyManager : private boost::noncopyable {
   struct TLSTicketKeySource {
     int32_t hashCount_;
     std::string keyName_;
+    // keyName_ as a number, to search by
+    uint32_t name_;
     TLSTicketSeedType type_;
     unsigned char keySource_[SHA256_DIGEST_LENGTH];
   };
 
+  /**
+   * The keys made from one set of seeds.  Never changed once published, and
+   * kept alive by the handshakes still using it after being replaced.
+   */
+  struct TLSTicketKeySet {
+    // All key sources that can be used for decryption, sorted by name_
+    std::vector<TLSTicketKeySource> keys_;
+    // Key sources that can be used for encryption
+    std::vector<const TLSTicketKeySource*> activeKeys_;
+  };
+
+  // Per thread, derived keys and contexts, see processTicket()
+  struct KeyCache;
+
   /**
    * Method to setup encryption/decryption context for a TLS Ticket Key
    *
@@ -149,12 +187,12 @@ class TLSTicketKeyManager : private boost::noncopyable {
                           unsigned char* nameBuf);
 
   /**
-   * Creates the key hashCount hashes from the given seed and inserts it in
-   * ticketKeys.  A naked pointer to the key is returned for additional
-   * processing if needed.
+   * Creates the key hashCount hashes from the given seed and adds it to
+   * keySet, which is left for the caller to sort.
    */
-  TLSTicketKeySource* insertNewKey(TLSTicketSeed* seed, uint32_t hashCount,
-                                   TLSTicketKeySource* prevKeySource);
+  void insertNewKey(TLSTicketKeySet* keySet, TLSTicketSeed* seed,
+                    uint32_t hashCount,
+                    const TLSTicketKeySource* prevKeySource);
 
   /**
    * hashes input N times placing result in output, which must be at least
@@ -164,40 +202,51 @@ class TLSTicketKeyManager : private boost::noncopyable {
                unsigned char* output, uint32_t n);
 
   /**
-   * Adds the given seed to the manager
+   * Decodes the given seed, or returns null if it isn't valid hex
    */
-  TLSTicketSeed* insertSeed(const std::string& seedInput,
-                            TLSTicketSeedType type);
+  std::unique_ptr<TLSTicketSeed> makeSeed(const std::string& seedInput,
+                                          TLSTicketSeedType type);
 
   /**
    * Locate a key for encrypting a new ticket
    */
-  TLSTicketKeySource* findEncryptionKey();
+  static const TLSTicketKeySource* findEncryptionKey(
+    const TLSTicketKeySet& keySet);
 
   /**
    * Locate a key for decrypting a ticket with the given keyName
    */
-  TLSTicketKeySource* findDecryptionKey(unsigned char* keyName);
+  static const TLSTicketKeySource* findDecryptionKey(
+    const TLSTicketKeySet& keySet, const unsigned char* keyName);
 
   /**
    * Derive a unique key from the parent key and the salt via hashing
    */
-  void makeUniqueKeys(unsigned char* parentKey, size_t keyLen,
-                      unsigned char* salt, unsigned char* output);
+  void makeUniqueKeys(const unsigned char* parentKey, size_t keyLen,
+                      const unsigned char* salt, unsigned char* output);
+
+  /**
+   * Sets up the contexts for key and salt from this thread's cache, which
+   * is cleared for the keys of keySet once the seeds are set again.
+   */
+  void initCachedContexts(
+    const std::shared_ptr<const TLSTicketKeySet>& keySet,
+    const TLSTicketKeySource* key, const unsigned char* salt,
+    unsigned char* iv, EVP_CIPHER_CTX* cipherCtx, HMAC_CTX* hmacCtx,
+    int encrypt);
+
+  // The salt of this thread's tickets, redrawn once per interval
+  const unsigned char* getEpochSalt();
 
-  typedef std::vector<std::unique_ptr<TLSTicketSeed>> TLSTicketSeedList;
-  typedef std::map<std::string, std::unique_ptr<TLSTicketKeySource> >
-    TLSTicketKeyMap;
-  typedef std::vector<TLSTicketKeySource *> TLSActiveKeyList;
+  KeyCache& getKeyCache();
 
-  TLSTicketSeedList ticketSeeds_;
-  // All key sources that can be used for decryption
-  TLSTicketKeyMap ticketKeys_;
-  // Key sources that can be used for encryption
-  TLSActiveKeyList activeKeys_;
+  // Read and replaced with std::atomic_load and std::atomic_store only
+  std::shared_ptr<const TLSTicketKeySet> keySet_;
 
   folly::SSLContext* ctx_;
   SSLStats* stats_{nullptr};
+  std::chrono::seconds saltRotationInterval_{0};
+  folly::ThreadLocalPtr<KeyCache> keyCache_;
 
   static int32_t sExDataIndex_;
 };
@@ -0,0 +1,98 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gtest/gtest.h>
+#include <wangle/ssl/EarlyDataReplayCache.h>
+
+using namespace folly;
+
+namespace wangle {
+
+namespace {
+
+EarlyDataReplayCache::Options makeOptions(size_t capacity) {
+  EarlyDataReplayCache::Options options;
+  options.window = std::chrono::seconds(10);
+  options.capacity = capacity;
+  options.shards = 1;
+  return options;
+}
+
+}
+
+TEST(EarlyDataReplayCacheTest, RejectsReplay) {
+  EarlyDataReplayCache cache(makeOptions(100));
+  auto now = EarlyDataReplayCache::Clock::now();
+  EXPECT_TRUE(cache.checkAndInsert(StringPiece("ticket1"), now));
+  EXPECT_TRUE(cache.checkAndInsert(StringPiece("ticket2"), now));
+  EXPECT_FALSE(cache.checkAndInsert(StringPiece("ticket1"), now));
+  EXPECT_EQ(2, cache.size());
+  EXPECT_EQ(1, cache.getNumReplays());
+}
+
+TEST(EarlyDataReplayCacheTest, ForgetsAfterWindow) {
+  EarlyDataReplayCache cache(makeOptions(100));
+  auto now = EarlyDataReplayCache::Clock::now();
+  EXPECT_TRUE(cache.checkAndInsert(StringPiece("ticket1"), now));
+  EXPECT_FALSE(cache.checkAndInsert(
+    StringPiece("ticket1"), now + std::chrono::seconds(9)));
+  EXPECT_TRUE(cache.checkAndInsert(
+    StringPiece("ticket1"), now + std::chrono::seconds(10)));
+  EXPECT_EQ(1, cache.size());
+}
+
+TEST(EarlyDataReplayCacheTest, FullRejects) {
+  EarlyDataReplayCache cache(makeOptions(2));
+  auto now = EarlyDataReplayCache::Clock::now();
+  EXPECT_TRUE(cache.checkAndInsert(StringPiece("ticket1"), now));
+  EXPECT_TRUE(cache.checkAndInsert(
+    StringPiece("ticket2"), now + std::chrono::seconds(5)));
+  // Forgetting ticket1 to make room would let it be replayed
+  EXPECT_FALSE(cache.checkAndInsert(
+    StringPiece("ticket3"), now + std::chrono::seconds(5)));
+  EXPECT_EQ(1, cache.getNumRejectedFull());
+  EXPECT_FALSE(cache.checkAndInsert(
+    StringPiece("ticket1"), now + std::chrono::seconds(5)));
+  // Room again once ticket1 is past the window
+  EXPECT_TRUE(cache.checkAndInsert(
+    StringPiece("ticket3"), now + std::chrono::seconds(10)));
+  EXPECT_EQ(2, cache.size());
+}
+
+TEST(EarlyDataReplayCacheTest, WindowFromTicketLifetime) {
+  auto options = makeOptions(100);
+  options.window = std::chrono::seconds(0);
+  EarlyDataReplayCache cache(options);
+  auto now = EarlyDataReplayCache::Clock::now();
+  // Without a ticket lifetime to cover, nothing is accepted
+  EXPECT_FALSE(cache.checkAndInsert(StringPiece("ticket1"), now));
+  EXPECT_EQ(0, cache.size());
+
+  cache.coverTicketLifetime(std::chrono::seconds(20));
+  EXPECT_EQ(std::chrono::seconds(20), cache.getWindow());
+  // Not shortened by a shorter lifetime
+  cache.coverTicketLifetime(std::chrono::seconds(5));
+  EXPECT_EQ(std::chrono::seconds(20), cache.getWindow());
+
+  EXPECT_TRUE(cache.checkAndInsert(StringPiece("ticket1"), now));
+  EXPECT_FALSE(cache.checkAndInsert(
+    StringPiece("ticket1"), now + std::chrono::seconds(19)));
+  EXPECT_TRUE(cache.checkAndInsert(
+    StringPiece("ticket1"), now + std::chrono::seconds(20)));
+}
+
+TEST(EarlyDataReplayCacheTest, WindowAtLeastOptions) {
+  EarlyDataReplayCache cache(makeOptions(100));
+  cache.coverTicketLifetime(std::chrono::seconds(5));
+  EXPECT_EQ(std::chrono::seconds(10), cache.getWindow());
+  cache.coverTicketLifetime(std::chrono::seconds(30));
+  EXPECT_EQ(std::chrono::seconds(30), cache.getWindow());
+}
+
+}
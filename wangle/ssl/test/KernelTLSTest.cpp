@@ -0,0 +1,207 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/String.h>
+#include <folly/io/async/EventBase.h>
+#include <folly/io/async/SSLContext.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <wangle/ssl/KernelTLS.h>
+
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace folly;
+
+namespace wangle {
+
+namespace {
+
+std::string testCertPath(const std::string& name) {
+  const std::string file = __FILE__;
+  return file.substr(0, file.rfind('/') + 1) + "certs/" + name;
+}
+
+std::string toHex(const unsigned char* data, size_t len) {
+  return hexlify(std::string(reinterpret_cast<const char*>(data), len));
+}
+
+class HandshakeCallback : public AsyncSSLSocket::HandshakeCB {
+ public:
+  void handshakeSuc(AsyncSSLSocket*) noexcept override {
+    done = true;
+  }
+
+  void handshakeErr(AsyncSSLSocket*,
+                    const AsyncSocketException& ex) noexcept override {
+    LOG(ERROR) << "Handshake failed: " << ex.what();
+    done = true;
+    failed = true;
+  }
+
+  bool done{false};
+  bool failed{false};
+};
+
+class StringReadCallback : public AsyncTransportWrapper::ReadCallback {
+ public:
+  void getReadBuffer(void** buf, size_t* len) override {
+    *buf = buf_;
+    *len = sizeof(buf_);
+  }
+
+  void readDataAvailable(size_t len) noexcept override {
+    data.append(buf_, len);
+  }
+
+  void readEOF() noexcept override {}
+
+  void readErr(const AsyncSocketException& ex) noexcept override {
+    LOG(ERROR) << "Read failed: " << ex.what();
+    failed = true;
+  }
+
+  std::string data;
+  bool failed{false};
+
+ private:
+  char buf_[1024];
+};
+
+// Runs evb until done, for up to 5 seconds
+bool loopUntil(EventBase& evb, const std::function<bool()>& done) {
+  for (int i = 0; i < 5000 && !done(); i++) {
+    evb.loopOnce(EVLOOP_NONBLOCK);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return done();
+}
+
+// A connected pair of TCP sockets on the loopback
+void tcpPair(int fds[2]) {
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_GE(listener, 0);
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  ASSERT_EQ(0, bind(listener, reinterpret_cast<sockaddr*>(&addr), len));
+  ASSERT_EQ(0, listen(listener, 1));
+  ASSERT_EQ(0, getsockname(listener, reinterpret_cast<sockaddr*>(&addr),
+                           &len));
+  fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+  ASSERT_EQ(0, connect(fds[0], reinterpret_cast<sockaddr*>(&addr), len));
+  fds[1] = accept(listener, nullptr, nullptr);
+  ASSERT_GE(fds[1], 0);
+  close(listener);
+}
+
+}
+
+// The TLS 1.2 PRF with SHA-256 test vector of the IETF TLS working group
+TEST(KernelTLSTest, PRFKnownVector) {
+  auto secret = unhexlify("9bbe436ba940f017b17652849a71db35");
+  auto seed = "test label" + unhexlify("a0ba9f936cda311827a6f796ffd5198c");
+  unsigned char out[100];
+  detail::tls12PRF(reinterpret_cast<const unsigned char*>(secret.data()),
+                   secret.size(), seed, out, sizeof(out));
+  EXPECT_EQ(
+    "e3f229ba727be17b8d122620557cd453c2aab21d07c3d495329b52d4e61edb5a"
+    "6b301791e90d35c9c9a46b4e14baf9af0fa022f7077def17abfd3797c0564bab"
+    "4fbc91666e9def9b97fce34f796789baa48082d122ee42c5a72e5a5110fff701"
+    "87347b66",
+    toHex(out, sizeof(out)));
+}
+
+// The key block is expanded from server_random then client_random, and
+// split client key, server key, client IV, server IV
+TEST(KernelTLSTest, KeyBlockKnownVector) {
+  std::string master(48, '\x0b');
+  std::string clientRandom(32, '\xc1');
+  std::string serverRandom(32, '\x5e');
+  detail::TLS12GCMKeys keys;
+  detail::deriveTLS12GCMKeys(
+    reinterpret_cast<const unsigned char*>(master.data()), master.size(),
+    reinterpret_cast<const unsigned char*>(clientRandom.data()),
+    reinterpret_cast<const unsigned char*>(serverRandom.data()),
+    clientRandom.size(), keys);
+  EXPECT_EQ("ec1972d528ed2eba8e5ba68f3d29db3b",
+            toHex(keys.clientKey, sizeof(keys.clientKey)));
+  EXPECT_EQ("316df042e42f6c95f9406d3bca2a5241",
+            toHex(keys.serverKey, sizeof(keys.serverKey)));
+  EXPECT_EQ("e36b2e37", toHex(keys.clientSalt, sizeof(keys.clientSalt)));
+  EXPECT_EQ("f7630ea9", toHex(keys.serverSalt, sizeof(keys.serverSalt)));
+}
+
+TEST(KernelTLSTest, Loopback) {
+  if (!KernelTLS::isSupported()) {
+    LOG(INFO) << "Kernel TLS not supported by this build, skipping";
+    return;
+  }
+  auto serverCtx = std::make_shared<SSLContext>();
+  serverCtx->loadCertificate(testCertPath("test.cert.pem").c_str());
+  serverCtx->loadPrivateKey(testCertPath("test.key.pem").c_str());
+  serverCtx->ciphers("AES128-GCM-SHA256");
+  auto clientCtx = std::make_shared<SSLContext>();
+  clientCtx->ciphers("AES128-GCM-SHA256");
+
+  EventBase evb;
+  int fds[2];
+  tcpPair(fds);
+  auto client = AsyncSSLSocket::newSocket(clientCtx, &evb, fds[0], false);
+  AsyncSSLSocket::UniquePtr server(
+    new AsyncSSLSocket(serverCtx, &evb, fds[1], true));
+  HandshakeCallback clientHandshake;
+  HandshakeCallback serverHandshake;
+  client->sslConn(&clientHandshake);
+  server->sslAccept(&serverHandshake);
+  ASSERT_TRUE(loopUntil(evb, [&] {
+    return clientHandshake.done && serverHandshake.done;
+  }));
+  ASSERT_FALSE(clientHandshake.failed || serverHandshake.failed);
+
+  auto plain = KernelTLS::offload(server);
+  if (!plain) {
+    LOG(INFO) << "Kernel TLS not available, e.g. without the tls module, "
+              << "skipping";
+    return;
+  }
+  EXPECT_FALSE(server);
+
+  // Decrypted by the kernel
+  StringReadCallback plainRead;
+  plain->setReadCB(&plainRead);
+  client->write(nullptr, "hello", 5);
+  EXPECT_TRUE(loopUntil(evb, [&] {
+    return plainRead.data.size() >= 5 || plainRead.failed;
+  }));
+  EXPECT_EQ("hello", plainRead.data);
+
+  // Encrypted by the kernel, in sequence with the handshake's records
+  StringReadCallback clientRead;
+  client->setReadCB(&clientRead);
+  plain->write(nullptr, "world", 5);
+  EXPECT_TRUE(loopUntil(evb, [&] {
+    return clientRead.data.size() >= 5 || clientRead.failed;
+  }));
+  EXPECT_EQ("world", clientRead.data);
+
+  client->setReadCB(nullptr);
+  plain->setReadCB(nullptr);
+  client->closeNow();
+  plain->closeNow();
+}
+
+} // namespace wangle
@@ -0,0 +1,212 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/FileUtil.h>
+#include <folly/ScopeGuard.h>
+#include <folly/experimental/TestUtil.h>
+#include <folly/io/async/SSLContext.h>
+#include <gtest/gtest.h>
+#include <openssl/ocsp.h>
+#include <openssl/pem.h>
+#include <wangle/ssl/OCSPStapler.h>
+
+#include <chrono>
+#include <ctime>
+#include <unistd.h>
+
+using namespace folly;
+
+namespace wangle {
+
+namespace {
+
+std::string testCertPath(const std::string& name) {
+  const std::string file = __FILE__;
+  return file.substr(0, file.rfind('/') + 1) + "certs/" + name;
+}
+
+X509* readCert() {
+  BIO* bio = BIO_new_file(testCertPath("test.cert.pem").c_str(), "r");
+  CHECK(bio);
+  SCOPE_EXIT { BIO_free(bio); };
+  return PEM_read_bio_X509(bio, nullptr, nullptr, nullptr);
+}
+
+EVP_PKEY* readKey() {
+  BIO* bio = BIO_new_file(testCertPath("test.key.pem").c_str(), "r");
+  CHECK(bio);
+  SCOPE_EXIT { BIO_free(bio); };
+  return PEM_read_bio_PrivateKey(bio, nullptr, nullptr, nullptr);
+}
+
+// A good status for the self signed test cert, signed with its key, valid
+// until nextUpdate seconds from now, or not saying if 0
+std::string makeResponse(long nextUpdate) {
+  X509* cert = readCert();
+  EVP_PKEY* key = readKey();
+  CHECK(cert && key);
+  SCOPE_EXIT {
+    X509_free(cert);
+    EVP_PKEY_free(key);
+  };
+
+  OCSP_BASICRESP* basic = OCSP_BASICRESP_new();
+  SCOPE_EXIT { OCSP_BASICRESP_free(basic); };
+  OCSP_CERTID* id = OCSP_cert_to_id(EVP_sha1(), cert, cert);
+  SCOPE_EXIT { OCSP_CERTID_free(id); };
+  auto now = time(nullptr);
+  ASN1_TIME* thisUpd = ASN1_GENERALIZEDTIME_set(nullptr, now);
+  ASN1_TIME* nextUpd = nextUpdate ?
+    ASN1_GENERALIZEDTIME_set(nullptr, now + nextUpdate) : nullptr;
+  SCOPE_EXIT {
+    ASN1_TIME_free(thisUpd);
+    if (nextUpd) {
+      ASN1_TIME_free(nextUpd);
+    }
+  };
+  CHECK(OCSP_basic_add1_status(
+    basic, id, V_OCSP_CERTSTATUS_GOOD, 0, nullptr, thisUpd, nextUpd));
+  CHECK(OCSP_basic_sign(basic, cert, key, EVP_sha256(), nullptr, 0));
+
+  OCSP_RESPONSE* resp =
+    OCSP_response_create(OCSP_RESPONSE_STATUS_SUCCESSFUL, basic);
+  CHECK(resp);
+  SCOPE_EXIT { OCSP_RESPONSE_free(resp); };
+  std::string der(i2d_OCSP_RESPONSE(resp, nullptr), '\0');
+  auto p = reinterpret_cast<unsigned char*>(&der[0]);
+  i2d_OCSP_RESPONSE(resp, &p);
+  return der;
+}
+
+}
+
+class OCSPStaplerTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    ctx_.loadCertificate(testCertPath("test.cert.pem").c_str());
+    ctx_.loadPrivateKey(testCertPath("test.key.pem").c_str());
+    ssl_ = SSL_new(ctx_.getSSLCtx());
+    ASSERT_NE(nullptr, ssl_);
+    cert_ = SSL_get_certificate(ssl_);
+    ASSERT_NE(nullptr, cert_);
+  }
+
+  void TearDown() override {
+    SSL_free(ssl_);
+  }
+
+  std::string file() const {
+    return tmpdir_.path().string() + "/ocsp";
+  }
+
+  void writeResponse(const std::string& der) {
+    ASSERT_TRUE(folly::writeFile(der, file().c_str()));
+  }
+
+  // What the status callback staples to a handshake of ssl_
+  std::string stapled() {
+    auto ctx = ctx_.getSSLCtx();
+    auto ret = ctx->tlsext_status_cb(ssl_, ctx->tlsext_status_arg);
+    if (ret != SSL_TLSEXT_ERR_OK) {
+      return "";
+    }
+    unsigned char* der = nullptr;
+    long len = SSL_get_tlsext_status_ocsp_resp(ssl_, &der);
+    return std::string(reinterpret_cast<char*>(der), len);
+  }
+
+  folly::SSLContext ctx_;
+  SSL* ssl_{nullptr};
+  X509* cert_{nullptr};
+  folly::test::TemporaryDirectory tmpdir_{"wangle-ocsp-stapler-test"};
+};
+
+TEST_F(OCSPStaplerTest, StapledInStatusCallback) {
+  auto der = makeResponse(3600);
+  writeResponse(der);
+  auto stapler = OCSPStapler::install(ctx_.getSSLCtx(),
+                                      std::chrono::seconds(3600));
+  EXPECT_EQ("", stapled());
+
+  stapler->addCertificate(cert_, file());
+  EXPECT_EQ(der, stapler->getResponse(cert_));
+  EXPECT_EQ(der, stapled());
+}
+
+TEST_F(OCSPStaplerTest, RejectsUnparsable) {
+  writeResponse("not a response");
+  auto stapler = OCSPStapler::install(ctx_.getSSLCtx(),
+                                      std::chrono::seconds(3600));
+  EXPECT_THROW(stapler->addCertificate(cert_, file()), std::runtime_error);
+  EXPECT_EQ("", stapler->getResponse(cert_));
+}
+
+TEST_F(OCSPStaplerTest, FailedRefreshKeepsResponse) {
+  auto first = makeResponse(3600);
+  writeResponse(first);
+  auto stapler = OCSPStapler::install(ctx_.getSSLCtx(),
+                                      std::chrono::seconds(3600));
+  stapler->addCertificate(cert_, file());
+
+  // Half written by the fetcher, or gone
+  writeResponse(first.substr(0, first.size() / 2));
+  stapler->refresh();
+  EXPECT_EQ(first, stapler->getResponse(cert_));
+  ASSERT_EQ(0, unlink(file().c_str()));
+  stapler->refresh();
+  EXPECT_EQ(first, stapled());
+
+  auto second = makeResponse(7200);
+  ASSERT_NE(first, second);
+  writeResponse(second);
+  stapler->refresh();
+  EXPECT_EQ(second, stapled());
+}
+
+TEST_F(OCSPStaplerTest, RefreshInterval) {
+  writeResponse(makeResponse(0));
+  auto stapler = OCSPStapler::install(ctx_.getSSLCtx(),
+                                      std::chrono::seconds(600));
+  stapler->addCertificate(cert_, file());
+  // Without a nextUpdate, every interval
+  auto next = stapler->nextRefresh() - OCSPStapler::Clock::now();
+  EXPECT_LE(next, std::chrono::seconds(600));
+  EXPECT_GT(next, std::chrono::seconds(590));
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+TEST_F(OCSPStaplerTest, RefreshBeforeNextUpdate) {
+  writeResponse(makeResponse(600));
+  auto stapler = OCSPStapler::install(ctx_.getSSLCtx(),
+                                      std::chrono::seconds(3600));
+  stapler->addCertificate(cert_, file());
+  // Half way to the nextUpdate, sooner than the interval
+  auto next = stapler->nextRefresh() - OCSPStapler::Clock::now();
+  EXPECT_LE(next, std::chrono::seconds(300));
+  EXPECT_GT(next, std::chrono::seconds(290));
+
+  // Never sooner than kMinRefreshInterval
+  writeResponse(makeResponse(30));
+  stapler->refresh();
+  next = stapler->nextRefresh() - OCSPStapler::Clock::now();
+  EXPECT_LE(next, OCSPStapler::kMinRefreshInterval);
+  EXPECT_GT(next, OCSPStapler::kMinRefreshInterval - std::chrono::seconds(10));
+}
+
+TEST_F(OCSPStaplerTest, ExpiredNotStapled) {
+  writeResponse(makeResponse(-60));
+  auto stapler = OCSPStapler::install(ctx_.getSSLCtx(),
+                                      std::chrono::seconds(3600));
+  stapler->addCertificate(cert_, file());
+  EXPECT_FALSE(stapler->getResponse(cert_).empty());
+  EXPECT_EQ("", stapled());
+}
+#endif
+
+} // namespace wangle
@@ -0,0 +1,106 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/io/async/EventBase.h>
+#include <gtest/gtest.h>
+#include <wangle/ssl/PrivateKeyOpBatcher.h>
+
+using namespace folly;
+
+namespace wangle {
+
+namespace {
+
+PrivateKeyOp makeOp(const std::string& input) {
+  PrivateKeyOp op;
+  op.keyId = "key";
+  op.input = input;
+  return op;
+}
+
+// Signs by reversing the input
+std::vector<std::string> sign(const std::vector<PrivateKeyOp>& ops) {
+  std::vector<std::string> results;
+  for (auto& op : ops) {
+    results.emplace_back(op.input.rbegin(), op.input.rend());
+  }
+  return results;
+}
+
+}
+
+TEST(PrivateKeyOpBatcherTest, Batch) {
+  EventBase evb;
+  std::vector<size_t> batches;
+  PrivateKeyOpBatcher batcher(&evb, [&](std::vector<PrivateKeyOp> ops) {
+    batches.push_back(ops.size());
+    return makeFuture(sign(ops));
+  });
+
+  auto f1 = batcher.add(makeOp("abc"));
+  auto f2 = batcher.add(makeOp("de"));
+  auto f3 = batcher.add(makeOp("f"));
+  EXPECT_FALSE(f1.isReady());
+  EXPECT_EQ("cba", f1.getVia(&evb));
+  EXPECT_EQ("ed", f2.getVia(&evb));
+  EXPECT_EQ("f", f3.getVia(&evb));
+  EXPECT_EQ(std::vector<size_t>({3}), batches);
+  EXPECT_EQ(1u, batcher.getNumBatches());
+  EXPECT_EQ(3u, batcher.getNumOps());
+}
+
+TEST(PrivateKeyOpBatcherTest, MaxBatchSize) {
+  EventBase evb;
+  std::vector<size_t> batches;
+  PrivateKeyOpBatcher::Options options;
+  options.window = std::chrono::milliseconds(1000);
+  options.maxBatchSize = 2;
+  PrivateKeyOpBatcher batcher(&evb, [&](std::vector<PrivateKeyOp> ops) {
+    batches.push_back(ops.size());
+    return makeFuture(sign(ops));
+  }, options);
+
+  auto f1 = batcher.add(makeOp("a"));
+  auto f2 = batcher.add(makeOp("b"));
+  // Sent without waiting for the window
+  EXPECT_EQ(std::vector<size_t>({2}), batches);
+  auto f3 = batcher.add(makeOp("c"));
+  batcher.flush();
+  EXPECT_EQ(std::vector<size_t>({2, 1}), batches);
+  EXPECT_EQ("c", f3.getVia(&evb));
+}
+
+TEST(PrivateKeyOpBatcherTest, Timeout) {
+  EventBase evb;
+  Promise<std::vector<std::string>> never;
+  PrivateKeyOpBatcher::Options options;
+  options.timeout = std::chrono::milliseconds(10);
+  PrivateKeyOpBatcher batcher(&evb, [&](std::vector<PrivateKeyOp>) {
+    return never.getFuture();
+  }, options);
+
+  auto f = batcher.add(makeOp("a"));
+  EXPECT_THROW(f.getVia(&evb), PrivateKeyOpTimeout);
+  EXPECT_EQ(1u, batcher.getNumTimeouts());
+  // A late result is dropped
+  never.setValue(std::vector<std::string>{"a"});
+  evb.loopOnce();
+}
+
+TEST(PrivateKeyOpBatcherTest, Failure) {
+  EventBase evb;
+  PrivateKeyOpBatcher batcher(&evb, [&](std::vector<PrivateKeyOp>) {
+    // Fewer results than operations
+    return makeFuture(std::vector<std::string>());
+  });
+  auto f = batcher.add(makeOp("a"));
+  EXPECT_THROW(f.getVia(&evb), std::runtime_error);
+}
+
+}
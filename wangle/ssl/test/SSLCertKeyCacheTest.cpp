@@ -0,0 +1,197 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/FileUtil.h>
+#include <folly/experimental/TestUtil.h>
+#include <folly/io/async/EventBase.h>
+#include <folly/io/async/SSLContext.h>
+#include <gtest/gtest.h>
+#include <wangle/acceptor/SSLContextSelectionMisc.h>
+#include <wangle/ssl/SSLCacheOptions.h>
+#include <wangle/ssl/SSLCertKeyCache.h>
+#include <wangle/ssl/SSLContextManager.h>
+
+#include <thread>
+
+using namespace folly;
+
+namespace wangle {
+
+namespace {
+
+std::string testCertPath(const std::string& name) {
+  const std::string file = __FILE__;
+  return file.substr(0, file.rfind('/') + 1) + "certs/" + name;
+}
+
+std::string readTestFile(const std::string& name) {
+  std::string data;
+  CHECK(folly::readFile(testCertPath(name).c_str(), data));
+  return data;
+}
+
+// What an SSL of ctx presents and signs with
+X509* certificateOf(SSL_CTX* ctx) {
+  SSL* ssl = SSL_new(ctx);
+  CHECK(ssl);
+  auto cert = SSL_get_certificate(ssl);
+  SSL_free(ssl);
+  return cert;
+}
+
+EVP_PKEY* privateKeyOf(SSL_CTX* ctx) {
+  SSL* ssl = SSL_new(ctx);
+  CHECK(ssl);
+  auto key = SSL_get_privatekey(ssl);
+  SSL_free(ssl);
+  return key;
+}
+
+}
+
+class SSLCertKeyCacheTest : public testing::Test {
+ protected:
+  // A copy of the test cert, for the tests to rewrite
+  std::string copyCert() {
+    auto path = tmpdir_.path().string() + "/test.cert.pem";
+    CHECK(folly::writeFile(readTestFile("test.cert.pem"), path.c_str()));
+    return path;
+  }
+
+  SSLCertKeyCache cache_;
+  folly::test::TemporaryDirectory tmpdir_{"wangle-cert-key-cache-test"};
+};
+
+TEST_F(SSLCertKeyCacheTest, ParsedOnce) {
+  auto cert = cache_.getCertificate(testCertPath("test.cert.pem"));
+  ASSERT_NE(nullptr, cert->cert);
+  EXPECT_EQ(cert, cache_.getCertificate(testCertPath("test.cert.pem")));
+  EXPECT_EQ(1, cache_.size());
+
+  auto key = cache_.getPrivateKey(testCertPath("test.key.pem"), "");
+  ASSERT_NE(nullptr, key->key);
+  EXPECT_EQ(key, cache_.getPrivateKey(testCertPath("test.key.pem"), ""));
+  EXPECT_EQ(2, cache_.size());
+
+  cache_.clear();
+  EXPECT_EQ(0, cache_.size());
+  EXPECT_NE(cert, cache_.getCertificate(testCertPath("test.cert.pem")));
+}
+
+TEST_F(SSLCertKeyCacheTest, ConcurrentGetsShareParse) {
+  auto path = testCertPath("test.cert.pem");
+  std::vector<std::shared_ptr<const SSLCertKeyCache::Certificate>> certs(8);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < certs.size(); i++) {
+    threads.emplace_back([&, i] { certs[i] = cache_.getCertificate(path); });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (const auto& cert : certs) {
+    EXPECT_EQ(certs[0], cert);
+  }
+  EXPECT_EQ(1, cache_.size());
+}
+
+TEST_F(SSLCertKeyCacheTest, FailureNotCached) {
+  auto path = tmpdir_.path().string() + "/missing.pem";
+  EXPECT_THROW(cache_.getCertificate(path), std::runtime_error);
+  EXPECT_EQ(0, cache_.size());
+  EXPECT_THROW(cache_.getPrivateKey(path, ""), std::runtime_error);
+  EXPECT_EQ(0, cache_.size());
+
+  ASSERT_TRUE(folly::writeFile(std::string("not a cert"), path.c_str()));
+  EXPECT_THROW(cache_.getCertificate(path), std::runtime_error);
+  EXPECT_EQ(0, cache_.size());
+
+  // Parsed once fixed
+  ASSERT_TRUE(folly::writeFile(readTestFile("test.cert.pem"), path.c_str()));
+  EXPECT_NE(nullptr, cache_.getCertificate(path)->cert);
+  EXPECT_EQ(1, cache_.size());
+}
+
+TEST_F(SSLCertKeyCacheTest, ChangedFileParsedAgain) {
+  auto path = copyCert();
+  auto first = cache_.getCertificate(path);
+  EXPECT_EQ(first, cache_.getCertificate(path));
+
+  // Renewed in place, here only the size differs
+  ASSERT_TRUE(folly::writeFile(readTestFile("test.cert.pem") + "\n",
+                               path.c_str()));
+  auto second = cache_.getCertificate(path);
+  EXPECT_NE(first, second);
+  EXPECT_EQ(second, cache_.getCertificate(path));
+  // Replacing the entry of the path
+  EXPECT_EQ(1, cache_.size());
+  // Still usable by the SSL_CTXs holding it
+  EXPECT_NE(nullptr, first->cert);
+}
+
+TEST_F(SSLCertKeyCacheTest, SharedBySSLContexts) {
+  auto cert = cache_.getCertificate(testCertPath("test.cert.pem"));
+  auto key = cache_.getPrivateKey(testCertPath("test.key.pem"), "");
+  SSLContext ctx1;
+  SSLContext ctx2;
+  for (auto ctx : {&ctx1, &ctx2}) {
+    SSLCertKeyCache::useCertificate(ctx->getSSLCtx(), *cert);
+    SSLCertKeyCache::usePrivateKey(ctx->getSSLCtx(), *key);
+  }
+  EXPECT_EQ(cert->cert, certificateOf(ctx1.getSSLCtx()));
+  EXPECT_EQ(cert->cert, certificateOf(ctx2.getSSLCtx()));
+  EXPECT_EQ(key->key, privateKeyOf(ctx1.getSSLCtx()));
+  EXPECT_EQ(key->key, privateKeyOf(ctx2.getSSLCtx()));
+
+  // The SSL_CTXs hold references of their own
+  cert.reset();
+  key.reset();
+  cache_.clear();
+  EXPECT_NE(nullptr, certificateOf(ctx1.getSSLCtx()));
+  EXPECT_NE(nullptr, privateKeyOf(ctx2.getSSLCtx()));
+}
+
+// As with a manager per IO thread
+TEST_F(SSLCertKeyCacheTest, SharedBySSLContextManagers) {
+  auto defaultCache = SSLCertKeyCache::getDefault();
+  if (!defaultCache) {
+    LOG(INFO) << "No default SSLCertKeyCache, skipping";
+    return;
+  }
+  defaultCache->clear();
+  SSLContextConfig ctxConfig;
+  ctxConfig.addCertificate(testCertPath("test.cert.pem"),
+                           testCertPath("test.key.pem"), "");
+  SSLCacheOptions cacheOptions;
+  SocketAddress addr;
+
+  EventBase evb1;
+  EventBase evb2;
+  SSLContextManager manager1(&evb1, "vip_cert_key_cache_test_", true,
+                             nullptr);
+  SSLContextManager manager2(&evb2, "vip_cert_key_cache_test_", true,
+                             nullptr);
+  manager1.addSSLContextConfig(ctxConfig, cacheOptions, nullptr, addr,
+                               nullptr);
+  manager2.addSSLContextConfig(ctxConfig, cacheOptions, nullptr, addr,
+                               nullptr);
+  EXPECT_EQ(2, defaultCache->size());
+
+  auto sslCtx1 = manager1.getSSLCtx(SSLContextKey("test.com"));
+  auto sslCtx2 = manager2.getSSLCtx(SSLContextKey("test.com"));
+  ASSERT_TRUE(sslCtx1 && sslCtx2);
+  auto ctx1 = sslCtx1->getSSLCtx();
+  auto ctx2 = sslCtx2->getSSLCtx();
+  ASSERT_NE(ctx1, ctx2);
+  EXPECT_EQ(certificateOf(ctx1), certificateOf(ctx2));
+  EXPECT_EQ(privateKeyOf(ctx1), privateKeyOf(ctx2));
+  EXPECT_EQ(defaultCache->getCertificate(testCertPath("test.cert.pem"))->cert,
+            certificateOf(ctx1));
+}
+
+} // namespace wangle
@@ -0,0 +1,61 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <folly/String.h>
+#include <gtest/gtest.h>
+#include <wangle/ssl/SSLClientHello.h>
+
+namespace wangle {
+
+namespace {
+
+std::string makeClientHello(const std::string& body) {
+  std::string message = folly::unhexlify(
+    "01"            // ClientHello
+    "0000" "00"     // length, unchecked
+    "0303" +        // TLS 1.2
+    std::string(64, '0') +
+    "00");          // no session id
+  return message + folly::unhexlify(body);
+}
+
+}
+
+TEST(SSLClientHelloTest, Fields) {
+  SSLClientHello hello(makeClientHello(
+    "0006" "c02f" "009c" "fafa"  // ciphers, the last unknown
+    "01" "00"                    // null compression
+    "0012"
+    "0000" "0000"                // server_name, empty
+    "000d" "000a" "0008"         // signature_algorithms
+    "0401" "0403" "0601" "0201"));
+  EXPECT_FALSE(hello.empty());
+  EXPECT_EQ("ECDHE-RSA-AES128-GCM-SHA256:AES128-GCM-SHA256:fafa",
+            hello.getCiphers());
+  EXPECT_EQ("c02f:009c:fafa", hello.getCiphersHex());
+  EXPECT_EQ("0", hello.getComprMethods());
+  EXPECT_EQ("0:13", hello.getExts());
+  EXPECT_EQ("4,1:4,3:6,1:2,1", hello.getSigAlgs());
+}
+
+TEST(SSLClientHelloTest, NoExtensions) {
+  SSLClientHello hello(makeClientHello("0002" "002f" "01" "00"));
+  EXPECT_EQ("002f", hello.getCiphersHex());
+  EXPECT_EQ("", hello.getExts());
+  EXPECT_EQ("", hello.getSigAlgs());
+}
+
+TEST(SSLClientHelloTest, Truncated) {
+  SSLClientHello hello(makeClientHello("0006" "c02f" "00"));
+  EXPECT_EQ("", hello.getCiphersHex());
+  EXPECT_EQ("", hello.getComprMethods());
+  EXPECT_TRUE(SSLClientHello().empty());
+}
+
+}
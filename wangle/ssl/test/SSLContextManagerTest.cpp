@@ -20,6 +20,13 @@ using namespace folly;
 
 namespace wangle {
 
+// The test certs, found next to this file rather than relative to where the
+// test runs from
+std::string testCertPath(const std::string& name) {
+  const std::string file = __FILE__;
+  return file.substr(0, file.rfind('/') + 1) + "certs/" + name;
+}
+
 TEST(SSLContextManagerTest, Test1)
 {
   EventBase eventBase;
@@ -111,6 +118,57 @@ TEST(SSLContextManagerTest, Test1)
 
 
 // TODO Opensource builds cannot the cert/key paths
+TEST(SSLContextManagerTest, TestGetSSLCtx)
+{
+  EventBase eventBase;
+  SSLContextManager sslCtxMgr(&eventBase, "vip_ssl_context_manager_test_",
+                              true, nullptr);
+  auto facebook_com_ctx = std::make_shared<SSLContext>();
+  auto start_facebook_com_ctx = std::make_shared<SSLContext>();
+  auto www_facebook_com_ctx = std::make_shared<SSLContext>();
+  auto a_b_facebook_com_ctx = std::make_shared<SSLContext>();
+
+  sslCtxMgr.insertSSLCtxByDomainName(
+    "facebook.com",
+    strlen("facebook.com"),
+    facebook_com_ctx);
+  sslCtxMgr.insertSSLCtxByDomainName(
+    "*.facebook.com",
+    strlen("*.facebook.com"),
+    start_facebook_com_ctx);
+  sslCtxMgr.insertSSLCtxByDomainName(
+    "WWW.Facebook.com",
+    strlen("WWW.Facebook.com"),
+    www_facebook_com_ctx);
+  sslCtxMgr.insertSSLCtxByDomainName(
+    "a.b.facebook.com",
+    strlen("a.b.facebook.com"),
+    a_b_facebook_com_ctx);
+
+  // exact matches are preferred over the wildcard, at every depth
+  EXPECT_EQ(sslCtxMgr.getSSLCtx(SSLContextKey("facebook.com")),
+            facebook_com_ctx);
+  EXPECT_EQ(sslCtxMgr.getSSLCtx(SSLContextKey("www.facebook.COM")),
+            www_facebook_com_ctx);
+  EXPECT_EQ(sslCtxMgr.getSSLCtx(SSLContextKey("a.b.facebook.com")),
+            a_b_facebook_com_ctx);
+  EXPECT_EQ(sslCtxMgr.getSSLCtx(SSLContextKey("xyz.facebook.com")),
+            start_facebook_com_ctx);
+  // "b.facebook.com" is only an inner node for "a.b.facebook.com"
+  EXPECT_EQ(sslCtxMgr.getSSLCtx(SSLContextKey("b.facebook.com")),
+            start_facebook_com_ctx);
+  EXPECT_EQ(sslCtxMgr.getSSLCtxByExactDomain(SSLContextKey(".facebook.com")),
+            start_facebook_com_ctx);
+
+  EXPECT_FALSE(sslCtxMgr.getSSLCtx(SSLContextKey("com")));
+  EXPECT_FALSE(sslCtxMgr.getSSLCtx(SSLContextKey("c.b.facebook.com")));
+  EXPECT_FALSE(sslCtxMgr.getSSLCtx(SSLContextKey("www.bookface.com")));
+  EXPECT_FALSE(sslCtxMgr.getSSLCtx(SSLContextKey("www.facebook.com",
+        CertCrypto::SHA1_SIGNATURE)));
+
+  eventBase.loop(); // Clean up events before SSLContextManager is destructed
+}
+
 TEST(SSLContextManagerTest, DISABLED_TestSessionContextIfSupplied)
 {
   EventBase eventBase;
@@ -169,4 +227,91 @@ TEST(SSLContextManagerTest, DISABLED_TestSessionContextIfSessionCacheAbsent)
   eventBase.loop();
 }
 
+TEST(SSLContextManagerTest, TestReloadOnlyChanged)
+{
+  EventBase eventBase;
+  SSLContextManager sslCtxMgr(&eventBase, "vip_ssl_context_manager_test_",
+                              true, nullptr);
+  SSLContextConfig ctxConfig;
+  ctxConfig.isDefault = true;
+  ctxConfig.addCertificate(
+      testCertPath("test.cert.pem"),
+      testCertPath("test.key.pem"),
+      "");
+
+  SSLCacheOptions cacheOptions;
+  SocketAddress addr;
+
+  sslCtxMgr.addSSLContextConfig(
+      ctxConfig, cacheOptions, nullptr, addr, nullptr);
+  auto ctx = sslCtxMgr.getDefaultSSLCtx();
+  ASSERT_NE(ctx, nullptr);
+
+  // Nothing changed: the same SSL_CTX is kept
+  sslCtxMgr.reloadSSLContextConfigs(
+      {ctxConfig}, cacheOptions, nullptr, addr, nullptr, &eventBase)
+    .getVia(&eventBase);
+  EXPECT_EQ(ctx, sslCtxMgr.getDefaultSSLCtx());
+  EXPECT_EQ(ctx, sslCtxMgr.getSSLCtx(SSLContextKey("test.com")));
+
+  // A connection still using the old SSL_CTX keeps it, and its managers
+  SSL* ssl = SSL_new(ctx->getSSLCtx());
+  ASSERT_NE(ssl, nullptr);
+  SSL_CTX* oldSSLCtx = ctx->getSSLCtx();
+  ctx.reset();
+
+  ctxConfig.sslCiphers = "AES128-GCM-SHA256";
+  sslCtxMgr.reloadSSLContextConfigs(
+      {ctxConfig}, cacheOptions, nullptr, addr, nullptr, &eventBase)
+    .getVia(&eventBase);
+  auto newCtx = sslCtxMgr.getDefaultSSLCtx();
+  ASSERT_NE(newCtx, nullptr);
+  EXPECT_NE(oldSSLCtx, newCtx->getSSLCtx());
+  EXPECT_EQ(oldSSLCtx, SSL_get_SSL_CTX(ssl));
+  // Frees the old SSL_CTX along with what its callbacks still used
+  SSL_free(ssl);
+  EXPECT_EQ(newCtx, sslCtxMgr.getSSLCtx(SSLContextKey("test.com")));
+
+  // A config failing to load leaves the current contexts in place
+  auto badConfig = ctxConfig;
+  badConfig.setCertificate("/no/such/cert.pem", "/no/such/key.pem", "");
+  EXPECT_THROW(
+    sslCtxMgr.reloadSSLContextConfigs(
+        {badConfig}, cacheOptions, nullptr, addr, nullptr, &eventBase)
+      .getVia(&eventBase),
+    std::runtime_error);
+  EXPECT_EQ(newCtx, sslCtxMgr.getDefaultSSLCtx());
+  eventBase.loop();
+}
+
+// TODO Opensource builds cannot find cert paths
+TEST(SSLContextManagerTest, TestLazyContext)
+{
+  EventBase eventBase;
+  SSLContextManager sslCtxMgr(&eventBase, "vip_ssl_context_manager_test_",
+                              true, nullptr);
+  SSLContextConfig ctxConfig;
+  ctxConfig.lazy = true;
+  ctxConfig.addCertificate(
+      testCertPath("test.cert.pem"),
+      testCertPath("test.key.pem"),
+      "");
+
+  SSLCacheOptions cacheOptions;
+  SocketAddress addr;
+
+  sslCtxMgr.addSSLContextConfig(
+      ctxConfig, cacheOptions, nullptr, addr, nullptr);
+  EXPECT_EQ(0, sslCtxMgr.getNumBuiltLazySSLContexts());
+  EXPECT_FALSE(sslCtxMgr.getSSLCtx(SSLContextKey("test.com")));
+  EXPECT_FALSE(sslCtxMgr.getLazySSLCtx(SSLContextKey("other.com")));
+
+  // Built on first use, then kept
+  auto ctx = sslCtxMgr.getLazySSLCtx(SSLContextKey("TEST.com"));
+  ASSERT_NE(ctx, nullptr);
+  EXPECT_EQ(1, sslCtxMgr.getNumBuiltLazySSLContexts());
+  EXPECT_EQ(ctx, sslCtxMgr.getLazySSLCtx(SSLContextKey("test.com")));
+  eventBase.loop();
+}
+
 } // namespace wangle
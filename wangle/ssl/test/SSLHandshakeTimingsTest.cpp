@@ -0,0 +1,51 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gtest/gtest.h>
+#include <thread>
+#include <wangle/ssl/SSLHandshakeTimings.h>
+
+using namespace folly;
+
+namespace wangle {
+
+typedef SSLHandshakeTimings::Stage Stage;
+
+TEST(SSLHandshakeTimingsTest, Mark) {
+  SSLHandshakeTimings timings(
+    SSLHandshakeTimings::Clock::now() - std::chrono::milliseconds(5));
+  EXPECT_FALSE(timings.reached(Stage::STARTED));
+  EXPECT_EQ(-1, timings.get(Stage::FINISHED).count());
+
+  timings.mark(Stage::STARTED);
+  EXPECT_TRUE(timings.reached(Stage::STARTED));
+  EXPECT_GE(timings.get(Stage::STARTED), std::chrono::milliseconds(5));
+  EXPECT_FALSE(timings.reached(Stage::CLIENT_HELLO));
+}
+
+TEST(SSLHandshakeTimingsTest, StartedStagesKeepFirstMark) {
+  SSLHandshakeTimings timings(SSLHandshakeTimings::Clock::now());
+  timings.mark(Stage::SESSION_LOOKUP_STARTED);
+  timings.mark(Stage::SESSION_LOOKUP_FINISHED);
+  auto started = timings.get(Stage::SESSION_LOOKUP_STARTED);
+  auto finished = timings.get(Stage::SESSION_LOOKUP_FINISHED);
+  /* sleep override */
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  timings.mark(Stage::SESSION_LOOKUP_STARTED);
+  timings.mark(Stage::SESSION_LOOKUP_FINISHED);
+  EXPECT_EQ(started, timings.get(Stage::SESSION_LOOKUP_STARTED));
+  EXPECT_GT(timings.get(Stage::SESSION_LOOKUP_FINISHED), finished);
+}
+
+TEST(SSLHandshakeTimingsTest, UntimedSocket) {
+  // Nothing attached on this thread: no lookup of the SSL's socket
+  SSLHandshakeTimings::mark(nullptr, Stage::CLIENT_HELLO);
+}
+
+}
@@ -0,0 +1,370 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <wangle/ssl/SSLSessionCacheManager.h>
+
+#include <folly/FileUtil.h>
+#include <folly/Memory.h>
+#include <folly/SpookyHashV2.h>
+#include <folly/experimental/TestUtil.h>
+#include <folly/io/async/EventBase.h>
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <thread>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace wangle {
+
+namespace {
+
+// A session that serializes, made to live for timeout seconds from
+// created
+SSL_SESSION* makeSession(const std::string& id, long timeout,
+                         time_t created = time(nullptr)) {
+  auto session = SSL_SESSION_new();
+  session->ssl_version = TLS1_2_VERSION;
+  // TLS_RSA_WITH_AES_128_GCM_SHA256
+  session->cipher_id = 0x0300009C;
+  session->master_key_length = 48;
+  memset(session->master_key, 'k', session->master_key_length);
+  session->session_id_length = id.size();
+  memcpy(session->session_id, id.data(), id.size());
+  SSL_SESSION_set_time(session, created);
+  SSL_SESSION_set_timeout(session, timeout);
+  return session;
+}
+
+std::vector<std::string> sessionIds(ShardedLocalSSLSessionCache& cache) {
+  std::vector<std::string> ids;
+  cache.forEachSession([&](const std::string& id, SSL_SESSION*) {
+    ids.push_back(id);
+  });
+  return ids;
+}
+
+// Records the lookups it's asked for, without ever answering them
+class RecordingCacheProvider : public SSLCacheProvider {
+ public:
+  bool setAsync(const std::string&, const std::string&,
+                std::chrono::seconds) override {
+    return true;
+  }
+
+  bool getAsync(const std::string& sessionId,
+                CacheContext* context) override {
+    gets.push_back(sessionId);
+    delete context;
+    return true;
+  }
+
+  std::vector<CacheContext*> getAsyncBatch(
+      const std::vector<CacheContext*>& contexts) override {
+    batches.push_back(contexts.size());
+    for (auto context : contexts) {
+      delete context;
+    }
+    return {};
+  }
+
+  std::vector<std::string> gets;
+  std::vector<size_t> batches;
+};
+
+class TestSessionCacheManager : public SSLSessionCacheManager {
+ public:
+  using SSLSessionCacheManager::SSLSessionCacheManager;
+  using SSLSessionCacheManager::ExternalLookup;
+  using SSLSessionCacheManager::pendingLookups_;
+  using SSLSessionCacheManager::lookupCacheRecord;
+  using SSLSessionCacheManager::startExternalLookup;
+  using SSLSessionCacheManager::finishExternalLookup;
+  using SSLSessionCacheManager::lookupLocalSession;
+  using SSLSessionCacheManager::storeLocalSession;
+};
+
+// Whether the manager has the session, dropping the reference it returns
+bool hasSession(TestSessionCacheManager& manager, const std::string& id) {
+  auto session = manager.lookupLocalSession(id);
+  if (!session) {
+    return false;
+  }
+  SSL_SESSION_free(session);
+  return true;
+}
+
+SSLCacheOptions cacheOptions() {
+  return SSLCacheOptions{std::chrono::seconds(60), 20480, 200, 0, 0, 0,
+                         std::chrono::milliseconds(0), ""};
+}
+
+}
+
+class SSLSessionSnapshotTest : public testing::Test {
+ protected:
+  std::string file() const {
+    return tmpdir_.path().string() + "/sessions";
+  }
+
+  folly::test::TemporaryDirectory tmpdir_{"wangle-ssl-snapshot-test"};
+};
+
+TEST_F(SSLSessionSnapshotTest, RoundTrip) {
+  ShardedLocalSSLSessionCache cache(1, 10, 1);
+  cache.storeSession("a", makeSession("a", 3600), nullptr);
+  cache.storeSession("b", makeSession("b", 3600), nullptr);
+  EXPECT_EQ(2, SSLSessionCacheManager::saveSessions(cache, file()));
+
+  ShardedLocalSSLSessionCache loaded(1, 10, 1);
+  EXPECT_EQ(2, SSLSessionCacheManager::loadSessions(loaded, file()));
+  auto session = loaded.lookupSession("a");
+  ASSERT_NE(nullptr, session);
+  EXPECT_EQ(48, session->master_key_length);
+  EXPECT_EQ(0, memcmp(session->master_key, std::string(48, 'k').data(), 48));
+  SSL_SESSION_free(session);
+  session = loaded.lookupSession("b");
+  ASSERT_NE(nullptr, session);
+  SSL_SESSION_free(session);
+}
+
+TEST_F(SSLSessionSnapshotTest, SkipsExpired) {
+  ShardedLocalSSLSessionCache cache(1, 10, 1);
+  const auto now = time(nullptr);
+  cache.storeSession("expired", makeSession("expired", 10, now - 100),
+                     nullptr);
+  // Still valid when saved, expired by the time it's loaded
+  cache.storeSession("expiring", makeSession("expiring", 101, now - 100),
+                     nullptr);
+  cache.storeSession("valid", makeSession("valid", 3600), nullptr);
+  EXPECT_EQ(2, SSLSessionCacheManager::saveSessions(cache, file()));
+
+  ShardedLocalSSLSessionCache loaded(1, 10, 1);
+  sleep(2);
+  EXPECT_EQ(1, SSLSessionCacheManager::loadSessions(loaded, file()));
+  EXPECT_EQ(std::vector<std::string>({"valid"}), sessionIds(loaded));
+}
+
+TEST_F(SSLSessionSnapshotTest, KeepsLRUOrder) {
+  ShardedLocalSSLSessionCache cache(1, 10, 1);
+  for (auto id : {"a", "b", "c"}) {
+    cache.storeSession(id, makeSession(id, 3600), nullptr);
+  }
+  // Now the most recently used
+  SSL_SESSION_free(cache.lookupSession("a"));
+  const std::vector<std::string> order({"b", "c", "a"});
+  EXPECT_EQ(order, sessionIds(cache));
+  EXPECT_EQ(3, SSLSessionCacheManager::saveSessions(cache, file()));
+
+  ShardedLocalSSLSessionCache loaded(1, 10, 1);
+  EXPECT_EQ(3, SSLSessionCacheManager::loadSessions(loaded, file()));
+  EXPECT_EQ(order, sessionIds(loaded));
+
+  // A smaller cache keeps the most recently used
+  ShardedLocalSSLSessionCache small(1, 2, 1);
+  SSLSessionCacheManager::loadSessions(small, file());
+  EXPECT_EQ(std::vector<std::string>({"c", "a"}), sessionIds(small));
+}
+
+TEST_F(SSLSessionSnapshotTest, OwnerOnly) {
+  // Whatever was there before doesn't lend the file its permissions
+  ASSERT_TRUE(folly::writeFile(std::string("old"), file().c_str()));
+  ASSERT_EQ(0, chmod(file().c_str(), 0644));
+
+  ShardedLocalSSLSessionCache cache(1, 10, 1);
+  cache.storeSession("a", makeSession("a", 3600), nullptr);
+  EXPECT_EQ(1, SSLSessionCacheManager::saveSessions(cache, file()));
+  struct stat st;
+  ASSERT_EQ(0, stat(file().c_str(), &st));
+  EXPECT_EQ(0600, st.st_mode & 0777);
+  EXPECT_EQ(getuid(), st.st_uid);
+}
+
+class SSLSessionCacheManagerTest : public testing::Test {
+ protected:
+  void TearDown() override {
+    // Fresh shared cache and external lookups, with their options, for the
+    // next test
+    SSLSessionCacheManager::shutdown();
+  }
+
+  std::unique_ptr<TestSessionCacheManager> makeManager(
+      folly::EventBase* evb,
+      const SSLCacheOptions& options = cacheOptions()) {
+    auto ctx = std::make_shared<folly::SSLContext>();
+    contexts_.push_back(ctx);
+    return folly::make_unique<TestSessionCacheManager>(
+      options, ctx.get(), folly::SocketAddress("127.0.0.1", 443), "test",
+      evb, nullptr, provider_);
+  }
+
+  std::shared_ptr<folly::AsyncSSLSocket> makeSocket(folly::EventBase* evb) {
+    return folly::AsyncSSLSocket::newSocket(contexts_.front(), evb);
+  }
+
+  std::vector<std::shared_ptr<folly::SSLContext>> contexts_;
+  std::shared_ptr<RecordingCacheProvider> provider_{
+    std::make_shared<RecordingCacheProvider>()};
+};
+
+TEST_F(SSLSessionCacheManagerTest, ConcurrentMissesShareLookup) {
+  using Lookup = TestSessionCacheManager::ExternalLookup;
+  folly::EventBase evbA;
+  folly::EventBase evbB;
+  auto a = makeManager(&evbA);
+  auto b = makeManager(&evbB);
+
+  EXPECT_EQ(Lookup::STARTED, a->startExternalLookup("id"));
+  EXPECT_EQ(Lookup::COALESCED, b->startExternalLookup("id"));
+  // As getSession() leaves it when coalesced
+  b->pendingLookups_["id"].coalesced = true;
+
+  auto session = makeSession("id", 3600);
+  a->finishExternalLookup("id", session, true);
+  // Told in its own thread
+  EXPECT_EQ(1, b->pendingLookups_.size());
+  evbB.loopOnce();
+  EXPECT_TRUE(b->pendingLookups_.empty());
+  SSL_SESSION_free(session);
+
+  // Done with, so the next miss is looked up again
+  EXPECT_EQ(Lookup::STARTED, b->startExternalLookup("id"));
+  b->finishExternalLookup("id", nullptr, false);
+}
+
+TEST_F(SSLSessionCacheManagerTest, WithoutEventBaseNotCoalesced) {
+  using Lookup = TestSessionCacheManager::ExternalLookup;
+  folly::EventBase evb;
+  auto a = makeManager(&evb);
+  auto b = makeManager(nullptr);
+
+  EXPECT_EQ(Lookup::STARTED, a->startExternalLookup("id"));
+  EXPECT_EQ(Lookup::STARTED, b->startExternalLookup("id"));
+  a->finishExternalLookup("id", nullptr, false);
+}
+
+TEST_F(SSLSessionCacheManagerTest, BatchFlushedBySizeAndLoop) {
+  auto options = cacheOptions();
+  options.sslExternalBatchSize = 2;
+  folly::EventBase evb;
+  auto manager = makeManager(&evb, options);
+  auto socket = makeSocket(&evb);
+
+  for (auto id : {"a", "b", "c"}) {
+    EXPECT_TRUE(manager->lookupCacheRecord(id, socket.get()));
+  }
+  // Held until the end of the loop iteration
+  EXPECT_TRUE(provider_->batches.empty());
+  evb.loopOnce();
+  EXPECT_EQ(std::vector<size_t>({2, 1}), provider_->batches);
+  EXPECT_TRUE(provider_->gets.empty());
+
+  EXPECT_TRUE(manager->lookupCacheRecord("d", socket.get()));
+  evb.loopOnce();
+  EXPECT_EQ(std::vector<size_t>({2, 1, 1}), provider_->batches);
+}
+
+TEST_F(SSLSessionCacheManagerTest, UnbatchedLookupSentAtOnce) {
+  folly::EventBase evb;
+  auto manager = makeManager(&evb);
+  auto socket = makeSocket(&evb);
+
+  EXPECT_TRUE(manager->lookupCacheRecord("a", socket.get()));
+  EXPECT_EQ(std::vector<std::string>({"a"}), provider_->gets);
+  EXPECT_TRUE(provider_->batches.empty());
+}
+
+TEST_F(SSLSessionCacheManagerTest, MissExpires) {
+  using Lookup = TestSessionCacheManager::ExternalLookup;
+  auto options = cacheOptions();
+  options.sslExternalMissTTL = std::chrono::milliseconds(50);
+  folly::EventBase evb;
+  auto manager = makeManager(&evb, options);
+
+  EXPECT_EQ(Lookup::STARTED, manager->startExternalLookup("id"));
+  manager->finishExternalLookup("id", nullptr, true);
+  EXPECT_EQ(Lookup::KNOWN_MISS, manager->startExternalLookup("id"));
+  // Not remembered when the lookup failed rather than missed
+  EXPECT_EQ(Lookup::STARTED, manager->startExternalLookup("other"));
+  manager->finishExternalLookup("other", nullptr, false);
+  EXPECT_EQ(Lookup::STARTED, manager->startExternalLookup("other"));
+  manager->finishExternalLookup("other", nullptr, false);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(60));
+  EXPECT_EQ(Lookup::STARTED, manager->startExternalLookup("id"));
+  manager->finishExternalLookup("id", nullptr, false);
+}
+
+TEST_F(SSLSessionCacheManagerTest, ThreadCacheInFrontOfShared) {
+  // A shared cache of just one session
+  auto options = cacheOptions();
+  options.maxSSLCacheSize = 1;
+  options.sslCacheFlushSize = 1;
+  options.sslCacheShards = 1;
+  options.sslThreadCacheSize = 4;
+  folly::EventBase evbA;
+  folly::EventBase evbB;
+  auto a = makeManager(&evbA, options);
+  options.sslThreadCacheSize = 0;
+  auto b = makeManager(&evbB, options);
+
+  a->storeLocalSession("a", makeSession("a", 3600));
+  a->storeLocalSession("b", makeSession("b", 3600));
+  // Evicted from the shared cache, still in the thread cache of a
+  EXPECT_TRUE(hasSession(*a, "a"));
+  EXPECT_FALSE(hasSession(*b, "a"));
+  EXPECT_TRUE(hasSession(*b, "b"));
+
+  // Found in the shared cache, then kept by the thread cache
+  b->storeLocalSession("c", makeSession("c", 3600));
+  EXPECT_TRUE(hasSession(*a, "c"));
+  b->storeLocalSession("d", makeSession("d", 3600));
+  EXPECT_FALSE(hasSession(*b, "c"));
+  EXPECT_TRUE(hasSession(*a, "c"));
+}
+
+TEST_F(SSLSessionCacheManagerTest, CacheShards) {
+  const std::vector<std::string> ids({"a", "b", "c", "d", "e", "f"});
+  for (uint32_t shards : {1, 3}) {
+    // The size is split across the shards, one session each with 3
+    auto options = cacheOptions();
+    options.maxSSLCacheSize = 3;
+    options.sslCacheFlushSize = 1;
+    options.sslCacheShards = shards;
+    folly::EventBase evb;
+    auto manager = makeManager(&evb, options);
+    for (const auto& id : ids) {
+      manager->storeLocalSession(id, makeSession(id, 3600));
+    }
+
+    // Each shard keeps its most recent
+    std::vector<std::string> expected;
+    std::vector<std::string> kept;
+    std::vector<size_t> counts(shards);
+    for (auto it = ids.rbegin(); it != ids.rend(); ++it) {
+      auto shard = folly::hash::SpookyHashV2::Hash64(
+        it->data(), it->size(), 0) % shards;
+      if (counts[shard]++ < 3 / shards) {
+        expected.push_back(*it);
+      }
+      if (hasSession(*manager, *it)) {
+        kept.push_back(*it);
+      }
+    }
+    EXPECT_EQ(expected, kept) << shards << " shards";
+    SSLSessionCacheManager::shutdown();
+  }
+}
+
+} // namespace wangle
@@ -0,0 +1,218 @@
+/*
+ *  Copyright (c) 2016, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+#include <gtest/gtest.h>
+#include <openssl/aes.h>
+#include <openssl/hmac.h>
+#include <wangle/ssl/TLSTicketKeyManager.h>
+
+#include <atomic>
+#include <thread>
+
+using namespace folly;
+
+namespace wangle {
+
+#ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
+namespace {
+
+const std::vector<std::string> kSeeds{"00112233445566778899aabbccddeeff"};
+const std::vector<std::string> kNextSeeds{
+  "ffeeddccbbaa99887766554433221100"};
+const size_t kKeyNameLength = 16;
+
+// The contexts OpenSSL hands the callback, for one ticket
+class TicketContexts {
+ public:
+  TicketContexts() : cipherCtx_(EVP_CIPHER_CTX_new()) {
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    hmacCtx_ = HMAC_CTX_new();
+#else
+    hmacCtx_ = new HMAC_CTX;
+    HMAC_CTX_init(hmacCtx_);
+#endif
+  }
+
+  ~TicketContexts() {
+    EVP_CIPHER_CTX_free(cipherCtx_);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    HMAC_CTX_free(hmacCtx_);
+#else
+    HMAC_CTX_cleanup(hmacCtx_);
+    delete hmacCtx_;
+#endif
+  }
+
+  int process(TLSTicketKeyManager& manager, unsigned char* keyName,
+              unsigned char* iv, int encrypt) {
+    return manager.unsafe().processTicket(
+      nullptr, keyName, iv, cipherCtx_, hmacCtx_, encrypt);
+  }
+
+  std::string crypt(const std::string& in) {
+    std::string out(in.size() + AES_BLOCK_SIZE, '\0');
+    auto outBuf = reinterpret_cast<unsigned char*>(&out[0]);
+    int len = 0;
+    int finalLen = 0;
+    EVP_CipherUpdate(cipherCtx_, outBuf, &len,
+                     reinterpret_cast<const unsigned char*>(in.data()),
+                     in.size());
+    EVP_CipherFinal_ex(cipherCtx_, outBuf + len, &finalLen);
+    out.resize(len + finalLen);
+    return out;
+  }
+
+  std::string mac(const std::string& in) {
+    unsigned char buf[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+    HMAC_Update(hmacCtx_, reinterpret_cast<const unsigned char*>(in.data()),
+                in.size());
+    HMAC_Final(hmacCtx_, buf, &len);
+    return std::string(reinterpret_cast<char*>(buf), len);
+  }
+
+ private:
+  EVP_CIPHER_CTX* cipherCtx_;
+  HMAC_CTX* hmacCtx_;
+};
+
+} // namespace
+
+TEST(TLSTicketKeyManagerTest, SaltRotation) {
+  SSLContext ctx;
+  TLSTicketKeyManager manager(&ctx, nullptr);
+  ASSERT_TRUE(manager.setTLSTicketKeySeeds({}, kSeeds, {}));
+  manager.setSaltRotationInterval(std::chrono::seconds(3600));
+
+  unsigned char keyName1[kKeyNameLength];
+  unsigned char keyName2[kKeyNameLength];
+  unsigned char iv1[AES_BLOCK_SIZE];
+  unsigned char iv2[AES_BLOCK_SIZE];
+  TicketContexts enc1;
+  TicketContexts enc2;
+  EXPECT_EQ(1, enc1.process(manager, keyName1, iv1, 1));
+  EXPECT_EQ(1, enc2.process(manager, keyName2, iv2, 1));
+  // Same key and salt, from the cache, but not the same iv
+  EXPECT_EQ(0, memcmp(keyName1, keyName2, kKeyNameLength));
+  EXPECT_NE(0, memcmp(iv1, iv2, AES_BLOCK_SIZE));
+  auto ticket1 = enc1.crypt("session one");
+  auto ticket2 = enc2.crypt("session two");
+  auto mac1 = enc1.mac(ticket1);
+
+  // Whether cached or derived once again, the keys are the same
+  TLSTicketKeyManager perTicket(&ctx, nullptr);
+  ASSERT_TRUE(perTicket.setTLSTicketKeySeeds({}, kSeeds, {}));
+  TicketContexts dec1;
+  TicketContexts dec2;
+  EXPECT_EQ(1, dec1.process(perTicket, keyName1, iv1, 0));
+  EXPECT_EQ(1, dec2.process(manager, keyName2, iv2, 0));
+  EXPECT_EQ(mac1, dec1.mac(ticket1));
+  EXPECT_EQ("session one", dec1.crypt(ticket1));
+  EXPECT_EQ("session two", dec2.crypt(ticket2));
+
+  // Caching or not, new seeds replace the keys
+  ASSERT_TRUE(manager.setTLSTicketKeySeeds({}, kNextSeeds, {}));
+  TicketContexts dec3;
+  EXPECT_EQ(0, dec3.process(manager, keyName1, iv1, 0));
+}
+
+TEST(TLSTicketKeyManagerTest, SaltPerTicket) {
+  SSLContext ctx;
+  TLSTicketKeyManager manager(&ctx, nullptr);
+  ASSERT_TRUE(manager.setTLSTicketKeySeeds({}, kSeeds, {}));
+
+  unsigned char keyName1[kKeyNameLength];
+  unsigned char keyName2[kKeyNameLength];
+  unsigned char iv[AES_BLOCK_SIZE];
+  TicketContexts enc1;
+  TicketContexts enc2;
+  EXPECT_EQ(1, enc1.process(manager, keyName1, iv, 1));
+  EXPECT_EQ(1, enc2.process(manager, keyName2, iv, 1));
+  EXPECT_NE(0, memcmp(keyName1, keyName2, kKeyNameLength));
+}
+
+TEST(TLSTicketKeyManagerTest, RotatedKeysStillDecrypt) {
+  SSLContext ctx;
+  TLSTicketKeyManager manager(&ctx, nullptr);
+  ASSERT_TRUE(manager.setTLSTicketKeySeeds({}, kSeeds, {}));
+
+  unsigned char keyName1[kKeyNameLength];
+  unsigned char iv1[AES_BLOCK_SIZE];
+  TicketContexts enc1;
+  EXPECT_EQ(1, enc1.process(manager, keyName1, iv1, 1));
+  auto ticket1 = enc1.crypt("session one");
+
+  // The current seed made old, new tickets use the next one
+  ASSERT_TRUE(manager.setTLSTicketKeySeeds(kSeeds, kNextSeeds, {}));
+  TicketContexts dec1;
+  EXPECT_EQ(1, dec1.process(manager, keyName1, iv1, 0));
+  EXPECT_EQ("session one", dec1.crypt(ticket1));
+
+  unsigned char keyName2[kKeyNameLength];
+  unsigned char iv2[AES_BLOCK_SIZE];
+  TicketContexts enc2;
+  EXPECT_EQ(1, enc2.process(manager, keyName2, iv2, 1));
+  // The name, ahead of the salt
+  EXPECT_NE(0, memcmp(keyName1, keyName2, 4));
+
+  // Without a current seed, no keys at all
+  EXPECT_FALSE(manager.setTLSTicketKeySeeds(kSeeds, {}, kNextSeeds));
+  TicketContexts enc3;
+  TicketContexts dec2;
+  EXPECT_EQ(-1, enc3.process(manager, keyName2, iv2, 1));
+  EXPECT_EQ(0, dec2.process(manager, keyName1, iv1, 0));
+}
+
+// Each ticket is encrypted and decrypted by whole sets, during rotations
+TEST(TLSTicketKeyManagerTest, ConcurrentRotation) {
+  SSLContext ctx;
+  TLSTicketKeyManager manager(&ctx, nullptr);
+  ASSERT_TRUE(manager.setTLSTicketKeySeeds({}, kSeeds, kNextSeeds));
+  manager.setSaltRotationInterval(std::chrono::seconds(3600));
+
+  std::atomic<bool> stop{false};
+  std::atomic<int> failures{0};
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([&] {
+      while (!stop) {
+        unsigned char keyName[kKeyNameLength];
+        unsigned char iv[AES_BLOCK_SIZE];
+        TicketContexts enc;
+        TicketContexts dec;
+        if (enc.process(manager, keyName, iv, 1) != 1) {
+          failures++;
+          continue;
+        }
+        auto ticket = enc.crypt("session");
+        auto mac = enc.mac(ticket);
+        // Both seeds are in every set published
+        if (dec.process(manager, keyName, iv, 0) != 1 ||
+            dec.mac(ticket) != mac || dec.crypt(ticket) != "session") {
+          failures++;
+        }
+      }
+    });
+  }
+  for (int i = 0; i < 1000; i++) {
+    if (i % 2) {
+      EXPECT_TRUE(manager.setTLSTicketKeySeeds({}, kSeeds, kNextSeeds));
+    } else {
+      EXPECT_TRUE(manager.setTLSTicketKeySeeds(kSeeds, kNextSeeds, {}));
+    }
+  }
+  stop = true;
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(0, failures);
+}
+#endif
+
+} // namespace wangle